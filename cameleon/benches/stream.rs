@@ -0,0 +1,47 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! Benchmarks of the host side streaming path against the emulated U3V camera.
+//!
+//! Each iteration receives a payload and sends it back to the pool, so the result covers leader
+//! and trailer parsing, payload building and delivery of a frame. Frames are generated as fast as
+//! possible, thus the image generation by the emulator is included as well.
+
+use cameleon::u3v::emulator::{self, EmulatorConfig};
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+
+const RESOLUTIONS: [(u32, u32); 3] = [(640, 480), (1920, 1080), (3840, 2160)];
+
+fn bench_stream(c: &mut Criterion) {
+    let mut group = c.benchmark_group("emulated_stream");
+    for &(width, height) in &RESOLUTIONS {
+        let mut camera = emulator::camera(EmulatorConfig {
+            width,
+            height,
+            frame_rate: 0.0,
+            ..EmulatorConfig::default()
+        });
+        camera.open().unwrap();
+        camera.load_context().unwrap();
+        let payload_rx = camera.start_streaming(4).unwrap();
+
+        group.throughput(Throughput::Bytes(u64::from(width * height)));
+        group.bench_function(
+            BenchmarkId::from_parameter(format!("{}x{}", width, height)),
+            |b| {
+                b.iter(|| {
+                    let payload = payload_rx.recv_blocking().unwrap();
+                    black_box(payload.image());
+                    payload_rx.send_back(payload);
+                });
+            },
+        );
+
+        camera.close().unwrap();
+    }
+    group.finish();
+}
+
+criterion_group!(benches, bench_stream);
+criterion_main!(benches);
@@ -58,11 +58,11 @@
 //! ```
 
 use auto_impl::auto_impl;
-use tracing::info;
+use tracing::{info, warn};
 
 use super::{
-    genapi::{DefaultGenApiCtxt, FromXml, GenApiCtxt, ParamsCtxt},
-    payload::{channel, PayloadReceiver, PayloadSender},
+    genapi::{cache::XmlCache, DefaultGenApiCtxt, FromXml, GenApiCtxt, ParamsCtxt},
+    payload::{channel_with_policy, BackpressurePolicy, PayloadReceiver, PayloadSender},
     CameleonError, CameleonResult, ControlResult, StreamError, StreamResult,
 };
 
@@ -249,6 +249,79 @@ impl<Ctrl, Strm, Ctxt> Camera<Ctrl, Strm, Ctxt> {
         Ok(xml)
     }
 
+    /// Loads `GenApi` context like [`Self::load_context`], but uses `cache` to avoid retrieving
+    /// and parsing the xml.
+    ///
+    /// The cache is keyed by SHA1 hash of the xml file provided by the device. If the device
+    /// doesn't provide the hash, the xml is always retrieved from the device and not cached.
+    /// If the context is cached as well as the xml, and the context supports
+    /// [`FromXml::from_compiled`], the context is restored without parsing the xml.
+    /// Failure to store the xml or the context into the cache is logged and ignored.
+    ///
+    /// # Examples
+    /// ```rust
+    /// # use cameleon::u3v;
+    /// # let mut cameras = u3v::enumerate_cameras().unwrap();
+    /// # if cameras.is_empty() {
+    /// #     return;
+    /// # }
+    /// # let mut camera = cameras.pop().unwrap();
+    /// use cameleon::genapi::cache::XmlCache;
+    ///
+    /// camera.open().unwrap();
+    ///
+    /// let cache = XmlCache::in_user_cache_dir().unwrap();
+    /// // Retrieves and parses the xml only for the first time.
+    /// camera.load_context_with_cache(&cache).unwrap();
+    ///
+    /// camera.close().unwrap();
+    /// ```
+    pub fn load_context_with_cache(&mut self, cache: &XmlCache) -> CameleonResult<String>
+    where
+        Ctrl: DeviceControl,
+        Strm: PayloadStream,
+        Ctxt: GenApiCtxt + FromXml,
+    {
+        let hash = match self.ctrl.genapi_sha1_hash()? {
+            Some(hash) => hash,
+            None => return self.load_context(),
+        };
+
+        let cached_xml = cache.load(&hash);
+        if let Some(xml) = &cached_xml {
+            if let Some(ctxt) = cache
+                .load_compiled(&hash)
+                .and_then(|data| Ctxt::from_compiled(&data))
+            {
+                info!("load GenApi context from cache");
+                self.ctxt = Some(ctxt);
+                return Ok(xml.clone());
+            }
+        }
+
+        let xml = match cached_xml {
+            Some(xml) => {
+                info!("load GenApi xml from cache");
+                xml
+            }
+            None => {
+                let xml = self.ctrl.genapi()?;
+                if let Err(err) = cache.store(&hash, &xml) {
+                    warn!(?err, "failed to store GenApi xml into cache");
+                }
+                xml
+            }
+        };
+        let ctxt = Ctxt::from_xml(&xml)?;
+        if let Some(data) = ctxt.to_compiled() {
+            if let Err(err) = cache.store_compiled(&hash, &data) {
+                warn!(?err, "failed to store GenApi context into cache");
+            }
+        }
+        self.ctxt = Some(ctxt);
+        Ok(xml)
+    }
+
     /// Starts streaming and returns the receiver for the `Payload`.
     ///
     /// Make sure to load `GenApi` context before calling this method.
@@ -282,15 +355,57 @@ impl<Ctrl, Strm, Ctxt> Camera<Ctrl, Strm, Ctxt> {
     ///
     /// # Arguments
     /// * `cap` - A capacity of the paylaod receiver, the sender will stop to send a payload when it
-    /// gets full.
+    ///   gets full.
     ///
     ///
     /// # Panics
     /// If `cap` is zero, this method will panic.
+    pub fn start_streaming(&mut self, cap: usize) -> CameleonResult<PayloadReceiver>
+    where
+        Ctrl: DeviceControl,
+        Strm: PayloadStream,
+        Ctxt: GenApiCtxt,
+    {
+        self.start_streaming_with_policy(cap, BackpressurePolicy::default())
+    }
+
+    /// Starts streaming like [`Self::start_streaming`], but with `policy` applied when the
+    /// payload receiver is full.
+    ///
+    /// The numbers of payloads dropped by the policy are available from
+    /// [`PayloadReceiver::dropped_frames`].
+    ///
+    /// # Examples
+    /// ```
+    /// # use cameleon::u3v;
+    /// # let mut cameras = u3v::enumerate_cameras().unwrap();
+    /// # if cameras.is_empty() {
+    /// #     return;
+    /// # }
+    /// # let mut camera = cameras.pop().unwrap();
+    /// use cameleon::payload::BackpressurePolicy;
+    ///
+    /// camera.open().unwrap();
+    /// camera.load_context().unwrap();
+    ///
+    /// // Always deliver the latest frame for live preview.
+    /// let payload_rx = camera
+    ///     .start_streaming_with_policy(1, BackpressurePolicy::DropOldest)
+    ///     .unwrap();
+    ///
+    /// camera.close().unwrap();
+    /// ```
+    ///
+    /// # Panics
+    /// If `cap` is zero, this method will panic.
     #[tracing::instrument(skip(self),
                           level = "info",
                           fields(camera = ?self.info()))]
-    pub fn start_streaming(&mut self, cap: usize) -> CameleonResult<PayloadReceiver>
+    pub fn start_streaming_with_policy(
+        &mut self,
+        cap: usize,
+        policy: BackpressurePolicy,
+    ) -> CameleonResult<PayloadReceiver>
     where
         Ctrl: DeviceControl,
         Strm: PayloadStream,
@@ -310,7 +425,7 @@ impl<Ctrl, Strm, Ctxt> Camera<Ctrl, Strm, Ctxt> {
         expect_node!(&ctxt, "AcquisitionStart", as_command).execute(&mut ctxt)?;
 
         // Start streaming loop.
-        let (sender, receiver) = channel(cap, DEFAULT_BUFFER_CAP);
+        let (sender, receiver) = channel_with_policy(cap, DEFAULT_BUFFER_CAP, policy);
         self.strm.start_streaming_loop(sender, &mut self.ctrl)?;
 
         info!("start streaming successfully");
@@ -549,9 +664,47 @@ pub trait DeviceControl {
     /// Writes data to the device's memory.
     fn write(&mut self, address: u64, data: &[u8]) -> ControlResult<()>;
 
+    /// Reads data from multiple regions of the device's memory. Each entry is a pair of an
+    /// address and a buffer, and reads length is same as the buffer length.
+    ///
+    /// The default implementation calls [`DeviceControl::read`] for each entry.
+    fn read_stacked(&mut self, entries: &mut [(u64, &mut [u8])]) -> ControlResult<()> {
+        for (address, buf) in entries {
+            self.read(*address, buf)?;
+        }
+        Ok(())
+    }
+
+    /// Writes data to multiple regions of the device's memory. Each entry is a pair of an address
+    /// and data.
+    ///
+    /// The default implementation calls [`DeviceControl::write`] for each entry.
+    fn write_stacked(&mut self, entries: &[(u64, &[u8])]) -> ControlResult<()> {
+        for (address, data) in entries {
+            self.write(*address, data)?;
+        }
+        Ok(())
+    }
+
     /// Returns `GenICam` xml string.
     fn genapi(&mut self) -> ControlResult<String>;
 
+    /// Returns SHA1 hash of the `GenICam` xml file stored in the device, which identifies the xml
+    /// without reading it.
+    ///
+    /// Returns `None` if the device doesn't provide the hash.
+    fn genapi_sha1_hash(&mut self) -> ControlResult<Option<[u8; 20]>> {
+        Ok(None)
+    }
+
+    /// Returns the chunk data with `chunk_id` attached to the handle, which `GenApi` nodes of
+    /// chunk ports are read from.
+    ///
+    /// The default implementation returns `None`. See [`ChunkCtrl`](crate::genapi::ChunkCtrl).
+    fn chunk_data(&self, _chunk_id: u64) -> Option<&[u8]> {
+        None
+    }
+
     /// Enables streaming.
     fn enable_streaming(&mut self) -> ControlResult<()>;
 
@@ -0,0 +1,307 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! This module contains correlation between the device clock and the host monotonic clock.
+//!
+//! [`ClockCorrelation`] samples the device timestamp through `TimestampLatch` and fits a linear
+//! drift model to the samples, which converts [`Payload::timestamp`] to the host time
+//! regardless of the device vendor.
+//!
+//! # Examples
+//! ```no_run
+//! use cameleon::{clock::ClockCorrelation, u3v};
+//!
+//! let mut cameras = u3v::enumerate_cameras().unwrap();
+//! let mut camera = cameras.pop().unwrap();
+//! camera.open().unwrap();
+//! camera.load_context().unwrap();
+//!
+//! let mut clock = ClockCorrelation::default();
+//! let payload_rx = camera.start_streaming(3).unwrap();
+//! loop {
+//!     // Sample the device clock periodically to follow its drift.
+//!     if clock.needs_sample(std::time::Duration::from_secs(1)) {
+//!         clock.sample(&mut camera.params_ctxt().unwrap()).unwrap();
+//!     }
+//!
+//!     let payload = payload_rx.recv_blocking().unwrap();
+//!     let exposure = payload.host_exposure_time(&clock).unwrap();
+//!     let received = payload.host_timestamp().unwrap().trailer;
+//!     println!("latency: {:?}", received.saturating_duration_since(exposure));
+//!     payload_rx.send_back(payload);
+//! }
+//! ```
+//!
+//! [`Payload::timestamp`]: crate::payload::Payload::timestamp
+
+use std::{
+    collections::VecDeque,
+    convert::TryInto,
+    time::{Duration, Instant},
+};
+
+use super::{
+    genapi::{GenApiCtxt, ParamsCtxt},
+    CameleonError, CameleonResult, DeviceControl,
+};
+
+/// Default number of samples used to fit the drift model.
+const DEFAULT_WINDOW: usize = 16;
+
+/// One correspondence between the device clock and the host clock.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct ClockSample {
+    /// Host time estimated to correspond to `device`.
+    pub host: Instant,
+    /// Device timestamp in nanoseconds.
+    pub device: Duration,
+    /// Half of the round trip of the latch, which bounds the error of `host`.
+    pub uncertainty: Duration,
+}
+
+/// Linear model from the device clock to the host clock fitted to [`ClockSample`]s.
+///
+/// The device clock may run slightly faster or slower than the host clock, so the offset between
+/// them drifts. The model is refitted by least squares every time a sample is added.
+#[derive(Debug, Clone)]
+pub struct ClockCorrelation {
+    /// Origin of the host time used during fitting.
+    anchor: Instant,
+    samples: VecDeque<ClockSample>,
+    window: usize,
+    model: Option<DriftModel>,
+}
+
+#[derive(Debug, Clone, Copy)]
+struct DriftModel {
+    /// Mean of host times in nanoseconds since `anchor`.
+    host_mean: f64,
+    /// Mean of device times in nanoseconds.
+    device_mean: f64,
+    /// Device nanoseconds elapsed per host nanosecond.
+    rate: f64,
+}
+
+impl ClockCorrelation {
+    /// Creates a correlation which fits the model to the latest `window` samples.
+    ///
+    /// # Panics
+    /// If `window` is zero, this method will panic.
+    #[must_use]
+    pub fn new(window: usize) -> Self {
+        assert!(window > 0);
+        Self {
+            anchor: Instant::now(),
+            samples: VecDeque::with_capacity(window),
+            window,
+            model: None,
+        }
+    }
+
+    /// Latches the device timestamp and adds the sample.
+    ///
+    /// `TimestampLatch` and `TimestampLatchValue` defined in SFNC are used. If they are missing,
+    /// `GevTimestampControlLatch` and `GevTimestampValue` are used instead, and the value is
+    /// converted to nanoseconds with `GevTimestampTickFrequency`.
+    pub fn sample<Ctrl, Ctxt>(
+        &mut self,
+        ctxt: &mut ParamsCtxt<Ctrl, Ctxt>,
+    ) -> CameleonResult<ClockSample>
+    where
+        Ctrl: DeviceControl,
+        Ctxt: GenApiCtxt,
+    {
+        let (latch, value, tick_frequency) = match (
+            ctxt.node("TimestampLatch"),
+            ctxt.node("TimestampLatchValue"),
+        ) {
+            (Some(latch), Some(value)) => (latch, value, None),
+            _ => (
+                ctxt.node("GevTimestampControlLatch").ok_or_else(|| {
+                    CameleonError::InvalidGenApiXml("missing TimestampLatch".into())
+                })?,
+                ctxt.node("GevTimestampValue").ok_or_else(|| {
+                    CameleonError::InvalidGenApiXml("missing TimestampLatchValue".into())
+                })?,
+                ctxt.node("GevTimestampTickFrequency"),
+            ),
+        };
+        let latch = latch
+            .as_command(ctxt)
+            .ok_or_else(|| CameleonError::InvalidGenApiXml("invalid TimestampLatch".into()))?;
+        let value = value
+            .as_integer(ctxt)
+            .ok_or_else(|| CameleonError::InvalidGenApiXml("invalid TimestampLatchValue".into()))?;
+        let tick_frequency = match tick_frequency.and_then(|node| node.as_integer(ctxt)) {
+            Some(node) => Some(node.value(ctxt)?),
+            None => None,
+        };
+
+        let before = Instant::now();
+        latch.execute(ctxt)?;
+        let after = Instant::now();
+        let ticks = value.value(ctxt)?;
+
+        let ticks: u64 = ticks.try_into().map_err(|_| {
+            CameleonError::InvalidGenApiXml("TimestampLatchValue is negative".into())
+        })?;
+        let device = match tick_frequency {
+            Some(freq) if freq > 0 && freq != 1_000_000_000 => {
+                Duration::from_nanos((u128::from(ticks) * 1_000_000_000 / freq as u128) as u64)
+            }
+            _ => Duration::from_nanos(ticks),
+        };
+        let uncertainty = (after - before) / 2;
+        let sample = ClockSample {
+            host: before + uncertainty,
+            device,
+            uncertainty,
+        };
+        self.add_sample(sample);
+        Ok(sample)
+    }
+
+    /// Adds `sample` and refits the model. The oldest sample is discarded if the window is full.
+    pub fn add_sample(&mut self, sample: ClockSample) {
+        if self.samples.len() == self.window {
+            self.samples.pop_front();
+        }
+        self.samples.push_back(sample);
+        self.model = Some(self.fit());
+    }
+
+    /// Returns `true` if no sample has been taken within `interval`.
+    #[must_use]
+    pub fn needs_sample(&self, interval: Duration) -> bool {
+        match self.samples.back() {
+            Some(last) => last.host.elapsed() >= interval,
+            None => true,
+        }
+    }
+
+    /// Drops all samples, e.g. when the device clock is reset.
+    pub fn reset(&mut self) {
+        self.samples.clear();
+        self.model = None;
+    }
+
+    /// Returns the samples the model is fitted to, from oldest to newest.
+    pub fn samples(&self) -> impl Iterator<Item = &ClockSample> {
+        self.samples.iter()
+    }
+
+    /// Returns the drift of the device clock relative to the host clock in parts per million.
+    ///
+    /// A positive value means the device clock runs faster. Returns `None` if less than two
+    /// samples are taken.
+    #[must_use]
+    pub fn drift_ppm(&self) -> Option<f64> {
+        if self.samples.len() < 2 {
+            return None;
+        }
+        self.model.map(|model| (model.rate - 1.0) * 1e6)
+    }
+
+    /// Converts a device timestamp to the host time.
+    ///
+    /// Returns `None` if no sample is taken yet, or if the host time is before the anchor of the
+    /// correlation.
+    #[must_use]
+    pub fn host_time(&self, device: Duration) -> Option<Instant> {
+        let model = self.model?;
+        let device = device.as_nanos() as f64;
+        let host = model.host_mean + (device - model.device_mean) / model.rate;
+        if host < 0.0 {
+            return None;
+        }
+        Some(self.anchor + Duration::from_nanos(host as u64))
+    }
+
+    fn fit(&self) -> DriftModel {
+        let n = self.samples.len() as f64;
+        let point = |sample: &ClockSample| {
+            (
+                sample
+                    .host
+                    .saturating_duration_since(self.anchor)
+                    .as_nanos() as f64,
+                sample.device.as_nanos() as f64,
+            )
+        };
+        let (host_sum, device_sum) = self
+            .samples
+            .iter()
+            .map(point)
+            .fold((0.0, 0.0), |(h, d), (x, y)| (h + x, d + y));
+        let (host_mean, device_mean) = (host_sum / n, device_sum / n);
+
+        // Values are centered so that large timestamps don't lose precision.
+        let (cov, var) = self
+            .samples
+            .iter()
+            .map(point)
+            .fold((0.0, 0.0), |(cov, var), (x, y)| {
+                let dx = x - host_mean;
+                (cov + dx * (y - device_mean), var + dx * dx)
+            });
+        // Assume no drift until the samples span enough time.
+        let rate = if var > 0.0 && cov > 0.0 {
+            cov / var
+        } else {
+            1.0
+        };
+
+        DriftModel {
+            host_mean,
+            device_mean,
+            rate,
+        }
+    }
+}
+
+impl Default for ClockCorrelation {
+    fn default() -> Self {
+        Self::new(DEFAULT_WINDOW)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sample(clock: &ClockCorrelation, host_ms: u64, device_ns: u64) -> ClockSample {
+        ClockSample {
+            host: clock.anchor + Duration::from_millis(host_ms),
+            device: Duration::from_nanos(device_ns),
+            uncertainty: Duration::default(),
+        }
+    }
+
+    #[test]
+    fn test_clock_correlation() {
+        let mut clock = ClockCorrelation::new(4);
+        assert!(clock.host_time(Duration::from_secs(1)).is_none());
+
+        // The device clock started 5s before the anchor and runs 100ppm faster.
+        let device_ns = |host_ms: u64| 5_000_000_000 + host_ms * 1_000_100;
+        clock.add_sample(sample(&clock, 1000, device_ns(1000)));
+        assert!(clock.drift_ppm().is_none());
+        for host_ms in [2000, 3000, 4000, 5000] {
+            clock.add_sample(sample(&clock, host_ms, device_ns(host_ms)));
+        }
+        assert_eq!(clock.samples().count(), 4);
+        assert!((clock.drift_ppm().unwrap() - 100.0).abs() < 1e-3);
+
+        let host = clock
+            .host_time(Duration::from_nanos(device_ns(10_000)))
+            .unwrap();
+        let expected = clock.anchor + Duration::from_secs(10);
+        let error = if host > expected {
+            host - expected
+        } else {
+            expected - host
+        };
+        assert!(error < Duration::from_micros(1));
+    }
+}
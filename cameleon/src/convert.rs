@@ -0,0 +1,1258 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! This module contains conversion of images in a [`Payload`] to a format ready to be consumed.
+//!
+//! [`ImageConverter`] unpacks packed 10/12-bit formats to `Mono16`, debayers to `RGB8`/`RGB16`
+//! with bilinear interpolation and converts YUV 4:2:2 to `RGB8`. See
+//! [`ImageConverter::output_format`] for the supported formats.
+//!
+//! Rows of an image are split into bands converted on worker threads kept by the converter, and the
+//! converted images are written to buffers of a [`PayloadBufferPool`]. The inner loops of the
+//! kernels are branch free, with the edges of an image handled outside of them, so that they are
+//! vectorized. They are compiled for AVX2 and SSE4.1 in addition to the baseline, and the best one
+//! is selected at runtime on `x86_64`. NEON is the baseline of `aarch64`, so the kernels are
+//! vectorized for it without dispatch.
+//!
+//! # Examples
+//! ```no_run
+//! use cameleon::{convert::ImageConverter, u3v};
+//!
+//! let mut cameras = u3v::enumerate_cameras().unwrap();
+//! let mut camera = cameras.pop().unwrap();
+//! camera.open().unwrap();
+//! camera.load_context().unwrap();
+//!
+//! let payload_rx = camera.start_streaming(3).unwrap();
+//! let mut converter = ImageConverter::new();
+//! for _ in 0..10 {
+//!     // The payload is sent back to the stream as soon as it's converted.
+//!     let image = converter.recv_blocking(&payload_rx).unwrap();
+//!     println!("{:?} {}x{}", image.pixel_format(), image.width(), image.height());
+//! }
+//! ```
+
+use std::{
+    ops::Range,
+    panic::{self, AssertUnwindSafe},
+    sync::{mpsc, Arc, Condvar, Mutex},
+    thread::JoinHandle,
+};
+
+use tracing::warn;
+
+use super::{
+    payload::{HeapAllocator, Payload, PayloadBuffer, PayloadBufferPool, PayloadReceiver},
+    StreamError, StreamResult,
+};
+
+pub use super::payload::PixelFormat;
+
+/// Default number of pooled output buffers.
+const DEFAULT_POOL_CAPACITY: usize = 4;
+
+/// Images with fewer rows than this per thread are converted on the calling thread only.
+const MINIMUM_ROWS_PER_BAND: usize = 16;
+
+/// An image converted by [`ImageConverter`].
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct ConvertedImage {
+    width: usize,
+    height: usize,
+    pixel_format: PixelFormat,
+    buffer: PayloadBuffer,
+    len: usize,
+}
+
+impl ConvertedImage {
+    /// Width of the image.
+    #[must_use]
+    pub fn width(&self) -> usize {
+        self.width
+    }
+
+    /// Height of the image.
+    #[must_use]
+    pub fn height(&self) -> usize {
+        self.height
+    }
+
+    /// Pixel format of the image, either `Mono8`, `Mono16`, `RGB8` or `RGB16`.
+    #[must_use]
+    pub fn pixel_format(&self) -> PixelFormat {
+        self.pixel_format
+    }
+
+    /// Returns the image data. Samples of 16-bit formats are little endian.
+    #[must_use]
+    pub fn data(&self) -> &[u8] {
+        &self.buffer[..self.len]
+    }
+
+    /// Returns the buffer holding the image data. A pooled buffer is returned to the pool of the
+    /// converter when it's dropped.
+    #[must_use]
+    pub fn into_buffer(self) -> PayloadBuffer {
+        self.buffer
+    }
+}
+
+/// Converts images in payloads to `Mono8`, `Mono16`, `RGB8` or `RGB16`.
+///
+/// 16-bit outputs keep the bit depth of the source, e.g. values of `Mono12p` are in `0..4096`.
+#[derive(Debug)]
+pub struct ImageConverter {
+    threads: usize,
+    pool_capacity: usize,
+    pool: Option<PayloadBufferPool>,
+    /// Spawned on the first conversion split into bands.
+    workers: Option<WorkerPool>,
+    /// Unpacked samples of a Bayer image with more than 8 bits.
+    scratch: Vec<u16>,
+}
+
+impl ImageConverter {
+    /// Creates a converter using all available cores.
+    #[must_use]
+    pub fn new() -> Self {
+        let threads = std::thread::available_parallelism().map_or(1, |n| n.get());
+        Self {
+            threads,
+            pool_capacity: DEFAULT_POOL_CAPACITY,
+            pool: None,
+            workers: None,
+            scratch: Vec::new(),
+        }
+    }
+
+    /// Sets the number of threads used for a conversion. `1` converts on the calling thread only.
+    #[must_use]
+    pub fn with_threads(mut self, threads: usize) -> Self {
+        self.threads = threads.max(1);
+        self.workers = None;
+        self
+    }
+
+    /// Sets the number of pooled output buffers. When all of them are in use, the output is
+    /// allocated on the heap instead.
+    #[must_use]
+    pub fn with_pool_capacity(mut self, capacity: usize) -> Self {
+        self.pool_capacity = capacity;
+        self.pool = None;
+        self
+    }
+
+    /// Returns the format `pixel_format` is converted to, or `None` if it's not supported.
+    #[must_use]
+    pub fn output_format(pixel_format: PixelFormat) -> Option<PixelFormat> {
+        Some(Source::new(pixel_format)?.output_format())
+    }
+
+    /// Receives a payload from `receiver`, converts its image and sends the payload back.
+    pub fn recv_blocking(&mut self, receiver: &PayloadReceiver) -> StreamResult<ConvertedImage> {
+        let payload = receiver.recv_blocking()?;
+        let image = self.convert(&payload);
+        receiver.send_back(payload);
+        image
+    }
+
+    /// Converts the image in `payload`.
+    pub fn convert(&mut self, payload: &Payload) -> StreamResult<ConvertedImage> {
+        let (info, image) = match (payload.image_info(), payload.image()) {
+            (Some(info), Some(image)) => (info, image),
+            _ => {
+                return Err(StreamError::InvalidPayload(
+                    "payload doesn't contain an image".into(),
+                ))
+            }
+        };
+        self.convert_raw(image, info.width, info.height, info.pixel_format)
+    }
+
+    /// Converts `image` of `width` x `height` pixels in `pixel_format`.
+    pub fn convert_raw(
+        &mut self,
+        image: &[u8],
+        width: usize,
+        height: usize,
+        pixel_format: PixelFormat,
+    ) -> StreamResult<ConvertedImage> {
+        let source = Source::new(pixel_format).ok_or_else(|| {
+            StreamError::InvalidPayload(
+                format!("conversion of {:?} is not supported", pixel_format).into(),
+            )
+        })?;
+        source.validate(image, width, height)?;
+
+        let output_format = source.output_format();
+        let len = width * height * output_bytes_per_pixel(output_format);
+        let mut buffer = self.output_buffer(len);
+        let dst = &mut buffer[..len];
+
+        match source.layout {
+            Layout::Mono | Layout::Rgb => match source.packing {
+                Packing::U8 | Packing::U16 => dst.copy_from_slice(&image[..len]),
+                packing => self.run(
+                    Kernel::Unpack {
+                        packing,
+                        src: image,
+                    },
+                    width,
+                    height,
+                    Dst::Bytes(dst),
+                ),
+            },
+            Layout::Bgr => self.run(Kernel::Bgr8 { src: image }, width, height, Dst::Bytes(dst)),
+            Layout::Yuv422 { y_first } => self.run(
+                Kernel::Yuv422 {
+                    src: image,
+                    y_first,
+                },
+                width,
+                height,
+                Dst::Bytes(dst),
+            ),
+            Layout::Bayer(cfa) if source.packing == Packing::U8 => self.run(
+                Kernel::Debayer8 {
+                    src: image,
+                    width,
+                    height,
+                    cfa,
+                },
+                width,
+                height,
+                Dst::Bytes(dst),
+            ),
+            Layout::Bayer(cfa) => {
+                let mut scratch = std::mem::take(&mut self.scratch);
+                scratch.resize(width * height, 0);
+                self.run(
+                    Kernel::Unpack {
+                        packing: source.packing,
+                        src: image,
+                    },
+                    width,
+                    height,
+                    Dst::Samples(&mut scratch),
+                );
+                self.run(
+                    Kernel::Debayer16 {
+                        src: &scratch,
+                        width,
+                        height,
+                        cfa,
+                    },
+                    width,
+                    height,
+                    Dst::Bytes(dst),
+                );
+                self.scratch = scratch;
+            }
+        }
+
+        Ok(ConvertedImage {
+            width,
+            height,
+            pixel_format: output_format,
+            buffer,
+            len,
+        })
+    }
+
+    fn output_buffer(&mut self, len: usize) -> PayloadBuffer {
+        if len == 0 || self.pool_capacity == 0 {
+            return vec![0; len].into();
+        }
+
+        if !matches!(&self.pool, Some(pool) if pool.buffer_size() == len) {
+            self.pool = PayloadBufferPool::new(HeapAllocator, len, self.pool_capacity);
+        }
+        self.pool
+            .as_ref()
+            .and_then(PayloadBufferPool::acquire)
+            .unwrap_or_else(|| vec![0; len].into())
+    }
+
+    /// Runs `kernel` on bands of rows in parallel.
+    fn run(&mut self, kernel: Kernel<'_>, width: usize, height: usize, dst: Dst<'_>) {
+        if height == 0 || width == 0 {
+            return;
+        }
+
+        // Bands start at a multiple of 4 rows so that packed samples of a band start at a byte
+        // boundary.
+        let threads = self.threads;
+        // `height` isn't 0, so this rounds up the rows divided by the threads.
+        let rows_per_band = std::cmp::max((height - 1) / threads + 1, MINIMUM_ROWS_PER_BAND);
+        let rows_per_band = (rows_per_band + 3) & !3;
+
+        if rows_per_band >= height {
+            return dispatch(kernel, 0..height, dst);
+        }
+        // The calling thread converts the first band.
+        let workers = self
+            .workers
+            .get_or_insert_with(|| WorkerPool::new(threads - 1));
+        match dst {
+            Dst::Bytes(dst) => for_each_band(workers, dst, height, rows_per_band, |rows, band| {
+                dispatch(kernel, rows, Dst::Bytes(band))
+            }),
+            Dst::Samples(dst) => {
+                for_each_band(workers, dst, height, rows_per_band, |rows, band| {
+                    dispatch(kernel, rows, Dst::Samples(band))
+                })
+            }
+        }
+    }
+}
+
+impl Default for ImageConverter {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+fn for_each_band<T: Send>(
+    workers: &WorkerPool,
+    dst: &mut [T],
+    height: usize,
+    rows_per_band: usize,
+    f: impl Fn(Range<usize>, &mut [T]) + Sync,
+) {
+    let row_len = dst.len() / height;
+
+    let f = &f;
+    let mut bands = dst.chunks_mut(rows_per_band * row_len).enumerate();
+    let (_, first) = bands.next().unwrap();
+    let jobs = bands
+        .map(|(i, band)| {
+            let start = i * rows_per_band;
+            let end = std::cmp::min(start + rows_per_band, height);
+            Box::new(move || f(start..end, band)) as Box<dyn FnOnce() + Send + '_>
+        })
+        .collect();
+    workers.scope(jobs, || f(0..rows_per_band, first));
+}
+
+/// Job run on a worker of [`WorkerPool`].
+type Job = Box<dyn FnOnce() + Send + 'static>;
+
+/// Threads converting bands of images, which are kept alive between conversions.
+///
+/// The threads stop when the pool is dropped.
+struct WorkerPool {
+    job_tx: Option<mpsc::Sender<Job>>,
+    join_handles: Vec<JoinHandle<()>>,
+}
+
+impl WorkerPool {
+    fn new(workers: usize) -> Self {
+        let (job_tx, job_rx) = mpsc::channel::<Job>();
+        let job_rx = Arc::new(Mutex::new(job_rx));
+        let join_handles = (0..workers)
+            .map(|_| {
+                let job_rx = job_rx.clone();
+                std::thread::spawn(move || loop {
+                    // The guard is dropped before the job runs, so that the other workers can
+                    // receive jobs meanwhile.
+                    let job = job_rx.lock().unwrap().recv();
+                    match job {
+                        Ok(job) => job(),
+                        Err(_) => break,
+                    }
+                })
+            })
+            .collect();
+
+        Self {
+            job_tx: Some(job_tx),
+            join_handles,
+        }
+    }
+
+    /// Runs `jobs` on the workers and `local` on the calling thread, and returns when all of them
+    /// have finished. A panic of a job is propagated to the caller.
+    fn scope<'a>(&self, jobs: Vec<Box<dyn FnOnce() + Send + 'a>>, local: impl FnOnce()) {
+        let latch = Arc::new(Latch::new(jobs.len()));
+        // Waits for the jobs even if `local` panics, because they borrow from the caller.
+        let _guard = WaitGuard(&latch);
+
+        for job in jobs {
+            let latch = latch.clone();
+            let job: Box<dyn FnOnce() + Send + 'a> = Box::new(move || {
+                let result = panic::catch_unwind(AssertUnwindSafe(job));
+                latch.count_down(result.is_err());
+            });
+            // Safety: `_guard` doesn't return before the job has run, so the borrows of the job
+            // outlive it.
+            let job: Job = unsafe { std::mem::transmute(job) };
+            // Workers are alive as long as the sender is.
+            self.job_tx.as_ref().unwrap().send(job).unwrap();
+        }
+
+        local();
+        if latch.wait() {
+            panic!("conversion of a band panicked");
+        }
+    }
+}
+
+impl Drop for WorkerPool {
+    fn drop(&mut self) {
+        // Dropping the sender stops the workers once they are idle.
+        self.job_tx.take();
+        for join_handle in self.join_handles.drain(..) {
+            if join_handle.join().is_err() {
+                warn!("image conversion worker panicked");
+            }
+        }
+    }
+}
+
+impl std::fmt::Debug for WorkerPool {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("WorkerPool")
+            .field("workers", &self.join_handles.len())
+            .finish()
+    }
+}
+
+/// Counts down the jobs of [`WorkerPool::scope`] which have not finished yet.
+struct Latch {
+    /// The number of remaining jobs and whether any of them panicked.
+    state: Mutex<(usize, bool)>,
+    done: Condvar,
+}
+
+impl Latch {
+    fn new(count: usize) -> Self {
+        Self {
+            state: Mutex::new((count, false)),
+            done: Condvar::new(),
+        }
+    }
+
+    fn count_down(&self, panicked: bool) {
+        let mut state = self.state.lock().unwrap();
+        state.0 -= 1;
+        state.1 |= panicked;
+        if state.0 == 0 {
+            self.done.notify_all();
+        }
+    }
+
+    /// Waits for all of the jobs and returns whether any of them panicked.
+    fn wait(&self) -> bool {
+        let mut state = self.state.lock().unwrap();
+        while state.0 > 0 {
+            state = self.done.wait(state).unwrap();
+        }
+        state.1
+    }
+}
+
+struct WaitGuard<'a>(&'a Latch);
+
+impl Drop for WaitGuard<'_> {
+    fn drop(&mut self) {
+        self.0.wait();
+    }
+}
+
+/// Encoding of samples in the source image.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+enum Packing {
+    U8,
+    /// 16-bit little endian.
+    U16,
+    /// PFNC 10-bit packed, 4 samples in 5 bytes from LSB.
+    P10,
+    /// PFNC 12-bit packed, 2 samples in 3 bytes from LSB.
+    P12,
+    /// GigE Vision 10-bit packed, 2 samples in 3 bytes with 2 bit remainders in the middle.
+    Packed10,
+    /// GigE Vision 12-bit packed, 2 samples in 3 bytes with 4 bit remainders in the middle.
+    Packed12,
+}
+
+impl Packing {
+    fn bits(self) -> usize {
+        match self {
+            Self::U8 => 8,
+            Self::U16 => 16,
+            Self::P10 => 10,
+            Self::P12 | Self::Packed10 | Self::Packed12 => 12,
+        }
+    }
+}
+
+/// Position of the red sample in the 2x2 cell of a Bayer pattern.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+struct Cfa {
+    red_x: usize,
+    red_y: usize,
+}
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+enum Layout {
+    Mono,
+    Rgb,
+    Bgr,
+    Bayer(Cfa),
+    /// 2 pixels in 4 bytes, `Y0 U Y1 V` if `y_first`, otherwise `U Y0 V Y1`.
+    Yuv422 {
+        y_first: bool,
+    },
+}
+
+#[derive(Clone, Copy, Debug)]
+struct Source {
+    packing: Packing,
+    layout: Layout,
+}
+
+impl Source {
+    fn new(pixel_format: PixelFormat) -> Option<Self> {
+        use PixelFormat::*;
+
+        const RG: Cfa = Cfa { red_x: 0, red_y: 0 };
+        const GR: Cfa = Cfa { red_x: 1, red_y: 0 };
+        const GB: Cfa = Cfa { red_x: 0, red_y: 1 };
+        const BG: Cfa = Cfa { red_x: 1, red_y: 1 };
+
+        let (packing, layout) = match pixel_format {
+            Mono8 => (Packing::U8, Layout::Mono),
+            Mono10 | Mono12 | Mono14 | Mono16 => (Packing::U16, Layout::Mono),
+            Mono10p => (Packing::P10, Layout::Mono),
+            Mono12p => (Packing::P12, Layout::Mono),
+            Mono10Packed => (Packing::Packed10, Layout::Mono),
+            Mono12Packed => (Packing::Packed12, Layout::Mono),
+
+            RGB8 => (Packing::U8, Layout::Rgb),
+            RGB16 => (Packing::U16, Layout::Rgb),
+            BGR8 => (Packing::U8, Layout::Bgr),
+
+            YUV422_8 | YCbCr422_8 => (Packing::U8, Layout::Yuv422 { y_first: true }),
+            YCbCr422_8_CbYCrY => (Packing::U8, Layout::Yuv422 { y_first: false }),
+
+            BayerRG8 => (Packing::U8, Layout::Bayer(RG)),
+            BayerGR8 => (Packing::U8, Layout::Bayer(GR)),
+            BayerGB8 => (Packing::U8, Layout::Bayer(GB)),
+            BayerBG8 => (Packing::U8, Layout::Bayer(BG)),
+            BayerRG10 | BayerRG12 | BayerRG14 | BayerRG16 => (Packing::U16, Layout::Bayer(RG)),
+            BayerGR10 | BayerGR12 | BayerGR14 | BayerGR16 => (Packing::U16, Layout::Bayer(GR)),
+            BayerGB10 | BayerGB12 | BayerGB14 | BayerGB16 => (Packing::U16, Layout::Bayer(GB)),
+            BayerBG10 | BayerBG12 | BayerBG14 | BayerBG16 => (Packing::U16, Layout::Bayer(BG)),
+            BayerRG10p => (Packing::P10, Layout::Bayer(RG)),
+            BayerGR10p => (Packing::P10, Layout::Bayer(GR)),
+            BayerGB10p => (Packing::P10, Layout::Bayer(GB)),
+            BayerBG10p => (Packing::P10, Layout::Bayer(BG)),
+            BayerRG12p => (Packing::P12, Layout::Bayer(RG)),
+            BayerGR12p => (Packing::P12, Layout::Bayer(GR)),
+            BayerGB12p => (Packing::P12, Layout::Bayer(GB)),
+            BayerBG12p => (Packing::P12, Layout::Bayer(BG)),
+            BayerRG10Packed => (Packing::Packed10, Layout::Bayer(RG)),
+            BayerGR10Packed => (Packing::Packed10, Layout::Bayer(GR)),
+            BayerGB10Packed => (Packing::Packed10, Layout::Bayer(GB)),
+            BayerBG10Packed => (Packing::Packed10, Layout::Bayer(BG)),
+            BayerRG12Packed => (Packing::Packed12, Layout::Bayer(RG)),
+            BayerGR12Packed => (Packing::Packed12, Layout::Bayer(GR)),
+            BayerGB12Packed => (Packing::Packed12, Layout::Bayer(GB)),
+            BayerBG12Packed => (Packing::Packed12, Layout::Bayer(BG)),
+            _ => return None,
+        };
+        Some(Self { packing, layout })
+    }
+
+    fn output_format(self) -> PixelFormat {
+        let is_8bit = self.packing == Packing::U8;
+        match self.layout {
+            Layout::Mono if is_8bit => PixelFormat::Mono8,
+            Layout::Mono => PixelFormat::Mono16,
+            Layout::Rgb | Layout::Bayer(_) if !is_8bit => PixelFormat::RGB16,
+            Layout::Rgb | Layout::Bgr | Layout::Bayer(_) | Layout::Yuv422 { .. } => {
+                PixelFormat::RGB8
+            }
+        }
+    }
+
+    fn validate(self, image: &[u8], width: usize, height: usize) -> StreamResult<()> {
+        let invalid = |msg: String| Err(StreamError::InvalidPayload(msg.into()));
+
+        let samples = match self.layout {
+            Layout::Rgb | Layout::Bgr => width * height * 3,
+            Layout::Yuv422 { .. } => width * height * 2,
+            Layout::Mono | Layout::Bayer(_) => width * height,
+        };
+        let required = (samples * self.packing.bits() + 7) >> 3;
+        if image.len() < required {
+            return invalid(format!(
+                "image size is {}, but {}x{} image requires {} bytes",
+                image.len(),
+                width,
+                height,
+                required
+            ));
+        }
+        if matches!(self.layout, Layout::Bayer(_)) && (width < 2 || height < 2) {
+            return invalid("Bayer image must be at least 2x2".into());
+        }
+        if matches!(self.layout, Layout::Yuv422 { .. }) && width & 1 != 0 {
+            return invalid("width of YUV 4:2:2 image must be even".into());
+        }
+        Ok(())
+    }
+}
+
+fn output_bytes_per_pixel(pixel_format: PixelFormat) -> usize {
+    match pixel_format {
+        PixelFormat::Mono8 => 1,
+        PixelFormat::Mono16 => 2,
+        PixelFormat::RGB8 => 3,
+        _ => 6,
+    }
+}
+
+/// Operation applied to each band of rows.
+#[derive(Clone, Copy)]
+enum Kernel<'a> {
+    /// Unpacks samples to 16-bit.
+    Unpack {
+        packing: Packing,
+        src: &'a [u8],
+    },
+    Bgr8 {
+        src: &'a [u8],
+    },
+    Yuv422 {
+        src: &'a [u8],
+        y_first: bool,
+    },
+    Debayer8 {
+        src: &'a [u8],
+        width: usize,
+        height: usize,
+        cfa: Cfa,
+    },
+    Debayer16 {
+        src: &'a [u16],
+        width: usize,
+        height: usize,
+        cfa: Cfa,
+    },
+}
+
+/// Destination of a band.
+enum Dst<'a> {
+    Bytes(&'a mut [u8]),
+    Samples(&'a mut [u16]),
+}
+
+/// Runs `kernel` with the best instruction set available.
+fn dispatch(kernel: Kernel<'_>, rows: Range<usize>, dst: Dst<'_>) {
+    #[cfg(target_arch = "x86_64")]
+    {
+        if is_x86_feature_detected!("avx2") {
+            // Safety: AVX2 is available.
+            return unsafe { dispatch_avx2(kernel, rows, dst) };
+        }
+        if is_x86_feature_detected!("sse4.1") {
+            // Safety: SSE4.1 is available.
+            return unsafe { dispatch_sse41(kernel, rows, dst) };
+        }
+    }
+    run_kernel(kernel, rows, dst)
+}
+
+#[cfg(target_arch = "x86_64")]
+#[target_feature(enable = "avx2")]
+unsafe fn dispatch_avx2(kernel: Kernel<'_>, rows: Range<usize>, dst: Dst<'_>) {
+    run_kernel(kernel, rows, dst)
+}
+
+#[cfg(target_arch = "x86_64")]
+#[target_feature(enable = "sse4.1")]
+unsafe fn dispatch_sse41(kernel: Kernel<'_>, rows: Range<usize>, dst: Dst<'_>) {
+    run_kernel(kernel, rows, dst)
+}
+
+/// All kernels are inlined so that they are compiled with the instruction set of the caller.
+#[inline(always)]
+fn run_kernel(kernel: Kernel<'_>, rows: Range<usize>, dst: Dst<'_>) {
+    match (kernel, dst) {
+        (Kernel::Unpack { packing, src }, Dst::Bytes(dst)) => {
+            let start = rows.start * (dst.len() / 2 / rows.len());
+            unpack(packing, src, start, dst);
+        }
+        (Kernel::Unpack { packing, src }, Dst::Samples(dst)) => {
+            let start = rows.start * (dst.len() / rows.len());
+            unpack(packing, src, start, dst);
+        }
+        (Kernel::Bgr8 { src }, Dst::Bytes(dst)) => {
+            let src = &src[rows.start * (dst.len() / rows.len())..];
+            for (d, s) in dst.chunks_exact_mut(3).zip(src.chunks_exact(3)) {
+                d[0] = s[2];
+                d[1] = s[1];
+                d[2] = s[0];
+            }
+        }
+        (Kernel::Yuv422 { src, y_first }, Dst::Bytes(dst)) => {
+            // 6 bytes of output for each 4 bytes of input.
+            let src = &src[rows.start * (dst.len() / rows.len()) / 3 * 2..];
+            yuv422(src, y_first, dst);
+        }
+        (
+            Kernel::Debayer8 {
+                src,
+                width,
+                height,
+                cfa,
+            },
+            Dst::Bytes(dst),
+        ) => debayer(src, width, height, cfa, rows, dst),
+        (
+            Kernel::Debayer16 {
+                src,
+                width,
+                height,
+                cfa,
+            },
+            Dst::Bytes(dst),
+        ) => debayer(src, width, height, cfa, rows, dst),
+        _ => unreachable!(),
+    }
+}
+
+/// Destination of unpacked samples.
+trait Unpacked: Sized {
+    /// The number of elements of a sample.
+    const LEN: usize;
+
+    fn store(v: u16, dst: &mut [Self]);
+}
+
+/// Samples are stored as 16-bit little endian.
+impl Unpacked for u8 {
+    const LEN: usize = 2;
+
+    #[inline(always)]
+    fn store(v: u16, dst: &mut [Self]) {
+        dst[..2].copy_from_slice(&v.to_le_bytes());
+    }
+}
+
+impl Unpacked for u16 {
+    const LEN: usize = 1;
+
+    #[inline(always)]
+    fn store(v: u16, dst: &mut [Self]) {
+        dst[0] = v;
+    }
+}
+
+/// Unpacks samples to `dst` beginning at the `start`-th sample of `src`. `start` must be a
+/// multiple of 4.
+#[inline(always)]
+fn unpack<T: Unpacked>(packing: Packing, src: &[u8], start: usize, dst: &mut [T]) {
+    let src = &src[start * packing.bits() / 8..];
+
+    let unpacked = match packing {
+        Packing::U8 => unpack_groups::<T, 1, 1>(src, dst, |b| [u16::from(b[0])]),
+        Packing::U16 => unpack_groups::<T, 1, 2>(src, dst, |b| [u16::from_le_bytes([b[0], b[1]])]),
+        Packing::P10 => unpack_groups::<T, 4, 5>(src, dst, |b| {
+            let (b0, b1, b2, b3, b4) = (
+                u16::from(b[0]),
+                u16::from(b[1]),
+                u16::from(b[2]),
+                u16::from(b[3]),
+                u16::from(b[4]),
+            );
+            [
+                b0 | (b1 & 0x3) << 8,
+                b1 >> 2 | (b2 & 0xf) << 6,
+                b2 >> 4 | (b3 & 0x3f) << 4,
+                b3 >> 6 | b4 << 2,
+            ]
+        }),
+        Packing::P12 => unpack_groups::<T, 2, 3>(src, dst, |b| {
+            let (b0, b1, b2) = (u16::from(b[0]), u16::from(b[1]), u16::from(b[2]));
+            [b0 | (b1 & 0xf) << 8, b1 >> 4 | b2 << 4]
+        }),
+        Packing::Packed10 => unpack_groups::<T, 2, 3>(src, dst, |b| {
+            let (b0, b1, b2) = (u16::from(b[0]), u16::from(b[1]), u16::from(b[2]));
+            [b0 << 2 | (b1 & 0x3), b2 << 2 | (b1 >> 4 & 0x3)]
+        }),
+        Packing::Packed12 => unpack_groups::<T, 2, 3>(src, dst, |b| {
+            let (b0, b1, b2) = (u16::from(b[0]), u16::from(b[1]), u16::from(b[2]));
+            [b0 << 4 | (b1 & 0xf), b2 << 4 | b1 >> 4]
+        }),
+    };
+
+    // Remaining samples of the last incomplete group.
+    let byte = |idx: usize| u16::from(src.get(idx).copied().unwrap_or(0));
+    for (i, d) in dst.chunks_exact_mut(T::LEN).enumerate().skip(unpacked) {
+        let v = match packing {
+            Packing::U8 | Packing::U16 => unreachable!(),
+            Packing::P10 | Packing::P12 => {
+                let bits = packing.bits();
+                let bit = i * bits;
+                let word = u32::from(byte(bit / 8))
+                    | u32::from(byte(bit / 8 + 1)) << 8
+                    | u32::from(byte(bit / 8 + 2)) << 16;
+                (word >> (bit % 8) & ((1 << bits) - 1)) as u16
+            }
+            Packing::Packed10 => byte(i / 2 * 3) << 2 | (byte(i / 2 * 3 + 1) & 0x3),
+            Packing::Packed12 => byte(i / 2 * 3) << 4 | (byte(i / 2 * 3 + 1) & 0xf),
+        };
+        T::store(v, d);
+    }
+}
+
+/// Unpacks groups of `N` samples packed into `M` bytes with `decode`, and returns the number of
+/// samples unpacked.
+#[inline(always)]
+fn unpack_groups<T: Unpacked, const N: usize, const M: usize>(
+    src: &[u8],
+    dst: &mut [T],
+    decode: impl Fn(&[u8]) -> [u16; N],
+) -> usize {
+    let mut groups = 0;
+    for (d, b) in dst.chunks_exact_mut(N * T::LEN).zip(src.chunks_exact(M)) {
+        for (d, v) in d.chunks_exact_mut(T::LEN).zip(decode(b)) {
+            T::store(v, d);
+        }
+        groups += 1;
+    }
+    groups * N
+}
+
+/// Converts YUV 4:2:2 to RGB8 with BT.601 full range coefficients.
+#[inline(always)]
+fn yuv422(src: &[u8], y_first: bool, dst: &mut [u8]) {
+    #[inline(always)]
+    fn clamp(v: i32) -> u8 {
+        v.clamp(0, 255) as u8
+    }
+
+    for (d, s) in dst.chunks_exact_mut(6).zip(src.chunks_exact(4)) {
+        let (y0, u, y1, v) = if y_first {
+            (s[0], s[1], s[2], s[3])
+        } else {
+            (s[1], s[0], s[3], s[2])
+        };
+        let u = i32::from(u) - 128;
+        let v = i32::from(v) - 128;
+        // Fixed point coefficients scaled by 2^16.
+        let dr = (91_881 * v) >> 16;
+        let dg = (22_554 * u + 46_802 * v) >> 16;
+        let db = (116_130 * u) >> 16;
+        for (d, y) in d.chunks_exact_mut(3).zip([y0, y1]) {
+            let y = i32::from(y);
+            d[0] = clamp(y + dr);
+            d[1] = clamp(y - dg);
+            d[2] = clamp(y + db);
+        }
+    }
+}
+
+/// Sample of a Bayer image.
+trait Sample: Copy {
+    /// The number of bytes of an output sample.
+    const BYTES: usize;
+
+    fn get(self) -> u32;
+
+    /// Writes the red, green and blue samples of a pixel to `dst` of `3 * BYTES` bytes.
+    fn put(rgb: [u32; 3], dst: &mut [u8]);
+}
+
+impl Sample for u8 {
+    const BYTES: usize = 1;
+
+    #[inline(always)]
+    fn get(self) -> u32 {
+        u32::from(self)
+    }
+
+    #[inline(always)]
+    fn put(rgb: [u32; 3], dst: &mut [u8]) {
+        dst[0] = rgb[0] as u8;
+        dst[1] = rgb[1] as u8;
+        dst[2] = rgb[2] as u8;
+    }
+}
+
+impl Sample for u16 {
+    const BYTES: usize = 2;
+
+    #[inline(always)]
+    fn get(self) -> u32 {
+        u32::from(self)
+    }
+
+    #[inline(always)]
+    fn put(rgb: [u32; 3], dst: &mut [u8]) {
+        dst[0..2].copy_from_slice(&(rgb[0] as u16).to_le_bytes());
+        dst[2..4].copy_from_slice(&(rgb[1] as u16).to_le_bytes());
+        dst[4..6].copy_from_slice(&(rgb[2] as u16).to_le_bytes());
+    }
+}
+
+/// Debayers `rows` of `src` with bilinear interpolation. Rows and columns outside of the image
+/// are mirrored, which keeps the color of each position in the pattern.
+#[inline(always)]
+fn debayer<T: Sample>(
+    src: &[T],
+    width: usize,
+    height: usize,
+    cfa: Cfa,
+    rows: Range<usize>,
+    dst: &mut [u8],
+) {
+    let row = |y: usize| &src[y * width..(y + 1) * width];
+    for (y, dst) in rows.zip(dst.chunks_exact_mut(width * 3 * T::BYTES)) {
+        let up = row(if y == 0 { 1 } else { y - 1 });
+        let down = row(if y + 1 == height { height - 2 } else { y + 1 });
+        let cur = row(y);
+
+        let is_red_row = y & 1 == cfa.red_y;
+        // Whether the first column is a red or blue sample rather than a green one.
+        let is_color_first = (cfa.red_x == 0) == is_red_row;
+        match (is_red_row, is_color_first) {
+            (true, true) => debayer_row::<T, true, true>(up, cur, down, dst),
+            (true, false) => debayer_row::<T, true, false>(up, cur, down, dst),
+            (false, true) => debayer_row::<T, false, true>(up, cur, down, dst),
+            (false, false) => debayer_row::<T, false, false>(up, cur, down, dst),
+        }
+    }
+}
+
+/// Debayers the row `cur` between `up` and `down`. A red sample is in the row if `RED_ROW`,
+/// otherwise a blue one is, and it's in the first column if `COLOR_FIRST`.
+///
+/// Pairs of pixels inside the row are interpolated without branches, and the mirrored edges are
+/// handled outside of the loop.
+#[inline(always)]
+fn debayer_row<T: Sample, const RED_ROW: bool, const COLOR_FIRST: bool>(
+    up: &[T],
+    cur: &[T],
+    down: &[T],
+    dst: &mut [u8],
+) {
+    let width = cur.len();
+    let pixel_bytes = 3 * T::BYTES;
+    // Pairs of pixels from the second column up to the one before the last.
+    let pairs = (width - 2) / 2;
+
+    let (first, rest) = dst.split_at_mut(pixel_bytes);
+    debayer_edge::<T, RED_ROW, COLOR_FIRST>(up, cur, down, 0, first);
+
+    let (inner, last) = rest.split_at_mut(pairs * 2 * pixel_bytes);
+    let neighbors = up
+        .windows(4)
+        .step_by(2)
+        .zip(cur.windows(4).step_by(2))
+        .zip(down.windows(4).step_by(2));
+    for (((up, cur), down), dst) in neighbors.zip(inner.chunks_exact_mut(2 * pixel_bytes)) {
+        let odd = (
+            [up[0], up[1], up[2]],
+            [cur[0], cur[1], cur[2]],
+            [down[0], down[1], down[2]],
+        );
+        let even = (
+            [up[1], up[2], up[3]],
+            [cur[1], cur[2], cur[3]],
+            [down[1], down[2], down[3]],
+        );
+        let (odd_dst, even_dst) = dst.split_at_mut(pixel_bytes);
+        if COLOR_FIRST {
+            T::put(green_site::<T, RED_ROW>(odd), odd_dst);
+            T::put(color_site::<T, RED_ROW>(even), even_dst);
+        } else {
+            T::put(color_site::<T, RED_ROW>(odd), odd_dst);
+            T::put(green_site::<T, RED_ROW>(even), even_dst);
+        }
+    }
+
+    for (i, dst) in last.chunks_exact_mut(pixel_bytes).enumerate() {
+        debayer_edge::<T, RED_ROW, COLOR_FIRST>(up, cur, down, 1 + pairs * 2 + i, dst);
+    }
+}
+
+/// Debayers the pixel at `x` of the row whose neighbors may be outside of the image.
+#[inline(always)]
+fn debayer_edge<T: Sample, const RED_ROW: bool, const COLOR_FIRST: bool>(
+    up: &[T],
+    cur: &[T],
+    down: &[T],
+    x: usize,
+    dst: &mut [u8],
+) {
+    let l = if x == 0 { 1 } else { x - 1 };
+    let r = if x + 1 == cur.len() { x - 1 } else { x + 1 };
+    let pick = |row: &[T]| [row[l], row[x], row[r]];
+    let neighbors = (pick(up), pick(cur), pick(down));
+    if (x & 1 == 0) == COLOR_FIRST {
+        T::put(color_site::<T, RED_ROW>(neighbors), dst);
+    } else {
+        T::put(green_site::<T, RED_ROW>(neighbors), dst);
+    }
+}
+
+/// 3x3 neighbors of a pixel, from the upper row to the lower one.
+type Neighbors<T> = ([T; 3], [T; 3], [T; 3]);
+
+/// Interpolates the pixel at a red or blue sample.
+#[inline(always)]
+fn color_site<T: Sample, const RED_ROW: bool>((up, cur, down): Neighbors<T>) -> [u32; 3] {
+    let c = cur[1].get();
+    let cross = (up[1].get() + down[1].get() + cur[0].get() + cur[2].get() + 2) / 4;
+    let diag = (up[0].get() + up[2].get() + down[0].get() + down[2].get() + 2) / 4;
+    if RED_ROW {
+        [c, cross, diag]
+    } else {
+        [diag, cross, c]
+    }
+}
+
+/// Interpolates the pixel at a green sample.
+#[inline(always)]
+fn green_site<T: Sample, const RED_ROW: bool>((up, cur, down): Neighbors<T>) -> [u32; 3] {
+    let c = cur[1].get();
+    let horizontal = (cur[0].get() + cur[2].get() + 1) >> 1;
+    let vertical = (up[1].get() + down[1].get() + 1) >> 1;
+    if RED_ROW {
+        [horizontal, c, vertical]
+    } else {
+        [vertical, c, horizontal]
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn samples16(data: &[u8]) -> Vec<u16> {
+        data.chunks_exact(2)
+            .map(|b| u16::from_le_bytes([b[0], b[1]]))
+            .collect()
+    }
+
+    #[test]
+    fn test_unpack() {
+        let mut converter = ImageConverter::new().with_threads(1);
+
+        // 0x123, 0x2ab, 0x3cd, 0x0ef packed from LSB.
+        let mono10p = [0x23, 0xad, 0xda, 0xfc, 0x3b];
+        let image = converter
+            .convert_raw(&mono10p, 4, 1, PixelFormat::Mono10p)
+            .unwrap();
+        assert_eq!(image.pixel_format(), PixelFormat::Mono16);
+        assert_eq!(samples16(image.data()), vec![0x123, 0x2ab, 0x3cd, 0x0ef]);
+
+        let mono12p = [0x23, 0x61, 0x45, 0xab];
+        let image = converter
+            .convert_raw(&mono12p, 2, 1, PixelFormat::Mono12p)
+            .unwrap();
+        assert_eq!(samples16(image.data()), vec![0x123, 0x456]);
+
+        // The last sample of an odd width is unpacked from an incomplete group.
+        let image = converter
+            .convert_raw(&mono12p, 1, 1, PixelFormat::Mono12p)
+            .unwrap();
+        assert_eq!(samples16(image.data()), vec![0x123]);
+
+        let mono12_packed = [0x12, 0x63, 0x45];
+        let image = converter
+            .convert_raw(&mono12_packed, 2, 1, PixelFormat::Mono12Packed)
+            .unwrap();
+        assert_eq!(samples16(image.data()), vec![0x123, 0x456]);
+
+        assert!(converter
+            .convert_raw(&mono12p[..2], 2, 1, PixelFormat::Mono12p)
+            .is_err());
+    }
+
+    #[test]
+    fn test_debayer() {
+        let (width, height) = (6, 4);
+        // A uniformly colored image.
+        let (red, green, blue) = (200, 100, 50);
+        let mut bayer = vec![0; width * height];
+        for y in 0..height {
+            for x in 0..width {
+                bayer[y * width + x] = match (x % 2, y % 2) {
+                    (0, 0) => red,
+                    (1, 1) => blue,
+                    _ => green,
+                };
+            }
+        }
+
+        let mut converter = ImageConverter::new().with_threads(1);
+        let image = converter
+            .convert_raw(&bayer, width, height, PixelFormat::BayerRG8)
+            .unwrap();
+        assert_eq!(image.pixel_format(), PixelFormat::RGB8);
+        for pixel in image.data().chunks_exact(3) {
+            assert_eq!(pixel, [red, green, blue]);
+        }
+
+        // The same pattern read from the second row starts with blue.
+        let image = converter
+            .convert_raw(&bayer[width..], width, height - 1, PixelFormat::BayerGB8)
+            .unwrap();
+        for pixel in image.data().chunks_exact(3) {
+            assert_eq!(pixel, [red, green, blue]);
+        }
+
+        let bayer16: Vec<u8> = bayer
+            .iter()
+            .flat_map(|v| (u16::from(*v) << 4).to_le_bytes())
+            .collect();
+        let image = converter
+            .convert_raw(&bayer16, width, height, PixelFormat::BayerRG12)
+            .unwrap();
+        assert_eq!(image.pixel_format(), PixelFormat::RGB16);
+        for pixel in samples16(image.data()).chunks_exact(3) {
+            assert_eq!(pixel, [200 << 4, 100 << 4, 50 << 4]);
+        }
+    }
+
+    #[test]
+    fn test_debayer_edges() {
+        // Debayers the pixel at (x, y) one by one, mirroring the neighbors outside of the image.
+        fn reference(bayer: &[u8], width: usize, height: usize, cfa: Cfa) -> Vec<u8> {
+            let mirror = |i: usize, len: usize, delta: isize| match i as isize + delta {
+                -1 => 1,
+                j if j as usize == len => len - 2,
+                j => j as usize,
+            };
+            let at = |x: usize, y: usize| u32::from(bayer[y * width + x]);
+            let mut rgb = vec![];
+            for y in 0..height {
+                let (u, d) = (mirror(y, height, -1), mirror(y, height, 1));
+                for x in 0..width {
+                    let (l, r) = (mirror(x, width, -1), mirror(x, width, 1));
+                    let is_red_row = y % 2 == cfa.red_y;
+                    let pixel = if (x % 2 == cfa.red_x) == is_red_row {
+                        let cross = (at(x, u) + at(x, d) + at(l, y) + at(r, y) + 2) / 4;
+                        let diag = (at(l, u) + at(r, u) + at(l, d) + at(r, d) + 2) / 4;
+                        [at(x, y), cross, diag]
+                    } else {
+                        let horizontal = (at(l, y) + at(r, y) + 1) >> 1;
+                        let vertical = (at(x, u) + at(x, d) + 1) >> 1;
+                        [horizontal, at(x, y), vertical]
+                    };
+                    let [red, green, blue] = pixel;
+                    let (red, blue) = if is_red_row { (red, blue) } else { (blue, red) };
+                    rgb.extend([red as u8, green as u8, blue as u8]);
+                }
+            }
+            rgb
+        }
+
+        let mut state = 0x9e37_79b9_u32;
+        let bayer: Vec<u8> = (0..7 * 5)
+            .map(|_| {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                state as u8
+            })
+            .collect();
+
+        let mut converter = ImageConverter::new().with_threads(1);
+        for (width, height) in [(2, 2), (3, 2), (4, 3), (7, 5)] {
+            let bayer = &bayer[..width * height];
+            for (pixel_format, red_x, red_y) in [
+                (PixelFormat::BayerRG8, 0, 0),
+                (PixelFormat::BayerGR8, 1, 0),
+                (PixelFormat::BayerGB8, 0, 1),
+                (PixelFormat::BayerBG8, 1, 1),
+            ] {
+                let image = converter
+                    .convert_raw(bayer, width, height, pixel_format)
+                    .unwrap();
+                let expected = reference(bayer, width, height, Cfa { red_x, red_y });
+                assert_eq!(
+                    image.data(),
+                    expected,
+                    "{:?} {}x{}",
+                    pixel_format,
+                    width,
+                    height
+                );
+            }
+        }
+    }
+
+    #[test]
+    fn test_yuv422() {
+        let mut converter = ImageConverter::new();
+        let yuv = [100, 128, 150, 128];
+        let image = converter
+            .convert_raw(&yuv, 2, 1, PixelFormat::YUV422_8)
+            .unwrap();
+        assert_eq!(image.data(), [100, 100, 100, 150, 150, 150]);
+
+        let image = converter
+            .convert_raw(&[128, 100, 255, 100], 2, 1, PixelFormat::YCbCr422_8_CbYCrY)
+            .unwrap();
+        assert_eq!(image.data()[0], 255);
+    }
+
+    #[test]
+    fn test_parallel_conversion() {
+        let (width, height) = (64, 100);
+        let mut state = 0x1234_5678_u32;
+        let image: Vec<u8> = (0..width * height * 3 / 2)
+            .map(|_| {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                state as u8
+            })
+            .collect();
+
+        for pixel_format in [
+            PixelFormat::Mono12p,
+            PixelFormat::BayerGR12p,
+            PixelFormat::BayerBG8,
+        ] {
+            let single = ImageConverter::new()
+                .with_threads(1)
+                .convert_raw(&image, width, height, pixel_format)
+                .unwrap();
+            let mut converter = ImageConverter::new().with_threads(4);
+            // The workers are reused by the second conversion.
+            for _ in 0..2 {
+                let parallel = converter
+                    .convert_raw(&image, width, height, pixel_format)
+                    .unwrap();
+                assert_eq!(single.data(), parallel.data());
+            }
+        }
+    }
+
+    #[test]
+    fn test_pooled_output() {
+        let mut converter = ImageConverter::new().with_pool_capacity(1);
+        let image = converter
+            .convert_raw(&[0; 4], 2, 2, PixelFormat::Mono8)
+            .unwrap();
+        assert!(image.buffer.is_pooled());
+
+        // The pool is exhausted while `image` is alive.
+        let second = converter
+            .convert_raw(&[0; 4], 2, 2, PixelFormat::Mono8)
+            .unwrap();
+        assert!(!second.buffer.is_pooled());
+        drop(image);
+        let third = converter
+            .convert_raw(&[0; 4], 2, 2, PixelFormat::Mono8)
+            .unwrap();
+        assert!(third.buffer.is_pooled());
+    }
+}
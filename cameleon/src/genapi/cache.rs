@@ -0,0 +1,214 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! This module contains on-disk cache of `GenApi` xml and contexts built from it.
+//!
+//! Retrieving `GenApi` xml from the device reads a (possibly zipped) file of several MBs through
+//! the control channel, which often takes seconds, and parsing it takes a large part of the rest
+//! of loading a context. [`XmlCache`] stores the decompressed xml and the built context keyed by
+//! SHA1 hash of the file in the device's manifest entry, so the next
+//! [`Camera::load_context_with_cache`] only reads the hash from the device and neither retrieves
+//! nor parses the xml.
+//!
+//! [`Camera::load_context_with_cache`]: crate::Camera::load_context_with_cache
+
+use std::{
+    fs,
+    io::{self, Write},
+    path::{Path, PathBuf},
+    sync::atomic::{AtomicU64, Ordering},
+};
+
+use sha1::Digest;
+
+const XML_EXTENSION: &str = "xml";
+const COMPILED_EXTENSION: &str = "ctxt";
+
+/// Numbers temporary files written by this process, so that concurrent writers of the same entry
+/// never share a temporary file.
+static TMP_COUNTER: AtomicU64 = AtomicU64::new(0);
+
+/// Directory based cache of `GenApi` xml and contexts built from it.
+///
+/// Each xml is stored in `<dir>/<hex of hash>.xml`, and the context built from it in
+/// `<dir>/<hex of hash>.ctxt`. Each entry is prefixed with the digest of its content, so that a
+/// corrupted entry is detected and ignored.
+#[derive(Debug, Clone)]
+pub struct XmlCache {
+    dir: PathBuf,
+}
+
+impl XmlCache {
+    /// Creates a cache stored in `dir`. The directory is created when the first entry is stored.
+    pub fn new(dir: impl Into<PathBuf>) -> Self {
+        Self { dir: dir.into() }
+    }
+
+    /// Creates a cache stored in the user's cache directory, i.e. `$XDG_CACHE_HOME/cameleon`,
+    /// `$HOME/.cache/cameleon` or `%LOCALAPPDATA%\cameleon`.
+    ///
+    /// Returns `None` if none of the environment variables is set.
+    #[must_use]
+    pub fn in_user_cache_dir() -> Option<Self> {
+        let env_dir = |key| std::env::var_os(key).filter(|dir| !dir.is_empty());
+        let base = env_dir("XDG_CACHE_HOME")
+            .map(PathBuf::from)
+            .or_else(|| env_dir("HOME").map(|home| Path::new(&home).join(".cache")))
+            .or_else(|| env_dir("LOCALAPPDATA").map(PathBuf::from))?;
+        Some(Self::new(base.join("cameleon")))
+    }
+
+    /// Returns the directory of the cache.
+    #[must_use]
+    pub fn dir(&self) -> &Path {
+        &self.dir
+    }
+
+    /// Returns the cached xml whose source file has `hash`.
+    ///
+    /// Returns `None` if the entry doesn't exist or is corrupted.
+    #[must_use]
+    pub fn load(&self, hash: &[u8]) -> Option<String> {
+        let xml = self.read_entry(&self.entry_path(hash, XML_EXTENSION))?;
+        String::from_utf8(xml).ok()
+    }
+
+    /// Stores `xml` whose source file has `hash`.
+    ///
+    /// The entry is written to a temporary file and then renamed, so concurrent readers never see
+    /// a partially written entry.
+    pub fn store(&self, hash: &[u8], xml: &str) -> io::Result<()> {
+        self.write_entry(&self.entry_path(hash, XML_EXTENSION), xml.as_bytes())
+    }
+
+    /// Returns the cached context built from the xml whose source file has `hash`.
+    ///
+    /// The data is encoded by [`FromXml::to_compiled`].
+    ///
+    /// Returns `None` if the entry doesn't exist or is corrupted.
+    ///
+    /// [`FromXml::to_compiled`]: super::FromXml::to_compiled
+    #[must_use]
+    pub fn load_compiled(&self, hash: &[u8]) -> Option<Vec<u8>> {
+        self.read_entry(&self.entry_path(hash, COMPILED_EXTENSION))
+    }
+
+    /// Stores the context encoded by [`FromXml::to_compiled`], which is built from the xml whose
+    /// source file has `hash`.
+    ///
+    /// [`FromXml::to_compiled`]: super::FromXml::to_compiled
+    pub fn store_compiled(&self, hash: &[u8], data: &[u8]) -> io::Result<()> {
+        self.write_entry(&self.entry_path(hash, COMPILED_EXTENSION), data)
+    }
+
+    /// Removes the entries whose source file has `hash`.
+    pub fn remove(&self, hash: &[u8]) -> io::Result<()> {
+        match fs::remove_file(self.entry_path(hash, COMPILED_EXTENSION)) {
+            Err(err) if err.kind() != io::ErrorKind::NotFound => return Err(err),
+            _ => {}
+        }
+        fs::remove_file(self.entry_path(hash, XML_EXTENSION))
+    }
+
+    fn read_entry(&self, path: &Path) -> Option<Vec<u8>> {
+        let mut data = fs::read(path).ok()?;
+        let digest_len = sha1::Sha1::output_size();
+        if data.len() < digest_len {
+            return None;
+        }
+
+        if sha1::Sha1::digest(&data[digest_len..]).as_slice() != &data[..digest_len] {
+            tracing::warn!("ignore corrupted GenApi cache: {:?}", path);
+            return None;
+        }
+        data.drain(..digest_len);
+        Some(data)
+    }
+
+    fn write_entry(&self, path: &Path, data: &[u8]) -> io::Result<()> {
+        fs::create_dir_all(&self.dir)?;
+        let tmp_path = path.with_extension(format!(
+            "tmp{}-{}",
+            std::process::id(),
+            TMP_COUNTER.fetch_add(1, Ordering::Relaxed)
+        ));
+
+        let result = (|| {
+            let mut file = fs::OpenOptions::new()
+                .write(true)
+                .create_new(true)
+                .open(&tmp_path)?;
+            file.write_all(sha1::Sha1::digest(data).as_slice())?;
+            file.write_all(data)?;
+            file.sync_all()?;
+            fs::rename(&tmp_path, path)
+        })();
+        if result.is_err() {
+            fs::remove_file(&tmp_path).ok();
+        }
+        result
+    }
+
+    fn entry_path(&self, hash: &[u8], extension: &str) -> PathBuf {
+        let name: String = hash.iter().map(|byte| format!("{:02x}", byte)).collect();
+        self.dir.join(name).with_extension(extension)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_xml_cache() {
+        let dir = std::env::temp_dir().join(format!("cameleon-xml-cache-{}", std::process::id()));
+        let cache = XmlCache::new(&dir);
+        let hash = [0xab; 20];
+        assert!(cache.load(&hash).is_none());
+
+        cache.store(&hash, "<RegisterDescription/>").unwrap();
+        assert_eq!(cache.load(&hash).unwrap(), "<RegisterDescription/>");
+
+        // Corrupted entry is ignored.
+        let path = cache.entry_path(&hash, XML_EXTENSION);
+        let mut data = fs::read(&path).unwrap();
+        *data.last_mut().unwrap() = b'!';
+        fs::write(&path, data).unwrap();
+        assert!(cache.load(&hash).is_none());
+
+        // Compiled entries are stored next to the xml.
+        assert!(cache.load_compiled(&hash).is_none());
+        cache.store_compiled(&hash, &[1, 2, 3]).unwrap();
+        assert_eq!(cache.load_compiled(&hash).unwrap(), [1, 2, 3]);
+        assert!(cache.entry_path(&hash, COMPILED_EXTENSION).exists());
+
+        cache.remove(&hash).unwrap();
+        assert!(cache.load_compiled(&hash).is_none());
+        fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn test_concurrent_store() {
+        let dir = std::env::temp_dir().join(format!(
+            "cameleon-xml-cache-concurrent-{}",
+            std::process::id()
+        ));
+        let cache = XmlCache::new(&dir);
+        let hash = [0xcd; 20];
+        let xml = "<RegisterDescription/>".repeat(1024);
+
+        // Writers of the same entry don't corrupt each other.
+        std::thread::scope(|s| {
+            for _ in 0..4 {
+                s.spawn(|| {
+                    for _ in 0..8 {
+                        cache.store(&hash, &xml).unwrap();
+                        assert_eq!(cache.load(&hash).unwrap(), xml);
+                    }
+                });
+            }
+        });
+        fs::remove_dir_all(&dir).unwrap();
+    }
+}
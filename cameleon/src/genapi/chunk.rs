@@ -0,0 +1,88 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+use std::convert::TryFrom;
+
+use crate::{payload::Payload, ControlResult, DeviceControl};
+
+/// A control handle with chunk data of a [`Payload`] attached.
+///
+/// Nodes of chunk ports are read from the chunk in the payload whose ID matches `ChunkID` of the
+/// port, and other nodes are read from the device through the inner handle.
+/// See [`ParamsCtxt::attach_chunk`](super::ParamsCtxt::attach_chunk).
+#[derive(Debug)]
+pub struct ChunkCtrl<'a, Ctrl> {
+    ctrl: Ctrl,
+    payload: &'a Payload,
+}
+
+impl<'a, Ctrl> ChunkCtrl<'a, Ctrl> {
+    /// Attaches chunk data of `payload` to `ctrl`.
+    pub fn new(ctrl: Ctrl, payload: &'a Payload) -> Self {
+        Self { ctrl, payload }
+    }
+
+    /// Returns the attached payload.
+    pub fn payload(&self) -> &'a Payload {
+        self.payload
+    }
+
+    /// Returns the inner handle.
+    pub fn into_inner(self) -> Ctrl {
+        self.ctrl
+    }
+}
+
+impl<'a, Ctrl> DeviceControl for ChunkCtrl<'a, Ctrl>
+where
+    Ctrl: DeviceControl,
+{
+    fn open(&mut self) -> ControlResult<()> {
+        self.ctrl.open()
+    }
+
+    fn close(&mut self) -> ControlResult<()> {
+        self.ctrl.close()
+    }
+
+    fn is_opened(&self) -> bool {
+        self.ctrl.is_opened()
+    }
+
+    fn read(&mut self, address: u64, buf: &mut [u8]) -> ControlResult<()> {
+        self.ctrl.read(address, buf)
+    }
+
+    fn write(&mut self, address: u64, data: &[u8]) -> ControlResult<()> {
+        self.ctrl.write(address, data)
+    }
+
+    fn read_stacked(&mut self, entries: &mut [(u64, &mut [u8])]) -> ControlResult<()> {
+        self.ctrl.read_stacked(entries)
+    }
+
+    fn write_stacked(&mut self, entries: &[(u64, &[u8])]) -> ControlResult<()> {
+        self.ctrl.write_stacked(entries)
+    }
+
+    fn genapi(&mut self) -> ControlResult<String> {
+        self.ctrl.genapi()
+    }
+
+    fn genapi_sha1_hash(&mut self) -> ControlResult<Option<[u8; 20]>> {
+        self.ctrl.genapi_sha1_hash()
+    }
+
+    fn chunk_data(&self, chunk_id: u64) -> Option<&[u8]> {
+        self.payload.chunk(u32::try_from(chunk_id).ok()?)
+    }
+
+    fn enable_streaming(&mut self) -> ControlResult<()> {
+        self.ctrl.enable_streaming()
+    }
+
+    fn disable_streaming(&mut self) -> ControlResult<()> {
+        self.ctrl.disable_streaming()
+    }
+}
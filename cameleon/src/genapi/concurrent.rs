@@ -0,0 +1,443 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! This module contains a `GenApi` context for concurrent readers.
+//!
+//! [`SharedDefaultGenApiCtxt`](super::SharedDefaultGenApiCtxt) locks the whole value context
+//! during each access, so threads reading cached values wait for each other and for any thread
+//! waiting for the device. [`ConcurrentGenApiCtxt`] instead gives each clone its own snapshot of
+//! the value context tagged with an epoch. An access whose snapshot is up to date and which only
+//! reads cached values never takes a lock.
+//!
+//! Every mutation of the snapshot, i.e. a register write, a cache miss or an update of a value, is
+//! journaled. At the end of the access the journal is replayed onto the shared value context under
+//! its lock and the epoch is advanced, so that other clones take a new snapshot on their next
+//! access.
+
+use std::sync::{
+    atomic::{AtomicU64, Ordering},
+    Arc, Mutex,
+};
+
+use super::{
+    store, ChunkRegisters, ControlResult, DefaultGenApiCtxt, EvaluationResult, FromXml, GenApiCtxt,
+    NodeId, RegisterDescription, ValueCtxt,
+};
+use store::{CacheStore, ValueData, ValueId, ValueStore};
+
+/// A `GenApi` context whose clones read cached values without locking.
+///
+/// Clone the context for each thread instead of sharing it behind a lock. All clones observe the
+/// writes of the others.
+///
+/// # Examples
+/// ```no_run
+/// use cameleon::{
+///     genapi::{ConcurrentGenApiCtxt, ParamsCtxt},
+///     u3v::{self, SharedControlHandle, StreamHandle},
+///     Camera,
+/// };
+///
+/// let mut cameras = u3v::enumerate_cameras().unwrap();
+/// let mut camera: Camera<SharedControlHandle, StreamHandle, ConcurrentGenApiCtxt> =
+///     cameras.pop().unwrap().convert_into();
+/// camera.open().unwrap();
+/// camera.load_context().unwrap();
+///
+/// // Each thread owns its clone of the control handle and the context.
+/// let mut telemetry = ParamsCtxt {
+///     ctrl: camera.ctrl.clone(),
+///     ctxt: camera.ctxt.clone().unwrap(),
+/// };
+/// std::thread::spawn(move || {
+///     let width = telemetry.node("Width").unwrap().as_integer(&telemetry).unwrap();
+///     println!("{}", width.value(&mut telemetry).unwrap());
+/// });
+/// ```
+#[derive(Debug, Clone)]
+pub struct ConcurrentGenApiCtxt {
+    /// Node store.
+    pub node_store: Arc<store::DefaultNodeStore>,
+    /// Register description.
+    pub reg_desc: Arc<RegisterDescription>,
+    shared: Arc<SharedValueCtxt>,
+    snapshot: ValueCtxt<JournaledValueStore, JournaledCacheStore>,
+    /// Epoch of `shared` which `snapshot` was taken at.
+    epoch: u64,
+    chunk_registers: ChunkRegisters,
+}
+
+#[derive(Debug)]
+struct SharedValueCtxt {
+    /// Advanced every time the value context is modified. Only modified while `value_ctxt` is
+    /// locked.
+    epoch: AtomicU64,
+    value_ctxt: Mutex<ValueCtxt<store::DefaultValueStore, store::DefaultCacheStore>>,
+}
+
+impl ConcurrentGenApiCtxt {
+    /// Takes a new snapshot if another clone has modified the shared value context.
+    fn sync(&mut self) {
+        if self.shared.epoch.load(Ordering::Acquire) == self.epoch {
+            return;
+        }
+
+        let value_ctxt = self.shared.value_ctxt.lock().unwrap();
+        self.snapshot = snapshot(&value_ctxt);
+        self.epoch = self.shared.epoch.load(Ordering::Acquire);
+    }
+
+    /// Replays the journal of the snapshot onto the shared value context.
+    fn publish(&mut self) {
+        let mut value_ctxt = self.shared.value_ctxt.lock().unwrap();
+        let epoch = self.shared.epoch.load(Ordering::Acquire);
+        // Cached data read from a stale snapshot may be older than a write of another clone, so
+        // only invalidations are replayed in that case.
+        let is_stale = epoch != self.epoch;
+
+        self.snapshot
+            .value_store
+            .replay(&mut value_ctxt.value_store);
+        self.snapshot
+            .cache_store
+            .replay(&mut value_ctxt.cache_store, is_stale);
+        self.shared.epoch.store(epoch + 1, Ordering::Release);
+
+        // Otherwise the snapshot is already identical to the shared value context.
+        if is_stale {
+            self.snapshot = snapshot(&value_ctxt);
+        }
+        self.epoch = epoch + 1;
+    }
+}
+
+impl GenApiCtxt for ConcurrentGenApiCtxt {
+    type NS = store::DefaultNodeStore;
+    type VS = JournaledValueStore;
+    type CS = JournaledCacheStore;
+
+    fn enter<F, R>(&mut self, f: F) -> R
+    where
+        F: FnOnce(&Self::NS, &mut ValueCtxt<Self::VS, Self::CS>) -> R,
+    {
+        self.sync();
+        let result = f(&self.node_store, &mut self.snapshot);
+        if self.snapshot.value_store.is_dirty() || self.snapshot.cache_store.is_dirty() {
+            self.publish();
+        }
+        result
+    }
+
+    fn node_store(&self) -> &Self::NS {
+        &self.node_store
+    }
+
+    fn invalidate_chunk_registers(&mut self) {
+        let chunk_registers = self.chunk_registers.clone();
+        self.enter(|node_store, value_ctxt| chunk_registers.invalidate(node_store, value_ctxt));
+    }
+}
+
+impl FromXml for ConcurrentGenApiCtxt {
+    fn from_xml(xml: &impl AsRef<str>) -> ControlResult<Self>
+    where
+        Self: Sized + GenApiCtxt,
+    {
+        Ok(DefaultGenApiCtxt::from_xml(xml)?.into())
+    }
+}
+
+impl From<DefaultGenApiCtxt> for ConcurrentGenApiCtxt {
+    fn from(ctxt: DefaultGenApiCtxt) -> Self {
+        Self {
+            node_store: Arc::new(ctxt.node_store),
+            reg_desc: Arc::new(ctxt.reg_desc),
+            snapshot: snapshot(&ctxt.value_ctxt),
+            shared: Arc::new(SharedValueCtxt {
+                epoch: AtomicU64::new(0),
+                value_ctxt: Mutex::new(ctxt.value_ctxt),
+            }),
+            epoch: 0,
+            chunk_registers: ctxt.chunk_registers,
+        }
+    }
+}
+
+/// Only the caches are copied, the dependencies between nodes are shared with `value_ctxt`.
+fn snapshot(
+    value_ctxt: &ValueCtxt<store::DefaultValueStore, store::DefaultCacheStore>,
+) -> ValueCtxt<JournaledValueStore, JournaledCacheStore> {
+    ValueCtxt::new(
+        JournaledValueStore {
+            inner: value_ctxt.value_store.clone(),
+            journal: vec![],
+        },
+        JournaledCacheStore {
+            inner: value_ctxt.cache_store.clone(),
+            journal: vec![],
+        },
+    )
+}
+
+/// [`ValueStore`] of a [`ConcurrentGenApiCtxt`] snapshot which records updates.
+#[derive(Debug, Clone)]
+pub struct JournaledValueStore {
+    inner: store::DefaultValueStore,
+    journal: Vec<(ValueId, ValueData)>,
+}
+
+impl JournaledValueStore {
+    fn is_dirty(&self) -> bool {
+        !self.journal.is_empty()
+    }
+
+    fn replay(&mut self, to: &mut store::DefaultValueStore) {
+        for (id, value) in self.journal.drain(..) {
+            to.update(id, value);
+        }
+    }
+}
+
+impl ValueStore for JournaledValueStore {
+    fn value_opt<T>(&self, id: T) -> Option<&ValueData>
+    where
+        T: Into<ValueId>,
+    {
+        self.inner.value_opt(id)
+    }
+
+    fn update<T, U>(&mut self, id: T, value: U) -> Option<ValueData>
+    where
+        T: Into<ValueId>,
+        U: Into<ValueData>,
+    {
+        let id = id.into();
+        let value = value.into();
+        self.journal.push((id, value.clone()));
+        self.inner.update(id, value)
+    }
+}
+
+#[derive(Debug, Clone)]
+enum CacheOp {
+    Cache {
+        nid: NodeId,
+        address: i64,
+        length: i64,
+        data: Vec<u8>,
+    },
+    CacheValue(NodeId, EvaluationResult),
+    InvalidateBy(NodeId),
+    InvalidateOf(NodeId),
+    Clear,
+}
+
+/// [`CacheStore`] of a [`ConcurrentGenApiCtxt`] snapshot which records modifications.
+#[derive(Debug, Clone)]
+pub struct JournaledCacheStore {
+    inner: store::DefaultCacheStore,
+    journal: Vec<CacheOp>,
+}
+
+impl JournaledCacheStore {
+    fn is_dirty(&self) -> bool {
+        !self.journal.is_empty()
+    }
+
+    fn replay(&mut self, to: &mut store::DefaultCacheStore, invalidation_only: bool) {
+        for op in self.journal.drain(..) {
+            match op {
+                CacheOp::Cache {
+                    nid,
+                    address,
+                    length,
+                    data,
+                } if !invalidation_only => to.cache(nid, address, length, &data),
+                CacheOp::CacheValue(nid, value) if !invalidation_only => to.cache_value(nid, value),
+                CacheOp::InvalidateBy(nid) => to.invalidate_by(nid),
+                CacheOp::InvalidateOf(nid) => to.invalidate_of(nid),
+                CacheOp::Clear => to.clear(),
+                _ => {}
+            }
+        }
+    }
+}
+
+impl CacheStore for JournaledCacheStore {
+    fn cache(&mut self, nid: NodeId, address: i64, length: i64, data: &[u8]) {
+        self.journal.push(CacheOp::Cache {
+            nid,
+            address,
+            length,
+            data: data.to_vec(),
+        });
+        self.inner.cache(nid, address, length, data);
+    }
+
+    fn get_cache(&self, nid: NodeId, address: i64, length: i64) -> Option<&[u8]> {
+        self.inner.get_cache(nid, address, length)
+    }
+
+    fn cache_value(&mut self, nid: NodeId, value: EvaluationResult) {
+        self.inner.cache_value(nid, value);
+        // Values of volatile nodes are never cached, and recording them would make every read of
+        // them lock the shared context.
+        if self.inner.get_value_cache(nid).is_some() {
+            self.journal.push(CacheOp::CacheValue(nid, value));
+        }
+    }
+
+    fn get_value_cache(&self, nid: NodeId) -> Option<EvaluationResult> {
+        self.inner.get_value_cache(nid)
+    }
+
+    fn invalidate_by(&mut self, nid: NodeId) {
+        self.journal.push(CacheOp::InvalidateBy(nid));
+        self.inner.invalidate_by(nid);
+    }
+
+    fn invalidate_of(&mut self, nid: NodeId) {
+        self.journal.push(CacheOp::InvalidateOf(nid));
+        self.inner.invalidate_of(nid);
+    }
+
+    fn clear(&mut self) {
+        self.journal.push(CacheOp::Clear);
+        self.inner.clear();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use cameleon_genapi::{
+        interface::IInteger,
+        testing::{register_description, TestDevice},
+    };
+    use store::NodeStore;
+
+    use super::*;
+
+    fn xml() -> String {
+        register_description(
+            r#"
+
+            <IntReg Name="Width">
+              <Address>0x0</Address>
+              <Length>4</Length>
+              <AccessMode>RW</AccessMode>
+              <pPort>Device</pPort>
+              <Cachable>WriteThrough</Cachable>
+              <Endianess>LittleEndian</Endianess>
+            </IntReg>
+
+            <Port Name="Device">
+            </Port>
+
+        "#,
+        )
+    }
+
+    fn width(ctxt: &mut ConcurrentGenApiCtxt, device: &mut TestDevice) -> i64 {
+        integer_value(ctxt, device, "Width")
+    }
+
+    fn integer_value(ctxt: &mut ConcurrentGenApiCtxt, device: &mut TestDevice, name: &str) -> i64 {
+        ctxt.enter(|ns, cx| {
+            let nid = ns.id_by_name(name).unwrap();
+            nid.as_iinteger_kind(ns)
+                .unwrap()
+                .value(device, ns, cx)
+                .unwrap()
+        })
+    }
+
+    #[test]
+    fn test_concurrent_ctxt() {
+        let mut ctxt_a = ConcurrentGenApiCtxt::from_xml(&xml()).unwrap();
+        let mut ctxt_b = ctxt_a.clone();
+        let mut device = TestDevice::new(vec![100, 0, 0, 0]);
+
+        // A cache miss of one clone is shared with the others.
+        assert_eq!(width(&mut ctxt_a, &mut device), 100);
+        assert_eq!(width(&mut ctxt_b, &mut device), 100);
+        assert_eq!(device.reads.len(), 1);
+
+        // Cached reads don't modify the shared context.
+        let epoch = ctxt_a.shared.epoch.load(Ordering::Acquire);
+        assert_eq!(width(&mut ctxt_a, &mut device), 100);
+        assert_eq!(ctxt_a.shared.epoch.load(Ordering::Acquire), epoch);
+
+        // A write of one clone is observed by the others.
+        ctxt_b.enter(|ns, cx| {
+            let nid = ns.id_by_name("Width").unwrap();
+            nid.as_iinteger_kind(ns)
+                .unwrap()
+                .set_value(200, &mut device, ns, cx)
+                .unwrap();
+        });
+        assert_eq!(width(&mut ctxt_a, &mut device), 200);
+        assert_eq!(device.reads.len(), 1);
+    }
+
+    #[test]
+    fn test_stale_journal() {
+        let mut ctxt_a = ConcurrentGenApiCtxt::from_xml(&xml()).unwrap();
+        let mut ctxt_b = ctxt_a.clone();
+        let mut device = TestDevice::new(vec![100, 0, 0, 0]);
+
+        // `ctxt_b` caches `Width` on a snapshot older than the invalidation of `ctxt_a`.
+        ctxt_b.sync();
+        ctxt_a.enter(|_, cx| cx.clear_cache());
+        let nid = ctxt_b.node_store.id_by_name("Width").unwrap();
+        ctxt_b.snapshot.cache_store.cache(nid, 0, 4, &[1, 0, 0, 0]);
+        ctxt_b.publish();
+
+        // The stale data isn't published.
+        assert_eq!(width(&mut ctxt_a, &mut device), 100);
+        assert_eq!(device.reads.len(), 1);
+    }
+
+    #[test]
+    fn test_chunk_registers() {
+        let xml = register_description(
+            r#"
+
+            <IntReg Name="ChunkFrameCounter">
+              <Address>0x0</Address>
+              <Length>4</Length>
+              <AccessMode>RO</AccessMode>
+              <pPort>ChunkPort</pPort>
+              <Endianess>LittleEndian</Endianess>
+            </IntReg>
+
+            <Port Name="ChunkPort">
+                <ChunkID>1000</ChunkID>
+            </Port>
+
+        "#,
+        );
+        let mut ctxt_a = ConcurrentGenApiCtxt::from_xml(&xml).unwrap();
+        let mut ctxt_b = ctxt_a.clone();
+        let mut device = TestDevice::new(vec![]);
+
+        device.chunk = Some((0x1000, vec![1, 0, 0, 0]));
+        assert_eq!(
+            integer_value(&mut ctxt_a, &mut device, "ChunkFrameCounter"),
+            1
+        );
+        device.chunk = Some((0x1000, vec![2, 0, 0, 0]));
+        assert_eq!(
+            integer_value(&mut ctxt_a, &mut device, "ChunkFrameCounter"),
+            1
+        );
+
+        // Registers collected by one clone are reused by the others.
+        ctxt_b.invalidate_chunk_registers();
+        assert!(ctxt_a.chunk_registers.0.get().is_some());
+        assert_eq!(
+            integer_value(&mut ctxt_a, &mut device, "ChunkFrameCounter"),
+            2
+        );
+    }
+}
@@ -38,7 +38,14 @@
 //! # camera.close().unwrap();
 //! ```
 
+pub mod cache;
+mod chunk;
+mod concurrent;
 mod node_kind;
+pub mod poller;
+
+pub use chunk::ChunkCtrl;
+pub use concurrent::{ConcurrentGenApiCtxt, JournaledCacheStore, JournaledValueStore};
 
 pub use node_kind::{
     BooleanNode, CategoryNode, CommandNode, EnumEntryNode, EnumerationNode, FloatNode, IntegerNode,
@@ -47,21 +54,23 @@ pub use node_kind::{
 
 use std::{
     convert::TryInto,
-    sync::{Arc, Mutex},
+    sync::{Arc, Mutex, OnceLock},
 };
 
 use auto_impl::auto_impl;
-use cameleon_genapi::{builder::GenApiBuilder, store};
+use cameleon_genapi::{builder::GenApiBuilder, codec, store};
+use tracing::debug;
 
-use super::{ControlError, ControlResult, DeviceControl};
+use super::{payload::Payload, ControlError, ControlResult, DeviceControl};
 
 pub use cameleon_genapi::{
     elem_type::{AccessMode, NameSpace, Visibility},
+    formula::EvaluationResult,
     store::{
-        CacheSink, CacheStore, DefaultCacheStore, DefaultNodeStore, DefaultValueStore, NodeId,
-        NodeStore, ValueStore,
+        CacheSink, CacheStore, DefaultCacheStore, DefaultNodeStore, DefaultValueStore,
+        LazyCacheStore, LazyNodeStore, LazyValueStore, NodeId, NodeStore, ValueStore,
     },
-    GenApiError, RegisterDescription, ValueCtxt,
+    GenApiError, GenApiResult, RegisterDescription, ValueCtxt,
 };
 
 /// Manages context of parameters of the device.
@@ -145,6 +154,69 @@ where
             ctxt.enter(|node_store, value_ctxt| f(ctrl, node_store, value_ctxt))
         })
     }
+
+    /// Reads registers which `nodes` depend on with as few transactions as possible and caches
+    /// them, so that the following reads of `nodes` don't access the device.
+    ///
+    /// Adjacent registers are read at once, and `ReadMemStacked` is used if the device supports
+    /// it. Registers which must not be cached are skipped.
+    ///
+    /// # Examples
+    /// ```no_run
+    /// # use cameleon::u3v;
+    /// # let mut cameras = u3v::enumerate_cameras().unwrap();
+    /// # let mut camera = cameras.pop().unwrap();
+    /// # camera.open().unwrap();
+    /// # camera.load_context().unwrap();
+    /// let mut params_ctxt = camera.params_ctxt().unwrap();
+    /// let names = ["Width", "Height", "OffsetX", "OffsetY", "PixelFormat"];
+    /// let nodes: Vec<_> = names.iter().filter_map(|name| params_ctxt.node(name)).collect();
+    /// params_ctxt.prefetch(nodes.iter().copied()).unwrap();
+    /// ```
+    pub fn prefetch(&mut self, nodes: impl IntoIterator<Item = Node>) -> GenApiResult<()> {
+        let nodes: Vec<_> = nodes.into_iter().map(|node| node.0).collect();
+        self.enter2(|ctrl, node_store, value_ctxt| {
+            let mut device = GenApiDevice::new(ctrl);
+            cameleon_genapi::prefetch(nodes, &mut device, node_store, value_ctxt)
+        })
+    }
+
+    /// Attaches chunk data of `payload`, so that nodes of chunk ports, e.g. `ChunkExposureTime`,
+    /// are read from the payload buffer without copying and without accessing the device.
+    ///
+    /// Cached values of the nodes read from previously attached chunk data are invalidated.
+    ///
+    /// # Examples
+    /// ```no_run
+    /// # use cameleon::u3v;
+    /// # let mut cameras = u3v::enumerate_cameras().unwrap();
+    /// # let mut camera = cameras.pop().unwrap();
+    /// # camera.open().unwrap();
+    /// # camera.load_context().unwrap();
+    /// let payload_rx = camera.start_streaming(3).unwrap();
+    /// let payload = payload_rx.recv_blocking().unwrap();
+    ///
+    /// let mut params_ctxt = camera.params_ctxt().unwrap();
+    /// let mut chunk_ctxt = params_ctxt.attach_chunk(&payload);
+    /// let exposure_time = chunk_ctxt
+    ///     .node("ChunkExposureTime")
+    ///     .unwrap()
+    ///     .as_float(&chunk_ctxt)
+    ///     .unwrap();
+    /// println!("{}", exposure_time.value(&mut chunk_ctxt).unwrap());
+    ///
+    /// payload_rx.send_back(payload);
+    /// ```
+    pub fn attach_chunk<'a>(
+        &'a mut self,
+        payload: &'a Payload,
+    ) -> ParamsCtxt<ChunkCtrl<'a, &'a mut Ctrl>, &'a mut Ctxt> {
+        self.ctxt.invalidate_chunk_registers();
+        ParamsCtxt {
+            ctrl: ChunkCtrl::new(&mut self.ctrl, payload),
+            ctxt: &mut self.ctxt,
+        }
+    }
 }
 
 impl<Ctrl, Ctxt> ParamsCtxt<Ctrl, Ctxt> {
@@ -197,6 +269,36 @@ pub trait GenApiCtxt {
     fn clear_cache(&mut self) {
         self.enter(|_, value_ctxt| value_ctxt.clear_cache())
     }
+
+    /// Invalidates cached values of registers of chunk ports, which is called every time chunk
+    /// data is attached by [`ParamsCtxt::attach_chunk`].
+    ///
+    /// The default implementation collects the registers from the node store on every call,
+    /// while contexts of this crate collect them once after the context is loaded.
+    fn invalidate_chunk_registers(&mut self) {
+        self.enter(|node_store, value_ctxt| {
+            let nodes = cameleon_genapi::chunk_registers(node_store);
+            cameleon_genapi::invalidate_registers(nodes, node_store, value_ctxt);
+        });
+    }
+}
+
+/// Registers of chunk ports, which are collected from the node store on first use and shared
+/// between clones of a context.
+#[derive(Clone, Debug, Default)]
+pub(super) struct ChunkRegisters(Arc<OnceLock<Vec<NodeId>>>);
+
+impl ChunkRegisters {
+    fn invalidate<T: ValueStore, U: CacheStore>(
+        &self,
+        node_store: &impl NodeStore,
+        value_ctxt: &mut ValueCtxt<T, U>,
+    ) {
+        let nodes = self
+            .0
+            .get_or_init(|| cameleon_genapi::chunk_registers(node_store));
+        cameleon_genapi::invalidate_registers(nodes.iter().copied(), node_store, value_ctxt);
+    }
 }
 
 /// A trait that provides directly conversion from `GenApi` string to a `GenApi` context.
@@ -205,6 +307,27 @@ pub trait FromXml {
     fn from_xml(xml: &impl AsRef<str>) -> ControlResult<Self>
     where
         Self: Sized + GenApiCtxt;
+
+    /// Restores the context from `data` encoded by [`Self::to_compiled`], which skips parsing
+    /// the xml.
+    ///
+    /// Returns `None` if the context doesn't support it, or `data` is invalid or encoded by
+    /// another version of `cameleon`.
+    fn from_compiled(data: &[u8]) -> Option<Self>
+    where
+        Self: Sized + GenApiCtxt,
+    {
+        let _ = data;
+        None
+    }
+
+    /// Encodes the context so that it can be restored by [`Self::from_compiled`].
+    ///
+    /// This should be called right after the context is built, because the current values of
+    /// nodes are encoded as well. Returns `None` if the context doesn't support it.
+    fn to_compiled(&self) -> Option<Vec<u8>> {
+        None
+    }
 }
 
 /// Default `GenApi` context.  
@@ -219,6 +342,7 @@ pub struct DefaultGenApiCtxt {
     pub value_ctxt: ValueCtxt<store::DefaultValueStore, store::DefaultCacheStore>,
     /// Register description.
     pub reg_desc: RegisterDescription,
+    chunk_registers: ChunkRegisters,
 }
 
 impl GenApiCtxt for DefaultGenApiCtxt {
@@ -236,6 +360,11 @@ impl GenApiCtxt for DefaultGenApiCtxt {
     fn node_store(&self) -> &Self::NS {
         &self.node_store
     }
+
+    fn invalidate_chunk_registers(&mut self) {
+        self.chunk_registers
+            .invalidate(&self.node_store, &mut self.value_ctxt);
+    }
 }
 
 impl FromXml for DefaultGenApiCtxt {
@@ -251,8 +380,32 @@ impl FromXml for DefaultGenApiCtxt {
             node_store,
             value_ctxt,
             reg_desc,
+            chunk_registers: ChunkRegisters::default(),
         })
     }
+
+    fn from_compiled(data: &[u8]) -> Option<Self> {
+        match codec::decode(data) {
+            Ok((reg_desc, node_store, value_ctxt)) => Some(Self {
+                node_store,
+                value_ctxt,
+                reg_desc,
+                chunk_registers: ChunkRegisters::default(),
+            }),
+            Err(err) => {
+                debug!(%err, "failed to decode compiled GenApi context");
+                None
+            }
+        }
+    }
+
+    fn to_compiled(&self) -> Option<Vec<u8>> {
+        Some(codec::encode(
+            &self.reg_desc,
+            &self.node_store,
+            &self.value_ctxt,
+        ))
+    }
 }
 
 /// A sharable version of [`DefaultGenApiCtxt`].
@@ -264,6 +417,7 @@ pub struct SharedDefaultGenApiCtxt {
     pub value_ctxt: Arc<Mutex<ValueCtxt<store::DefaultValueStore, store::DefaultCacheStore>>>,
     /// Register description.
     pub reg_desc: Arc<RegisterDescription>,
+    chunk_registers: ChunkRegisters,
 }
 
 impl GenApiCtxt for SharedDefaultGenApiCtxt {
@@ -281,6 +435,27 @@ impl GenApiCtxt for SharedDefaultGenApiCtxt {
     fn node_store(&self) -> &Self::NS {
         &self.node_store
     }
+
+    fn invalidate_chunk_registers(&mut self) {
+        self.chunk_registers
+            .invalidate(&*self.node_store, &mut self.value_ctxt.lock().unwrap());
+    }
+}
+
+impl SharedDefaultGenApiCtxt {
+    /// Spawns a thread which refreshes nodes declaring `PollingTime` at their interval through
+    /// `ctrl`, so that reads of them are answered from the cache.
+    ///
+    /// `ctrl` should share the device with the camera, e.g. a clone of [`SharedControlHandle`].
+    /// The thread stops when the returned [`poller::Poller`] is dropped.
+    ///
+    /// [`SharedControlHandle`]: crate::u3v::SharedControlHandle
+    pub fn start_polling<Ctrl>(&self, ctrl: Ctrl) -> poller::Poller
+    where
+        Ctrl: DeviceControl + Send + 'static,
+    {
+        poller::Poller::spawn(self.clone(), ctrl)
+    }
 }
 
 impl FromXml for SharedDefaultGenApiCtxt {
@@ -291,6 +466,18 @@ impl FromXml for SharedDefaultGenApiCtxt {
     {
         Ok(DefaultGenApiCtxt::from_xml(xml)?.into())
     }
+
+    fn from_compiled(data: &[u8]) -> Option<Self> {
+        DefaultGenApiCtxt::from_compiled(data).map(Into::into)
+    }
+
+    fn to_compiled(&self) -> Option<Vec<u8>> {
+        Some(codec::encode(
+            &self.reg_desc,
+            &self.node_store,
+            &self.value_ctxt.lock().unwrap(),
+        ))
+    }
 }
 
 impl From<DefaultGenApiCtxt> for SharedDefaultGenApiCtxt {
@@ -299,6 +486,7 @@ impl From<DefaultGenApiCtxt> for SharedDefaultGenApiCtxt {
             node_store: Arc::new(ctxt.node_store),
             value_ctxt: Arc::new(Mutex::new(ctxt.value_ctxt)),
             reg_desc: Arc::new(ctxt.reg_desc),
+            chunk_registers: ctxt.chunk_registers,
         }
     }
 }
@@ -330,6 +518,9 @@ impl GenApiCtxt for NoCacheGenApiCtxt {
     fn node_store(&self) -> &Self::NS {
         &self.node_store
     }
+
+    /// Nothing is cached.
+    fn invalidate_chunk_registers(&mut self) {}
 }
 
 impl FromXml for NoCacheGenApiCtxt {
@@ -348,6 +539,10 @@ impl FromXml for NoCacheGenApiCtxt {
             reg_desc,
         })
     }
+
+    fn from_compiled(data: &[u8]) -> Option<Self> {
+        DefaultGenApiCtxt::from_compiled(data).map(Into::into)
+    }
 }
 
 impl From<DefaultGenApiCtxt> for NoCacheGenApiCtxt {
@@ -386,6 +581,9 @@ impl GenApiCtxt for SharedNoCacheGenApiCtxt {
     fn node_store(&self) -> &Self::NS {
         &self.node_store
     }
+
+    /// Nothing is cached.
+    fn invalidate_chunk_registers(&mut self) {}
 }
 
 impl FromXml for SharedNoCacheGenApiCtxt {
@@ -395,6 +593,10 @@ impl FromXml for SharedNoCacheGenApiCtxt {
     {
         Ok(NoCacheGenApiCtxt::from_xml(xml)?.into())
     }
+
+    fn from_compiled(data: &[u8]) -> Option<Self> {
+        DefaultGenApiCtxt::from_compiled(data).map(Into::into)
+    }
 }
 
 impl From<NoCacheGenApiCtxt> for SharedNoCacheGenApiCtxt {
@@ -414,6 +616,74 @@ impl From<DefaultGenApiCtxt> for SharedNoCacheGenApiCtxt {
     }
 }
 
+/// `GenApi` context which parses each node of the xml the first time it's used.
+///
+/// Building the context only indexes the xml, so loading the context of a device with a large
+/// xml is fast when only a few features are used. Values are cached like [`DefaultGenApiCtxt`].
+///
+/// # Examples
+/// ```rust
+/// use cameleon::{genapi::LazyGenApiCtxt, u3v, Camera};
+/// # let mut cameras = u3v::enumerate_cameras().unwrap();
+/// # if cameras.is_empty() {
+/// #     return;
+/// # }
+/// let camera = cameras.pop().unwrap();
+/// let mut camera: Camera<_, _, LazyGenApiCtxt> =
+///     Camera::new(camera.ctrl, camera.strm, None, camera.info);
+/// camera.open().unwrap();
+/// camera.load_context().unwrap();
+/// ```
+#[derive(Debug)]
+pub struct LazyGenApiCtxt {
+    /// Node store.
+    pub node_store: store::LazyNodeStore,
+    /// Value context.
+    pub value_ctxt: ValueCtxt<store::LazyValueStore, store::LazyCacheStore>,
+    /// Register description.
+    pub reg_desc: RegisterDescription,
+    chunk_registers: ChunkRegisters,
+}
+
+impl GenApiCtxt for LazyGenApiCtxt {
+    type NS = store::LazyNodeStore;
+    type VS = store::LazyValueStore;
+    type CS = store::LazyCacheStore;
+
+    fn enter<F, R>(&mut self, f: F) -> R
+    where
+        F: FnOnce(&Self::NS, &mut ValueCtxt<Self::VS, Self::CS>) -> R,
+    {
+        f(&self.node_store, &mut self.value_ctxt)
+    }
+
+    fn node_store(&self) -> &Self::NS {
+        &self.node_store
+    }
+
+    fn invalidate_chunk_registers(&mut self) {
+        self.chunk_registers
+            .invalidate(&self.node_store, &mut self.value_ctxt);
+    }
+}
+
+impl FromXml for LazyGenApiCtxt {
+    fn from_xml(xml: &impl AsRef<str>) -> ControlResult<Self>
+    where
+        Self: Sized + GenApiCtxt,
+    {
+        let (reg_desc, node_store, value_ctxt) = GenApiBuilder::<DefaultNodeStore>::default()
+            .build_on_demand(xml.as_ref())
+            .map_err(|e| ControlError::InvalidData(e.into()))?;
+        Ok(Self {
+            node_store,
+            value_ctxt,
+            reg_desc,
+            chunk_registers: ChunkRegisters::default(),
+        })
+    }
+}
+
 /// Represents `CompressionType` of `GenICam` XML file on the device's memory.
 #[derive(Debug, Clone, Copy)]
 pub enum CompressionType {
@@ -462,4 +732,24 @@ where
         })?;
         Ok(self.inner.write(address, data)?)
     }
+
+    fn read_mem_stacked(
+        &mut self,
+        entries: &mut [(i64, &mut [u8])],
+    ) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
+        let mut converted = Vec::with_capacity(entries.len());
+        for (address, buf) in entries.iter_mut() {
+            let address: u64 = (*address).try_into().map_err(|_| {
+                ControlError::InvalidData(
+                    "invalid address: the given address has negative value".into(),
+                )
+            })?;
+            converted.push((address, &mut **buf));
+        }
+        Ok(self.inner.read_stacked(&mut converted)?)
+    }
+
+    fn chunk_data(&self, chunk_id: u64) -> Option<&[u8]> {
+        self.inner.chunk_data(chunk_id)
+    }
 }
@@ -0,0 +1,180 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! This module contains background refresh of nodes declaring `PollingTime`.
+//!
+//! `NoCache` registers such as `DeviceTemperature` are read from the device on every access.
+//! [`Poller`] refreshes the nodes at the interval declared by their `PollingTime` in a background
+//! thread, batching all nodes due at the same time into one stacked read, so that readers get a
+//! recent value from the cache without accessing the device.
+//!
+//! # Examples
+//! ```no_run
+//! use cameleon::{
+//!     genapi::SharedDefaultGenApiCtxt,
+//!     u3v::{self, SharedControlHandle, StreamHandle},
+//!     Camera,
+//! };
+//!
+//! let mut cameras = u3v::enumerate_cameras().unwrap();
+//! let mut camera: Camera<SharedControlHandle, StreamHandle, SharedDefaultGenApiCtxt> =
+//!     cameras.pop().unwrap().convert_into();
+//! camera.open().unwrap();
+//! camera.load_context().unwrap();
+//!
+//! let poller = camera.ctxt.as_ref().unwrap().start_polling(camera.ctrl.clone());
+//! let mut params_ctxt = camera.params_ctxt().unwrap();
+//! let temperature = params_ctxt
+//!     .node("DeviceTemperature")
+//!     .unwrap()
+//!     .as_float(&params_ctxt)
+//!     .unwrap();
+//! // Answered from the cache while the poller is running.
+//! println!("{}", temperature.value(&mut params_ctxt).unwrap());
+//! poller.stop();
+//! ```
+
+use std::{
+    sync::mpsc,
+    thread::JoinHandle,
+    time::{Duration, Instant},
+};
+
+use tracing::warn;
+
+use super::{GenApiDevice, NodeId, SharedDefaultGenApiCtxt};
+use crate::DeviceControl;
+
+/// Handle of the background thread refreshing nodes declaring `PollingTime`.
+///
+/// The thread stops when the handle is dropped. The cache of the polled registers is invalidated
+/// on stop, so that `NoCache` registers are read from the device again.
+pub struct Poller {
+    stop_tx: Option<mpsc::Sender<()>>,
+    join_handle: Option<JoinHandle<()>>,
+}
+
+impl Poller {
+    pub(super) fn spawn<Ctrl>(ctxt: SharedDefaultGenApiCtxt, ctrl: Ctrl) -> Self
+    where
+        Ctrl: DeviceControl + Send + 'static,
+    {
+        let (stop_tx, stop_rx) = mpsc::channel();
+        let polling_loop = PollingLoop::new(ctxt, ctrl, stop_rx);
+        let join_handle = std::thread::spawn(move || polling_loop.run());
+        Self {
+            stop_tx: Some(stop_tx),
+            join_handle: Some(join_handle),
+        }
+    }
+
+    /// Stops the thread and waits for it to exit.
+    pub fn stop(mut self) {
+        self.stop_impl();
+    }
+
+    fn stop_impl(&mut self) {
+        // Dropping the sender wakes the thread up immediately.
+        self.stop_tx.take();
+        if let Some(join_handle) = self.join_handle.take() {
+            if join_handle.join().is_err() {
+                warn!("polling loop panicked");
+            }
+        }
+    }
+}
+
+impl Drop for Poller {
+    fn drop(&mut self) {
+        self.stop_impl();
+    }
+}
+
+impl std::fmt::Debug for Poller {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("Poller")
+            .field("is_running", &self.join_handle.is_some())
+            .finish()
+    }
+}
+
+struct Schedule {
+    nid: NodeId,
+    interval: Duration,
+    next: Instant,
+}
+
+struct PollingLoop<Ctrl> {
+    ctxt: SharedDefaultGenApiCtxt,
+    ctrl: Ctrl,
+    stop_rx: mpsc::Receiver<()>,
+    schedules: Vec<Schedule>,
+}
+
+impl<Ctrl: DeviceControl> PollingLoop<Ctrl> {
+    fn new(ctxt: SharedDefaultGenApiCtxt, ctrl: Ctrl, stop_rx: mpsc::Receiver<()>) -> Self {
+        let now = Instant::now();
+        let schedules = cameleon_genapi::polling_nodes(&*ctxt.node_store)
+            .into_iter()
+            .map(|(nid, polling_time)| Schedule {
+                nid,
+                interval: Duration::from_millis(polling_time),
+                next: now,
+            })
+            .collect();
+        Self {
+            ctxt,
+            ctrl,
+            stop_rx,
+            schedules,
+        }
+    }
+
+    fn run(mut self) {
+        if self.schedules.is_empty() {
+            return;
+        }
+
+        loop {
+            let now = Instant::now();
+            let mut due = vec![];
+            for schedule in &mut self.schedules {
+                if schedule.next <= now {
+                    due.push(schedule.nid);
+                    // Skip missed ticks instead of bursting to catch up.
+                    schedule.next += schedule.interval;
+                    if schedule.next <= now {
+                        schedule.next = now + schedule.interval;
+                    }
+                }
+            }
+            if !due.is_empty() {
+                self.refresh(due);
+            }
+
+            let next = self.schedules.iter().map(|s| s.next).min().unwrap();
+            match self
+                .stop_rx
+                .recv_timeout(next.saturating_duration_since(Instant::now()))
+            {
+                Err(mpsc::RecvTimeoutError::Timeout) => {}
+                _ => break,
+            }
+        }
+
+        let nodes = self.schedules.iter().map(|s| s.nid);
+        let mut value_ctxt = self.ctxt.value_ctxt.lock().unwrap();
+        cameleon_genapi::invalidate_registers(nodes, &*self.ctxt.node_store, &mut value_ctxt);
+    }
+
+    fn refresh(&mut self, nodes: Vec<NodeId>) {
+        let mut device = GenApiDevice::new(&mut self.ctrl);
+        let mut value_ctxt = self.ctxt.value_ctxt.lock().unwrap();
+        if let Err(e) =
+            cameleon_genapi::refresh(nodes, &mut device, &*self.ctxt.node_store, &mut value_ctxt)
+        {
+            warn!("failed to refresh polled nodes: {}", e);
+        }
+    }
+}
@@ -1,56 +1,279 @@
 //! This module contains a unified C API that can be shared between Cameleon and Aravis.
+//!
+//! Frames are handed out as [`GenicamFrame`] which borrows the payload buffer of the stream, so
+//! the image is never copied nor allocated across the FFI boundary. A frame acquired by
+//! [`genicam_frame_acquire`] must be returned by [`genicam_frame_release`], otherwise its buffer
+//! can't be reused by the stream.
+
+use std::{ptr, sync::Mutex, thread::JoinHandle, time::Instant};
 
 use libc::{c_double, c_int, c_void};
-use std::ptr;
-use crate::u3v;
-use crate::u3v::ControlHandle;
-use crate::u3v::StreamHandle;
-use crate::camera::Camera;
+
+use crate::{
+    camera::{Camera, PayloadStream},
+    genapi::{DefaultGenApiCtxt, ParamsCtxt},
+    payload::{Payload, PayloadReceiver},
+    u3v::{self, ControlHandle, StreamHandle},
+    CameleonError, CameleonResult, StreamError,
+};
+
+/// The call succeeded.
+pub const GENICAM_OK: c_int = 0;
+/// The call failed, e.g. communication with the camera failed.
+pub const GENICAM_ERROR: c_int = -1;
+/// An argument is null or invalid.
+pub const GENICAM_INVALID_ARGUMENT: c_int = -2;
+/// The camera is not streaming, or is streaming in the other mode.
+pub const GENICAM_NOT_STREAMING: c_int = -3;
+/// The camera is already streaming, or frames of the previous streaming are not released yet.
+pub const GENICAM_BUSY: c_int = -4;
+/// No frame has been received yet.
+pub const GENICAM_NO_FRAME: c_int = -5;
+/// All buffers are held by the caller. Release a frame to acquire the next one.
+pub const GENICAM_NO_BUFFER: c_int = -6;
 
 /// Genicam opaque camera descriptor.
 #[repr(C)]
 pub struct GenicamCamera {
     camera: Camera<ControlHandle, StreamHandle>,
+    /// Origin of `host_timestamp_ns` of frames.
+    epoch: Instant,
+    /// Receiver of frames in the polling mode.
+    receiver: Option<PayloadReceiver>,
+    /// Payloads borrowed by the caller, indexed by `GenicamFrame::slot`. Allocated when streaming
+    /// starts, so acquiring a frame doesn't allocate.
+    frames: Vec<Option<Payload>>,
+    /// Thread calling the callback in the callback mode.
+    callback_thread: Option<JoinHandle<()>>,
+}
+
+/// A frame borrowed from the stream.
+///
+/// `data` points to the payload buffer, which is valid until the frame is released. Image fields
+/// are zero if the payload has no image.
+#[repr(C)]
+#[derive(Debug)]
+pub struct GenicamFrame {
+    /// Pointer to the image, or to the whole payload if the payload has no image.
+    pub data: *const u8,
+    /// Size of `data` in bytes.
+    pub size: usize,
+    /// Width of the image.
+    pub width: usize,
+    /// Height of the image.
+    pub height: usize,
+    /// X offset of the image in pixels.
+    pub x_offset: usize,
+    /// Y offset of the image in pixels.
+    pub y_offset: usize,
+    /// PFNC value of the pixel format of the image.
+    pub pixel_format: u32,
+    /// Block ID of the payload sent by the device.
+    pub frame_id: u64,
+    /// Device timestamp in nanoseconds.
+    pub timestamp_ns: u64,
+    /// Host time when the frame was completely received, in nanoseconds since the camera was
+    /// opened. Zero if the stream doesn't record host timestamps.
+    pub host_timestamp_ns: u64,
+    /// Slot of the frame in the camera, which is used by [`genicam_frame_release`].
+    pub slot: usize,
+}
+
+impl GenicamFrame {
+    fn new(payload: &Payload, epoch: Instant, slot: usize) -> Self {
+        let (data, image_info) = match (payload.image(), payload.image_info()) {
+            (Some(image), Some(image_info)) => (image, Some(image_info)),
+            _ => (payload.payload(), None),
+        };
+        let host_timestamp_ns = payload.host_timestamp().map_or(0, |ts| {
+            ts.trailer.saturating_duration_since(epoch).as_nanos() as u64
+        });
+
+        Self {
+            data: data.as_ptr(),
+            size: data.len(),
+            width: image_info.map_or(0, |info| info.width),
+            height: image_info.map_or(0, |info| info.height),
+            x_offset: image_info.map_or(0, |info| info.x_offset),
+            y_offset: image_info.map_or(0, |info| info.y_offset),
+            pixel_format: image_info.map_or(0, |info| info.pixel_format.into()),
+            frame_id: payload.id(),
+            timestamp_ns: payload.timestamp().as_nanos() as u64,
+            host_timestamp_ns,
+            slot,
+        }
+    }
+}
+
+/// Callback called with each frame in the callback mode.
+///
+/// The frame is valid only while the callback runs, and it's released when the callback returns.
+pub type GenicamFrameCallback = extern "C" fn(frame: *const GenicamFrame, user_data: *mut c_void);
+
+/// User data passed to the callback on the callback thread.
+struct UserData(*mut c_void);
+
+// Safety: The caller of `genicam_start_callback` guarantees that the user data can be used from
+// the callback thread.
+unsafe impl Send for UserData {}
+
+impl GenicamCamera {
+    /// Opens `camera` and loads its `GenApi` context.
+    fn open(mut camera: Camera<ControlHandle, StreamHandle>) -> Option<Self> {
+        if camera.open().is_err() || camera.load_context().is_err() {
+            camera.close().ok();
+            return None;
+        }
+
+        Some(Self {
+            camera,
+            epoch: Instant::now(),
+            receiver: None,
+            frames: vec![],
+            callback_thread: None,
+        })
+    }
+
+    fn configure(&mut self, width: c_int, height: c_int, fps: c_double) -> CameleonResult<()> {
+        let mut ctxt = self.camera.params_ctxt()?;
+        if width > 0 {
+            set_integer(&mut ctxt, "Width", width.into())?;
+        }
+        if height > 0 {
+            set_integer(&mut ctxt, "Height", height.into())?;
+        }
+        if fps > 0.0 {
+            if let Some(enable) = ctxt.node("AcquisitionFrameRateEnable") {
+                if let Some(enable) = enable.as_boolean(&ctxt) {
+                    enable.set_value(&mut ctxt, true)?;
+                }
+            }
+            let rate = ["AcquisitionFrameRate", "AcquisitionFrameRateAbs"]
+                .iter()
+                .find_map(|name| ctxt.node(name).and_then(|node| node.as_float(&ctxt)))
+                .ok_or_else(|| {
+                    CameleonError::InvalidGenApiXml("missing AcquisitionFrameRate".into())
+                })?;
+            rate.set_value(&mut ctxt, fps)?;
+        }
+        Ok(())
+    }
+
+    fn start(&mut self, buffer_count: usize) -> CameleonResult<PayloadReceiver> {
+        if self.camera.strm.is_loop_running() || self.frames.iter().any(Option::is_some) {
+            return Err(StreamError::InStreaming.into());
+        }
+
+        self.camera.strm.params_mut().buffer_count = buffer_count;
+        let receiver = self.camera.start_streaming(buffer_count)?;
+        self.frames.clear();
+        self.frames.resize_with(buffer_count, || None);
+        Ok(receiver)
+    }
+
+    fn stop(&mut self) -> CameleonResult<()> {
+        // The receiver is closed by stopping streaming, which ends the callback thread.
+        let result = self.camera.stop_streaming();
+        if let Some(callback_thread) = self.callback_thread.take() {
+            callback_thread.join().ok();
+        }
+        self.receiver = None;
+        result
+    }
+}
+
+impl Drop for GenicamCamera {
+    fn drop(&mut self) {
+        self.stop().ok();
+        self.frames.clear();
+        self.camera.close().ok();
+    }
+}
+
+fn set_integer(
+    ctxt: &mut ParamsCtxt<&mut ControlHandle, &mut DefaultGenApiCtxt>,
+    name: &str,
+    value: i64,
+) -> CameleonResult<()> {
+    let node = ctxt
+        .node(name)
+        .and_then(|node| node.as_integer(ctxt))
+        .ok_or_else(|| CameleonError::InvalidGenApiXml(format!("missing {}", name).into()))?;
+    node.set_value(ctxt, value)?;
+    Ok(())
+}
+
+fn status<T>(result: CameleonResult<T>) -> c_int {
+    match result {
+        Ok(_) => GENICAM_OK,
+        Err(CameleonError::StreamError(StreamError::InStreaming)) => GENICAM_BUSY,
+        Err(_) => GENICAM_ERROR,
+    }
+}
+
+unsafe fn camera_mut<'a>(genicam_camera: *mut c_void) -> Option<&'a mut GenicamCamera> {
+    (genicam_camera as *mut GenicamCamera).as_mut()
+}
+
+/// Devices probed by the previous calls, so that only newly connected cameras are probed.
+static DEVICE_CACHE: Mutex<Option<u3v::DeviceCache>> = Mutex::new(None);
+
+fn enumerate_cameras() -> Vec<Camera<ControlHandle, StreamHandle>> {
+    let mut cache = DEVICE_CACHE
+        .lock()
+        .unwrap_or_else(|poisoned| poisoned.into_inner());
+    u3v::enumerate_cameras_with(cache.get_or_insert_with(u3v::DeviceCache::new)).unwrap_or_default()
 }
 
 /// Try to pick up a Genicam camera best matching the provided specification.
+///
+/// The camera is opened and configured to `width`, `height` and `fps` through `GenApi`. Zero or
+/// negative values of them mean any.
+///
+/// # Safety
+/// All arguments MUST be valid pointers.
 #[no_mangle]
-pub unsafe extern "C" fn genicam_new(vid: *const c_int, pid: *const c_int, width: *const c_int, height: *const c_int, fps: *const c_double) -> *mut c_void {
+pub unsafe extern "C" fn genicam_new(
+    vid: *const c_int,
+    pid: *const c_int,
+    width: *const c_int,
+    height: *const c_int,
+    fps: *const c_double,
+) -> *mut c_void {
     if vid.is_null() || pid.is_null() || width.is_null() || height.is_null() || fps.is_null() {
         return ptr::null_mut();
     }
 
-    // Logic to find and initialize a Genicam camera matching the specification
-    let cameras = u3v::enumerate_cameras().unwrap_or_default();
-    let camera = cameras.into_iter().find(|c| {
-        (vid.is_null() || i32::from(c.info.vid) == *vid) &&
-        (pid.is_null() || i32::from(c.info.pid) == *pid) //&&
-        //(width.is_null() || c.width == *width) &&
-        //(height.is_null() || c.height == *height) &&
-        //(fps.is_null() || c.fps == *fps)
-    });
+    // Cameras whose mode can't be configured to the specification are closed and skipped.
+    let camera = enumerate_cameras()
+        .into_iter()
+        .filter(|c| i32::from(c.info.vid) == *vid && i32::from(c.info.pid) == *pid)
+        .filter_map(GenicamCamera::open)
+        .find_map(|mut c| c.configure(*width, *height, *fps).is_ok().then_some(c));
 
-    if let Some(camera) = camera {
-        let genicam_camera = Box::new(GenicamCamera { camera });
-        Box::into_raw(genicam_camera) as *mut c_void
+    if let Some(genicam_camera) = camera {
+        Box::into_raw(Box::new(genicam_camera)) as *mut c_void
     } else {
         ptr::null_mut()
     }
 }
 
-/// Try to pick up the first available Genicam camera.
+/// Try to pick up the first available Genicam camera. The camera is opened.
 #[no_mangle]
 pub extern "C" fn genicam_new_any() -> *mut c_void {
-    let cameras = u3v::enumerate_cameras().unwrap_or_default();
-    if let Some(camera) = cameras.into_iter().next() {
-        let genicam_camera = Box::new(GenicamCamera { camera });
-        Box::into_raw(genicam_camera) as *mut c_void
+    let camera = enumerate_cameras()
+        .into_iter()
+        .find_map(GenicamCamera::open);
+    if let Some(genicam_camera) = camera {
+        Box::into_raw(Box::new(genicam_camera)) as *mut c_void
     } else {
         ptr::null_mut()
     }
 }
 
-/// Release the Genicam camera.
+/// Release the Genicam camera. Streaming is stopped and the camera is closed.
+///
+/// All frames acquired from the camera are invalidated.
 #[no_mangle]
 pub extern "C" fn genicam_release(genicam_camera: *mut c_void) {
     if genicam_camera.is_null() {
@@ -60,3 +283,179 @@ pub extern "C" fn genicam_release(genicam_camera: *mut c_void) {
         drop(Box::from_raw(genicam_camera as *mut GenicamCamera));
     }
 }
+
+/// Configure the resolution and the frame rate of the camera through `GenApi`. Zero or negative
+/// values mean unchanged.
+///
+/// # Safety
+/// `genicam_camera` MUST be a camera returned by `genicam_new` or `genicam_new_any`.
+#[no_mangle]
+pub unsafe extern "C" fn genicam_configure(
+    genicam_camera: *mut c_void,
+    width: c_int,
+    height: c_int,
+    fps: c_double,
+) -> c_int {
+    match camera_mut(genicam_camera) {
+        Some(camera) => status(camera.configure(width, height, fps)),
+        None => GENICAM_INVALID_ARGUMENT,
+    }
+}
+
+/// Start streaming with `buffer_count` pre-allocated payload buffers. Frames are acquired by
+/// [`genicam_frame_acquire`].
+///
+/// At most `buffer_count` frames can be held at once.
+///
+/// # Safety
+/// `genicam_camera` MUST be a camera returned by `genicam_new` or `genicam_new_any`.
+#[no_mangle]
+pub unsafe extern "C" fn genicam_start(genicam_camera: *mut c_void, buffer_count: usize) -> c_int {
+    let camera = match camera_mut(genicam_camera) {
+        Some(camera) if buffer_count > 0 => camera,
+        _ => return GENICAM_INVALID_ARGUMENT,
+    };
+
+    match camera.start(buffer_count) {
+        Ok(receiver) => {
+            camera.receiver = Some(receiver);
+            GENICAM_OK
+        }
+        Err(err) => status::<()>(Err(err)),
+    }
+}
+
+/// Start streaming with `buffer_count` pre-allocated payload buffers, and call `callback` with
+/// each frame on a thread of the library.
+///
+/// # Safety
+/// `genicam_camera` MUST be a camera returned by `genicam_new` or `genicam_new_any`.
+/// `user_data` MUST be usable from another thread until streaming is stopped.
+#[no_mangle]
+pub unsafe extern "C" fn genicam_start_callback(
+    genicam_camera: *mut c_void,
+    buffer_count: usize,
+    callback: Option<GenicamFrameCallback>,
+    user_data: *mut c_void,
+) -> c_int {
+    let (camera, callback) = match (camera_mut(genicam_camera), callback) {
+        (Some(camera), Some(callback)) if buffer_count > 0 => (camera, callback),
+        _ => return GENICAM_INVALID_ARGUMENT,
+    };
+
+    let receiver = match camera.start(buffer_count) {
+        Ok(receiver) => receiver,
+        Err(err) => return status::<()>(Err(err)),
+    };
+    let epoch = camera.epoch;
+    let user_data = UserData(user_data);
+    camera.callback_thread = Some(std::thread::spawn(move || {
+        let user_data = user_data;
+        loop {
+            match receiver.recv_blocking() {
+                Ok(payload) => {
+                    let frame = GenicamFrame::new(&payload, epoch, usize::MAX);
+                    callback(&frame, user_data.0);
+                    receiver.send_back(payload);
+                }
+                // The channel is closed when streaming is stopped.
+                Err(StreamError::ReceiveError(..)) => break,
+                Err(_) => continue,
+            }
+        }
+    }));
+
+    GENICAM_OK
+}
+
+/// Stop streaming.
+///
+/// Frames acquired before stopping stay valid until they are released, and streaming can't be
+/// started again until all of them are released.
+///
+/// # Safety
+/// `genicam_camera` MUST be a camera returned by `genicam_new` or `genicam_new_any`.
+#[no_mangle]
+pub unsafe extern "C" fn genicam_stop(genicam_camera: *mut c_void) -> c_int {
+    match camera_mut(genicam_camera) {
+        Some(camera) => status(camera.stop()),
+        None => GENICAM_INVALID_ARGUMENT,
+    }
+}
+
+/// Acquire the next frame started by [`genicam_start`] into `frame`.
+///
+/// If `wait` is zero, returns `GENICAM_NO_FRAME` immediately when no frame has been received,
+/// otherwise blocks until a frame is received.
+///
+/// # Safety
+/// `genicam_camera` MUST be a camera returned by `genicam_new` or `genicam_new_any`, and `frame`
+/// MUST be a valid pointer.
+#[no_mangle]
+pub unsafe extern "C" fn genicam_frame_acquire(
+    genicam_camera: *mut c_void,
+    frame: *mut GenicamFrame,
+    wait: c_int,
+) -> c_int {
+    let camera = match camera_mut(genicam_camera) {
+        Some(camera) if !frame.is_null() => camera,
+        _ => return GENICAM_INVALID_ARGUMENT,
+    };
+    let receiver = match &camera.receiver {
+        Some(receiver) => receiver,
+        None => return GENICAM_NOT_STREAMING,
+    };
+    let slot = match camera.frames.iter().position(Option::is_none) {
+        Some(slot) => slot,
+        None => return GENICAM_NO_BUFFER,
+    };
+
+    loop {
+        let received = if wait == 0 {
+            receiver.try_recv()
+        } else {
+            receiver.recv_blocking()
+        };
+        match received {
+            Ok(payload) => {
+                frame.write(GenicamFrame::new(&payload, camera.epoch, slot));
+                camera.frames[slot] = Some(payload);
+                return GENICAM_OK;
+            }
+            // The channel is closed once the streaming loop stops, which a polling caller must
+            // tell from an empty channel.
+            Err(StreamError::ReceiveError(..)) if wait == 0 && !receiver.is_closed() => {
+                return GENICAM_NO_FRAME
+            }
+            Err(StreamError::ReceiveError(..)) => return GENICAM_NOT_STREAMING,
+            // A broken payload is skipped.
+            Err(_) => continue,
+        }
+    }
+}
+
+/// Release the frame acquired by [`genicam_frame_acquire`], so that its buffer is reused by the
+/// stream.
+///
+/// # Safety
+/// `genicam_camera` MUST be a camera returned by `genicam_new` or `genicam_new_any`, and `frame`
+/// MUST be a frame acquired from it.
+#[no_mangle]
+pub unsafe extern "C" fn genicam_frame_release(
+    genicam_camera: *mut c_void,
+    frame: *const GenicamFrame,
+) -> c_int {
+    let (camera, frame) = match (camera_mut(genicam_camera), frame.as_ref()) {
+        (Some(camera), Some(frame)) => (camera, frame),
+        _ => return GENICAM_INVALID_ARGUMENT,
+    };
+    match camera.frames.get_mut(frame.slot).and_then(Option::take) {
+        Some(payload) => {
+            if let Some(receiver) = &camera.receiver {
+                receiver.send_back(payload);
+            }
+            GENICAM_OK
+        }
+        None => GENICAM_INVALID_ARGUMENT,
+    }
+}
@@ -0,0 +1,749 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! This module contains low level device control implementation for `GigE Vision` device.
+
+use std::{
+    convert::TryInto,
+    io::Read,
+    sync::{
+        atomic::{AtomicU16, Ordering},
+        mpsc, Arc, Mutex,
+    },
+    thread::JoinHandle,
+    time::Duration,
+};
+
+use cameleon_device::gige::{
+    self,
+    protocol::{ack, cmd},
+    register_map::{bootstrap, privilege, stream_channel},
+};
+use tracing::{error, warn};
+
+use crate::{camera::DeviceControl, ControlError, ControlResult};
+
+/// Default timeout duration for transaction between device and host.
+const DEFAULT_TIMEOUT_DURATION: Duration = Duration::from_millis(200);
+
+/// The minimum interval of heartbeats, which is used for a device with a very short heartbeat
+/// timeout.
+const MINIMUM_HEARTBEAT_INTERVAL: Duration = Duration::from_millis(100);
+
+/// This handle provides low level API to read and write data from the device with `GVCP`.
+///
+/// While the handle is opened, it holds the control privilege of the device and keeps it by
+/// sending heartbeats from a background thread.
+///
+/// # Examples
+///
+/// ```no_run
+/// use cameleon::{Camera, DeviceControl};
+/// use cameleon::gige;
+///
+/// // Enumerates cameras on the network.
+/// let mut cameras = gige::enumerate_cameras().unwrap();
+///
+/// // If no camera is found, return.
+/// if cameras.is_empty() {
+///     return;
+/// }
+/// let mut camera = cameras.pop().unwrap();
+///
+/// // Opens the camera.
+/// camera.open().unwrap();
+///
+/// // Read 32 bytes of the model name from address 0x0068.
+/// let address = 0x0068;
+/// let mut buffer = vec![0; 32];
+/// camera.ctrl.read(address, &mut buffer).unwrap();
+/// ```
+pub struct ControlHandle {
+    inner: Arc<Mutex<Gvcp>>,
+    /// Device information.
+    info: gige::DeviceInfo,
+    /// Host port of the stream channel, which is set while [`StreamHandle`] is opened.
+    ///
+    /// [`StreamHandle`]: super::StreamHandle
+    stream_port: Arc<AtomicU16>,
+    heartbeat: Option<Heartbeat>,
+}
+
+impl ControlHandle {
+    /// Timeout duration of each transaction between device.
+    ///
+    /// NOTE: [`ControlHandle::read`] and [`ControlHandle::write`] may send multiple
+    /// requests in a single call. In that case, Timeout is reflected to each request.
+    #[must_use]
+    pub fn timeout_duration(&self) -> Duration {
+        self.inner.lock().unwrap().config.timeout_duration
+    }
+
+    /// Set timeout duration of each transaction between device.
+    ///
+    /// NOTE: [`ControlHandle::read`] and [`ControlHandle::write`] may send multiple
+    /// requests in a single call. In that case, Timeout is reflected to each request.
+    pub fn set_timeout_duration(&mut self, duration: Duration) {
+        self.inner.lock().unwrap().config.timeout_duration = duration;
+    }
+
+    /// The value determines how many times to resend a command when its ack is lost, or to wait
+    /// again when pending acknowledge is returned from the device.
+    #[must_use]
+    pub fn retry_count(&self) -> u16 {
+        self.inner.lock().unwrap().config.retry_count
+    }
+
+    /// Set the value determines how many times to resend a command when its ack is lost, or to
+    /// wait again when pending acknowledge is returned from the device.
+    pub fn set_retry_count(&mut self, count: u16) {
+        self.inner.lock().unwrap().config.retry_count = count;
+    }
+
+    /// Returns the device info of the handle.
+    pub fn device_info(&self) -> &gige::DeviceInfo {
+        &self.info
+    }
+
+    pub(super) fn new(info: &gige::DeviceInfo, stream_port: Arc<AtomicU16>) -> Self {
+        let channel = gige::ControlChannel::new(info.ip_address, info.interface_address);
+        Self {
+            inner: Arc::new(Mutex::new(Gvcp::new(channel))),
+            info: info.clone(),
+            stream_port,
+            heartbeat: None,
+        }
+    }
+
+    fn assert_open(&self) -> ControlResult<()> {
+        if self.is_opened() {
+            Ok(())
+        } else {
+            Err(ControlError::NotOpened)
+        }
+    }
+
+    fn read_url(&mut self, url_reg: (u64, u16)) -> ControlResult<XmlLocation> {
+        let mut buf = vec![0; url_reg.1 as usize];
+        self.read(url_reg.0, &mut buf)?;
+        let len = buf.iter().position(|&b| b == 0).unwrap_or(buf.len());
+        XmlLocation::parse(&String::from_utf8_lossy(&buf[..len]))
+    }
+
+    /// Returns the location of the device XML. The second URL is used if the first URL isn't
+    /// a local URL.
+    fn xml_location(&mut self) -> ControlResult<XmlLocation> {
+        match self.read_url(bootstrap::FIRST_URL) {
+            Ok(location) => Ok(location),
+            Err(err) => {
+                warn!(?err, "failed to use the first URL, try the second URL");
+                self.read_url(bootstrap::SECOND_URL)
+            }
+        }
+    }
+
+    fn stream_channel_register(reg: (u64, u16)) -> u64 {
+        // Only the first stream channel is used.
+        stream_channel::BASE + reg.0
+    }
+}
+
+macro_rules! unwrap_or_log {
+    ($expr:expr) => {{
+        match $expr {
+            Ok(v) => v,
+            Err(error) => {
+                error!(?error);
+                return Err(error.into());
+            }
+        }
+    }};
+}
+
+impl DeviceControl for ControlHandle {
+    fn open(&mut self) -> ControlResult<()> {
+        if self.is_opened() {
+            return Ok(());
+        }
+
+        let mut inner = self.inner.lock().unwrap();
+        unwrap_or_log!(inner.channel.open());
+        if let Err(err) = inner.write_reg(&[(
+            bootstrap::CONTROL_CHANNEL_PRIVILEGE.0 as u32,
+            privilege::CONTROL_ACCESS,
+        )]) {
+            error!(?err, "failed to take the control privilege");
+            inner.channel.close().ok();
+            return Err(err);
+        }
+
+        // Send heartbeats well before the device releases the privilege.
+        let heartbeat_timeout = match inner.read_reg(&[bootstrap::HEARTBEAT_TIMEOUT.0 as u32]) {
+            Ok(values) => Duration::from_millis(values[0].into()),
+            Err(err) => {
+                warn!(?err, "failed to read heartbeat timeout, use the default");
+                Duration::from_millis(3000)
+            }
+        };
+        drop(inner);
+        let interval = std::cmp::max(heartbeat_timeout / 3, MINIMUM_HEARTBEAT_INTERVAL);
+        self.heartbeat = Some(Heartbeat::start(self.inner.clone(), interval));
+
+        Ok(())
+    }
+
+    fn is_opened(&self) -> bool {
+        self.inner.lock().unwrap().channel.is_opened()
+    }
+
+    fn close(&mut self) -> ControlResult<()> {
+        if let Some(heartbeat) = self.heartbeat.take() {
+            heartbeat.stop();
+        }
+
+        let mut inner = self.inner.lock().unwrap();
+        if inner.channel.is_opened() {
+            // Release the privilege so that other applications can control the device
+            // immediately.
+            if let Err(err) = inner.write_reg(&[(bootstrap::CONTROL_CHANNEL_PRIVILEGE.0 as u32, 0)])
+            {
+                warn!(?err, "failed to release the control privilege");
+            }
+            unwrap_or_log!(inner.channel.close());
+        }
+        Ok(())
+    }
+
+    fn read(&mut self, address: u64, buf: &mut [u8]) -> ControlResult<()> {
+        unwrap_or_log!(self.assert_open());
+        let address: u32 = unwrap_or_log!(address_of(address, buf.len()));
+        let mut inner = self.inner.lock().unwrap();
+
+        if buf.len() == 4 && address & 0b11 == 0 {
+            let value = unwrap_or_log!(inner.read_reg(&[address]))[0];
+            buf.copy_from_slice(&value.to_be_bytes());
+            return Ok(());
+        }
+
+        // `READMEM_CMD` requires an aligned address and length.
+        let (start, aligned_len) = aligned_range(address, buf.len());
+        if start == address && aligned_len == buf.len() {
+            return inner.read_mem(address, buf);
+        }
+        let mut aligned = vec![0; aligned_len];
+        unwrap_or_log!(inner.read_mem(start, &mut aligned));
+        let offset = (address - start) as usize;
+        buf.copy_from_slice(&aligned[offset..offset + buf.len()]);
+        Ok(())
+    }
+
+    fn write(&mut self, address: u64, data: &[u8]) -> ControlResult<()> {
+        unwrap_or_log!(self.assert_open());
+        let address: u32 = unwrap_or_log!(address_of(address, data.len()));
+        let mut inner = self.inner.lock().unwrap();
+
+        if data.len() == 4 && address & 0b11 == 0 {
+            let value = u32::from_be_bytes(data.try_into().unwrap());
+            return inner.write_reg(&[(address, value)]);
+        }
+
+        let (start, aligned_len) = aligned_range(address, data.len());
+        if start == address && aligned_len == data.len() {
+            return inner.write_mem(address, data);
+        }
+        // Read-modify-write the aligned range.
+        let mut aligned = vec![0; aligned_len];
+        unwrap_or_log!(inner.read_mem(start, &mut aligned));
+        let offset = (address - start) as usize;
+        aligned[offset..offset + data.len()].copy_from_slice(data);
+        inner.write_mem(start, &aligned)
+    }
+
+    /// Reads 4 bytes aligned entries with as few `READREG_CMD`s as possible. Other entries are read
+    /// by [`DeviceControl::read`].
+    fn read_stacked(&mut self, entries: &mut [(u64, &mut [u8])]) -> ControlResult<()> {
+        unwrap_or_log!(self.assert_open());
+
+        let mut idx = 0;
+        while idx < entries.len() {
+            let start = idx;
+            while idx < entries.len()
+                && idx - start < cmd::ReadReg::MAXIMUM_ENTRY_COUNT
+                && is_register(entries[idx].0, entries[idx].1.len())
+            {
+                idx += 1;
+            }
+
+            if start == idx {
+                let (address, buf) = &mut entries[idx];
+                self.read(*address, buf)?;
+                idx += 1;
+                continue;
+            }
+
+            let addresses: Vec<_> = entries[start..idx]
+                .iter()
+                .map(|(address, _)| *address as u32)
+                .collect();
+            let values = unwrap_or_log!(self.inner.lock().unwrap().read_reg(&addresses));
+            for ((_, buf), value) in entries[start..idx].iter_mut().zip(values) {
+                buf.copy_from_slice(&value.to_be_bytes());
+            }
+        }
+
+        Ok(())
+    }
+
+    /// Writes 4 bytes aligned entries with as few `WRITEREG_CMD`s as possible. Other entries are
+    /// written by [`DeviceControl::write`].
+    fn write_stacked(&mut self, entries: &[(u64, &[u8])]) -> ControlResult<()> {
+        unwrap_or_log!(self.assert_open());
+
+        let mut idx = 0;
+        while idx < entries.len() {
+            let start = idx;
+            while idx < entries.len()
+                && idx - start < cmd::WriteReg::MAXIMUM_ENTRY_COUNT
+                && is_register(entries[idx].0, entries[idx].1.len())
+            {
+                idx += 1;
+            }
+
+            if start == idx {
+                let (address, data) = entries[idx];
+                self.write(address, data)?;
+                idx += 1;
+                continue;
+            }
+
+            let regs: Vec<_> = entries[start..idx]
+                .iter()
+                .map(|(address, data)| {
+                    (
+                        *address as u32,
+                        u32::from_be_bytes((*data).try_into().unwrap()),
+                    )
+                })
+                .collect();
+            unwrap_or_log!(self.inner.lock().unwrap().write_reg(&regs));
+        }
+
+        Ok(())
+    }
+
+    fn genapi(&mut self) -> ControlResult<String> {
+        let location = unwrap_or_log!(self.xml_location());
+        let mut buf = vec![0; location.length];
+        unwrap_or_log!(self.read(location.address, &mut buf));
+
+        if location.is_zipped() {
+            Ok(unwrap_or_log!(unzip_xml(buf)))
+        } else {
+            Ok(String::from_utf8_lossy(&buf).into())
+        }
+    }
+
+    fn genapi_sha1_hash(&mut self) -> ControlResult<Option<[u8; 20]>> {
+        Ok(unwrap_or_log!(self.xml_location()).sha1)
+    }
+
+    /// Sets the destination of the stream channel to [`StreamHandle`], which opens the stream
+    /// channel.
+    ///
+    /// [`StreamHandle`]: super::StreamHandle
+    fn enable_streaming(&mut self) -> ControlResult<()> {
+        unwrap_or_log!(self.assert_open());
+        let port = self.stream_port.load(Ordering::Acquire);
+        if port == 0 {
+            let err = ControlError::InvalidDevice("the stream handle is not opened".into());
+            error!(?err);
+            return Err(err);
+        }
+
+        let mut inner = self.inner.lock().unwrap();
+        let host_address = unwrap_or_log!(inner.channel.local_addr()).ip().octets();
+        unwrap_or_log!(inner.write_reg(&[
+            (
+                Self::stream_channel_register(stream_channel::DESTINATION_ADDRESS) as u32,
+                u32::from_be_bytes(host_address),
+            ),
+            (
+                Self::stream_channel_register(stream_channel::PORT) as u32,
+                port.into(),
+            ),
+        ]));
+        Ok(())
+    }
+
+    /// Closes the stream channel by setting its host port to zero.
+    fn disable_streaming(&mut self) -> ControlResult<()> {
+        unwrap_or_log!(self.assert_open());
+        let mut inner = self.inner.lock().unwrap();
+        inner.write_reg(&[(
+            Self::stream_channel_register(stream_channel::PORT) as u32,
+            0,
+        )])
+    }
+}
+
+impl Drop for ControlHandle {
+    fn drop(&mut self) {
+        if let Err(e) = self.close() {
+            error!(?e)
+        }
+    }
+}
+
+impl From<ControlHandle> for Box<dyn DeviceControl> {
+    fn from(ctrl: ControlHandle) -> Self {
+        Box::new(ctrl)
+    }
+}
+
+/// `GVCP` transaction state shared with the heartbeat thread.
+struct Gvcp {
+    channel: gige::ControlChannel,
+    config: ConnectionConfig,
+    /// Request id of the next packet. 0 is reserved by the protocol.
+    next_req_id: u16,
+    /// Buffer for serializing/deserializing a packet.
+    buffer: Vec<u8>,
+}
+
+impl Gvcp {
+    fn new(channel: gige::ControlChannel) -> Self {
+        Self {
+            channel,
+            config: ConnectionConfig::default(),
+            next_req_id: 1,
+            buffer: Vec::new(),
+        }
+    }
+
+    fn read_reg(&mut self, addresses: &[u32]) -> ControlResult<Vec<u32>> {
+        let cmd = cmd::ReadReg::new(addresses.to_vec())?;
+        let ack: ack::ReadReg = self.send_cmd(cmd)?;
+        let values: Vec<_> = ack.values().collect();
+        if values.len() != addresses.len() {
+            return Err(ControlError::Io(anyhow::Error::msg(
+                "read reg failed: the number of values mismatch",
+            )));
+        }
+        Ok(values)
+    }
+
+    fn write_reg(&mut self, entries: &[(u32, u32)]) -> ControlResult<()> {
+        let cmd = cmd::WriteReg::new(entries.to_vec())?;
+        let ack: ack::WriteReg = self.send_cmd(cmd)?;
+        if ack.index as usize != entries.len() {
+            return Err(ControlError::Io(anyhow::Error::msg(
+                "write reg failed: the number of written registers mismatch",
+            )));
+        }
+        Ok(())
+    }
+
+    fn read_mem(&mut self, mut address: u32, buf: &mut [u8]) -> ControlResult<()> {
+        for buf_chunk in buf.chunks_mut(cmd::ReadMem::MAXIMUM_READ_LENGTH as usize) {
+            let read_len = buf_chunk.len() as u16;
+            let cmd = cmd::ReadMem::new(address, read_len)?;
+            let ack: ack::ReadMem = self.send_cmd(cmd)?;
+            if ack.data.len() != buf_chunk.len() {
+                return Err(ControlError::Io(anyhow::Error::msg(
+                    "read mem failed: read length mismatch",
+                )));
+            }
+            buf_chunk.copy_from_slice(ack.data);
+            address += u32::from(read_len);
+        }
+        Ok(())
+    }
+
+    fn write_mem(&mut self, mut address: u32, data: &[u8]) -> ControlResult<()> {
+        for chunk in data.chunks(cmd::WriteMem::MAXIMUM_DATA_LENGTH) {
+            let cmd = cmd::WriteMem::new(address, chunk)?;
+            let ack: ack::WriteMem = self.send_cmd(cmd)?;
+            if ack.index as usize != chunk.len() {
+                return Err(ControlError::Io(anyhow::Error::msg(
+                    "write mem failed: written length mismatch",
+                )));
+            }
+            address += chunk.len() as u32;
+        }
+        Ok(())
+    }
+
+    fn send_cmd<'a, T, U>(&'a mut self, cmd: T) -> ControlResult<U>
+    where
+        T: cmd::CommandScd,
+        U: ack::ParseScd<'a>,
+    {
+        let req_id = self.next_req_id;
+        // Request id 0 is reserved.
+        self.next_req_id = self.next_req_id.checked_add(1).unwrap_or(1);
+
+        let cmd = cmd.finalize(req_id);
+        let cmd_len = cmd.cmd_len();
+        let ack_len = cmd.maximum_ack_len();
+        if self.buffer.len() < ack_len {
+            self.buffer.resize(ack_len, 0);
+        }
+        let mut cmd_buf = Vec::with_capacity(cmd_len);
+        cmd.serialize(&mut cmd_buf)?;
+
+        // UDP may lose either the command or the ack, so resend the command with the same
+        // request id on timeout. The device doesn't execute a resent command twice.
+        let mut retry_count = self.config.retry_count;
+        let mut recv_timeout = self.config.timeout_duration;
+        self.channel.send(&cmd_buf)?;
+        let recv_len = loop {
+            let recv_len = match self.channel.recv(&mut self.buffer, recv_timeout) {
+                Ok(len) => len,
+                Err(gige::Error::Timeout) if retry_count > 0 => {
+                    warn!(req_id, "ack timed out, resend the command");
+                    retry_count -= 1;
+                    recv_timeout = self.config.timeout_duration;
+                    self.channel.send(&cmd_buf)?;
+                    continue;
+                }
+                Err(err) => return Err(err.into()),
+            };
+
+            let ack = ack::AckPacket::parse(&self.buffer[..recv_len])?;
+            // An ack of a command which has already timed out may arrive late, skip it.
+            if ack.request_id() != req_id {
+                warn!(
+                    "skip stale ack: expected request id {}, but got {}",
+                    req_id,
+                    ack.request_id()
+                );
+                continue;
+            }
+
+            // The device sends the actual ack within the timeout of pending ack.
+            if ack.scd_kind() == ack::ScdKind::Pending {
+                let pending: ack::Pending = ack.scd_as()?;
+                recv_timeout = std::cmp::max(pending.timeout, self.config.timeout_duration);
+                continue;
+            }
+
+            let status = ack.status();
+            if !status.is_success() {
+                return Err(status_error(status));
+            }
+            break recv_len;
+        };
+
+        // `ack::AckPacket::parse` is a fast operation, so it's ok to call it again to avoid a
+        // lifetime problem.
+        Ok(ack::AckPacket::parse(&self.buffer[..recv_len])
+            .unwrap()
+            .scd_as()?)
+    }
+}
+
+fn status_error(status: ack::Status) -> ControlError {
+    match status.kind() {
+        ack::StatusKind::AccessDenied | ack::StatusKind::Busy => ControlError::Busy,
+        kind => ControlError::Io(anyhow::Error::msg(format!(
+            "invalid status: {:?}({:#X})",
+            kind,
+            status.code()
+        ))),
+    }
+}
+
+struct ConnectionConfig {
+    /// Timeout duration of each transaction between device.
+    timeout_duration: Duration,
+
+    /// The value determines how many times to resend a command whose ack is lost.
+    retry_count: u16,
+}
+
+impl Default for ConnectionConfig {
+    fn default() -> Self {
+        Self {
+            timeout_duration: DEFAULT_TIMEOUT_DURATION,
+            retry_count: 3,
+        }
+    }
+}
+
+/// Background thread which keeps the control privilege by reading the privilege register
+/// periodically.
+struct Heartbeat {
+    /// The thread exits when the sender is dropped.
+    cancel_tx: mpsc::Sender<()>,
+    join_handle: JoinHandle<()>,
+}
+
+impl Heartbeat {
+    fn start(inner: Arc<Mutex<Gvcp>>, interval: Duration) -> Self {
+        let (cancel_tx, cancel_rx) = mpsc::channel::<()>();
+        let join_handle = std::thread::spawn(move || {
+            while let Err(mpsc::RecvTimeoutError::Timeout) = cancel_rx.recv_timeout(interval) {
+                let mut inner = inner.lock().unwrap();
+                if let Err(err) = inner.read_reg(&[bootstrap::CONTROL_CHANNEL_PRIVILEGE.0 as u32]) {
+                    warn!(?err, "heartbeat failed");
+                }
+            }
+        });
+
+        Self {
+            cancel_tx,
+            join_handle,
+        }
+    }
+
+    fn stop(self) {
+        drop(self.cancel_tx);
+        if self.join_handle.join().is_err() {
+            error!("heartbeat thread panicked");
+        }
+    }
+}
+
+/// Location of the device XML described by a local URL, e.g.
+/// `Local:camera.zip;8000;1A2B?SchemaVersion=1.1.0&SHA1=...`, where the address and the length
+/// are hexadecimal.
+#[derive(Debug, Clone, PartialEq, Eq)]
+struct XmlLocation {
+    file_name: String,
+    address: u64,
+    length: usize,
+    sha1: Option<[u8; 20]>,
+}
+
+impl XmlLocation {
+    fn parse(url: &str) -> ControlResult<Self> {
+        let invalid = || ControlError::InvalidDevice(format!("invalid xml URL: {}", url).into());
+
+        let (scheme, rest) = url.split_once(':').ok_or_else(invalid)?;
+        if !scheme.eq_ignore_ascii_case("local") {
+            return Err(ControlError::InvalidDevice(
+                format!("xml URL other than local is not supported: {}", url).into(),
+            ));
+        }
+
+        let (location, query) = match rest.split_once('?') {
+            Some((location, query)) => (location, Some(query)),
+            None => (rest, None),
+        };
+        let mut parts = location.split(';');
+        let file_name = parts.next().ok_or_else(invalid)?.to_string();
+        let address = parts
+            .next()
+            .and_then(|s| u64::from_str_radix(s.trim_start_matches("0x"), 16).ok())
+            .ok_or_else(invalid)?;
+        let length = parts
+            .next()
+            .and_then(|s| usize::from_str_radix(s.trim_start_matches("0x"), 16).ok())
+            .ok_or_else(invalid)?;
+
+        let sha1 = query
+            .into_iter()
+            .flat_map(|query| query.split('&'))
+            .find_map(|param| param.strip_prefix("SHA1="))
+            .and_then(parse_sha1);
+
+        Ok(Self {
+            file_name,
+            address,
+            length,
+            sha1,
+        })
+    }
+
+    fn is_zipped(&self) -> bool {
+        self.file_name.to_ascii_lowercase().ends_with(".zip")
+    }
+}
+
+fn parse_sha1(hex: &str) -> Option<[u8; 20]> {
+    if hex.len() != 40 || !hex.is_ascii() {
+        return None;
+    }
+    let mut hash = [0; 20];
+    for (i, byte) in hash.iter_mut().enumerate() {
+        *byte = u8::from_str_radix(&hex[i * 2..i * 2 + 2], 16).ok()?;
+    }
+    Some(hash)
+}
+
+fn unzip_xml(buf: Vec<u8>) -> ControlResult<String> {
+    fn zip_err(err: impl std::fmt::Debug) -> ControlError {
+        ControlError::InvalidDevice(format!("zipped xml file is broken: {:?}", err).into())
+    }
+
+    let mut zip = zip::ZipArchive::new(std::io::Cursor::new(buf)).map_err(zip_err)?;
+    if zip.len() != 1 {
+        return Err(zip_err("more than one files in zipped GenApi XML"));
+    }
+    let mut file = zip.by_index(0).map_err(zip_err)?;
+    let mut xml = Vec::with_capacity(file.size().try_into()?);
+    file.read_to_end(&mut xml).map_err(zip_err)?;
+    Ok(String::from_utf8_lossy(&xml).into())
+}
+
+/// Converts `address` into 32 bit `GVCP` address.
+fn address_of(address: u64, len: usize) -> ControlResult<u32> {
+    if address + len as u64 > u64::from(u32::MAX) + 1 {
+        return Err(ControlError::InvalidData(
+            format!("address {:#X} is out of the 32 bit address space", address).into(),
+        ));
+    }
+    Ok(address as u32)
+}
+
+/// Returns the start and the length of the range aligned to 4 bytes which contains
+/// `address..address + len`.
+fn aligned_range(address: u32, len: usize) -> (u32, usize) {
+    let start = address & !0b11;
+    let end = (u64::from(address) + len as u64 + 0b11) & !0b11;
+    (start, (end - u64::from(start)) as usize)
+}
+
+fn is_register(address: u64, len: usize) -> bool {
+    len == 4 && address & 0b11 == 0 && address <= u64::from(u32::MAX)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_xml_location() {
+        let sha1 = "0123456789abcdef0123456789abcdef01234567";
+        let url = format!(
+            "Local:Camera_1_0.zip;8000;1a2b?SchemaVersion=1.1.0&SHA1={}",
+            sha1
+        );
+        let location = XmlLocation::parse(&url).unwrap();
+        assert_eq!(location.file_name, "Camera_1_0.zip");
+        assert_eq!(location.address, 0x8000);
+        assert_eq!(location.length, 0x1a2b);
+        assert!(location.is_zipped());
+        assert_eq!(location.sha1.unwrap()[..2], [0x01, 0x23]);
+
+        let location = XmlLocation::parse("local:camera.xml;0x10000;400").unwrap();
+        assert_eq!(location.address, 0x10000);
+        assert_eq!(location.length, 0x400);
+        assert!(!location.is_zipped());
+        assert!(location.sha1.is_none());
+
+        assert!(XmlLocation::parse("http://example.com/camera.xml").is_err());
+        assert!(XmlLocation::parse("Local:camera.xml;zz;400").is_err());
+        assert!(XmlLocation::parse("Local:camera.xml").is_err());
+    }
+
+    #[test]
+    fn test_aligned_range() {
+        assert_eq!(aligned_range(0x0200, 512), (0x0200, 512));
+        assert_eq!(aligned_range(0x0201, 2), (0x0200, 4));
+        assert_eq!(aligned_range(0x0203, 2), (0x0200, 8));
+        assert!(address_of(u64::from(u32::MAX) - 3, 4).is_ok());
+        assert!(address_of(u64::from(u32::MAX) - 3, 8).is_err());
+    }
+}
@@ -0,0 +1,126 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! This module provides low level API for `GigE Vision` compatible devices.
+//!
+//! The device is controlled with `GVCP` by [`ControlHandle`], and payloads are received with
+//! `GVSP` by [`StreamHandle`].
+//!
+//! # Examples
+//!
+//! ```no_run
+//! use cameleon::gige;
+//!
+//! // Enumerates cameras on the networks the host is connected to.
+//! let mut cameras = gige::enumerate_cameras().unwrap();
+//!
+//! // If no camera is found, return.
+//! if cameras.is_empty() {
+//!     return;
+//! }
+//!
+//! let mut camera = cameras.pop().unwrap();
+//! // Opens the camera.
+//! camera.open().unwrap();
+//! camera.load_context().unwrap();
+//!
+//! // Packet resend is tuned by stream parameters.
+//! camera.strm.params_mut().max_resend_requests = 5;
+//!
+//! let payload_rx = camera.start_streaming(3).unwrap();
+//! let payload = payload_rx.recv_blocking().unwrap();
+//! println!("{:?}", payload.image_info());
+//! payload_rx.send_back(payload);
+//!
+//! // Statistics of packets, e.g. resent and missing packets.
+//! println!("{:?}", camera.strm.stats().snapshot());
+//! camera.close().unwrap();
+//! ```
+#![allow(clippy::missing_panics_doc)]
+
+pub mod control_handle;
+pub mod stream_handle;
+pub mod stream_stats;
+
+pub use control_handle::ControlHandle;
+pub use stream_handle::{StreamHandle, StreamParams};
+pub use stream_stats::{StreamStats, StreamStatsSnapshot};
+
+pub use cameleon_device::gige::DeviceInfo;
+
+use std::{
+    sync::{atomic::AtomicU16, Arc},
+    time::Duration,
+};
+
+use cameleon_device::gige;
+
+use super::{
+    genapi::DefaultGenApiCtxt, CameleonResult, Camera, CameraInfo, ControlError, StreamError,
+};
+
+/// Enumerate all `GigE Vision` compatible cameras reachable from the host.
+///
+/// # Examples
+///
+/// ```no_run
+/// use cameleon::gige;
+///
+/// // Enumerate cameras on the networks.
+/// let mut cameras = gige::enumerate_cameras().unwrap();
+/// ```
+pub fn enumerate_cameras() -> CameleonResult<Vec<Camera<ControlHandle, StreamHandle>>> {
+    let devices = gige::enumerate_devices().map_err(ControlError::from)?;
+    Ok(devices.iter().map(camera_from_device).collect())
+}
+
+/// Enumerate all `GigE Vision` compatible cameras like [`enumerate_cameras`], waiting for
+/// answers of devices up to `timeout`.
+pub fn enumerate_cameras_with_timeout(
+    timeout: Duration,
+) -> CameleonResult<Vec<Camera<ControlHandle, StreamHandle>>> {
+    let devices = gige::enumerate_devices_with_timeout(timeout).map_err(ControlError::from)?;
+    Ok(devices.iter().map(camera_from_device).collect())
+}
+
+fn camera_from_device(dev: &DeviceInfo) -> Camera<ControlHandle, StreamHandle> {
+    let stream_port = Arc::new(AtomicU16::new(0));
+    let ctrl = ControlHandle::new(dev, stream_port.clone());
+    let strm = StreamHandle::new(dev, stream_port);
+    let ctxt = None;
+
+    let camera: Camera<ControlHandle, StreamHandle, DefaultGenApiCtxt> =
+        Camera::new(ctrl, strm, ctxt, camera_info(dev));
+    camera
+}
+
+fn camera_info(dev_info: &DeviceInfo) -> CameraInfo {
+    CameraInfo {
+        vendor_name: dev_info.vendor_name.clone(),
+        model_name: dev_info.model_name.clone(),
+        serial_number: dev_info.serial_number.clone(),
+        // `GigE Vision` devices don't have USB IDs.
+        vid: 0,
+        pid: 0,
+    }
+}
+
+impl From<gige::Error> for ControlError {
+    fn from(err: gige::Error) -> ControlError {
+        match &err {
+            gige::Error::Timeout => ControlError::Timeout,
+            gige::Error::InvalidDevice => ControlError::InvalidDevice(err.to_string().into()),
+            gige::Error::Io(_) | gige::Error::InvalidPacket(_) => ControlError::Io(err.into()),
+        }
+    }
+}
+
+impl From<gige::Error> for StreamError {
+    fn from(err: gige::Error) -> Self {
+        match &err {
+            gige::Error::Timeout => Self::Timeout,
+            _ => Self::Io(err.into()),
+        }
+    }
+}
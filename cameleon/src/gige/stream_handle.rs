@@ -0,0 +1,1310 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! This module contains low level streaming implementation for `GigE Vision` device.
+//!
+//! `GVSP` sends a block, i.e. a payload, as a leader packet, data packets and a trailer packet,
+//! whose packet IDs are `0`, `1..=N` and `N + 1` respectively. The streaming loop receives
+//! packets in batches and copies the data of each packet straight into the payload buffer at the
+//! offset derived from its packet ID, so packets don't need to arrive in order. Missing packets
+//! are requested again with `PACKETRESEND_CMD`.
+
+use std::{
+    collections::VecDeque,
+    convert::TryInto,
+    sync::{
+        atomic::{AtomicBool, AtomicU16, AtomicUsize, Ordering},
+        Arc,
+    },
+    thread::JoinHandle,
+    time::{Duration, Instant},
+};
+
+use cameleon_device::gige::{
+    self,
+    prelude::CommandScd,
+    protocol::{ack::StatusKind, cmd, stream as gvsp},
+    register_map::{bootstrap, stream_channel},
+};
+use tracing::{error, info, warn};
+
+use crate::{
+    camera::PayloadStream,
+    payload::{
+        acquire_payload_buf, ChunkLayout, HeapAllocator, HostTimestamp, ImageInfo, Payload,
+        PayloadBuffer, PayloadBufferPool, PayloadSender, PayloadType,
+    },
+    ControlResult, DeviceControl, StreamError, StreamResult,
+};
+
+use super::stream_stats::StreamStats;
+
+/// Length of IP and UDP headers, which are included in the packet size of the stream channel.
+const IP_UDP_HEADER_LENGTH: usize = 28;
+
+/// Maximum payload size accepted by the reassembly, to reject packets with corrupted IDs.
+const MAXIMUM_PAYLOAD_SIZE: usize = 1 << 30;
+
+/// Factor of the expected payload size up to which packet IDs of a block are accepted, which
+/// leaves a margin for a payload larger than expected.
+const PACKET_ID_MARGIN_FACTOR: usize = 2;
+
+/// Size of the payload buffer of the first block when [`StreamParams::payload_size`] is unknown.
+/// The buffer grows while the block is received.
+const INITIAL_PAYLOAD_BUFFER_SIZE: usize = 1 << 20;
+
+/// The number of finished block IDs remembered to ignore packets resent late.
+const FINISHED_BLOCK_HISTORY: usize = 16;
+
+/// Timeout of the socket while no block is in flight, which bounds the latency of stopping the
+/// loop.
+const IDLE_POLL_INTERVAL: Duration = Duration::from_millis(50);
+
+/// This type is used to receive stream packets from the device.
+pub struct StreamHandle {
+    /// Addresses of the device and the host interface which the device is found on.
+    device_address: std::net::Ipv4Addr,
+    interface_address: std::net::Ipv4Addr,
+    /// Bound while the handle is opened.
+    channel: Option<Arc<gige::StreamChannel>>,
+    /// Host port of the stream channel, shared with [`ControlHandle`] to set the destination of
+    /// the stream channel in the device.
+    ///
+    /// [`ControlHandle`]: super::ControlHandle
+    stream_port: Arc<AtomicU16>,
+    /// Parameters for streaming.
+    params: StreamParams,
+    streaming_loop: Option<LoopHandle>,
+    /// Payload size of the largest block received, which is used to allocate payload buffers in
+    /// the following streaming.
+    payload_size: Arc<AtomicUsize>,
+    /// Statistics of the streaming loop, accumulated across streaming sessions.
+    stats: Arc<StreamStats>,
+}
+
+impl StreamHandle {
+    pub(super) fn new(info: &gige::DeviceInfo, stream_port: Arc<AtomicU16>) -> Self {
+        Self {
+            device_address: info.ip_address,
+            interface_address: info.interface_address,
+            channel: None,
+            stream_port,
+            params: StreamParams::default(),
+            streaming_loop: None,
+            payload_size: Arc::default(),
+            stats: Arc::default(),
+        }
+    }
+
+    /// Return params.
+    #[must_use]
+    pub fn params(&self) -> &StreamParams {
+        &self.params
+    }
+
+    ///  Return mutable params.
+    pub fn params_mut(&mut self) -> &mut StreamParams {
+        &mut self.params
+    }
+
+    /// Return statistics of the streaming loop.
+    ///
+    /// The returned value is updated while streaming, so it can be kept to scrape the statistics
+    /// periodically.
+    #[must_use]
+    pub fn stats(&self) -> Arc<StreamStats> {
+        self.stats.clone()
+    }
+
+    fn is_opened(&self) -> bool {
+        self.channel.is_some()
+    }
+}
+
+impl PayloadStream for StreamHandle {
+    fn open(&mut self) -> StreamResult<()> {
+        if self.is_opened() {
+            return Ok(());
+        }
+
+        let channel = gige::StreamChannel::bind(self.device_address, self.interface_address)
+            .map_err(|e| {
+                error!(?e);
+                StreamError::from(e)
+            })?;
+
+        // A large socket buffer absorbs bursts of packets while the loop is busy.
+        let requested = self.params.recv_buffer_size;
+        match channel.set_recv_buffer_size(requested) {
+            Ok(size) if size != 0 && size < requested => warn!(
+                requested,
+                size, "socket receive buffer is capped by the system, e.g. `net.core.rmem_max`"
+            ),
+            Ok(_) => {}
+            Err(err) => warn!(?err, "failed to set socket receive buffer size"),
+        }
+
+        let port = channel.local_addr()?.port();
+        self.channel = Some(Arc::new(channel));
+        self.stream_port.store(port, Ordering::Release);
+        Ok(())
+    }
+
+    fn close(&mut self) -> StreamResult<()> {
+        if self.is_loop_running() {
+            self.stop_streaming_loop()?;
+        }
+        self.stream_port.store(0, Ordering::Release);
+        self.channel = None;
+        Ok(())
+    }
+
+    fn start_streaming_loop(
+        &mut self,
+        sender: PayloadSender,
+        ctrl: &mut dyn DeviceControl,
+    ) -> StreamResult<()> {
+        if self.is_loop_running() {
+            return Err(StreamError::InStreaming);
+        }
+        let channel = self.channel.clone().ok_or_else(|| {
+            StreamError::Io(anyhow::Error::msg("the stream handle is not opened"))
+        })?;
+
+        let mut params = StreamParams::from_control(ctrl).map_err(|e| {
+            StreamError::Io(anyhow::Error::msg(format!(
+                "failed to setup streaming parameters: {}",
+                e
+            )))
+        })?;
+        // Host side parameters are not stored in the device, so carry them over.
+        params.copy_host_params(&self.params);
+        params.validate_packet_size()?;
+        self.params = params;
+
+        let payload_size = std::cmp::max(
+            self.params.payload_size,
+            self.payload_size.load(Ordering::Relaxed),
+        );
+        let buffer_pool =
+            PayloadBufferPool::new(HeapAllocator, payload_size, self.params.buffer_count);
+
+        let cancelled = Arc::new(AtomicBool::new(false));
+        let strm_loop = StreamingLoop {
+            channel,
+            reassembler: Reassembler::new(&self.params, payload_size),
+            params: self.params.clone(),
+            sender,
+            cancelled: cancelled.clone(),
+            buffer_pool,
+            payload_size: self.payload_size.clone(),
+            stats: self.stats.clone(),
+            resend_req_id: 1,
+            cmd_buf: vec![],
+        };
+        let join_handle = std::thread::spawn(|| {
+            strm_loop.run();
+        });
+        self.streaming_loop = Some(LoopHandle {
+            cancelled,
+            join_handle,
+        });
+
+        info!("start streaming loop successfully");
+        Ok(())
+    }
+
+    fn stop_streaming_loop(&mut self) -> StreamResult<()> {
+        if let Some(streaming_loop) = self.streaming_loop.take() {
+            streaming_loop.cancelled.store(true, Ordering::SeqCst);
+            // The loop wakes up at least every `IDLE_POLL_INTERVAL` to check the cancellation.
+            streaming_loop.join_handle.join().map_err(|_| {
+                StreamError::Poisoned("streaming loop panicked before cancellation".into())
+            })?;
+        }
+
+        info!("stop streaming loop successfully");
+        Ok(())
+    }
+
+    fn is_loop_running(&self) -> bool {
+        self.streaming_loop.is_some()
+    }
+}
+
+/// Handle of the running [`StreamingLoop`].
+struct LoopHandle {
+    cancelled: Arc<AtomicBool>,
+    join_handle: JoinHandle<()>,
+}
+
+impl Drop for StreamHandle {
+    fn drop(&mut self) {
+        if let Err(e) = self.close() {
+            error!(?e)
+        }
+    }
+}
+
+impl From<StreamHandle> for Box<dyn PayloadStream> {
+    fn from(strm: StreamHandle) -> Self {
+        Box::new(strm)
+    }
+}
+
+struct StreamingLoop {
+    channel: Arc<gige::StreamChannel>,
+    reassembler: Reassembler,
+    params: StreamParams,
+    sender: PayloadSender,
+    cancelled: Arc<AtomicBool>,
+    /// `None` until the payload size is known.
+    buffer_pool: Option<PayloadBufferPool>,
+    payload_size: Arc<AtomicUsize>,
+    stats: Arc<StreamStats>,
+    /// Request ID of the next `PACKETRESEND_CMD`. 0 is reserved by the protocol.
+    resend_req_id: u16,
+    /// Buffer to serialize `PACKETRESEND_CMD` into, reused across commands.
+    cmd_buf: Vec<u8>,
+}
+
+impl StreamingLoop {
+    fn run(mut self) {
+        let mut batch = gige::PacketBatch::new(
+            std::cmp::max(self.params.batch_size, 1),
+            self.params.packet_size,
+        );
+        let mut events = Events::default();
+
+        while !self.cancelled.load(Ordering::Relaxed) {
+            let timeout = if self.reassembler.is_idle() {
+                IDLE_POLL_INTERVAL
+            } else {
+                std::cmp::min(self.params.packet_timeout, IDLE_POLL_INTERVAL)
+            };
+
+            match self.channel.recv_batch(&mut batch, timeout) {
+                Ok(0) => {}
+                Ok(n) => {
+                    let bytes = batch.packets().map(<[u8]>::len).sum();
+                    self.stats.batch_received(n, bytes);
+                    let now = Instant::now();
+                    let (pool, sender) = (&self.buffer_pool, &self.sender);
+                    let mut acquire = |len| acquire_buf(pool, sender, len);
+                    for packet in batch.packets() {
+                        self.reassembler
+                            .push(packet, now, &mut acquire, &mut events);
+                    }
+                }
+                Err(err) => {
+                    warn!(?err);
+                    self.report_error(err.into());
+                    // Avoid a busy loop while the socket keeps failing.
+                    std::thread::sleep(IDLE_POLL_INTERVAL);
+                }
+            }
+
+            self.reassembler.poll_timeouts(Instant::now(), &mut events);
+            self.handle_events(&mut events);
+        }
+    }
+
+    fn handle_events(&mut self, events: &mut Events) {
+        for _ in 0..std::mem::take(&mut events.resent_packets) {
+            self.stats.packet_resent();
+        }
+        for _ in 0..std::mem::take(&mut events.invalid_packets) {
+            self.stats.packet_invalid();
+        }
+
+        for range in events.resends.drain(..) {
+            let cmd = cmd::PacketResend::new(
+                0,
+                range.block_id,
+                range.first_packet_id,
+                range.last_packet_id,
+                range.extended_id,
+            )
+            .finalize(self.resend_req_id);
+            self.resend_req_id = self.resend_req_id.checked_add(1).unwrap_or(1);
+
+            self.cmd_buf.clear();
+            let sent = cmd
+                .serialize(&mut self.cmd_buf)
+                .and_then(|()| self.channel.send_to_device(&self.cmd_buf));
+            match sent {
+                Ok(_) => self.stats.resend_requested(),
+                Err(err) => warn!(?err, "failed to send packet resend command"),
+            }
+        }
+
+        while let Some(mut block) = events.completed.pop() {
+            let result = block.build_payload(self.params.tick_frequency);
+            self.reassembler.recycle(block);
+            match result {
+                Ok(payload) => self.deliver(payload),
+                Err(err) => {
+                    warn!(?err);
+                    self.report_error(err);
+                }
+            }
+        }
+
+        while let Some(block) = events.incomplete.pop() {
+            let missing = block.missing_packets();
+            let err = StreamError::InvalidPayload(
+                format!(
+                    "block {} is incomplete: {} packets are missing",
+                    block.id, missing
+                )
+                .into(),
+            );
+            self.reassembler.recycle(block);
+            warn!(?err);
+            self.stats.frame_incomplete(missing as u64);
+            self.report_error(err);
+        }
+    }
+
+    /// Sends `payload` to the host with the backpressure policy of the sender, and grows the
+    /// buffer pool if the payload doesn't fit in its buffers.
+    fn deliver(&mut self, payload: Payload) {
+        let payload_size = payload.valid_payload_size;
+        if self.reassembler.expected_payload_size < payload_size {
+            self.reassembler.expected_payload_size = payload_size;
+            self.payload_size.fetch_max(payload_size, Ordering::Relaxed);
+            self.buffer_pool =
+                PayloadBufferPool::new(HeapAllocator, payload_size, self.params.buffer_count);
+        }
+
+        let dropped = self.sender.dropped_frames();
+        if let Err(err) = self.sender.send_with_policy(payload) {
+            warn!(?err);
+            return;
+        }
+        let now_dropped = self.sender.dropped_frames();
+        self.stats
+            .frames_dropped(now_dropped.total() - dropped.total());
+        // A frame evicted by `DropOldest` is not the one just sent.
+        if now_dropped.newest == dropped.newest
+            && now_dropped.deadline_exceeded == dropped.deadline_exceeded
+        {
+            self.stats.frame_delivered();
+        }
+    }
+
+    /// Records `err` in the statistics and sends it to the host.
+    fn report_error(&self, err: StreamError) {
+        self.stats.error();
+        self.sender.try_send(Err(err)).ok();
+    }
+}
+
+fn acquire_buf(
+    buffer_pool: &Option<PayloadBufferPool>,
+    sender: &PayloadSender,
+    len: usize,
+) -> PayloadBuffer {
+    match buffer_pool {
+        Some(pool) => acquire_payload_buf(pool, sender, len),
+        None => vec![0; len].into(),
+    }
+}
+
+/// Outputs of [`Reassembler`], which are handled by the streaming loop.
+#[derive(Default)]
+struct Events {
+    resends: Vec<ResendRange>,
+    completed: Vec<Block>,
+    incomplete: Vec<Block>,
+    resent_packets: usize,
+    invalid_packets: usize,
+}
+
+/// Range of packets to be requested by `PACKETRESEND_CMD`.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+struct ResendRange {
+    block_id: u64,
+    first_packet_id: u32,
+    last_packet_id: u32,
+    extended_id: bool,
+}
+
+/// Reassembles blocks from `GVSP` packets.
+struct Reassembler {
+    packet_size: usize,
+    packet_timeout: Duration,
+    block_timeout: Duration,
+    max_resend_requests: usize,
+    max_timeout_resends: usize,
+    max_inflight_blocks: usize,
+    /// Blocks in flight, from the oldest to the newest.
+    blocks: VecDeque<Block>,
+    /// Finished blocks kept to reuse their allocations.
+    spare_blocks: Vec<Block>,
+    /// IDs of recently finished blocks.
+    finished: VecDeque<u64>,
+    /// Size of the payload buffer acquired for a new block.
+    expected_payload_size: usize,
+}
+
+impl Reassembler {
+    fn new(params: &StreamParams, expected_payload_size: usize) -> Self {
+        Self {
+            packet_size: params.packet_size,
+            packet_timeout: params.packet_timeout,
+            block_timeout: params.block_timeout,
+            max_resend_requests: params.max_resend_requests,
+            max_timeout_resends: params.max_timeout_resends,
+            max_inflight_blocks: std::cmp::max(params.max_inflight_blocks, 1),
+            blocks: VecDeque::new(),
+            spare_blocks: vec![],
+            finished: VecDeque::with_capacity(FINISHED_BLOCK_HISTORY),
+            expected_payload_size,
+        }
+    }
+
+    fn is_idle(&self) -> bool {
+        self.blocks.is_empty()
+    }
+
+    fn push(
+        &mut self,
+        buf: &[u8],
+        now: Instant,
+        acquire: &mut impl FnMut(usize) -> PayloadBuffer,
+        events: &mut Events,
+    ) {
+        let packet = match gvsp::Packet::parse(buf) {
+            Ok(packet) => packet,
+            Err(err) => {
+                warn!(?err, "skip invalid packet");
+                events.invalid_packets += 1;
+                return;
+            }
+        };
+        let header = packet.header();
+        let status = header.status();
+        if !status.is_success() {
+            warn!(?status, "skip packet with error status");
+            events.invalid_packets += 1;
+            return;
+        }
+        if status.kind() == StatusKind::PacketResend {
+            events.resent_packets += 1;
+        }
+
+        let block_id = header.block_id();
+        if self.finished.contains(&block_id) {
+            // Late or duplicated resent packet.
+            return;
+        }
+        let data_size = self
+            .packet_size
+            .saturating_sub(IP_UDP_HEADER_LENGTH + header.len());
+        let packet_id = header.packet_id();
+        // A corrupted packet ID, e.g. of the trailer, would make the block wait for packets
+        // which never arrive.
+        if packet_id > self.max_packet_id(data_size) {
+            warn!(block_id, packet_id, "skip packet with out of range ID");
+            events.invalid_packets += 1;
+            return;
+        }
+
+        let idx = match self.blocks.iter().position(|block| block.id == block_id) {
+            Some(idx) => idx,
+            None => self.start_block(block_id, header.is_extended_id(), now, acquire, events),
+        };
+        let block = &mut self.blocks[idx];
+        if block.is_received(packet_id) {
+            return;
+        }
+        let accepted = match header.packet_format() {
+            gvsp::PacketFormat::Leader if packet_id == 0 => {
+                block.leader.clear();
+                block.leader.extend_from_slice(buf);
+                block.leader_at = now;
+                true
+            }
+            gvsp::PacketFormat::Trailer if packet_id != 0 && packet_id >= block.next_packet_id => {
+                block.trailer.clear();
+                block.trailer.extend_from_slice(buf);
+                block.trailer_id = Some(packet_id);
+                block.trailer_at = now;
+                true
+            }
+            gvsp::PacketFormat::Payload if packet_id != 0 => {
+                block.write_data(packet_id, packet.payload(), data_size, acquire)
+            }
+            _ => false,
+        };
+        if !accepted {
+            warn!(
+                block_id,
+                packet_id,
+                format = ?header.packet_format(),
+                "skip unexpected packet"
+            );
+            events.invalid_packets += 1;
+            return;
+        }
+
+        block.mark_received(packet_id, now);
+        // Packets are sent in order, so a skipped packet ID means the packet is lost.
+        if packet_id > block.next_packet_id && block.resend_requests < self.max_resend_requests {
+            block.resend_requests += 1;
+            events
+                .resends
+                .push(block.resend_range(block.next_packet_id, packet_id - 1));
+        }
+        block.next_packet_id = std::cmp::max(block.next_packet_id, packet_id + 1);
+
+        if block.is_completed() {
+            let block = self.blocks.remove(idx).unwrap();
+            self.finish(block.id);
+            events.completed.push(block);
+        }
+    }
+
+    /// Returns the largest packet ID of a block, i.e. the ID of the trailer of the largest
+    /// block accepted.
+    fn max_packet_id(&self, data_size: usize) -> u32 {
+        let payload_size = if self.expected_payload_size == 0 {
+            MAXIMUM_PAYLOAD_SIZE
+        } else {
+            std::cmp::min(
+                self.expected_payload_size * PACKET_ID_MARGIN_FACTOR,
+                MAXIMUM_PAYLOAD_SIZE,
+            )
+        };
+        // The data packets follow the leader, and the trailer follows them.
+        let data_packets = (payload_size - 1) / std::cmp::max(data_size, 1) + 1;
+        std::cmp::min(data_packets + 1, u32::MAX as usize) as u32
+    }
+
+    /// Requests packets still missing after `packet_timeout`, and gives up blocks not completed
+    /// within `block_timeout`.
+    fn poll_timeouts(&mut self, now: Instant, events: &mut Events) {
+        let mut idx = 0;
+        while idx < self.blocks.len() {
+            let block = &mut self.blocks[idx];
+            if now.saturating_duration_since(block.started_at) >= self.block_timeout {
+                let block = self.blocks.remove(idx).unwrap();
+                self.finish(block.id);
+                events.incomplete.push(block);
+                continue;
+            }
+
+            if now.saturating_duration_since(block.last_packet_at) >= self.packet_timeout
+                && now >= block.next_resend_at
+                && block.timeout_resends < self.max_timeout_resends
+            {
+                block.timeout_resends += 1;
+                block.next_resend_at = now + self.packet_timeout;
+                block.missing_ranges(&mut events.resends);
+                // The packets following the last received one are unknown until the trailer
+                // arrives, so request the next packet to find out the rest.
+                if block.trailer_id.is_none() {
+                    let next = block.next_packet_id;
+                    events.resends.push(block.resend_range(next, next));
+                }
+            }
+            idx += 1;
+        }
+    }
+
+    fn start_block(
+        &mut self,
+        block_id: u64,
+        extended_id: bool,
+        now: Instant,
+        acquire: &mut impl FnMut(usize) -> PayloadBuffer,
+        events: &mut Events,
+    ) -> usize {
+        if self.blocks.len() >= self.max_inflight_blocks {
+            let oldest = self.blocks.pop_front().unwrap();
+            self.finish(oldest.id);
+            events.incomplete.push(oldest);
+        }
+
+        let mut block = self.spare_blocks.pop().unwrap_or_else(|| Block::new(now));
+        block.reset(block_id, extended_id, now);
+        let buffer_size = if self.expected_payload_size == 0 {
+            INITIAL_PAYLOAD_BUFFER_SIZE
+        } else {
+            self.expected_payload_size
+        };
+        block.payload_buf = acquire(buffer_size);
+        self.blocks.push_back(block);
+        self.blocks.len() - 1
+    }
+
+    fn finish(&mut self, block_id: u64) {
+        if self.finished.len() == FINISHED_BLOCK_HISTORY {
+            self.finished.pop_front();
+        }
+        self.finished.push_back(block_id);
+    }
+
+    fn recycle(&mut self, mut block: Block) {
+        // Return a pooled buffer to the pool.
+        block.payload_buf = PayloadBuffer::default();
+        self.spare_blocks.push(block);
+    }
+}
+
+/// A block being reassembled.
+struct Block {
+    id: u64,
+    extended_id: bool,
+    /// Leader and trailer packets including their headers.
+    leader: Vec<u8>,
+    trailer: Vec<u8>,
+    trailer_id: Option<u32>,
+    payload_buf: PayloadBuffer,
+    /// Length of the payload data received, i.e. the end of the furthest data packet.
+    payload_len: usize,
+    /// Bitmap of received packet IDs.
+    received: Vec<u64>,
+    received_count: usize,
+    /// The packet ID following the largest one received.
+    next_packet_id: u32,
+    /// Rounds of `PACKETRESEND_CMD` requested on gaps of packet IDs.
+    resend_requests: usize,
+    /// Rounds of `PACKETRESEND_CMD` requested after `packet_timeout`.
+    timeout_resends: usize,
+    started_at: Instant,
+    leader_at: Instant,
+    trailer_at: Instant,
+    last_packet_at: Instant,
+    next_resend_at: Instant,
+}
+
+impl Block {
+    fn new(now: Instant) -> Self {
+        Self {
+            id: 0,
+            extended_id: false,
+            leader: vec![],
+            trailer: vec![],
+            trailer_id: None,
+            payload_buf: PayloadBuffer::default(),
+            payload_len: 0,
+            received: vec![],
+            received_count: 0,
+            next_packet_id: 0,
+            resend_requests: 0,
+            timeout_resends: 0,
+            started_at: now,
+            leader_at: now,
+            trailer_at: now,
+            last_packet_at: now,
+            next_resend_at: now,
+        }
+    }
+
+    fn reset(&mut self, id: u64, extended_id: bool, now: Instant) {
+        self.id = id;
+        self.extended_id = extended_id;
+        self.leader.clear();
+        self.trailer.clear();
+        self.trailer_id = None;
+        self.payload_len = 0;
+        self.received.clear();
+        self.received_count = 0;
+        self.next_packet_id = 0;
+        self.resend_requests = 0;
+        self.timeout_resends = 0;
+        self.started_at = now;
+        self.leader_at = now;
+        self.trailer_at = now;
+        self.last_packet_at = now;
+        self.next_resend_at = now;
+    }
+
+    /// Copies the data of the packet into the payload buffer, growing the buffer if needed.
+    /// Returns `false` if the packet doesn't fit in the block.
+    fn write_data(
+        &mut self,
+        packet_id: u32,
+        data: &[u8],
+        data_size: usize,
+        acquire: &mut impl FnMut(usize) -> PayloadBuffer,
+    ) -> bool {
+        if data.len() > data_size || matches!(self.trailer_id, Some(id) if packet_id >= id) {
+            return false;
+        }
+        let offset = (packet_id as usize - 1) * data_size;
+        let end = offset + data.len();
+        if end > MAXIMUM_PAYLOAD_SIZE {
+            return false;
+        }
+
+        if end > self.payload_buf.len() {
+            let len = std::cmp::max(end, self.payload_buf.len() * 2);
+            let mut payload_buf = acquire(len);
+            payload_buf[..self.payload_len].copy_from_slice(&self.payload_buf[..self.payload_len]);
+            self.payload_buf = payload_buf;
+        }
+        self.payload_buf[offset..end].copy_from_slice(data);
+        self.payload_len = std::cmp::max(self.payload_len, end);
+        true
+    }
+
+    fn is_received(&self, packet_id: u32) -> bool {
+        let (word, bit) = (packet_id as usize / 64, packet_id % 64);
+        self.received.get(word).copied().unwrap_or(0) & (1 << bit) != 0
+    }
+
+    fn mark_received(&mut self, packet_id: u32, now: Instant) {
+        let (word, bit) = (packet_id as usize / 64, packet_id % 64);
+        if self.received.len() <= word {
+            self.received.resize(word + 1, 0);
+        }
+        self.received[word] |= 1 << bit;
+        self.received_count += 1;
+        self.last_packet_at = now;
+    }
+
+    fn is_completed(&self) -> bool {
+        match self.trailer_id {
+            // All packets from the leader to the trailer are received.
+            Some(trailer_id) => {
+                self.next_packet_id == trailer_id + 1
+                    && self.received_count == trailer_id as usize + 1
+            }
+            None => false,
+        }
+    }
+
+    fn missing_packets(&self) -> usize {
+        let expected = match self.trailer_id {
+            Some(trailer_id) => trailer_id as usize + 1,
+            // At least one more packet, i.e. the trailer, is missing.
+            None => self.next_packet_id as usize + 1,
+        };
+        expected.saturating_sub(self.received_count)
+    }
+
+    /// Appends ranges of missing packets before the largest packet ID received.
+    fn missing_ranges(&self, ranges: &mut Vec<ResendRange>) {
+        let mut first_missing = None;
+        for packet_id in 0..self.next_packet_id {
+            match (self.is_received(packet_id), first_missing) {
+                (false, None) => first_missing = Some(packet_id),
+                (true, Some(first)) => {
+                    ranges.push(self.resend_range(first, packet_id - 1));
+                    first_missing = None;
+                }
+                _ => {}
+            }
+        }
+        if let Some(first) = first_missing {
+            ranges.push(self.resend_range(first, self.next_packet_id - 1));
+        }
+    }
+
+    fn resend_range(&self, first_packet_id: u32, last_packet_id: u32) -> ResendRange {
+        ResendRange {
+            block_id: self.id,
+            first_packet_id,
+            last_packet_id,
+            extended_id: self.extended_id,
+        }
+    }
+
+    /// Builds a payload from the completed block. The payload buffer is moved into the payload.
+    fn build_payload(&mut self, tick_frequency: u64) -> StreamResult<Payload> {
+        let leader = gvsp::Packet::parse(&self.leader)
+            .and_then(|packet| packet.leader())
+            .map_err(|e| StreamError::InvalidPayload(format!("invalid leader: {}", e).into()))?;
+        let trailer = gvsp::Packet::parse(&self.trailer)
+            .and_then(|packet| packet.trailer())
+            .map_err(|e| StreamError::InvalidPayload(format!("invalid trailer: {}", e).into()))?;
+
+        let id = self.id;
+        let timestamp = ticks_to_duration(leader.timestamp(), tick_frequency);
+        let host_timestamp = Some(HostTimestamp {
+            leader: self.leader_at,
+            trailer: self.trailer_at,
+        });
+        let mut valid_payload_size = self.payload_len;
+
+        let (payload_type, image_info, chunks) = match leader.payload_type() {
+            gvsp::PayloadType::Image => {
+                let image_leader: gvsp::ImageLeader =
+                    leader.specific_leader_as().map_err(invalid_payload)?;
+                let image_trailer: gvsp::ImageTrailer =
+                    trailer.specific_trailer_as().map_err(invalid_payload)?;
+                let image_info = ImageInfo {
+                    width: image_leader.width() as usize,
+                    height: image_trailer.actual_height() as usize,
+                    x_offset: image_leader.x_offset() as usize,
+                    y_offset: image_leader.y_offset() as usize,
+                    pixel_format: image_leader.pixel_format(),
+                    image_size: valid_payload_size,
+                };
+                (PayloadType::Image, Some(image_info), vec![])
+            }
+
+            gvsp::PayloadType::ImageExtendedChunk => {
+                let image_leader: gvsp::ImageLeader =
+                    leader.specific_leader_as().map_err(invalid_payload)?;
+                let image_trailer: gvsp::ImageTrailer =
+                    trailer.specific_trailer_as().map_err(invalid_payload)?;
+                // The first chunk of the payload data is the image.
+                let chunks = ChunkLayout::parse_all(&self.payload_buf[..valid_payload_size])?;
+                let image_info = ImageInfo {
+                    width: image_leader.width() as usize,
+                    height: image_trailer.actual_height() as usize,
+                    x_offset: image_leader.x_offset() as usize,
+                    y_offset: image_leader.y_offset() as usize,
+                    pixel_format: image_leader.pixel_format(),
+                    image_size: chunks.first().map_or(0, |chunk| chunk.len),
+                };
+                (PayloadType::ImageExtendedChunk, Some(image_info), chunks)
+            }
+
+            gvsp::PayloadType::Chunk => {
+                let chunk_trailer: gvsp::ChunkTrailer =
+                    trailer.specific_trailer_as().map_err(invalid_payload)?;
+                let chunk_len = chunk_trailer.chunk_data_payload_length() as usize;
+                if chunk_len > valid_payload_size {
+                    return Err(StreamError::InvalidPayload(
+                        format!("the received payload size is smaller than the size specified in the trailer: expected {}, but got {}",
+                                chunk_len,
+                                valid_payload_size).into(),
+                    ));
+                }
+                valid_payload_size = chunk_len;
+                let chunks = ChunkLayout::parse_all(&self.payload_buf[..valid_payload_size])?;
+                (PayloadType::Chunk, None, chunks)
+            }
+        };
+
+        Ok(Payload {
+            id,
+            payload_type,
+            image_info,
+            chunks,
+            payload: std::mem::take(&mut self.payload_buf),
+            valid_payload_size,
+            timestamp,
+            host_timestamp,
+        })
+    }
+}
+
+fn invalid_payload(err: gige::Error) -> StreamError {
+    StreamError::InvalidPayload(format!("{}", err).into())
+}
+
+/// Converts ticks of the device's timestamp counter to the duration. Ticks are regarded as
+/// nanoseconds if the frequency is unknown.
+fn ticks_to_duration(ticks: u64, tick_frequency: u64) -> Duration {
+    if tick_frequency == 0 {
+        return Duration::from_nanos(ticks);
+    }
+    let nanos = u128::from(ticks) * 1_000_000_000 / u128::from(tick_frequency);
+    Duration::from_nanos(nanos.try_into().unwrap_or(u64::MAX))
+}
+
+/// Parameters to receive stream packets.
+///
+/// Both [`StreamHandle`] doesn't check the integrity of the parameters. That's up to user.
+#[derive(Debug, Clone)]
+pub struct StreamParams {
+    /// Packet size of the stream channel including IP, UDP and `GVSP` headers.
+    pub packet_size: usize,
+
+    /// Frequency of the device's timestamp counter in Hz.
+    pub tick_frequency: u64,
+
+    /// Size of payload buffers. If `0`, the size is learned from received blocks.
+    ///
+    /// Setting the value, e.g. to `PayloadSize` of the device, avoids growing the buffer of the
+    /// first block.
+    ///
+    /// This value is a host side parameter, so it's kept as is when [`StreamHandle`] starts
+    /// streaming.
+    pub payload_size: usize,
+
+    /// The number of payload buffers pre-allocated in the buffer pool.
+    ///
+    /// This value is a host side parameter, so it's kept as is when [`StreamHandle`] starts
+    /// streaming.
+    pub buffer_count: usize,
+
+    /// The maximum number of packets received by a system call.
+    ///
+    /// This value is a host side parameter, so it's kept as is when [`StreamHandle`] starts
+    /// streaming.
+    pub batch_size: usize,
+
+    /// Requested size of the socket receive buffer, which is applied when [`StreamHandle`] is
+    /// opened. The size may be capped by the system, e.g. `net.core.rmem_max` on Linux.
+    ///
+    /// This value is a host side parameter, so it's kept as is when [`StreamHandle`] starts
+    /// streaming.
+    pub recv_buffer_size: usize,
+
+    /// Time to wait for the next packet of a block before requesting missing packets again.
+    ///
+    /// This value is a host side parameter, so it's kept as is when [`StreamHandle`] starts
+    /// streaming.
+    pub packet_timeout: Duration,
+
+    /// Time to wait for a block to complete after its first packet arrives. An incomplete
+    /// block is reported as [`StreamError::InvalidPayload`].
+    ///
+    /// This value is a host side parameter, so it's kept as is when [`StreamHandle`] starts
+    /// streaming.
+    pub block_timeout: Duration,
+
+    /// The maximum number of rounds of `PACKETRESEND_CMD` for a block, which are requested as
+    /// soon as a gap of packet IDs is found. `0` disables the requests.
+    ///
+    /// This value is a host side parameter, so it's kept as is when [`StreamHandle`] starts
+    /// streaming.
+    pub max_resend_requests: usize,
+
+    /// The maximum number of rounds of `PACKETRESEND_CMD` for a block, which are requested when
+    /// no packet of the block arrives within [`Self::packet_timeout`]. `0` disables the
+    /// requests.
+    ///
+    /// This value is a host side parameter, so it's kept as is when [`StreamHandle`] starts
+    /// streaming.
+    pub max_timeout_resends: usize,
+
+    /// The maximum number of blocks reassembled at the same time. The oldest block is given up
+    /// when a new block arrives beyond the limit.
+    ///
+    /// This value is a host side parameter, so it's kept as is when [`StreamHandle`] starts
+    /// streaming.
+    pub max_inflight_blocks: usize,
+}
+
+impl Default for StreamParams {
+    fn default() -> Self {
+        Self {
+            packet_size: 0,
+            tick_frequency: 0,
+            payload_size: 0,
+            buffer_count: 8,
+            batch_size: 64,
+            recv_buffer_size: 64 << 20,
+            packet_timeout: Duration::from_millis(5),
+            block_timeout: Duration::from_millis(100),
+            max_resend_requests: 3,
+            max_timeout_resends: 3,
+            max_inflight_blocks: 4,
+        }
+    }
+}
+
+impl StreamParams {
+    /// Build `StreamParams` from [`DeviceControl`].
+    pub fn from_control<Ctrl: DeviceControl + ?Sized>(ctrl: &mut Ctrl) -> ControlResult<Self> {
+        // Only the first stream channel is used.
+        let packet_size =
+            read_u32(ctrl, stream_channel::BASE + stream_channel::PACKET_SIZE.0)? & 0xFFFF;
+        let tick_frequency_high = read_u32(ctrl, bootstrap::TIMESTAMP_TICK_FREQUENCY_HIGH.0)?;
+        let tick_frequency_low = read_u32(ctrl, bootstrap::TIMESTAMP_TICK_FREQUENCY_LOW.0)?;
+
+        Ok(Self {
+            packet_size: packet_size as usize,
+            tick_frequency: u64::from(tick_frequency_high) << 32 | u64::from(tick_frequency_low),
+            ..Self::default()
+        })
+    }
+
+    /// Fails if packets of `packet_size` can't carry data, in which case no block would be
+    /// reassembled.
+    fn validate_packet_size(&self) -> StreamResult<()> {
+        if self.packet_size <= IP_UDP_HEADER_LENGTH + gvsp::STANDARD_HEADER_LENGTH {
+            return Err(StreamError::Io(anyhow::Error::msg(format!(
+                "packet size of the stream channel is too small to carry data: {}",
+                self.packet_size
+            ))));
+        }
+        Ok(())
+    }
+
+    /// Copies parameters which are not stored in the device.
+    fn copy_host_params(&mut self, other: &Self) {
+        self.payload_size = other.payload_size;
+        self.buffer_count = other.buffer_count;
+        self.batch_size = other.batch_size;
+        self.recv_buffer_size = other.recv_buffer_size;
+        self.packet_timeout = other.packet_timeout;
+        self.block_timeout = other.block_timeout;
+        self.max_resend_requests = other.max_resend_requests;
+        self.max_timeout_resends = other.max_timeout_resends;
+        self.max_inflight_blocks = other.max_inflight_blocks;
+    }
+}
+
+fn read_u32<Ctrl: DeviceControl + ?Sized>(ctrl: &mut Ctrl, address: u64) -> ControlResult<u32> {
+    let mut buf = [0; 4];
+    ctrl.read(address, &mut buf)?;
+    Ok(u32::from_be_bytes(buf))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use crate::payload::PixelFormat;
+
+    /// Packet size which carries 4 bytes of data in a standard ID packet.
+    const PACKET_SIZE: usize = IP_UDP_HEADER_LENGTH + gvsp::STANDARD_HEADER_LENGTH + 4;
+
+    fn header(block_id: u16, format: u8, packet_id: u32) -> Vec<u8> {
+        let mut buf = vec![0, 0];
+        buf.extend(block_id.to_be_bytes());
+        buf.extend((u32::from(format) << 24 | packet_id).to_be_bytes());
+        buf
+    }
+
+    fn leader(block_id: u16) -> Vec<u8> {
+        let mut buf = header(block_id, 1, 0);
+        // Field info and payload type.
+        buf.extend([0, 0, 0, 1]);
+        // Timestamp.
+        buf.extend(2000_u64.to_be_bytes());
+        buf.extend(u32::from(PixelFormat::Mono8).to_be_bytes());
+        // Width, height, x offset and y offset.
+        for v in [4_u32, 3, 0, 0] {
+            buf.extend(v.to_be_bytes());
+        }
+        // Padding.
+        buf.extend([0, 0, 0, 0]);
+        buf
+    }
+
+    fn data(block_id: u16, packet_id: u32) -> Vec<u8> {
+        let mut buf = header(block_id, 3, packet_id);
+        buf.extend([packet_id as u8; 4]);
+        buf
+    }
+
+    fn trailer(block_id: u16, packet_id: u32) -> Vec<u8> {
+        let mut buf = header(block_id, 2, packet_id);
+        // Reserved and payload type.
+        buf.extend([0, 0, 0, 1]);
+        // Actual height.
+        buf.extend(3_u32.to_be_bytes());
+        buf
+    }
+
+    /// A block of a 4x3 image sent in 3 data packets.
+    fn block(block_id: u16) -> Vec<Vec<u8>> {
+        vec![
+            leader(block_id),
+            data(block_id, 1),
+            data(block_id, 2),
+            data(block_id, 3),
+            trailer(block_id, 4),
+        ]
+    }
+
+    fn reassembler() -> Reassembler {
+        let params = StreamParams {
+            packet_size: PACKET_SIZE,
+            ..StreamParams::default()
+        };
+        Reassembler::new(&params, 0)
+    }
+
+    fn push(re: &mut Reassembler, packet: &[u8], now: Instant, events: &mut Events) {
+        re.push(packet, now, &mut |len| vec![0; len].into(), events);
+    }
+
+    #[test]
+    fn test_reassemble() {
+        let mut re = reassembler();
+        let mut events = Events::default();
+        let now = Instant::now();
+
+        // Out of order packets are placed by their packet ID.
+        let mut packets = block(1);
+        packets.swap(1, 3);
+        for packet in &packets {
+            push(&mut re, packet, now, &mut events);
+        }
+        // Late duplicate of a finished block is ignored.
+        push(&mut re, &packets[2], now, &mut events);
+
+        assert!(re.is_idle());
+        assert_eq!(events.completed.len(), 1);
+        assert_eq!(events.invalid_packets, 0);
+        let payload = events.completed[0].build_payload(1_000).unwrap();
+        assert_eq!(payload.id(), 1);
+        assert_eq!(payload.payload_type(), PayloadType::Image);
+        assert_eq!(
+            payload.image(),
+            Some(&[1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3][..])
+        );
+        let image_info = payload.image_info().unwrap();
+        assert_eq!((image_info.width, image_info.height), (4, 3));
+        assert_eq!(payload.timestamp(), Duration::from_secs(2));
+    }
+
+    #[test]
+    fn test_resend_missing_packets() {
+        let mut re = reassembler();
+        let mut events = Events::default();
+        let now = Instant::now();
+
+        let packets = block(7);
+        push(&mut re, &packets[0], now, &mut events);
+        push(&mut re, &packets[3], now, &mut events);
+        // Packets 1 and 2 are requested as soon as the gap is found.
+        assert_eq!(
+            events.resends,
+            vec![ResendRange {
+                block_id: 7,
+                first_packet_id: 1,
+                last_packet_id: 2,
+                extended_id: false,
+            }]
+        );
+        events.resends.clear();
+
+        // After `packet_timeout`, missing packets and the packet following the last one are
+        // requested.
+        push(&mut re, &packets[2], now, &mut events);
+        re.poll_timeouts(now + re.packet_timeout, &mut events);
+        let ranges: Vec<_> = events
+            .resends
+            .iter()
+            .map(|r| (r.first_packet_id, r.last_packet_id))
+            .collect();
+        assert_eq!(ranges, vec![(1, 1), (4, 4)]);
+        // Not requested again until the next `packet_timeout`.
+        events.resends.clear();
+        re.poll_timeouts(now + re.packet_timeout, &mut events);
+        assert!(events.resends.is_empty());
+
+        push(&mut re, &packets[1], now, &mut events);
+        push(&mut re, &packets[4], now, &mut events);
+        assert_eq!(events.completed.len(), 1);
+    }
+
+    #[test]
+    fn test_incomplete_block() {
+        let mut re = reassembler();
+        let mut events = Events::default();
+        let now = Instant::now();
+
+        let packets = block(1);
+        for packet in packets.iter().filter(|p| p != &&packets[2]) {
+            push(&mut re, packet, now, &mut events);
+        }
+        re.poll_timeouts(now + re.block_timeout, &mut events);
+        assert!(re.is_idle());
+        assert_eq!(events.incomplete.len(), 1);
+        assert_eq!(events.incomplete[0].missing_packets(), 1);
+
+        // The oldest block is given up when too many blocks are in flight.
+        let mut events = Events::default();
+        for block_id in 2..=(2 + re.max_inflight_blocks as u16) {
+            push(&mut re, &leader(block_id), now, &mut events);
+        }
+        assert_eq!(events.incomplete.len(), 1);
+        assert_eq!(events.incomplete[0].id, 2);
+    }
+
+    #[test]
+    fn test_reject_out_of_range_packet_id() {
+        let params = StreamParams {
+            packet_size: PACKET_SIZE,
+            ..StreamParams::default()
+        };
+        // A block has 3 data packets.
+        let mut re = Reassembler::new(&params, 12);
+        let mut events = Events::default();
+        let now = Instant::now();
+
+        let packets = block(1);
+        for packet in &packets[..4] {
+            push(&mut re, packet, now, &mut events);
+        }
+        push(&mut re, &trailer(1, 0xFF_FFFF), now, &mut events);
+        assert_eq!(events.invalid_packets, 1);
+        push(&mut re, &packets[4], now, &mut events);
+        assert_eq!(events.completed.len(), 1);
+    }
+
+    #[test]
+    fn test_timeout_resend_limit() {
+        let params = StreamParams {
+            packet_size: PACKET_SIZE,
+            max_resend_requests: 0,
+            max_timeout_resends: 2,
+            ..StreamParams::default()
+        };
+        let mut re = Reassembler::new(&params, 0);
+        let mut events = Events::default();
+        let now = Instant::now();
+
+        let packets = block(1);
+        push(&mut re, &packets[0], now, &mut events);
+        push(&mut re, &packets[2], now, &mut events);
+        assert!(events.resends.is_empty());
+
+        // Timeout resends are limited independently of resends on gaps.
+        let mut rounds = 0;
+        for i in 1..=4 {
+            events.resends.clear();
+            re.poll_timeouts(now + re.packet_timeout * i, &mut events);
+            if !events.resends.is_empty() {
+                rounds += 1;
+            }
+        }
+        assert_eq!(rounds, 2);
+    }
+
+    #[test]
+    fn test_grow_payload_buffer() {
+        let mut re = reassembler();
+        let mut events = Events::default();
+        let now = Instant::now();
+
+        // Start with a buffer smaller than the payload.
+        let mut first = true;
+        let mut acquire = |len: usize| {
+            let len = if first { 6 } else { len };
+            first = false;
+            vec![0; len].into()
+        };
+        for packet in block(1) {
+            re.push(&packet, now, &mut acquire, &mut events);
+        }
+        let payload = events.completed[0].build_payload(0).unwrap();
+        assert_eq!(
+            payload.payload()[..12],
+            [1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3]
+        );
+    }
+
+    #[test]
+    fn test_validate_packet_size() {
+        let mut params = StreamParams::default();
+        assert!(params.validate_packet_size().is_err());
+        params.packet_size = IP_UDP_HEADER_LENGTH + gvsp::STANDARD_HEADER_LENGTH;
+        assert!(params.validate_packet_size().is_err());
+        params.packet_size = PACKET_SIZE;
+        params.validate_packet_size().unwrap();
+    }
+
+    #[test]
+    fn test_ticks_to_duration() {
+        assert_eq!(
+            ticks_to_duration(125_000_000, 125_000_000),
+            Duration::from_secs(1)
+        );
+        assert_eq!(ticks_to_duration(42, 0), Duration::from_nanos(42));
+    }
+}
@@ -0,0 +1,134 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! This module contains statistics of the receive loop of [`StreamHandle`].
+//!
+//! All counters are updated with relaxed atomic operations and never lock. A
+//! [`StreamStatsSnapshot`] can be taken from any thread while streaming.
+//!
+//! [`StreamHandle`]: super::StreamHandle
+
+use std::sync::atomic::{AtomicU64, Ordering};
+
+/// Statistics of the receive loop, shared between [`StreamHandle`] and its receive loop.
+///
+/// [`StreamHandle`]: super::StreamHandle
+#[derive(Debug, Default)]
+pub struct StreamStats {
+    frames_delivered: AtomicU64,
+    frames_dropped: AtomicU64,
+    frames_incomplete: AtomicU64,
+    errors: AtomicU64,
+    packets_received: AtomicU64,
+    packets_resent: AtomicU64,
+    packets_missing: AtomicU64,
+    packets_invalid: AtomicU64,
+    resend_requests: AtomicU64,
+    bytes_received: AtomicU64,
+    batches: AtomicU64,
+}
+
+impl StreamStats {
+    /// Returns the current values of the statistics.
+    ///
+    /// Counters are read one by one, so the snapshot may be slightly inconsistent while
+    /// streaming.
+    #[must_use]
+    pub fn snapshot(&self) -> StreamStatsSnapshot {
+        StreamStatsSnapshot {
+            frames_delivered: load(&self.frames_delivered),
+            frames_dropped: load(&self.frames_dropped),
+            frames_incomplete: load(&self.frames_incomplete),
+            errors: load(&self.errors),
+            packets_received: load(&self.packets_received),
+            packets_resent: load(&self.packets_resent),
+            packets_missing: load(&self.packets_missing),
+            packets_invalid: load(&self.packets_invalid),
+            resend_requests: load(&self.resend_requests),
+            bytes_received: load(&self.bytes_received),
+            batches: load(&self.batches),
+        }
+    }
+
+    pub(super) fn frame_delivered(&self) {
+        add(&self.frames_delivered, 1);
+    }
+
+    pub(super) fn frames_dropped(&self, n: u64) {
+        add(&self.frames_dropped, n);
+    }
+
+    pub(super) fn frame_incomplete(&self, missing_packets: u64) {
+        add(&self.frames_incomplete, 1);
+        add(&self.packets_missing, missing_packets);
+    }
+
+    pub(super) fn error(&self) {
+        add(&self.errors, 1);
+    }
+
+    pub(super) fn batch_received(&self, packets: usize, bytes: usize) {
+        add(&self.batches, 1);
+        add(&self.packets_received, packets as u64);
+        add(&self.bytes_received, bytes as u64);
+    }
+
+    pub(super) fn packet_resent(&self) {
+        add(&self.packets_resent, 1);
+    }
+
+    pub(super) fn packet_invalid(&self) {
+        add(&self.packets_invalid, 1);
+    }
+
+    pub(super) fn resend_requested(&self) {
+        add(&self.resend_requests, 1);
+    }
+}
+
+/// Values of [`StreamStats`] at some point.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct StreamStatsSnapshot {
+    /// Frames sent to [`PayloadReceiver`](crate::payload::PayloadReceiver).
+    pub frames_delivered: u64,
+
+    /// Frames dropped by the [`BackpressurePolicy`](crate::payload::BackpressurePolicy).
+    pub frames_dropped: u64,
+
+    /// Frames given up because packets were still missing after resend requests.
+    pub frames_incomplete: u64,
+
+    /// Errors reported to [`PayloadReceiver`](crate::payload::PayloadReceiver).
+    pub errors: u64,
+
+    /// Packets received, including duplicated and invalid ones.
+    pub packets_received: u64,
+
+    /// Packets received in response to resend requests.
+    pub packets_resent: u64,
+
+    /// Packets missing in incomplete frames.
+    pub packets_missing: u64,
+
+    /// Packets which couldn't be parsed or didn't fit in the frame.
+    pub packets_invalid: u64,
+
+    /// `PACKETRESEND_CMD`s sent to the device.
+    pub resend_requests: u64,
+
+    /// Bytes of received packets, including headers.
+    pub bytes_received: u64,
+
+    /// Batches of packets received from the socket. `packets_received / batches` is the average
+    /// number of packets received by a system call.
+    pub batches: u64,
+}
+
+fn load(counter: &AtomicU64) -> u64 {
+    counter.load(Ordering::Relaxed)
+}
+
+fn add(counter: &AtomicU64, n: u64) {
+    counter.fetch_add(n, Ordering::Relaxed);
+}
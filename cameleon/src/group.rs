@@ -0,0 +1,780 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! This module contains [`CameraGroup`], which streams from several cameras together and
+//! delivers their payloads as [`FrameSet`]s matched by timestamp.
+//!
+//! Payloads of all cameras are merged on a single dispatcher thread. A payload which can no
+//! longer be matched, e.g. because another camera has already sent a newer payload, is dropped as
+//! soon as it's known and its buffer is sent back to the camera. The number of payloads waiting
+//! for their partners is bounded by [`GroupParams::queue_depth`] and [`GroupParams::max_wait`].
+//!
+//! # Examples
+//! ```no_run
+//! use cameleon::{group::CameraGroup, u3v};
+//!
+//! let cameras = u3v::enumerate_cameras().unwrap();
+//! if cameras.is_empty() {
+//!     return;
+//! }
+//!
+//! let mut group = CameraGroup::new(cameras);
+//! group.open().unwrap();
+//! group.load_context().unwrap();
+//!
+//! let frame_set_rx = group.start_streaming(3).unwrap();
+//! for _ in 0..10 {
+//!     let frame_set = frame_set_rx.recv_blocking().unwrap();
+//!     println!("timestamp: {:?}, skew: {:?}", frame_set.timestamp(), frame_set.skew());
+//!     for payload in frame_set.payloads() {
+//!         // do something with the payload.
+//!     }
+//!     frame_set_rx.send_back(frame_set);
+//! }
+//!
+//! group.close().unwrap();
+//! ```
+
+use std::{
+    collections::VecDeque,
+    pin::Pin,
+    sync::{
+        atomic::{AtomicBool, AtomicU64, Ordering},
+        Arc,
+    },
+    task::{Context, Poll, Wake, Waker},
+    thread::{self, JoinHandle, Thread},
+    time::{Duration, Instant},
+};
+
+use async_channel::{Receiver, Sender};
+use futures_core::Stream;
+use tracing::{info, warn};
+
+use super::{
+    genapi::{DefaultGenApiCtxt, FromXml, GenApiCtxt},
+    payload::{Payload, PayloadReceiver},
+    CameleonResult, Camera, DeviceControl, PayloadStream, StreamError, StreamResult,
+};
+
+/// Interval to check expired payloads and cancellation while no payload arrives.
+const DISPATCH_INTERVAL: Duration = Duration::from_millis(10);
+
+/// Streams from several cameras together and matches their payloads by timestamp.
+///
+/// All cameras must have the same handle types. Cameras of different types can be grouped by
+/// converting them with [`Camera::convert_into`] first, e.g. into boxed handles.
+pub struct CameraGroup<Ctrl, Strm, Ctxt = DefaultGenApiCtxt> {
+    cameras: Vec<Camera<Ctrl, Strm, Ctxt>>,
+    params: GroupParams,
+    dispatcher: Option<DispatcherHandle>,
+    stats: Arc<GroupStats>,
+}
+
+/// Parameters to match payloads of a [`CameraGroup`].
+#[derive(Debug, Clone)]
+pub struct GroupParams {
+    /// Maximum difference between the timestamps of payloads in a [`FrameSet`].
+    pub tolerance: Duration,
+
+    /// Clock which timestamps of payloads are compared on.
+    pub clock: FrameClock,
+
+    /// Maximum number of payloads of each camera waiting for their partners. The oldest payload
+    /// is dropped when a new payload arrives at the full queue.
+    ///
+    /// This is also used as the capacity of the payload receiver of each camera.
+    pub queue_depth: usize,
+
+    /// Maximum duration for which a payload waits for its partners.
+    pub max_wait: Duration,
+}
+
+impl Default for GroupParams {
+    fn default() -> Self {
+        Self {
+            tolerance: Duration::from_millis(5),
+            clock: FrameClock::Host,
+            queue_depth: 4,
+            max_wait: Duration::from_millis(500),
+        }
+    }
+}
+
+/// Clock which timestamps of payloads are compared on.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum FrameClock {
+    /// [`Payload::timestamp`], the device clock.
+    ///
+    /// Use this only if clocks of the devices are synchronized, e.g. by IEEE 1588 or by
+    /// resetting timestamps with the shared trigger.
+    Device,
+
+    /// Host time when the leader of the payload was received, which is comparable among any
+    /// devices but includes the transfer jitter.
+    Host,
+}
+
+impl<Ctrl, Strm, Ctxt> CameraGroup<Ctrl, Strm, Ctxt> {
+    /// Creates a group of `cameras`. Payloads in a [`FrameSet`] are in the same order as
+    /// `cameras`.
+    ///
+    /// # Panics
+    /// If `cameras` is empty, this method will panic.
+    #[must_use]
+    pub fn new(cameras: Vec<Camera<Ctrl, Strm, Ctxt>>) -> Self {
+        assert!(!cameras.is_empty());
+        Self {
+            cameras,
+            params: GroupParams::default(),
+            dispatcher: None,
+            stats: Arc::new(GroupStats::default()),
+        }
+    }
+
+    /// Returns cameras of the group.
+    #[must_use]
+    pub fn cameras(&self) -> &[Camera<Ctrl, Strm, Ctxt>] {
+        &self.cameras
+    }
+
+    /// Returns mutable cameras of the group to configure each camera.
+    ///
+    /// NOTE: Streaming of a camera must not be started or stopped individually while the group
+    /// is streaming.
+    pub fn cameras_mut(&mut self) -> &mut [Camera<Ctrl, Strm, Ctxt>] {
+        &mut self.cameras
+    }
+
+    /// Returns params.
+    #[must_use]
+    pub fn params(&self) -> &GroupParams {
+        &self.params
+    }
+
+    /// Returns mutable params. Changes take effect from the next [`Self::start_streaming`].
+    pub fn params_mut(&mut self) -> &mut GroupParams {
+        &mut self.params
+    }
+
+    /// Returns the statistics of the dispatcher.
+    #[must_use]
+    pub fn stats(&self) -> Arc<GroupStats> {
+        self.stats.clone()
+    }
+
+    /// Returns `true` if the group is streaming.
+    #[must_use]
+    pub fn is_streaming(&self) -> bool {
+        self.dispatcher.is_some()
+    }
+
+    /// Opens all cameras.
+    pub fn open(&mut self) -> CameleonResult<()>
+    where
+        Ctrl: DeviceControl,
+        Strm: PayloadStream,
+    {
+        for camera in &mut self.cameras {
+            camera.open()?;
+        }
+        Ok(())
+    }
+
+    /// Closes all cameras after stopping streaming.
+    ///
+    /// All cameras are closed even if some of them fail, then the first error is returned.
+    pub fn close(&mut self) -> CameleonResult<()>
+    where
+        Ctrl: DeviceControl,
+        Strm: PayloadStream,
+        Ctxt: GenApiCtxt,
+    {
+        let mut result = self.stop_streaming();
+        for camera in &mut self.cameras {
+            let closed = camera.close();
+            result = result.and(closed);
+        }
+        result
+    }
+
+    /// Loads `GenApi` context of all cameras.
+    pub fn load_context(&mut self) -> CameleonResult<()>
+    where
+        Ctrl: DeviceControl,
+        Strm: PayloadStream,
+        Ctxt: GenApiCtxt + FromXml,
+    {
+        for camera in &mut self.cameras {
+            camera.load_context()?;
+        }
+        Ok(())
+    }
+
+    /// Starts streaming of all cameras and returns the receiver for matched [`FrameSet`]s.
+    ///
+    /// If any camera fails to start, cameras which have already started are stopped.
+    ///
+    /// # Arguments
+    /// * `cap` - A capacity of the frame set receiver. A frame set is dropped when the receiver
+    ///   is full.
+    ///
+    /// # Panics
+    /// If `cap` or [`GroupParams::queue_depth`] is zero, this method will panic.
+    pub fn start_streaming(&mut self, cap: usize) -> CameleonResult<FrameSetReceiver>
+    where
+        Ctrl: DeviceControl,
+        Strm: PayloadStream,
+        Ctxt: GenApiCtxt,
+    {
+        assert!(cap > 0 && self.params.queue_depth > 0);
+        if self.is_streaming() {
+            return Err(StreamError::InStreaming.into());
+        }
+
+        let anchor = Instant::now();
+        let mut payload_rxs = Vec::with_capacity(self.cameras.len());
+        for idx in 0..self.cameras.len() {
+            match self.cameras[idx].start_streaming(self.params.queue_depth) {
+                Ok(payload_rx) => payload_rxs.push(payload_rx),
+                Err(err) => {
+                    for camera in &mut self.cameras[..idx] {
+                        camera.stop_streaming().ok();
+                    }
+                    return Err(err);
+                }
+            }
+        }
+
+        let (tx, rx) = async_channel::bounded(cap);
+        let cancelled = Arc::new(AtomicBool::new(false));
+        let dispatcher = Dispatcher {
+            payload_rxs: payload_rxs.clone(),
+            matcher: FrameMatcher::new(payload_rxs.len(), &self.params),
+            clock: self.params.clock,
+            anchor,
+            sender: tx,
+            stats: self.stats.clone(),
+            cancelled: cancelled.clone(),
+        };
+        let join_handle = thread::spawn(|| dispatcher.run());
+        self.dispatcher = Some(DispatcherHandle {
+            cancelled,
+            join_handle: Some(join_handle),
+        });
+
+        info!("start group streaming successfully");
+        Ok(FrameSetReceiver { rx, payload_rxs })
+    }
+
+    /// Stops streaming of all cameras.
+    ///
+    /// The receiver returned from the previous [`Self::start_streaming`] call will be
+    /// invalidated. All cameras are stopped even if some of them fail, then the first error is
+    /// returned.
+    pub fn stop_streaming(&mut self) -> CameleonResult<()>
+    where
+        Ctrl: DeviceControl,
+        Strm: PayloadStream,
+        Ctxt: GenApiCtxt,
+    {
+        let dispatcher = match self.dispatcher.take() {
+            Some(dispatcher) => dispatcher,
+            None => return Ok(()),
+        };
+
+        let mut result = dispatcher.join().map_err(|_| {
+            StreamError::Poisoned("dispatcher panicked before cancellation".into()).into()
+        });
+        for camera in &mut self.cameras {
+            let stopped = camera.stop_streaming();
+            result = result.and(stopped);
+        }
+
+        info!("stop group streaming successfully");
+        result
+    }
+
+    /// Returns the cameras of the group.
+    ///
+    /// NOTE: Streaming is not stopped, call [`Self::stop_streaming`] beforehand.
+    #[must_use]
+    pub fn into_cameras(self) -> Vec<Camera<Ctrl, Strm, Ctxt>> {
+        self.cameras
+    }
+}
+
+/// Payloads of all cameras of a [`CameraGroup`] whose timestamps are within the tolerance.
+#[derive(Debug)]
+pub struct FrameSet {
+    payloads: Vec<Payload>,
+    timestamp: Duration,
+    skew: Duration,
+}
+
+impl FrameSet {
+    /// Returns payloads in the same order as the cameras of the group.
+    #[must_use]
+    pub fn payloads(&self) -> &[Payload] {
+        &self.payloads
+    }
+
+    /// Returns payloads in the same order as the cameras of the group.
+    #[must_use]
+    pub fn into_payloads(self) -> Vec<Payload> {
+        self.payloads
+    }
+
+    /// Returns the earliest timestamp of the payloads on [`GroupParams::clock`].
+    ///
+    /// For [`FrameClock::Host`], the timestamp is the duration since the streaming started.
+    #[must_use]
+    pub fn timestamp(&self) -> Duration {
+        self.timestamp
+    }
+
+    /// Returns the difference between the latest and the earliest timestamps of the payloads.
+    #[must_use]
+    pub fn skew(&self) -> Duration {
+        self.skew
+    }
+}
+
+/// A receiver of [`FrameSet`]s matched by [`CameraGroup`].
+///
+/// The channel is closed when the group stops streaming or a stream of any camera ends.
+#[derive(Debug, Clone)]
+pub struct FrameSetReceiver {
+    rx: Receiver<StreamResult<FrameSet>>,
+    /// Used to send back payloads to each camera.
+    payload_rxs: Vec<PayloadReceiver>,
+}
+
+impl FrameSetReceiver {
+    /// Receives [`FrameSet`]. An error of a camera is received as is.
+    pub async fn recv(&self) -> StreamResult<FrameSet> {
+        self.rx.recv().await?
+    }
+
+    /// Tries to receive [`FrameSet`].
+    /// This method doesn't wait arrival of a frame set and immediately returns `StreamError` if
+    /// the channel is empty.
+    pub fn try_recv(&self) -> StreamResult<FrameSet> {
+        self.rx.try_recv()?
+    }
+
+    /// Receives [`FrameSet`].
+    /// If the channel is empty, this method blocks until a frame set is matched.
+    pub fn recv_blocking(&self) -> StreamResult<FrameSet> {
+        self.rx.recv_blocking()?
+    }
+
+    /// Sends back payloads of `frame_set` to each camera to reuse their buffers.
+    pub fn send_back(&self, frame_set: FrameSet) {
+        for (payload_rx, payload) in self.payload_rxs.iter().zip(frame_set.payloads) {
+            payload_rx.send_back(payload);
+        }
+    }
+}
+
+/// Statistics of the dispatcher of [`CameraGroup`].
+#[derive(Debug, Default)]
+pub struct GroupStats {
+    sets_delivered: AtomicU64,
+    sets_dropped: AtomicU64,
+    stragglers: AtomicU64,
+    errors: AtomicU64,
+}
+
+impl GroupStats {
+    /// Returns the current values of the statistics.
+    #[must_use]
+    pub fn snapshot(&self) -> GroupStatsSnapshot {
+        GroupStatsSnapshot {
+            sets_delivered: self.sets_delivered.load(Ordering::Relaxed),
+            sets_dropped: self.sets_dropped.load(Ordering::Relaxed),
+            stragglers: self.stragglers.load(Ordering::Relaxed),
+            errors: self.errors.load(Ordering::Relaxed),
+        }
+    }
+
+    fn add(counter: &AtomicU64) {
+        counter.fetch_add(1, Ordering::Relaxed);
+    }
+}
+
+/// Values of [`GroupStats`] at a point in time.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct GroupStatsSnapshot {
+    /// Frame sets delivered to [`FrameSetReceiver`].
+    pub sets_delivered: u64,
+    /// Frame sets dropped because [`FrameSetReceiver`] was full.
+    pub sets_dropped: u64,
+    /// Payloads dropped without being matched.
+    pub stragglers: u64,
+    /// Errors received from the cameras.
+    pub errors: u64,
+}
+
+/// Handle of the running [`Dispatcher`]. The dispatcher is cancelled when the handle is dropped.
+struct DispatcherHandle {
+    cancelled: Arc<AtomicBool>,
+    join_handle: Option<JoinHandle<()>>,
+}
+
+impl DispatcherHandle {
+    fn cancel(&self) {
+        self.cancelled.store(true, Ordering::Release);
+        if let Some(join_handle) = &self.join_handle {
+            join_handle.thread().unpark();
+        }
+    }
+
+    fn join(mut self) -> thread::Result<()> {
+        self.cancel();
+        self.join_handle.take().unwrap().join()
+    }
+}
+
+impl Drop for DispatcherHandle {
+    fn drop(&mut self) {
+        self.cancel();
+    }
+}
+
+struct Dispatcher {
+    payload_rxs: Vec<PayloadReceiver>,
+    matcher: FrameMatcher,
+    clock: FrameClock,
+    /// Origin of the host timestamps.
+    anchor: Instant,
+    sender: Sender<StreamResult<FrameSet>>,
+    stats: Arc<GroupStats>,
+    cancelled: Arc<AtomicBool>,
+}
+
+impl Dispatcher {
+    fn run(mut self) {
+        // Receivers wake up the dispatcher as soon as payloads are delivered.
+        let waker = Waker::from(Arc::new(ThreadWaker(thread::current())));
+        let mut cx = Context::from_waker(&waker);
+
+        while !self.cancelled.load(Ordering::Acquire) {
+            if !self.poll_receivers(&mut cx) {
+                info!("a stream of the group has ended");
+                break;
+            }
+
+            let Self {
+                payload_rxs,
+                matcher,
+                sender,
+                stats,
+                ..
+            } = &mut self;
+            let mut recycle = |camera: usize, payload| {
+                GroupStats::add(&stats.stragglers);
+                payload_rxs[camera].send_back(payload);
+            };
+            matcher.expire(Instant::now(), &mut recycle);
+            while let Some(frame_set) = matcher.next_set(&mut recycle) {
+                match sender.try_send(Ok(frame_set)) {
+                    Ok(()) => GroupStats::add(&stats.sets_delivered),
+                    Err(err) => {
+                        GroupStats::add(&stats.sets_dropped);
+                        if let Ok(frame_set) = err.into_inner() {
+                            for (payload_rx, payload) in payload_rxs.iter().zip(frame_set.payloads)
+                            {
+                                payload_rx.send_back(payload);
+                            }
+                        }
+                    }
+                }
+            }
+
+            thread::park_timeout(DISPATCH_INTERVAL);
+        }
+    }
+
+    /// Moves all delivered payloads into the matcher. Returns `false` if any stream has ended.
+    fn poll_receivers(&mut self, cx: &mut Context<'_>) -> bool {
+        let now = Instant::now();
+        for camera in 0..self.payload_rxs.len() {
+            loop {
+                match Pin::new(&mut self.payload_rxs[camera]).poll_next(cx) {
+                    Poll::Ready(Some(Ok(payload))) => {
+                        let timestamp = match self.clock {
+                            FrameClock::Device => payload.timestamp(),
+                            FrameClock::Host => payload
+                                .host_timestamp()
+                                .map_or(now, |ts| ts.leader)
+                                .saturating_duration_since(self.anchor),
+                        };
+                        let Self {
+                            payload_rxs,
+                            matcher,
+                            stats,
+                            ..
+                        } = self;
+                        matcher.push(camera, timestamp, payload, now, &mut |camera, payload| {
+                            GroupStats::add(&stats.stragglers);
+                            payload_rxs[camera].send_back(payload);
+                        });
+                    }
+                    Poll::Ready(Some(Err(err))) => {
+                        warn!(camera, ?err);
+                        GroupStats::add(&self.stats.errors);
+                        self.sender.try_send(Err(err)).ok();
+                    }
+                    Poll::Ready(None) => return false,
+                    Poll::Pending => break,
+                }
+            }
+        }
+        true
+    }
+}
+
+struct ThreadWaker(Thread);
+
+impl Wake for ThreadWaker {
+    fn wake(self: Arc<Self>) {
+        self.0.unpark();
+    }
+
+    fn wake_by_ref(self: &Arc<Self>) {
+        self.0.unpark();
+    }
+}
+
+/// Matches payloads of cameras by timestamp, assuming that timestamps of each camera increase
+/// monotonically.
+struct FrameMatcher {
+    queues: Vec<VecDeque<Pending>>,
+    /// The latest timestamp of each camera, including payloads which have left the queue.
+    latest: Vec<Option<Duration>>,
+    tolerance: Duration,
+    queue_depth: usize,
+    max_wait: Duration,
+}
+
+struct Pending {
+    payload: Payload,
+    timestamp: Duration,
+    arrived_at: Instant,
+}
+
+impl FrameMatcher {
+    fn new(camera_count: usize, params: &GroupParams) -> Self {
+        Self {
+            queues: (0..camera_count)
+                .map(|_| VecDeque::with_capacity(params.queue_depth))
+                .collect(),
+            latest: vec![None; camera_count],
+            tolerance: params.tolerance,
+            queue_depth: params.queue_depth,
+            max_wait: params.max_wait,
+        }
+    }
+
+    fn push(
+        &mut self,
+        camera: usize,
+        timestamp: Duration,
+        payload: Payload,
+        arrived_at: Instant,
+        recycle: &mut impl FnMut(usize, Payload),
+    ) {
+        let queue = &mut self.queues[camera];
+        if queue.len() == self.queue_depth {
+            recycle(camera, queue.pop_front().unwrap().payload);
+        }
+        queue.push_back(Pending {
+            payload,
+            timestamp,
+            arrived_at,
+        });
+        self.latest[camera] = Some(timestamp);
+    }
+
+    /// Drops payloads which have waited for their partners longer than `max_wait`.
+    fn expire(&mut self, now: Instant, recycle: &mut impl FnMut(usize, Payload)) {
+        for (camera, queue) in self.queues.iter_mut().enumerate() {
+            while matches!(queue.front(), Some(head) if now - head.arrived_at >= self.max_wait) {
+                recycle(camera, queue.pop_front().unwrap().payload);
+            }
+        }
+    }
+
+    /// Returns the next matched frame set, dropping payloads which turn out to be unmatchable.
+    fn next_set(&mut self, recycle: &mut impl FnMut(usize, Payload)) -> Option<FrameSet> {
+        loop {
+            // A payload can't be matched any more if a camera has sent only newer payloads
+            // beyond the tolerance since then.
+            let frontier = self
+                .queues
+                .iter()
+                .zip(&self.latest)
+                .filter_map(|(queue, latest)| queue.front().map(|head| head.timestamp).or(*latest))
+                .max()?;
+            let mut dropped = false;
+            for (camera, queue) in self.queues.iter_mut().enumerate() {
+                while matches!(queue.front(), Some(head) if head.timestamp + self.tolerance < frontier)
+                {
+                    recycle(camera, queue.pop_front().unwrap().payload);
+                    dropped = true;
+                }
+            }
+            if dropped {
+                continue;
+            }
+
+            if self.queues.iter().any(VecDeque::is_empty) {
+                return None;
+            }
+            let heads = self.queues.iter().map(|queue| queue[0].timestamp);
+            let earliest = heads.clone().min().unwrap();
+            let skew = heads.max().unwrap() - earliest;
+            // Heads are within the tolerance, otherwise the earliest one has been dropped.
+            debug_assert!(skew <= self.tolerance);
+            let payloads = self
+                .queues
+                .iter_mut()
+                .map(|queue| queue.pop_front().unwrap().payload)
+                .collect();
+            return Some(FrameSet {
+                payloads,
+                timestamp: earliest,
+                skew,
+            });
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use crate::payload::{PayloadBuffer, PayloadType};
+
+    fn payload(id: u64) -> Payload {
+        Payload {
+            id,
+            payload_type: PayloadType::Image,
+            image_info: None,
+            chunks: vec![],
+            payload: PayloadBuffer::default(),
+            valid_payload_size: 0,
+            timestamp: Duration::default(),
+            host_timestamp: None,
+        }
+    }
+
+    fn matcher(camera_count: usize) -> FrameMatcher {
+        let params = GroupParams {
+            tolerance: Duration::from_millis(2),
+            queue_depth: 3,
+            max_wait: Duration::from_millis(100),
+            ..GroupParams::default()
+        };
+        FrameMatcher::new(camera_count, &params)
+    }
+
+    #[test]
+    fn test_match_frames() {
+        let mut matcher = matcher(3);
+        let mut dropped = vec![];
+        let mut recycle = |camera, payload: Payload| dropped.push((camera, payload.id()));
+        let now = Instant::now();
+        let push = |matcher: &mut FrameMatcher, camera, ms, recycle: &mut _| {
+            matcher.push(camera, Duration::from_millis(ms), payload(ms), now, recycle);
+        };
+
+        push(&mut matcher, 0, 10, &mut recycle);
+        push(&mut matcher, 1, 11, &mut recycle);
+        assert!(matcher.next_set(&mut recycle).is_none());
+        push(&mut matcher, 2, 9, &mut recycle);
+        let frame_set = matcher.next_set(&mut recycle).unwrap();
+        let ids: Vec<_> = frame_set.payloads().iter().map(Payload::id).collect();
+        assert_eq!(ids, vec![10, 11, 9]);
+        assert_eq!(frame_set.timestamp(), Duration::from_millis(9));
+        assert_eq!(frame_set.skew(), Duration::from_millis(2));
+
+        // Camera 2 misses the frame at 20ms. The stragglers are dropped as soon as camera 2
+        // sends the next frame.
+        push(&mut matcher, 0, 20, &mut recycle);
+        push(&mut matcher, 1, 20, &mut recycle);
+        assert!(matcher.next_set(&mut recycle).is_none());
+        push(&mut matcher, 2, 30, &mut recycle);
+        assert!(matcher.next_set(&mut recycle).is_none());
+        push(&mut matcher, 0, 31, &mut recycle);
+        push(&mut matcher, 1, 29, &mut recycle);
+        let frame_set = matcher.next_set(&mut recycle).unwrap();
+        let ids: Vec<_> = frame_set.payloads().iter().map(Payload::id).collect();
+        assert_eq!(ids, vec![31, 29, 30]);
+        assert!(matcher.queues.iter().all(VecDeque::is_empty));
+
+        assert_eq!(dropped, vec![(0, 20), (1, 20)]);
+    }
+
+    #[test]
+    fn test_bounded_queue() {
+        let mut matcher = matcher(2);
+        let mut dropped = vec![];
+        let mut recycle = |camera, payload: Payload| dropped.push((camera, payload.id()));
+        let now = Instant::now();
+
+        // Camera 1 never sends a frame.
+        for id in 0..5 {
+            let timestamp = Duration::from_millis(id * 10);
+            matcher.push(0, timestamp, payload(id), now, &mut recycle);
+            assert!(matcher.next_set(&mut recycle).is_none());
+        }
+        assert_eq!(matcher.queues[0].len(), 3);
+
+        matcher.expire(now + Duration::from_millis(50), &mut recycle);
+        assert_eq!(matcher.queues[0].len(), 3);
+        matcher.expire(now + Duration::from_millis(100), &mut recycle);
+        assert!(matcher.queues[0].is_empty());
+
+        let ids: Vec<_> = dropped.iter().map(|(_, id)| *id).collect();
+        assert_eq!(ids, vec![0, 1, 2, 3, 4]);
+    }
+
+    #[cfg(feature = "emulator")]
+    #[test]
+    fn test_emulated_group() {
+        use crate::u3v::emulator::{self, EmulatorConfig};
+
+        let cameras = (0..2)
+            .map(|i| {
+                emulator::camera(EmulatorConfig {
+                    width: 16,
+                    height: 16,
+                    frame_rate: 100.0,
+                    serial_number: format!("EMU{:04}", i),
+                })
+            })
+            .collect();
+        let mut group = CameraGroup::new(cameras);
+        // Emulated cameras aren't triggered together, allow any phase difference.
+        group.params_mut().tolerance = Duration::from_millis(10);
+        group.open().unwrap();
+        group.load_context().unwrap();
+
+        let frame_set_rx = group.start_streaming(2).unwrap();
+        assert!(group.start_streaming(2).is_err());
+        for _ in 0..3 {
+            let frame_set = frame_set_rx.recv_blocking().unwrap();
+            assert_eq!(frame_set.payloads().len(), 2);
+            assert!(frame_set.skew() <= Duration::from_millis(10));
+            frame_set_rx.send_back(frame_set);
+        }
+
+        group.stop_streaming().unwrap();
+        assert!(!group.is_streaming());
+        assert!(group.stats().snapshot().sets_delivered >= 3);
+        group.close().unwrap();
+    }
+}
@@ -11,7 +11,7 @@
 //! `cameleon` is a library for operating on `GenICam` compatible cameras.
 //! Our main goal is to provide safe, fast, and flexible library for `GenICam` cameras.
 //!
-//! Currently, `cameleon` supports only `USB3 Vision` cameras, but it's planned to support other protocols including `GigE Vision`. See [Roadmap][roadmap-url] for more details.
+//! Currently, `cameleon` supports `USB3 Vision` and `GigE Vision` cameras. See [Roadmap][roadmap-url] for more details.
 //!
 //! [roadmap-url]: https://github.com/cameleon-rs/cameleon#roadmap
 //!
@@ -80,6 +80,17 @@
 //! camera.close().unwrap();
 //! ```
 //!
+//! ### GigE Vision cameras
+//! `GigE Vision` cameras are available with the `gige` feature, which doesn't need any external
+//! library.
+//! ```toml
+//! [dependencies]
+//! cameleon = { version = "0.1", features = ["gige"] }
+//! ```
+//!
+//! Cameras are enumerated by `cameleon::gige::enumerate_cameras`, and operated in the same way as
+//! `USB3 Vision` cameras.
+//!
 //! More examples can be found [here][cameleon-example].
 //!
 //! [libusb-url]: https://libusb.info
@@ -131,6 +142,16 @@
 //! echo 1000 > /sys/module/usbcore/parameters/usbfs_memory_mb
 //! ```
 //!
+//! ### GigE Vision
+//! #### How to avoid packet loss at high frame rates
+//! The stream handle requests a large socket receive buffer, but Linux caps it by
+//! `net.core.rmem_max`. We recommend raising the limit for 10GigE cameras, e.g.
+//! ```sh
+//! sysctl -w net.core.rmem_max=67108864
+//! ```
+//! Jumbo frames, i.e. a large MTU of the interface and a large `GevSCPSPacketSize`, also reduce the
+//! number of packets to receive.
+//!
 //! ## License
 //! This project is licenced under [MPL 2.0][license].
 //!
@@ -144,11 +165,17 @@
 )]
 
 pub mod camera;
+pub mod clock;
+pub mod convert;
 pub mod genapi;
+#[cfg(feature = "libusb")]
+pub mod genicam;
+pub mod group;
 pub mod payload;
+#[cfg(feature = "gige")]
+pub mod gige;
 #[cfg(feature = "libusb")]
 pub mod u3v;
-pub mod genicam;
 
 pub use camera::{Camera, CameraInfo, DeviceControl, PayloadStream};
 
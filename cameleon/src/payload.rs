@@ -9,11 +9,26 @@
 
 pub use cameleon_device::PixelFormat;
 
-use std::time;
+use std::{
+    alloc,
+    collections::VecDeque,
+    convert::TryInto,
+    fmt,
+    ops::{Deref, DerefMut},
+    pin::Pin,
+    ptr::NonNull,
+    sync::{
+        atomic::{AtomicU64, AtomicUsize, Ordering},
+        Arc, Condvar, Mutex,
+    },
+    task::{Context, Poll},
+    time,
+};
 
 use async_channel::{Receiver, Sender};
+use futures_core::Stream;
 
-use super::{StreamError, StreamResult};
+use super::{clock::ClockCorrelation, StreamError, StreamResult};
 
 /// Represents Payload type of the image.
 #[derive(Clone, Copy, Debug, PartialEq, Eq)]
@@ -45,15 +60,78 @@ pub struct ImageInfo {
     pub image_size: usize,
 }
 
+/// Location of a chunk in the payload.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct ChunkLayout {
+    /// Chunk ID, which corresponds to `ChunkID` of a `GenApi` chunk port.
+    pub id: u32,
+    /// Offset of the chunk data from the beginning of the payload.
+    pub offset: usize,
+    /// Length of the chunk data in bytes.
+    pub len: usize,
+}
+
+impl ChunkLayout {
+    /// Builds the index of chunks in `data`.
+    ///
+    /// Each chunk is followed by a trailer of its big endian ID and length, so chunk data is
+    /// decoded from the last byte to the first byte.
+    pub(crate) fn parse_all(data: &[u8]) -> StreamResult<Vec<Self>> {
+        const CHUNK_ID_LEN: usize = 4;
+        const CHUNK_SIZE_LEN: usize = 4;
+
+        let read_u32 =
+            |offset: usize| u32::from_be_bytes(data[offset..offset + 4].try_into().unwrap());
+
+        let mut chunks = vec![];
+        let mut current_offset = data.len();
+        while current_offset != 0 {
+            current_offset = current_offset.checked_sub(CHUNK_SIZE_LEN).ok_or_else(|| {
+                StreamError::InvalidPayload("failed to parse chunk data: size field missing".into())
+            })?;
+            let len = read_u32(current_offset) as usize;
+            current_offset = current_offset.checked_sub(CHUNK_ID_LEN).ok_or_else(|| {
+                StreamError::InvalidPayload("failed to parse chunk data: id field missing".into())
+            })?;
+            let id = read_u32(current_offset);
+            current_offset = current_offset.checked_sub(len).ok_or_else(|| {
+                StreamError::InvalidPayload(
+                    "failed to parse chunk data: chunk data size is smaller than specified size"
+                        .into(),
+                )
+            })?;
+            chunks.push(Self {
+                id,
+                offset: current_offset,
+                len,
+            });
+        }
+
+        chunks.reverse();
+        Ok(chunks)
+    }
+}
+
 /// A payload sent from the device.
 #[derive(Clone, Debug, PartialEq, Eq)]
 pub struct Payload {
     pub(crate) id: u64,
     pub(crate) payload_type: PayloadType,
     pub(crate) image_info: Option<ImageInfo>,
-    pub(crate) payload: Vec<u8>,
+    pub(crate) chunks: Vec<ChunkLayout>,
+    pub(crate) payload: PayloadBuffer,
     pub(crate) valid_payload_size: usize,
     pub(crate) timestamp: time::Duration,
+    pub(crate) host_timestamp: Option<HostTimestamp>,
+}
+
+/// Host monotonic time when transfers of a payload were completed.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct HostTimestamp {
+    /// When the leader was received.
+    pub leader: time::Instant,
+    /// When the trailer was received, i.e. when the whole payload was received.
+    pub trailer: time::Instant,
 }
 
 impl Payload {
@@ -81,6 +159,22 @@ impl Payload {
         &self.payload[..self.valid_payload_size]
     }
 
+    /// Returns the data of the chunk with `id` without copying, or `None` if the payload has no
+    /// such chunk.
+    pub fn chunk(&self, id: u32) -> Option<&[u8]> {
+        self.chunks
+            .iter()
+            .find(|chunk| chunk.id == id)
+            .map(|chunk| &self.payload[chunk.offset..chunk.offset + chunk.len])
+    }
+
+    /// Returns the layouts of all chunks in the payload in the order of the payload.
+    ///
+    /// Empty if `payload_type` is [`PayloadType::Image`].
+    pub fn chunk_layouts(&self) -> &[ChunkLayout] {
+        &self.chunks
+    }
+
     /// Returns unique id of `payload`, which sequentially incremented every time the device send a
     /// `payload`.
     pub fn id(&self) -> u64 {
@@ -92,49 +186,589 @@ impl Payload {
         self.timestamp
     }
 
+    /// Returns the host monotonic time when the payload was received, if the stream records it.
+    pub fn host_timestamp(&self) -> Option<HostTimestamp> {
+        self.host_timestamp
+    }
+
+    /// Estimates the host monotonic time corresponding to [`Self::timestamp`], i.e. when the
+    /// device generated the payload.
+    ///
+    /// Returns `None` if `clock` has no sample yet.
+    pub fn host_exposure_time(&self, clock: &ClockCorrelation) -> Option<time::Instant> {
+        clock.host_time(self.timestamp)
+    }
+
     /// Returns the payload as `Vec<u8>`.
-    pub fn into_vec(mut self) -> Vec<u8> {
-        self.payload.resize(self.valid_payload_size, 0);
-        self.payload
+    ///
+    /// If the payload is backed by [`PayloadBufferPool`], the valid bytes are copied and the buffer
+    /// is returned to the pool.
+    pub fn into_vec(self) -> Vec<u8> {
+        self.payload.into_vec_truncated(self.valid_payload_size)
+    }
+
+    /// Converts the payload into [`SharedPayload`] to share it across threads without copying.
+    pub fn into_shared(self) -> SharedPayload {
+        self.into()
     }
 }
 
-/// An Receiver of the `Payload` which is sent from a device.
+/// A [`Payload`] which can be cheaply shared across threads.
+///
+/// Cloning `SharedPayload` doesn't copy the payload bytes. If the payload is backed by
+/// [`PayloadBufferPool`], its buffer is returned to the pool when the last clone is dropped.
 #[derive(Debug, Clone)]
+pub struct SharedPayload(Arc<Payload>);
+
+impl SharedPayload {
+    /// Returns the inner [`Payload`] if `self` is the last clone, otherwise returns `self` as is.
+    pub fn try_unwrap(self) -> Result<Payload, Self> {
+        Arc::try_unwrap(self.0).map_err(Self)
+    }
+
+    /// Returns the number of clones which share the payload.
+    pub fn share_count(&self) -> usize {
+        Arc::strong_count(&self.0)
+    }
+}
+
+impl Deref for SharedPayload {
+    type Target = Payload;
+
+    fn deref(&self) -> &Payload {
+        &self.0
+    }
+}
+
+impl From<Payload> for SharedPayload {
+    fn from(payload: Payload) -> Self {
+        Self(Arc::new(payload))
+    }
+}
+
+/// A buffer which holds bytes of [`Payload`].
+///
+/// A buffer acquired from [`PayloadBufferPool`] is returned to the pool when it's dropped.
+/// Cloning the buffer makes a heap allocated copy which doesn't belong to any pool.
+pub struct PayloadBuffer {
+    inner: BufferInner,
+}
+
+enum BufferInner {
+    Owned(Vec<u8>),
+    Pooled {
+        ptr: NonNull<u8>,
+        len: usize,
+        pool: Arc<PoolShared>,
+    },
+}
+
+// Safety: `PayloadBuffer` uniquely owns its memory as `Vec<u8>` does.
+unsafe impl Send for PayloadBuffer {}
+unsafe impl Sync for PayloadBuffer {}
+
+impl PayloadBuffer {
+    /// Returns `true` if the buffer belongs to [`PayloadBufferPool`].
+    pub fn is_pooled(&self) -> bool {
+        matches!(self.inner, BufferInner::Pooled { .. })
+    }
+
+    /// Converts the buffer into `Vec<u8>`.
+    ///
+    /// If the buffer belongs to [`PayloadBufferPool`], the bytes are copied and the buffer is
+    /// returned to the pool.
+    pub fn into_vec(self) -> Vec<u8> {
+        let len = self.len();
+        self.into_vec_truncated(len)
+    }
+
+    fn into_vec_truncated(mut self, len: usize) -> Vec<u8> {
+        match &mut self.inner {
+            BufferInner::Owned(vec) => {
+                let mut vec = std::mem::take(vec);
+                vec.truncate(len);
+                vec
+            }
+            BufferInner::Pooled { .. } => self[..len].to_vec(),
+        }
+    }
+}
+
+impl Deref for PayloadBuffer {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match &self.inner {
+            BufferInner::Owned(vec) => vec,
+            // Safety: `ptr` points to initialized memory of `len` bytes which is uniquely owned by
+            // `self` until `self` is dropped.
+            BufferInner::Pooled { ptr, len, .. } => unsafe {
+                std::slice::from_raw_parts(ptr.as_ptr(), *len)
+            },
+        }
+    }
+}
+
+impl DerefMut for PayloadBuffer {
+    fn deref_mut(&mut self) -> &mut [u8] {
+        match &mut self.inner {
+            BufferInner::Owned(vec) => vec,
+            // Safety: Same as `deref`.
+            BufferInner::Pooled { ptr, len, .. } => unsafe {
+                std::slice::from_raw_parts_mut(ptr.as_ptr(), *len)
+            },
+        }
+    }
+}
+
+impl Drop for PayloadBuffer {
+    fn drop(&mut self) {
+        if let BufferInner::Pooled { ptr, len, pool } = &self.inner {
+            pool.free.lock().unwrap().push_back(RawBuffer {
+                ptr: *ptr,
+                len: *len,
+            });
+        }
+    }
+}
+
+impl Default for PayloadBuffer {
+    fn default() -> Self {
+        Vec::new().into()
+    }
+}
+
+impl From<Vec<u8>> for PayloadBuffer {
+    fn from(vec: Vec<u8>) -> Self {
+        Self {
+            inner: BufferInner::Owned(vec),
+        }
+    }
+}
+
+impl Clone for PayloadBuffer {
+    fn clone(&self) -> Self {
+        self.to_vec().into()
+    }
+}
+
+impl PartialEq for PayloadBuffer {
+    fn eq(&self, other: &Self) -> bool {
+        **self == **other
+    }
+}
+
+impl Eq for PayloadBuffer {}
+
+impl fmt::Debug for PayloadBuffer {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("PayloadBuffer")
+            .field("len", &self.len())
+            .field("is_pooled", &self.is_pooled())
+            .finish()
+    }
+}
+
+/// Allocates memory of buffers in [`PayloadBufferPool`].
+pub trait BufferAllocator: Send + Sync {
+    /// Allocates `len` bytes of memory. Returns `None` if the allocation fails.
+    ///
+    /// The memory doesn't need to be initialized.
+    fn allocate(&self, len: usize) -> Option<NonNull<u8>>;
+
+    /// Deallocates the memory.
+    ///
+    /// # Safety
+    /// `ptr` MUST be allocated by [`Self::allocate`] of the same allocator with the same `len`.
+    unsafe fn deallocate(&self, ptr: NonNull<u8>, len: usize);
+}
+
+/// Allocates page aligned heap memory.
+#[derive(Debug, Clone, Copy, Default)]
+pub struct HeapAllocator;
+
+impl HeapAllocator {
+    const ALIGNMENT: usize = 4096;
+}
+
+impl BufferAllocator for HeapAllocator {
+    fn allocate(&self, len: usize) -> Option<NonNull<u8>> {
+        let layout = alloc::Layout::from_size_align(len, Self::ALIGNMENT).ok()?;
+        if layout.size() == 0 {
+            return None;
+        }
+        // Safety: The size of `layout` is non-zero.
+        NonNull::new(unsafe { alloc::alloc(layout) })
+    }
+
+    unsafe fn deallocate(&self, ptr: NonNull<u8>, len: usize) {
+        let layout = alloc::Layout::from_size_align_unchecked(len, Self::ALIGNMENT);
+        alloc::dealloc(ptr.as_ptr(), layout);
+    }
+}
+
+/// Allocates memory backed by huge pages, which reduces TLB misses when large payloads are
+/// touched.
+///
+/// Only supported on Linux, and huge pages must be reserved in advance (e.g.
+/// `/proc/sys/vm/nr_hugepages`).
+#[derive(Debug, Clone, Copy, Default)]
+pub struct HugePageAllocator;
+
+impl HugePageAllocator {
+    #[cfg(target_os = "linux")]
+    const HUGE_PAGE_SIZE: usize = 2 * 1024 * 1024;
+
+    #[cfg(target_os = "linux")]
+    fn mapping_size(len: usize) -> usize {
+        (len + Self::HUGE_PAGE_SIZE - 1) & !(Self::HUGE_PAGE_SIZE - 1)
+    }
+}
+
+impl BufferAllocator for HugePageAllocator {
+    #[cfg(target_os = "linux")]
+    fn allocate(&self, len: usize) -> Option<NonNull<u8>> {
+        if len == 0 {
+            return None;
+        }
+        // Safety: Anonymous mapping doesn't have any precondition.
+        let ptr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                Self::mapping_size(len),
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_PRIVATE | libc::MAP_ANONYMOUS | libc::MAP_HUGETLB,
+                -1,
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            None
+        } else {
+            NonNull::new(ptr.cast())
+        }
+    }
+
+    #[cfg(not(target_os = "linux"))]
+    fn allocate(&self, _len: usize) -> Option<NonNull<u8>> {
+        None
+    }
+
+    #[cfg(target_os = "linux")]
+    unsafe fn deallocate(&self, ptr: NonNull<u8>, len: usize) {
+        libc::munmap(ptr.as_ptr().cast(), Self::mapping_size(len));
+    }
+
+    #[cfg(not(target_os = "linux"))]
+    unsafe fn deallocate(&self, _ptr: NonNull<u8>, _len: usize) {
+        unreachable!()
+    }
+}
+
+/// A fixed set of pre-allocated [`PayloadBuffer`]s.
+///
+/// All buffers are allocated and zero-initialized when the pool is created, so acquiring a buffer
+/// from the pool never allocates. A buffer is returned to the pool when it's dropped, and the
+/// memory is deallocated when both the pool and all its buffers are dropped.
+///
+/// A pool created by [`PayloadBufferPool::external`] doesn't own memory. Instead, buffers are lent
+/// by their owner, e.g. buffers announced by a GenTL consumer, so that payloads are received
+/// directly into them.
+#[derive(Clone)]
+pub struct PayloadBufferPool {
+    shared: Arc<PoolShared>,
+}
+
+struct PoolShared {
+    /// `None` if the memory of buffers is lent by [`PayloadBufferPool::lend`].
+    allocator: Option<Box<dyn BufferAllocator>>,
+    buffer_size: usize,
+    buffer_count: AtomicUsize,
+    free: Mutex<VecDeque<RawBuffer>>,
+}
+
+struct RawBuffer {
+    ptr: NonNull<u8>,
+    len: usize,
+}
+
+// Safety: Buffers in the free list aren't owned by anyone.
+unsafe impl Send for RawBuffer {}
+
+impl PayloadBufferPool {
+    /// Allocates `buffer_count` buffers of `buffer_size` bytes with `allocator`.
+    ///
+    /// Returns `None` if `buffer_size` is zero or `allocator` fails to allocate the buffers.
+    pub fn new(
+        allocator: impl BufferAllocator + 'static,
+        buffer_size: usize,
+        buffer_count: usize,
+    ) -> Option<Self> {
+        if buffer_size == 0 {
+            return None;
+        }
+
+        let mut free = VecDeque::with_capacity(buffer_count);
+        for _ in 0..buffer_count {
+            match allocator.allocate(buffer_size) {
+                Some(ptr) => {
+                    // Safety: `ptr` points to `buffer_size` bytes just allocated.
+                    unsafe { std::ptr::write_bytes(ptr.as_ptr(), 0, buffer_size) };
+                    free.push_back(RawBuffer {
+                        ptr,
+                        len: buffer_size,
+                    });
+                }
+                None => {
+                    for buf in free {
+                        // Safety: `buf` is allocated above with the same size.
+                        unsafe { allocator.deallocate(buf.ptr, buffer_size) };
+                    }
+                    return None;
+                }
+            }
+        }
+
+        Some(Self {
+            shared: Arc::new(PoolShared {
+                allocator: Some(Box::new(allocator)),
+                buffer_size,
+                buffer_count: AtomicUsize::new(buffer_count),
+                free: Mutex::new(free),
+            }),
+        })
+    }
+
+    /// Creates a pool without buffers, which accepts buffers of at least `buffer_size` bytes lent
+    /// by [`Self::lend`].
+    ///
+    /// Lent buffers are acquired in the order they are lent.
+    pub fn external(buffer_size: usize) -> Self {
+        Self {
+            shared: Arc::new(PoolShared {
+                allocator: None,
+                buffer_size,
+                buffer_count: AtomicUsize::new(0),
+                free: Mutex::new(VecDeque::new()),
+            }),
+        }
+    }
+
+    /// Lends a buffer of `len` bytes to the pool created by [`Self::external`].
+    ///
+    /// Returns `false` without lending the buffer if the pool owns its memory or `len` is smaller
+    /// than [`Self::buffer_size`].
+    ///
+    /// # Safety
+    /// `ptr` MUST be valid for reads and writes of `len` bytes, and MUST NOT be accessed nor freed
+    /// until it's taken back by [`Self::take_back`]. Note that the buffer is returned to the pool
+    /// when [`PayloadBuffer`] acquired from the pool is dropped.
+    pub unsafe fn lend(&self, ptr: NonNull<u8>, len: usize) -> bool {
+        if self.shared.allocator.is_some() || len < self.buffer_size() {
+            return false;
+        }
+        self.shared
+            .free
+            .lock()
+            .unwrap()
+            .push_back(RawBuffer { ptr, len });
+        self.shared.buffer_count.fetch_add(1, Ordering::Relaxed);
+        true
+    }
+
+    /// Takes back the buffer lent by [`Self::lend`].
+    ///
+    /// Returns `false` if the buffer is not lent or is in use.
+    pub fn take_back(&self, ptr: NonNull<u8>) -> bool {
+        let mut free = self.shared.free.lock().unwrap();
+        match free.iter().position(|buf| buf.ptr == ptr) {
+            Some(pos) if self.shared.allocator.is_none() => {
+                free.remove(pos);
+                self.shared.buffer_count.fetch_sub(1, Ordering::Relaxed);
+                true
+            }
+            _ => false,
+        }
+    }
+
+    /// Returns `true` if both refer to the same pool.
+    pub fn ptr_eq(this: &Self, other: &Self) -> bool {
+        Arc::ptr_eq(&this.shared, &other.shared)
+    }
+
+    /// Acquires a buffer from the pool. Returns `None` if all buffers are in use.
+    pub fn acquire(&self) -> Option<PayloadBuffer> {
+        let mut free = self.shared.free.lock().unwrap();
+        // Reuse the most recently returned buffer, which is likely still in the cache. Lent
+        // buffers are filled in the order their owner lent them.
+        let buf = if self.shared.allocator.is_some() {
+            free.pop_back()
+        } else {
+            free.pop_front()
+        }?;
+        Some(PayloadBuffer {
+            inner: BufferInner::Pooled {
+                ptr: buf.ptr,
+                len: buf.len,
+                pool: self.shared.clone(),
+            },
+        })
+    }
+
+    /// Returns the size of each buffer in bytes.
+    ///
+    /// For the pool created by [`Self::external`], this is the minimum size of lent buffers.
+    pub fn buffer_size(&self) -> usize {
+        self.shared.buffer_size
+    }
+
+    /// Returns the number of buffers owned by the pool, or lent to the pool.
+    pub fn buffer_count(&self) -> usize {
+        self.shared.buffer_count.load(Ordering::Relaxed)
+    }
+
+    /// Returns the number of buffers which are not in use.
+    pub fn available(&self) -> usize {
+        self.shared.free.lock().unwrap().len()
+    }
+}
+
+impl fmt::Debug for PayloadBufferPool {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("PayloadBufferPool")
+            .field("buffer_size", &self.buffer_size())
+            .field("buffer_count", &self.buffer_count())
+            .field("available", &self.available())
+            .finish()
+    }
+}
+
+impl Drop for PoolShared {
+    fn drop(&mut self) {
+        // All buffers have been returned because each of them holds `Arc<PoolShared>`.
+        // Lent buffers are owned by the lender.
+        if let Some(allocator) = &self.allocator {
+            for buf in self.free.get_mut().unwrap().drain(..) {
+                // Safety: `buf` is allocated by `allocator` with `buffer_size`.
+                unsafe { allocator.deallocate(buf.ptr, self.buffer_size) };
+            }
+        }
+    }
+}
+
+/// An Receiver of the `Payload` which is sent from a device.
+///
+/// The receiver is also a [`Stream`] of payloads, which ends when the device side of the channel
+/// is closed. The stream is woken up as soon as the streaming loop delivers a payload, so many
+/// cameras can be multiplexed on a few executor threads.
+/// ```no_run
+/// # async fn f(receiver: cameleon::payload::PayloadReceiver) {
+/// use futures_util::StreamExt;
+///
+/// let mut receiver = receiver;
+/// while let Some(payload) = receiver.next().await {
+///     match payload {
+///         Ok(payload) => println!("payload received! block_id: {:?}", payload.id()),
+///         Err(e) => println!("payload error! {e}"),
+///     }
+/// }
+/// # }
+/// ```
+#[derive(Debug)]
 pub struct PayloadReceiver {
     /// Sends back `payload` to the device for reusing it.
     tx: Sender<Payload>,
 
     /// Receives `payload` from the device.
     rx: Receiver<StreamResult<Payload>>,
+
+    shared: Arc<ChannelShared>,
 }
 
 impl PayloadReceiver {
     /// Receives [`Payload`] sent from the device.
     pub async fn recv(&self) -> StreamResult<Payload> {
-        self.rx.recv().await?
+        let payload = self.rx.recv().await;
+        self.shared.notify_space();
+        payload?
     }
 
     /// Tries to receive [`Payload`].
     /// This method doesn't wait arrival of `payload` and immediately returns `StreamError` if
     /// the channel is empty.
     pub fn try_recv(&self) -> StreamResult<Payload> {
-        self.rx.try_recv()?
+        let payload = self.rx.try_recv();
+        self.shared.notify_space();
+        payload?
+    }
+
+    /// Returns `true` if the sender is dropped, e.g. the streaming loop has stopped.
+    ///
+    /// Payloads sent before the sender is dropped can still be received.
+    #[must_use]
+    pub fn is_closed(&self) -> bool {
+        self.rx.is_closed()
     }
 
     /// Receives [`Payload`] sent from the device.
     /// If the channel is empty, this method blocks until the device produces the payload.
     pub fn recv_blocking(&self) -> StreamResult<Payload> {
-        self.rx.recv_blocking()?
+        let payload = self.rx.recv_blocking();
+        self.shared.notify_space();
+        payload?
     }
 
     /// Sends back [`Payload`] to the device to reuse already allocated `payload`.
     ///
     /// Sending back `payload` may improve performance of streaming, but not required to call this
-    /// method.
+    /// method. A payload backed by [`PayloadBufferPool`] is returned to the pool when it's dropped
+    /// anyway.
     pub fn send_back(&self, payload: Payload) {
         self.tx.try_send(payload).ok();
     }
+
+    /// Returns the numbers of payloads dropped by the [`BackpressurePolicy`] of the channel.
+    #[must_use]
+    pub fn dropped_frames(&self) -> DroppedFrames {
+        self.shared.dropped_frames()
+    }
+}
+
+impl Clone for PayloadReceiver {
+    fn clone(&self) -> Self {
+        self.shared.receivers.fetch_add(1, Ordering::SeqCst);
+        Self {
+            tx: self.tx.clone(),
+            rx: self.rx.clone(),
+            shared: self.shared.clone(),
+        }
+    }
+}
+
+impl Drop for PayloadReceiver {
+    fn drop(&mut self) {
+        // `PayloadSender` may hold a receiving end to evict payloads, so the channel is closed
+        // explicitly when the host drops the last receiver.
+        if self.shared.receivers.fetch_sub(1, Ordering::SeqCst) == 1 {
+            self.rx.close();
+        }
+    }
+}
+
+impl Stream for PayloadReceiver {
+    type Item = StreamResult<Payload>;
+
+    fn poll_next(mut self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Option<Self::Item>> {
+        let poll = Pin::new(&mut self.rx).poll_next(cx);
+        if poll.is_ready() {
+            self.shared.notify_space();
+        }
+        poll
+    }
+
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        self.rx.size_hint()
+    }
 }
 
 /// A sender of the [`Payload`] which is sent to the host.
@@ -144,6 +778,16 @@ pub struct PayloadSender {
     tx: Sender<StreamResult<Payload>>,
     /// Sends back payload to reuse it.
     rx: Receiver<Payload>,
+    /// Pushes payloads dropped by the policy to the send back queue so that their buffers are
+    /// reused.
+    reclaim_tx: Sender<Payload>,
+    /// Evicts the oldest payload from the channel. Only set for
+    /// [`BackpressurePolicy::DropOldest`].
+    ///
+    /// This doesn't keep the channel open, see the `Drop` of [`PayloadReceiver`].
+    evict_rx: Option<Receiver<StreamResult<Payload>>>,
+    policy: BackpressurePolicy,
+    shared: Arc<ChannelShared>,
 }
 
 impl PayloadSender {
@@ -158,26 +802,263 @@ impl PayloadSender {
         Ok(self.tx.try_send(payload)?)
     }
 
+    /// Returns the [`BackpressurePolicy`] of the channel.
+    pub fn policy(&self) -> BackpressurePolicy {
+        self.policy
+    }
+
+    /// Sends [`Payload`] to the host following the [`BackpressurePolicy`] of the channel.
+    ///
+    /// A payload dropped by the policy is counted in [`Self::dropped_frames`], and its buffer is
+    /// reclaimed to be reused for the following payloads.
+    /// Returns `StreamError` only if the channel is closed.
+    pub fn send_with_policy(&self, payload: Payload) -> StreamResult<()> {
+        match self.policy {
+            BackpressurePolicy::DropNewest => match self.tx.try_send(Ok(payload)) {
+                Ok(()) => Ok(()),
+                Err(async_channel::TrySendError::Full(payload)) => {
+                    self.drop_payload(payload, &self.shared.dropped_newest);
+                    Ok(())
+                }
+                Err(err) => Err(err.into()),
+            },
+
+            BackpressurePolicy::DropOldest => {
+                let mut payload = Ok(payload);
+                loop {
+                    match self.tx.try_send(payload) {
+                        Ok(()) => return Ok(()),
+                        Err(async_channel::TrySendError::Full(rejected)) => {
+                            payload = rejected;
+                            let evict_rx = self.evict_rx.as_ref().unwrap();
+                            if let Ok(oldest) = evict_rx.try_recv() {
+                                self.drop_payload(oldest, &self.shared.dropped_oldest);
+                            }
+                        }
+                        Err(err) => return Err(err.into()),
+                    }
+                }
+            }
+
+            BackpressurePolicy::Block { deadline } => {
+                let deadline = time::Instant::now() + deadline;
+                let mut payload = Ok(payload);
+                let mut guard = self.shared.wait_space();
+                let result = loop {
+                    match self.tx.try_send(payload) {
+                        Ok(()) => break Ok(()),
+                        Err(async_channel::TrySendError::Full(rejected)) => {
+                            let remaining =
+                                deadline.saturating_duration_since(time::Instant::now());
+                            if remaining == time::Duration::ZERO {
+                                self.drop_payload(rejected, &self.shared.deadline_exceeded);
+                                break Ok(());
+                            }
+                            payload = rejected;
+                            guard = self.shared.space.wait_timeout(guard, remaining).unwrap().0;
+                        }
+                        Err(err) => break Err(err.into()),
+                    }
+                };
+                self.shared.waiters.fetch_sub(1, Ordering::SeqCst);
+                result
+            }
+        }
+    }
+
     /// Tries to receive [`Payload`].
     /// This method doesn't wait arrival of `payload` and immediately returns `StreamError` if
     /// the channel is empty.
     pub fn try_recv(&self) -> StreamResult<Payload> {
         Ok(self.rx.try_recv()?)
     }
+
+    /// Returns the numbers of payloads dropped by the [`BackpressurePolicy`] of the channel.
+    #[must_use]
+    pub fn dropped_frames(&self) -> DroppedFrames {
+        self.shared.dropped_frames()
+    }
+
+    fn drop_payload(&self, payload: StreamResult<Payload>, counter: &AtomicU64) {
+        // Errors are not frames, so they are discarded without being counted.
+        if let Ok(payload) = payload {
+            counter.fetch_add(1, Ordering::Relaxed);
+            // A pooled buffer is returned to the pool when it's dropped.
+            if !payload.payload.is_pooled() {
+                self.reclaim_tx.try_send(payload).ok();
+            }
+        }
+    }
+}
+
+/// Policy applied by [`PayloadSender::send_with_policy`] when the channel is full.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum BackpressurePolicy {
+    /// Drops the payload being sent. The host receives the payloads which were queued first.
+    DropNewest,
+
+    /// Drops the oldest payload in the channel to make room, so that the latest payload always
+    /// reaches the host. Suitable for live preview.
+    DropOldest,
+
+    /// Waits for the host to receive a payload up to `deadline`, then drops the payload being
+    /// sent. Suitable for recording.
+    ///
+    /// NOTE: The streaming loop doesn't handle completed transfers while it's waiting, so
+    /// `deadline` should be shorter than the time to fill all queued transfers. For the same
+    /// reason, the policy can't be used with the shared stream driver, where the waiting would
+    /// stall the streams of the other cameras.
+    Block {
+        /// Maximum duration to wait for the room in the channel.
+        deadline: time::Duration,
+    },
+}
+
+impl Default for BackpressurePolicy {
+    fn default() -> Self {
+        Self::DropNewest
+    }
+}
+
+/// The numbers of payloads dropped by each [`BackpressurePolicy`].
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct DroppedFrames {
+    /// Payloads dropped by [`BackpressurePolicy::DropNewest`].
+    pub newest: u64,
+    /// Payloads evicted by [`BackpressurePolicy::DropOldest`].
+    pub oldest: u64,
+    /// Payloads dropped because [`BackpressurePolicy::Block`] exceeded its deadline.
+    pub deadline_exceeded: u64,
+}
+
+impl DroppedFrames {
+    /// Returns the total number of dropped payloads.
+    #[must_use]
+    pub fn total(&self) -> u64 {
+        self.newest + self.oldest + self.deadline_exceeded
+    }
+}
+
+/// State shared between [`PayloadSender`] and [`PayloadReceiver`].
+#[derive(Debug)]
+struct ChannelShared {
+    /// The number of live [`PayloadReceiver`]s.
+    receivers: AtomicUsize,
+    dropped_newest: AtomicU64,
+    dropped_oldest: AtomicU64,
+    deadline_exceeded: AtomicU64,
+    /// The number of senders waiting for the room in the channel.
+    waiters: AtomicUsize,
+    lock: Mutex<()>,
+    /// Notified when the host receives a payload while a sender is waiting.
+    space: Condvar,
+}
+
+impl ChannelShared {
+    fn new() -> Self {
+        Self {
+            receivers: AtomicUsize::new(1),
+            dropped_newest: AtomicU64::default(),
+            dropped_oldest: AtomicU64::default(),
+            deadline_exceeded: AtomicU64::default(),
+            waiters: AtomicUsize::default(),
+            lock: Mutex::default(),
+            space: Condvar::default(),
+        }
+    }
+
+    fn dropped_frames(&self) -> DroppedFrames {
+        DroppedFrames {
+            newest: self.dropped_newest.load(Ordering::Relaxed),
+            oldest: self.dropped_oldest.load(Ordering::Relaxed),
+            deadline_exceeded: self.deadline_exceeded.load(Ordering::Relaxed),
+        }
+    }
+
+    /// Registers the caller as a waiter. The caller MUST decrement `waiters` when it finishes
+    /// waiting.
+    fn wait_space(&self) -> std::sync::MutexGuard<'_, ()> {
+        let guard = self.lock.lock().unwrap();
+        self.waiters.fetch_add(1, Ordering::SeqCst);
+        guard
+    }
+
+    fn notify_space(&self) {
+        // Skip locking in the common case where no sender is blocked.
+        if self.waiters.load(Ordering::SeqCst) > 0 {
+            let _guard = self.lock.lock().unwrap();
+            self.space.notify_all();
+        }
+    }
+}
+
+/// Acquires a buffer from the pool, or allocates a new one if all buffers in the pool are in
+/// use.
+#[cfg(any(feature = "libusb", feature = "gige"))]
+pub(crate) fn acquire_payload_buf(
+    buffer_pool: &PayloadBufferPool,
+    sender: &PayloadSender,
+    len: usize,
+) -> PayloadBuffer {
+    if buffer_pool.buffer_size() >= len {
+        if let Some(buf) = buffer_pool.acquire() {
+            return buf;
+        }
+    }
+
+    // The host may hold buffers of the pool in payloads sent back.
+    while let Ok(payload) = sender.try_recv() {
+        let buf = payload.payload;
+        if !buf.is_pooled() && buf.len() >= len {
+            return buf;
+        }
+        // Dropping a pooled buffer returns it to the pool.
+        drop(buf);
+        if buffer_pool.buffer_size() >= len {
+            if let Some(buf) = buffer_pool.acquire() {
+                return buf;
+            }
+        }
+    }
+
+    vec![0; len].into()
 }
 
 /// Creates [`PayloadReceiver`] and [`PayloadSender`].
+///
+/// The channel uses [`BackpressurePolicy::DropNewest`], see [`channel_with_policy`] to specify
+/// the policy.
 pub fn channel(payload_cap: usize, buffer_cap: usize) -> (PayloadSender, PayloadReceiver) {
+    channel_with_policy(payload_cap, buffer_cap, BackpressurePolicy::default())
+}
+
+/// Creates [`PayloadReceiver`] and [`PayloadSender`] whose sender follows `policy` when the
+/// channel is full.
+pub fn channel_with_policy(
+    payload_cap: usize,
+    buffer_cap: usize,
+    policy: BackpressurePolicy,
+) -> (PayloadSender, PayloadReceiver) {
     let (device_tx, host_rx) = async_channel::bounded(payload_cap);
     let (host_tx, device_rx) = async_channel::bounded(buffer_cap);
+    let shared = Arc::new(ChannelShared::new());
+    let evict_rx = match policy {
+        BackpressurePolicy::DropOldest => Some(host_rx.clone()),
+        _ => None,
+    };
     (
         PayloadSender {
             tx: device_tx,
             rx: device_rx,
+            reclaim_tx: host_tx.clone(),
+            evict_rx,
+            policy,
+            shared: shared.clone(),
         },
         PayloadReceiver {
             tx: host_tx,
             rx: host_rx,
+            shared,
         },
     )
 }
@@ -205,3 +1086,252 @@ impl<T> From<async_channel::TrySendError<T>> for StreamError {
         StreamError::ReceiveError(err.to_string().into())
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_buffer_pool() {
+        let pool = PayloadBufferPool::new(HeapAllocator, 16, 2).unwrap();
+        assert_eq!(pool.available(), 2);
+
+        let mut buf1 = pool.acquire().unwrap();
+        assert!(buf1.is_pooled());
+        assert_eq!(buf1.len(), 16);
+        assert!(buf1.iter().all(|b| *b == 0));
+        buf1[0] = 1;
+
+        let buf2 = pool.acquire().unwrap();
+        assert!(pool.acquire().is_none());
+
+        // Cloned buffer doesn't belong to the pool.
+        let cloned = buf1.clone();
+        assert!(!cloned.is_pooled());
+        assert_eq!(cloned, buf1);
+
+        drop(buf1);
+        drop(buf2);
+        assert_eq!(pool.available(), 2);
+    }
+
+    #[test]
+    fn test_external_pool() {
+        let mut bufs = [vec![0_u8; 16], vec![0_u8; 32], vec![0_u8; 8]];
+        let ptrs: Vec<_> = bufs
+            .iter_mut()
+            .map(|buf| NonNull::new(buf.as_mut_ptr()).unwrap())
+            .collect();
+
+        let pool = PayloadBufferPool::external(16);
+        unsafe {
+            assert!(pool.lend(ptrs[0], 16));
+            assert!(pool.lend(ptrs[1], 32));
+            // Smaller than the buffer size of the pool.
+            assert!(!pool.lend(ptrs[2], 8));
+        }
+        assert_eq!(pool.buffer_count(), 2);
+
+        // Lent buffers are acquired in the order they are lent.
+        let mut buf = pool.acquire().unwrap();
+        assert_eq!(buf.as_ptr(), ptrs[0].as_ptr());
+        buf[0] = 1;
+        let buf2 = pool.acquire().unwrap();
+        assert_eq!(buf2.len(), 32);
+
+        // Buffers in use can't be taken back.
+        assert!(!pool.take_back(ptrs[0]));
+        drop(buf);
+        assert!(pool.take_back(ptrs[0]));
+        assert_eq!(pool.buffer_count(), 1);
+        drop(buf2);
+        drop(pool);
+        assert_eq!(bufs[0][0], 1);
+
+        // Memory of the pool which owns its memory can't be lent.
+        let pool = PayloadBufferPool::new(HeapAllocator, 16, 1).unwrap();
+        assert!(!unsafe { pool.lend(ptrs[1], 32) });
+    }
+
+    fn payload(id: u64, payload: PayloadBuffer) -> Payload {
+        Payload {
+            id,
+            payload_type: PayloadType::Chunk,
+            image_info: None,
+            chunks: vec![],
+            valid_payload_size: payload.len(),
+            payload,
+            timestamp: time::Duration::default(),
+            host_timestamp: None,
+        }
+    }
+
+    #[test]
+    fn test_chunk_index() {
+        let mut data = vec![];
+        for (id, chunk) in [(0x10_u32, &[1_u8, 2, 3][..]), (0x20, &[4, 5, 6, 7][..])] {
+            data.extend_from_slice(chunk);
+            data.extend_from_slice(&id.to_be_bytes());
+            data.extend_from_slice(&(chunk.len() as u32).to_be_bytes());
+        }
+
+        let mut payload = payload(0, data.clone().into());
+        payload.chunks = ChunkLayout::parse_all(&data).unwrap();
+        assert_eq!(
+            payload.chunk_layouts(),
+            [
+                ChunkLayout {
+                    id: 0x10,
+                    offset: 0,
+                    len: 3
+                },
+                ChunkLayout {
+                    id: 0x20,
+                    offset: 11,
+                    len: 4
+                }
+            ]
+        );
+        assert_eq!(payload.chunk(0x20), Some(&[4, 5, 6, 7][..]));
+        assert_eq!(payload.chunk(0x30), None);
+
+        // The last chunk claims more data than the payload has.
+        let last = data.len() - 1;
+        data[last] = 16;
+        assert!(ChunkLayout::parse_all(&data).is_err());
+    }
+
+    #[test]
+    fn test_shared_payload() {
+        let pool = PayloadBufferPool::new(HeapAllocator, 16, 1).unwrap();
+        let mut payload = payload(0, pool.acquire().unwrap());
+        payload.valid_payload_size = 8;
+        let payload = payload.into_shared();
+
+        let cloned = payload.clone();
+        assert_eq!(payload.share_count(), 2);
+        assert_eq!(cloned.payload().as_ptr(), payload.payload().as_ptr());
+
+        std::thread::spawn(move || assert_eq!(cloned.payload().len(), 8))
+            .join()
+            .unwrap();
+        assert_eq!(pool.available(), 0);
+
+        let payload = payload.try_unwrap().unwrap();
+        drop(payload);
+        assert_eq!(pool.available(), 1);
+    }
+
+    #[test]
+    fn test_buffer_outlives_pool() {
+        let pool = PayloadBufferPool::new(HeapAllocator, 16, 1).unwrap();
+        let mut buf = pool.acquire().unwrap();
+        drop(pool);
+
+        buf[15] = 1;
+        assert_eq!(buf.into_vec().len(), 16);
+    }
+
+    #[test]
+    fn test_drop_newest() {
+        let (sender, receiver) = channel_with_policy(1, 1, BackpressurePolicy::DropNewest);
+        sender
+            .send_with_policy(payload(0, vec![0; 4].into()))
+            .unwrap();
+        sender
+            .send_with_policy(payload(1, vec![0; 4].into()))
+            .unwrap();
+
+        assert_eq!(receiver.try_recv().unwrap().id(), 0);
+        assert_eq!(receiver.dropped_frames().newest, 1);
+        // The buffer of the dropped payload is reclaimed.
+        assert_eq!(sender.try_recv().unwrap().id(), 1);
+    }
+
+    #[test]
+    fn test_drop_oldest() {
+        let pool = PayloadBufferPool::new(HeapAllocator, 4, 2).unwrap();
+        let (sender, receiver) = channel_with_policy(1, 1, BackpressurePolicy::DropOldest);
+        sender
+            .send_with_policy(payload(0, pool.acquire().unwrap()))
+            .unwrap();
+        sender
+            .send_with_policy(payload(1, pool.acquire().unwrap()))
+            .unwrap();
+
+        // The buffer of the evicted payload is returned to the pool.
+        assert_eq!(pool.available(), 1);
+        assert_eq!(receiver.try_recv().unwrap().id(), 1);
+        assert_eq!(
+            receiver.dropped_frames(),
+            DroppedFrames {
+                oldest: 1,
+                ..DroppedFrames::default()
+            }
+        );
+    }
+
+    #[test]
+    fn test_drop_oldest_closed() {
+        let (sender, receiver) = channel_with_policy(1, 1, BackpressurePolicy::DropOldest);
+        let cloned = receiver.clone();
+        drop(receiver);
+        sender
+            .send_with_policy(payload(0, vec![0; 4].into()))
+            .unwrap();
+
+        // The channel is closed when the host drops all receivers, even though the sender holds
+        // a receiving end to evict payloads.
+        drop(cloned);
+        assert!(sender
+            .send_with_policy(payload(1, vec![0; 4].into()))
+            .is_err());
+    }
+
+    #[test]
+    fn test_receiver_closed() {
+        let (sender, receiver) = channel(1, 1);
+        sender.try_send(Ok(payload(0, vec![0; 4].into()))).unwrap();
+        assert!(!receiver.is_closed());
+
+        // Payloads sent before the sender is dropped are still received.
+        drop(sender);
+        assert!(receiver.is_closed());
+        assert!(receiver.try_recv().is_ok());
+        assert!(receiver.try_recv().is_err());
+    }
+
+    #[test]
+    fn test_block_with_deadline() {
+        let policy = BackpressurePolicy::Block {
+            deadline: time::Duration::from_millis(10),
+        };
+        let (sender, receiver) = channel_with_policy(1, 2, policy);
+        sender
+            .send_with_policy(payload(0, vec![0; 4].into()))
+            .unwrap();
+        sender
+            .send_with_policy(payload(1, vec![0; 4].into()))
+            .unwrap();
+        assert_eq!(receiver.dropped_frames().deadline_exceeded, 1);
+
+        let policy = BackpressurePolicy::Block {
+            deadline: time::Duration::from_secs(10),
+        };
+        let (sender, receiver) = channel_with_policy(1, 1, policy);
+        sender
+            .send_with_policy(payload(0, vec![0; 4].into()))
+            .unwrap();
+        let host = std::thread::spawn(move || {
+            std::thread::sleep(time::Duration::from_millis(10));
+            let id = receiver.recv_blocking().unwrap().id();
+            // Keep the channel open until the sender is done.
+            (id, receiver)
+        });
+        sender
+            .send_with_policy(payload(1, vec![0; 4].into()))
+            .unwrap();
+        assert_eq!(host.join().unwrap().0, 0);
+        assert_eq!(sender.dropped_frames().total(), 0);
+    }
+}
@@ -8,16 +8,19 @@ use std::{
     convert::TryInto,
     io::Read,
     sync::{Arc, Mutex},
-    time::Duration,
+    time::{Duration, Instant},
 };
 
 use cameleon_device::{
     u3v,
     u3v::protocol::{ack, cmd},
 };
-use tracing::error;
+use tracing::{error, warn};
 
-use super::register_map::{self, Abrm, ManifestTable, Sbrm, Sirm};
+use super::{
+    event_handle::EventHandle,
+    register_map::{self, Abrm, Eirm, ManifestTable, Sbrm, Sirm},
+};
 
 use crate::{camera::DeviceControl, genapi::CompressionType, ControlError, ControlResult};
 
@@ -35,6 +38,10 @@ const INITIAL_MAXIMUM_ACK_LENGTH: u32 = 128;
 
 const PAYLOAD_TRANSFER_SIZE: u32 = 1024 * 64;
 
+/// Maximum length of a command or acknowledge packet the protocol can express, i.e.
+/// Magic(4 bytes) + CCD(8 bytes) + SCD whose length field is 2 bytes.
+const MAXIMUM_PACKET_LENGTH: u32 = 12 + u16::MAX as u32;
+
 /// This handle provides low level API to read and write data from the device.  
 /// See [`ControlHandle::abrm`] and [`register_map`] which provide more
 /// convenient way to communicate with `u3v` specific registers.
@@ -80,8 +87,13 @@ pub struct ControlHandle {
     sbrm: Option<Sbrm>,
     /// Cache for `Sirm`.
     sirm: Option<Sirm>,
+    /// Cache for `Eirm`.
+    eirm: Option<Eirm>,
     /// Cache for `ManifestTable`.
     manifest_table: Option<ManifestTable>,
+
+    /// Event channel of the device which is not taken yet.
+    event_channel: Option<u3v::ReceiveChannel>,
 }
 
 impl ControlHandle {
@@ -148,6 +160,12 @@ impl ControlHandle {
         Ok(abrm)
     }
 
+    /// Returns `true` if the device accepts `ReadMemStacked` and `WriteMemStacked` commands.
+    pub fn is_stacked_commands_supported(&mut self) -> ControlResult<bool> {
+        let abrm = self.abrm()?;
+        Ok(abrm.device_capability()?.is_stacked_commands_supported())
+    }
+
     /// Returns [`Sbrm`].
     pub fn sbrm(&mut self) -> ControlResult<Sbrm> {
         if let Some(sbrm) = self.sbrm {
@@ -174,6 +192,28 @@ impl ControlHandle {
         Ok(sirm)
     }
 
+    /// Returns [`Eirm`].
+    pub fn eirm(&mut self) -> ControlResult<Eirm> {
+        if let Some(eirm) = self.eirm {
+            return Ok(eirm);
+        }
+
+        let addr = self.sbrm()?.eirm_address(self)?.ok_or_else(|| {
+            ControlError::InvalidDevice("the u3v device doesn't have `EIRM ADDRESS`".into())
+        })?;
+        let eirm = Eirm::new(addr);
+        self.eirm = Some(eirm);
+
+        Ok(eirm)
+    }
+
+    /// Takes [`EventHandle`] to receive events of the device.
+    ///
+    /// Returns `None` if the device has no event interface or the handle has already been taken.
+    pub fn take_event_handle(&mut self) -> Option<EventHandle> {
+        self.event_channel.take().map(EventHandle::new)
+    }
+
     /// Returns [`ManifestTable`].
     pub fn manifest_table(&mut self) -> ControlResult<ManifestTable> {
         if let Some(manifest_table) = self.manifest_table {
@@ -188,6 +228,16 @@ impl ControlHandle {
 
     pub(super) fn new(device: &u3v::Device) -> ControlResult<Self> {
         let inner = device.control_channel()?;
+        // Events are optional, so failing to open the event channel doesn't prevent controlling
+        // the device.
+        let event_channel = device.event_channel().unwrap_or_else(|err| {
+            let err: ControlError = err.into();
+            warn!(
+                ?err,
+                "failed to open the event channel, events are disabled"
+            );
+            None
+        });
 
         Ok(Self {
             inner,
@@ -198,7 +248,9 @@ impl ControlHandle {
             abrm: None,
             sbrm: None,
             sirm: None,
+            eirm: None,
             manifest_table: None,
+            event_channel,
         })
     }
 
@@ -215,8 +267,16 @@ impl ControlHandle {
         let sbrm = abrm.sbrm(self)?;
 
         let timeout_duration = abrm.maximum_device_response_time(self)?;
-        let maximum_cmd_length = sbrm.maximum_command_transfer_length(self)?;
-        let maximum_ack_length = sbrm.maximum_acknowledge_trasfer_length(self)?;
+        // Use the largest length the device accepts so that large transfers, e.g. GenApi xml
+        // retrieval, are split into as few transactions as possible.
+        let maximum_cmd_length = std::cmp::min(
+            sbrm.maximum_command_transfer_length(self)?,
+            MAXIMUM_PACKET_LENGTH,
+        );
+        let maximum_ack_length = std::cmp::min(
+            sbrm.maximum_acknowledge_trasfer_length(self)?,
+            MAXIMUM_PACKET_LENGTH,
+        );
 
         self.config.timeout_duration = timeout_duration;
         self.config.maximum_cmd_length = maximum_cmd_length;
@@ -243,73 +303,83 @@ impl ControlHandle {
             .send(&self.buffer[..cmd_len], self.config.timeout_duration)?;
 
         // Receive ack and interpret the packet.
-        let mut retry_count = self.config.retry_count;
-        let mut ok = None;
-        while retry_count > 0 {
-            let recv_len = self
-                .inner
-                .recv(&mut self.buffer, self.config.timeout_duration)?;
-
-            let ack = ack::AckPacket::parse(&self.buffer[0..recv_len])?;
-            self.verify_ack(&ack)?;
-
-            // Retry up to retry count.
-            if ack.scd_kind() == ack::ScdKind::Pending {
-                let pending_ack: ack::Pending = ack.scd_as()?;
-                std::thread::sleep(pending_ack.timeout);
-                retry_count -= 1;
-                continue;
-            }
-
-            self.next_req_id = self.next_req_id.wrapping_add(1);
-            ok = Some(recv_len);
-            break;
-        }
+        let inner = &self.inner;
+        let recv_len = recv_ack(
+            |buf, timeout| Ok(inner.recv(buf, timeout)?),
+            &mut self.buffer,
+            self.next_req_id,
+            &self.config,
+        )?;
+        self.next_req_id = self.next_req_id.wrapping_add(1);
 
         // This codes seems weird due to a lifetime problem.
         // `ack::AckPacket::parse` is a fast operation, so it's ok to call it repeatedly.
-        if let Some(recv_len) = ok {
-            Ok(ack::AckPacket::parse(&self.buffer[0..recv_len])
-                .unwrap()
-                .scd_as()?)
-        } else {
-            Err(ControlError::Io(anyhow::Error::msg(
-                "the number of times pending was returned exceeds the retry_count.",
-            )))
-        }
+        Ok(ack::AckPacket::parse(&self.buffer[0..recv_len])
+            .unwrap()
+            .scd_as()?)
     }
+}
 
-    fn verify_ack(&self, ack: &ack::AckPacket) -> ControlResult<()> {
-        let status = ack.status().kind();
-        if status != ack::StatusKind::GenCp(ack::GenCpStatus::Success) {
-            return Err(ControlError::Io(anyhow::Error::msg(format!(
-                "invalid status: {:?}",
-                ack.status().kind()
-            ))));
+/// Receives the ack of the command whose request id is `req_id` into `buffer`, and returns its
+/// length.
+///
+/// Stale acks are skipped without extending the deadline, so that a device which keeps sending
+/// acks of other commands can't make the host wait forever.
+fn recv_ack(
+    mut recv: impl FnMut(&mut [u8], Duration) -> ControlResult<usize>,
+    buffer: &mut [u8],
+    req_id: u16,
+    config: &ConnectionConfig,
+) -> ControlResult<usize> {
+    let mut retry_count = config.retry_count;
+    let mut deadline = Instant::now() + config.timeout_duration;
+    loop {
+        let recv_timeout = deadline.saturating_duration_since(Instant::now());
+        if recv_timeout == Duration::ZERO {
+            return Err(ControlError::Timeout);
         }
-
-        if ack.request_id() != self.next_req_id {
-            return Err(ControlError::Io(anyhow::Error::msg("request id mismatch")));
+        let recv_len = recv(buffer, recv_timeout)?;
+
+        let ack = ack::AckPacket::parse(&buffer[0..recv_len])?;
+        // An ack of a command which has already timed out may arrive late, skip it.
+        if ack.request_id() != req_id {
+            warn!(
+                "skip stale ack: expected request id {}, but got {}",
+                req_id,
+                ack.request_id()
+            );
+            continue;
+        }
+        verify_ack(&ack)?;
+
+        // The device sends the actual ack within the timeout of pending ack, so wait for it
+        // instead of sleeping for the whole timeout. Retry up to retry count.
+        if ack.scd_kind() == ack::ScdKind::Pending {
+            retry_count = retry_count.saturating_sub(1);
+            if retry_count == 0 {
+                return Err(ControlError::Io(anyhow::Error::msg(
+                    "the number of times pending was returned exceeds the retry_count.",
+                )));
+            }
+            let pending_ack: ack::Pending = ack.scd_as()?;
+            deadline = Instant::now() + std::cmp::max(pending_ack.timeout, config.timeout_duration);
+            continue;
         }
 
-        Ok(())
+        return Ok(recv_len);
     }
+}
 
-    fn verify_xml(&mut self, xml: &[u8], ent: register_map::ManifestEntry) -> ControlResult<()> {
-        use sha1::Digest;
-
-        if let Some(hash) = ent.sha1_hash(self)? {
-            let xml_hash = sha1::Sha1::digest(xml);
-            if xml_hash.as_slice() == hash {
-                Ok(())
-            } else {
-                println!("Warning: sha1 of retrieved xml file isn't same as entry's hash");
-                Ok(())
-            }
-        } else {
-            Ok(())
-        }
+fn verify_ack(ack: &ack::AckPacket) -> ControlResult<()> {
+    let status = ack.status().kind();
+    if status != ack::StatusKind::GenCp(ack::GenCpStatus::Success) {
+        return Err(ControlError::Io(anyhow::Error::msg(format!(
+            "invalid status: {:?}",
+            ack.status().kind()
+        ))));
     }
+
+    Ok(())
 }
 
 macro_rules! unwrap_or_log {
@@ -389,115 +459,296 @@ impl DeviceControl for ControlHandle {
         Ok(())
     }
 
-    fn genapi(&mut self) -> ControlResult<String> {
-        fn zip_err(err: impl std::fmt::Debug) -> ControlError {
-            ControlError::InvalidDevice(format!("zipped xml file is broken: {:?}", err).into())
+    /// Reads entries with `ReadMemStacked` if the device supports it.
+    ///
+    /// Entries are packed into as few commands as the maximum command and acknowledge lengths
+    /// allow. An entry which doesn't fit in a single acknowledge is read by
+    /// [`DeviceControl::read`].
+    fn read_stacked(&mut self, entries: &mut [(u64, &mut [u8])]) -> ControlResult<()> {
+        unwrap_or_log!(self.assert_open());
+
+        if !unwrap_or_log!(self.is_stacked_commands_supported()) {
+            for (address, buf) in entries {
+                self.read(*address, buf)?;
+            }
+            return Ok(());
         }
 
-        let table = unwrap_or_log!(self.manifest_table());
-        // Use newest version if there are more than one entries.
-        let mut newest_ent = None;
-        for ent in unwrap_or_log!(table.entries(self)) {
-            let file_info = unwrap_or_log!(ent.file_info(self));
-            if unwrap_or_log!(file_info.file_type()) == register_map::GenICamFileType::DeviceXml {
-                let version = unwrap_or_log!(ent.genicam_file_version(self));
-                match &newest_ent {
-                    Some((_, cur_version, _)) if &version <= cur_version => {
-                        // Current entry is newest.
-                    }
-                    _ => newest_ent = Some((ent, version, file_info)),
-                }
+        let maximum_read_length =
+            cmd::ReadMem::maximum_read_length(self.config.maximum_ack_length as usize) as usize;
+        // Magic(4 bytes) + CCD(8 bytes) followed by 12 bytes of SCD for each entry.
+        let maximum_entry_count = std::cmp::max(
+            (self.config.maximum_cmd_length as usize).saturating_sub(12) / 12,
+            1,
+        );
+
+        let mut idx = 0;
+        while idx < entries.len() {
+            if entries[idx].1.len() > maximum_read_length {
+                let (address, buf) = &mut entries[idx];
+                self.read(*address, buf)?;
+                idx += 1;
+                continue;
+            }
+
+            let start = idx;
+            let mut total_len = 0;
+            while idx < entries.len()
+                && idx - start < maximum_entry_count
+                && total_len + entries[idx].1.len() <= maximum_read_length
+            {
+                total_len += entries[idx].1.len();
+                idx += 1;
+            }
+
+            let cmd_entries = entries[start..idx]
+                .iter()
+                .map(|(address, buf)| cmd::ReadMem::new(*address, buf.len() as u16))
+                .collect();
+            let cmd = unwrap_or_log!(cmd::ReadMemStacked::new(cmd_entries));
+            let ack: ack::ReadMemStacked = unwrap_or_log!(self.send_cmd(cmd));
+            if ack.data.len() != total_len {
+                let err_msg = "read mem stacked failed: read length mismatch";
+                return Err(ControlError::Io(anyhow::Error::msg(err_msg)));
+            }
+
+            let mut offset = 0;
+            for (_, buf) in &mut entries[start..idx] {
+                buf.copy_from_slice(&ack.data[offset..offset + buf.len()]);
+                offset += buf.len();
             }
         }
 
-        let (ent, _, file_info) = unwrap_or_log!(newest_ent.ok_or_else(|| {
-            ControlError::InvalidDevice("device doesn't have valid `ManifestEntry`".into())
-        }));
+        Ok(())
+    }
 
-        let file_address: u64 = unwrap_or_log!(ent.file_address(self));
-        let file_size: usize = unwrap_or_log!(unwrap_or_log!(ent.file_size(self)).try_into());
-        let comp_type = unwrap_or_log!(file_info.compression_type());
+    /// Writes entries with `WriteMemStacked` if the device supports it.
+    ///
+    /// Entries are packed into as few commands as the maximum command and acknowledge lengths
+    /// allow. An entry which doesn't fit in a single command is written by
+    /// [`DeviceControl::write`].
+    fn write_stacked(&mut self, entries: &[(u64, &[u8])]) -> ControlResult<()> {
+        unwrap_or_log!(self.assert_open());
 
-        // Store current capacity so that we can set back it after XML retrieval because this needs exceptional large size of internal buffer.
-        let current_capacity = self.buffer_capacity();
-        let mut buf = vec![0; file_size];
-        unwrap_or_log!(self.read(file_address, &mut buf));
-        self.resize_buffer(current_capacity);
+        if !unwrap_or_log!(self.is_stacked_commands_supported()) {
+            for (address, data) in entries {
+                self.write(*address, data)?;
+            }
+            return Ok(());
+        }
 
-        // Verify retrieved xml has correct hash.
-        unwrap_or_log!(self.verify_xml(&buf, ent));
+        // Magic(4 bytes) + CCD(8 bytes) followed by SCD. Each entry of SCD is composed of
+        // address(8 bytes), reserved(2 bytes), length(2 bytes) and data.
+        let maximum_scd_length = (self.config.maximum_cmd_length as usize).saturating_sub(12);
+        // Each entry of acknowledge SCD is composed of reserved(2 bytes) and length(2 bytes).
+        let maximum_entry_count = std::cmp::max(
+            (self.config.maximum_ack_length as usize).saturating_sub(12) / 4,
+            1,
+        );
+
+        let mut idx = 0;
+        while idx < entries.len() {
+            if 12 + entries[idx].1.len() > maximum_scd_length {
+                let (address, data) = entries[idx];
+                self.write(address, data)?;
+                idx += 1;
+                continue;
+            }
 
-        match comp_type {
-            CompressionType::Zip => {
-                let mut zip = zip::ZipArchive::new(std::io::Cursor::new(buf)).unwrap();
-                if zip.len() != 1 {
-                    return Err(zip_err("more than one files in zipped GenApi XML"));
-                }
-                let mut file = unwrap_or_log!(zip.by_index(0).map_err(zip_err));
-                let file_size: usize = unwrap_or_log!(file.size().try_into());
-                let mut xml = Vec::with_capacity(file_size);
-                unwrap_or_log!(file.read_to_end(&mut xml).map_err(zip_err));
-                Ok(String::from_utf8_lossy(&xml).into())
+            let start = idx;
+            let mut scd_len = 0;
+            while idx < entries.len()
+                && idx - start < maximum_entry_count
+                && scd_len + 12 + entries[idx].1.len() <= maximum_scd_length
+            {
+                scd_len += 12 + entries[idx].1.len();
+                idx += 1;
             }
 
-            CompressionType::Uncompressed => Ok(String::from_utf8_lossy(&buf).into()),
+            let cmd_entries: Vec<_> = unwrap_or_log!(entries[start..idx]
+                .iter()
+                .map(|(address, data)| cmd::WriteMem::new(*address, data))
+                .collect());
+            let cmd = unwrap_or_log!(cmd::WriteMemStacked::new(cmd_entries));
+            let ack: ack::WriteMemStacked = unwrap_or_log!(self.send_cmd(cmd));
+            let is_written = ack.lengths.len() == idx - start
+                && ack
+                    .lengths
+                    .iter()
+                    .zip(&entries[start..idx])
+                    .all(|(len, (_, data))| *len as usize == data.len());
+            if !is_written {
+                let err_msg = "write mem stacked failed: written length mismatch";
+                return Err(ControlError::Io(anyhow::Error::msg(err_msg)));
+            }
         }
+
+        Ok(())
+    }
+
+    fn genapi(&mut self) -> ControlResult<String> {
+        let table = unwrap_or_log!(self.manifest_table());
+
+        // Store current capacity so that we can set back it after XML retrieval because this needs exceptional large size of internal buffer.
+        let current_capacity = self.buffer_capacity();
+        let xml = read_device_xml(self, table);
+        self.resize_buffer(current_capacity);
+
+        Ok(unwrap_or_log!(xml))
+    }
+
+    fn genapi_sha1_hash(&mut self) -> ControlResult<Option<[u8; 20]>> {
+        let table = unwrap_or_log!(self.manifest_table());
+        let (ent, _) = unwrap_or_log!(newest_xml_entry(self, table));
+        ent.sha1_hash(self)
     }
 
     fn enable_streaming(&mut self) -> ControlResult<()> {
         let sirm = unwrap_or_log!(self.sirm());
+        setup_stream_interface(self, sirm)
+    }
 
-        // It's forbidden to set SIRM registers while stream is enabled.
-        // This is necessary in case we lost control of a device before properly closing it, which
-        // can happen if the process closes in some way without gracefully terminating.
-        if unwrap_or_log!(sirm.is_stream_enable(self)) {
-            unwrap_or_log!(sirm.disable_stream(self));
-        }
+    fn disable_streaming(&mut self) -> ControlResult<()> {
+        let sirm = unwrap_or_log!(self.sirm());
+        sirm.disable_stream(self)
+    }
+}
+
+/// Reads the newest device XML listed in `table`.
+pub(super) fn read_device_xml<Ctrl: DeviceControl + ?Sized>(
+    device: &mut Ctrl,
+    table: ManifestTable,
+) -> ControlResult<String> {
+    fn zip_err(err: impl std::fmt::Debug) -> ControlError {
+        ControlError::InvalidDevice(format!("zipped xml file is broken: {:?}", err).into())
+    }
+
+    let (ent, file_info) = unwrap_or_log!(newest_xml_entry(device, table));
+
+    let file_address: u64 = unwrap_or_log!(ent.file_address(device));
+    let file_size: usize = unwrap_or_log!(unwrap_or_log!(ent.file_size(device)).try_into());
+    let comp_type = unwrap_or_log!(file_info.compression_type());
 
-        let payload_alignment = unwrap_or_log!(sirm.payload_size_alignment(self));
-        macro_rules! align {
-            ($expr:expr, $ty: ty) => {
-                // Payload alignment is always power of two.
-                ($expr + (payload_alignment as $ty - 1)) & !(payload_alignment as $ty - 1)
-            };
+    let mut buf = vec![0; file_size];
+    unwrap_or_log!(device.read(file_address, &mut buf));
+
+    // Verify retrieved xml has correct hash.
+    unwrap_or_log!(verify_xml(device, &buf, ent));
+
+    match comp_type {
+        CompressionType::Zip => {
+            let mut zip = zip::ZipArchive::new(std::io::Cursor::new(buf)).unwrap();
+            if zip.len() != 1 {
+                return Err(zip_err("more than one files in zipped GenApi XML"));
+            }
+            let mut file = unwrap_or_log!(zip.by_index(0).map_err(zip_err));
+            let file_size: usize = unwrap_or_log!(file.size().try_into());
+            let mut xml = Vec::with_capacity(file_size);
+            unwrap_or_log!(file.read_to_end(&mut xml).map_err(zip_err));
+            Ok(String::from_utf8_lossy(&xml).into())
         }
 
-        let required_leader_size = unwrap_or_log!(sirm.required_leader_size(self));
-        let required_payload_size = unwrap_or_log!(sirm.required_payload_size(self));
-        let required_trailer_size = unwrap_or_log!(sirm.required_leader_size(self));
+        CompressionType::Uncompressed => Ok(String::from_utf8_lossy(&buf).into()),
+    }
+}
 
-        let payload_transfer_size = align!(PAYLOAD_TRANSFER_SIZE, u32);
-        let payload_transfer_count = (required_payload_size / payload_transfer_size as u64) as u32;
-        let payload_final_transfer1_size =
-            align!(required_payload_size % payload_transfer_size as u64, u64) as u32;
-        let payload_final_transfer2_size = 0;
+/// Returns the manifest entry of the newest device XML.
+fn newest_xml_entry<Ctrl: DeviceControl + ?Sized>(
+    device: &mut Ctrl,
+    table: ManifestTable,
+) -> ControlResult<(register_map::ManifestEntry, register_map::GenICamFileInfo)> {
+    // Use newest version if there are more than one entries.
+    let mut newest_ent = None;
+    for ent in table.entries(device)? {
+        let file_info = ent.file_info(device)?;
+        if file_info.file_type()? == register_map::GenICamFileType::DeviceXml {
+            let version = ent.genicam_file_version(device)?;
+            match &newest_ent {
+                Some((_, cur_version, _)) if &version <= cur_version => {
+                    // Current entry is newest.
+                }
+                _ => newest_ent = Some((ent, version, file_info)),
+            }
+        }
+    }
 
-        let maximum_leader_size = if required_leader_size == 0 {
-            payload_transfer_size
-        } else {
-            align!(required_leader_size, u32)
-        };
-        let maximum_trailer_size = if required_trailer_size == 0 {
-            payload_transfer_size
-        } else {
-            align!(required_trailer_size, u32)
-        };
+    newest_ent
+        .map(|(ent, _, file_info)| (ent, file_info))
+        .ok_or_else(|| {
+            ControlError::InvalidDevice("device doesn't have valid `ManifestEntry`".into())
+        })
+}
 
-        unwrap_or_log!(sirm.set_payload_transfer_size(self, payload_transfer_size));
-        unwrap_or_log!(sirm.set_payload_transfer_count(self, payload_transfer_count));
-        unwrap_or_log!(sirm.set_payload_final_transfer1_size(self, payload_final_transfer1_size));
-        unwrap_or_log!(sirm.set_payload_final_transfer2_size(self, payload_final_transfer2_size));
-        unwrap_or_log!(sirm.set_maximum_leader_size(self, maximum_leader_size));
-        unwrap_or_log!(sirm.set_maximum_trailer_size(self, maximum_trailer_size));
-        unwrap_or_log!(sirm.enable_stream(self));
+fn verify_xml<Ctrl: DeviceControl + ?Sized>(
+    device: &mut Ctrl,
+    xml: &[u8],
+    ent: register_map::ManifestEntry,
+) -> ControlResult<()> {
+    use sha1::Digest;
 
+    if let Some(hash) = ent.sha1_hash(device)? {
+        let xml_hash = sha1::Sha1::digest(xml);
+        if xml_hash.as_slice() == hash {
+            Ok(())
+        } else {
+            println!("Warning: sha1 of retrieved xml file isn't same as entry's hash");
+            Ok(())
+        }
+    } else {
         Ok(())
     }
+}
 
-    fn disable_streaming(&mut self) -> ControlResult<()> {
-        let sirm = unwrap_or_log!(self.sirm());
-        sirm.disable_stream(self)
+/// Sets up `SIRM` registers from the sizes required by the device, then enables the stream.
+pub(super) fn setup_stream_interface<Ctrl: DeviceControl + ?Sized>(
+    device: &mut Ctrl,
+    sirm: Sirm,
+) -> ControlResult<()> {
+    // It's forbidden to set SIRM registers while stream is enabled.
+    // This is necessary in case we lost control of a device before properly closing it, which
+    // can happen if the process closes in some way without gracefully terminating.
+    if unwrap_or_log!(sirm.is_stream_enable(device)) {
+        unwrap_or_log!(sirm.disable_stream(device));
+    }
+
+    let payload_alignment = unwrap_or_log!(sirm.payload_size_alignment(device));
+    macro_rules! align {
+        ($expr:expr, $ty: ty) => {
+            // Payload alignment is always power of two.
+            ($expr + (payload_alignment as $ty - 1)) & !(payload_alignment as $ty - 1)
+        };
     }
+
+    let required_leader_size = unwrap_or_log!(sirm.required_leader_size(device));
+    let required_payload_size = unwrap_or_log!(sirm.required_payload_size(device));
+    let required_trailer_size = unwrap_or_log!(sirm.required_leader_size(device));
+
+    let payload_transfer_size = align!(PAYLOAD_TRANSFER_SIZE, u32);
+    let payload_transfer_count = (required_payload_size / payload_transfer_size as u64) as u32;
+    let payload_final_transfer1_size =
+        align!(required_payload_size % payload_transfer_size as u64, u64) as u32;
+    let payload_final_transfer2_size = 0;
+
+    let maximum_leader_size = if required_leader_size == 0 {
+        payload_transfer_size
+    } else {
+        align!(required_leader_size, u32)
+    };
+    let maximum_trailer_size = if required_trailer_size == 0 {
+        payload_transfer_size
+    } else {
+        align!(required_trailer_size, u32)
+    };
+
+    unwrap_or_log!(sirm.set_payload_transfer_size(device, payload_transfer_size));
+    unwrap_or_log!(sirm.set_payload_transfer_count(device, payload_transfer_count));
+    unwrap_or_log!(sirm.set_payload_final_transfer1_size(device, payload_final_transfer1_size));
+    unwrap_or_log!(sirm.set_payload_final_transfer2_size(device, payload_final_transfer2_size));
+    unwrap_or_log!(sirm.set_maximum_leader_size(device, maximum_leader_size));
+    unwrap_or_log!(sirm.set_maximum_trailer_size(device, maximum_trailer_size));
+    unwrap_or_log!(sirm.enable_stream(device));
+
+    Ok(())
 }
 
 impl Drop for ControlHandle {
@@ -558,7 +809,15 @@ impl SharedControlHandle {
         #[must_use]
         pub fn retry_count(&self) -> u16,
         /// Thread safe version of [`ControlHandle::set_retry_count`].
-        pub fn set_retry_count(&self, count: u16) -> ()
+        pub fn set_retry_count(&self, count: u16) -> (),
+        /// Thread safe version of [`ControlHandle::abrm`].
+        pub fn abrm(&self) -> ControlResult<Abrm>,
+        /// Thread safe version of [`ControlHandle::is_stacked_commands_supported`].
+        pub fn is_stacked_commands_supported(&self) -> ControlResult<bool>,
+        /// Thread safe version of [`ControlHandle::eirm`].
+        pub fn eirm(&self) -> ControlResult<Eirm>,
+        /// Thread safe version of [`ControlHandle::take_event_handle`].
+        pub fn take_event_handle(&self) -> Option<EventHandle>
     );
 
     /// Returns the device info of the handle.
@@ -577,7 +836,10 @@ impl DeviceControl for SharedControlHandle {
         fn close(&mut self) -> ControlResult<()>,
         fn read(&mut self, address: u64, buf: &mut [u8]) -> ControlResult<()>,
         fn write(&mut self, address: u64, data: &[u8]) -> ControlResult<()>,
+        fn read_stacked(&mut self, entries: &mut [(u64, &mut [u8])]) -> ControlResult<()>,
+        fn write_stacked(&mut self, entries: &[(u64, &[u8])]) -> ControlResult<()>,
         fn genapi(&mut self) -> ControlResult<String>,
+        fn genapi_sha1_hash(&mut self) -> ControlResult<Option<[u8; 20]>>,
         fn enable_streaming(&mut self) -> ControlResult<()>,
         fn disable_streaming(&mut self) -> ControlResult<()>
     }
@@ -620,3 +882,63 @@ impl From<ControlHandle> for Box<dyn DeviceControl> {
         Box::new(ctrl)
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// `ReadMem` ack without data.
+    fn read_mem_ack(req_id: u16) -> Vec<u8> {
+        let mut buf = vec![];
+        buf.extend(0x4356_3355_u32.to_le_bytes());
+        // Status, command id and scd length.
+        buf.extend(0_u16.to_le_bytes());
+        buf.extend(0x0801_u16.to_le_bytes());
+        buf.extend(0_u16.to_le_bytes());
+        buf.extend(req_id.to_le_bytes());
+        buf
+    }
+
+    fn config() -> ConnectionConfig {
+        ConnectionConfig {
+            timeout_duration: Duration::from_millis(20),
+            ..ConnectionConfig::default()
+        }
+    }
+
+    fn recv_from(
+        mut acks: impl FnMut() -> Vec<u8>,
+    ) -> impl FnMut(&mut [u8], Duration) -> ControlResult<usize> {
+        move |buf, _| {
+            let ack = acks();
+            buf[..ack.len()].copy_from_slice(&ack);
+            Ok(ack.len())
+        }
+    }
+
+    #[test]
+    fn test_recv_ack() {
+        let mut buffer = vec![0; 64];
+        let mut req_ids = vec![3, 1, 2].into_iter();
+        let len = recv_ack(
+            recv_from(move || read_mem_ack(req_ids.next().unwrap())),
+            &mut buffer,
+            2,
+            &config(),
+        )
+        .unwrap();
+        assert_eq!(
+            ack::AckPacket::parse(&buffer[..len]).unwrap().request_id(),
+            2
+        );
+    }
+
+    #[test]
+    fn test_recv_only_stale_acks() {
+        let mut buffer = vec![0; 64];
+        let start = Instant::now();
+        let result = recv_ack(recv_from(|| read_mem_ack(1)), &mut buffer, 2, &config());
+        assert!(matches!(result, Err(ControlError::Timeout)));
+        assert!(start.elapsed() < Duration::from_secs(1));
+    }
+}
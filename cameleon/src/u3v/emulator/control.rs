@@ -0,0 +1,92 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+use crate::{
+    u3v::{
+        control_handle::{read_device_xml, setup_stream_interface},
+        register_map::{Abrm, Sirm},
+    },
+    ControlError, ControlResult, DeviceControl,
+};
+
+use super::SharedDevice;
+
+/// Control handle of the emulated camera.
+///
+/// Registers are read and written in the memory of the emulated device instead of over USB.
+pub struct EmulatedControl {
+    device: SharedDevice,
+    is_opened: bool,
+}
+
+impl EmulatedControl {
+    pub(super) fn new(device: SharedDevice) -> Self {
+        Self {
+            device,
+            is_opened: false,
+        }
+    }
+
+    fn assert_open(&self) -> ControlResult<()> {
+        if self.is_opened {
+            Ok(())
+        } else {
+            Err(ControlError::NotOpened)
+        }
+    }
+
+    fn sirm(&mut self) -> ControlResult<Sirm> {
+        Abrm::new(self)?
+            .sbrm(self)?
+            .sirm(self)?
+            .ok_or_else(|| ControlError::InvalidDevice("the device doesn't have `SIRM`".into()))
+    }
+}
+
+impl DeviceControl for EmulatedControl {
+    fn open(&mut self) -> ControlResult<()> {
+        self.is_opened = true;
+        Ok(())
+    }
+
+    fn close(&mut self) -> ControlResult<()> {
+        self.is_opened = false;
+        Ok(())
+    }
+
+    fn is_opened(&self) -> bool {
+        self.is_opened
+    }
+
+    fn read(&mut self, address: u64, buf: &mut [u8]) -> ControlResult<()> {
+        self.assert_open()?;
+        self.device.lock().unwrap().read(address, buf)
+    }
+
+    fn write(&mut self, address: u64, data: &[u8]) -> ControlResult<()> {
+        self.assert_open()?;
+        self.device.lock().unwrap().write(address, data)
+    }
+
+    fn genapi(&mut self) -> ControlResult<String> {
+        let table = Abrm::new(self)?.manifest_table(self)?;
+        read_device_xml(self, table)
+    }
+
+    fn enable_streaming(&mut self) -> ControlResult<()> {
+        let sirm = self.sirm()?;
+        setup_stream_interface(self, sirm)
+    }
+
+    fn disable_streaming(&mut self) -> ControlResult<()> {
+        let sirm = self.sirm()?;
+        sirm.disable_stream(self)
+    }
+}
+
+impl From<EmulatedControl> for Box<dyn DeviceControl> {
+    fn from(ctrl: EmulatedControl) -> Self {
+        Box::new(ctrl)
+    }
+}
@@ -0,0 +1,438 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! Register maps and `GenApi` XML of the emulated device.
+
+use cameleon_device::PixelFormat;
+use cameleon_impl::memory::{memory, prelude::*, register_map};
+
+pub(super) const SBRM_ADDRESS: u64 = 0x1000;
+pub(super) const SIRM_ADDRESS: u64 = 0x2000;
+pub(super) const MANIFEST_TABLE_ADDRESS: u64 = 0x3000;
+pub(super) const DEVICE_REG_ADDRESS: u64 = 0x4000;
+pub(super) const GENAPI_XML_ADDRESS: u64 = 0x5000;
+pub(super) const GENAPI_XML_LENGTH: usize = 0x4000;
+
+/// Size of an image leader, i.e. a generic leader followed by an image specific leader.
+pub(super) const LEADER_SIZE: u32 = 52;
+/// Size of an image trailer, i.e. a generic trailer followed by an image specific trailer.
+pub(super) const TRAILER_SIZE: u32 = 32;
+
+pub(super) const MANUFACTURER_NAME: &str = "CameleonProjectDevelopers";
+pub(super) const MODEL_NAME: &str = "CameleonEmulatedU3VCamera";
+
+/// Pixel formats the emulated device can stream.
+pub(super) const PIXEL_FORMATS: [PixelFormat; 2] = [PixelFormat::Mono8, PixelFormat::Mono16];
+
+#[memory]
+pub(super) struct Memory {
+    abrm: Abrm,
+    sbrm: Sbrm,
+    sirm: Sirm,
+    manifest_table: ManifestTable,
+    device_reg: DeviceReg,
+    genapi_xml: GenApiXml,
+}
+
+/// Technology agnostic bootstrap register map.
+#[register_map(base = 0, endianness = LE)]
+pub(super) enum Abrm {
+    /// `GenCP` version 1.0.
+    #[register(len = 4, access = RO, ty = u32)]
+    GenCpVersion = 0x0001_0000,
+
+    #[register(len = 64, access = RO, ty = String)]
+    ManufacturerName = MANUFACTURER_NAME,
+
+    #[register(len = 64, access = RO, ty = String)]
+    ModelName = MODEL_NAME,
+
+    #[register(len = 64, access = RO, ty = String)]
+    FamilyName = "Cameleon",
+
+    #[register(len = 64, access = RO, ty = String)]
+    DeviceVersion = "1.0.0",
+
+    #[register(len = 64, access = RO, ty = String)]
+    ManufacturerInfo = "Software emulated device",
+
+    #[register(len = 64, access = RO, ty = String)]
+    SerialNumber,
+
+    #[register(len = 64, access = RW, ty = String)]
+    UserDefinedName,
+
+    /// User defined name and family name are supported.
+    #[register(len = 8, access = RO, ty = u64)]
+    DeviceCapability = 0b1_0000_0001,
+
+    /// In milliseconds.
+    #[register(len = 4, access = RO, ty = u32)]
+    MaximumDeviceResponseTime = 100,
+
+    #[register(len = 8, access = RO, ty = u64)]
+    ManifestTableAddress = MANIFEST_TABLE_ADDRESS,
+
+    #[register(len = 8, access = RO, ty = u64)]
+    SbrmAddress = SBRM_ADDRESS,
+
+    #[register(len = 8, access = RW, ty = u64)]
+    DeviceConfiguration,
+
+    #[register(len = 4, access = RW, ty = u32)]
+    HeartbeatTimeout = 3000,
+
+    #[register(len = 4, access = RW, ty = u32)]
+    MessageChannelId,
+
+    /// Latched value of the device timestamp in nanoseconds.
+    #[register(len = 8, access = RO, ty = u64)]
+    Timestamp,
+
+    /// Latches the current device timestamp to [`Abrm::Timestamp`] when written.
+    #[register(len = 4, access = WO, ty = u32)]
+    TimestampLatch,
+
+    /// The timestamp is counted in nanoseconds.
+    #[register(len = 8, access = RO, ty = u64)]
+    TimestampIncrement = 1,
+
+    #[register(len = 4, access = RW, ty = u32)]
+    AccessPrivilege,
+
+    /// Little endian.
+    #[register(len = 4, access = RO, ty = u32)]
+    ProtocolEndianness = u32::MAX,
+
+    /// Little endian.
+    #[register(len = 4, access = RO, ty = u32)]
+    ImplementationEndianness = u32::MAX,
+
+    #[register(len = 64, access = RO, ty = String)]
+    DeviceSoftwareInterfaceVersion = "1.0.0",
+}
+
+/// Technology specific bootstrap register map.
+#[register_map(base = SBRM_ADDRESS, endianness = LE)]
+pub(super) enum Sbrm {
+    /// U3V version 1.0.
+    #[register(len = 4, access = RO, ty = u32)]
+    U3VVersion = 0x0001_0000,
+
+    /// Only `SIRM` is available.
+    #[register(len = 8, access = RO, ty = u64)]
+    U3VCPCapability = 0b1,
+
+    #[register(len = 8, access = RW, ty = u64)]
+    U3VCPConfiguration,
+
+    #[register(len = 4, access = RO, ty = u32)]
+    MaximumCommandTransferLength = 1024,
+
+    #[register(len = 4, access = RO, ty = u32)]
+    MaximumAcknowledgeTransferLength = 1024,
+
+    #[register(len = 4, access = RO, ty = u32)]
+    NumberOfStreamChannels = 1,
+
+    #[register(len = 8, access = RO, ty = u64)]
+    SirmAddress = SIRM_ADDRESS,
+
+    #[register(len = 4, access = RO, ty = u32)]
+    SirmLength = Sirm::size() as u32,
+
+    #[register(len = 8, access = RO, ty = u64)]
+    EirmAddress,
+
+    #[register(len = 4, access = RO, ty = u32)]
+    EirmLength,
+
+    #[register(len = 8, access = RO, ty = u64)]
+    Iidc2Address,
+
+    /// SuperSpeed.
+    #[register(len = 4, access = RO, ty = u32)]
+    CurrentSpeed = 0b1000,
+}
+
+/// Streaming interface register map.
+#[register_map(base = SIRM_ADDRESS, endianness = LE)]
+pub(super) enum Sirm {
+    /// Payload sizes are aligned to 8 bytes.
+    #[register(len = 4, access = RO, ty = u32)]
+    SiInfo = 3 << 24,
+
+    #[register(len = 4, access = RW, ty = u32)]
+    SiControl,
+
+    #[register(len = 8, access = RO, ty = u64)]
+    RequiredPayloadSize,
+
+    #[register(len = 4, access = RO, ty = u32)]
+    RequiredLeaderSize = LEADER_SIZE,
+
+    #[register(len = 4, access = RO, ty = u32)]
+    RequiredTrailerSize = TRAILER_SIZE,
+
+    #[register(len = 4, access = RW, ty = u32)]
+    MaximumLeaderSize,
+
+    #[register(len = 4, access = RW, ty = u32)]
+    PayloadTransferSize,
+
+    #[register(len = 4, access = RW, ty = u32)]
+    PayloadTransferCount,
+
+    #[register(len = 4, access = RW, ty = u32)]
+    PayloadFinalTransfer1Size,
+
+    #[register(len = 4, access = RW, ty = u32)]
+    PayloadFinalTransfer2Size,
+
+    #[register(len = 4, access = RW, ty = u32)]
+    MaximumTrailerSize,
+}
+
+/// Manifest table with a single entry of the device XML.
+#[register_map(base = MANIFEST_TABLE_ADDRESS, endianness = LE)]
+pub(super) enum ManifestTable {
+    #[register(len = 8, access = RO, ty = u64)]
+    EntryCount = 1,
+
+    /// File version 1.0.0.
+    #[register(len = 4, access = RO, ty = u32)]
+    GenICamFileVersion = 0x0100_0000,
+
+    /// Uncompressed device XML of schema version 1.1.
+    #[register(len = 4, access = RO, ty = u32)]
+    FileFormatInfo = 0x0101_0000,
+
+    #[register(len = 8, access = RO, ty = u64)]
+    RegisterAddress = GENAPI_XML_ADDRESS,
+
+    #[register(len = 8, access = RO, ty = u64)]
+    FileSize,
+
+    /// All zero, i.e. the hash is not available.
+    #[register(len = 20, access = RO, ty = Bytes)]
+    Sha1Hash,
+}
+
+/// Registers of the features described in the `GenApi` XML.
+#[register_map(base = DEVICE_REG_ADDRESS, endianness = LE)]
+pub(super) enum DeviceReg {
+    #[register(len = 4, access = RW, ty = u32)]
+    Width,
+
+    #[register(len = 4, access = RW, ty = u32)]
+    Height,
+
+    #[register(len = 4, access = RO, ty = u32)]
+    WidthMax,
+
+    #[register(len = 4, access = RO, ty = u32)]
+    HeightMax,
+
+    #[register(len = 4, access = RW, ty = u32)]
+    PixelFormat = 0x0108_0001,
+
+    #[register(len = 4, access = RO, ty = u32)]
+    PayloadSize,
+
+    #[register(len = 4, access = RW, ty = u32)]
+    TLParamsLocked,
+
+    #[register(len = 4, access = WO, ty = u32)]
+    AcquisitionStart,
+
+    #[register(len = 4, access = WO, ty = u32)]
+    AcquisitionStop,
+
+    /// In frames per second. Frames are sent as fast as possible if the value is not positive.
+    #[register(len = 8, access = RW, ty = f64)]
+    AcquisitionFrameRate,
+}
+
+#[register_map(base = GENAPI_XML_ADDRESS, endianness = LE)]
+pub(super) enum GenApiXml {
+    #[register(len = GENAPI_XML_LENGTH, access = RO, ty = String)]
+    Xml,
+}
+
+/// Returns the `GenApi` XML of the device with the sensor of `width_max` x `height_max`.
+pub(super) fn genapi_xml(width_max: u32, height_max: u32) -> String {
+    let pixel_format_entries: String = PIXEL_FORMATS
+        .iter()
+        .map(|format| {
+            format!(
+                r#"
+        <EnumEntry Name="{:?}" NameSpace="Standard">
+            <Value>{:#x}</Value>
+        </EnumEntry>"#,
+                format,
+                u32::from(*format)
+            )
+        })
+        .collect();
+
+    format!(
+        r#"<?xml version="1.0" encoding="UTF-8"?>
+<RegisterDescription
+ModelName="{model_name}"
+VendorName="{vendor_name}"
+StandardNameSpace="None"
+SchemaMajorVersion="1"
+SchemaMinorVersion="1"
+SchemaSubMinorVersion="0"
+MajorVersion="1"
+MinorVersion="0"
+SubMinorVersion="0"
+ToolTip="Software emulated U3V camera"
+ProductGuid="5b4cf3a1-7e1d-4e0b-9a55-3f2d0c8e6a11"
+VersionGuid="c2a7d0e4-1b8f-4c36-8d2e-9f6a5b3c1d70"
+xmlns="http://www.genicam.org/GenApi/Version_1_1"
+xmlns:xsi="http://www.w3.org/2001/XMLSchema-instance"
+xsi:schemaLocation="http://www.genicam.org/GenApi/Version_1_1 http://www.genicam.org/GenApi/GenApiSchema_Version_1_1.xsd">
+
+    <Category Name="Root" NameSpace="Standard">
+        <pFeature>ImageFormatControl</pFeature>
+        <pFeature>AcquisitionControl</pFeature>
+        <pFeature>TransportLayerControl</pFeature>
+    </Category>
+
+    <Category Name="ImageFormatControl" NameSpace="Standard">
+        <pFeature>Width</pFeature>
+        <pFeature>Height</pFeature>
+        <pFeature>PixelFormat</pFeature>
+    </Category>
+
+    <Category Name="AcquisitionControl" NameSpace="Standard">
+        <pFeature>AcquisitionStart</pFeature>
+        <pFeature>AcquisitionStop</pFeature>
+        <pFeature>AcquisitionFrameRate</pFeature>
+    </Category>
+
+    <Category Name="TransportLayerControl" NameSpace="Standard">
+        <pFeature>PayloadSize</pFeature>
+        <pFeature>TLParamsLocked</pFeature>
+    </Category>
+
+    <Integer Name="Width" NameSpace="Standard">
+        <pValue>WidthReg</pValue>
+        <Min>1</Min>
+        <Max>{width_max}</Max>
+    </Integer>
+
+    <IntReg Name="WidthReg">
+        <Address>{width:#x}</Address>
+        <Length>4</Length>
+        <AccessMode>RW</AccessMode>
+        <pPort>Device</pPort>
+        <Endianess>LittleEndian</Endianess>
+    </IntReg>
+
+    <Integer Name="Height" NameSpace="Standard">
+        <pValue>HeightReg</pValue>
+        <Min>1</Min>
+        <Max>{height_max}</Max>
+    </Integer>
+
+    <IntReg Name="HeightReg">
+        <Address>{height:#x}</Address>
+        <Length>4</Length>
+        <AccessMode>RW</AccessMode>
+        <pPort>Device</pPort>
+        <Endianess>LittleEndian</Endianess>
+    </IntReg>
+
+    <Enumeration Name="PixelFormat" NameSpace="Standard">{pixel_format_entries}
+        <pValue>PixelFormatReg</pValue>
+    </Enumeration>
+
+    <IntReg Name="PixelFormatReg">
+        <Address>{pixel_format:#x}</Address>
+        <Length>4</Length>
+        <AccessMode>RW</AccessMode>
+        <pPort>Device</pPort>
+        <Endianess>LittleEndian</Endianess>
+    </IntReg>
+
+    <IntReg Name="PayloadSize" NameSpace="Standard">
+        <Address>{payload_size:#x}</Address>
+        <Length>4</Length>
+        <AccessMode>RO</AccessMode>
+        <pPort>Device</pPort>
+        <Cachable>NoCache</Cachable>
+        <Endianess>LittleEndian</Endianess>
+    </IntReg>
+
+    <IntReg Name="TLParamsLocked" NameSpace="Standard">
+        <Address>{tl_params_locked:#x}</Address>
+        <Length>4</Length>
+        <AccessMode>RW</AccessMode>
+        <pPort>Device</pPort>
+        <Endianess>LittleEndian</Endianess>
+    </IntReg>
+
+    <Command Name="AcquisitionStart" NameSpace="Standard">
+        <pValue>AcquisitionStartReg</pValue>
+        <CommandValue>1</CommandValue>
+    </Command>
+
+    <IntReg Name="AcquisitionStartReg">
+        <Address>{acquisition_start:#x}</Address>
+        <Length>4</Length>
+        <AccessMode>WO</AccessMode>
+        <pPort>Device</pPort>
+        <Endianess>LittleEndian</Endianess>
+    </IntReg>
+
+    <Command Name="AcquisitionStop" NameSpace="Standard">
+        <pValue>AcquisitionStopReg</pValue>
+        <CommandValue>1</CommandValue>
+    </Command>
+
+    <IntReg Name="AcquisitionStopReg">
+        <Address>{acquisition_stop:#x}</Address>
+        <Length>4</Length>
+        <AccessMode>WO</AccessMode>
+        <pPort>Device</pPort>
+        <Endianess>LittleEndian</Endianess>
+    </IntReg>
+
+    <Float Name="AcquisitionFrameRate" NameSpace="Standard">
+        <pValue>AcquisitionFrameRateReg</pValue>
+        <Min>0.0</Min>
+        <Max>100000.0</Max>
+        <Unit>Hz</Unit>
+    </Float>
+
+    <FloatReg Name="AcquisitionFrameRateReg">
+        <Address>{acquisition_frame_rate:#x}</Address>
+        <Length>8</Length>
+        <AccessMode>RW</AccessMode>
+        <pPort>Device</pPort>
+        <Endianess>LittleEndian</Endianess>
+    </FloatReg>
+
+    <Port Name="Device" NameSpace="Standard">
+    </Port>
+
+</RegisterDescription>
+"#,
+        model_name = MODEL_NAME,
+        vendor_name = MANUFACTURER_NAME,
+        width_max = width_max,
+        height_max = height_max,
+        pixel_format_entries = pixel_format_entries,
+        width = DeviceReg::Width::ADDRESS,
+        height = DeviceReg::Height::ADDRESS,
+        pixel_format = DeviceReg::PixelFormat::ADDRESS,
+        payload_size = DeviceReg::PayloadSize::ADDRESS,
+        tl_params_locked = DeviceReg::TLParamsLocked::ADDRESS,
+        acquisition_start = DeviceReg::AcquisitionStart::ADDRESS,
+        acquisition_stop = DeviceReg::AcquisitionStop::ADDRESS,
+        acquisition_frame_rate = DeviceReg::AcquisitionFrameRate::ADDRESS,
+    )
+}
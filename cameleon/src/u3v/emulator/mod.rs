@@ -0,0 +1,395 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! This module provides a software emulated U3V camera.
+//!
+//! The emulated camera serves `ABRM`, `SBRM`, `SIRM`, a manifest table and a `GenApi` XML from
+//! memory, and streams synthetic images at the configured resolution and frame rate. Bootstrap
+//! registers, `GenApi` and payload parsing go through the same code as a real U3V camera, so the
+//! host side can be tested and benchmarked without hardware.
+//!
+//! # Examples
+//!
+//! ```
+//! use cameleon::u3v::emulator::{self, EmulatorConfig};
+//!
+//! let mut camera = emulator::camera(EmulatorConfig::default());
+//! camera.open().unwrap();
+//! camera.load_context().unwrap();
+//!
+//! let payload_rx = camera.start_streaming(3).unwrap();
+//! let payload = payload_rx.recv_blocking().unwrap();
+//! assert_eq!(payload.image_info().unwrap().width, 640);
+//! payload_rx.send_back(payload);
+//!
+//! camera.close().unwrap();
+//! ```
+
+mod control;
+mod memory;
+mod stream;
+
+pub use control::EmulatedControl;
+pub use stream::EmulatedStream;
+
+use std::{
+    ops::Range,
+    sync::{Arc, Mutex},
+    time::{Duration, Instant},
+};
+
+use cameleon_device::PixelFormat;
+use cameleon_impl::memory::{prelude::*, AccessRight, MemoryError};
+
+use crate::{Camera, CameraInfo, ControlError, ControlResult};
+
+use memory::{Abrm, DeviceReg, GenApiXml, ManifestTable, Memory, Sirm};
+
+/// Configuration of the emulated camera.
+#[derive(Debug, Clone)]
+pub struct EmulatorConfig {
+    /// Maximum width of the image, which is also the initial width.
+    pub width: u32,
+    /// Maximum height of the image, which is also the initial height.
+    pub height: u32,
+    /// Initial frame rate in frames per second. Frames are sent as fast as possible if the value
+    /// is not positive.
+    ///
+    /// The frame rate can be changed through `AcquisitionFrameRate` node.
+    pub frame_rate: f64,
+    /// Serial number of the camera.
+    pub serial_number: String,
+}
+
+impl Default for EmulatorConfig {
+    fn default() -> Self {
+        Self {
+            width: 640,
+            height: 480,
+            frame_rate: 30.0,
+            serial_number: "EMU0000".into(),
+        }
+    }
+}
+
+/// Returns a new emulated camera.
+///
+/// Each call creates an independent device.
+///
+/// # Panics
+/// If `config.width` or `config.height` is zero.
+#[must_use]
+pub fn camera(config: EmulatorConfig) -> Camera<EmulatedControl, EmulatedStream> {
+    assert!(config.width > 0 && config.height > 0);
+
+    let info = CameraInfo {
+        vendor_name: memory::MANUFACTURER_NAME.into(),
+        model_name: memory::MODEL_NAME.into(),
+        serial_number: config.serial_number.clone(),
+        vid: 0,
+        pid: 0,
+    };
+    let device = Arc::new(Mutex::new(Device::new(&config)));
+    let ctrl = EmulatedControl::new(device.clone());
+    let strm = EmulatedStream::new(device);
+
+    Camera::new(ctrl, strm, None, info)
+}
+
+type SharedDevice = Arc<Mutex<Device>>;
+
+/// State of the emulated device shared between [`EmulatedControl`] and [`EmulatedStream`].
+struct Device {
+    memory: Memory,
+    /// Origin of the device timestamp.
+    started_at: Instant,
+    /// Set by `AcquisitionStart` and cleared by `AcquisitionStop`.
+    is_acquiring: bool,
+}
+
+/// Properties of the next frame.
+struct FrameSpec {
+    width: u32,
+    height: u32,
+    pixel_format: PixelFormat,
+    payload_size: usize,
+    timestamp: u64,
+    /// `None` if frames are sent as fast as possible.
+    frame_period: Option<Duration>,
+}
+
+impl Device {
+    fn new(config: &EmulatorConfig) -> Self {
+        let mut memory = Memory::new();
+        let xml = memory::genapi_xml(config.width, config.height);
+        let xml_len = xml.len() as u64;
+
+        memory
+            .write::<Abrm::SerialNumber>(config.serial_number.clone())
+            .unwrap();
+        memory.write::<DeviceReg::Width>(config.width).unwrap();
+        memory.write::<DeviceReg::Height>(config.height).unwrap();
+        memory.write::<DeviceReg::WidthMax>(config.width).unwrap();
+        memory.write::<DeviceReg::HeightMax>(config.height).unwrap();
+        memory
+            .write::<DeviceReg::AcquisitionFrameRate>(config.frame_rate)
+            .unwrap();
+        memory.write::<GenApiXml::Xml>(xml).unwrap();
+        memory.write::<ManifestTable::FileSize>(xml_len).unwrap();
+        memory
+            .write::<ManifestTable::Sha1Hash>(vec![0; 20])
+            .unwrap();
+
+        let mut device = Self {
+            memory,
+            started_at: Instant::now(),
+            is_acquiring: false,
+        };
+        device.update_payload_size();
+        device
+    }
+
+    fn read(&self, address: u64, buf: &mut [u8]) -> ControlResult<()> {
+        let start = address as usize;
+        let data = self
+            .memory
+            .read_raw(start..start + buf.len())
+            .map_err(memory_error)?;
+        buf.copy_from_slice(data);
+        Ok(())
+    }
+
+    fn write(&mut self, address: u64, data: &[u8]) -> ControlResult<()> {
+        let start = address as usize;
+        self.memory.write_raw(start, data).map_err(memory_error)?;
+        self.handle_write(start..start + data.len())
+    }
+
+    /// Emulates side effects of writing to `range`.
+    fn handle_write(&mut self, range: Range<usize>) -> ControlResult<()> {
+        if overlaps::<Abrm::TimestampLatch>(&range) {
+            let timestamp = self.timestamp();
+            self.memory.write::<Abrm::Timestamp>(timestamp).unwrap();
+        }
+
+        if overlaps::<DeviceReg::AcquisitionStart>(&range) {
+            self.is_acquiring = true;
+        }
+        if overlaps::<DeviceReg::AcquisitionStop>(&range) {
+            self.is_acquiring = false;
+        }
+
+        // Image format can't be changed while transport layer parameters are locked.
+        if overlaps::<DeviceReg::TLParamsLocked>(&range) {
+            let access_right = if self.read_reg::<DeviceReg::TLParamsLocked>() == 0 {
+                AccessRight::RW
+            } else {
+                AccessRight::RO
+            };
+            self.memory
+                .set_access_right::<DeviceReg::Width>(access_right);
+            self.memory
+                .set_access_right::<DeviceReg::Height>(access_right);
+            self.memory
+                .set_access_right::<DeviceReg::PixelFormat>(access_right);
+        }
+
+        if overlaps::<DeviceReg::Width>(&range) || overlaps::<DeviceReg::Height>(&range) {
+            let width_max = self.read_reg::<DeviceReg::WidthMax>();
+            let height_max = self.read_reg::<DeviceReg::HeightMax>();
+            let width = self.read_reg::<DeviceReg::Width>().clamp(1, width_max);
+            let height = self.read_reg::<DeviceReg::Height>().clamp(1, height_max);
+            self.memory.write::<DeviceReg::Width>(width).unwrap();
+            self.memory.write::<DeviceReg::Height>(height).unwrap();
+            self.update_payload_size();
+        }
+
+        if overlaps::<DeviceReg::PixelFormat>(&range) {
+            if self.pixel_format().is_none() {
+                self.memory
+                    .write::<DeviceReg::PixelFormat>(PixelFormat::Mono8.into())
+                    .unwrap();
+                self.update_payload_size();
+                return Err(ControlError::InvalidData(
+                    "the pixel format is not supported by the emulated device".into(),
+                ));
+            }
+            self.update_payload_size();
+        }
+
+        Ok(())
+    }
+
+    /// Returns the properties of the next frame, or `None` if the device is not streaming.
+    fn frame_spec(&self) -> Option<FrameSpec> {
+        let is_stream_enabled = self.read_reg::<Sirm::SiControl>() & 1 == 1;
+        if !is_stream_enabled || !self.is_acquiring {
+            return None;
+        }
+
+        let frame_rate = self
+            .memory
+            .read::<DeviceReg::AcquisitionFrameRate>()
+            .unwrap();
+        let frame_period = if frame_rate > 0.0 && frame_rate.is_finite() {
+            Some(Duration::from_secs_f64(1.0 / frame_rate))
+        } else {
+            None
+        };
+
+        Some(FrameSpec {
+            width: self.read_reg::<DeviceReg::Width>(),
+            height: self.read_reg::<DeviceReg::Height>(),
+            pixel_format: self.pixel_format()?,
+            payload_size: self.read_reg::<DeviceReg::PayloadSize>() as usize,
+            timestamp: self.timestamp(),
+            frame_period,
+        })
+    }
+
+    fn update_payload_size(&mut self) {
+        let bytes_per_pixel = match self.pixel_format() {
+            Some(PixelFormat::Mono16) => 2,
+            _ => 1,
+        };
+        let payload_size = self.read_reg::<DeviceReg::Width>()
+            * self.read_reg::<DeviceReg::Height>()
+            * bytes_per_pixel;
+        self.memory
+            .write::<DeviceReg::PayloadSize>(payload_size)
+            .unwrap();
+        self.memory
+            .write::<Sirm::RequiredPayloadSize>(u64::from(payload_size))
+            .unwrap();
+    }
+
+    fn pixel_format(&self) -> Option<PixelFormat> {
+        let raw = self.read_reg::<DeviceReg::PixelFormat>();
+        memory::PIXEL_FORMATS
+            .iter()
+            .copied()
+            .find(|format| u32::from(*format) == raw)
+    }
+
+    /// Device timestamp in nanoseconds.
+    fn timestamp(&self) -> u64 {
+        self.started_at.elapsed().as_nanos() as u64
+    }
+
+    fn read_reg<T: Register<Ty = u32>>(&self) -> u32 {
+        self.memory.read::<T>().unwrap()
+    }
+}
+
+/// Returns `true` if `range` overlaps the register `T`.
+fn overlaps<T: Register>(range: &Range<usize>) -> bool {
+    let reg = T::range();
+    range.start < reg.end && reg.start < range.end
+}
+
+/// Converts an error of the device memory to the error a U3V device would return.
+fn memory_error(err: MemoryError) -> ControlError {
+    ControlError::Io(anyhow::Error::msg(format!("invalid status: {}", err)))
+}
+
+#[cfg(test)]
+mod tests {
+    use cameleon_device::u3v::register_map::{abrm, manifest_entry, sbrm, sirm};
+
+    use crate::{genapi::ParamsCtxt, DeviceControl};
+
+    use super::{
+        memory::{Sbrm, MANIFEST_TABLE_ADDRESS, SBRM_ADDRESS, SIRM_ADDRESS},
+        *,
+    };
+
+    #[test]
+    fn test_bootstrap_layout() {
+        fn assert_reg<T: Register>(base: u64, (offset, len): (u64, u16)) {
+            assert_eq!(T::ADDRESS, (base + offset) as usize);
+            assert_eq!(T::LENGTH, len as usize);
+        }
+
+        assert_reg::<Abrm::SerialNumber>(0, abrm::SERIAL_NUMBER);
+        assert_reg::<Abrm::DeviceCapability>(0, abrm::DEVICE_CAPABILITY);
+        assert_reg::<Abrm::SbrmAddress>(0, abrm::SBRM_ADDRESS);
+        assert_reg::<Abrm::TimestampLatch>(0, abrm::TIMESTAMP_LATCH);
+        assert_reg::<Abrm::DeviceSoftwareInterfaceVersion>(
+            0,
+            abrm::DEVICE_SOFTWARE_INTERFACE_VERSION,
+        );
+        assert_reg::<Sbrm::SirmAddress>(SBRM_ADDRESS, sbrm::SIRM_ADDRESS);
+        assert_reg::<Sbrm::CurrentSpeed>(SBRM_ADDRESS, sbrm::CURRENT_SPEED);
+        assert_reg::<Sirm::RequiredPayloadSize>(SIRM_ADDRESS, sirm::REQUIRED_PAYLOAD_SIZE);
+        assert_reg::<Sirm::MaximumTrailerSize>(SIRM_ADDRESS, sirm::MAXIMUM_TRAILER_SIZE);
+        // The first entry follows the entry count.
+        let entry_address = MANIFEST_TABLE_ADDRESS + 8;
+        assert_reg::<ManifestTable::FileSize>(entry_address, manifest_entry::FILE_SIZE);
+        assert_reg::<ManifestTable::Sha1Hash>(entry_address, manifest_entry::SHA1_HASH);
+    }
+
+    #[test]
+    fn test_streaming() {
+        let config = EmulatorConfig {
+            width: 64,
+            height: 48,
+            frame_rate: 0.0,
+            ..EmulatorConfig::default()
+        };
+        let mut camera = camera(config);
+        camera.open().unwrap();
+        camera.load_context().unwrap();
+
+        let mut ctxt = camera.params_ctxt().unwrap();
+        set_integer(&mut ctxt, "Width", 32);
+        let pixel_format = ctxt
+            .node("PixelFormat")
+            .unwrap()
+            .as_enumeration(&ctxt)
+            .unwrap();
+        pixel_format
+            .set_entry_by_symbolic(&mut ctxt, "Mono16")
+            .unwrap();
+
+        let payload_rx = camera.start_streaming(3).unwrap();
+        // The image format is locked while streaming.
+        let width_address = DeviceReg::Width::ADDRESS as u64;
+        assert!(camera
+            .ctrl
+            .write(width_address, &16_u32.to_le_bytes())
+            .is_err());
+
+        let mut last_id = None;
+        for _ in 0..5 {
+            let payload = payload_rx.recv_blocking().unwrap();
+            let image_info = payload.image_info().unwrap();
+            assert_eq!(image_info.width, 32);
+            assert_eq!(image_info.height, 48);
+            assert_eq!(image_info.pixel_format, PixelFormat::Mono16);
+            assert_eq!(payload.image().unwrap().len(), 32 * 48 * 2);
+            if let Some(id) = last_id {
+                assert!(id < payload.id());
+            }
+            last_id = Some(payload.id());
+            payload_rx.send_back(payload);
+        }
+
+        camera.stop_streaming().unwrap();
+        assert!(camera.strm.stats().snapshot().frames_delivered >= 5);
+
+        let mut ctxt = camera.params_ctxt().unwrap();
+        set_integer(&mut ctxt, "Width", 16);
+        camera.close().unwrap();
+    }
+
+    fn set_integer<Ctrl: DeviceControl, Ctxt: crate::genapi::GenApiCtxt>(
+        ctxt: &mut ParamsCtxt<Ctrl, Ctxt>,
+        name: &str,
+        value: i64,
+    ) {
+        let node = ctxt.node(name).unwrap().as_integer(ctxt).unwrap();
+        node.set_value(ctxt, value).unwrap();
+        assert_eq!(node.value(ctxt).unwrap(), value);
+    }
+}
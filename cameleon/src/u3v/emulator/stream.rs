@@ -0,0 +1,324 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+use std::{
+    sync::{mpsc, Arc},
+    thread::JoinHandle,
+    time::{Duration, Instant},
+};
+
+use cameleon_device::u3v::protocol::stream as u3v_stream;
+use cameleon_impl::bytes_io::WriteBytes;
+use tracing::{info, warn};
+
+use crate::{
+    camera::PayloadStream,
+    payload::{acquire_payload_buf, HeapAllocator, HostTimestamp, PayloadBufferPool, PayloadSender},
+    u3v::{
+        stream_handle::{send_payload, PayloadBuilder},
+        stream_stats::StreamStats,
+        StreamParams,
+    },
+    DeviceControl, StreamError, StreamResult,
+};
+
+use super::{memory, FrameSpec, SharedDevice};
+
+/// Interval to check whether the device starts streaming.
+const IDLE_INTERVAL: Duration = Duration::from_millis(5);
+
+/// Stream handle of the emulated camera.
+///
+/// The streaming loop generates a leader, an image and a trailer for each frame in the device
+/// memory, then parses and delivers them in the same way as [`StreamHandle`] does.
+///
+/// [`StreamHandle`]: crate::u3v::StreamHandle
+pub struct EmulatedStream {
+    device: SharedDevice,
+    params: StreamParams,
+    buffer_pool: Option<PayloadBufferPool>,
+    streaming_loop: Option<LoopHandle>,
+    stats: Arc<StreamStats>,
+}
+
+impl EmulatedStream {
+    pub(super) fn new(device: SharedDevice) -> Self {
+        Self {
+            device,
+            params: StreamParams::default(),
+            buffer_pool: None,
+            streaming_loop: None,
+            stats: Arc::new(StreamStats::default()),
+        }
+    }
+
+    /// Returns params.
+    #[must_use]
+    pub fn params(&self) -> &StreamParams {
+        &self.params
+    }
+
+    /// Returns mutable params. Only [`StreamParams::buffer_count`] affects the emulated stream.
+    pub fn params_mut(&mut self) -> &mut StreamParams {
+        &mut self.params
+    }
+
+    /// Returns the statistics of the streaming loop.
+    #[must_use]
+    pub fn stats(&self) -> Arc<StreamStats> {
+        self.stats.clone()
+    }
+
+    fn prepare_buffer_pool(&mut self, buffer_size: usize) -> StreamResult<PayloadBufferPool> {
+        let buffer_count = self.params.buffer_count;
+        if let Some(pool) = &self.buffer_pool {
+            if pool.buffer_size() >= buffer_size && pool.buffer_count() == buffer_count {
+                return Ok(pool.clone());
+            }
+        }
+
+        let pool =
+            PayloadBufferPool::new(HeapAllocator, buffer_size, buffer_count).ok_or_else(|| {
+                StreamError::Io(anyhow::Error::msg("failed to allocate payload buffers"))
+            })?;
+        self.buffer_pool = Some(pool.clone());
+        Ok(pool)
+    }
+}
+
+impl PayloadStream for EmulatedStream {
+    fn open(&mut self) -> StreamResult<()> {
+        Ok(())
+    }
+
+    fn close(&mut self) -> StreamResult<()> {
+        if self.is_loop_running() {
+            self.stop_streaming_loop()?;
+        }
+        Ok(())
+    }
+
+    fn start_streaming_loop(
+        &mut self,
+        sender: PayloadSender,
+        ctrl: &mut dyn DeviceControl,
+    ) -> StreamResult<()> {
+        if self.is_loop_running() {
+            return Err(StreamError::InStreaming);
+        }
+
+        let mut params = StreamParams::from_control(ctrl).map_err(|e| {
+            StreamError::Io(anyhow::Error::msg(format!(
+                "failed to setup streaming parameters: {}",
+                e
+            )))
+        })?;
+        params.buffer_count = self.params.buffer_count;
+        self.params = params;
+
+        let buffer_pool = self.prepare_buffer_pool(self.params.maximum_payload_size())?;
+        let (cancel_tx, cancel_rx) = mpsc::channel();
+        let strm_loop = EmulatorLoop {
+            device: self.device.clone(),
+            sender,
+            cancel_rx,
+            buffer_pool,
+            stats: self.stats.clone(),
+            leader_buf: Vec::with_capacity(memory::LEADER_SIZE as usize),
+            trailer_buf: Vec::with_capacity(memory::TRAILER_SIZE as usize),
+        };
+        let join_handle = std::thread::spawn(|| strm_loop.run());
+        self.streaming_loop = Some(LoopHandle {
+            cancel_tx,
+            join_handle,
+        });
+
+        info!("start emulated streaming loop successfully");
+        Ok(())
+    }
+
+    fn stop_streaming_loop(&mut self) -> StreamResult<()> {
+        if let Some(streaming_loop) = self.streaming_loop.take() {
+            // Dropping the sender also wakes up the loop.
+            drop(streaming_loop.cancel_tx);
+            streaming_loop.join_handle.join().map_err(|_| {
+                StreamError::Poisoned("streaming loop panicked before cancellation".into())
+            })?;
+        }
+
+        info!("stop emulated streaming loop successfully");
+        Ok(())
+    }
+
+    fn is_loop_running(&self) -> bool {
+        self.streaming_loop.is_some()
+    }
+}
+
+impl Drop for EmulatedStream {
+    fn drop(&mut self) {
+        self.close().ok();
+    }
+}
+
+impl From<EmulatedStream> for Box<dyn PayloadStream> {
+    fn from(strm: EmulatedStream) -> Self {
+        Box::new(strm)
+    }
+}
+
+/// Handle of the running [`EmulatorLoop`].
+struct LoopHandle {
+    /// The loop exits when the sender is dropped.
+    cancel_tx: mpsc::Sender<()>,
+    join_handle: JoinHandle<()>,
+}
+
+struct EmulatorLoop {
+    device: SharedDevice,
+    sender: PayloadSender,
+    cancel_rx: mpsc::Receiver<()>,
+    buffer_pool: PayloadBufferPool,
+    stats: Arc<StreamStats>,
+    leader_buf: Vec<u8>,
+    trailer_buf: Vec<u8>,
+}
+
+impl EmulatorLoop {
+    fn run(mut self) {
+        let mut block_id = 0;
+        let mut deadline = Instant::now();
+
+        loop {
+            let timeout = deadline.saturating_duration_since(Instant::now());
+            if !matches!(
+                self.cancel_rx.recv_timeout(timeout),
+                Err(mpsc::RecvTimeoutError::Timeout)
+            ) {
+                break;
+            }
+
+            let frame = match self.device.lock().unwrap().frame_spec() {
+                Some(frame) => frame,
+                None => {
+                    deadline = Instant::now() + IDLE_INTERVAL;
+                    continue;
+                }
+            };
+
+            // Keep the frame rate, but don't send frames in a burst to catch up after a stall.
+            let now = Instant::now();
+            deadline = match frame.frame_period {
+                Some(period) => (deadline + period).max(now),
+                None => now,
+            };
+
+            self.send_frame(&frame, block_id);
+            block_id += 1;
+        }
+    }
+
+    fn send_frame(&mut self, frame: &FrameSpec, block_id: u64) {
+        let leader_at = Instant::now();
+        write_leader(&mut self.leader_buf, frame, block_id);
+        let mut payload_buf =
+            acquire_payload_buf(&self.buffer_pool, &self.sender, frame.payload_size);
+        fill_image(&mut payload_buf[..frame.payload_size], frame, block_id);
+        write_trailer(&mut self.trailer_buf, frame, block_id);
+        let trailer_at = Instant::now();
+
+        self.stats
+            .bytes_received(self.leader_buf.len() + frame.payload_size + self.trailer_buf.len());
+        self.stats.leader_to_trailer(trailer_at - leader_at);
+
+        let payload = u3v_stream::Leader::parse(&self.leader_buf)
+            .and_then(|leader| Ok((leader, u3v_stream::Trailer::parse(&self.trailer_buf)?)))
+            .map_err(|e| StreamError::InvalidPayload(format!("{}", e).into()))
+            .and_then(|(leader, trailer)| {
+                PayloadBuilder {
+                    leader,
+                    payload_buf,
+                    read_payload_size: frame.payload_size,
+                    trailer,
+                    host_timestamp: HostTimestamp {
+                        leader: leader_at,
+                        trailer: trailer_at,
+                    },
+                }
+                .build()
+            });
+
+        match payload {
+            Ok(payload) => {
+                if let Err(err) = send_payload(&self.sender, &self.stats, payload) {
+                    warn!(?err);
+                    return;
+                }
+            }
+            Err(err) => {
+                warn!(?err);
+                self.stats.error(&err);
+                self.sender.try_send(Err(err)).ok();
+            }
+        }
+        self.stats.trailer_to_delivery(trailer_at.elapsed());
+    }
+}
+
+/// Writes an image leader of `frame` to `buf`.
+fn write_leader(buf: &mut Vec<u8>, frame: &FrameSpec, block_id: u64) {
+    buf.clear();
+    // Leader magic.
+    buf.write_bytes_le(0x4C56_3355_u32).unwrap();
+    // Reserved.
+    buf.write_bytes_le(0_u16).unwrap();
+    // Leader size.
+    buf.write_bytes_le(memory::LEADER_SIZE as u16).unwrap();
+    buf.write_bytes_le(block_id).unwrap();
+    // Reserved.
+    buf.write_bytes_le(0_u16).unwrap();
+    // Payload type, Image.
+    buf.write_bytes_le(0x0001_u16).unwrap();
+    buf.write_bytes_le(frame.timestamp).unwrap();
+    buf.write_bytes_le::<u32>(frame.pixel_format.into())
+        .unwrap();
+    buf.write_bytes_le(frame.width).unwrap();
+    buf.write_bytes_le(frame.height).unwrap();
+    // X offset.
+    buf.write_bytes_le(0_u32).unwrap();
+    // Y offset.
+    buf.write_bytes_le(0_u32).unwrap();
+    // X padding.
+    buf.write_bytes_le(0_u16).unwrap();
+    // Reserved.
+    buf.write_bytes_le(0_u16).unwrap();
+}
+
+/// Writes an image trailer of `frame` to `buf`.
+fn write_trailer(buf: &mut Vec<u8>, frame: &FrameSpec, block_id: u64) {
+    buf.clear();
+    // Trailer magic.
+    buf.write_bytes_le(0x5456_3355_u32).unwrap();
+    // Reserved.
+    buf.write_bytes_le(0_u16).unwrap();
+    // Trailer size.
+    buf.write_bytes_le(memory::TRAILER_SIZE as u16).unwrap();
+    buf.write_bytes_le(block_id).unwrap();
+    // Status, Success.
+    buf.write_bytes_le(0_u16).unwrap();
+    // Reserved.
+    buf.write_bytes_le(0_u16).unwrap();
+    // Valid payload size.
+    buf.write_bytes_le(frame.payload_size as u64).unwrap();
+    // Actual height.
+    buf.write_bytes_le(frame.height).unwrap();
+}
+
+/// Fills `image` with horizontal stripes scrolling down by a row per frame.
+fn fill_image(image: &mut [u8], frame: &FrameSpec, block_id: u64) {
+    let row_len = image.len() / frame.height as usize;
+    for (y, row) in image.chunks_mut(row_len).enumerate() {
+        row.fill((y as u64).wrapping_sub(block_id) as u8);
+    }
+}
@@ -0,0 +1,535 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! This module contains low level event receiving implementation for `U3V` device.
+//!
+//! Events such as `ExposureEnd` or `FrameTriggerMissed` are sent by the device through the event
+//! interface as soon as they occur, so the host doesn't need to poll registers over the control
+//! channel to learn about them.
+//!
+//! # Examples
+//! ```no_run
+//! use cameleon::u3v;
+//!
+//! let mut cameras = u3v::enumerate_cameras().unwrap();
+//! let mut camera = cameras.pop().unwrap();
+//! camera.open().unwrap();
+//! camera.load_context().unwrap();
+//!
+//! let mut event_handle = camera.ctrl.take_event_handle().unwrap();
+//! event_handle.open().unwrap();
+//! let event_rx = event_handle.start_event_loop(&mut camera.ctrl, 16).unwrap();
+//! let event = event_rx.recv_blocking().unwrap();
+//! println!("event {:#x} at {}", event.event_id, event.timestamp);
+//!
+//! event_handle.stop_event_loop(&mut camera.ctrl).unwrap();
+//! ```
+
+use std::{
+    pin::Pin,
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        Arc, Mutex,
+    },
+    task::{Context, Poll},
+    thread::JoinHandle,
+    time::{Duration, Instant},
+};
+
+use async_channel::{Receiver, Sender};
+use cameleon_device::u3v::{
+    self,
+    async_read::{AsyncPool, AsyncWaker},
+    protocol::event::EventPacket,
+};
+use futures_core::Stream;
+use tracing::{error, info, warn};
+
+use crate::{genapi::GenApiCtxt, DeviceControl, StreamError, StreamResult};
+
+use super::register_map::{Abrm, Eirm};
+
+/// Default value of [`EventParams::queue_depth`].
+const DEFAULT_QUEUE_DEPTH: usize = 4;
+
+/// Default value of [`EventParams::timeout`].
+const DEFAULT_TIMEOUT: Duration = Duration::from_millis(500);
+
+/// An event sent from the device.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Event {
+    /// ID of the event, which corresponds to `EventID` of a `GenApi` event port.
+    pub event_id: u16,
+    /// Timestamp of the device when the event occurred.
+    pub timestamp: u64,
+    /// Request ID of the event packet, which is incremented for each packet.
+    pub request_id: u16,
+    /// Data attached to the event.
+    pub data: Vec<u8>,
+    /// Host monotonic time when the event packet was received.
+    pub host_timestamp: Instant,
+}
+
+/// Parameters to receive events.
+#[derive(Debug, Clone)]
+pub struct EventParams {
+    /// The number of event transfers submitted in advance, so that the device can send events
+    /// back to back without waiting for the host.
+    pub queue_depth: usize,
+
+    /// Interval to check the cancellation of the loop while no event arrives.
+    pub timeout: Duration,
+}
+
+impl Default for EventParams {
+    fn default() -> Self {
+        Self {
+            queue_depth: DEFAULT_QUEUE_DEPTH,
+            timeout: DEFAULT_TIMEOUT,
+        }
+    }
+}
+
+type Callback = Box<dyn FnMut(&Event) + Send>;
+
+/// This type is used to receive events from the device.
+pub struct EventHandle {
+    /// Inner channel to receive event packets.
+    pub inner: Arc<Mutex<u3v::ReceiveChannel>>,
+    /// Parameters for receiving events.
+    params: EventParams,
+    event_loop: Option<LoopHandle>,
+    /// Feeds each event to `GenApi` nodes before it's delivered.
+    genapi_feeder: Option<Arc<Mutex<Callback>>>,
+}
+
+macro_rules! unwrap_or_poisoned {
+    ($res:expr) => {{
+        $res.map_err(|cause| {
+            let err = StreamError::Poisoned(cause.to_string().into());
+            error!(?err);
+            err
+        })
+    }};
+}
+
+impl EventHandle {
+    pub(super) fn new(channel: u3v::ReceiveChannel) -> Self {
+        Self {
+            inner: Arc::new(Mutex::new(channel)),
+            params: EventParams::default(),
+            event_loop: None,
+            genapi_feeder: None,
+        }
+    }
+
+    /// Return params.
+    #[must_use]
+    pub fn params(&self) -> &EventParams {
+        &self.params
+    }
+
+    ///  Return mutable params.
+    pub fn params_mut(&mut self) -> &mut EventParams {
+        &mut self.params
+    }
+
+    /// Opens the handle.
+    pub fn open(&mut self) -> StreamResult<()> {
+        unwrap_or_poisoned!(self.inner.lock())?.open().map_err(|e| {
+            error!(?e);
+            e.into()
+        })
+    }
+
+    /// Closes the handle. The event loop is stopped if it's running.
+    pub fn close(&mut self) -> StreamResult<()> {
+        self.stop_loop()?;
+        unwrap_or_poisoned!(self.inner.lock())?
+            .close()
+            .map_err(|e| {
+                error!(?e);
+                e.into()
+            })
+    }
+
+    /// Returns `true` if the handle is opened.
+    #[must_use]
+    pub fn is_opened(&self) -> bool {
+        matches!(self.inner.lock(), Ok(inner) if inner.is_opened())
+    }
+
+    /// Feeds data of each received event to the registers of the `GenApi` event port with the
+    /// same `EventID`, e.g. `EventExposureEndTimestamp`, before the event is delivered.
+    ///
+    /// `ctxt` should share the cache with the camera, e.g. a clone of
+    /// [`SharedDefaultGenApiCtxt`](crate::genapi::SharedDefaultGenApiCtxt). Takes effect from the
+    /// next [`Self::start_event_loop`].
+    pub fn feed_genapi<Ctxt>(&mut self, mut ctxt: Ctxt)
+    where
+        Ctxt: GenApiCtxt + Send + 'static,
+    {
+        let registers = ctxt.enter(cameleon_genapi::EventRegisters::new);
+        if registers.is_empty() {
+            warn!("no GenApi event port is found");
+        }
+        let feeder: Callback = Box::new(move |event: &Event| {
+            ctxt.enter(|_, value_ctxt| {
+                registers.feed(event.event_id.into(), &event.data, value_ctxt)
+            });
+        });
+        self.genapi_feeder = Some(Arc::new(Mutex::new(feeder)));
+    }
+
+    /// Enables the event interface of the device and starts the loop receiving events.
+    /// Events are delivered through the returned receiver, which can hold up to `cap` events.
+    ///
+    /// Events arriving while the receiver is full are dropped.
+    pub fn start_event_loop(
+        &mut self,
+        ctrl: &mut dyn DeviceControl,
+        cap: usize,
+    ) -> StreamResult<EventReceiver> {
+        let (tx, rx) = async_channel::bounded(cap.max(1));
+        self.start_loop(ctrl, EventSink::Channel(tx))?;
+        Ok(EventReceiver { rx })
+    }
+
+    /// Enables the event interface of the device and starts the loop receiving events.
+    ///
+    /// `callback` is called on the loop thread as soon as each event is parsed, so it should
+    /// return quickly to keep the latency of the following events low.
+    pub fn start_event_loop_with_callback(
+        &mut self,
+        ctrl: &mut dyn DeviceControl,
+        callback: impl FnMut(&Event) + Send + 'static,
+    ) -> StreamResult<()> {
+        self.start_loop(ctrl, EventSink::Callback(Box::new(callback)))
+    }
+
+    /// Stops the event loop and disables the event interface of the device.
+    pub fn stop_event_loop(&mut self, ctrl: &mut dyn DeviceControl) -> StreamResult<()> {
+        let eirm = self.event_loop.as_ref().map(|event_loop| event_loop.eirm);
+        self.stop_loop()?;
+        if let Some(eirm) = eirm {
+            eirm.disable_event(ctrl).map_err(to_stream_error)?;
+        }
+        info!("stop event loop successfully");
+        Ok(())
+    }
+
+    /// Returns `true` if the event loop is running.
+    #[must_use]
+    pub fn is_loop_running(&self) -> bool {
+        self.event_loop.is_some()
+    }
+
+    fn start_loop(&mut self, ctrl: &mut dyn DeviceControl, sink: EventSink) -> StreamResult<()> {
+        if self.is_loop_running() {
+            return Err(StreamError::InStreaming);
+        }
+
+        let eirm = Abrm::new(ctrl)
+            .and_then(|abrm| abrm.sbrm(ctrl))
+            .and_then(|sbrm| sbrm.eirm(ctrl))
+            .map_err(to_stream_error)?
+            .ok_or_else(|| {
+                StreamError::Io(anyhow::Error::msg(
+                    "the device doesn't have event interface register map",
+                ))
+            })?;
+        let max_event_size = eirm
+            .maximum_event_transfer_length(ctrl)
+            .map_err(to_stream_error)?;
+        eirm.enable_event(ctrl).map_err(to_stream_error)?;
+
+        let waker = unwrap_or_poisoned!(self.inner.lock())?.async_waker();
+        let cancelled = Arc::new(AtomicBool::new(false));
+        let event_loop = EventLoop {
+            inner: self.inner.clone(),
+            params: self.params.clone(),
+            max_event_size: max_event_size as usize,
+            sink,
+            genapi_feeder: self.genapi_feeder.clone(),
+            cancelled: cancelled.clone(),
+        };
+        let join_handle = std::thread::spawn(|| event_loop.run());
+        self.event_loop = Some(LoopHandle {
+            cancelled,
+            waker,
+            join_handle,
+            eirm,
+        });
+
+        info!("start event loop successfully");
+        Ok(())
+    }
+
+    fn stop_loop(&mut self) -> StreamResult<()> {
+        if let Some(event_loop) = self.event_loop.take() {
+            event_loop.cancelled.store(true, Ordering::SeqCst);
+            event_loop.waker.wake();
+            event_loop.join_handle.join().map_err(|_| {
+                StreamError::Poisoned("event loop panicked before cancellation".into())
+            })?;
+        }
+        Ok(())
+    }
+}
+
+impl Drop for EventHandle {
+    fn drop(&mut self) {
+        if let Err(e) = self.close() {
+            error!(?e)
+        }
+    }
+}
+
+impl std::fmt::Debug for EventHandle {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("EventHandle")
+            .field("params", &self.params)
+            .field("is_loop_running", &self.is_loop_running())
+            .field("feeds_genapi", &self.genapi_feeder.is_some())
+            .finish()
+    }
+}
+
+fn to_stream_error(err: crate::ControlError) -> StreamError {
+    StreamError::Io(anyhow::Error::msg(format!(
+        "failed to setup event interface: {}",
+        err
+    )))
+}
+
+/// A receiver of [`Event`]s sent from the device.
+///
+/// The receiver is also a [`Stream`] of events, which ends when the event loop stops.
+#[derive(Debug, Clone)]
+pub struct EventReceiver {
+    rx: Receiver<Event>,
+}
+
+impl EventReceiver {
+    /// Receives [`Event`].
+    pub async fn recv(&self) -> StreamResult<Event> {
+        Ok(self.rx.recv().await?)
+    }
+
+    /// Tries to receive [`Event`].
+    /// This method doesn't wait arrival of an event and immediately returns `StreamError` if
+    /// the channel is empty.
+    pub fn try_recv(&self) -> StreamResult<Event> {
+        Ok(self.rx.try_recv()?)
+    }
+
+    /// Receives [`Event`].
+    /// If the channel is empty, this method blocks until the device sends an event.
+    pub fn recv_blocking(&self) -> StreamResult<Event> {
+        Ok(self.rx.recv_blocking()?)
+    }
+}
+
+impl Stream for EventReceiver {
+    type Item = Event;
+
+    fn poll_next(mut self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Option<Self::Item>> {
+        Pin::new(&mut self.rx).poll_next(cx)
+    }
+}
+
+enum EventSink {
+    Channel(Sender<Event>),
+    Callback(Callback),
+}
+
+impl EventSink {
+    fn deliver(&mut self, event: Event) {
+        match self {
+            Self::Channel(tx) => {
+                if tx.try_send(event).is_err() {
+                    warn!("event receiver is full or closed, drop the event");
+                }
+            }
+            Self::Callback(callback) => callback(&event),
+        }
+    }
+}
+
+/// Handle of the running [`EventLoop`].
+struct LoopHandle {
+    cancelled: Arc<AtomicBool>,
+    /// Interrupts the loop waiting for transfer completions.
+    waker: AsyncWaker,
+    join_handle: JoinHandle<()>,
+    eirm: Eirm,
+}
+
+struct EventLoop {
+    inner: Arc<Mutex<u3v::ReceiveChannel>>,
+    params: EventParams,
+    max_event_size: usize,
+    sink: EventSink,
+    genapi_feeder: Option<Arc<Mutex<Callback>>>,
+    /// Set when the loop is requested to stop.
+    cancelled: Arc<AtomicBool>,
+}
+
+impl EventLoop {
+    fn run(mut self) {
+        let queue_depth = self.params.queue_depth.max(1);
+        // NOTE: `bufs` must be declared before the pool so that pending transfers are cancelled
+        // and drained before the buffers are dropped.
+        let mut bufs: Vec<Vec<u8>> = (0..queue_depth)
+            .map(|_| vec![0; self.max_event_size])
+            .collect();
+
+        // All transfers are submitted in advance, and completed in the order of submission.
+        let mut suspended = {
+            let inner = self.inner.lock().unwrap();
+            let mut async_pool = AsyncPool::new(&inner);
+            for buf in &mut bufs {
+                if let Err(err) = async_pool.submit(buf) {
+                    let err: StreamError = err.into();
+                    error!(?err, "failed to submit event transfer");
+                    return drain(&mut async_pool);
+                }
+            }
+            async_pool.suspend()
+        };
+
+        let mut next = 0;
+        while !self.cancelled.load(Ordering::SeqCst) {
+            // The channel is locked only while receiving so that the handle isn't blocked by the
+            // running loop.
+            let inner = self.inner.lock().unwrap();
+            let mut async_pool = AsyncPool::resume(&inner, suspended);
+            let events = match self.receive(&mut async_pool, &mut bufs, &mut next) {
+                Some(events) => events,
+                None => return drain(&mut async_pool),
+            };
+            suspended = async_pool.suspend();
+            drop(inner);
+
+            for event in events {
+                if let Some(feeder) = &self.genapi_feeder {
+                    (feeder.lock().unwrap())(&event);
+                }
+                self.sink.deliver(event);
+            }
+        }
+
+        let inner = self.inner.lock().unwrap();
+        drain(&mut AsyncPool::resume(&inner, suspended));
+    }
+
+    /// Waits for the next transfer and resubmits it.
+    ///
+    /// Returns `None` if the loop can't continue.
+    fn receive(
+        &self,
+        async_pool: &mut AsyncPool,
+        bufs: &mut [Vec<u8>],
+        next: &mut usize,
+    ) -> Option<Vec<Event>> {
+        let result = async_pool.poll(self.params.timeout);
+        if async_pool.pending() == bufs.len() {
+            // No transfer has completed, just check the cancellation.
+            return match result {
+                Err(u3v::Error::LibUsb(
+                    u3v::LibUsbError::Interrupted | u3v::LibUsbError::Timeout,
+                )) => Some(vec![]),
+                Err(err) => {
+                    let err: StreamError = err.into();
+                    error!(?err, "failed to poll event transfers");
+                    None
+                }
+                Ok(_) => unreachable!("a completed transfer must be popped from the pool"),
+            };
+        }
+        let host_timestamp = Instant::now();
+
+        let events = match result {
+            Ok(len) => parse_events(&bufs[*next][..len], host_timestamp),
+            Err(err) => {
+                let err: StreamError = err.into();
+                warn!(?err, "failed to receive event");
+                vec![]
+            }
+        };
+        // Resubmit before delivering to keep the queue full.
+        if let Err(err) = async_pool.submit(&mut bufs[*next]) {
+            let err: StreamError = err.into();
+            error!(?err, "failed to submit event transfer");
+            return None;
+        }
+        *next = (*next + 1) % bufs.len();
+        Some(events)
+    }
+}
+
+fn drain(async_pool: &mut AsyncPool) {
+    async_pool.cancel_all();
+    while !async_pool.is_empty() {
+        async_pool.poll(Duration::from_secs(1)).ok();
+    }
+}
+
+fn parse_events(buf: &[u8], host_timestamp: Instant) -> Vec<Event> {
+    match EventPacket::parse(buf) {
+        Ok(packet) => {
+            let request_id = packet.request_id();
+            packet
+                .scd
+                .iter()
+                .map(|scd| Event {
+                    event_id: scd.event_id,
+                    timestamp: scd.timestamp,
+                    request_id,
+                    data: scd.data.to_vec(),
+                    host_timestamp,
+                })
+                .collect()
+        }
+        Err(err) => {
+            warn!(?err, "failed to parse event packet");
+            vec![]
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_parse_events() {
+        let mut packet = vec![];
+        packet.extend_from_slice(&0x4556_3355_u32.to_le_bytes());
+        packet.extend_from_slice(&0_u16.to_le_bytes());
+        packet.extend_from_slice(&0x0c00_u16.to_le_bytes());
+        packet.extend_from_slice(&14_u16.to_le_bytes());
+        packet.extend_from_slice(&3_u16.to_le_bytes());
+        // Single event.
+        packet.extend_from_slice(&0_u16.to_le_bytes());
+        packet.extend_from_slice(&0x9001_u16.to_le_bytes());
+        packet.extend_from_slice(&10_u64.to_le_bytes());
+        packet.extend_from_slice(&[1, 2]);
+
+        let now = Instant::now();
+        let events = parse_events(&packet, now);
+        assert_eq!(
+            events,
+            vec![Event {
+                event_id: 0x9001,
+                timestamp: 10,
+                request_id: 3,
+                data: vec![1, 2],
+                host_timestamp: now,
+            }]
+        );
+
+        assert!(parse_events(&packet[..8], now).is_empty());
+    }
+}
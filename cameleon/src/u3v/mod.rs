@@ -46,15 +46,23 @@
 #![allow(clippy::missing_panics_doc)]
 
 pub mod control_handle;
+#[cfg(feature = "emulator")]
+pub mod emulator;
+pub mod event_handle;
 pub mod register_map;
+mod stream_driver;
 pub mod stream_handle;
+pub mod stream_stats;
 
 pub use control_handle::{ControlHandle, SharedControlHandle};
-pub use stream_handle::{StreamHandle, StreamParams};
+pub use event_handle::{Event, EventHandle, EventParams, EventReceiver};
+pub use stream_handle::{PayloadBufferKind, StreamHandle, StreamParams};
+pub use stream_stats::{StreamStats, StreamStatsSnapshot};
 
-pub use cameleon_device::u3v::DeviceInfo;
+pub use cameleon_device::u3v::{DeviceCache, DeviceInfo};
 
 use cameleon_device::u3v;
+use tracing::warn;
 
 use super::{
     genapi::DefaultGenApiCtxt, CameleonResult, Camera, CameraInfo, ControlError, StreamError,
@@ -74,35 +82,124 @@ use super::{
 /// ```
 pub fn enumerate_cameras() -> CameleonResult<Vec<Camera<ControlHandle, StreamHandle>>> {
     let devices = u3v::enumerate_devices().map_err(ControlError::from)?;
+    cameras_from_devices(devices)
+}
+
+/// Enumerate all U3V compatible cameras connected to the host, probing only cameras that are not
+/// in `cache` yet.
+///
+/// On a host with many cameras, this is much faster than [`enumerate_cameras`] from the second
+/// call. See [`DeviceCache`] for details.
+///
+/// # Examples
+///
+/// ```no_run
+/// use cameleon::u3v;
+///
+/// let mut cache = u3v::DeviceCache::new();
+/// let cameras = u3v::enumerate_cameras_with(&mut cache).unwrap();
+/// drop(cameras);
+///
+/// // Only cameras connected after the first enumeration are probed.
+/// let cameras = u3v::enumerate_cameras_with(&mut cache).unwrap();
+/// ```
+pub fn enumerate_cameras_with(
+    cache: &mut DeviceCache,
+) -> CameleonResult<Vec<Camera<ControlHandle, StreamHandle>>> {
+    let devices = cache.enumerate().map_err(ControlError::from)?;
+    cameras_from_devices(devices)
+}
+
+/// Notification of [`CameraMonitor`].
+pub enum CameraEvent {
+    /// A camera is connected.
+    Arrived(Box<Camera<ControlHandle, StreamHandle>>),
+    /// A camera notified by [`CameraEvent::Arrived`] is disconnected.
+    Left(CameraInfo),
+}
 
+/// Monitors connection and disconnection of U3V cameras.
+/// Monitoring is stopped when the monitor is dropped.
+pub struct CameraMonitor {
+    _inner: u3v::HotplugMonitor,
+}
+
+/// Start monitoring connection and disconnection of U3V cameras.
+///
+/// `callback` is called on a background thread with [`CameraEvent::Arrived`] for cameras already
+/// connected, then for each connection and disconnection. Only the connected camera is probed on
+/// each notification, so reconnection is handled without scanning the whole bus.
+///
+/// Returns an error if the platform doesn't support hotplug notifications.
+///
+/// # Examples
+///
+/// ```no_run
+/// use cameleon::u3v::{self, CameraEvent};
+///
+/// let monitor = u3v::watch_cameras(|event| match event {
+///     CameraEvent::Arrived(camera) => println!("{:?} is connected", camera.info()),
+///     CameraEvent::Left(info) => println!("{:?} is disconnected", info),
+/// })
+/// .unwrap();
+/// ```
+pub fn watch_cameras<F>(mut callback: F) -> CameleonResult<CameraMonitor>
+where
+    F: FnMut(CameraEvent) + Send + 'static,
+{
+    let inner = u3v::HotplugMonitor::start(move |event| match event {
+        u3v::HotplugEvent::Arrived(dev) => match camera_from_device(dev) {
+            Ok(Some(camera)) => callback(CameraEvent::Arrived(Box::new(camera))),
+            Ok(None) => {}
+            Err(err) => warn!(?err, "failed to create camera from connected device"),
+        },
+        u3v::HotplugEvent::Left(dev_info) => callback(CameraEvent::Left(camera_info(dev_info))),
+    })
+    .map_err(ControlError::from)?;
+
+    Ok(CameraMonitor { _inner: inner })
+}
+
+fn cameras_from_devices(
+    devices: Vec<u3v::Device>,
+) -> CameleonResult<Vec<Camera<ControlHandle, StreamHandle>>> {
     let mut cameras: Vec<Camera<ControlHandle, StreamHandle>> = Vec::with_capacity(devices.len());
 
     for dev in devices {
-        let ctrl = ControlHandle::new(&dev)?;
-        let strm = if let Some(strm) = StreamHandle::new(&dev)? {
-            strm
-        } else {
-            continue;
-        };
-        let ctxt = None;
-
-        let dev_info = dev.device_info;
-        let camera_info = CameraInfo {
-            vendor_name: dev_info.vendor_name,
-            model_name: dev_info.model_name,
-            serial_number: dev_info.serial_number,
-            vid : dev_info.vid,
-            pid : dev_info.pid,
-        };
-
-        let camera: Camera<ControlHandle, StreamHandle, DefaultGenApiCtxt> =
-            Camera::new(ctrl, strm, ctxt, camera_info);
-        cameras.push(camera)
+        if let Some(camera) = camera_from_device(dev)? {
+            cameras.push(camera);
+        }
     }
 
     Ok(cameras)
 }
 
+fn camera_from_device(
+    dev: u3v::Device,
+) -> CameleonResult<Option<Camera<ControlHandle, StreamHandle>>> {
+    let ctrl = ControlHandle::new(&dev)?;
+    let strm = if let Some(strm) = StreamHandle::new(&dev)? {
+        strm
+    } else {
+        return Ok(None);
+    };
+    let ctxt = None;
+
+    let camera: Camera<ControlHandle, StreamHandle, DefaultGenApiCtxt> =
+        Camera::new(ctrl, strm, ctxt, camera_info(dev.device_info));
+    Ok(Some(camera))
+}
+
+fn camera_info(dev_info: DeviceInfo) -> CameraInfo {
+    CameraInfo {
+        vendor_name: dev_info.vendor_name,
+        model_name: dev_info.model_name,
+        serial_number: dev_info.serial_number,
+        vid: dev_info.vid,
+        pid: dev_info.pid,
+    }
+}
+
 impl From<u3v::Error> for ControlError {
     fn from(err: u3v::Error) -> ControlError {
         use u3v::Error::{BufferIo, InvalidDevice, InvalidPacket, LibUsb};
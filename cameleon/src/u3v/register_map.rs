@@ -50,7 +50,7 @@ use std::{convert::TryInto, time::Duration};
 
 use cameleon_device::u3v::{
     self,
-    register_map::{abrm, manifest_entry, sbrm, sirm},
+    register_map::{abrm, eirm, manifest_entry, sbrm, sirm},
 };
 
 use crate::{genapi::CompressionType, ControlError, ControlResult, DeviceControl};
@@ -466,9 +466,16 @@ impl Sbrm {
         }
     }
 
+    /// Return [`Eirm`] if it's available.
+    pub fn eirm<Ctrl: DeviceControl + ?Sized>(
+        &self,
+        device: &mut Ctrl,
+    ) -> ControlResult<Option<Eirm>> {
+        Ok(self.eirm_address(device)?.map(Eirm::new))
+    }
+
     /// The initial address of `Eirm`.
     ///
-    ///
     /// NOTE: Some device doesn't support this feature.
     /// Please refer to [`U3VCapablitiy`] to see whether the feature is available on the device.
     pub fn eirm_address<Ctrl: DeviceControl + ?Sized>(
@@ -771,6 +778,93 @@ impl Sirm {
     }
 }
 
+/// Represent Event Interface Register Map (EIRM).
+///
+/// To maintain consistency with the device data, `Eirm` doesn't cache any data. It means
+/// that all methods of this struct cause communication with the device every time, thus the device
+/// is expected to be opened when methods are called.
+#[derive(Clone, Copy, Debug)]
+pub struct Eirm {
+    eirm_addr: u64,
+}
+
+impl Eirm {
+    /// Constructs new `Eirm`, consider using [`super::ControlHandle::eirm`] instead.
+    ///
+    /// To construct `Eirm`, Use [`Sbrm::eirm`] also can be used.
+    #[must_use]
+    pub fn new(eirm_addr: u64) -> Self {
+        Self { eirm_addr }
+    }
+
+    /// Enables event interface.
+    pub fn enable_event<Ctrl: DeviceControl + ?Sized>(
+        &self,
+        device: &mut Ctrl,
+    ) -> ControlResult<()> {
+        let value = 1_u32;
+        self.write_register(device, eirm::EI_CONTROL, value)
+    }
+
+    /// Disables event interface.
+    pub fn disable_event<Ctrl: DeviceControl + ?Sized>(
+        &self,
+        device: &mut Ctrl,
+    ) -> ControlResult<()> {
+        let value = 0_u32;
+        self.write_register(device, eirm::EI_CONTROL, value)
+    }
+
+    /// Returns `true` if event interface is enabled.
+    pub fn is_event_enable<Ctrl: DeviceControl + ?Sized>(
+        &self,
+        device: &mut Ctrl,
+    ) -> ControlResult<bool> {
+        let ei_ctrl: u32 = self.read_register(device, eirm::EI_CONTROL)?;
+        Ok((ei_ctrl & 1) == 1)
+    }
+
+    /// Maximum size of an event packet in bytes.
+    pub fn maximum_event_transfer_length<Ctrl: DeviceControl + ?Sized>(
+        &self,
+        device: &mut Ctrl,
+    ) -> ControlResult<u32> {
+        self.read_register(device, eirm::MAXIMUM_EVENT_TRANSFER_LENGTH)
+    }
+
+    /// Requests the device to send a test event, whose event ID is `0x4FFF`.
+    pub fn request_test_event<Ctrl: DeviceControl + ?Sized>(
+        &self,
+        device: &mut Ctrl,
+    ) -> ControlResult<()> {
+        let value = 1_u32;
+        self.write_register(device, eirm::EVENT_TEST_CONTROL, value)
+    }
+
+    fn read_register<T, Ctrl>(&self, device: &mut Ctrl, register: (u64, u16)) -> ControlResult<T>
+    where
+        T: ParseBytes,
+        Ctrl: DeviceControl + ?Sized,
+    {
+        let (offset, len) = register;
+        let addr = offset + self.eirm_addr;
+        read_register(device, addr, len)
+    }
+
+    fn write_register<Ctrl: DeviceControl + ?Sized>(
+        &self,
+        device: &mut Ctrl,
+        register: (u64, u16),
+        data: impl DumpBytes,
+    ) -> ControlResult<()> {
+        let (offset, len) = register;
+        let addr = self.eirm_addr + offset;
+        let mut buf = vec![0; len as usize];
+        data.dump_bytes(&mut buf)?;
+        device.write(addr, &buf)
+    }
+}
+
 /// `ManifestTable` provides iterator of [`ManifestEntry`].
 #[derive(Clone, Copy, Debug)]
 pub struct ManifestTable {
@@ -0,0 +1,307 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! This module contains the driver which serves streaming loops of multiple cameras on a few
+//! threads.
+//!
+//! Each loop is a [`DriverTask`] which is advanced without blocking. A worker thread steps all of
+//! its tasks, and then waits for the [`CompletionSignal`] attached to the channels of the tasks,
+//! so a worker doesn't need a thread per camera to wait for transfer completions.
+
+use std::{
+    io,
+    sync::{
+        atomic::{AtomicBool, AtomicUsize, Ordering},
+        mpsc, Arc, Mutex, Weak,
+    },
+    thread::JoinHandle,
+    time::{Duration, Instant},
+};
+
+use cameleon_device::u3v::async_read::CompletionSignal;
+use tracing::warn;
+
+/// Upper bound of the time a worker waits for the signal, so that a missed notification only
+/// delays the worker.
+const MAXIMUM_WAIT: Duration = Duration::from_millis(100);
+
+static DRIVER: Mutex<Weak<DriverInner>> = Mutex::new(Weak::new());
+
+/// A streaming loop advanced by a worker of [`StreamDriver`].
+pub(super) trait DriverTask: Send + 'static {
+    /// Advances the task as far as possible without blocking.
+    fn step(&mut self) -> Step;
+}
+
+/// The result of [`DriverTask::step`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub(super) enum Step {
+    /// The task made progress and may be able to make more.
+    Progress,
+    /// The task waits for the signal, or until the deadline.
+    Idle(Instant),
+    /// The task is finished and dropped by the worker.
+    Finished,
+}
+
+/// Handle of the worker threads shared by all streams.
+///
+/// The threads are spawned by the first [`StreamDriver::acquire`] call and stop when the last
+/// handle is dropped.
+#[derive(Clone)]
+pub(super) struct StreamDriver {
+    inner: Arc<DriverInner>,
+}
+
+impl StreamDriver {
+    /// Returns the handle of the running driver, or spawns `threads` workers if it's not running.
+    ///
+    /// `threads` is ignored if the driver is already running.
+    pub(super) fn acquire(threads: usize) -> io::Result<Self> {
+        let mut current = DRIVER.lock().unwrap();
+        if let Some(inner) = current.upgrade() {
+            if inner.workers.len() != threads.max(1) {
+                warn!(
+                    threads = inner.workers.len(),
+                    "stream driver is already running, ignoring {} threads", threads
+                );
+            }
+            return Ok(Self { inner });
+        }
+
+        let driver = Self::spawn_workers(threads)?;
+        *current = Arc::downgrade(&driver.inner);
+        Ok(driver)
+    }
+
+    /// Spawns a driver of `threads` workers which isn't shared by [`StreamDriver::acquire`], so
+    /// that tests running in parallel don't share its workers.
+    #[cfg(test)]
+    pub(super) fn private(threads: usize) -> io::Result<Self> {
+        Self::spawn_workers(threads)
+    }
+
+    fn spawn_workers(threads: usize) -> io::Result<Self> {
+        let mut workers = Vec::with_capacity(threads.max(1));
+        for _ in 0..threads.max(1) {
+            workers.push(Worker::spawn()?);
+        }
+        Ok(Self {
+            inner: Arc::new(DriverInner { workers }),
+        })
+    }
+
+    /// Assigns the task built by `build` to the worker serving the fewest tasks.
+    ///
+    /// `build` receives the signal of the worker, which must be notified when the task can make
+    /// progress.
+    pub(super) fn spawn<T: DriverTask>(
+        &self,
+        build: impl FnOnce(&Arc<CompletionSignal>) -> T,
+    ) -> TaskHandle {
+        let shared = self
+            .inner
+            .workers
+            .iter()
+            .map(|worker| &worker.shared)
+            .min_by_key(|shared| shared.load.load(Ordering::Relaxed))
+            .unwrap()
+            .clone();
+
+        let (finished_tx, finished) = mpsc::channel();
+        let task = build(&shared.signal);
+        shared.load.fetch_add(1, Ordering::Relaxed);
+        shared
+            .incoming
+            .lock()
+            .unwrap()
+            .push((Box::new(task), finished_tx));
+        shared.signal.notify();
+
+        TaskHandle {
+            shared,
+            finished,
+            _driver: self.clone(),
+        }
+    }
+
+    /// Returns the number of worker threads.
+    #[cfg(test)]
+    fn threads(&self) -> usize {
+        self.inner.workers.len()
+    }
+}
+
+/// Handle of a task assigned to [`StreamDriver`].
+pub(super) struct TaskHandle {
+    shared: Arc<WorkerShared>,
+    /// Disconnected when the worker drops the task.
+    finished: mpsc::Receiver<()>,
+    /// Keeps the workers running while the task is alive.
+    _driver: StreamDriver,
+}
+
+impl TaskHandle {
+    /// Makes the worker step its tasks even if no transfer has completed.
+    pub(super) fn wake(&self) {
+        self.shared.signal.notify();
+    }
+
+    /// Blocks until the worker drops the task.
+    pub(super) fn join(self) {
+        // The sender is never used, so this returns when it's dropped with the task.
+        self.finished.recv().ok();
+    }
+}
+
+struct DriverInner {
+    workers: Vec<Worker>,
+}
+
+impl Drop for DriverInner {
+    fn drop(&mut self) {
+        for worker in &self.workers {
+            worker.shared.running.store(false, Ordering::SeqCst);
+            worker.shared.signal.notify();
+        }
+        for worker in &mut self.workers {
+            if let Some(join_handle) = worker.join_handle.take() {
+                join_handle.join().ok();
+            }
+        }
+    }
+}
+
+struct Worker {
+    shared: Arc<WorkerShared>,
+    join_handle: Option<JoinHandle<()>>,
+}
+
+type Assigned = (Box<dyn DriverTask>, mpsc::Sender<()>);
+
+struct WorkerShared {
+    signal: Arc<CompletionSignal>,
+    /// Tasks assigned to the worker, which are not taken by the worker thread yet.
+    incoming: Mutex<Vec<Assigned>>,
+    /// The number of tasks assigned to the worker.
+    load: AtomicUsize,
+    running: AtomicBool,
+}
+
+impl Worker {
+    fn spawn() -> io::Result<Self> {
+        let shared = Arc::new(WorkerShared {
+            signal: Arc::default(),
+            incoming: Mutex::default(),
+            load: AtomicUsize::new(0),
+            running: AtomicBool::new(true),
+        });
+        let join_handle = std::thread::Builder::new()
+            .name("cameleon-stream-driver".into())
+            .spawn({
+                let shared = shared.clone();
+                move || shared.run()
+            })?;
+
+        Ok(Self {
+            shared,
+            join_handle: Some(join_handle),
+        })
+    }
+}
+
+impl WorkerShared {
+    fn run(&self) {
+        let mut tasks: Vec<Assigned> = Vec::new();
+        while self.running.load(Ordering::SeqCst) {
+            // Read the generation before stepping, so that a completion during the steps wakes
+            // up the wait below immediately.
+            let generation = self.signal.generation();
+            tasks.append(&mut self.incoming.lock().unwrap());
+
+            let mut progressed = false;
+            let mut deadline = Instant::now() + MAXIMUM_WAIT;
+            tasks.retain_mut(|(task, _)| match task.step() {
+                Step::Progress => {
+                    progressed = true;
+                    true
+                }
+                Step::Idle(task_deadline) => {
+                    deadline = deadline.min(task_deadline);
+                    true
+                }
+                Step::Finished => {
+                    self.load.fetch_sub(1, Ordering::Relaxed);
+                    false
+                }
+            });
+
+            if !progressed {
+                let timeout = deadline.saturating_duration_since(Instant::now());
+                self.signal.wait(generation, timeout);
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Makes progress `steps` times, then waits for `ready` before finishing.
+    struct CountingTask {
+        steps: usize,
+        ready: Arc<AtomicBool>,
+    }
+
+    impl DriverTask for CountingTask {
+        fn step(&mut self) -> Step {
+            if self.steps > 0 {
+                self.steps -= 1;
+                Step::Progress
+            } else if self.ready.load(Ordering::SeqCst) {
+                Step::Finished
+            } else {
+                Step::Idle(Instant::now() + Duration::from_secs(60))
+            }
+        }
+    }
+
+    #[test]
+    fn test_driver() {
+        let driver = StreamDriver::acquire(2).unwrap();
+        assert_eq!(driver.threads(), 2);
+        // The running driver is shared.
+        assert!(Arc::ptr_eq(
+            &driver.inner,
+            &StreamDriver::acquire(4).unwrap().inner
+        ));
+
+        let ready = Arc::new(AtomicBool::new(false));
+        let tasks: Vec<_> = (0..4)
+            .map(|i| {
+                driver.spawn(|_| CountingTask {
+                    steps: i * 10,
+                    ready: ready.clone(),
+                })
+            })
+            .collect();
+        // Tasks are distributed to the workers.
+        for worker in &driver.inner.workers {
+            assert_eq!(worker.shared.load.load(Ordering::Relaxed), 2);
+        }
+
+        // Idle tasks finish as soon as they're woken up, not after their deadline.
+        ready.store(true, Ordering::SeqCst);
+        let start = Instant::now();
+        for task in tasks {
+            task.wake();
+            task.join();
+        }
+        assert!(start.elapsed() < Duration::from_secs(30));
+        for worker in &driver.inner.workers {
+            assert_eq!(worker.shared.load.load(Ordering::Relaxed), 0);
+        }
+    }
+}
@@ -5,22 +5,49 @@
 //! This module contains low level streaming implementation for `U3V` device.
 
 use std::{
-    convert::TryInto,
-    sync::mpsc,
-    sync::{mpsc::TryRecvError, Arc, Mutex},
-    time::Duration,
+    collections::VecDeque,
+    ptr::NonNull,
+    sync::{
+        atomic::{AtomicBool, AtomicUsize, Ordering},
+        Arc, Mutex,
+    },
+    thread::JoinHandle,
+    time::{Duration, Instant},
 };
 
-use cameleon_device::u3v::{self, async_read::AsyncPool, protocol::stream as u3v_stream};
+use cameleon_device::u3v::{
+    self,
+    async_read::{
+        AsyncPool, AsyncWaker, CompletionSignal, DevMemAllocator, EventThread, SuspendedPool,
+    },
+    protocol::stream as u3v_stream,
+};
 use tracing::{error, info, warn};
 
 use crate::{
     camera::PayloadStream,
-    payload::{ImageInfo, Payload, PayloadSender, PayloadType},
+    payload::{
+        acquire_payload_buf, BackpressurePolicy, BufferAllocator, ChunkLayout, HeapAllocator,
+        HostTimestamp, HugePageAllocator, ImageInfo, Payload, PayloadBuffer, PayloadBufferPool,
+        PayloadSender, PayloadType,
+    },
     ControlError, ControlResult, DeviceControl, StreamError, StreamResult,
 };
 
-use super::register_map::Abrm;
+use super::{
+    register_map::Abrm,
+    stream_driver::{DriverTask, Step, StreamDriver, TaskHandle},
+    stream_stats::StreamStats,
+};
+
+/// Default value of [`StreamParams::queue_depth`].
+const DEFAULT_QUEUE_DEPTH: usize = 1;
+
+/// Default value of [`StreamParams::buffer_count`].
+const DEFAULT_BUFFER_COUNT: usize = 8;
+
+/// Default value of [`StreamParams::driver_threads`].
+const DEFAULT_DRIVER_THREADS: usize = 2;
 
 /// This type is used to receive stream packets from the device.
 pub struct StreamHandle {
@@ -28,7 +55,17 @@ pub struct StreamHandle {
     pub inner: Arc<Mutex<u3v::ReceiveChannel>>,
     /// Parameters for streaming.
     params: StreamParams,
-    cancellation_tx: Option<mpsc::SyncSender<()>>,
+    streaming_loop: Option<LoopHandle>,
+    /// The number of transfers allocated to receive the last delivered frame.
+    frame_transfer_allocations: Arc<AtomicUsize>,
+    /// Pool of payload buffers and the kind of its memory.
+    buffer_pool: Option<(PayloadBufferKind, PayloadBufferPool)>,
+    /// Pool set by the user, which is used instead of `buffer_pool`.
+    external_pool: Option<PayloadBufferPool>,
+    /// Transfer plan built from the last params.
+    transfer_plan: Option<Arc<TransferPlan>>,
+    /// Statistics of the streaming loop, accumulated across streaming sessions.
+    stats: Arc<StreamStats>,
 }
 
 macro_rules! unwrap_or_poisoned {
@@ -47,7 +84,12 @@ impl StreamHandle {
         Ok(inner.map(|inner| Self {
             inner: Arc::new(Mutex::new(inner)),
             params: StreamParams::default(),
-            cancellation_tx: None,
+            streaming_loop: None,
+            frame_transfer_allocations: Arc::default(),
+            buffer_pool: None,
+            external_pool: None,
+            transfer_plan: None,
+            stats: Arc::default(),
         }))
     }
 
@@ -61,6 +103,103 @@ impl StreamHandle {
     pub fn params_mut(&mut self) -> &mut StreamParams {
         &mut self.params
     }
+
+    /// Return the number of `libusb_transfer` allocated to receive the last delivered frame.
+    ///
+    /// Transfers are reused across frames, so the value is `0` in steady state.
+    #[must_use]
+    pub fn frame_transfer_allocations(&self) -> usize {
+        self.frame_transfer_allocations.load(Ordering::Relaxed)
+    }
+
+    /// Return statistics of the streaming loop.
+    ///
+    /// The returned value is updated while streaming, so it can be kept to scrape the statistics
+    /// periodically.
+    #[must_use]
+    pub fn stats(&self) -> Arc<StreamStats> {
+        self.stats.clone()
+    }
+
+    /// Return the pool of payload buffers used in the last streaming.
+    #[must_use]
+    pub fn buffer_pool(&self) -> Option<&PayloadBufferPool> {
+        self.buffer_pool.as_ref().map(|(_, pool)| pool)
+    }
+
+    /// Receive payloads of the following streaming into buffers of `pool`, e.g. a pool created by
+    /// [`PayloadBufferPool::external`], instead of allocating a pool by
+    /// [`StreamParams::buffer_kind`]. `None` restores the default.
+    ///
+    /// Starting streaming fails with [`StreamError::BufferTooSmall`] if the buffers of `pool` are
+    /// smaller than the payload. While all buffers of `pool` are in use, a payload is received
+    /// into a buffer out of the pool.
+    pub fn set_buffer_pool(&mut self, pool: Option<PayloadBufferPool>) {
+        self.external_pool = pool;
+    }
+
+    /// Returns the transfer plan matched to the current params, rebuilding it only if the payload
+    /// layout has changed.
+    fn prepare_transfer_plan(&mut self) -> Arc<TransferPlan> {
+        match &self.transfer_plan {
+            Some(plan) if plan.is_built_from(&self.params) => plan.clone(),
+            _ => {
+                let plan = Arc::new(TransferPlan::new(&self.params));
+                self.transfer_plan = Some(plan.clone());
+                plan
+            }
+        }
+    }
+
+    /// Returns the buffer pool matched to the current params, allocating a new one if needed.
+    ///
+    /// The current pool is reused as long as its buffers are large enough, so that shrinking the
+    /// payload, e.g. by ROI or binning, doesn't cause reallocation.
+    fn prepare_buffer_pool(&mut self, buffer_size: usize) -> StreamResult<PayloadBufferPool> {
+        if let Some(pool) = &self.external_pool {
+            if pool.buffer_size() < buffer_size {
+                return Err(StreamError::BufferTooSmall);
+            }
+            return Ok(pool.clone());
+        }
+
+        let buffer_count = self.params.buffer_count;
+        let kind = self.params.buffer_kind;
+        if let Some((pool_kind, pool)) = &self.buffer_pool {
+            if *pool_kind == kind
+                && pool.buffer_size() >= buffer_size
+                && pool.buffer_count() == buffer_count
+            {
+                return Ok(pool.clone());
+            }
+        }
+
+        let pool = match kind {
+            PayloadBufferKind::Heap => None,
+            PayloadBufferKind::HugePage => {
+                PayloadBufferPool::new(HugePageAllocator, buffer_size, buffer_count)
+            }
+            PayloadBufferKind::DeviceMapped => DeviceMappedAllocator::new(self.inner.clone())?
+                .and_then(|alloc| PayloadBufferPool::new(alloc, buffer_size, buffer_count)),
+        };
+        let pool = match pool {
+            Some(pool) => pool,
+            None => {
+                if kind != PayloadBufferKind::Heap {
+                    warn!(
+                        ?kind,
+                        "failed to allocate payload buffers, fall back to heap"
+                    );
+                }
+                PayloadBufferPool::new(HeapAllocator, buffer_size, buffer_count).ok_or_else(
+                    || StreamError::Io(anyhow::Error::msg("failed to allocate payload buffers")),
+                )?
+            }
+        };
+
+        self.buffer_pool = Some((kind, pool.clone()));
+        Ok(pool)
+    }
 }
 
 impl PayloadStream for StreamHandle {
@@ -88,43 +227,85 @@ impl PayloadStream for StreamHandle {
         sender: PayloadSender,
         ctrl: &mut dyn DeviceControl,
     ) -> StreamResult<()> {
-        self.params = StreamParams::from_control(ctrl).map_err(|e| {
+        let mut params = StreamParams::from_control(ctrl).map_err(|e| {
             StreamError::Io(anyhow::Error::msg(format!(
                 "failed to setup streaming parameters: {}",
                 e
             )))
         })?;
+        // Host side parameters are not stored in the device, so carry them over.
+        params.copy_host_params(&self.params);
+        self.params = params;
 
         if self.is_loop_running() {
             return Err(StreamError::InStreaming);
         }
+        check_driver_policy(&self.params, sender.policy())?;
 
-        // Sync channel of capacity 0 is a special rendez-vous mode, where every send() blocks.
-        let (cancellation_tx, cancellation_rx) = mpsc::sync_channel(0);
-        self.cancellation_tx = Some(cancellation_tx);
+        let transfer_plan = self.prepare_transfer_plan();
+        let buffer_pool = self.prepare_buffer_pool(transfer_plan.payload_buffer_size())?;
 
+        let waker = unwrap_or_poisoned!(self.inner.lock())?.async_waker();
+        let cancelled = Arc::new(AtomicBool::new(false));
         let strm_loop = StreamingLoop {
             inner: self.inner.clone(),
             params: self.params.clone(),
             sender,
-            cancellation_rx,
+            cancelled: cancelled.clone(),
+            frame_transfer_allocations: self.frame_transfer_allocations.clone(),
+            buffer_pool,
+            transfer_plan,
+            stats: self.stats.clone(),
         };
-        std::thread::spawn(|| {
-            strm_loop.run();
-        });
+        let event_thread = strm_loop.event_thread();
+        let driver = match &event_thread {
+            Some(_) if self.params.shared_driver => {
+                StreamDriver::acquire(self.params.driver_threads)
+                    .map_err(|err| {
+                        warn!(
+                            ?err,
+                            "failed to start stream driver, fall back to streaming thread"
+                        )
+                    })
+                    .ok()
+            }
+            _ => None,
+        };
+        let runner = match (driver, event_thread) {
+            (Some(driver), Some(event_thread)) => LoopRunner::Driver(
+                driver.spawn(|signal| DrivenLoop::new(strm_loop, event_thread, signal)),
+            ),
+            (_, event_thread) => LoopRunner::Thread {
+                waker,
+                join_handle: std::thread::spawn(move || {
+                    strm_loop.run(event_thread);
+                }),
+            },
+        };
+        self.streaming_loop = Some(LoopHandle { cancelled, runner });
 
         info!("start streaming loop successfully");
         Ok(())
     }
 
     fn stop_streaming_loop(&mut self) -> StreamResult<()> {
-        if self.is_loop_running() {
-            let cancellation_tx = self.cancellation_tx.take().unwrap();
-            // Since `cancellation` channel has a capacity of 0, this blocks until the streaming
-            // loop receives it.
-            cancellation_tx.send(()).map_err(|_| {
-                StreamError::Poisoned("failed to send cancellation signal to streaming loop".into())
-            })?;
+        if let Some(streaming_loop) = self.streaming_loop.take() {
+            streaming_loop.cancelled.store(true, Ordering::SeqCst);
+            // Wake up the loop even if it's waiting for a frame, so that the cancellation takes
+            // effect immediately instead of after `params.timeout`.
+            // This blocks until the loop cancels its pending transfers and exits.
+            match streaming_loop.runner {
+                LoopRunner::Thread { waker, join_handle } => {
+                    waker.wake();
+                    join_handle.join().map_err(|_| {
+                        StreamError::Poisoned("streaming loop panicked before cancellation".into())
+                    })?;
+                }
+                LoopRunner::Driver(task) => {
+                    task.wake();
+                    task.join();
+                }
+            }
         }
 
         info!("stop streaming loop successfully");
@@ -132,10 +313,27 @@ impl PayloadStream for StreamHandle {
     }
 
     fn is_loop_running(&self) -> bool {
-        self.cancellation_tx.is_some()
+        self.streaming_loop.is_some()
     }
 }
 
+/// Handle of the running [`StreamingLoop`].
+struct LoopHandle {
+    cancelled: Arc<AtomicBool>,
+    runner: LoopRunner,
+}
+
+enum LoopRunner {
+    /// The loop runs on its own thread.
+    Thread {
+        /// Interrupts the loop waiting for transfer completions.
+        waker: AsyncWaker,
+        join_handle: JoinHandle<()>,
+    },
+    /// The loop is a task of the shared [`StreamDriver`].
+    Driver(TaskHandle),
+}
+
 impl Drop for StreamHandle {
     fn drop(&mut self) {
         if let Err(e) = self.close() {
@@ -154,159 +352,445 @@ struct StreamingLoop {
     inner: Arc<Mutex<u3v::ReceiveChannel>>,
     params: StreamParams,
     sender: PayloadSender,
-    cancellation_rx: mpsc::Receiver<()>,
+    /// Set when the loop is requested to stop.
+    cancelled: Arc<AtomicBool>,
+    frame_transfer_allocations: Arc<AtomicUsize>,
+    buffer_pool: PayloadBufferPool,
+    transfer_plan: Arc<TransferPlan>,
+    stats: Arc<StreamStats>,
+}
+
+/// Buffers of a frame whose transfers are queued in [`AsyncPool`].
+///
+/// The buffers MUST NOT be dropped nor reallocated while their transfers are pending.
+struct InFlightFrame {
+    leader_buf: Vec<u8>,
+    payload_buf: PayloadBuffer,
+    trailer_buf: Vec<u8>,
+    /// The number of transfers submitted for the frame.
+    transfer_count: usize,
+    /// The number of transfers which have been completed.
+    completed_count: usize,
+    /// Total bytes received by payload transfers.
+    payload_len: usize,
+    /// The number of transfers newly allocated to submit the frame.
+    transfer_allocations: usize,
+    /// When the transfers of the frame were submitted.
+    submitted_at: Instant,
+    /// When the leader transfer was completed.
+    leader_at: Instant,
+    /// When the trailer transfer was completed.
+    trailer_at: Instant,
+}
+
+impl InFlightFrame {
+    fn new(params: &StreamParams) -> Self {
+        Self {
+            leader_buf: vec![0; params.leader_size],
+            payload_buf: PayloadBuffer::default(),
+            trailer_buf: vec![0; params.trailer_size],
+            transfer_count: 0,
+            completed_count: 0,
+            payload_len: 0,
+            transfer_allocations: 0,
+            submitted_at: Instant::now(),
+            leader_at: Instant::now(),
+            trailer_at: Instant::now(),
+        }
+    }
+
+    fn is_completed(&self) -> bool {
+        self.completed_count == self.transfer_count
+    }
 }
 
 impl StreamingLoop {
-    fn run(self) {
-        let mut trailer_buf = vec![0; self.params.trailer_size];
-        let mut payload_buf_opt = None;
-        let mut leader_buf = vec![0; self.params.leader_size];
+    fn event_thread(&self) -> Option<EventThread> {
+        // The shared driver relies on the event thread to complete transfers.
+        if !self.params.shared_event_thread && !self.params.shared_driver {
+            return None;
+        }
+        EventThread::acquire(self.params.event_thread_cpu)
+            .map_err(|err| {
+                warn!(
+                    ?err,
+                    "failed to start libusb event thread, fall back to polling"
+                )
+            })
+            .ok()
+    }
+
+    /// Runs the loop on the current thread until the cancellation.
+    fn run(self, event_thread: Option<EventThread>) {
         let inner = self.inner.lock().unwrap();
+        // NOTE: `queue` must be declared before `async_pool` so that pending transfers are
+        // cancelled and drained before the buffers are dropped.
+        let mut queue = FrameQueue::new(&self.params);
+        let mut async_pool = match event_thread {
+            Some(event_thread) => AsyncPool::with_event_thread(&inner, event_thread),
+            None => AsyncPool::new(&inner),
+        };
 
-        'outer: loop {
-            // Stop the loop when
-            // 1. `cancellation_tx` sends signal.
-            // 2. `cancellation_tx` is dropped.
-            match self.cancellation_rx.try_recv() {
-                Ok(()) | Err(TryRecvError::Disconnected) => break,
-                Err(TryRecvError::Empty) => {}
+        loop {
+            // Stop the loop when `StreamHandle` requests the cancellation.
+            if self.cancelled.load(Ordering::SeqCst) {
+                break;
             }
 
-            let maximum_payload_size = self.params.maximum_payload_size();
-            let mut payload_buf = match payload_buf_opt.take() {
-                Some(payload_buf) => payload_buf,
-                None => match self.sender.try_recv() {
-                    Ok(mut payload) => {
-                        if payload.payload.len() != maximum_payload_size {
-                            payload.payload.resize(maximum_payload_size, 0);
-                        }
-                        payload.payload
-                    }
-                    Err(_) => {
-                        vec![0; maximum_payload_size]
-                    }
-                },
-            };
+            // Keep `queue_depth` frames queued so that the device can send the next frame without
+            // waiting for the host.
+            if let Err(err) = self.fill_queue(&mut async_pool, &mut queue) {
+                self.handle_submit_error(&mut async_pool, &mut queue, err);
+                continue;
+            }
 
-            let mut async_pool = AsyncPool::new(&inner);
+            match async_pool.poll(self.params.timeout) {
+                Ok(len) => self.handle_completion(&mut async_pool, &mut queue, len),
+                // Woken up by `StreamHandle`, check the cancellation.
+                Err(u3v::Error::LibUsb(u3v::LibUsbError::Interrupted)) => continue,
+                Err(err) => self.handle_transfer_error(&mut async_pool, &mut queue, err.into()),
+            }
+        }
 
-            if let Err(err) = read_leader(&mut async_pool, &self.params, &mut leader_buf) {
-                // Report and send error if the error is fatal.
-                if matches!(err, StreamError::Io(..) | StreamError::Disconnected) {
-                    error!(?err);
-                    self.sender.try_send(Err(err)).ok();
-                }
-                payload_buf_opt = Some(payload_buf);
-                continue;
-            };
+        queue.reset(&mut async_pool);
+    }
 
-            if let Err(err) = read_payload(&mut async_pool, &self.params, &mut payload_buf) {
-                warn!(?err);
-                // Reuse `payload_buf`.
-                payload_buf_opt = Some(payload_buf);
-                self.sender.try_send(Err(err)).ok();
-                continue;
-            };
+    fn handle_submit_error(
+        &self,
+        async_pool: &mut AsyncPool,
+        queue: &mut FrameQueue,
+        err: StreamError,
+    ) {
+        // Report and send error if the error is fatal.
+        if matches!(err, StreamError::Io(..) | StreamError::Disconnected) {
+            error!(?err);
+            self.report_error(err);
+        }
+        queue.reset(async_pool);
+    }
 
-            if let Err(err) = read_trailer(&mut async_pool, &self.params, &mut trailer_buf) {
-                warn!(?err);
-                // Reuse `payload_buf`.
-                payload_buf_opt = Some(payload_buf);
-                self.sender.try_send(Err(err)).ok();
-                continue;
-            };
+    fn handle_transfer_error(
+        &self,
+        async_pool: &mut AsyncPool,
+        queue: &mut FrameQueue,
+        err: StreamError,
+    ) {
+        if matches!(err, StreamError::Timeout) {
+            self.stats.usb_timeout();
+        }
+        let frame = queue.in_flight.front().unwrap();
+        if frame.completed_count == 0 && matches!(err, StreamError::Timeout) {
+            // The device hasn't started to send the frame yet, keep transfers queued.
+            self.report_error(err);
+            return;
+        }
 
-            // We've submitted the bulk transfers, now wait for them.
-            let mut first_buf_len = None;
-            let mut last_buf_len = None;
-            let mut payload_len = 0;
-
-            while !async_pool.is_empty() {
-                let len = match async_pool.poll(self.params.timeout) {
-                    Ok(len) => len,
-                    Err(err) => {
-                        warn!(?err);
-                        // Can't reuse `payload_buf` because we're in a loop.
-                        self.sender.try_send(Err(err.into())).ok();
-                        continue 'outer;
-                    }
-                };
-
-                if first_buf_len.is_none() {
-                    first_buf_len = Some(len);
-                } else {
-                    payload_len += len;
-                }
+        warn!(?err);
+        // The frame is broken in the middle, resynchronize with the device.
+        self.report_error(err);
+        queue.reset(async_pool);
+    }
 
-                last_buf_len = Some(len);
+    /// Handles the completion of the next transfer which received `len` bytes.
+    fn handle_completion(&self, async_pool: &mut AsyncPool, queue: &mut FrameQueue, len: usize) {
+        self.stats.bytes_received(len);
+
+        // Transfers are completed in the order of submission, so the front frame is the
+        // one the completed transfer belongs to.
+        let frame = queue.in_flight.front_mut().unwrap();
+        // The first transfer is for the leader and the last one is for the trailer.
+        let transfer_idx = frame.completed_count;
+        frame.completed_count += 1;
+        if transfer_idx == 0 {
+            frame.leader_at = Instant::now();
+            self.stats
+                .submit_to_leader(frame.leader_at - frame.submitted_at);
+        } else if !frame.is_completed() {
+            frame.payload_len += len;
+        }
+
+        if frame.is_completed() {
+            frame.trailer_at = Instant::now();
+            self.stats
+                .leader_to_trailer(frame.trailer_at - frame.leader_at);
+            let frame = queue.in_flight.pop_front().unwrap();
+            // Resubmit before parsing the completed frame to keep host-side turnaround out of
+            // the bus idle time.
+            if let Err(err) = self.fill_queue(async_pool, queue) {
+                warn!(?err);
+                queue.reset(async_pool);
             }
+            self.deliver(frame, &mut queue.spare_frames);
+        }
+    }
 
-            let payload_len = payload_len - last_buf_len.unwrap();
+    /// Submits transfers of new frames until `queue_depth` frames are queued.
+    fn fill_queue(&self, async_pool: &mut AsyncPool, queue: &mut FrameQueue) -> StreamResult<()> {
+        while queue.in_flight.len() < queue.depth {
+            let mut frame = queue
+                .spare_frames
+                .pop()
+                .unwrap_or_else(|| InFlightFrame::new(&self.params));
+            frame.completed_count = 0;
+            frame.payload_len = 0;
+
+            // A buffer larger than required is used as is. No reallocation nor zero-fill occurs.
+            let payload_buffer_size = self.transfer_plan.payload_buffer_size();
+            if frame.payload_buf.len() < payload_buffer_size {
+                frame.payload_buf = self.acquire_payload_buf(payload_buffer_size);
+            }
 
-            // We received the data from the bulk transfers, try to parse stuff now.
-            let leader = match u3v_stream::Leader::parse(&leader_buf)
-                .map_err(|e| StreamError::InvalidPayload(format!("{}", e).into()))
-            {
-                Ok(leader) => leader,
-                Err(err) => {
-                    warn!(?err);
-                    // Reuse `payload_buf`.
-                    payload_buf_opt = Some(payload_buf);
-                    self.sender.try_send(Err(err)).ok();
-                    continue;
-                }
-            };
+            // Push the frame before submitting so that its buffers outlive the transfers even if
+            // the submission fails in the middle.
+            queue.in_flight.push_back(frame);
+            let frame = queue.in_flight.back_mut().unwrap();
+            let pending = async_pool.pending();
+            let allocations = async_pool.transfer_allocations();
+            frame.submitted_at = Instant::now();
+            read_leader(async_pool, &self.params, &mut frame.leader_buf)?;
+            read_payload(async_pool, &self.transfer_plan, &mut frame.payload_buf)?;
+            read_trailer(async_pool, &self.params, &mut frame.trailer_buf)?;
+            frame.transfer_count = async_pool.pending() - pending;
+            frame.transfer_allocations = async_pool.transfer_allocations() - allocations;
+        }
 
-            let trailer = match u3v_stream::Trailer::parse(&trailer_buf)
-                .map_err(|e| StreamError::InvalidPayload(format!("invalid trailer: {}", e).into()))
-            {
-                Ok(trailer) => trailer,
-                Err(err) => {
+        Ok(())
+    }
+
+    fn acquire_payload_buf(&self, len: usize) -> PayloadBuffer {
+        acquire_payload_buf(&self.buffer_pool, &self.sender, len)
+    }
+
+    /// Builds a payload from the completed frame and sends it to the host.
+    fn deliver(&self, mut frame: InFlightFrame, spare_frames: &mut Vec<InFlightFrame>) {
+        self.frame_transfer_allocations
+            .store(frame.transfer_allocations, Ordering::Relaxed);
+        let payload_buf = std::mem::take(&mut frame.payload_buf);
+        let result = self.build_payload(&frame, payload_buf);
+        spare_frames.push(frame);
+
+        match result {
+            Ok(payload) => {
+                if let Err(err) = send_payload(&self.sender, &self.stats, payload) {
                     warn!(?err);
+                    return;
+                }
+            }
+            Err((err, payload_buf)) => {
+                warn!(?err);
+                if let Some(payload_buf) = payload_buf {
                     // Reuse `payload_buf`.
-                    payload_buf_opt = Some(payload_buf);
-                    self.sender.try_send(Err(err)).ok();
-                    continue;
+                    spare_frames.last_mut().unwrap().payload_buf = payload_buf;
                 }
-            };
+                self.report_error(err);
+            }
+        }
+        let frame = spare_frames.last().unwrap();
+        self.stats.trailer_to_delivery(frame.trailer_at.elapsed());
+    }
+
+    /// Records `err` in the statistics and sends it to the host.
+    fn report_error(&self, err: StreamError) {
+        self.stats.error(&err);
+        self.sender.try_send(Err(err)).ok();
+    }
 
-            let builder_result = PayloadBuilder {
-                leader,
-                payload_buf,
-                read_payload_size: payload_len,
-                trailer,
+    /// Returns the payload buffer with the error if it can be reused.
+    fn build_payload(
+        &self,
+        frame: &InFlightFrame,
+        payload_buf: PayloadBuffer,
+    ) -> Result<Payload, (StreamError, Option<PayloadBuffer>)> {
+        // We received the data from the bulk transfers, try to parse stuff now.
+        let leader = match u3v_stream::Leader::parse(&frame.leader_buf)
+            .map_err(|e| StreamError::InvalidPayload(format!("{}", e).into()))
+        {
+            Ok(leader) => leader,
+            Err(err) => {
+                self.stats.leader_parse_failure();
+                return Err((err, Some(payload_buf)));
             }
-            .build();
-
-            let payload = match builder_result {
-                Ok(payload) => payload,
-                Err(e) => {
-                    warn!(?e);
-                    // Can't reuse `payload_buf` because we moved it
-                    // into PayloadBuilder above.
-                    payload_buf_opt = None;
-                    self.sender.try_send(Err(e)).ok();
-                    continue;
-                }
-            };
+        };
 
-            if let Err(err) = self.sender.try_send(Ok(payload)) {
-                warn!(?err);
+        let trailer = match u3v_stream::Trailer::parse(&frame.trailer_buf)
+            .map_err(|e| StreamError::InvalidPayload(format!("invalid trailer: {}", e).into()))
+        {
+            Ok(trailer) => trailer,
+            Err(err) => {
+                self.stats.trailer_parse_failure();
+                return Err((err, Some(payload_buf)));
             }
+        };
+
+        PayloadBuilder {
+            leader,
+            payload_buf,
+            read_payload_size: frame.payload_len,
+            trailer,
+            host_timestamp: HostTimestamp {
+                leader: frame.leader_at,
+                trailer: frame.trailer_at,
+            },
         }
+        .build()
+        // Can't reuse `payload_buf` because we moved it into PayloadBuilder above.
+        .map_err(|err| (err, None))
     }
 }
 
-struct PayloadBuilder<'a> {
-    leader: u3v_stream::Leader<'a>,
-    payload_buf: Vec<u8>,
-    read_payload_size: usize,
-    trailer: u3v_stream::Trailer<'a>,
+/// Frames whose transfers are queued in [`AsyncPool`], and frames to be queued next.
+struct FrameQueue {
+    in_flight: VecDeque<InFlightFrame>,
+    spare_frames: Vec<InFlightFrame>,
+    /// The number of frames kept queued.
+    depth: usize,
+}
+
+impl FrameQueue {
+    fn new(params: &StreamParams) -> Self {
+        let depth = params.queue_depth.max(1);
+        Self {
+            in_flight: VecDeque::with_capacity(depth),
+            spare_frames: Vec::with_capacity(depth),
+            depth,
+        }
+    }
+
+    /// Cancels all pending transfers and waits for them, then recycles buffers of queued frames.
+    fn reset(&mut self, async_pool: &mut AsyncPool) {
+        async_pool.cancel_all();
+        while !async_pool.is_empty() {
+            async_pool.poll(Duration::from_secs(1)).ok();
+        }
+        self.spare_frames.extend(self.in_flight.drain(..));
+    }
+}
+
+/// [`StreamingLoop`] driven by [`StreamDriver`] instead of its own thread.
+///
+/// The channel is locked only while the loop is stepped, and the pending transfers are kept in
+/// `async_pool` between the steps.
+struct DrivenLoop {
+    // NOTE: `async_pool` must be declared before `queue` so that pending transfers are drained
+    // before the buffers are dropped.
+    async_pool: Option<SuspendedPool>,
+    queue: FrameQueue,
+    strm_loop: StreamingLoop,
+    /// When the next transfer times out.
+    deadline: Instant,
+}
+
+impl DrivenLoop {
+    fn new(
+        strm_loop: StreamingLoop,
+        event_thread: EventThread,
+        signal: &Arc<CompletionSignal>,
+    ) -> Self {
+        let async_pool = {
+            let inner = strm_loop.inner.lock().unwrap();
+            let mut async_pool = AsyncPool::with_event_thread(&inner, event_thread);
+            async_pool.set_completion_signal(Some(signal.clone()));
+            async_pool.suspend()
+        };
+        Self {
+            async_pool: Some(async_pool),
+            queue: FrameQueue::new(&strm_loop.params),
+            deadline: Instant::now() + strm_loop.params.timeout,
+            strm_loop,
+        }
+    }
+
+    fn advance(&mut self, async_pool: &mut AsyncPool) -> Step {
+        let strm_loop = &self.strm_loop;
+        let queue = &mut self.queue;
+        let mut progressed = false;
+        loop {
+            if let Err(err) = strm_loop.fill_queue(async_pool, queue) {
+                strm_loop.handle_submit_error(async_pool, queue, err);
+                return Step::Progress;
+            }
+
+            match async_pool.try_poll() {
+                Some(Ok(len)) => strm_loop.handle_completion(async_pool, queue, len),
+                Some(Err(err)) => strm_loop.handle_transfer_error(async_pool, queue, err.into()),
+                None => break,
+            }
+            self.deadline = Instant::now() + strm_loop.params.timeout;
+            progressed = true;
+        }
+
+        if progressed {
+            Step::Progress
+        } else if Instant::now() >= self.deadline {
+            strm_loop.handle_transfer_error(async_pool, queue, StreamError::Timeout);
+            self.deadline = Instant::now() + strm_loop.params.timeout;
+            Step::Progress
+        } else {
+            Step::Idle(self.deadline)
+        }
+    }
+}
+
+impl DriverTask for DrivenLoop {
+    fn step(&mut self) -> Step {
+        let inner = self.strm_loop.inner.clone();
+        let inner = inner.lock().unwrap();
+        let mut async_pool = AsyncPool::resume(&inner, self.async_pool.take().unwrap());
+
+        // Stop the loop when `StreamHandle` requests the cancellation.
+        if self.strm_loop.cancelled.load(Ordering::SeqCst) {
+            self.queue.reset(&mut async_pool);
+            async_pool.set_completion_signal(None);
+            return Step::Finished;
+        }
+
+        let step = self.advance(&mut async_pool);
+        self.async_pool = Some(async_pool.suspend());
+        step
+    }
+}
+
+/// Sends `payload` to the host with the backpressure policy of `sender`, and records the result
+/// in `stats`.
+/// Rejects [`BackpressurePolicy::Block`] on the shared driver, where waiting for the consumer
+/// blocks the worker serving the other streams.
+fn check_driver_policy(params: &StreamParams, policy: BackpressurePolicy) -> StreamResult<()> {
+    if params.shared_driver && matches!(policy, BackpressurePolicy::Block { .. }) {
+        return Err(StreamError::Io(anyhow::Error::msg(
+            "BackpressurePolicy::Block can't be used with the shared stream driver",
+        )));
+    }
+    Ok(())
+}
+
+pub(super) fn send_payload(
+    sender: &PayloadSender,
+    stats: &StreamStats,
+    payload: Payload,
+) -> StreamResult<()> {
+    let dropped = sender.dropped_frames();
+    sender.send_with_policy(payload)?;
+    let now_dropped = sender.dropped_frames();
+    stats.frames_dropped(now_dropped.total() - dropped.total());
+    // A frame evicted by `DropOldest` is not the one just sent.
+    if now_dropped.newest == dropped.newest
+        && now_dropped.deadline_exceeded == dropped.deadline_exceeded
+    {
+        stats.frame_delivered();
+    }
+    Ok(())
+}
+
+pub(super) struct PayloadBuilder<'a> {
+    pub(super) leader: u3v_stream::Leader<'a>,
+    pub(super) payload_buf: PayloadBuffer,
+    pub(super) read_payload_size: usize,
+    pub(super) trailer: u3v_stream::Trailer<'a>,
+    pub(super) host_timestamp: HostTimestamp,
 }
 
 impl<'a> PayloadBuilder<'a> {
-    fn build(self) -> StreamResult<Payload> {
+    pub(super) fn build(self) -> StreamResult<Payload> {
         let payload_status = self.trailer.payload_status();
         if payload_status != u3v_stream::PayloadStatus::Success {
             return Err(StreamError::InvalidPayload(
@@ -348,45 +832,24 @@ impl<'a> PayloadBuilder<'a> {
             id,
             payload_type: PayloadType::Image,
             image_info,
+            chunks: vec![],
             payload: self.payload_buf,
             valid_payload_size,
             timestamp: leader.timestamp(),
+            host_timestamp: Some(self.host_timestamp),
         })
     }
 
     fn build_image_extended_payload(self) -> StreamResult<Payload> {
-        const CHUNK_ID_LEN: usize = 4;
-        const CHUNK_SIZE_LEN: usize = 4;
-
         let leader: u3v_stream::ImageExtendedChunkLeader = self.specific_leader_as()?;
         let trailer: u3v_stream::ImageExtendedChunkTrailer = self.specific_trailer_as()?;
 
         let id = self.leader.block_id();
         let valid_payload_size = self.trailer.valid_payload_size() as usize;
 
-        // Extract image size from the first chunk of the paload data.
-        // Chunk data is designed to be decoded from the last byte to the first byte.
-        // Use chunk parser of `cameleon_genapi` once it gets implemented.
-        let mut current_offset = valid_payload_size;
-        let image_size = loop {
-            current_offset = current_offset.checked_sub(CHUNK_SIZE_LEN).ok_or_else(|| {
-                StreamError::InvalidPayload("failed to parse chunk data: size field missing".into())
-            })?;
-            let data_size = u32::from_be_bytes(
-                self.payload_buf[current_offset..current_offset + CHUNK_SIZE_LEN]
-                    .try_into()
-                    .unwrap(),
-            ) as usize;
-            current_offset = current_offset.checked_sub(data_size + CHUNK_ID_LEN).ok_or_else(|| {
-                StreamError::InvalidPayload(
-                    "failed to parse chunk data: chunk data size is smaller than specified size".into()
-                )
-            })?;
-
-            if current_offset == 0 {
-                break data_size;
-            }
-        };
+        // The first chunk of the payload data is the image.
+        let chunks = ChunkLayout::parse_all(&self.payload_buf[..valid_payload_size])?;
+        let image_size = chunks.first().map_or(0, |chunk| chunk.len);
 
         let image_info = Some(ImageInfo {
             width: leader.width() as usize,
@@ -401,9 +864,11 @@ impl<'a> PayloadBuilder<'a> {
             id,
             payload_type: PayloadType::ImageExtendedChunk,
             image_info,
+            chunks,
             payload: self.payload_buf,
             valid_payload_size,
             timestamp: leader.timestamp(),
+            host_timestamp: Some(self.host_timestamp),
         })
     }
 
@@ -413,14 +878,17 @@ impl<'a> PayloadBuilder<'a> {
 
         let id = self.leader.block_id();
         let valid_payload_size = self.trailer.valid_payload_size() as usize;
+        let chunks = ChunkLayout::parse_all(&self.payload_buf[..valid_payload_size])?;
 
         Ok(Payload {
             id,
             payload_type: PayloadType::Chunk,
             image_info: None,
+            chunks,
             payload: self.payload_buf,
             valid_payload_size,
             timestamp: leader.timestamp(),
+            host_timestamp: Some(self.host_timestamp),
         })
     }
 
@@ -440,7 +908,7 @@ impl<'a> PayloadBuilder<'a> {
 /// Parameters to receive stream packets.
 ///
 /// Both [`StreamHandle`] doesn't check the integrity of the parameters. That's up to user.
-#[derive(Debug, Clone, Default)]
+#[derive(Debug, Clone)]
 pub struct StreamParams {
     /// Maximum leader size.
     pub leader_size: usize,
@@ -462,6 +930,123 @@ pub struct StreamParams {
 
     /// Timeout duration of each transaction between device.
     pub timeout: Duration,
+
+    /// The number of frames whose transfers are kept queued in the host controller.
+    ///
+    /// If the value is larger than 1, the next frame's transfers are already submitted when a frame
+    /// is completed, so the device can keep sending frames while the host processes the completed
+    /// one. `0` is treated as `1`.
+    ///
+    /// This value is a host side parameter, so it's kept as is when [`StreamHandle`] starts
+    /// streaming.
+    ///
+    /// NOTE: On Linux, all queued transfers must fit in `usbfs_memory_mb`.
+    pub queue_depth: usize,
+
+    /// The number of payload buffers pre-allocated in the buffer pool.
+    ///
+    /// The value should be large enough to cover frames queued in the host controller and
+    /// payloads held by the host. If all buffers are in use, a buffer is allocated out of the
+    /// pool.
+    ///
+    /// This value is a host side parameter, so it's kept as is when [`StreamHandle`] starts
+    /// streaming.
+    pub buffer_count: usize,
+
+    /// Kind of memory of payload buffers.
+    ///
+    /// This value is a host side parameter, so it's kept as is when [`StreamHandle`] starts
+    /// streaming.
+    pub buffer_kind: PayloadBufferKind,
+
+    /// Whether libusb events are handled by the event thread shared by all streams.
+    ///
+    /// If `false`, each streaming thread handles libusb events by itself, and streaming threads of
+    /// multiple cameras contend for the libusb event lock. If `true`, a single thread handles the
+    /// events and streaming threads just wait for the completion of their transfers.
+    ///
+    /// This value is a host side parameter, so it's kept as is when [`StreamHandle`] starts
+    /// streaming.
+    pub shared_event_thread: bool,
+
+    /// CPU core which the shared event thread is pinned to. Only supported on Linux.
+    ///
+    /// The value is used only by the stream which spawns the event thread, i.e. the first stream
+    /// started with [`StreamParams::shared_event_thread`] set.
+    ///
+    /// This value is a host side parameter, so it's kept as is when [`StreamHandle`] starts
+    /// streaming.
+    pub event_thread_cpu: Option<usize>,
+
+    /// Whether the streaming loop is driven by the threads shared by all streams instead of its
+    /// own thread.
+    ///
+    /// If `true`, [`StreamParams::driver_threads`] threads serve the streams of all cameras and
+    /// libusb events are handled by the shared event thread regardless of
+    /// [`StreamParams::shared_event_thread`]. Falls back to a streaming thread per camera if the
+    /// driver can't be started.
+    ///
+    /// Streaming fails to start if this is set and the channel uses
+    /// [`BackpressurePolicy::Block`](crate::payload::BackpressurePolicy::Block), because a worker
+    /// waiting for a slow consumer would stall the streams of the other cameras.
+    ///
+    /// This value is a host side parameter, so it's kept as is when [`StreamHandle`] starts
+    /// streaming.
+    pub shared_driver: bool,
+
+    /// The number of threads of the shared driver.
+    ///
+    /// The value is used only by the stream which spawns the driver, i.e. the first stream
+    /// started with [`StreamParams::shared_driver`] set.
+    ///
+    /// This value is a host side parameter, so it's kept as is when [`StreamHandle`] starts
+    /// streaming.
+    pub driver_threads: usize,
+}
+
+/// Kind of memory used for payload buffers.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum PayloadBufferKind {
+    /// Page aligned heap memory.
+    Heap,
+
+    /// Memory backed by huge pages. Falls back to [`PayloadBufferKind::Heap`] if huge pages are
+    /// not available.
+    HugePage,
+
+    /// Memory mapped to the device by `libusb_dev_mem_alloc`, which lets usbfs transfer data
+    /// without copying it from the kernel buffer. Falls back to [`PayloadBufferKind::Heap`] if
+    /// the platform doesn't support it.
+    ///
+    /// NOTE: On Linux, all buffers must fit in `usbfs_memory_mb`.
+    DeviceMapped,
+}
+
+impl Default for PayloadBufferKind {
+    fn default() -> Self {
+        Self::Heap
+    }
+}
+
+impl Default for StreamParams {
+    fn default() -> Self {
+        Self {
+            leader_size: 0,
+            trailer_size: 0,
+            payload_size: 0,
+            payload_count: 0,
+            payload_final1_size: 0,
+            payload_final2_size: 0,
+            timeout: Duration::default(),
+            queue_depth: DEFAULT_QUEUE_DEPTH,
+            buffer_count: DEFAULT_BUFFER_COUNT,
+            buffer_kind: PayloadBufferKind::default(),
+            shared_event_thread: false,
+            event_thread_cpu: None,
+            shared_driver: false,
+            driver_threads: DEFAULT_DRIVER_THREADS,
+        }
+    }
 }
 
 impl StreamParams {
@@ -471,6 +1056,17 @@ impl StreamParams {
     pub fn maximum_payload_size(&self) -> usize {
         self.payload_size * self.payload_count + self.payload_final1_size + self.payload_final2_size
     }
+
+    /// Copies parameters which are not stored in the device.
+    fn copy_host_params(&mut self, other: &Self) {
+        self.queue_depth = other.queue_depth;
+        self.buffer_count = other.buffer_count;
+        self.buffer_kind = other.buffer_kind;
+        self.shared_event_thread = other.shared_event_thread;
+        self.event_thread_cpu = other.event_thread_cpu;
+        self.shared_driver = other.shared_driver;
+        self.driver_threads = other.driver_threads;
+    }
 }
 
 impl StreamParams {
@@ -493,6 +1089,13 @@ impl StreamParams {
             payload_final1_size,
             payload_final2_size,
             timeout,
+            queue_depth: DEFAULT_QUEUE_DEPTH,
+            buffer_count: DEFAULT_BUFFER_COUNT,
+            buffer_kind: PayloadBufferKind::default(),
+            shared_event_thread: false,
+            event_thread_cpu: None,
+            shared_driver: false,
+            driver_threads: DEFAULT_DRIVER_THREADS,
         }
     }
 
@@ -525,6 +1128,90 @@ impl StreamParams {
     }
 }
 
+/// Layout of the bulk transfers to receive a payload, built from `SIRM` values.
+///
+/// The payload is received by `payload_count` transfers of `payload_size`, followed by a
+/// `payload_final1_size` transfer and a `payload_final2_size` transfer. A final transfer of size
+/// zero is skipped.
+#[derive(Debug, Clone, PartialEq, Eq)]
+struct TransferPlan {
+    /// `payload_size`, `payload_count`, `payload_final1_size` and `payload_final2_size` which the
+    /// plan is built from.
+    layout: (usize, usize, usize, usize),
+    /// `(offset, len)` of each payload transfer in the payload buffer.
+    payload_transfers: Vec<(usize, usize)>,
+}
+
+impl TransferPlan {
+    fn new(params: &StreamParams) -> Self {
+        let mut payload_transfers = Vec::with_capacity(params.payload_count + 2);
+        let mut offset = 0;
+        let transfer_sizes = (0..params.payload_count)
+            .map(|_| params.payload_size)
+            .chain([params.payload_final1_size, params.payload_final2_size]);
+        for len in transfer_sizes.filter(|len| *len != 0) {
+            payload_transfers.push((offset, len));
+            offset += len;
+        }
+
+        Self {
+            layout: Self::layout_of(params),
+            payload_transfers,
+        }
+    }
+
+    fn is_built_from(&self, params: &StreamParams) -> bool {
+        self.layout == Self::layout_of(params)
+    }
+
+    /// Returns the buffer size required to receive the payload.
+    fn payload_buffer_size(&self) -> usize {
+        self.payload_transfers
+            .last()
+            .map_or(0, |(offset, len)| offset + len)
+    }
+
+    fn layout_of(params: &StreamParams) -> (usize, usize, usize, usize) {
+        (
+            params.payload_size,
+            params.payload_count,
+            params.payload_final1_size,
+            params.payload_final2_size,
+        )
+    }
+}
+
+/// Allocates device-mapped memory of the stream channel.
+struct DeviceMappedAllocator {
+    inner: DevMemAllocator,
+    /// Keeps the channel alive as long as the allocator.
+    _channel: Arc<Mutex<u3v::ReceiveChannel>>,
+}
+
+impl DeviceMappedAllocator {
+    fn new(channel: Arc<Mutex<u3v::ReceiveChannel>>) -> StreamResult<Option<Self>> {
+        let inner = match DevMemAllocator::new(&*unwrap_or_poisoned!(channel.lock())?) {
+            Some(inner) => inner,
+            None => return Ok(None),
+        };
+        Ok(Some(Self {
+            inner,
+            _channel: channel,
+        }))
+    }
+}
+
+impl BufferAllocator for DeviceMappedAllocator {
+    fn allocate(&self, len: usize) -> Option<NonNull<u8>> {
+        // Safety: `_channel` outlives `inner`.
+        unsafe { self.inner.alloc(len) }
+    }
+
+    unsafe fn deallocate(&self, ptr: NonNull<u8>, len: usize) {
+        self.inner.free(ptr, len);
+    }
+}
+
 fn read_leader(
     async_pool: &mut AsyncPool,
     params: &StreamParams,
@@ -538,19 +1225,11 @@ fn read_leader(
 
 fn read_payload(
     async_pool: &mut AsyncPool,
-    params: &StreamParams,
+    plan: &TransferPlan,
     buf: &mut [u8],
 ) -> StreamResult<()> {
-    let payload_size = params.payload_size;
-    let mut cursor = 0;
-    for _ in 0..params.payload_count {
-        async_pool.submit(&mut buf[cursor..cursor + payload_size])?;
-        cursor += payload_size;
-    }
-
-    if params.payload_final1_size != 0 {
-        async_pool.submit(&mut buf[cursor..cursor + params.payload_final1_size])?;
-        cursor += params.payload_final1_size;
+    for &(offset, len) in &plan.payload_transfers {
+        async_pool.submit(&mut buf[offset..offset + len])?;
     }
 
     Ok(())
@@ -566,3 +1245,109 @@ fn read_trailer(
 
     Ok(())
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::payload;
+
+    #[test]
+    fn test_transfer_plan() {
+        let mut params = StreamParams::new(64, 64, 1024, 3, 512, 16, Duration::from_secs(1));
+        let plan = TransferPlan::new(&params);
+        assert_eq!(
+            plan.payload_transfers,
+            vec![
+                (0, 1024),
+                (1024, 1024),
+                (2048, 1024),
+                (3072, 512),
+                (3584, 16)
+            ]
+        );
+        assert_eq!(plan.payload_buffer_size(), params.maximum_payload_size());
+        assert!(plan.is_built_from(&params));
+
+        // Final transfers of size zero are skipped.
+        params.payload_final1_size = 0;
+        params.payload_final2_size = 0;
+        assert!(!plan.is_built_from(&params));
+        let plan = TransferPlan::new(&params);
+        assert_eq!(
+            plan.payload_transfers,
+            vec![(0, 1024), (1024, 1024), (2048, 1024)]
+        );
+        assert_eq!(plan.payload_buffer_size(), params.maximum_payload_size());
+    }
+
+    /// Delivers `remaining` payloads without waiting for the consumer.
+    struct DeliveryTask {
+        sender: PayloadSender,
+        stats: StreamStats,
+        remaining: u64,
+    }
+
+    impl DriverTask for DeliveryTask {
+        fn step(&mut self) -> Step {
+            if self.remaining == 0 {
+                return Step::Finished;
+            }
+            self.remaining -= 1;
+            let payload = Payload {
+                id: self.remaining,
+                payload_type: PayloadType::Chunk,
+                image_info: None,
+                chunks: vec![],
+                payload: vec![0; 16].into(),
+                valid_payload_size: 16,
+                timestamp: Duration::default(),
+                host_timestamp: None,
+            };
+            send_payload(&self.sender, &self.stats, payload).unwrap();
+            Step::Progress
+        }
+    }
+
+    #[test]
+    fn test_idle_consumer_on_driver() {
+        const PAYLOADS: u64 = 64;
+        // Both tasks are served by the same worker.
+        let driver = StreamDriver::private(1).unwrap();
+        let (idle_tx, idle_rx) = payload::channel(1, 1);
+        let (active_tx, active_rx) = payload::channel(PAYLOADS as usize, 1);
+        let idle = driver.spawn(|_| DeliveryTask {
+            sender: idle_tx,
+            stats: StreamStats::default(),
+            remaining: PAYLOADS,
+        });
+        let active = driver.spawn(|_| DeliveryTask {
+            sender: active_tx,
+            stats: StreamStats::default(),
+            remaining: PAYLOADS,
+        });
+
+        // The consumer which never receives doesn't stall the other stream.
+        let deadline = Instant::now() + Duration::from_secs(30);
+        let mut received = 0;
+        while received < PAYLOADS && Instant::now() < deadline {
+            match active_rx.try_recv() {
+                Ok(_) => received += 1,
+                Err(_) => std::thread::sleep(Duration::from_millis(1)),
+            }
+        }
+        assert_eq!(received, PAYLOADS);
+        active.join();
+        idle.join();
+        assert_eq!(idle_rx.dropped_frames().newest, PAYLOADS - 1);
+
+        // Waiting for the consumer is rejected on the shared driver.
+        let mut params = StreamParams::new(64, 64, 1024, 3, 512, 16, Duration::from_secs(1));
+        let block = BackpressurePolicy::Block {
+            deadline: Duration::from_millis(100),
+        };
+        assert!(check_driver_policy(&params, block).is_ok());
+        params.shared_driver = true;
+        assert!(check_driver_policy(&params, block).is_err());
+        assert!(check_driver_policy(&params, BackpressurePolicy::DropNewest).is_ok());
+    }
+}
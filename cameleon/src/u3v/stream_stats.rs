@@ -0,0 +1,342 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! This module contains statistics of the streaming loop of [`StreamHandle`].
+//!
+//! All counters are updated with relaxed atomic operations and never lock, so the statistics are
+//! always collected. A [`StreamStatsSnapshot`] can be taken from any thread while streaming.
+//!
+//! [`StreamHandle`]: super::StreamHandle
+
+use std::{
+    convert::TryInto,
+    sync::atomic::{AtomicU64, Ordering},
+    time::Duration,
+};
+
+use crate::StreamError;
+
+/// The number of buckets of [`LatencyHistogram`].
+pub const HISTOGRAM_BUCKET_COUNT: usize = 25;
+
+/// Statistics of the streaming loop, shared between [`StreamHandle`] and its streaming loop.
+///
+/// [`StreamHandle`]: super::StreamHandle
+#[derive(Debug, Default)]
+pub struct StreamStats {
+    frames_delivered: AtomicU64,
+    frames_dropped: AtomicU64,
+    errors: ErrorCounters,
+    leader_parse_failures: AtomicU64,
+    trailer_parse_failures: AtomicU64,
+    bytes_received: AtomicU64,
+    usb_timeouts: AtomicU64,
+    submit_to_leader: LatencyHistogram,
+    leader_to_trailer: LatencyHistogram,
+    trailer_to_delivery: LatencyHistogram,
+}
+
+impl StreamStats {
+    /// Returns the current values of the statistics.
+    ///
+    /// Counters are read one by one, so the snapshot may be slightly inconsistent while
+    /// streaming, e.g. a frame may be counted in `bytes_received` but not yet in
+    /// `frames_delivered`.
+    #[must_use]
+    pub fn snapshot(&self) -> StreamStatsSnapshot {
+        StreamStatsSnapshot {
+            frames_delivered: load(&self.frames_delivered),
+            frames_dropped: load(&self.frames_dropped),
+            errors: self.errors.snapshot(),
+            leader_parse_failures: load(&self.leader_parse_failures),
+            trailer_parse_failures: load(&self.trailer_parse_failures),
+            bytes_received: load(&self.bytes_received),
+            usb_timeouts: load(&self.usb_timeouts),
+            submit_to_leader: self.submit_to_leader.snapshot(),
+            leader_to_trailer: self.leader_to_trailer.snapshot(),
+            trailer_to_delivery: self.trailer_to_delivery.snapshot(),
+        }
+    }
+
+    pub(super) fn frame_delivered(&self) {
+        add(&self.frames_delivered, 1);
+    }
+
+    pub(super) fn frames_dropped(&self, n: u64) {
+        add(&self.frames_dropped, n);
+    }
+
+    pub(super) fn error(&self, err: &StreamError) {
+        self.errors.record(err);
+    }
+
+    pub(super) fn leader_parse_failure(&self) {
+        add(&self.leader_parse_failures, 1);
+    }
+
+    pub(super) fn trailer_parse_failure(&self) {
+        add(&self.trailer_parse_failures, 1);
+    }
+
+    pub(super) fn bytes_received(&self, len: usize) {
+        add(&self.bytes_received, len as u64);
+    }
+
+    pub(super) fn usb_timeout(&self) {
+        add(&self.usb_timeouts, 1);
+    }
+
+    pub(super) fn submit_to_leader(&self, latency: Duration) {
+        self.submit_to_leader.record(latency);
+    }
+
+    pub(super) fn leader_to_trailer(&self, latency: Duration) {
+        self.leader_to_trailer.record(latency);
+    }
+
+    pub(super) fn trailer_to_delivery(&self, latency: Duration) {
+        self.trailer_to_delivery.record(latency);
+    }
+}
+
+/// Values of [`StreamStats`] at some point.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct StreamStatsSnapshot {
+    /// Frames sent to [`PayloadReceiver`](crate::payload::PayloadReceiver).
+    ///
+    /// Frames evicted later by [`BackpressurePolicy::DropOldest`] are also counted in
+    /// `frames_dropped`.
+    ///
+    /// [`BackpressurePolicy::DropOldest`]: crate::payload::BackpressurePolicy::DropOldest
+    pub frames_delivered: u64,
+
+    /// Frames dropped by the [`BackpressurePolicy`](crate::payload::BackpressurePolicy).
+    pub frames_dropped: u64,
+
+    /// Errors reported to [`PayloadReceiver`](crate::payload::PayloadReceiver).
+    pub errors: StreamErrorCounts,
+
+    /// Frames whose leader couldn't be parsed.
+    pub leader_parse_failures: u64,
+
+    /// Frames whose trailer couldn't be parsed.
+    pub trailer_parse_failures: u64,
+
+    /// Bytes received by completed transfers, including leaders and trailers.
+    pub bytes_received: u64,
+
+    /// Transfers which weren't completed within [`StreamParams::timeout`].
+    ///
+    /// [`StreamParams::timeout`]: super::StreamParams::timeout
+    pub usb_timeouts: u64,
+
+    /// Latency from the submission of a frame's transfers to the completion of its leader.
+    ///
+    /// NOTE: If [`StreamParams::queue_depth`](super::StreamParams::queue_depth) is larger than 1,
+    /// this includes the time the frame waits behind preceding frames.
+    pub submit_to_leader: HistogramSnapshot,
+
+    /// Latency from the completion of a frame's leader to the completion of its trailer.
+    pub leader_to_trailer: HistogramSnapshot,
+
+    /// Latency from the completion of a frame's trailer to the delivery of its payload.
+    pub trailer_to_delivery: HistogramSnapshot,
+}
+
+/// The numbers of errors for each [`StreamError`] variant.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct StreamErrorCounts {
+    /// [`StreamError::ReceiveError`].
+    pub receive_error: u64,
+    /// [`StreamError::SendError`].
+    pub send_error: u64,
+    /// [`StreamError::InvalidPayload`].
+    pub invalid_payload: u64,
+    /// [`StreamError::Disconnected`].
+    pub disconnected: u64,
+    /// [`StreamError::Io`].
+    pub io: u64,
+    /// [`StreamError::Timeout`].
+    pub timeout: u64,
+    /// [`StreamError::Poisoned`].
+    pub poisoned: u64,
+    /// [`StreamError::BufferTooSmall`].
+    pub buffer_too_small: u64,
+    /// [`StreamError::InStreaming`].
+    pub in_streaming: u64,
+}
+
+impl StreamErrorCounts {
+    /// Returns the total number of errors.
+    #[must_use]
+    pub fn total(&self) -> u64 {
+        self.receive_error
+            + self.send_error
+            + self.invalid_payload
+            + self.disconnected
+            + self.io
+            + self.timeout
+            + self.poisoned
+            + self.buffer_too_small
+            + self.in_streaming
+    }
+}
+
+#[derive(Debug, Default)]
+struct ErrorCounters([AtomicU64; 9]);
+
+impl ErrorCounters {
+    fn record(&self, err: &StreamError) {
+        let idx = match err {
+            StreamError::ReceiveError(..) => 0,
+            StreamError::SendError(..) => 1,
+            StreamError::InvalidPayload(..) => 2,
+            StreamError::Disconnected => 3,
+            StreamError::Io(..) => 4,
+            StreamError::Timeout => 5,
+            StreamError::Poisoned(..) => 6,
+            StreamError::BufferTooSmall => 7,
+            StreamError::InStreaming => 8,
+        };
+        add(&self.0[idx], 1);
+    }
+
+    fn snapshot(&self) -> StreamErrorCounts {
+        let counts = &self.0;
+        StreamErrorCounts {
+            receive_error: load(&counts[0]),
+            send_error: load(&counts[1]),
+            invalid_payload: load(&counts[2]),
+            disconnected: load(&counts[3]),
+            io: load(&counts[4]),
+            timeout: load(&counts[5]),
+            poisoned: load(&counts[6]),
+            buffer_too_small: load(&counts[7]),
+            in_streaming: load(&counts[8]),
+        }
+    }
+}
+
+/// Histogram of latencies with exponential buckets.
+///
+/// The upper bound of the `i`-th bucket is `2^i` microseconds, and the last bucket has no upper
+/// bound.
+#[derive(Debug, Default)]
+pub struct LatencyHistogram {
+    buckets: [AtomicU64; HISTOGRAM_BUCKET_COUNT],
+    sum_nanos: AtomicU64,
+}
+
+impl LatencyHistogram {
+    /// Records `latency`.
+    pub fn record(&self, latency: Duration) {
+        let micros = latency.as_micros();
+        // The smallest `i` with `micros < 2^i`.
+        let idx = (u128::BITS - micros.leading_zeros()) as usize;
+        add(&self.buckets[idx.min(HISTOGRAM_BUCKET_COUNT - 1)], 1);
+        add(
+            &self.sum_nanos,
+            latency.as_nanos().try_into().unwrap_or(u64::MAX),
+        );
+    }
+
+    /// Returns the current counts of the histogram.
+    #[must_use]
+    pub fn snapshot(&self) -> HistogramSnapshot {
+        let mut buckets = [0; HISTOGRAM_BUCKET_COUNT];
+        for (count, bucket) in buckets.iter_mut().zip(&self.buckets) {
+            *count = load(bucket);
+        }
+        HistogramSnapshot {
+            buckets,
+            sum: Duration::from_nanos(load(&self.sum_nanos)),
+        }
+    }
+}
+
+/// Counts of [`LatencyHistogram`] at some point.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct HistogramSnapshot {
+    /// The number of latencies recorded in each bucket, not cumulative.
+    pub buckets: [u64; HISTOGRAM_BUCKET_COUNT],
+
+    /// Sum of all recorded latencies.
+    pub sum: Duration,
+}
+
+impl HistogramSnapshot {
+    /// Returns the upper bound (exclusive) of the `idx`-th bucket, or `None` for the last bucket.
+    #[must_use]
+    pub fn upper_bound(idx: usize) -> Option<Duration> {
+        if idx + 1 < HISTOGRAM_BUCKET_COUNT {
+            Some(Duration::from_micros(1 << idx))
+        } else {
+            None
+        }
+    }
+
+    /// Returns the total number of recorded latencies.
+    #[must_use]
+    pub fn count(&self) -> u64 {
+        self.buckets.iter().sum()
+    }
+
+    /// Returns `(upper_bound, cumulative_count)` of each bucket, which is the form used by
+    /// Prometheus histograms.
+    pub fn cumulative(&self) -> impl Iterator<Item = (Option<Duration>, u64)> + '_ {
+        self.buckets
+            .iter()
+            .enumerate()
+            .scan(0, |acc, (idx, count)| {
+                *acc += count;
+                Some((Self::upper_bound(idx), *acc))
+            })
+    }
+}
+
+fn load(counter: &AtomicU64) -> u64 {
+    counter.load(Ordering::Relaxed)
+}
+
+fn add(counter: &AtomicU64, n: u64) {
+    counter.fetch_add(n, Ordering::Relaxed);
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_histogram() {
+        let histogram = LatencyHistogram::default();
+        histogram.record(Duration::from_nanos(500));
+        histogram.record(Duration::from_micros(1));
+        histogram.record(Duration::from_micros(3));
+        histogram.record(Duration::from_secs(3600));
+
+        let snapshot = histogram.snapshot();
+        assert_eq!(snapshot.count(), 4);
+        assert_eq!(snapshot.buckets[0], 1);
+        assert_eq!(snapshot.buckets[1], 1);
+        assert_eq!(snapshot.buckets[2], 1);
+        assert_eq!(snapshot.buckets[HISTOGRAM_BUCKET_COUNT - 1], 1);
+
+        let cumulative: Vec<_> = snapshot.cumulative().collect();
+        assert_eq!(cumulative[2], (Some(Duration::from_micros(4)), 3));
+        assert_eq!(cumulative[HISTOGRAM_BUCKET_COUNT - 1], (None, 4));
+    }
+
+    #[test]
+    fn test_error_counts() {
+        let stats = StreamStats::default();
+        stats.error(&StreamError::Timeout);
+        stats.error(&StreamError::Timeout);
+        stats.error(&StreamError::Disconnected);
+
+        let errors = stats.snapshot().errors;
+        assert_eq!(errors.timeout, 2);
+        assert_eq!(errors.disconnected, 1);
+        assert_eq!(errors.total(), 3);
+    }
+}
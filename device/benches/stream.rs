@@ -0,0 +1,177 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! Benchmarks of U3V stream leader and trailer parsing.
+
+use cameleon_device::{
+    u3v::protocol::stream::{
+        ChunkLeader, ChunkTrailer, ImageExtendedChunkLeader, ImageExtendedChunkTrailer,
+        ImageLeader, ImageTrailer, Leader, PayloadType, Trailer,
+    },
+    PixelFormat,
+};
+use cameleon_impl::bytes_io::WriteBytes;
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion};
+
+const PAYLOAD_TYPES: [PayloadType; 3] = [
+    PayloadType::Image,
+    PayloadType::ImageExtendedChunk,
+    PayloadType::Chunk,
+];
+
+const WIDTH: u32 = 3840;
+const HEIGHT: u32 = 2160;
+
+fn leader_bytes(payload_type: PayloadType) -> Vec<u8> {
+    let (payload_num, size): (u16, u16) = match payload_type {
+        PayloadType::Image => (0x0001, 52),
+        PayloadType::ImageExtendedChunk => (0x4001, 52),
+        PayloadType::Chunk => (0x4000, 28),
+    };
+
+    let mut buf = vec![];
+    // Leader magic.
+    buf.write_bytes_le(0x4C56_3355_u32).unwrap();
+    // Reserved.
+    buf.write_bytes_le(0_u16).unwrap();
+    // Leader size.
+    buf.write_bytes_le(size).unwrap();
+    // Block ID.
+    buf.write_bytes_le(51_u64).unwrap();
+    // Reserved.
+    buf.write_bytes_le(0_u16).unwrap();
+    // Payload type.
+    buf.write_bytes_le(payload_num).unwrap();
+    // Time stamp.
+    buf.write_bytes_le(100_u64).unwrap();
+
+    if payload_type != PayloadType::Chunk {
+        // Pixel format.
+        buf.write_bytes_le::<u32>(PixelFormat::Mono8.into())
+            .unwrap();
+        // Width.
+        buf.write_bytes_le(WIDTH).unwrap();
+        // Height.
+        buf.write_bytes_le(HEIGHT).unwrap();
+        // X offset.
+        buf.write_bytes_le(0_u32).unwrap();
+        // Y offset.
+        buf.write_bytes_le(0_u32).unwrap();
+        // X padding.
+        buf.write_bytes_le(0_u16).unwrap();
+        // Reserved.
+        buf.write_bytes_le(0_u16).unwrap();
+    }
+    buf
+}
+
+fn trailer_bytes(payload_type: PayloadType) -> Vec<u8> {
+    let size: u16 = match payload_type {
+        PayloadType::Image | PayloadType::Chunk => 32,
+        PayloadType::ImageExtendedChunk => 36,
+    };
+
+    let mut buf = vec![];
+    // Trailer magic.
+    buf.write_bytes_le(0x5456_3355_u32).unwrap();
+    // Reserved.
+    buf.write_bytes_le(0_u16).unwrap();
+    // Trailer size.
+    buf.write_bytes_le(size).unwrap();
+    // Block ID.
+    buf.write_bytes_le(51_u64).unwrap();
+    // Status, Success.
+    buf.write_bytes_le(0_u16).unwrap();
+    // Reserved.
+    buf.write_bytes_le(0_u16).unwrap();
+    // Valid payload size.
+    buf.write_bytes_le(u64::from(WIDTH * HEIGHT)).unwrap();
+
+    match payload_type {
+        PayloadType::Image => {
+            // Actual height.
+            buf.write_bytes_le(HEIGHT).unwrap();
+        }
+        PayloadType::ImageExtendedChunk => {
+            // Actual height.
+            buf.write_bytes_le(HEIGHT).unwrap();
+            // Chunk layout ID.
+            buf.write_bytes_le(1_u32).unwrap();
+        }
+        PayloadType::Chunk => {
+            // Chunk layout ID.
+            buf.write_bytes_le(1_u32).unwrap();
+        }
+    }
+    buf
+}
+
+/// Parses a leader and its specific part as the stream handle does for each payload.
+fn parse_leader(buf: &[u8]) {
+    let leader = Leader::parse(buf).unwrap();
+    match leader.payload_type() {
+        PayloadType::Image => {
+            black_box(leader.specific_leader_as::<ImageLeader>().unwrap());
+        }
+        PayloadType::ImageExtendedChunk => {
+            black_box(
+                leader
+                    .specific_leader_as::<ImageExtendedChunkLeader>()
+                    .unwrap(),
+            );
+        }
+        PayloadType::Chunk => {
+            black_box(leader.specific_leader_as::<ChunkLeader>().unwrap());
+        }
+    }
+}
+
+/// Parses a trailer and its specific part as the stream handle does for each payload.
+fn parse_trailer(buf: &[u8], payload_type: PayloadType) {
+    let trailer = Trailer::parse(buf).unwrap();
+    match payload_type {
+        PayloadType::Image => {
+            black_box(trailer.specific_trailer_as::<ImageTrailer>().unwrap());
+        }
+        PayloadType::ImageExtendedChunk => {
+            black_box(
+                trailer
+                    .specific_trailer_as::<ImageExtendedChunkTrailer>()
+                    .unwrap(),
+            );
+        }
+        PayloadType::Chunk => {
+            black_box(trailer.specific_trailer_as::<ChunkTrailer>().unwrap());
+        }
+    }
+}
+
+fn bench_leader(c: &mut Criterion) {
+    let mut group = c.benchmark_group("leader_parse");
+    for &payload_type in &PAYLOAD_TYPES {
+        let buf = leader_bytes(payload_type);
+        group.bench_with_input(
+            BenchmarkId::from_parameter(format!("{:?}", payload_type)),
+            &buf,
+            |b, buf| b.iter(|| parse_leader(black_box(buf))),
+        );
+    }
+    group.finish();
+}
+
+fn bench_trailer(c: &mut Criterion) {
+    let mut group = c.benchmark_group("trailer_parse");
+    for &payload_type in &PAYLOAD_TYPES {
+        let buf = trailer_bytes(payload_type);
+        group.bench_with_input(
+            BenchmarkId::from_parameter(format!("{:?}", payload_type)),
+            &buf,
+            |b, buf| b.iter(|| parse_trailer(black_box(buf), payload_type)),
+        );
+    }
+    group.finish();
+}
+
+criterion_group!(benches, bench_leader, bench_trailer);
+criterion_main!(benches);
@@ -0,0 +1,529 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+use std::{
+    io,
+    net::{Ipv4Addr, SocketAddrV4, UdpSocket},
+    sync::Mutex,
+    time,
+};
+
+use crate::gige::{Error, Result, GVCP_PORT};
+
+/// `GVCP` channel to a device.
+pub struct ControlChannel {
+    socket: Option<UdpSocket>,
+    device_address: Ipv4Addr,
+    interface_address: Ipv4Addr,
+}
+
+impl ControlChannel {
+    /// Creates a closed channel to the device at `device_address` through the host interface at
+    /// `interface_address`.
+    #[must_use]
+    pub fn new(device_address: Ipv4Addr, interface_address: Ipv4Addr) -> Self {
+        Self {
+            socket: None,
+            device_address,
+            interface_address,
+        }
+    }
+
+    pub fn open(&mut self) -> Result<()> {
+        if !self.is_opened() {
+            let socket = UdpSocket::bind((self.interface_address, 0))?;
+            socket.connect((self.device_address, GVCP_PORT))?;
+            self.socket = Some(socket);
+        }
+
+        Ok(())
+    }
+
+    pub fn close(&mut self) -> Result<()> {
+        self.socket = None;
+        Ok(())
+    }
+
+    #[must_use]
+    pub fn is_opened(&self) -> bool {
+        self.socket.is_some()
+    }
+
+    #[must_use]
+    pub fn device_address(&self) -> Ipv4Addr {
+        self.device_address
+    }
+
+    /// Returns the local address of the channel, i.e. the address of the host interface which
+    /// reaches the device.
+    pub fn local_addr(&self) -> Result<SocketAddrV4> {
+        match self.socket()?.local_addr()? {
+            std::net::SocketAddr::V4(addr) => Ok(addr),
+            std::net::SocketAddr::V6(_) => Err(Error::InvalidDevice),
+        }
+    }
+
+    pub fn send(&self, buf: &[u8]) -> Result<usize> {
+        Ok(self.socket()?.send(buf)?)
+    }
+
+    /// Receives a packet from the device. Returns [`Error::Timeout`] if no packet arrives within
+    /// `timeout`.
+    pub fn recv(&self, buf: &mut [u8], timeout: time::Duration) -> Result<usize> {
+        let socket = self.socket()?;
+        socket.set_read_timeout(Some(non_zero(timeout)))?;
+        socket.recv(buf).map_err(map_timeout)
+    }
+
+    fn socket(&self) -> Result<&UdpSocket> {
+        self.socket
+            .as_ref()
+            .ok_or_else(|| Error::Io(io::Error::new(io::ErrorKind::NotConnected, "not opened")))
+    }
+}
+
+/// `GVSP` channel to receive stream packets from a device.
+///
+/// The channel also sends `PACKETRESEND_CMD` to the device, which doesn't need the control
+/// privilege.
+pub struct StreamChannel {
+    socket: UdpSocket,
+    device_address: SocketAddrV4,
+    /// The last read timeout set to the socket, to avoid a syscall on each receive.
+    read_timeout: Mutex<Option<time::Duration>>,
+}
+
+impl StreamChannel {
+    /// Binds a socket on the host interface at `interface_address` to receive packets from the
+    /// device at `device_address`.
+    pub fn bind(device_address: Ipv4Addr, interface_address: Ipv4Addr) -> Result<Self> {
+        let socket = UdpSocket::bind((interface_address, 0))?;
+        Ok(Self {
+            socket,
+            device_address: SocketAddrV4::new(device_address, GVCP_PORT),
+            read_timeout: Mutex::new(None),
+        })
+    }
+
+    /// Returns the local address which the device sends stream packets to.
+    pub fn local_addr(&self) -> Result<SocketAddrV4> {
+        match self.socket.local_addr()? {
+            std::net::SocketAddr::V4(addr) => Ok(addr),
+            std::net::SocketAddr::V6(_) => Err(Error::InvalidDevice),
+        }
+    }
+
+    /// Sets the size of the socket receive buffer, and returns the size actually set.
+    ///
+    /// A large buffer is necessary to absorb bursts of a high bandwidth stream while the
+    /// receiver is busy. The size may be capped by the system, e.g. `net.core.rmem_max` on
+    /// Linux, which [`SO_RCVBUFFORCE`] bypasses if the process has `CAP_NET_ADMIN`.
+    ///
+    /// Returns 0 on the platforms which don't support the option.
+    ///
+    /// [`SO_RCVBUFFORCE`]: https://man7.org/linux/man-pages/man7/socket.7.html
+    pub fn set_recv_buffer_size(&self, size: usize) -> Result<usize> {
+        sys::set_recv_buffer_size(&self.socket, size)
+    }
+
+    /// Sends a `GVCP` command to the device without waiting for an ack.
+    pub fn send_to_device(&self, buf: &[u8]) -> Result<usize> {
+        Ok(self.socket.send_to(buf, self.device_address)?)
+    }
+
+    /// Receives packets into `batch`, and returns the number of received packets.
+    ///
+    /// Waits up to `timeout` for the first packet, then takes packets already queued in the
+    /// socket without waiting until `batch` is full. On Linux, all packets are received by a
+    /// single `recvmmsg` call. Returns 0 if no packet arrives within `timeout`.
+    ///
+    /// Packets sent from other hosts than the device are dropped, so the returned number may be
+    /// 0 even before `timeout` elapses.
+    pub fn recv_batch(&self, batch: &mut PacketBatch, timeout: time::Duration) -> Result<usize> {
+        self.set_read_timeout(timeout)?;
+        batch.clear();
+        match sys::recv_batch(&self.socket, batch, *self.device_address.ip()) {
+            Ok(()) => Ok(batch.len()),
+            Err(err) => match map_timeout(err) {
+                Error::Timeout => Ok(0),
+                err => Err(err),
+            },
+        }
+    }
+
+    fn set_read_timeout(&self, timeout: time::Duration) -> Result<()> {
+        let timeout = non_zero(timeout);
+        let mut current = self.read_timeout.lock().unwrap();
+        if *current != Some(timeout) {
+            self.socket.set_read_timeout(Some(timeout))?;
+            *current = Some(timeout);
+        }
+        Ok(())
+    }
+}
+
+/// Fixed size slots to receive packets in a batch.
+pub struct PacketBatch {
+    buf: Vec<u8>,
+    slot_len: usize,
+    lens: Vec<usize>,
+    #[cfg(target_os = "linux")]
+    scratch: sys::Scratch,
+}
+
+impl PacketBatch {
+    /// Creates a batch of `capacity` slots, each of which holds a packet up to `slot_len` bytes.
+    /// A longer packet is truncated.
+    ///
+    /// # Panics
+    /// If `capacity` or `slot_len` is zero, this method will panic.
+    #[must_use]
+    pub fn new(capacity: usize, slot_len: usize) -> Self {
+        assert!(capacity > 0 && slot_len > 0);
+        Self {
+            buf: vec![0; capacity * slot_len],
+            slot_len,
+            lens: Vec::with_capacity(capacity),
+            #[cfg(target_os = "linux")]
+            scratch: sys::Scratch::new(capacity),
+        }
+    }
+
+    /// Maximum number of packets in the batch.
+    #[must_use]
+    pub fn capacity(&self) -> usize {
+        self.buf.len() / self.slot_len
+    }
+
+    /// Maximum length of a packet.
+    #[must_use]
+    pub fn slot_len(&self) -> usize {
+        self.slot_len
+    }
+
+    /// The number of packets in the batch.
+    #[must_use]
+    pub fn len(&self) -> usize {
+        self.lens.len()
+    }
+
+    #[must_use]
+    pub fn is_empty(&self) -> bool {
+        self.lens.is_empty()
+    }
+
+    /// Returns the `i`-th packet.
+    #[must_use]
+    pub fn get(&self, i: usize) -> Option<&[u8]> {
+        let len = *self.lens.get(i)?;
+        let start = i * self.slot_len;
+        Some(&self.buf[start..start + len])
+    }
+
+    /// Returns packets in the order of arrival.
+    pub fn packets(&self) -> impl Iterator<Item = &[u8]> {
+        self.buf
+            .chunks_exact(self.slot_len)
+            .zip(&self.lens)
+            .map(|(slot, len)| &slot[..*len])
+    }
+
+    /// Copies `packet` to the next slot. Returns `false` if the batch is full.
+    pub fn push(&mut self, packet: &[u8]) -> bool {
+        let i = self.len();
+        if i == self.capacity() {
+            return false;
+        }
+        let len = std::cmp::min(packet.len(), self.slot_len);
+        let start = i * self.slot_len;
+        self.buf[start..start + len].copy_from_slice(&packet[..len]);
+        self.lens.push(len);
+        true
+    }
+
+    pub fn clear(&mut self) {
+        self.lens.clear();
+    }
+}
+
+fn non_zero(timeout: time::Duration) -> time::Duration {
+    // A zero timeout is rejected by the socket.
+    std::cmp::max(timeout, time::Duration::from_micros(1))
+}
+
+fn map_timeout(err: io::Error) -> Error {
+    match err.kind() {
+        io::ErrorKind::WouldBlock | io::ErrorKind::TimedOut => Error::Timeout,
+        _ => Error::Io(err),
+    }
+}
+
+#[cfg(target_os = "linux")]
+mod sys {
+    use std::{
+        io,
+        net::{Ipv4Addr, UdpSocket},
+        os::unix::io::AsRawFd,
+    };
+
+    use super::PacketBatch;
+    use crate::gige::Result;
+
+    /// `recvmmsg` headers, which are rebuilt on each call so that they never refer to a moved
+    /// batch.
+    pub(super) struct Scratch {
+        msgs: Vec<libc::mmsghdr>,
+        iovecs: Vec<libc::iovec>,
+        /// Source addresses of received packets.
+        addrs: Vec<libc::sockaddr_in>,
+    }
+
+    // SAFETY: The raw pointers in the headers are only dereferenced by `recvmmsg` during
+    // `recv_batch`, which updates them to point to the buffer of the batch beforehand.
+    unsafe impl Send for Scratch {}
+    unsafe impl Sync for Scratch {}
+
+    impl Scratch {
+        pub(super) fn new(capacity: usize) -> Self {
+            Self {
+                // SAFETY: All-zero `mmsghdr` and `iovec` are valid empty headers.
+                msgs: vec![unsafe { std::mem::zeroed() }; capacity],
+                iovecs: vec![unsafe { std::mem::zeroed() }; capacity],
+                // SAFETY: All-zero `sockaddr_in` is a valid address.
+                addrs: vec![unsafe { std::mem::zeroed() }; capacity],
+            }
+        }
+    }
+
+    pub(super) fn recv_batch(
+        socket: &UdpSocket,
+        batch: &mut PacketBatch,
+        device_address: Ipv4Addr,
+    ) -> io::Result<()> {
+        let capacity = batch.capacity();
+        let slot_len = batch.slot_len;
+        let base = batch.buf.as_mut_ptr();
+        let scratch = &mut batch.scratch;
+        for i in 0..capacity {
+            let iov = &mut scratch.iovecs[i];
+            // SAFETY: Each slot lies within `buf`.
+            iov.iov_base = unsafe { base.add(i * slot_len) }.cast();
+            iov.iov_len = slot_len;
+
+            let hdr = &mut scratch.msgs[i].msg_hdr;
+            hdr.msg_name = (&mut scratch.addrs[i] as *mut libc::sockaddr_in).cast();
+            hdr.msg_namelen = std::mem::size_of::<libc::sockaddr_in>() as libc::socklen_t;
+            hdr.msg_iov = iov;
+            hdr.msg_iovlen = 1;
+            hdr.msg_control = std::ptr::null_mut();
+            hdr.msg_controllen = 0;
+            hdr.msg_flags = 0;
+            scratch.msgs[i].msg_len = 0;
+        }
+
+        // The read timeout of the socket applies to the first packet, then `MSG_WAITFORONE`
+        // returns as soon as no more packet is queued.
+        // SAFETY: `msgs` has `capacity` headers, which point to valid slots.
+        let received = unsafe {
+            libc::recvmmsg(
+                socket.as_raw_fd(),
+                scratch.msgs.as_mut_ptr(),
+                capacity as libc::c_uint,
+                libc::MSG_WAITFORONE,
+                std::ptr::null_mut(),
+            )
+        };
+        if received < 0 {
+            return Err(io::Error::last_os_error());
+        }
+
+        let device_address = u32::from(device_address).to_be();
+        for i in 0..received as usize {
+            let addr = &scratch.addrs[i];
+            if i32::from(addr.sin_family) != libc::AF_INET || addr.sin_addr.s_addr != device_address
+            {
+                continue;
+            }
+            // Move the packet next to the accepted ones to keep the slots contiguous.
+            let len = std::cmp::min(scratch.msgs[i].msg_len as usize, slot_len);
+            let slot = batch.lens.len();
+            if slot != i {
+                batch
+                    .buf
+                    .copy_within(i * slot_len..i * slot_len + len, slot * slot_len);
+            }
+            batch.lens.push(len);
+        }
+        Ok(())
+    }
+
+    pub(super) fn set_recv_buffer_size(socket: &UdpSocket, size: usize) -> Result<usize> {
+        let fd = socket.as_raw_fd();
+        let value = size.min(libc::c_int::MAX as usize) as libc::c_int;
+        // `SO_RCVBUFFORCE` ignores `net.core.rmem_max`, but needs `CAP_NET_ADMIN`.
+        if setsockopt(fd, libc::SO_RCVBUFFORCE, value).is_err() {
+            setsockopt(fd, libc::SO_RCVBUF, value)?;
+        }
+
+        let mut actual: libc::c_int = 0;
+        let mut len = std::mem::size_of::<libc::c_int>() as libc::socklen_t;
+        // SAFETY: `actual` and `len` are valid for writes.
+        let ret = unsafe {
+            libc::getsockopt(
+                fd,
+                libc::SOL_SOCKET,
+                libc::SO_RCVBUF,
+                (&mut actual as *mut libc::c_int).cast(),
+                &mut len,
+            )
+        };
+        if ret < 0 {
+            return Err(io::Error::last_os_error().into());
+        }
+        // Linux doubles the value for bookkeeping overhead.
+        Ok(actual as usize / 2)
+    }
+
+    fn setsockopt(fd: libc::c_int, opt: libc::c_int, value: libc::c_int) -> io::Result<()> {
+        // SAFETY: `value` is a valid `c_int`.
+        let ret = unsafe {
+            libc::setsockopt(
+                fd,
+                libc::SOL_SOCKET,
+                opt,
+                (&value as *const libc::c_int).cast(),
+                std::mem::size_of::<libc::c_int>() as libc::socklen_t,
+            )
+        };
+        if ret < 0 {
+            Err(io::Error::last_os_error())
+        } else {
+            Ok(())
+        }
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+mod sys {
+    use std::{
+        io,
+        net::{IpAddr, Ipv4Addr, UdpSocket},
+    };
+
+    use super::PacketBatch;
+    use crate::gige::Result;
+
+    /// Receives a packet per call.
+    pub(super) fn recv_batch(
+        socket: &UdpSocket,
+        batch: &mut PacketBatch,
+        device_address: Ipv4Addr,
+    ) -> io::Result<()> {
+        let slot_len = batch.slot_len;
+        let (len, src) = socket.recv_from(&mut batch.buf[..slot_len])?;
+        if src.ip() == IpAddr::V4(device_address) {
+            batch.lens.push(len);
+        }
+        Ok(())
+    }
+
+    #[cfg(unix)]
+    pub(super) fn set_recv_buffer_size(socket: &UdpSocket, size: usize) -> Result<usize> {
+        use std::os::unix::io::AsRawFd;
+
+        let fd = socket.as_raw_fd();
+        let value = size.min(libc::c_int::MAX as usize) as libc::c_int;
+        // SAFETY: `value` is a valid `c_int`.
+        let ret = unsafe {
+            libc::setsockopt(
+                fd,
+                libc::SOL_SOCKET,
+                libc::SO_RCVBUF,
+                (&value as *const libc::c_int).cast(),
+                std::mem::size_of::<libc::c_int>() as libc::socklen_t,
+            )
+        };
+        if ret < 0 {
+            return Err(io::Error::last_os_error().into());
+        }
+        Ok(size)
+    }
+
+    #[cfg(not(unix))]
+    pub(super) fn set_recv_buffer_size(_socket: &UdpSocket, _size: usize) -> Result<usize> {
+        Ok(0)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_packet_batch() {
+        let mut batch = PacketBatch::new(2, 4);
+        assert!(batch.is_empty());
+        assert!(batch.push(&[1, 2]));
+        // Truncated to the slot length.
+        assert!(batch.push(&[3, 4, 5, 6, 7]));
+        assert!(!batch.push(&[8]));
+
+        let packets: Vec<_> = batch.packets().collect();
+        assert_eq!(packets, [&[1, 2][..], &[3, 4, 5, 6][..]]);
+        assert_eq!(batch.get(1), Some(&[3, 4, 5, 6][..]));
+        assert_eq!(batch.get(2), None);
+
+        batch.clear();
+        assert!(batch.is_empty());
+    }
+
+    #[test]
+    fn test_recv_batch() {
+        let strm = StreamChannel::bind(Ipv4Addr::LOCALHOST, Ipv4Addr::LOCALHOST).unwrap();
+        let dst = strm.local_addr().unwrap();
+        let sender = UdpSocket::bind((Ipv4Addr::LOCALHOST, 0)).unwrap();
+        for i in 0..3_u8 {
+            sender.send_to(&[i; 16], dst).unwrap();
+        }
+
+        let mut batch = PacketBatch::new(8, 64);
+        let mut received = vec![];
+        while received.len() < 3 {
+            let n = strm
+                .recv_batch(&mut batch, time::Duration::from_secs(1))
+                .unwrap();
+            assert_ne!(n, 0);
+            received.extend(batch.packets().map(<[u8]>::to_vec));
+        }
+        assert_eq!(received, [[0; 16], [1; 16], [2; 16]]);
+
+        // Returns 0 on timeout.
+        let n = strm
+            .recv_batch(&mut batch, time::Duration::from_millis(10))
+            .unwrap();
+        assert_eq!(n, 0);
+    }
+
+    #[test]
+    fn test_drop_packets_from_other_hosts() {
+        let device_address = Ipv4Addr::new(127, 0, 0, 2);
+        let strm = StreamChannel::bind(device_address, Ipv4Addr::LOCALHOST).unwrap();
+        let dst = strm.local_addr().unwrap();
+        let other = UdpSocket::bind((Ipv4Addr::LOCALHOST, 0)).unwrap();
+        let device = UdpSocket::bind((device_address, 0)).unwrap();
+        other.send_to(&[0; 16], dst).unwrap();
+        device.send_to(&[1; 16], dst).unwrap();
+        other.send_to(&[2; 16], dst).unwrap();
+
+        let mut batch = PacketBatch::new(8, 64);
+        let mut received = vec![];
+        // Dropped packets may make a receive return nothing before the timeout.
+        for _ in 0..3 {
+            strm.recv_batch(&mut batch, time::Duration::from_millis(100))
+                .unwrap();
+            received.extend(batch.packets().map(<[u8]>::to_vec));
+        }
+        assert_eq!(received, [[1; 16]]);
+    }
+}
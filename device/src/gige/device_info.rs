@@ -0,0 +1,96 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+use std::{fmt, net::Ipv4Addr};
+
+use semver::Version;
+
+/// Device information in the `DISCOVERY_ACK` of the device.
+#[derive(Clone, Debug)]
+pub struct DeviceInfo {
+    /// GigE Vision version the device provides.
+    pub gev_version: Version,
+
+    /// MAC address of the network interface of the device.
+    pub mac_address: [u8; 6],
+
+    /// Current IP address of the device.
+    pub ip_address: Ipv4Addr,
+
+    /// Current subnet mask of the device.
+    pub subnet_mask: Ipv4Addr,
+
+    /// Current default gateway of the device.
+    pub default_gateway: Ipv4Addr,
+
+    /// Address of the host interface which the device is found on.
+    pub interface_address: Ipv4Addr,
+
+    /// Manufacturer name of the device.
+    pub vendor_name: String,
+
+    /// Model name of the device.
+    pub model_name: String,
+
+    /// Manufacturer specific device version.
+    /// An application can't make any assumptions of this version.
+    pub device_version: String,
+
+    /// Manufacturer specific information.
+    pub manufacturer_info: String,
+
+    /// Serial number of the device.
+    pub serial_number: String,
+
+    /// User defined name.
+    /// This field is optional.
+    pub user_defined_name: Option<String>,
+}
+
+impl DeviceInfo {
+    /// Returns the MAC address formatted as `xx:xx:xx:xx:xx:xx`.
+    #[must_use]
+    pub fn mac_address_string(&self) -> String {
+        let octets: Vec<_> = self
+            .mac_address
+            .iter()
+            .map(|b| format!("{:02x}", b))
+            .collect();
+        octets.join(":")
+    }
+}
+
+impl fmt::Display for DeviceInfo {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        writeln!(f, "### Device Information ###")?;
+
+        writeln!(f, "GigE Vision Version: {}", self.gev_version)?;
+
+        writeln!(f, "MAC Address: {}", self.mac_address_string())?;
+
+        writeln!(f, "IP Address: {}", self.ip_address)?;
+
+        writeln!(f, "Subnet Mask: {}", self.subnet_mask)?;
+
+        writeln!(f, "Default Gateway: {}", self.default_gateway)?;
+
+        writeln!(f, "Vendor Name: {}", self.vendor_name)?;
+
+        writeln!(f, "Model Name: {}", self.model_name)?;
+
+        writeln!(f, "Device Version: {}", self.device_version)?;
+
+        writeln!(f, "Manufacturer Information: {}", self.manufacturer_info)?;
+
+        writeln!(f, "Serial Number: {}", self.serial_number)?;
+
+        if let Some(user_defined_name) = &self.user_defined_name {
+            write!(f, "User Defined Name: {}", user_defined_name)
+        } else {
+            write!(f, "User Defined Name: N/A")
+        }?;
+
+        Ok(())
+    }
+}
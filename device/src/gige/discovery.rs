@@ -0,0 +1,155 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+use std::{
+    net::{Ipv4Addr, UdpSocket},
+    time::{Duration, Instant},
+};
+
+use log::warn;
+
+use super::{
+    protocol::{ack, cmd, cmd::CommandScd},
+    DeviceInfo, Error, Result, GVCP_PORT,
+};
+
+/// Time to wait for `DISCOVERY_ACK`s in [`enumerate_devices`].
+const DEFAULT_DISCOVERY_TIMEOUT: Duration = Duration::from_millis(500);
+
+/// Enumerate `GigE Vision` devices reachable from IPv4 interfaces of the host.
+pub fn enumerate_devices() -> Result<Vec<DeviceInfo>> {
+    enumerate_devices_with_timeout(DEFAULT_DISCOVERY_TIMEOUT)
+}
+
+/// Enumerate `GigE Vision` devices like [`enumerate_devices`], waiting for answers of devices up
+/// to `timeout`.
+///
+/// A device reachable from multiple interfaces is listed once.
+pub fn enumerate_devices_with_timeout(timeout: Duration) -> Result<Vec<DeviceInfo>> {
+    let mut sockets = vec![];
+    for iface in ipv4_interfaces() {
+        match broadcast_discovery(iface) {
+            Ok(socket) => sockets.push((iface.address, socket)),
+            Err(err) => warn!("failed to send discovery on {}: {}", iface.address, err),
+        }
+    }
+
+    let deadline = Instant::now() + timeout;
+    let mut devices: Vec<DeviceInfo> = vec![];
+    let mut buf = vec![0; 576];
+    // Acks for the other sockets are queued while waiting on a socket, so each socket is polled
+    // until the common deadline.
+    for (interface_address, socket) in sockets {
+        loop {
+            let remaining = deadline.saturating_duration_since(Instant::now());
+            socket.set_read_timeout(Some(std::cmp::max(remaining, Duration::from_millis(1))))?;
+            let len = match socket.recv(&mut buf) {
+                Ok(len) => len,
+                Err(_) => break,
+            };
+
+            let info = match parse_discovery_ack(&buf[..len], interface_address) {
+                Ok(info) => info,
+                Err(err) => {
+                    warn!("skip invalid discovery ack: {}", err);
+                    continue;
+                }
+            };
+            if devices.iter().all(|dev| dev.mac_address != info.mac_address) {
+                devices.push(info);
+            }
+        }
+    }
+
+    Ok(devices)
+}
+
+fn parse_discovery_ack(buf: &[u8], interface_address: Ipv4Addr) -> Result<DeviceInfo> {
+    let ack = ack::AckPacket::parse(buf)?;
+    if ack.scd_kind() != ack::ScdKind::Discovery || !ack.status().is_success() {
+        return Err(Error::InvalidPacket("not a successful discovery ack".into()));
+    }
+    let discovery: ack::Discovery = ack.scd_as()?;
+    Ok(discovery.into_device_info(interface_address))
+}
+
+fn broadcast_discovery(iface: Interface) -> Result<UdpSocket> {
+    let socket = UdpSocket::bind((iface.address, 0))?;
+    socket.set_broadcast(true)?;
+
+    let cmd = cmd::Discovery::new(true).finalize(1);
+    let mut buf = Vec::with_capacity(cmd.cmd_len());
+    cmd.serialize(&mut buf)?;
+
+    // The directed broadcast goes out of the interface, and the limited broadcast reaches devices
+    // whose IP address is not in the subnet of the interface.
+    socket.send_to(&buf, (iface.broadcast, GVCP_PORT))?;
+    if iface.broadcast != Ipv4Addr::BROADCAST {
+        socket.send_to(&buf, (Ipv4Addr::BROADCAST, GVCP_PORT)).ok();
+    }
+    Ok(socket)
+}
+
+#[derive(Clone, Copy, Debug)]
+struct Interface {
+    address: Ipv4Addr,
+    broadcast: Ipv4Addr,
+}
+
+/// Returns IPv4 interfaces which are up, except loopback.
+#[cfg(unix)]
+fn ipv4_interfaces() -> Vec<Interface> {
+    let mut interfaces = vec![];
+    let mut ifap: *mut libc::ifaddrs = std::ptr::null_mut();
+    // SAFETY: `ifap` is freed by `freeifaddrs` below.
+    if unsafe { libc::getifaddrs(&mut ifap) } != 0 {
+        warn!("getifaddrs failed: {}", std::io::Error::last_os_error());
+        return interfaces;
+    }
+
+    let mut cur = ifap;
+    while !cur.is_null() {
+        // SAFETY: `cur` is a valid entry of the list returned by `getifaddrs`.
+        let ifa = unsafe { &*cur };
+        cur = ifa.ifa_next;
+
+        let flags = ifa.ifa_flags as libc::c_int;
+        if flags & libc::IFF_UP == 0 || flags & libc::IFF_LOOPBACK != 0 {
+            continue;
+        }
+        // SAFETY: `ifa_addr` and `ifa_netmask` point to `sockaddr_in` if the family is `AF_INET`.
+        let (address, netmask) = unsafe {
+            if ifa.ifa_addr.is_null()
+                || ifa.ifa_netmask.is_null()
+                || i32::from((*ifa.ifa_addr).sa_family) != libc::AF_INET
+            {
+                continue;
+            }
+            let addr = &*(ifa.ifa_addr as *const libc::sockaddr_in);
+            let mask = &*(ifa.ifa_netmask as *const libc::sockaddr_in);
+            (
+                u32::from_be(addr.sin_addr.s_addr),
+                u32::from_be(mask.sin_addr.s_addr),
+            )
+        };
+
+        interfaces.push(Interface {
+            address: address.into(),
+            broadcast: (address | !netmask).into(),
+        });
+    }
+
+    // SAFETY: `ifap` is returned by `getifaddrs`.
+    unsafe { libc::freeifaddrs(ifap) };
+    interfaces
+}
+
+/// Falls back to the default interface of the system.
+#[cfg(not(unix))]
+fn ipv4_interfaces() -> Vec<Interface> {
+    vec![Interface {
+        address: Ipv4Addr::UNSPECIFIED,
+        broadcast: Ipv4Addr::BROADCAST,
+    }]
+}
@@ -0,0 +1,49 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! Protocol decoders and UDP channels for `GigE Vision` devices.
+//!
+//! `GVCP`, the control protocol, is implemented in [`protocol::cmd`] and [`protocol::ack`].
+//! `GVSP`, the stream protocol, is implemented in [`protocol::stream`].
+
+pub mod protocol;
+pub mod register_map;
+pub mod prelude {
+    pub use protocol::ack::ParseScd;
+    pub use protocol::cmd::CommandScd;
+
+    use super::protocol;
+}
+
+mod channel;
+mod device_info;
+mod discovery;
+
+pub use channel::{ControlChannel, PacketBatch, StreamChannel};
+pub use device_info::DeviceInfo;
+pub use discovery::{enumerate_devices, enumerate_devices_with_timeout};
+
+use std::borrow::Cow;
+
+use thiserror::Error;
+
+/// UDP port of `GVCP` on the device side.
+pub const GVCP_PORT: u16 = 3956;
+
+#[derive(Debug, Error)]
+pub enum Error {
+    #[error("socket io error: {0}")]
+    Io(#[from] std::io::Error),
+
+    #[error("packet is broken: {0}")]
+    InvalidPacket(Cow<'static, str>),
+
+    #[error("operation timed out")]
+    Timeout,
+
+    #[error("device doesn't follow the specification")]
+    InvalidDevice,
+}
+
+pub type Result<T> = std::result::Result<T, Error>;
@@ -0,0 +1,530 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! `GVCP` ack packets. All fields of `GVCP` are big endian.
+
+use std::{io::Cursor, net::Ipv4Addr, time};
+
+use cameleon_impl::bytes_io::ReadBytes;
+use semver::Version;
+
+use crate::gige::{DeviceInfo, Error, Result};
+
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct AckPacket<'a> {
+    header: AckHeader,
+    raw_scd: &'a [u8],
+}
+
+impl<'a> AckPacket<'a> {
+    pub fn parse(buf: &'a (impl AsRef<[u8]> + ?Sized)) -> Result<Self> {
+        let mut cursor = Cursor::new(buf.as_ref());
+        let header = AckHeader::parse(&mut cursor)?;
+
+        let raw_scd = &cursor.get_ref()[cursor.position() as usize..];
+        if raw_scd.len() < header.scd_len as usize {
+            return Err(Error::InvalidPacket(
+                "ack payload is smaller than specified length in the header".into(),
+            ));
+        }
+        let raw_scd = &raw_scd[..header.scd_len as usize];
+        Ok(Self { header, raw_scd })
+    }
+
+    #[must_use]
+    pub fn scd_kind(&self) -> ScdKind {
+        self.header.scd_kind
+    }
+
+    #[must_use]
+    pub fn header(&self) -> &AckHeader {
+        &self.header
+    }
+
+    #[must_use]
+    pub fn raw_scd(&self) -> &'a [u8] {
+        self.raw_scd
+    }
+
+    pub fn scd_as<T: ParseScd<'a>>(&self) -> Result<T> {
+        T::parse(self.raw_scd, &self.header)
+    }
+
+    #[must_use]
+    pub fn status(&self) -> Status {
+        self.header.status
+    }
+
+    #[must_use]
+    pub fn request_id(&self) -> u16 {
+        self.header.request_id
+    }
+}
+
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct AckHeader {
+    pub(crate) status: Status,
+    pub(crate) scd_kind: ScdKind,
+    pub(crate) scd_len: u16,
+    pub(crate) request_id: u16,
+}
+
+impl AckHeader {
+    #[must_use]
+    pub fn status(&self) -> Status {
+        self.status
+    }
+
+    #[must_use]
+    pub fn scd_kind(&self) -> ScdKind {
+        self.scd_kind
+    }
+
+    #[must_use]
+    pub fn request_id(&self) -> u16 {
+        self.request_id
+    }
+
+    #[must_use]
+    pub fn scd_len(&self) -> u16 {
+        self.scd_len
+    }
+
+    fn parse(cursor: &mut Cursor<&[u8]>) -> Result<Self> {
+        let status = Status::parse(cursor)?;
+        let scd_kind = ScdKind::parse(cursor)?;
+        let scd_len = cursor.read_bytes_be()?;
+        let request_id = cursor.read_bytes_be()?;
+
+        Ok(Self {
+            status,
+            scd_kind,
+            scd_len,
+            request_id,
+        })
+    }
+}
+
+/// Status code of `GVCP` acks and `GVSP` packets.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct Status {
+    pub(crate) code: u16,
+    pub(crate) kind: StatusKind,
+}
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum StatusKind {
+    /// Success.
+    Success,
+
+    /// The stream packet is resent in response to `PACKETRESEND_CMD`.
+    PacketResend,
+
+    /// Command not implemented in the device.
+    NotImplemented,
+
+    /// Command parameter is invalid.
+    InvalidParameter,
+
+    /// Attempt to access an address that doesn't exist.
+    InvalidAddress,
+
+    /// Attempt to write to a read only address.
+    WriteProtect,
+
+    /// Attempt to access an address with bad alignment.
+    BadAlignment,
+
+    /// Attempt to access an address without the privilege.
+    AccessDenied,
+
+    /// The command receiver is busy.
+    Busy,
+
+    /// The requested resend packet is not available anymore.
+    PacketUnavailable,
+
+    /// Internal memory of the device has overrun, e.g. the stream data is lost.
+    DataOverrun,
+
+    /// Header is inconsistent with data.
+    InvalidHeader,
+
+    /// The device configuration does not allow the execution of the command.
+    WrongConfig,
+
+    /// The requested resend packet has not been acquired yet.
+    PacketNotYetAvailable,
+
+    /// The requested resend packet has been removed from the device memory.
+    PacketRemovedFromMemory,
+
+    /// Device specific status.
+    DeviceSpecific,
+
+    /// Generic error, or a code not listed above.
+    GenericError,
+}
+
+impl Status {
+    #[must_use]
+    pub fn is_success(self) -> bool {
+        matches!(self.kind, StatusKind::Success | StatusKind::PacketResend)
+    }
+
+    #[must_use]
+    pub fn is_fatal(self) -> bool {
+        self.code >> 15_i32 == 1
+    }
+
+    #[must_use]
+    pub fn code(self) -> u16 {
+        self.code
+    }
+
+    #[must_use]
+    pub fn kind(self) -> StatusKind {
+        self.kind
+    }
+
+    pub(crate) fn parse(cursor: &mut Cursor<&[u8]>) -> Result<Self> {
+        use StatusKind::{
+            AccessDenied, BadAlignment, Busy, DataOverrun, DeviceSpecific, GenericError,
+            InvalidAddress, InvalidHeader, InvalidParameter, NotImplemented, PacketNotYetAvailable,
+            PacketRemovedFromMemory, PacketResend, PacketUnavailable, Success, WriteProtect,
+            WrongConfig,
+        };
+
+        let code: u16 = cursor.read_bytes_be()?;
+        let kind = match code {
+            0x0000 => Success,
+            0x0100 => PacketResend,
+            0x8001 => NotImplemented,
+            0x8002 => InvalidParameter,
+            0x8003 => InvalidAddress,
+            0x8004 => WriteProtect,
+            0x8005 => BadAlignment,
+            0x8006 => AccessDenied,
+            0x8007 => Busy,
+            0x800C => PacketUnavailable,
+            0x800D => DataOverrun,
+            0x800E => InvalidHeader,
+            0x800F => WrongConfig,
+            0x8010 => PacketNotYetAvailable,
+            0x8011 | 0x8012 => PacketRemovedFromMemory,
+            // Bit 14 indicates device specific status.
+            _ if code & 0x4000 != 0 => DeviceSpecific,
+            _ => GenericError,
+        };
+
+        Ok(Self { code, kind })
+    }
+}
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum ScdKind {
+    Discovery,
+    ReadReg,
+    WriteReg,
+    ReadMem,
+    WriteMem,
+    Pending,
+}
+
+impl ScdKind {
+    fn parse(cursor: &mut Cursor<&[u8]>) -> Result<Self> {
+        let id: u16 = cursor.read_bytes_be()?;
+        match id {
+            0x0003 => Ok(ScdKind::Discovery),
+            0x0081 => Ok(ScdKind::ReadReg),
+            0x0083 => Ok(ScdKind::WriteReg),
+            0x0085 => Ok(ScdKind::ReadMem),
+            0x0087 => Ok(ScdKind::WriteMem),
+            0x0089 => Ok(ScdKind::Pending),
+            _ => Err(Error::InvalidPacket(
+                format!("unknown ack id {:#X}", id).into(),
+            )),
+        }
+    }
+}
+
+pub trait ParseScd<'a>: Sized {
+    fn parse(buf: &'a [u8], header: &AckHeader) -> Result<Self>;
+}
+
+pub struct Discovery {
+    pub gev_version: Version,
+    pub device_mode: u32,
+    pub mac_address: [u8; 6],
+    pub ip_address: Ipv4Addr,
+    pub subnet_mask: Ipv4Addr,
+    pub default_gateway: Ipv4Addr,
+    pub vendor_name: String,
+    pub model_name: String,
+    pub device_version: String,
+    pub manufacturer_info: String,
+    pub serial_number: String,
+    pub user_defined_name: String,
+}
+
+impl Discovery {
+    pub(crate) const SCD_LENGTH: u16 = 248;
+
+    /// Converts into [`DeviceInfo`] of the device found on `interface_address`.
+    #[must_use]
+    pub fn into_device_info(self, interface_address: Ipv4Addr) -> DeviceInfo {
+        DeviceInfo {
+            gev_version: self.gev_version,
+            mac_address: self.mac_address,
+            ip_address: self.ip_address,
+            subnet_mask: self.subnet_mask,
+            default_gateway: self.default_gateway,
+            interface_address,
+            vendor_name: self.vendor_name,
+            model_name: self.model_name,
+            device_version: self.device_version,
+            manufacturer_info: self.manufacturer_info,
+            serial_number: self.serial_number,
+            user_defined_name: if self.user_defined_name.is_empty() {
+                None
+            } else {
+                Some(self.user_defined_name)
+            },
+        }
+    }
+}
+
+pub struct ReadReg<'a> {
+    data: &'a [u8],
+}
+
+impl<'a> ReadReg<'a> {
+    /// Returns values of the registers in the order of the command.
+    pub fn values(&self) -> impl Iterator<Item = u32> + 'a {
+        self.data
+            .chunks_exact(4)
+            .map(|b| u32::from_be_bytes([b[0], b[1], b[2], b[3]]))
+    }
+}
+
+pub struct WriteReg {
+    /// The number of registers written successfully.
+    pub index: u16,
+}
+
+pub struct ReadMem<'a> {
+    pub address: u32,
+    pub data: &'a [u8],
+}
+
+pub struct WriteMem {
+    /// The number of bytes written successfully.
+    pub index: u16,
+}
+
+pub struct Pending {
+    pub timeout: time::Duration,
+}
+
+impl<'a> ParseScd<'a> for Discovery {
+    fn parse(buf: &'a [u8], _header: &AckHeader) -> Result<Self> {
+        if buf.len() < Self::SCD_LENGTH as usize {
+            return Err(Error::InvalidPacket("discovery ack is too short".into()));
+        }
+        let mut cursor = Cursor::new(buf);
+
+        let major: u16 = cursor.read_bytes_be()?;
+        let minor: u16 = cursor.read_bytes_be()?;
+        let device_mode = cursor.read_bytes_be()?;
+        // Reserved.
+        let _: u16 = cursor.read_bytes_be()?;
+        let mac_high: u16 = cursor.read_bytes_be()?;
+        let mac_low: u32 = cursor.read_bytes_be()?;
+        let mut mac_address = [0; 6];
+        mac_address[..2].copy_from_slice(&mac_high.to_be_bytes());
+        mac_address[2..].copy_from_slice(&mac_low.to_be_bytes());
+
+        let ip_of = |offset: usize| {
+            Ipv4Addr::new(buf[offset], buf[offset + 1], buf[offset + 2], buf[offset + 3])
+        };
+
+        Ok(Self {
+            gev_version: Version::new(major.into(), minor.into(), 0),
+            device_mode,
+            mac_address,
+            ip_address: ip_of(36),
+            subnet_mask: ip_of(52),
+            default_gateway: ip_of(68),
+            vendor_name: parse_string(&buf[72..104]),
+            model_name: parse_string(&buf[104..136]),
+            device_version: parse_string(&buf[136..168]),
+            manufacturer_info: parse_string(&buf[168..216]),
+            serial_number: parse_string(&buf[216..232]),
+            user_defined_name: parse_string(&buf[232..248]),
+        })
+    }
+}
+
+impl<'a> ParseScd<'a> for ReadReg<'a> {
+    fn parse(buf: &'a [u8], _header: &AckHeader) -> Result<Self> {
+        if buf.len() & 0b11 != 0 {
+            return Err(Error::InvalidPacket(
+                "READREG_ACK length must be a multiple of 4".into(),
+            ));
+        }
+        Ok(Self { data: buf })
+    }
+}
+
+impl<'a> ParseScd<'a> for WriteReg {
+    fn parse(buf: &'a [u8], _header: &AckHeader) -> Result<Self> {
+        let mut cursor = Cursor::new(buf);
+        // Reserved.
+        let _: u16 = cursor.read_bytes_be()?;
+        let index = cursor.read_bytes_be()?;
+        Ok(Self { index })
+    }
+}
+
+impl<'a> ParseScd<'a> for ReadMem<'a> {
+    fn parse(buf: &'a [u8], _header: &AckHeader) -> Result<Self> {
+        let mut cursor = Cursor::new(buf);
+        let address = cursor.read_bytes_be()?;
+        Ok(Self {
+            address,
+            data: &buf[4..],
+        })
+    }
+}
+
+impl<'a> ParseScd<'a> for WriteMem {
+    fn parse(buf: &'a [u8], _header: &AckHeader) -> Result<Self> {
+        let mut cursor = Cursor::new(buf);
+        // Reserved.
+        let _: u16 = cursor.read_bytes_be()?;
+        let index = cursor.read_bytes_be()?;
+        Ok(Self { index })
+    }
+}
+
+impl<'a> ParseScd<'a> for Pending {
+    fn parse(buf: &'a [u8], _header: &AckHeader) -> Result<Self> {
+        let mut cursor = Cursor::new(buf);
+        // Reserved.
+        let _: u16 = cursor.read_bytes_be()?;
+        let timeout_ms: u16 = cursor.read_bytes_be()?;
+        Ok(Self {
+            timeout: time::Duration::from_millis(timeout_ms.into()),
+        })
+    }
+}
+
+/// Parses a NUL terminated string in a fixed length field.
+fn parse_string(buf: &[u8]) -> String {
+    let len = buf.iter().position(|&b| b == 0).unwrap_or(buf.len());
+    String::from_utf8_lossy(&buf[..len]).trim().to_string()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn serialize_header(status_code: u16, ack_id: u16, scd_len: u16, request_id: u16) -> Vec<u8> {
+        let mut header = vec![];
+        header.extend(status_code.to_be_bytes());
+        header.extend(ack_id.to_be_bytes());
+        header.extend(scd_len.to_be_bytes());
+        header.extend(request_id.to_be_bytes());
+        header
+    }
+
+    #[test]
+    fn test_discovery_ack() {
+        let mut scd = vec![0; 248];
+        scd[0..4].copy_from_slice(&[0x00, 0x02, 0x00, 0x01]); // Version 2.1.
+        scd[10..16].copy_from_slice(&[0x00, 0x11, 0x22, 0x33, 0x44, 0x55]);
+        scd[36..40].copy_from_slice(&[192, 168, 1, 10]);
+        scd[52..56].copy_from_slice(&[255, 255, 255, 0]);
+        scd[72..80].copy_from_slice(b"Cameleon");
+        scd[104..109].copy_from_slice(b"Model");
+        scd[216..220].copy_from_slice(b"1234");
+        let mut raw_packet = serialize_header(0x0000, 0x0003, 248, 1);
+        raw_packet.extend(&scd);
+
+        let ack = AckPacket::parse(&raw_packet).unwrap();
+        assert!(ack.status().is_success());
+        assert_eq!(ack.scd_kind(), ScdKind::Discovery);
+
+        let info = ack
+            .scd_as::<Discovery>()
+            .unwrap()
+            .into_device_info(Ipv4Addr::new(192, 168, 1, 2));
+        assert_eq!(info.gev_version, Version::new(2, 1, 0));
+        assert_eq!(info.mac_address_string(), "00:11:22:33:44:55");
+        assert_eq!(info.ip_address, Ipv4Addr::new(192, 168, 1, 10));
+        assert_eq!(info.subnet_mask, Ipv4Addr::new(255, 255, 255, 0));
+        assert_eq!(info.vendor_name, "Cameleon");
+        assert_eq!(info.model_name, "Model");
+        assert_eq!(info.serial_number, "1234");
+        assert!(info.user_defined_name.is_none());
+    }
+
+    #[test]
+    fn test_read_reg_ack() {
+        let scd = [0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x05, 0xDC];
+        let mut raw_packet = serialize_header(0x0000, 0x0081, scd.len() as u16, 2);
+        raw_packet.extend(scd);
+
+        let ack = AckPacket::parse(&raw_packet).unwrap();
+        assert_eq!(ack.request_id(), 2);
+        let values: Vec<_> = ack.scd_as::<ReadReg>().unwrap().values().collect();
+        assert_eq!(values, [2, 1500]);
+    }
+
+    #[test]
+    fn test_read_mem_ack() {
+        let scd = [0x00, 0x00, 0x02, 0x00, 0x4C, 0x6F, 0x63, 0x61];
+        let mut raw_packet = serialize_header(0x0000, 0x0085, scd.len() as u16, 3);
+        raw_packet.extend(scd);
+
+        let ack = AckPacket::parse(&raw_packet).unwrap();
+        let read_mem = ack.scd_as::<ReadMem>().unwrap();
+        assert_eq!(read_mem.address, 0x0200);
+        assert_eq!(read_mem.data, b"Loca");
+    }
+
+    #[test]
+    fn test_write_ack() {
+        let scd = [0x00, 0x00, 0x00, 0x08];
+        let mut raw_packet = serialize_header(0x0000, 0x0087, scd.len() as u16, 4);
+        raw_packet.extend(scd);
+        let ack = AckPacket::parse(&raw_packet).unwrap();
+        assert_eq!(ack.scd_as::<WriteMem>().unwrap().index, 8);
+
+        let mut raw_packet = serialize_header(0x8006, 0x0083, scd.len() as u16, 5);
+        raw_packet.extend(scd);
+        let ack = AckPacket::parse(&raw_packet).unwrap();
+        assert!(ack.status().is_fatal());
+        assert_eq!(ack.status().kind(), StatusKind::AccessDenied);
+    }
+
+    #[test]
+    fn test_pending_ack() {
+        let scd = [0x00, 0x00, 0x02, 0xBC]; // 700 ms.
+        let mut raw_packet = serialize_header(0x0000, 0x0089, scd.len() as u16, 6);
+        raw_packet.extend(scd);
+
+        let ack = AckPacket::parse(&raw_packet).unwrap();
+        assert_eq!(ack.scd_kind(), ScdKind::Pending);
+        let pending = ack.scd_as::<Pending>().unwrap();
+        assert_eq!(pending.timeout, time::Duration::from_millis(700));
+    }
+
+    #[test]
+    fn test_short_ack() {
+        let mut raw_packet = serialize_header(0x0000, 0x0085, 8, 7);
+        raw_packet.extend([0x00, 0x00]);
+        assert!(AckPacket::parse(&raw_packet).is_err());
+    }
+}
@@ -0,0 +1,589 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! `GVCP` command packets. All fields of `GVCP` are big endian.
+
+use std::io::Write;
+
+use cameleon_impl::bytes_io::WriteBytes;
+
+use crate::gige::{Error, Result};
+
+#[derive(Debug)]
+pub struct CommandPacket<T> {
+    header: CommandHeader,
+    scd: T,
+}
+
+impl<T> CommandPacket<T>
+where
+    T: CommandScd,
+{
+    /// The first byte of every command packet.
+    const KEY: u8 = 0x42;
+
+    /// Length of the header of both command and ack packets.
+    const HEADER_LENGTH: usize = 8;
+
+    /// Length of `PENDING_ACK` payload. This ack can be returned with any command.
+    const MINIMUM_ACK_SCD_LENGTH: u16 = 4;
+
+    pub fn serialize(&self, mut buf: impl Write) -> Result<()> {
+        self.header.serialize(&mut buf)?;
+        self.scd.serialize(&mut buf)?;
+
+        Ok(())
+    }
+
+    pub fn scd(&self) -> &T {
+        &self.scd
+    }
+
+    pub fn cmd_len(&self) -> usize {
+        Self::HEADER_LENGTH + self.header.scd_len as usize
+    }
+
+    pub fn request_id(&self) -> u16 {
+        self.header.request_id
+    }
+
+    /// Returns `true` if the device responds to the command with an ack.
+    pub fn is_ack_requested(&self) -> bool {
+        self.header.flag.is_ack_requested()
+    }
+
+    /// Maximum length of corresponding ack packet.
+    pub fn maximum_ack_len(&self) -> usize {
+        let scd_len = std::cmp::max(self.scd.ack_scd_len(), Self::MINIMUM_ACK_SCD_LENGTH);
+        Self::HEADER_LENGTH + scd_len as usize
+    }
+
+    pub fn new(scd: T, request_id: u16) -> Self {
+        let header = CommandHeader {
+            flag: scd.flag(),
+            scd_kind: scd.scd_kind(),
+            scd_len: scd.scd_len(),
+            request_id,
+        };
+        Self { header, scd }
+    }
+}
+
+#[derive(Debug)]
+struct CommandHeader {
+    flag: CommandFlag,
+    scd_kind: ScdKind,
+    scd_len: u16,
+    request_id: u16,
+}
+
+impl CommandHeader {
+    fn serialize(&self, mut buf: impl Write) -> Result<()> {
+        buf.write_bytes_be(CommandPacket::<Discovery>::KEY)?;
+        buf.write_bytes_be(self.flag.0)?;
+        self.scd_kind.serialize(&mut buf)?;
+        buf.write_bytes_be(self.scd_len)?;
+        buf.write_bytes_be(self.request_id)?;
+        Ok(())
+    }
+}
+
+/// Broadcasts to find devices on the network.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Discovery {
+    pub(crate) allow_broadcast_ack: bool,
+}
+
+impl Discovery {
+    /// If `allow_broadcast_ack` is `true`, a device on another subnet answers by broadcast.
+    #[must_use]
+    pub fn new(allow_broadcast_ack: bool) -> Self {
+        Self {
+            allow_broadcast_ack,
+        }
+    }
+}
+
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct ReadReg {
+    pub(crate) addresses: Vec<u32>,
+}
+
+impl ReadReg {
+    /// Maximum number of registers read by a command so that the ack fits in 576 bytes.
+    pub const MAXIMUM_ENTRY_COUNT: usize = 135;
+
+    pub fn new(addresses: Vec<u32>) -> Result<Self> {
+        if addresses.is_empty() || addresses.len() > Self::MAXIMUM_ENTRY_COUNT {
+            return Err(Error::InvalidPacket(
+                "the number of registers must be in 1..=135".into(),
+            ));
+        }
+        if addresses.iter().any(|addr| addr & 0b11 != 0) {
+            return Err(Error::InvalidPacket(
+                "register address must be aligned to 4 bytes".into(),
+            ));
+        }
+
+        Ok(Self { addresses })
+    }
+}
+
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct WriteReg {
+    pub(crate) entries: Vec<(u32, u32)>,
+}
+
+impl WriteReg {
+    /// Maximum number of registers written by a command so that the command fits in 576 bytes.
+    pub const MAXIMUM_ENTRY_COUNT: usize = 67;
+
+    /// Each entry is a pair of register address and value.
+    pub fn new(entries: Vec<(u32, u32)>) -> Result<Self> {
+        if entries.is_empty() || entries.len() > Self::MAXIMUM_ENTRY_COUNT {
+            return Err(Error::InvalidPacket(
+                "the number of registers must be in 1..=67".into(),
+            ));
+        }
+        if entries.iter().any(|(addr, _)| addr & 0b11 != 0) {
+            return Err(Error::InvalidPacket(
+                "register address must be aligned to 4 bytes".into(),
+            ));
+        }
+
+        Ok(Self { entries })
+    }
+}
+
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct ReadMem {
+    pub(crate) address: u32,
+    pub(crate) read_length: u16,
+}
+
+impl ReadMem {
+    /// Maximum read length of a command so that the ack fits in 576 bytes.
+    pub const MAXIMUM_READ_LENGTH: u16 = 536;
+
+    pub fn new(address: u32, read_length: u16) -> Result<Self> {
+        if (address | u32::from(read_length)) & 0b11 != 0 {
+            return Err(Error::InvalidPacket(
+                "address and read length must be aligned to 4 bytes".into(),
+            ));
+        }
+        if read_length == 0 || read_length > Self::MAXIMUM_READ_LENGTH {
+            return Err(Error::InvalidPacket(
+                "read length must be in 1..=536".into(),
+            ));
+        }
+
+        Ok(Self {
+            address,
+            read_length,
+        })
+    }
+}
+
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct WriteMem<'a> {
+    pub(crate) address: u32,
+    pub(crate) data: &'a [u8],
+}
+
+impl<'a> WriteMem<'a> {
+    /// Maximum data length of a command so that the command fits in 576 bytes.
+    pub const MAXIMUM_DATA_LENGTH: usize = 536;
+
+    pub fn new(address: u32, data: &'a [u8]) -> Result<Self> {
+        if address & 0b11 != 0 || data.len() & 0b11 != 0 {
+            return Err(Error::InvalidPacket(
+                "address and data length must be aligned to 4 bytes".into(),
+            ));
+        }
+        if data.is_empty() || data.len() > Self::MAXIMUM_DATA_LENGTH {
+            return Err(Error::InvalidPacket(
+                "data length must be in 1..=536".into(),
+            ));
+        }
+
+        Ok(Self { address, data })
+    }
+}
+
+/// Requests the device to resend packets of a block. The device doesn't return an ack.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct PacketResend {
+    pub(crate) stream_channel: u16,
+    pub(crate) block_id: u64,
+    pub(crate) first_packet_id: u32,
+    pub(crate) last_packet_id: u32,
+    pub(crate) extended_id: bool,
+}
+
+impl PacketResend {
+    /// Requests packets in `first_packet_id..=last_packet_id` of the block.
+    ///
+    /// `extended_id` must be `true` if the stream channel is in extended ID mode, then 64 bit
+    /// block ID and 32 bit packet ID are sent. Otherwise, they are truncated to 16 bit and 24
+    /// bit respectively.
+    #[must_use]
+    pub fn new(
+        stream_channel: u16,
+        block_id: u64,
+        first_packet_id: u32,
+        last_packet_id: u32,
+        extended_id: bool,
+    ) -> Self {
+        Self {
+            stream_channel,
+            block_id,
+            first_packet_id,
+            last_packet_id,
+            extended_id,
+        }
+    }
+}
+
+/// Flag field of the command header.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct CommandFlag(u8);
+
+impl CommandFlag {
+    pub const NO_ACK: Self = Self(0);
+    pub const REQUEST_ACK: Self = Self(0x01);
+
+    /// Command specific bit. `DISCOVERY_CMD` uses it to allow broadcast ack, and
+    /// `PACKETRESEND_CMD` uses it to indicate extended ID.
+    const SPECIFIC: u8 = 0x10;
+
+    #[must_use]
+    pub fn is_ack_requested(self) -> bool {
+        self.0 & Self::REQUEST_ACK.0 != 0
+    }
+
+    fn with_specific(self, specific: bool) -> Self {
+        if specific {
+            Self(self.0 | Self::SPECIFIC)
+        } else {
+            self
+        }
+    }
+}
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum ScdKind {
+    Discovery,
+    PacketResend,
+    ReadReg,
+    WriteReg,
+    ReadMem,
+    WriteMem,
+}
+
+impl ScdKind {
+    fn serialize(self, mut buf: impl Write) -> Result<()> {
+        let kind_id: u16 = match self {
+            Self::Discovery => 0x0002,
+            Self::PacketResend => 0x0040,
+            Self::ReadReg => 0x0080,
+            Self::WriteReg => 0x0082,
+            Self::ReadMem => 0x0084,
+            Self::WriteMem => 0x0086,
+        };
+        buf.write_bytes_be(kind_id)?;
+        Ok(())
+    }
+}
+
+pub trait CommandScd: std::fmt::Debug + Sized {
+    fn flag(&self) -> CommandFlag;
+
+    fn scd_kind(&self) -> ScdKind;
+
+    fn scd_len(&self) -> u16;
+
+    fn serialize(&self, buf: impl Write) -> Result<()>;
+
+    fn ack_scd_len(&self) -> u16;
+
+    fn finalize(self, request_id: u16) -> CommandPacket<Self> {
+        CommandPacket::new(self, request_id)
+    }
+}
+
+impl CommandScd for Discovery {
+    fn flag(&self) -> CommandFlag {
+        CommandFlag::REQUEST_ACK.with_specific(self.allow_broadcast_ack)
+    }
+
+    fn scd_kind(&self) -> ScdKind {
+        ScdKind::Discovery
+    }
+
+    fn scd_len(&self) -> u16 {
+        0
+    }
+
+    fn serialize(&self, _buf: impl Write) -> Result<()> {
+        Ok(())
+    }
+
+    fn ack_scd_len(&self) -> u16 {
+        crate::gige::protocol::ack::Discovery::SCD_LENGTH
+    }
+}
+
+impl CommandScd for ReadReg {
+    fn flag(&self) -> CommandFlag {
+        CommandFlag::REQUEST_ACK
+    }
+
+    fn scd_kind(&self) -> ScdKind {
+        ScdKind::ReadReg
+    }
+
+    fn scd_len(&self) -> u16 {
+        (self.addresses.len() * 4) as u16
+    }
+
+    fn serialize(&self, mut buf: impl Write) -> Result<()> {
+        for addr in &self.addresses {
+            buf.write_bytes_be(*addr)?;
+        }
+        Ok(())
+    }
+
+    fn ack_scd_len(&self) -> u16 {
+        self.scd_len()
+    }
+}
+
+impl CommandScd for WriteReg {
+    fn flag(&self) -> CommandFlag {
+        CommandFlag::REQUEST_ACK
+    }
+
+    fn scd_kind(&self) -> ScdKind {
+        ScdKind::WriteReg
+    }
+
+    fn scd_len(&self) -> u16 {
+        (self.entries.len() * 8) as u16
+    }
+
+    fn serialize(&self, mut buf: impl Write) -> Result<()> {
+        for (addr, value) in &self.entries {
+            buf.write_bytes_be(*addr)?;
+            buf.write_bytes_be(*value)?;
+        }
+        Ok(())
+    }
+
+    fn ack_scd_len(&self) -> u16 {
+        // Reserved(2 bytes) + index(2 bytes).
+        4
+    }
+}
+
+impl CommandScd for ReadMem {
+    fn flag(&self) -> CommandFlag {
+        CommandFlag::REQUEST_ACK
+    }
+
+    fn scd_kind(&self) -> ScdKind {
+        ScdKind::ReadMem
+    }
+
+    fn scd_len(&self) -> u16 {
+        // Address(4 bytes) + reserved(2 bytes) + length(2 bytes).
+        8
+    }
+
+    fn serialize(&self, mut buf: impl Write) -> Result<()> {
+        buf.write_bytes_be(self.address)?;
+        buf.write_bytes_be(0_u16)?;
+        buf.write_bytes_be(self.read_length)?;
+        Ok(())
+    }
+
+    fn ack_scd_len(&self) -> u16 {
+        // Address(4 bytes) + data.
+        4 + self.read_length
+    }
+}
+
+impl<'a> CommandScd for WriteMem<'a> {
+    fn flag(&self) -> CommandFlag {
+        CommandFlag::REQUEST_ACK
+    }
+
+    fn scd_kind(&self) -> ScdKind {
+        ScdKind::WriteMem
+    }
+
+    fn scd_len(&self) -> u16 {
+        // Address(4 bytes) + data.
+        (4 + self.data.len()) as u16
+    }
+
+    fn serialize(&self, mut buf: impl Write) -> Result<()> {
+        buf.write_bytes_be(self.address)?;
+        buf.write_all(self.data)?;
+        Ok(())
+    }
+
+    fn ack_scd_len(&self) -> u16 {
+        // Reserved(2 bytes) + index(2 bytes).
+        4
+    }
+}
+
+impl CommandScd for PacketResend {
+    fn flag(&self) -> CommandFlag {
+        CommandFlag::NO_ACK.with_specific(self.extended_id)
+    }
+
+    fn scd_kind(&self) -> ScdKind {
+        ScdKind::PacketResend
+    }
+
+    fn scd_len(&self) -> u16 {
+        if self.extended_id {
+            20
+        } else {
+            12
+        }
+    }
+
+    fn serialize(&self, mut buf: impl Write) -> Result<()> {
+        buf.write_bytes_be(self.stream_channel)?;
+        if self.extended_id {
+            // Reserved.
+            buf.write_bytes_be(0_u16)?;
+            buf.write_bytes_be(self.first_packet_id)?;
+            buf.write_bytes_be(self.last_packet_id)?;
+            buf.write_bytes_be(self.block_id)?;
+        } else {
+            buf.write_bytes_be(self.block_id as u16)?;
+            buf.write_bytes_be(self.first_packet_id & 0x00FF_FFFF)?;
+            buf.write_bytes_be(self.last_packet_id & 0x00FF_FFFF)?;
+        }
+        Ok(())
+    }
+
+    fn ack_scd_len(&self) -> u16 {
+        0
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn serialize_header(flag: u8, command: [u8; 2], scd_len: u16, req_id: u16) -> Vec<u8> {
+        let mut header = vec![0x42, flag];
+        header.extend(command);
+        header.extend(scd_len.to_be_bytes());
+        header.extend(req_id.to_be_bytes());
+        header
+    }
+
+    #[test]
+    fn test_discovery_cmd() {
+        let command = Discovery::new(true).finalize(1);
+        assert_eq!(command.cmd_len(), 8);
+        assert_eq!(command.maximum_ack_len(), 8 + 248);
+
+        let mut buf = vec![];
+        command.serialize(&mut buf).unwrap();
+        assert_eq!(buf, serialize_header(0x11, [0x00, 0x02], 0, 1));
+    }
+
+    #[test]
+    fn test_read_reg_cmd() {
+        let command = ReadReg::new(vec![0x0A00, 0x0D04]).unwrap().finalize(2);
+        assert_eq!(command.cmd_len(), 16);
+        assert_eq!(command.maximum_ack_len(), 16);
+
+        let mut buf = vec![];
+        command.serialize(&mut buf).unwrap();
+        let mut expected = serialize_header(0x01, [0x00, 0x80], 8, 2);
+        expected.extend([0x00, 0x00, 0x0A, 0x00]);
+        expected.extend([0x00, 0x00, 0x0D, 0x04]);
+        assert_eq!(buf, expected);
+
+        assert!(ReadReg::new(vec![0x0A01]).is_err());
+        assert!(ReadReg::new(vec![]).is_err());
+    }
+
+    #[test]
+    fn test_write_reg_cmd() {
+        let command = WriteReg::new(vec![(0x0A00, 0x02)]).unwrap().finalize(3);
+        assert_eq!(command.cmd_len(), 16);
+
+        let mut buf = vec![];
+        command.serialize(&mut buf).unwrap();
+        let mut expected = serialize_header(0x01, [0x00, 0x82], 8, 3);
+        expected.extend([0x00, 0x00, 0x0A, 0x00]);
+        expected.extend([0x00, 0x00, 0x00, 0x02]);
+        assert_eq!(buf, expected);
+    }
+
+    #[test]
+    fn test_read_mem_cmd() {
+        let command = ReadMem::new(0x0200, 512).unwrap().finalize(4);
+        assert_eq!(command.cmd_len(), 16);
+        assert_eq!(command.maximum_ack_len(), 8 + 4 + 512);
+
+        let mut buf = vec![];
+        command.serialize(&mut buf).unwrap();
+        let mut expected = serialize_header(0x01, [0x00, 0x84], 8, 4);
+        expected.extend([0x00, 0x00, 0x02, 0x00]);
+        expected.extend([0x00, 0x00]);
+        expected.extend([0x02, 0x00]);
+        assert_eq!(buf, expected);
+
+        assert!(ReadMem::new(0x0200, 3).is_err());
+        assert!(ReadMem::new(0x0200, 540).is_err());
+    }
+
+    #[test]
+    fn test_write_mem_cmd() {
+        let data = [0x01, 0x02, 0x03, 0x04];
+        let command = WriteMem::new(0x00E8, &data).unwrap().finalize(5);
+        assert_eq!(command.cmd_len(), 16);
+
+        let mut buf = vec![];
+        command.serialize(&mut buf).unwrap();
+        let mut expected = serialize_header(0x01, [0x00, 0x86], 8, 5);
+        expected.extend([0x00, 0x00, 0x00, 0xE8]);
+        expected.extend(data);
+        assert_eq!(buf, expected);
+    }
+
+    #[test]
+    fn test_packet_resend_cmd() {
+        let command = PacketResend::new(0, 0x1_0005, 3, 7, false).finalize(6);
+        assert!(!command.is_ack_requested());
+
+        let mut buf = vec![];
+        command.serialize(&mut buf).unwrap();
+        let mut expected = serialize_header(0x00, [0x00, 0x40], 12, 6);
+        expected.extend([0x00, 0x00]); // Stream channel.
+        expected.extend([0x00, 0x05]); // Block ID truncated to 16 bit.
+        expected.extend([0x00, 0x00, 0x00, 0x03]);
+        expected.extend([0x00, 0x00, 0x00, 0x07]);
+        assert_eq!(buf, expected);
+
+        let command = PacketResend::new(0, 0x1_0005, 3, 7, true).finalize(7);
+        let mut buf = vec![];
+        command.serialize(&mut buf).unwrap();
+        let mut expected = serialize_header(0x10, [0x00, 0x40], 20, 7);
+        expected.extend([0x00, 0x00, 0x00, 0x00]); // Stream channel and reserved.
+        expected.extend([0x00, 0x00, 0x00, 0x03]);
+        expected.extend([0x00, 0x00, 0x00, 0x07]);
+        expected.extend(0x1_0005_u64.to_be_bytes());
+        assert_eq!(buf, expected);
+    }
+}
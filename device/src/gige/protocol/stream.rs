@@ -0,0 +1,530 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! `GVSP` packets. All fields of `GVSP` are big endian.
+//!
+//! A block, i.e. a payload, is transmitted as a leader packet, data packets and a trailer packet.
+//! The packet ID of the leader is 0, and data packets follow from 1 in the order of the payload
+//! data.
+
+use std::{convert::TryInto, io::Cursor};
+
+use cameleon_impl::bytes_io::ReadBytes;
+
+use crate::{
+    gige::{protocol::ack::Status, Error, Result},
+    PixelFormat,
+};
+
+/// Length of the header of a standard ID packet.
+pub const STANDARD_HEADER_LENGTH: usize = 8;
+
+/// Length of the header of an extended ID packet.
+pub const EXTENDED_HEADER_LENGTH: usize = 20;
+
+/// A `GVSP` packet.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Packet<'a> {
+    header: PacketHeader,
+    payload: &'a [u8],
+}
+
+impl<'a> Packet<'a> {
+    pub fn parse(buf: &'a (impl AsRef<[u8]> + ?Sized)) -> Result<Self> {
+        let buf = buf.as_ref();
+        let header = PacketHeader::parse(buf)?;
+        let payload = &buf[header.len()..];
+        Ok(Self { header, payload })
+    }
+
+    #[must_use]
+    pub fn header(&self) -> &PacketHeader {
+        &self.header
+    }
+
+    /// Returns the packet data following the header.
+    #[must_use]
+    pub fn payload(&self) -> &'a [u8] {
+        self.payload
+    }
+
+    /// Parses the packet as a leader.
+    pub fn leader(&self) -> Result<Leader<'a>> {
+        self.expect_format(PacketFormat::Leader)?;
+        Leader::parse(self.payload)
+    }
+
+    /// Parses the packet as a trailer.
+    pub fn trailer(&self) -> Result<Trailer<'a>> {
+        self.expect_format(PacketFormat::Trailer)?;
+        Trailer::parse(self.payload)
+    }
+
+    fn expect_format(&self, format: PacketFormat) -> Result<()> {
+        if self.header.packet_format == format {
+            Ok(())
+        } else {
+            Err(Error::InvalidPacket(
+                format!(
+                    "expected {:?} packet, but got {:?}",
+                    format, self.header.packet_format
+                )
+                .into(),
+            ))
+        }
+    }
+}
+
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct PacketHeader {
+    status: Status,
+    block_id: u64,
+    packet_format: PacketFormat,
+    packet_id: u32,
+    extended_id: bool,
+}
+
+impl PacketHeader {
+    /// Parses the header from the beginning of `buf`.
+    pub fn parse(buf: &[u8]) -> Result<Self> {
+        let mut cursor = Cursor::new(buf);
+        let status = Status::parse(&mut cursor)?;
+        let block_id_or_flag: u16 = cursor.read_bytes_be()?;
+        let format_and_packet_id: u32 = cursor.read_bytes_be()?;
+
+        let extended_id = format_and_packet_id >> 31_i32 == 1;
+        let packet_format = PacketFormat::from_raw((format_and_packet_id >> 24_i32) as u8 & 0x0F)?;
+
+        if extended_id {
+            let block_id = cursor.read_bytes_be()?;
+            let packet_id = cursor.read_bytes_be()?;
+            Ok(Self {
+                status,
+                block_id,
+                packet_format,
+                packet_id,
+                extended_id,
+            })
+        } else {
+            Ok(Self {
+                status,
+                block_id: block_id_or_flag.into(),
+                packet_format,
+                packet_id: format_and_packet_id & 0x00FF_FFFF,
+                extended_id,
+            })
+        }
+    }
+
+    #[must_use]
+    pub fn status(&self) -> Status {
+        self.status
+    }
+
+    /// Block ID of the packet. In standard ID mode, the ID is 16 bit and wraps around to 1, not
+    /// 0.
+    #[must_use]
+    pub fn block_id(&self) -> u64 {
+        self.block_id
+    }
+
+    #[must_use]
+    pub fn packet_format(&self) -> PacketFormat {
+        self.packet_format
+    }
+
+    /// Packet ID within the block. In standard ID mode, the ID is 24 bit.
+    #[must_use]
+    pub fn packet_id(&self) -> u32 {
+        self.packet_id
+    }
+
+    /// Returns `true` if the packet is sent in extended ID mode.
+    #[must_use]
+    pub fn is_extended_id(&self) -> bool {
+        self.extended_id
+    }
+
+    /// Length of the header.
+    #[must_use]
+    #[allow(clippy::len_without_is_empty)]
+    pub fn len(&self) -> usize {
+        if self.extended_id {
+            EXTENDED_HEADER_LENGTH
+        } else {
+            STANDARD_HEADER_LENGTH
+        }
+    }
+}
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum PacketFormat {
+    Leader,
+    Trailer,
+    /// Generic data packet.
+    Payload,
+    /// A block in a single packet which contains the leader, data and trailer.
+    AllIn,
+    H264,
+    MultiZone,
+    MultiPart,
+    GenDc,
+}
+
+impl PacketFormat {
+    fn from_raw(raw: u8) -> Result<Self> {
+        match raw {
+            1 => Ok(Self::Leader),
+            2 => Ok(Self::Trailer),
+            3 => Ok(Self::Payload),
+            4 => Ok(Self::AllIn),
+            5 => Ok(Self::H264),
+            6 => Ok(Self::MultiZone),
+            7 => Ok(Self::MultiPart),
+            8 => Ok(Self::GenDc),
+            _ => Err(Error::InvalidPacket(
+                format!("unknown packet format {}", raw).into(),
+            )),
+        }
+    }
+}
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum PayloadType {
+    Image,
+    ImageExtendedChunk,
+    Chunk,
+}
+
+impl PayloadType {
+    fn from_raw(raw: u16) -> Result<Self> {
+        match raw {
+            0x0001 => Ok(Self::Image),
+            0x4001 => Ok(Self::ImageExtendedChunk),
+            0x0004 => Ok(Self::Chunk),
+            _ => Err(Error::InvalidPacket(
+                format!("unsupported payload type {:#X}", raw).into(),
+            )),
+        }
+    }
+}
+
+/// Generic part of a leader packet.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Leader<'a> {
+    payload_type: PayloadType,
+    timestamp: u64,
+    raw_specific_leader: &'a [u8],
+}
+
+impl<'a> Leader<'a> {
+    fn parse(buf: &'a [u8]) -> Result<Self> {
+        let mut cursor = Cursor::new(buf);
+        // Field info and reserved.
+        let _: u16 = cursor.read_bytes_be()?;
+        let payload_type = PayloadType::from_raw(cursor.read_bytes_be()?)?;
+        let timestamp = cursor.read_bytes_be()?;
+        let raw_specific_leader = &buf[cursor.position() as usize..];
+
+        Ok(Self {
+            payload_type,
+            timestamp,
+            raw_specific_leader,
+        })
+    }
+
+    #[must_use]
+    pub fn payload_type(&self) -> PayloadType {
+        self.payload_type
+    }
+
+    /// Timestamp of the block in ticks of the device's timestamp counter.
+    #[must_use]
+    pub fn timestamp(&self) -> u64 {
+        self.timestamp
+    }
+
+    pub fn specific_leader_as<T: SpecificLeader>(&self) -> Result<T> {
+        T::from_bytes(self.raw_specific_leader)
+    }
+}
+
+pub trait SpecificLeader {
+    /// Construct Specific leader from bytes.
+    fn from_bytes(buf: &[u8]) -> Result<Self>
+    where
+        Self: Sized;
+}
+
+/// Specific leader part of [`PayloadType::Image`] and [`PayloadType::ImageExtendedChunk`].
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct ImageLeader {
+    pixel_format: PixelFormat,
+    width: u32,
+    height: u32,
+    x_offset: u32,
+    y_offset: u32,
+    x_padding: u16,
+    y_padding: u16,
+}
+
+impl ImageLeader {
+    #[must_use]
+    pub fn pixel_format(&self) -> PixelFormat {
+        self.pixel_format
+    }
+
+    #[must_use]
+    pub fn width(&self) -> u32 {
+        self.width
+    }
+
+    #[must_use]
+    pub fn height(&self) -> u32 {
+        self.height
+    }
+
+    #[must_use]
+    pub fn x_offset(&self) -> u32 {
+        self.x_offset
+    }
+
+    #[must_use]
+    pub fn y_offset(&self) -> u32 {
+        self.y_offset
+    }
+
+    #[must_use]
+    pub fn x_padding(&self) -> u16 {
+        self.x_padding
+    }
+
+    #[must_use]
+    pub fn y_padding(&self) -> u16 {
+        self.y_padding
+    }
+}
+
+impl SpecificLeader for ImageLeader {
+    fn from_bytes(buf: &[u8]) -> Result<Self> {
+        let mut cursor = Cursor::new(buf);
+        let pixel_format = cursor
+            .read_bytes_be::<u32>()?
+            .try_into()
+            .map_err(|e: String| Error::InvalidPacket(e.into()))?;
+        let width = cursor.read_bytes_be()?;
+        let height = cursor.read_bytes_be()?;
+        let x_offset = cursor.read_bytes_be()?;
+        let y_offset = cursor.read_bytes_be()?;
+        let x_padding = cursor.read_bytes_be()?;
+        let y_padding = cursor.read_bytes_be()?;
+
+        Ok(Self {
+            pixel_format,
+            width,
+            height,
+            x_offset,
+            y_offset,
+            x_padding,
+            y_padding,
+        })
+    }
+}
+
+/// Generic part of a trailer packet.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Trailer<'a> {
+    payload_type: PayloadType,
+    raw_specific_trailer: &'a [u8],
+}
+
+impl<'a> Trailer<'a> {
+    fn parse(buf: &'a [u8]) -> Result<Self> {
+        let mut cursor = Cursor::new(buf);
+        // Reserved.
+        let _: u16 = cursor.read_bytes_be()?;
+        let payload_type = PayloadType::from_raw(cursor.read_bytes_be()?)?;
+        let raw_specific_trailer = &buf[cursor.position() as usize..];
+
+        Ok(Self {
+            payload_type,
+            raw_specific_trailer,
+        })
+    }
+
+    #[must_use]
+    pub fn payload_type(&self) -> PayloadType {
+        self.payload_type
+    }
+
+    pub fn specific_trailer_as<T: SpecificTrailer>(&self) -> Result<T> {
+        T::from_bytes(self.raw_specific_trailer)
+    }
+}
+
+pub trait SpecificTrailer {
+    /// Construct Specific trailer from bytes.
+    fn from_bytes(buf: &[u8]) -> Result<Self>
+    where
+        Self: Sized;
+}
+
+/// Specific trailer part of [`PayloadType::Image`] and [`PayloadType::ImageExtendedChunk`].
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct ImageTrailer {
+    actual_height: u32,
+}
+
+impl ImageTrailer {
+    /// Height of the image actually transmitted, which may be smaller than the height in the
+    /// leader.
+    #[must_use]
+    pub fn actual_height(&self) -> u32 {
+        self.actual_height
+    }
+}
+
+impl SpecificTrailer for ImageTrailer {
+    fn from_bytes(buf: &[u8]) -> Result<Self> {
+        let mut cursor = Cursor::new(buf);
+        let actual_height = cursor.read_bytes_be()?;
+        Ok(Self { actual_height })
+    }
+}
+
+/// Specific trailer part of [`PayloadType::Chunk`].
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct ChunkTrailer {
+    chunk_data_payload_length: u32,
+}
+
+impl ChunkTrailer {
+    /// Length of the chunk data transmitted.
+    #[must_use]
+    pub fn chunk_data_payload_length(&self) -> u32 {
+        self.chunk_data_payload_length
+    }
+}
+
+impl SpecificTrailer for ChunkTrailer {
+    fn from_bytes(buf: &[u8]) -> Result<Self> {
+        let mut cursor = Cursor::new(buf);
+        let chunk_data_payload_length = cursor.read_bytes_be()?;
+        Ok(Self {
+            chunk_data_payload_length,
+        })
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::gige::protocol::ack::StatusKind;
+    use cameleon_impl::bytes_io::WriteBytes;
+
+    fn standard_header(block_id: u16, format: u8, packet_id: u32) -> Vec<u8> {
+        let mut buf = vec![];
+        buf.write_bytes_be(0_u16).unwrap();
+        buf.write_bytes_be(block_id).unwrap();
+        buf.write_bytes_be(u32::from(format) << 24 | packet_id).unwrap();
+        buf
+    }
+
+    fn extended_header(block_id: u64, format: u8, packet_id: u32) -> Vec<u8> {
+        let mut buf = vec![];
+        // Status, packet resend.
+        buf.write_bytes_be(0x0100_u16).unwrap();
+        // Flags.
+        buf.write_bytes_be(0_u16).unwrap();
+        buf.write_bytes_be((0x80 | u32::from(format)) << 24).unwrap();
+        buf.write_bytes_be(block_id).unwrap();
+        buf.write_bytes_be(packet_id).unwrap();
+        buf
+    }
+
+    #[test]
+    fn test_standard_header() {
+        let mut buf = standard_header(0x1234, 3, 0x00AB_CDEF);
+        buf.extend([1, 2, 3]);
+
+        let packet = Packet::parse(&buf).unwrap();
+        let header = packet.header();
+        assert!(!header.is_extended_id());
+        assert!(header.status().is_success());
+        assert_eq!(header.block_id(), 0x1234);
+        assert_eq!(header.packet_format(), PacketFormat::Payload);
+        assert_eq!(header.packet_id(), 0x00AB_CDEF);
+        assert_eq!(header.len(), STANDARD_HEADER_LENGTH);
+        assert_eq!(packet.payload(), [1, 2, 3]);
+    }
+
+    #[test]
+    fn test_extended_header() {
+        let buf = extended_header(0x1_0000_0001, 3, 0x0100_0000);
+
+        let packet = Packet::parse(&buf).unwrap();
+        let header = packet.header();
+        assert!(header.is_extended_id());
+        assert_eq!(header.status().kind(), StatusKind::PacketResend);
+        assert_eq!(header.block_id(), 0x1_0000_0001);
+        assert_eq!(header.packet_id(), 0x0100_0000);
+        assert_eq!(header.len(), EXTENDED_HEADER_LENGTH);
+        assert!(packet.payload().is_empty());
+    }
+
+    #[test]
+    fn test_image_leader() {
+        let mut buf = standard_header(1, 1, 0);
+        // Field info.
+        buf.write_bytes_be(0_u16).unwrap();
+        // Payload type.
+        buf.write_bytes_be(0x0001_u16).unwrap();
+        buf.write_bytes_be(100_u64).unwrap();
+        buf.write_bytes_be::<u32>(PixelFormat::Mono8.into())
+            .unwrap();
+        buf.write_bytes_be(640_u32).unwrap();
+        buf.write_bytes_be(480_u32).unwrap();
+        buf.write_bytes_be(8_u32).unwrap();
+        buf.write_bytes_be(16_u32).unwrap();
+        buf.write_bytes_be(0_u16).unwrap();
+        buf.write_bytes_be(0_u16).unwrap();
+
+        let packet = Packet::parse(&buf).unwrap();
+        assert!(packet.trailer().is_err());
+        let leader = packet.leader().unwrap();
+        assert_eq!(leader.payload_type(), PayloadType::Image);
+        assert_eq!(leader.timestamp(), 100);
+
+        let image_leader: ImageLeader = leader.specific_leader_as().unwrap();
+        assert_eq!(image_leader.pixel_format(), PixelFormat::Mono8);
+        assert_eq!(image_leader.width(), 640);
+        assert_eq!(image_leader.height(), 480);
+        assert_eq!(image_leader.x_offset(), 8);
+        assert_eq!(image_leader.y_offset(), 16);
+    }
+
+    #[test]
+    fn test_trailer() {
+        let mut buf = standard_header(1, 2, 301);
+        // Reserved.
+        buf.write_bytes_be(0_u16).unwrap();
+        // Payload type.
+        buf.write_bytes_be(0x0001_u16).unwrap();
+        // Actual height.
+        buf.write_bytes_be(240_u32).unwrap();
+
+        let packet = Packet::parse(&buf).unwrap();
+        let trailer = packet.trailer().unwrap();
+        assert_eq!(trailer.payload_type(), PayloadType::Image);
+        let image_trailer: ImageTrailer = trailer.specific_trailer_as().unwrap();
+        assert_eq!(image_trailer.actual_height(), 240);
+    }
+
+    #[test]
+    fn test_invalid_packet() {
+        assert!(Packet::parse(&[0, 0, 0]).is_err());
+        // Unknown packet format.
+        assert!(Packet::parse(&standard_header(1, 0x0F, 0)).is_err());
+    }
+}
@@ -0,0 +1,57 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+/// (Address, Length) of registers in the bootstrap register map.
+pub mod bootstrap {
+    pub const VERSION: (u64, u16) = (0x0000, 4);
+    pub const DEVICE_MODE: (u64, u16) = (0x0004, 4);
+    pub const DEVICE_MAC_ADDRESS_HIGH: (u64, u16) = (0x0008, 4);
+    pub const DEVICE_MAC_ADDRESS_LOW: (u64, u16) = (0x000C, 4);
+    pub const CURRENT_IP_ADDRESS: (u64, u16) = (0x0024, 4);
+    pub const CURRENT_SUBNET_MASK: (u64, u16) = (0x0034, 4);
+    pub const CURRENT_DEFAULT_GATEWAY: (u64, u16) = (0x0044, 4);
+    pub const MANUFACTURER_NAME: (u64, u16) = (0x0048, 32);
+    pub const MODEL_NAME: (u64, u16) = (0x0068, 32);
+    pub const DEVICE_VERSION: (u64, u16) = (0x0088, 32);
+    pub const MANUFACTURER_INFO: (u64, u16) = (0x00A8, 48);
+    pub const SERIAL_NUMBER: (u64, u16) = (0x00D8, 16);
+    pub const USER_DEFINED_NAME: (u64, u16) = (0x00E8, 16);
+    pub const FIRST_URL: (u64, u16) = (0x0200, 512);
+    pub const SECOND_URL: (u64, u16) = (0x0400, 512);
+    pub const NUMBER_OF_NETWORK_INTERFACES: (u64, u16) = (0x0600, 4);
+    pub const NUMBER_OF_MESSAGE_CHANNELS: (u64, u16) = (0x0900, 4);
+    pub const NUMBER_OF_STREAM_CHANNELS: (u64, u16) = (0x0904, 4);
+    pub const GVCP_CAPABILITY: (u64, u16) = (0x0934, 4);
+    pub const HEARTBEAT_TIMEOUT: (u64, u16) = (0x0938, 4);
+    pub const TIMESTAMP_TICK_FREQUENCY_HIGH: (u64, u16) = (0x093C, 4);
+    pub const TIMESTAMP_TICK_FREQUENCY_LOW: (u64, u16) = (0x0940, 4);
+    pub const TIMESTAMP_CONTROL: (u64, u16) = (0x0944, 4);
+    pub const TIMESTAMP_VALUE_HIGH: (u64, u16) = (0x0948, 4);
+    pub const TIMESTAMP_VALUE_LOW: (u64, u16) = (0x094C, 4);
+    pub const GVCP_CONFIGURATION: (u64, u16) = (0x0954, 4);
+    pub const CONTROL_CHANNEL_PRIVILEGE: (u64, u16) = (0x0A00, 4);
+}
+
+/// (Offset, Length) of registers of a stream channel.
+/// The base address of the stream channel `n` is `stream_channel::BASE + n * stream_channel::STRIDE`.
+pub mod stream_channel {
+    pub const BASE: u64 = 0x0D00;
+    pub const STRIDE: u64 = 0x40;
+
+    /// Host port, bit 15:0, and direction and network interface index.
+    pub const PORT: (u64, u16) = (0x0000, 4);
+    /// Packet size, bit 15:0, and do not fragment and fire test packet bits.
+    pub const PACKET_SIZE: (u64, u16) = (0x0004, 4);
+    pub const PACKET_DELAY: (u64, u16) = (0x0008, 4);
+    pub const DESTINATION_ADDRESS: (u64, u16) = (0x0018, 4);
+    pub const SOURCE_PORT: (u64, u16) = (0x001C, 4);
+    pub const CAPABILITY: (u64, u16) = (0x0020, 4);
+    pub const CONFIGURATION: (u64, u16) = (0x0024, 4);
+}
+
+/// Values of `bootstrap::CONTROL_CHANNEL_PRIVILEGE`.
+pub mod privilege {
+    pub const EXCLUSIVE_ACCESS: u32 = 1 << 0;
+    pub const CONTROL_ACCESS: u32 = 1 << 1;
+}
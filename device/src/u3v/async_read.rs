@@ -13,7 +13,11 @@ use std::{
     collections::VecDeque,
     convert::TryInto,
     ptr::NonNull,
-    sync::atomic::{AtomicBool, Ordering::SeqCst},
+    sync::{
+        atomic::{AtomicBool, AtomicUsize, Ordering::SeqCst},
+        Arc, Condvar, Mutex, Weak,
+    },
+    thread::JoinHandle,
     time::{Duration, Instant},
 };
 
@@ -28,6 +32,12 @@ pub struct AsyncPool<'a> {
     handle: AsyncHandle<'a>,
     iface_info: ReceiveIfaceInfo,
     pending: VecDeque<AsyncTransfer>,
+    /// Transfers which are not pending and can be reused for the next submission.
+    free: Vec<AsyncTransfer>,
+    ring: &'a TransferRing,
+    /// If set, libusb events are handled by the shared event thread and [`Self::poll`] just waits
+    /// for the completion notification.
+    event_thread: Option<EventThread>,
 }
 
 impl<'a> AsyncPool<'a> {
@@ -35,41 +45,137 @@ impl<'a> AsyncPool<'a> {
     pub fn new(channel: &'a ReceiveChannel) -> Self {
         let iface_info = channel.iface_info.clone();
         let handle = get_handle(channel);
+        let ring = &channel.transfer_ring;
         Self {
             handle,
             iface_info,
             pending: VecDeque::new(),
+            free: ring.take(),
+            ring,
+            event_thread: None,
         }
     }
 
+    /// Creates a pool whose transfers are completed by `event_thread` instead of the thread
+    /// polling the pool.
+    #[doc(hidden)]
+    pub fn with_event_thread(channel: &'a ReceiveChannel, event_thread: EventThread) -> Self {
+        let mut pool = Self::new(channel);
+        pool.event_thread = Some(event_thread);
+        pool
+    }
+
     #[doc(hidden)]
     pub fn submit(&mut self, buf: &mut [u8]) -> Result<()> {
+        let mut transfer = match self.free.pop() {
+            Some(transfer) => transfer,
+            None => self.ring.alloc(),
+        };
+
         // Safety: If transfer is submitted, it is pushed onto `pending` where it will be
         // dropped before `device` is freed.
         unsafe {
-            let mut transfer =
-                AsyncTransfer::new_bulk(self.handle.as_raw(), self.iface_info.bulk_in_ep, buf);
-            transfer.submit()?;
-            self.pending.push_back(transfer);
-            Ok(())
+            transfer.fill_bulk(self.handle.as_raw(), self.iface_info.bulk_in_ep, buf);
+        }
+        if let Err(err) = transfer.submit() {
+            self.free.push(transfer);
+            return Err(err);
         }
+        self.pending.push_back(transfer);
+        Ok(())
     }
 
     #[doc(hidden)]
+    /// Returns `LibUsbError::Interrupted` if [`AsyncWaker::wake`] is called before the next
+    /// transfer completes.
+    ///
     /// # Panics
     ///
     /// Panics if there is no pending transfer.
     pub fn poll(&mut self, timeout: Duration) -> Result<usize> {
         debug_assert!(!self.pending.is_empty());
         let next = self.pending.front().unwrap();
-        if poll_completed(self.handle.context(), timeout, next.completed_flag())? {
-            let mut transfer = self.pending.pop_front().unwrap();
-            Ok(transfer.handle_completed()?)
+        let notifier = &self.ring.notifier;
+        let completed = if self.event_thread.is_some() {
+            notifier.wait(next.completed_flag(), timeout)
+        } else {
+            poll_completed(
+                self.handle.context(),
+                timeout,
+                next.completed_flag(),
+                &notifier.interrupted,
+            )?
+        };
+        if completed {
+            self.complete_front()
+        } else if notifier.interrupted.swap(false, SeqCst) {
+            Err(LibUsbError::Interrupted.into())
         } else {
             Err(LibUsbError::Timeout.into())
         }
     }
 
+    /// Returns the result of the next transfer if it has already completed, or `None` without
+    /// blocking otherwise.
+    ///
+    /// Nothing handles libusb events in this call, so the pool must be created with
+    /// [`Self::with_event_thread`].
+    #[doc(hidden)]
+    pub fn try_poll(&mut self) -> Option<Result<usize>> {
+        debug_assert!(self.event_thread.is_some());
+        if self.pending.front()?.completed_flag().load(SeqCst) {
+            Some(self.complete_front())
+        } else {
+            None
+        }
+    }
+
+    /// Makes `signal` notified whenever a transfer of the channel completes, in addition to the
+    /// thread polling the pool. `None` detaches the current signal.
+    #[doc(hidden)]
+    pub fn set_completion_signal(&mut self, signal: Option<Arc<CompletionSignal>>) {
+        *self.ring.notifier.lock.lock().unwrap() = signal;
+    }
+
+    /// Detaches the pool from the channel, keeping its pending transfers.
+    ///
+    /// The returned state is resumed by [`Self::resume`], so that a pool can be kept across
+    /// the borrows of the channel.
+    #[doc(hidden)]
+    pub fn suspend(mut self) -> SuspendedPool {
+        SuspendedPool {
+            pending: std::mem::take(&mut self.pending),
+            free: std::mem::take(&mut self.free),
+            event_thread: self.event_thread.take(),
+            notifier: self.ring.notifier.clone(),
+        }
+    }
+
+    /// Reattaches the pool suspended by [`Self::suspend`] to its channel.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `channel` isn't the channel which the pool was created from.
+    #[doc(hidden)]
+    pub fn resume(channel: &'a ReceiveChannel, mut suspended: SuspendedPool) -> Self {
+        assert!(Arc::ptr_eq(
+            &channel.transfer_ring.notifier,
+            &suspended.notifier
+        ));
+        let mut pool = Self::new(channel);
+        pool.pending = std::mem::take(&mut suspended.pending);
+        pool.free.append(&mut suspended.free);
+        pool.event_thread = suspended.event_thread.take();
+        pool
+    }
+
+    fn complete_front(&mut self) -> Result<usize> {
+        let mut transfer = self.pending.pop_front().unwrap();
+        let result = transfer.handle_completed();
+        self.free.push(transfer);
+        result
+    }
+
     #[doc(hidden)]
     pub fn cancel_all(&mut self) {
         // Cancel in reverse order to avoid a race condition in which one
@@ -91,6 +197,15 @@ impl<'a> AsyncPool<'a> {
     pub fn is_empty(&self) -> bool {
         self.pending() == 0
     }
+
+    /// Returns the total number of transfers allocated for the channel.
+    ///
+    /// The value doesn't increase in steady state because transfers are reused across pools
+    /// created from the same channel.
+    #[doc(hidden)]
+    pub fn transfer_allocations(&self) -> usize {
+        self.ring.allocations()
+    }
 }
 
 impl<'a> Drop for AsyncPool<'a> {
@@ -99,31 +214,238 @@ impl<'a> Drop for AsyncPool<'a> {
         while !self.is_empty() {
             self.poll(Duration::from_secs(1)).ok();
         }
+        self.ring.put_back(&mut self.free);
+    }
+}
+
+/// [`AsyncPool`] detached from its channel by [`AsyncPool::suspend`].
+///
+/// If it's dropped without being resumed, the pending transfers are cancelled and waited for, and
+/// then all transfers are freed instead of being returned to the channel.
+#[doc(hidden)]
+pub struct SuspendedPool {
+    pending: VecDeque<AsyncTransfer>,
+    free: Vec<AsyncTransfer>,
+    event_thread: Option<EventThread>,
+    notifier: Arc<Notifier>,
+}
+
+impl Drop for SuspendedPool {
+    fn drop(&mut self) {
+        for transfer in self.pending.iter_mut().rev() {
+            transfer.cancel();
+        }
+        while let Some(transfer) = self.pending.front() {
+            let completed = if self.event_thread.is_some() {
+                self.notifier
+                    .wait(transfer.completed_flag(), Duration::from_secs(1))
+            } else {
+                poll_completed(
+                    &rusb::GlobalContext::default(),
+                    Duration::from_secs(1),
+                    transfer.completed_flag(),
+                    &AtomicBool::new(false),
+                )
+                .unwrap_or(false)
+            };
+            if completed {
+                self.pending.pop_front();
+            }
+        }
+    }
+}
+
+/// Signaled whenever a transfer of the channels which it's attached to completes.
+///
+/// A thread serving multiple channels waits for the signal instead of waiting for each channel.
+#[doc(hidden)]
+#[derive(Default)]
+pub struct CompletionSignal {
+    /// Incremented on every notification.
+    generation: Mutex<u64>,
+    cond: Condvar,
+}
+
+impl CompletionSignal {
+    /// Returns the current generation, which is passed to [`Self::wait`].
+    #[doc(hidden)]
+    pub fn generation(&self) -> u64 {
+        *self.generation.lock().unwrap()
     }
+
+    /// Wakes up the threads waiting for the signal.
+    #[doc(hidden)]
+    pub fn notify(&self) {
+        *self.generation.lock().unwrap() += 1;
+        self.cond.notify_all();
+    }
+
+    /// Waits until the signal is notified after `generation` is observed, or `timeout` elapses.
+    ///
+    /// Returns `true` if the signal has been notified.
+    #[doc(hidden)]
+    pub fn wait(&self, generation: u64, timeout: Duration) -> bool {
+        let guard = self.generation.lock().unwrap();
+        let (guard, _) = self
+            .cond
+            .wait_timeout_while(guard, timeout, |current| *current == generation)
+            .unwrap();
+        *guard != generation
+    }
+}
+
+/// Keeps allocated transfers of a channel so that they are reused across [`AsyncPool`]s.
+#[derive(Default)]
+pub(super) struct TransferRing {
+    /// Transfers which are not pending.
+    free: Mutex<Vec<AsyncTransfer>>,
+    /// The number of `libusb_transfer` allocated for the channel.
+    allocations: AtomicUsize,
+    /// Notified whenever a transfer of the channel completes.
+    notifier: Arc<Notifier>,
+}
+
+impl TransferRing {
+    pub(super) fn allocations(&self) -> usize {
+        self.allocations.load(SeqCst)
+    }
+
+    fn take(&self) -> Vec<AsyncTransfer> {
+        std::mem::take(&mut *self.free.lock().unwrap())
+    }
+
+    fn put_back(&self, transfers: &mut Vec<AsyncTransfer>) {
+        self.free.lock().unwrap().append(transfers);
+    }
+
+    fn alloc(&self) -> AsyncTransfer {
+        self.allocations.fetch_add(1, SeqCst);
+        AsyncTransfer::new(self.notifier.clone())
+    }
+
+    pub(super) fn waker(&self) -> AsyncWaker {
+        AsyncWaker {
+            notifier: self.notifier.clone(),
+        }
+    }
+}
+
+/// Wakes up a thread blocked in [`AsyncPool::poll`] of a channel from another thread.
+#[doc(hidden)]
+#[derive(Clone)]
+pub struct AsyncWaker {
+    notifier: Arc<Notifier>,
+}
+
+impl AsyncWaker {
+    /// Makes the ongoing or the next [`AsyncPool::poll`] of the channel return
+    /// `LibUsbError::Interrupted` unless its transfer has already completed.
+    #[doc(hidden)]
+    pub fn wake(&self) {
+        self.notifier.interrupt();
+        // The polling thread may be handling libusb events by itself.
+        // Safety: Interrupting the event handler is always safe, it just makes
+        // `libusb_handle_events_*` return early.
+        unsafe {
+            libusb1_sys::libusb_interrupt_event_handler(rusb::GlobalContext::default().as_raw());
+        }
+    }
+}
+
+/// Wakes up threads waiting for transfer completions.
+#[derive(Default)]
+struct Notifier {
+    /// Guards the condvar, and holds the signal which is notified together with the condvar.
+    lock: Mutex<Option<Arc<CompletionSignal>>>,
+    cond: Condvar,
+    /// Set by [`AsyncWaker::wake`] and cleared by the [`AsyncPool::poll`] which observes it.
+    interrupted: AtomicBool,
+}
+
+impl Notifier {
+    fn interrupt(&self) {
+        let _guard = self.lock.lock().unwrap();
+        self.interrupted.store(true, SeqCst);
+        self.cond.notify_all();
+    }
+
+    fn notify(&self) {
+        // Taking the lock ensures the waiter is either before the check of the flag or already
+        // waiting on the condvar, so the notification is never lost.
+        let guard = self.lock.lock().unwrap();
+        self.cond.notify_all();
+        if let Some(signal) = &*guard {
+            signal.notify();
+        }
+    }
+
+    /// Waits until `completed` is set, the notifier is interrupted, or `timeout` elapses.
+    fn wait(&self, completed: &AtomicBool, timeout: Duration) -> bool {
+        let deadline = Instant::now() + timeout;
+        let mut guard = self.lock.lock().unwrap();
+        while !completed.load(SeqCst) {
+            if self.interrupted.load(SeqCst) {
+                return false;
+            }
+            let remaining = deadline.saturating_duration_since(Instant::now());
+            if remaining == Duration::ZERO {
+                return false;
+            }
+            guard = self.cond.wait_timeout(guard, remaining).unwrap().0;
+        }
+        true
+    }
+}
+
+/// `user_data` of a transfer.
+struct Completion {
+    completed: AtomicBool,
+    notifier: Arc<Notifier>,
 }
 
 struct AsyncTransfer {
     ptr: NonNull<libusb1_sys::libusb_transfer>,
 }
 
+// Safety: The transfer is only accessed by the thread owning it while it's not pending. When it's
+// pending, libusb accesses only `user_data` which is synchronized by `AtomicBool` and `Notifier`.
+unsafe impl Send for AsyncTransfer {}
+
 impl AsyncTransfer {
-    /// Invariant: Caller must ensure `device` outlives this transfer.
-    unsafe fn new_bulk(
-        device: *mut libusb1_sys::libusb_device_handle,
-        endpoint: u8,
-        buffer: &mut [u8],
-    ) -> Self {
+    fn new(notifier: Arc<Notifier>) -> Self {
         // non-isochronous endpoints (e.g. control, bulk, interrupt) specify a value of 0
         // This is step 1 of async API
-        let ptr = libusb1_sys::libusb_alloc_transfer(0);
-        let ptr = NonNull::new(ptr).expect("Could not allocate transfer!");
+        let ptr = unsafe { libusb1_sys::libusb_alloc_transfer(0) };
+        let mut ptr = NonNull::new(ptr).expect("Could not allocate transfer!");
+
+        let completion = Completion {
+            completed: AtomicBool::new(false),
+            notifier,
+        };
+        let user_data = Box::into_raw(Box::new(completion)).cast::<libc::c_void>();
+        // Safety: `ptr` is a valid transfer which is just allocated.
+        unsafe {
+            ptr.as_mut().user_data = user_data;
+        }
 
-        let user_data = Box::into_raw(Box::new(AtomicBool::new(false))).cast::<libc::c_void>();
+        Self { ptr }
+    }
 
+    /// Points the transfer to `buffer`. The transfer is reused, so no allocation occurs.
+    ///
+    /// Invariant: Caller must ensure `device` and `buffer` outlive the submitted transfer, and
+    /// the transfer must not be pending.
+    unsafe fn fill_bulk(
+        &mut self,
+        device: *mut libusb1_sys::libusb_device_handle,
+        endpoint: u8,
+        buffer: &mut [u8],
+    ) {
+        let user_data = self.transfer().user_data;
         let length = buffer.len() as libc::c_int;
 
         libusb1_sys::libusb_fill_bulk_transfer(
-            ptr.as_ptr(),
+            self.ptr.as_ptr(),
             device,
             endpoint,
             buffer.as_ptr() as *mut u8,
@@ -132,8 +454,6 @@ impl AsyncTransfer {
             user_data,
             0,
         );
-
-        Self { ptr }
     }
 
     //// Part of step 4 of async API the transfer is finished being handled when
@@ -143,12 +463,15 @@ impl AsyncTransfer {
         // it but we haven't told anyone yet. user_data remains valid
         // because it is freed only with the transfer.
         // After the store to completed, these may no longer be valid if
-        // the polling thread freed it after seeing it completed.
-        let completed = unsafe {
+        // the polling thread freed it after seeing it completed, so the notifier is
+        // cloned beforehand.
+        let completion = unsafe {
             let transfer = &mut *transfer;
-            &*transfer.user_data.cast::<AtomicBool>()
+            &*transfer.user_data.cast::<Completion>()
         };
-        completed.store(true, SeqCst);
+        let notifier = completion.notifier.clone();
+        completion.completed.store(true, SeqCst);
+        notifier.notify();
     }
 
     fn transfer(&self) -> &libusb1_sys::libusb_transfer {
@@ -158,7 +481,7 @@ impl AsyncTransfer {
 
     fn completed_flag(&self) -> &AtomicBool {
         // Safety: transfer and user_data remain valid as long as self
-        unsafe { &*self.transfer().user_data.cast::<AtomicBool>() }
+        unsafe { &(*self.transfer().user_data.cast::<Completion>()).completed }
     }
 
     // Step 3 of async API
@@ -204,17 +527,192 @@ impl Drop for AsyncTransfer {
     fn drop(&mut self) {
         unsafe {
             drop(Box::from_raw(
-                self.transfer().user_data.cast::<AtomicBool>(),
+                self.transfer().user_data.cast::<Completion>(),
             ));
             libusb1_sys::libusb_free_transfer(self.ptr.as_ptr());
         }
     }
 }
 
+/// Allocator of device-mapped memory of a channel.
+///
+/// usbfs copies received data from its kernel buffer into the user buffer unless the user buffer
+/// is allocated by `libusb_dev_mem_alloc`, in which case the device transfers the data into the
+/// buffer directly.
+#[doc(hidden)]
+pub struct DevMemAllocator {
+    handle: NonNull<libusb1_sys::libusb_device_handle>,
+}
+
+// Safety: `libusb_dev_mem_alloc` and `libusb_dev_mem_free` are thread safe.
+unsafe impl Send for DevMemAllocator {}
+unsafe impl Sync for DevMemAllocator {}
+
+impl DevMemAllocator {
+    /// Returns `None` if the platform doesn't support device-mapped memory.
+    #[doc(hidden)]
+    pub fn new(channel: &ReceiveChannel) -> Option<Self> {
+        if cfg!(target_os = "linux") {
+            NonNull::new(get_handle(channel).as_raw()).map(|handle| Self { handle })
+        } else {
+            None
+        }
+    }
+
+    /// Allocates `len` bytes of device-mapped memory. Returns `None` if the allocation failed.
+    ///
+    /// # Safety
+    /// The channel which the allocator is created from MUST outlive the allocator.
+    #[doc(hidden)]
+    pub unsafe fn alloc(&self, len: usize) -> Option<NonNull<u8>> {
+        NonNull::new(libusb1_sys::libusb_dev_mem_alloc(self.handle.as_ptr(), len))
+    }
+
+    /// Frees memory allocated by [`Self::alloc`].
+    ///
+    /// # Safety
+    /// `ptr` and `len` MUST be the ones of the memory allocated by [`Self::alloc`] of the same
+    /// allocator. The channel which the allocator is created from MUST outlive the allocator.
+    #[doc(hidden)]
+    pub unsafe fn free(&self, ptr: NonNull<u8>, len: usize) {
+        libusb1_sys::libusb_dev_mem_free(self.handle.as_ptr(), ptr.as_ptr(), len);
+    }
+}
+
+static EVENT_THREAD: Mutex<Weak<EventThreadInner>> = Mutex::new(Weak::new());
+
+/// Handle of the thread which handles libusb events on behalf of all channels.
+///
+/// All devices are opened with `rusb::GlobalContext`, so at most one event thread runs in the
+/// process. The thread is spawned by the first [`EventThread::acquire`] call and stops when the
+/// last handle is dropped.
+#[doc(hidden)]
+#[derive(Clone)]
+pub struct EventThread {
+    inner: Arc<EventThreadInner>,
+}
+
+impl EventThread {
+    /// Returns the handle of the running event thread, or spawns it if it's not running.
+    ///
+    /// If `cpu` is set, the spawned thread is pinned to the core. `cpu` is ignored if the thread is
+    /// already running or the platform doesn't support thread affinity.
+    #[doc(hidden)]
+    pub fn acquire(cpu: Option<usize>) -> Result<Self> {
+        let mut current = EVENT_THREAD.lock().unwrap();
+        if let Some(inner) = current.upgrade() {
+            if cpu.is_some() && inner.cpu != cpu {
+                log::warn!(
+                    "libusb event thread is already running on {:?}, ignoring {:?}",
+                    inner.cpu,
+                    cpu
+                );
+            }
+            return Ok(Self { inner });
+        }
+
+        let running = Arc::new(AtomicBool::new(true));
+        let join_handle = std::thread::Builder::new()
+            .name("cameleon-libusb-events".into())
+            .spawn({
+                let running = running.clone();
+                move || handle_events_loop(&running, cpu)
+            })?;
+        let inner = Arc::new(EventThreadInner {
+            running,
+            cpu,
+            join_handle: Mutex::new(Some(join_handle)),
+        });
+        *current = Arc::downgrade(&inner);
+        Ok(Self { inner })
+    }
+
+    /// Returns the core which the event thread is pinned to.
+    #[doc(hidden)]
+    pub fn cpu(&self) -> Option<usize> {
+        self.inner.cpu
+    }
+}
+
+struct EventThreadInner {
+    running: Arc<AtomicBool>,
+    cpu: Option<usize>,
+    join_handle: Mutex<Option<JoinHandle<()>>>,
+}
+
+impl Drop for EventThreadInner {
+    fn drop(&mut self) {
+        self.running.store(false, SeqCst);
+        // Safety: Interrupting the event handler is always safe, it just makes
+        // `libusb_handle_events_*` return early.
+        unsafe {
+            libusb1_sys::libusb_interrupt_event_handler(rusb::GlobalContext::default().as_raw());
+        }
+        if let Some(join_handle) = self.join_handle.lock().unwrap().take() {
+            join_handle.join().ok();
+        }
+    }
+}
+
+fn handle_events_loop(running: &AtomicBool, cpu: Option<usize>) {
+    if let Some(cpu) = cpu {
+        pin_current_thread(cpu);
+    }
+
+    let ctx = rusb::GlobalContext::default();
+    // The timeout only bounds the latency of stopping the thread in case the interruption is
+    // missed.
+    let timeval = libc::timeval {
+        tv_sec: 0,
+        tv_usec: 100_000,
+    };
+    while running.load(SeqCst) {
+        let err = unsafe {
+            libusb1_sys::libusb_handle_events_timeout_completed(
+                ctx.as_raw(),
+                &timeval as *const _,
+                std::ptr::null_mut(),
+            )
+        };
+        match LibUsbError::from_libusb_error(err) {
+            Ok(()) | Err(LibUsbError::Interrupted | LibUsbError::Timeout) => {}
+            Err(err) => {
+                log::error!("libusb event handling failed: {}", err);
+                std::thread::sleep(Duration::from_millis(10));
+            }
+        }
+    }
+}
+
+#[cfg(target_os = "linux")]
+fn pin_current_thread(cpu: usize) {
+    // Safety: `cpu_set_t` is a plain bit set, and `sched_setaffinity` only reads it.
+    let result = unsafe {
+        let mut set = std::mem::zeroed::<libc::cpu_set_t>();
+        libc::CPU_SET(cpu, &mut set);
+        libc::sched_setaffinity(0, std::mem::size_of::<libc::cpu_set_t>(), &set)
+    };
+    if result != 0 {
+        log::warn!(
+            "failed to pin libusb event thread to cpu {}: {}",
+            cpu,
+            std::io::Error::last_os_error()
+        );
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+fn pin_current_thread(cpu: usize) {
+    log::warn!(
+        "thread affinity is not supported on this platform, ignoring cpu {}",
+        cpu
+    );
+}
+
 /// This is effectively libusb_handle_events_timeout_completed, but with
 /// `completed` as `AtomicBool` instead of `c_int` so it is safe to access
 /// without the events lock held. It also continues polling until completion,
-/// timeout, or error, instead of potentially returning early.
+/// timeout, interruption, or error, instead of potentially returning early.
 ///
 /// This design is based on
 /// <https://libusb.sourceforge.io/api-1.0/libusb_mtasync.html#threadwait>
@@ -222,6 +720,7 @@ fn poll_completed(
     ctx: &impl UsbContext,
     timeout: Duration,
     completed: &AtomicBool,
+    interrupted: &AtomicBool,
 ) -> Result<bool> {
     use libusb1_sys::{constants::*, *};
 
@@ -229,7 +728,11 @@ fn poll_completed(
 
     unsafe {
         let mut err = 0_i32;
-        while err == 0_i32 && !completed.load(SeqCst) && deadline > Instant::now() {
+        while err == 0_i32
+            && !completed.load(SeqCst)
+            && !interrupted.load(SeqCst)
+            && deadline > Instant::now()
+        {
             let remaining = deadline.saturating_duration_since(Instant::now());
             let timeval = libc::timeval {
                 tv_sec: remaining.as_secs().try_into().unwrap(),
@@ -307,3 +810,60 @@ cfg_if::cfg_if! {
         }
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_notifier() {
+        let notifier = Arc::new(Notifier::default());
+        let completed = Arc::new(AtomicBool::new(false));
+        assert!(!notifier.wait(&completed, Duration::from_millis(1)));
+
+        let waker = std::thread::spawn({
+            let notifier = notifier.clone();
+            let completed = completed.clone();
+            move || {
+                completed.store(true, SeqCst);
+                notifier.notify();
+            }
+        });
+        assert!(notifier.wait(&completed, Duration::from_secs(10)));
+        waker.join().unwrap();
+    }
+
+    #[test]
+    fn test_completion_signal() {
+        let notifier = Arc::new(Notifier::default());
+        let signal = Arc::new(CompletionSignal::default());
+        *notifier.lock.lock().unwrap() = Some(signal.clone());
+
+        let generation = signal.generation();
+        assert!(!signal.wait(generation, Duration::from_millis(1)));
+
+        let waker = std::thread::spawn({
+            let notifier = notifier.clone();
+            move || notifier.notify()
+        });
+        assert!(signal.wait(generation, Duration::from_secs(10)));
+        waker.join().unwrap();
+        // The notification isn't lost even if it happens before the wait.
+        assert!(signal.wait(generation, Duration::from_millis(1)));
+        assert!(!signal.wait(signal.generation(), Duration::from_millis(1)));
+    }
+
+    #[test]
+    fn test_notifier_interrupt() {
+        let notifier = Arc::new(Notifier::default());
+        let completed = AtomicBool::new(false);
+
+        let waker = std::thread::spawn({
+            let notifier = notifier.clone();
+            move || notifier.interrupt()
+        });
+        assert!(!notifier.wait(&completed, Duration::from_secs(10)));
+        waker.join().unwrap();
+        assert!(notifier.interrupted.load(SeqCst));
+    }
+}
@@ -6,7 +6,10 @@ use std::time;
 
 use crate::u3v::Result;
 
-use super::device::LibUsbDeviceHandle;
+use super::{
+    async_read::{AsyncWaker, TransferRing},
+    device::LibUsbDeviceHandle,
+};
 
 pub struct ControlChannel {
     pub(super) device_handle: LibUsbDeviceHandle,
@@ -78,6 +81,7 @@ pub struct ReceiveChannel {
     pub(super) device_handle: LibUsbDeviceHandle,
     pub iface_info: ReceiveIfaceInfo,
     pub is_opened: bool,
+    pub(super) transfer_ring: TransferRing,
 }
 
 impl ReceiveChannel {
@@ -123,11 +127,26 @@ impl ReceiveChannel {
         Ok(())
     }
 
+    /// Returns the total number of `libusb_transfer` allocated for async reads on the channel.
+    #[must_use]
+    pub fn transfer_allocations(&self) -> usize {
+        self.transfer_ring.allocations()
+    }
+
+    /// Returns a waker which interrupts [`AsyncPool::poll`] of the channel from another thread.
+    ///
+    /// [`AsyncPool::poll`]: super::async_read::AsyncPool::poll
+    #[doc(hidden)]
+    pub fn async_waker(&self) -> AsyncWaker {
+        self.transfer_ring.waker()
+    }
+
     pub(super) fn new(device_handle: LibUsbDeviceHandle, iface_info: ReceiveIfaceInfo) -> Self {
         Self {
             device_handle,
             iface_info,
             is_opened: false,
+            transfer_ring: TransferRing::default(),
         }
     }
 }
@@ -2,6 +2,8 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 
+use std::collections::HashMap;
+
 use cameleon_impl::bytes_io::ReadBytes;
 use semver::Version;
 
@@ -24,15 +26,188 @@ const USB3V_SUBCLASS: u8 = 0x05;
 
 pub fn enumerate_devices() -> Result<Vec<Device>> {
     let rusb_device_list = rusb::DeviceList::new()?;
-    let builders = rusb_device_list
+    let candidates = rusb_device_list
         .iter()
-        .filter_map(|dev| DeviceBuilder::new(dev).ok().flatten());
-
-    Ok(builders
-        .filter_map(|builder| builder.build().ok())
+        .filter(is_u3v_candidate)
+        .filter_map(|dev| Some((DeviceLocation::new(&dev).ok()?, dev)))
+        .collect();
+
+    Ok(probe_all(candidates)
+        .into_iter()
+        .filter_map(|(_, probed)| probed.ok())
+        .map(|probed| probed.to_device())
         .collect())
 }
 
+/// Cache of probed U3V devices.
+///
+/// Probing a device requires opening it and reading its string descriptors, which takes a while
+/// for each device. [`DeviceCache::enumerate`] only probes devices connected since the last call,
+/// and returns the rest from the cache.
+///
+/// NOTE: Device information is not updated while the device is cached, e.g. the user defined
+/// name written after probing. Call [`DeviceCache::clear`] to probe all devices again.
+#[derive(Default)]
+pub struct DeviceCache {
+    devices: HashMap<DeviceLocation, ProbedDevice>,
+}
+
+impl DeviceCache {
+    /// Creates an empty cache.
+    #[must_use]
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Enumerates U3V devices connected to the host.
+    ///
+    /// Devices which are newly connected are probed in parallel, and devices which are
+    /// disconnected are removed from the cache.
+    pub fn enumerate(&mut self) -> Result<Vec<Device>> {
+        let rusb_device_list = rusb::DeviceList::new()?;
+        let mut locations = vec![];
+        let mut candidates = vec![];
+        for dev in rusb_device_list.iter().filter(is_u3v_candidate) {
+            let location = match DeviceLocation::new(&dev) {
+                Ok(location) => location,
+                Err(_) => continue,
+            };
+            if !self.devices.contains_key(&location) {
+                candidates.push((location, dev));
+            }
+            locations.push(location);
+        }
+
+        for (location, probed) in probe_all(candidates) {
+            match probed {
+                Ok(probed) => {
+                    self.devices.insert(location, probed);
+                }
+                Err(err) => log::warn!("failed to probe U3V device: {}", err),
+            }
+        }
+        self.devices
+            .retain(|location, _| locations.contains(location));
+
+        Ok(locations
+            .iter()
+            .filter_map(|location| self.devices.get(location))
+            .map(ProbedDevice::to_device)
+            .collect())
+    }
+
+    /// Removes all devices from the cache.
+    pub fn clear(&mut self) {
+        self.devices.clear();
+    }
+
+    /// Returns the number of cached devices.
+    #[must_use]
+    pub fn len(&self) -> usize {
+        self.devices.len()
+    }
+
+    /// Returns `true` if no device is cached.
+    #[must_use]
+    pub fn is_empty(&self) -> bool {
+        self.devices.is_empty()
+    }
+}
+
+/// Location of a device on the bus.
+///
+/// The host assigns a new address to a device on each connection, so a reconnected device never
+/// shares the location with the previous connection.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub(super) struct DeviceLocation {
+    bus_number: u8,
+    address: u8,
+    vid: u16,
+    pid: u16,
+}
+
+impl DeviceLocation {
+    pub(super) fn new(device: &RusbDevice) -> Result<Self> {
+        let device_desc = device.device_descriptor()?;
+        Ok(Self {
+            bus_number: device.bus_number(),
+            address: device.address(),
+            vid: device_desc.vendor_id(),
+            pid: device_desc.product_id(),
+        })
+    }
+}
+
+/// All information needed to create [`Device`] without accessing the device again.
+#[derive(Clone)]
+pub(super) struct ProbedDevice {
+    device: RusbDevice,
+    ctrl_iface_info: ControlIfaceInfo,
+    event_iface_info: Option<ReceiveIfaceInfo>,
+    stream_iface_info: Option<ReceiveIfaceInfo>,
+    device_info: DeviceInfo,
+}
+
+impl ProbedDevice {
+    pub(super) fn device_info(&self) -> &DeviceInfo {
+        &self.device_info
+    }
+
+    pub(super) fn to_device(&self) -> Device {
+        Device::new(
+            self.device.clone(),
+            self.ctrl_iface_info.clone(),
+            self.event_iface_info.clone(),
+            self.stream_iface_info.clone(),
+            self.device_info.clone(),
+        )
+    }
+}
+
+/// Returns `true` if the device descriptor says the device may be a U3V device. The descriptor
+/// is cached by libusb, so this doesn't access the device.
+pub(super) fn is_u3v_candidate(device: &RusbDevice) -> bool {
+    matches!(device.device_descriptor(), Ok(desc)
+        if desc.class_code() == MISCELLANEOUS_CLASS
+            && desc.sub_class_code() == DEVICE_SUBCLASS
+            && desc.protocol_code() == DEVICE_PROTOCOL)
+}
+
+/// Probes `devices` and returns the result for each device in the same order.
+///
+/// Probing is dominated by control transfer round trips rather than CPU, so each device is
+/// probed on its own thread.
+pub(super) fn probe_all(
+    devices: Vec<(DeviceLocation, RusbDevice)>,
+) -> Vec<(DeviceLocation, Result<ProbedDevice>)> {
+    fn probe(device: RusbDevice) -> Result<ProbedDevice> {
+        DeviceBuilder::new(device)?
+            .ok_or(Error::InvalidDevice)?
+            .build()
+    }
+
+    if devices.len() <= 1 {
+        return devices
+            .into_iter()
+            .map(|(location, dev)| (location, probe(dev)))
+            .collect();
+    }
+
+    std::thread::scope(|s| {
+        let handles: Vec<_> = devices
+            .into_iter()
+            .map(|(location, dev)| (location, s.spawn(move || probe(dev))))
+            .collect();
+        handles
+            .into_iter()
+            .map(|(location, handle)| {
+                let probed = handle.join().unwrap_or(Err(Error::InvalidDevice));
+                (location, probed)
+            })
+            .collect()
+    })
+}
+
 struct DeviceBuilder {
     device: RusbDevice,
     u3v_iad: Iad,
@@ -59,7 +234,7 @@ impl DeviceBuilder {
         Ok(None)
     }
 
-    fn build(self) -> Result<Device> {
+    fn build(self) -> Result<ProbedDevice> {
         // TODO: Log it when device is broken or invalid.
         let dev_channel = self.device.open()?;
         if dev_channel.active_configuration()? != self.config_desc.number() {
@@ -114,13 +289,13 @@ impl DeviceBuilder {
             None => (None, None),
         };
 
-        Ok(Device::new(
-            self.device,
+        Ok(ProbedDevice {
+            device: self.device,
             ctrl_iface_info,
-            event_iface,
-            stream_iface,
+            event_iface_info: event_iface,
+            stream_iface_info: stream_iface,
             device_info,
-        ))
+        })
     }
 
     fn find_u3v_iad(
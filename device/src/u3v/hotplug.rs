@@ -0,0 +1,212 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+use std::{
+    collections::HashMap,
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        mpsc, Arc,
+    },
+    thread::JoinHandle,
+    time::Duration,
+};
+
+use rusb::UsbContext;
+
+use crate::u3v::{DeviceInfo, Error, LibUsbError, Result};
+
+use super::{
+    device::{Device, RusbDevice},
+    device_builder::{self, DeviceLocation},
+};
+
+/// Interval to check the cancellation of the monitor.
+const POLL_INTERVAL: Duration = Duration::from_millis(100);
+
+/// A device may not respond to requests right after its arrival, so probing is retried.
+const PROBE_RETRY: usize = 3;
+const PROBE_RETRY_INTERVAL: Duration = Duration::from_millis(200);
+
+/// Notification of [`HotplugMonitor`].
+pub enum HotplugEvent {
+    /// A U3V device is connected.
+    Arrived(Device),
+    /// A U3V device notified by [`HotplugEvent::Arrived`] is disconnected.
+    Left(DeviceInfo),
+}
+
+/// Monitors connection and disconnection of U3V devices using libusb hotplug.
+///
+/// Only the arrived device is probed on each notification, so the whole bus is never scanned
+/// again. The monitor is stopped when dropped.
+pub struct HotplugMonitor {
+    cancelled: Arc<AtomicBool>,
+    join_handle: Option<JoinHandle<()>>,
+}
+
+impl HotplugMonitor {
+    /// Starts monitoring on a background thread. `callback` is called with
+    /// [`HotplugEvent::Arrived`] for devices already connected, then for each connection and
+    /// disconnection.
+    ///
+    /// Returns `LibUsbError::NotSupported` if the platform doesn't support hotplug.
+    pub fn start<F>(callback: F) -> Result<Self>
+    where
+        F: FnMut(HotplugEvent) + Send + 'static,
+    {
+        if !rusb::has_hotplug() {
+            return Err(LibUsbError::NotSupported.into());
+        }
+
+        let cancelled = Arc::new(AtomicBool::new(false));
+        let (ready_tx, ready_rx) = mpsc::channel();
+        let monitor_loop = MonitorLoop {
+            callback,
+            cancelled: cancelled.clone(),
+            known: HashMap::new(),
+        };
+        let join_handle = std::thread::spawn(move || monitor_loop.run(&ready_tx));
+
+        match ready_rx.recv() {
+            Ok(Ok(())) => Ok(Self {
+                cancelled,
+                join_handle: Some(join_handle),
+            }),
+            Ok(Err(err)) => Err(err),
+            Err(_) => Err(LibUsbError::Other.into()),
+        }
+    }
+
+    /// Stops monitoring.
+    pub fn stop(mut self) {
+        self.stop_impl();
+    }
+
+    fn stop_impl(&mut self) {
+        if let Some(join_handle) = self.join_handle.take() {
+            self.cancelled.store(true, Ordering::Relaxed);
+            rusb::GlobalContext::default().interrupt_handle_events();
+            if join_handle.join().is_err() {
+                log::error!("hotplug monitor panicked");
+            }
+        }
+    }
+}
+
+impl Drop for HotplugMonitor {
+    fn drop(&mut self) {
+        self.stop_impl();
+    }
+}
+
+enum RawEvent {
+    Arrived(RusbDevice),
+    Left(RusbDevice),
+}
+
+/// Forwards notifications to the monitor loop, because libusb doesn't allow to communicate with
+/// the device inside the hotplug callback.
+struct Forwarder {
+    tx: mpsc::Sender<RawEvent>,
+}
+
+impl rusb::Hotplug<rusb::GlobalContext> for Forwarder {
+    fn device_arrived(&mut self, device: RusbDevice) {
+        self.tx.send(RawEvent::Arrived(device)).ok();
+    }
+
+    fn device_left(&mut self, device: RusbDevice) {
+        self.tx.send(RawEvent::Left(device)).ok();
+    }
+}
+
+struct MonitorLoop<F> {
+    callback: F,
+    cancelled: Arc<AtomicBool>,
+    known: HashMap<DeviceLocation, DeviceInfo>,
+}
+
+impl<F: FnMut(HotplugEvent)> MonitorLoop<F> {
+    fn run(mut self, ready_tx: &mpsc::Sender<Result<()>>) {
+        let ctx = rusb::GlobalContext::default();
+        let (tx, rx) = mpsc::channel();
+        let _registration = match rusb::HotplugBuilder::new()
+            .enumerate(true)
+            .register(ctx, Box::new(Forwarder { tx }))
+        {
+            Ok(registration) => {
+                ready_tx.send(Ok(())).ok();
+                registration
+            }
+            Err(err) => {
+                ready_tx.send(Err(err.into())).ok();
+                return;
+            }
+        };
+
+        while !self.cancelled.load(Ordering::Relaxed) {
+            if let Err(err) = ctx.handle_events(Some(POLL_INTERVAL)) {
+                let err: Error = err.into();
+                log::warn!("failed to handle hotplug events: {}", err);
+            }
+
+            let mut arrived = vec![];
+            for event in rx.try_iter() {
+                match event {
+                    RawEvent::Arrived(dev) if device_builder::is_u3v_candidate(&dev) => {
+                        if let Ok(location) = DeviceLocation::new(&dev) {
+                            arrived.push((location, dev));
+                        }
+                    }
+                    RawEvent::Arrived(_) => {}
+                    RawEvent::Left(dev) => self.left(&dev),
+                }
+            }
+            if !arrived.is_empty() {
+                self.arrived(arrived);
+            }
+        }
+    }
+
+    fn arrived(&mut self, mut pending: Vec<(DeviceLocation, RusbDevice)>) {
+        for retry in 0..PROBE_RETRY {
+            if retry > 0 {
+                std::thread::sleep(PROBE_RETRY_INTERVAL);
+            }
+
+            let results = device_builder::probe_all(pending.clone());
+            let mut failed = vec![];
+            for (candidate, (location, probed)) in pending.into_iter().zip(results) {
+                match probed {
+                    Ok(probed) => {
+                        self.known.insert(location, probed.device_info().clone());
+                        (self.callback)(HotplugEvent::Arrived(probed.to_device()));
+                    }
+                    // The device is not a U3V device.
+                    Err(Error::InvalidDevice) => {}
+                    Err(err) => {
+                        log::debug!("failed to probe arrived device: {}", err);
+                        failed.push(candidate);
+                    }
+                }
+            }
+
+            pending = failed;
+            if pending.is_empty() {
+                return;
+            }
+        }
+        log::warn!("failed to probe {} arrived device(s)", pending.len());
+    }
+
+    fn left(&mut self, device: &RusbDevice) {
+        let location = match DeviceLocation::new(device) {
+            Ok(location) => location,
+            Err(_) => return,
+        };
+        if let Some(device_info) = self.known.remove(&location) {
+            (self.callback)(HotplugEvent::Left(device_info));
+        }
+    }
+}
@@ -16,11 +16,13 @@ mod channel;
 mod device;
 mod device_builder;
 mod device_info;
+mod hotplug;
 
 pub use channel::{ControlChannel, ReceiveChannel};
 pub use device::Device;
-pub use device_builder::enumerate_devices;
+pub use device_builder::{enumerate_devices, DeviceCache};
 pub use device_info::{BusSpeed, DeviceInfo};
+pub use hotplug::{HotplugEvent, HotplugMonitor};
 
 use std::borrow::Cow;
 
@@ -0,0 +1,308 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! Benchmarks of `GenApi` parsing and node access.
+//!
+//! Parse benchmarks run against generated XMLs whose size is comparable to vendor XMLs. To
+//! measure actual vendor XMLs as well, set `CAMELEON_BENCH_XML` to a list of paths, e.g.
+//! `CAMELEON_BENCH_XML=a.xml:b.xml cargo bench -p cameleon-genapi`.
+
+use std::fmt::Write;
+
+use cameleon_genapi::{
+    builder::GenApiBuilder,
+    prelude::*,
+    store::{DefaultCacheStore, DefaultNodeStore, DefaultValueStore},
+    Device, NodeStore, ValueCtxt,
+};
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+
+// Shares the `RegisterDescription` fixture with unit tests.
+#[allow(dead_code)]
+#[path = "../src/testing.rs"]
+mod testing;
+
+type DeviceError = Box<dyn std::error::Error + Send + Sync>;
+
+/// A device which holds the whole register space in memory.
+struct MockDevice {
+    memory: Vec<u8>,
+}
+
+impl MockDevice {
+    fn new(len: usize) -> Self {
+        Self {
+            memory: vec![0; len],
+        }
+    }
+}
+
+impl Device for MockDevice {
+    fn read_mem(&mut self, address: i64, buf: &mut [u8]) -> Result<(), DeviceError> {
+        let address = address as usize;
+        buf.copy_from_slice(&self.memory[address..address + buf.len()]);
+        Ok(())
+    }
+
+    fn write_mem(&mut self, address: i64, data: &[u8]) -> Result<(), DeviceError> {
+        let address = address as usize;
+        self.memory[address..address + data.len()].copy_from_slice(data);
+        Ok(())
+    }
+}
+
+const PORT: &str = r#"
+    <Port Name="Device">
+    </Port>
+"#;
+
+/// Builds an XML with `feature_count` features, each of which consists of an `Integer`, an
+/// `Enumeration`, a `Float` and a `Boolean` backed by registers, in the way vendor XMLs are
+/// typically written.
+fn vendor_like_xml(feature_count: usize) -> String {
+    let mut xml = String::new();
+
+    xml.push_str("    <Category Name=\"Root\">\n");
+    for i in 0..feature_count {
+        writeln!(xml, "        <pFeature>Category{}</pFeature>", i).unwrap();
+    }
+    xml.push_str("    </Category>\n");
+
+    for i in 0..feature_count {
+        let address = i * 0x20;
+        write!(
+            xml,
+            r#"
+    <Category Name="Category{i}">
+        <pFeature>Int{i}</pFeature>
+        <pFeature>Enum{i}</pFeature>
+        <pFeature>Float{i}</pFeature>
+        <pFeature>Bool{i}</pFeature>
+    </Category>
+
+    <Integer Name="Int{i}" NameSpace="Custom">
+        <ToolTip>Integer feature {i}.</ToolTip>
+        <Description>Integer feature {i}, which is backed by IntReg{i}.</Description>
+        <DisplayName>Integer Feature {i}</DisplayName>
+        <Visibility>Beginner</Visibility>
+        <pValue>IntReg{i}</pValue>
+        <Min>0</Min>
+        <Max>65535</Max>
+        <Inc>1</Inc>
+    </Integer>
+
+    <IntReg Name="IntReg{i}">
+        <Address>{int_addr:#x}</Address>
+        <Length>4</Length>
+        <AccessMode>RW</AccessMode>
+        <pPort>Device</pPort>
+        <Endianess>LittleEndian</Endianess>
+    </IntReg>
+
+    <Enumeration Name="Enum{i}" NameSpace="Custom">
+        <ToolTip>Enumeration feature {i}.</ToolTip>
+        <Visibility>Expert</Visibility>
+        <EnumEntry Name="Off">
+            <Value>0</Value>
+        </EnumEntry>
+        <EnumEntry Name="Once">
+            <Value>1</Value>
+        </EnumEntry>
+        <EnumEntry Name="Continuous">
+            <Value>2</Value>
+        </EnumEntry>
+        <pValue>EnumReg{i}</pValue>
+    </Enumeration>
+
+    <IntReg Name="EnumReg{i}">
+        <Address>{enum_addr:#x}</Address>
+        <Length>4</Length>
+        <AccessMode>RW</AccessMode>
+        <pPort>Device</pPort>
+        <Endianess>LittleEndian</Endianess>
+    </IntReg>
+
+    <Float Name="Float{i}" NameSpace="Custom">
+        <ToolTip>Float feature {i}.</ToolTip>
+        <pValue>FloatReg{i}</pValue>
+        <Min>0.0</Min>
+        <Max>1000.0</Max>
+        <Unit>us</Unit>
+    </Float>
+
+    <FloatReg Name="FloatReg{i}">
+        <Address>{float_addr:#x}</Address>
+        <Length>8</Length>
+        <AccessMode>RW</AccessMode>
+        <pPort>Device</pPort>
+        <Endianess>LittleEndian</Endianess>
+    </FloatReg>
+
+    <Boolean Name="Bool{i}" NameSpace="Custom">
+        <ToolTip>Boolean feature {i}.</ToolTip>
+        <pValue>BoolReg{i}</pValue>
+        <OnValue>1</OnValue>
+        <OffValue>0</OffValue>
+    </Boolean>
+
+    <MaskedIntReg Name="BoolReg{i}">
+        <Address>{bool_addr:#x}</Address>
+        <Length>4</Length>
+        <AccessMode>RW</AccessMode>
+        <pPort>Device</pPort>
+        <Bit>0</Bit>
+    </MaskedIntReg>
+"#,
+            i = i,
+            int_addr = address,
+            enum_addr = address + 0x4,
+            float_addr = address + 0x8,
+            bool_addr = address + 0x10,
+        )
+        .unwrap();
+    }
+
+    xml.push_str(PORT);
+    testing::register_description(&xml)
+}
+
+/// Builds an XML with a chain of `depth` `IntSwissKnife`s, where `Knife{n}` refers to
+/// `Knife{n - 1}` and `Knife0` refers to `Seed` register.
+fn swiss_knife_chain_xml(depth: usize) -> String {
+    let mut xml = String::new();
+    xml.push_str(
+        r#"
+    <IntReg Name="Seed">
+        <Address>0x0</Address>
+        <Length>4</Length>
+        <AccessMode>RO</AccessMode>
+        <pPort>Device</pPort>
+        <Endianess>LittleEndian</Endianess>
+    </IntReg>
+"#,
+    );
+
+    for i in 0..depth {
+        let prev = if i == 0 {
+            "Seed".to_string()
+        } else {
+            format!("Knife{}", i - 1)
+        };
+        write!(
+            xml,
+            r#"
+    <IntSwissKnife Name="Knife{i}">
+        <pVariable Name="PREV">{prev}</pVariable>
+        <pVariable Name="SEED">Seed</pVariable>
+        <Constant Name="SCALE">3</Constant>
+        <Formula>((PREV * SCALE + SEED) % 65521) + (PREV &gt; SEED ? 1 : 0)</Formula>
+    </IntSwissKnife>
+"#,
+            i = i,
+            prev = prev,
+        )
+        .unwrap();
+    }
+
+    xml.push_str(PORT);
+    testing::register_description(&xml)
+}
+
+type Ctxt = ValueCtxt<DefaultValueStore, DefaultCacheStore>;
+
+fn build(xml: &str) -> (DefaultNodeStore, Ctxt) {
+    let (_, store, cx) = GenApiBuilder::<DefaultNodeStore>::default()
+        .build(&xml)
+        .unwrap();
+    (store, cx)
+}
+
+fn bench_parse(c: &mut Criterion) {
+    let mut xmls: Vec<(String, String)> = [100, 1000]
+        .iter()
+        .map(|&n| (format!("generated/{}", n), vendor_like_xml(n)))
+        .collect();
+    if let Some(paths) = std::env::var_os("CAMELEON_BENCH_XML") {
+        for path in std::env::split_paths(&paths) {
+            let xml = std::fs::read_to_string(&path).unwrap();
+            xmls.push((path.display().to_string(), xml));
+        }
+    }
+
+    let mut group = c.benchmark_group("parse");
+    for (name, xml) in &xmls {
+        group.throughput(Throughput::Bytes(xml.len() as u64));
+        group.bench_with_input(BenchmarkId::new("build", name), xml, |b, xml| {
+            b.iter(|| {
+                GenApiBuilder::<DefaultNodeStore>::default()
+                    .build(xml)
+                    .unwrap()
+            });
+        });
+        group.bench_with_input(BenchmarkId::new("build_lazy", name), xml, |b, xml| {
+            b.iter(|| {
+                GenApiBuilder::<DefaultNodeStore>::default()
+                    .build_lazy(xml.as_str())
+                    .unwrap()
+            });
+        });
+    }
+    group.finish();
+}
+
+fn bench_swiss_knife(c: &mut Criterion) {
+    let mut group = c.benchmark_group("swiss_knife_chain");
+    for &depth in &[1, 8, 64] {
+        let (store, mut cx) = build(&swiss_knife_chain_xml(depth));
+        let mut device = MockDevice::new(4);
+        device.memory[0] = 7;
+        let node = store
+            .id_by_name(format!("Knife{}", depth - 1))
+            .unwrap()
+            .as_iinteger_kind(&store)
+            .unwrap();
+
+        group.bench_with_input(BenchmarkId::from_parameter(depth), &depth, |b, _| {
+            b.iter(|| {
+                // Every node of the chain is evaluated again.
+                cx.clear_cache();
+                black_box(node.value(&mut device, &store, &mut cx).unwrap())
+            });
+        });
+    }
+    group.finish();
+}
+
+fn bench_integer_value(c: &mut Criterion) {
+    let (store, mut cx) = build(&vendor_like_xml(100));
+    let mut device = MockDevice::new(0x20 * 100);
+    let node = store
+        .id_by_name("Int50")
+        .unwrap()
+        .as_iinteger_kind(&store)
+        .unwrap();
+    let reg = store.id_by_name("IntReg50").unwrap();
+
+    let mut group = c.benchmark_group("integer_value");
+    group.bench_function("cache_hit", |b| {
+        node.value(&mut device, &store, &mut cx).unwrap();
+        b.iter(|| black_box(node.value(&mut device, &store, &mut cx).unwrap()));
+    });
+    group.bench_function("cache_miss", |b| {
+        b.iter(|| {
+            cx.invalidate_cache_of(reg);
+            black_box(node.value(&mut device, &store, &mut cx).unwrap())
+        });
+    });
+    group.bench_function("set_value", |b| {
+        b.iter(|| {
+            node.set_value(black_box(42), &mut device, &store, &mut cx)
+                .unwrap()
+        });
+    });
+    group.finish();
+}
+
+criterion_group!(benches, bench_parse, bench_swiss_knife, bench_integer_value);
+criterion_main!(benches);
@@ -0,0 +1,457 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! Batched read of registers.
+//!
+//! Reading nodes one by one issues a transaction for each register. [`prefetch`] instead gathers
+//! the registers which the nodes depend on, merges adjacent or overlapping ranges and reads them
+//! all in a single [`Device::read_mem_stacked`] call per port, so that the following reads of the
+//! nodes are answered from the cache.
+//!
+//! [`refresh`] does the same for nodes declaring `PollingTime`, overwriting the cache even for
+//! `NoCache` registers so that a poller can keep their values recent.
+//!
+//! Registers of chunk ports are never fetched since they are read from chunk data attached to the
+//! device, see [`chunk_registers`].
+
+use std::collections::{HashMap, HashSet};
+
+use super::{
+    elem_type::{AccessMode, CachingMode},
+    parser::visit_dependencies,
+    register_base::RegisterBase,
+    store::{CacheStore, NodeData, NodeId, NodeStore, ValueStore},
+    Device, GenApiError, GenApiResult, ValueCtxt,
+};
+
+/// Register to be fetched.
+struct Fetch {
+    nid: NodeId,
+    address: i64,
+    length: i64,
+}
+
+/// Contiguous range of the memory containing one or more registers.
+struct Block {
+    address: i64,
+    end: i64,
+    fetches: Vec<Fetch>,
+}
+
+/// Reads all registers which `nodes` depend on, and stores them in the cache.
+///
+/// Registers with `NoCache`, registers which aren't readable, e.g. not available, registers of
+/// chunk ports and registers which are already cached are skipped. Adjacent or overlapping
+/// registers are merged into one range, and the ranges of each port are read by a single
+/// [`Device::read_mem_stacked`] call.
+///
+/// Nothing is cached if the cache store doesn't cache register data, e.g. `CacheSink`.
+pub fn prefetch<T: ValueStore, U: CacheStore>(
+    nodes: impl IntoIterator<Item = NodeId>,
+    device: &mut impl Device,
+    store: &impl NodeStore,
+    cx: &mut ValueCtxt<T, U>,
+) -> GenApiResult<()> {
+    fetch(nodes, device, store, cx, false)
+}
+
+/// Reads all registers which `nodes` depend on, and overwrites their cache.
+///
+/// Unlike [`prefetch`], `NoCache` registers and registers which are already cached are also read,
+/// and cached values of nodes depending on them are invalidated. Readers then observe the value
+/// read by the latest `refresh` without accessing the device, until the cache is invalidated,
+/// e.g. by [`invalidate_registers`].
+pub fn refresh<T: ValueStore, U: CacheStore>(
+    nodes: impl IntoIterator<Item = NodeId>,
+    device: &mut impl Device,
+    store: &impl NodeStore,
+    cx: &mut ValueCtxt<T, U>,
+) -> GenApiResult<()> {
+    fetch(nodes, device, store, cx, true)
+}
+
+/// Invalidates the cache of all registers which `nodes` depend on.
+pub fn invalidate_registers<T: ValueStore, U: CacheStore>(
+    nodes: impl IntoIterator<Item = NodeId>,
+    store: &impl NodeStore,
+    cx: &mut ValueCtxt<T, U>,
+) {
+    for (nid, _) in registers(nodes, store) {
+        cx.invalidate_cache_of(nid);
+    }
+}
+
+/// Returns nodes declaring `PollingTime` paired with the time in milliseconds.
+pub fn polling_nodes(store: &impl NodeStore) -> Vec<(NodeId, u64)> {
+    let mut nodes = vec![];
+    store.visit_nodes(|data| match data.polling_time() {
+        Some(polling_time) if polling_time > 0 => {
+            nodes.push((data.node_base().id(), polling_time));
+        }
+        _ => {}
+    });
+    nodes
+}
+
+/// Returns registers of chunk ports.
+///
+/// Cached values of them are stale once another chunk data is attached to the device, so their
+/// cache should be invalidated, e.g. by [`invalidate_registers`], when the chunk data changes.
+pub fn chunk_registers(store: &impl NodeStore) -> Vec<NodeId> {
+    let mut nodes = vec![];
+    store.visit_nodes(|data| {
+        if let Some(register_base) = data.register_base() {
+            if matches!(store.node_opt(register_base.p_port), Some(NodeData::Port(port)) if port.chunk_id.is_some())
+            {
+                nodes.push(data.node_base().id());
+            }
+        }
+    });
+    nodes
+}
+
+fn fetch<T: ValueStore, U: CacheStore>(
+    nodes: impl IntoIterator<Item = NodeId>,
+    device: &mut impl Device,
+    store: &impl NodeStore,
+    cx: &mut ValueCtxt<T, U>,
+    is_refresh: bool,
+) -> GenApiResult<()> {
+    let mut fetches: HashMap<NodeId, Vec<Fetch>> = HashMap::new();
+    for (nid, register_base) in registers(nodes, store) {
+        if (!is_refresh && register_base.cacheable == CachingMode::NoCache)
+            || register_base.access_mode == AccessMode::WO
+        {
+            continue;
+        }
+        match store.node_opt(register_base.p_port) {
+            Some(NodeData::Port(port)) if port.chunk_id.is_none() => {}
+            _ => continue,
+        }
+
+        // A register which can't be read now, e.g. unavailable under the current selector, must
+        // not fail the other registers of the batch.
+        if !matches!(register_base.is_readable(device, store, cx), Ok(true)) {
+            continue;
+        }
+        let (address, length) = match (
+            register_base.address(device, store, cx),
+            register_base.length(device, store, cx),
+        ) {
+            (Ok(address), Ok(length)) => (address, length),
+            _ => continue,
+        };
+        if length <= 0 || (!is_refresh && cx.get_cache(nid, address, length).is_some()) {
+            continue;
+        }
+        fetches
+            .entry(register_base.p_port)
+            .or_default()
+            .push(Fetch {
+                nid,
+                address,
+                length,
+            });
+    }
+
+    for (_, fetches) in fetches {
+        let blocks = merge(fetches);
+        let mut bufs: Vec<Vec<u8>> = blocks
+            .iter()
+            .map(|block| vec![0; (block.end - block.address) as usize])
+            .collect();
+        let mut entries: Vec<_> = blocks
+            .iter()
+            .zip(bufs.iter_mut())
+            .map(|(block, buf)| (block.address, buf.as_mut_slice()))
+            .collect();
+        device
+            .read_mem_stacked(&mut entries)
+            .map_err(GenApiError::device)?;
+
+        for (block, buf) in blocks.iter().zip(&bufs) {
+            for fetch in &block.fetches {
+                let start = (fetch.address - block.address) as usize;
+                let data = &buf[start..start + fetch.length as usize];
+                if is_refresh {
+                    cx.invalidate_cache_of(fetch.nid);
+                }
+                cx.cache_data(fetch.nid, fetch.address, fetch.length, data);
+            }
+        }
+    }
+
+    Ok(())
+}
+
+/// Collects registers which `nodes` depend on transitively.
+fn registers(
+    nodes: impl IntoIterator<Item = NodeId>,
+    store: &impl NodeStore,
+) -> Vec<(NodeId, &RegisterBase)> {
+    let mut visited = HashSet::new();
+    let mut stack: Vec<_> = nodes.into_iter().collect();
+    let mut registers = vec![];
+    while let Some(nid) = stack.pop() {
+        if !visited.insert(nid) {
+            continue;
+        }
+        let data = if let Some(data) = store.node_opt(nid) {
+            data
+        } else {
+            continue;
+        };
+        if let Some(register_base) = data.register_base() {
+            registers.push((nid, register_base));
+        }
+        visit_dependencies(data, |dependency| stack.push(dependency));
+    }
+    registers
+}
+
+fn merge(mut fetches: Vec<Fetch>) -> Vec<Block> {
+    fetches.sort_by_key(|fetch| fetch.address);
+
+    let mut blocks: Vec<Block> = vec![];
+    for fetch in fetches {
+        let end = fetch.address + fetch.length;
+        match blocks.last_mut() {
+            Some(block) if fetch.address <= block.end => {
+                block.end = block.end.max(end);
+                block.fetches.push(fetch);
+            }
+            _ => blocks.push(Block {
+                address: fetch.address,
+                end,
+                fetches: vec![fetch],
+            }),
+        }
+    }
+    blocks
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::{
+        builder::GenApiBuilder,
+        interface::IInteger,
+        store::{DefaultNodeStore, NodeStore},
+        testing::{register_description, TestDevice},
+    };
+
+    use super::{chunk_registers, invalidate_registers, polling_nodes, prefetch, refresh};
+
+    #[test]
+    fn test_prefetch() {
+        let xml = register_description(
+            r#"
+
+            <Integer Name="Width">
+                <pValue>WidthReg</pValue>
+                <pMax>MaxWidthReg</pMax>
+            </Integer>
+
+            <IntReg Name="WidthReg">
+              <Address>0x0</Address>
+              <Length>4</Length>
+              <AccessMode>RW</AccessMode>
+              <pPort>Device</pPort>
+              <Endianess>LittleEndian</Endianess>
+            </IntReg>
+
+            <IntReg Name="MaxWidthReg">
+              <Address>0x4</Address>
+              <Length>4</Length>
+              <AccessMode>RO</AccessMode>
+              <pPort>Device</pPort>
+              <Endianess>LittleEndian</Endianess>
+            </IntReg>
+
+            <IntReg Name="Height">
+              <Address>0x10</Address>
+              <Length>4</Length>
+              <AccessMode>RW</AccessMode>
+              <pPort>Device</pPort>
+              <Endianess>LittleEndian</Endianess>
+            </IntReg>
+
+            <IntReg Name="Temperature">
+              <Address>0x8</Address>
+              <Length>4</Length>
+              <AccessMode>RO</AccessMode>
+              <pPort>Device</pPort>
+              <Cachable>NoCache</Cachable>
+              <Endianess>LittleEndian</Endianess>
+            </IntReg>
+
+            <IntReg Name="OffsetX">
+              <pIsAvailable>OffsetXAvailable</pIsAvailable>
+              <Address>0x100</Address>
+              <Length>4</Length>
+              <AccessMode>RW</AccessMode>
+              <pPort>Device</pPort>
+              <Endianess>LittleEndian</Endianess>
+            </IntReg>
+
+            <Integer Name="OffsetXAvailable">
+                <Value>0</Value>
+            </Integer>
+
+            <Port Name="Device">
+            </Port>
+
+        "#,
+        );
+
+        let (_, store, mut cx) = GenApiBuilder::<DefaultNodeStore>::default()
+            .build(&xml)
+            .unwrap();
+        let mut memory = vec![0; 0x14];
+        memory[0] = 64;
+        memory[4] = 128;
+        memory[8] = 40;
+        memory[0x10] = 32;
+        let mut device = TestDevice::new(memory);
+        let nid = |name| store.id_by_name(name).unwrap();
+
+        // `OffsetX` isn't available, so it's skipped without failing the others.
+        prefetch(
+            vec![
+                nid("Width"),
+                nid("Height"),
+                nid("Temperature"),
+                nid("OffsetX"),
+            ],
+            &mut device,
+            &store,
+            &mut cx,
+        )
+        .unwrap();
+        assert_eq!(device.stacked_reads, 1);
+        assert_eq!(device.reads, vec![(0, 8), (0x10, 4)]);
+
+        // Values are answered from the cache.
+        let width = nid("Width").as_iinteger_kind(&store).unwrap();
+        let height = nid("Height").as_iinteger_kind(&store).unwrap();
+        assert_eq!(width.value(&mut device, &store, &mut cx).unwrap(), 64);
+        assert_eq!(width.max(&mut device, &store, &mut cx).unwrap(), 128);
+        assert_eq!(height.value(&mut device, &store, &mut cx).unwrap(), 32);
+        assert_eq!(device.reads.len(), 2);
+
+        // Cached registers aren't read again.
+        prefetch(vec![nid("Width")], &mut device, &store, &mut cx).unwrap();
+        assert_eq!(device.stacked_reads, 1);
+    }
+
+    #[test]
+    fn test_refresh() {
+        let xml = register_description(
+            r#"
+
+            <IntReg Name="Temperature">
+              <Address>0x0</Address>
+              <Length>4</Length>
+              <AccessMode>RO</AccessMode>
+              <pPort>Device</pPort>
+              <Cachable>NoCache</Cachable>
+              <PollingTime>100</PollingTime>
+              <Endianess>LittleEndian</Endianess>
+            </IntReg>
+
+            <IntSwissKnife Name="TemperatureX2">
+                <pVariable Name="T">Temperature</pVariable>
+                <Formula>T * 2</Formula>
+            </IntSwissKnife>
+
+            <Port Name="Device">
+            </Port>
+
+        "#,
+        );
+
+        let (_, store, mut cx) = GenApiBuilder::<DefaultNodeStore>::default()
+            .build(&xml)
+            .unwrap();
+        let mut device = TestDevice::new(vec![40, 0, 0, 0]);
+        let nid = |name| store.id_by_name(name).unwrap();
+        assert_eq!(polling_nodes(&store), vec![(nid("Temperature"), 100)]);
+
+        let temperature = nid("TemperatureX2").as_iinteger_kind(&store).unwrap();
+        refresh(vec![nid("Temperature")], &mut device, &store, &mut cx).unwrap();
+        assert_eq!(temperature.value(&mut device, &store, &mut cx).unwrap(), 80);
+        assert_eq!(device.reads.len(), 1);
+
+        // The refreshed value is served until the next refresh.
+        device.memory[0] = 50;
+        assert_eq!(temperature.value(&mut device, &store, &mut cx).unwrap(), 80);
+        refresh(vec![nid("Temperature")], &mut device, &store, &mut cx).unwrap();
+        assert_eq!(
+            temperature.value(&mut device, &store, &mut cx).unwrap(),
+            100
+        );
+        assert_eq!(device.reads.len(), 2);
+
+        // `NoCache` register is read from the device again once invalidated.
+        invalidate_registers(vec![nid("Temperature")], &store, &mut cx);
+        assert_eq!(
+            temperature.value(&mut device, &store, &mut cx).unwrap(),
+            100
+        );
+        assert_eq!(device.reads.len(), 3);
+    }
+
+    #[test]
+    fn test_chunk_registers() {
+        let xml = register_description(
+            r#"
+
+            <IntReg Name="ChunkFrameCounter">
+              <Address>0x4</Address>
+              <Length>4</Length>
+              <AccessMode>RO</AccessMode>
+              <pPort>ChunkPort</pPort>
+              <Endianess>LittleEndian</Endianess>
+            </IntReg>
+
+            <IntReg Name="Width">
+              <Address>0x0</Address>
+              <Length>4</Length>
+              <AccessMode>RO</AccessMode>
+              <pPort>Device</pPort>
+              <Endianess>LittleEndian</Endianess>
+            </IntReg>
+
+            <Port Name="ChunkPort">
+                <ChunkID>1000</ChunkID>
+            </Port>
+
+            <Port Name="Device">
+            </Port>
+
+        "#,
+        );
+
+        let (_, store, mut cx) = GenApiBuilder::<DefaultNodeStore>::default()
+            .build(&xml)
+            .unwrap();
+        let mut device = TestDevice::new(vec![0; 8]);
+        let nid = |name| store.id_by_name(name).unwrap();
+        let chunk_nodes = chunk_registers(&store);
+        assert_eq!(chunk_nodes, vec![nid("ChunkFrameCounter")]);
+
+        let counter = nid("ChunkFrameCounter").as_iinteger_kind(&store).unwrap();
+        assert!(counter.value(&mut device, &store, &mut cx).is_err());
+
+        // Chunk registers are read from the attached chunk data, not from the device.
+        device.chunk = Some((0x1000, vec![0, 0, 0, 0, 1, 0, 0, 0]));
+        prefetch(vec![nid("ChunkFrameCounter")], &mut device, &store, &mut cx).unwrap();
+        assert_eq!(counter.value(&mut device, &store, &mut cx).unwrap(), 1);
+        assert!(device.reads.is_empty());
+
+        device.chunk = Some((0x1000, vec![0, 0, 0, 0, 2, 0, 0, 0]));
+        invalidate_registers(chunk_nodes, &store, &mut cx);
+        assert_eq!(counter.value(&mut device, &store, &mut cx).unwrap(), 2);
+        assert!(device.reads.is_empty());
+    }
+}
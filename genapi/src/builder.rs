@@ -5,8 +5,8 @@
 use super::{
     parser,
     store::{
-        CacheSink, DefaultCacheStore, DefaultNodeStore, DefaultValueStore, NodeData, NodeId,
-        ValueData, ValueId,
+        self, CacheSink, DefaultCacheStore, DefaultNodeStore, DefaultValueStore, LazyCacheStore,
+        LazyNodeStore, LazyValueStore, NodeData, NodeId, ValueData, ValueId,
     },
     RegisterDescription, ValueCtxt,
 };
@@ -41,6 +41,35 @@ impl<T, U, S> GenApiBuilder<T, U, S> {
         ))
     }
 
+    /// Builds stores without parsing nodes, which are parsed on demand by the returned
+    /// [`LazyParser`](parser::LazyParser).
+    ///
+    /// Stores are returned as builders so that [`LazyParser::load`](parser::LazyParser::load)
+    /// can store nodes into them later, thus each store must be its own builder.
+    pub fn build_lazy(
+        mut self,
+        xml: impl Into<String>,
+    ) -> parser::ParseResult<(RegisterDescription, parser::LazyParser, T, ValueCtxt<U, S>)>
+    where
+        T: NodeStoreBuilder<Store = T>,
+        U: ValueStoreBuilder<Store = U>,
+        S: CacheStoreBuilder<Store = S>,
+    {
+        let (parser, reg_desc) = parser::LazyParser::new(
+            xml,
+            &mut self.node_store,
+            &mut self.value_store,
+            &mut self.cache_store,
+        )?;
+
+        Ok((
+            reg_desc,
+            parser,
+            self.node_store,
+            ValueCtxt::new(self.value_store, self.cache_store),
+        ))
+    }
+
     pub fn no_cache(self) -> GenApiBuilder<T, U, CacheSink> {
         GenApiBuilder {
             node_store: self.node_store,
@@ -74,6 +103,22 @@ impl<T, U, S> GenApiBuilder<T, U, S> {
     }
 }
 
+impl<S> GenApiBuilder<DefaultNodeStore, DefaultValueStore, S> {
+    /// Builds stores which parse each node the first time it's looked up, instead of parsing
+    /// all nodes up front, see [`LazyNodeStore`].
+    ///
+    /// The cache store of the builder receives dependencies of nodes as they are loaded.
+    pub fn build_on_demand(
+        self,
+        xml: impl Into<String>,
+    ) -> BuildResult<LazyNodeStore, LazyValueStore, LazyCacheStore<S>>
+    where
+        S: CacheStoreBuilder,
+    {
+        store::build_lazy(xml.into(), self.cache_store)
+    }
+}
+
 pub trait NodeStoreBuilder {
     type Store;
 
@@ -113,4 +158,19 @@ pub trait CacheStoreBuilder {
 
     /// Store invalidator and its target to be invalidated.
     fn store_invalidator(&mut self, invalidator: NodeId, target: NodeId);
+
+    /// Store that the value of `dependent` is computed from the value of `dependency`.
+    ///
+    /// The default implementation ignores the dependency.
+    fn store_dependency(&mut self, dependent: NodeId, dependency: NodeId) {
+        let _ = (dependent, dependency);
+    }
+
+    /// Store that the value of `nid` may change without being written, e.g. a register whose
+    /// `Cachable` is `NoCache`.
+    ///
+    /// The default implementation ignores it.
+    fn store_volatile(&mut self, nid: NodeId) {
+        let _ = nid;
+    }
 }
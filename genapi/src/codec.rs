@@ -0,0 +1,1167 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! This module contains a compact binary encoding of built stores.
+//!
+//! Parsing a `GenApi` xml of several MBs takes a large part of loading a context. [`encode`]
+//! writes the stores built by [`GenApiBuilder::build`](crate::builder::GenApiBuilder::build) into
+//! bytes, and [`decode`] restores them without the xml, e.g. from an on-disk cache.
+//!
+//! Integers are LEB128 encoded and sequences are prefixed with their lengths. Runtime caches of
+//! [`DefaultCacheStore`] are not encoded, only dependencies between nodes are.
+
+use std::{
+    collections::{HashMap, HashSet},
+    convert::TryFrom,
+    hash::Hash,
+    marker::PhantomData,
+};
+
+use thiserror::Error;
+
+use super::{
+    elem_type::{
+        AccessMode, AddressKind, BitMask, CachingMode, DisplayNotation, Endianness,
+        FloatRepresentation, ImmOrPNode, IntegerRepresentation, MergePriority, NameSpace,
+        NamedValue, PIndex, PValue, RegPIndex, Sign, Slope, StandardNameSpace, ValueIndexed,
+        ValueKind, Visibility,
+    },
+    formula::{BinOpKind, EvaluationResult, Expr, Formula, UnOpKind},
+    node_base::{NodeAttributeBase, NodeElementBase},
+    store::{DefaultCacheStore, DefaultNodeStore, DefaultValueStore, NodeData, ValueData},
+    BooleanNode, CategoryNode, CommandNode, ConverterNode, EnumEntryNode, EnumerationNode,
+    FloatNode, FloatRegNode, IntConverterNode, IntRegNode, IntSwissKnifeNode, IntegerNode,
+    MaskedIntRegNode, Node, PortNode, RegisterBase, RegisterDescription, RegisterNode, StringNode,
+    StringRegNode, SwissKnifeNode, ValueCtxt,
+};
+
+/// Identifies the encoded data.
+const MAGIC: &[u8; 8] = b"CMLNGAPI";
+
+/// Incremented whenever the encoding changes.
+const FORMAT_VERSION: u64 = 1;
+
+#[derive(Debug, Error)]
+pub enum DecodeError {
+    #[error("data ends unexpectedly")]
+    UnexpectedEof,
+
+    #[error("data is encoded by another version: {0}")]
+    IncompatibleVersion(String),
+
+    #[error("invalid data: {0}")]
+    InvalidData(&'static str),
+}
+
+pub type DecodeResult<T> = std::result::Result<T, DecodeError>;
+
+/// Encodes the stores built by [`GenApiBuilder::build`](crate::builder::GenApiBuilder::build).
+///
+/// Caches of register data and values in `value_ctxt` are not encoded.
+#[must_use]
+pub fn encode(
+    reg_desc: &RegisterDescription,
+    node_store: &DefaultNodeStore,
+    value_ctxt: &ValueCtxt<DefaultValueStore, DefaultCacheStore>,
+) -> Vec<u8> {
+    let mut enc = Encoder::default();
+    enc.buf.extend_from_slice(MAGIC);
+    FORMAT_VERSION.encode(&mut enc);
+    enc.write_str(env!("CARGO_PKG_VERSION"));
+    reg_desc.encode(&mut enc);
+    node_store.encode(&mut enc);
+    value_ctxt.value_store.encode(&mut enc);
+    value_ctxt.cache_store.encode(&mut enc);
+    enc.buf
+}
+
+/// Decodes the stores encoded by [`encode`].
+///
+/// Returns [`DecodeError::IncompatibleVersion`] if `data` is encoded by another version of this
+/// crate.
+pub fn decode(
+    data: &[u8],
+) -> DecodeResult<(
+    RegisterDescription,
+    DefaultNodeStore,
+    ValueCtxt<DefaultValueStore, DefaultCacheStore>,
+)> {
+    let mut dec = Decoder { buf: data };
+    if dec.take(MAGIC.len())? != MAGIC {
+        return Err(DecodeError::InvalidData("not an encoded GenApi context"));
+    }
+    let format_version = u64::decode(&mut dec)?;
+    let crate_version = String::decode(&mut dec)?;
+    if format_version != FORMAT_VERSION || crate_version != env!("CARGO_PKG_VERSION") {
+        return Err(DecodeError::IncompatibleVersion(crate_version));
+    }
+
+    let reg_desc = Codec::decode(&mut dec)?;
+    let node_store = Codec::decode(&mut dec)?;
+    let value_store = Codec::decode(&mut dec)?;
+    let cache_store = Codec::decode(&mut dec)?;
+    if !dec.buf.is_empty() {
+        return Err(DecodeError::InvalidData("trailing data"));
+    }
+    Ok((
+        reg_desc,
+        node_store,
+        ValueCtxt::new(value_store, cache_store),
+    ))
+}
+
+#[derive(Default)]
+pub(crate) struct Encoder {
+    buf: Vec<u8>,
+}
+
+impl Encoder {
+    fn write_varint(&mut self, mut value: u64) {
+        while value >= 0x80 {
+            self.buf.push(value as u8 | 0x80);
+            value >>= 7;
+        }
+        self.buf.push(value as u8);
+    }
+
+    pub(crate) fn write_str(&mut self, s: &str) {
+        s.len().encode(self);
+        self.buf.extend_from_slice(s.as_bytes());
+    }
+}
+
+pub(crate) struct Decoder<'a> {
+    buf: &'a [u8],
+}
+
+impl<'a> Decoder<'a> {
+    fn take(&mut self, len: usize) -> DecodeResult<&'a [u8]> {
+        if self.buf.len() < len {
+            return Err(DecodeError::UnexpectedEof);
+        }
+        let (head, tail) = self.buf.split_at(len);
+        self.buf = tail;
+        Ok(head)
+    }
+
+    fn read_varint(&mut self) -> DecodeResult<u64> {
+        let mut value = 0_u64;
+        for shift in (0..64).step_by(7) {
+            let byte = self.take(1)?[0];
+            value |= u64::from(byte & 0x7f) << shift;
+            if byte & 0x80 == 0 {
+                return Ok(value);
+            }
+        }
+        Err(DecodeError::InvalidData("too long varint"))
+    }
+
+    /// Reads a length of a sequence. Each element takes at least one byte, so a length exceeding
+    /// the remaining data is rejected before allocating for it.
+    fn read_len(&mut self) -> DecodeResult<usize> {
+        let len = self.read_varint()?;
+        if len > self.buf.len() as u64 {
+            return Err(DecodeError::UnexpectedEof);
+        }
+        Ok(len as usize)
+    }
+
+    pub(crate) fn invalid<T>(msg: &'static str) -> DecodeResult<T> {
+        Err(DecodeError::InvalidData(msg))
+    }
+}
+
+pub(crate) trait Codec: Sized {
+    fn encode(&self, enc: &mut Encoder);
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self>;
+}
+
+/// Implements [`Codec`] for a struct by encoding its fields in order.
+macro_rules! impl_codec_struct {
+    ($ty:ident $(<$($param:ident),+>)? { $($field:ident),* $(,)? }) => {
+        impl$(<$($param: $crate::codec::Codec),+>)? $crate::codec::Codec for $ty$(<$($param),+>)? {
+            fn encode(&self, enc: &mut $crate::codec::Encoder) {
+                $($crate::codec::Codec::encode(&self.$field, enc);)*
+            }
+
+            fn decode(dec: &mut $crate::codec::Decoder) -> $crate::codec::DecodeResult<Self> {
+                Ok(Self {
+                    $($field: $crate::codec::Codec::decode(dec)?,)*
+                })
+            }
+        }
+    };
+}
+
+/// Implements [`Codec`] for a fieldless enum by encoding the index of its variant.
+macro_rules! impl_codec_unit_enum {
+    ($ty:ident { $($variant:ident),+ $(,)? }) => {
+        impl $crate::codec::Codec for $ty {
+            fn encode(&self, enc: &mut $crate::codec::Encoder) {
+                const VARIANTS: &[$ty] = &[$($ty::$variant),+];
+                let idx = VARIANTS.iter().position(|v| v == self).unwrap() as u8;
+                $crate::codec::Codec::encode(&idx, enc);
+            }
+
+            fn decode(dec: &mut $crate::codec::Decoder) -> $crate::codec::DecodeResult<Self> {
+                const VARIANTS: &[$ty] = &[$($ty::$variant),+];
+                let idx: u8 = $crate::codec::Codec::decode(dec)?;
+                VARIANTS.get(usize::from(idx)).copied().ok_or(
+                    $crate::codec::DecodeError::InvalidData(concat!("invalid ", stringify!($ty))),
+                )
+            }
+        }
+    };
+}
+
+pub(crate) use impl_codec_struct;
+pub(crate) use impl_codec_unit_enum;
+
+impl Codec for u8 {
+    fn encode(&self, enc: &mut Encoder) {
+        enc.buf.push(*self);
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        Ok(dec.take(1)?[0])
+    }
+}
+
+impl Codec for u32 {
+    fn encode(&self, enc: &mut Encoder) {
+        enc.write_varint(u64::from(*self));
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        let value = dec.read_varint()?;
+        u32::try_from(value).map_err(|_| DecodeError::InvalidData("u32 overflow"))
+    }
+}
+
+impl Codec for u64 {
+    fn encode(&self, enc: &mut Encoder) {
+        enc.write_varint(*self);
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        dec.read_varint()
+    }
+}
+
+impl Codec for usize {
+    fn encode(&self, enc: &mut Encoder) {
+        enc.write_varint(*self as u64);
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        let value = dec.read_varint()?;
+        usize::try_from(value).map_err(|_| DecodeError::InvalidData("usize overflow"))
+    }
+}
+
+impl Codec for i64 {
+    fn encode(&self, enc: &mut Encoder) {
+        // Zigzag encoding keeps small negative values short.
+        #[allow(clippy::cast_sign_loss)]
+        enc.write_varint(((*self << 1) ^ (*self >> 63)) as u64);
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        let value = dec.read_varint()?;
+        #[allow(clippy::cast_possible_wrap)]
+        Ok((value >> 1) as i64 ^ -((value & 1) as i64))
+    }
+}
+
+impl Codec for f64 {
+    fn encode(&self, enc: &mut Encoder) {
+        enc.buf.extend_from_slice(&self.to_le_bytes());
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        let mut bytes = [0; 8];
+        bytes.copy_from_slice(dec.take(8)?);
+        Ok(f64::from_le_bytes(bytes))
+    }
+}
+
+impl Codec for bool {
+    fn encode(&self, enc: &mut Encoder) {
+        u8::from(*self).encode(enc);
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        match u8::decode(dec)? {
+            0 => Ok(false),
+            1 => Ok(true),
+            _ => Decoder::invalid("invalid bool"),
+        }
+    }
+}
+
+impl Codec for () {
+    fn encode(&self, _: &mut Encoder) {}
+
+    fn decode(_: &mut Decoder) -> DecodeResult<Self> {
+        Ok(())
+    }
+}
+
+impl<T> Codec for PhantomData<T> {
+    fn encode(&self, _: &mut Encoder) {}
+
+    fn decode(_: &mut Decoder) -> DecodeResult<Self> {
+        Ok(PhantomData)
+    }
+}
+
+impl Codec for String {
+    fn encode(&self, enc: &mut Encoder) {
+        enc.write_str(self);
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        let len = dec.read_len()?;
+        let bytes = dec.take(len)?;
+        std::str::from_utf8(bytes)
+            .map(ToOwned::to_owned)
+            .map_err(|_| DecodeError::InvalidData("invalid UTF8 string"))
+    }
+}
+
+impl<T: Codec> Codec for Box<T> {
+    fn encode(&self, enc: &mut Encoder) {
+        (**self).encode(enc);
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        T::decode(dec).map(Box::new)
+    }
+}
+
+impl<T: Codec> Codec for Option<T> {
+    fn encode(&self, enc: &mut Encoder) {
+        match self {
+            Some(value) => {
+                true.encode(enc);
+                value.encode(enc);
+            }
+            None => false.encode(enc),
+        }
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        Ok(if bool::decode(dec)? {
+            Some(T::decode(dec)?)
+        } else {
+            None
+        })
+    }
+}
+
+impl<T: Codec> Codec for Vec<T> {
+    fn encode(&self, enc: &mut Encoder) {
+        self.len().encode(enc);
+        for elem in self {
+            elem.encode(enc);
+        }
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        let len = dec.read_len()?;
+        let mut vec = Vec::with_capacity(len);
+        for _ in 0..len {
+            vec.push(T::decode(dec)?);
+        }
+        Ok(vec)
+    }
+}
+
+impl<A: Codec, B: Codec> Codec for (A, B) {
+    fn encode(&self, enc: &mut Encoder) {
+        self.0.encode(enc);
+        self.1.encode(enc);
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        Ok((A::decode(dec)?, B::decode(dec)?))
+    }
+}
+
+impl<K: Codec + Eq + Hash, V: Codec> Codec for HashMap<K, V> {
+    fn encode(&self, enc: &mut Encoder) {
+        self.len().encode(enc);
+        for (key, value) in self {
+            key.encode(enc);
+            value.encode(enc);
+        }
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        let len = dec.read_len()?;
+        let mut map = HashMap::with_capacity(len);
+        for _ in 0..len {
+            let key = K::decode(dec)?;
+            map.insert(key, V::decode(dec)?);
+        }
+        Ok(map)
+    }
+}
+
+impl<T: Codec + Eq + Hash> Codec for HashSet<T> {
+    fn encode(&self, enc: &mut Encoder) {
+        self.len().encode(enc);
+        for elem in self {
+            elem.encode(enc);
+        }
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        let len = dec.read_len()?;
+        let mut set = HashSet::with_capacity(len);
+        for _ in 0..len {
+            set.insert(T::decode(dec)?);
+        }
+        Ok(set)
+    }
+}
+
+impl_codec_unit_enum!(NameSpace { Standard, Custom });
+impl_codec_unit_enum!(Visibility {
+    Beginner,
+    Expert,
+    Guru,
+    Invisible
+});
+impl_codec_unit_enum!(MergePriority { High, Mid, Low });
+impl_codec_unit_enum!(AccessMode { RO, WO, RW });
+impl_codec_unit_enum!(IntegerRepresentation {
+    Linear,
+    Logarithmic,
+    Boolean,
+    PureNumber,
+    HexNumber,
+    IpV4Address,
+    MacAddress,
+});
+impl_codec_unit_enum!(FloatRepresentation {
+    Linear,
+    Logarithmic,
+    PureNumber
+});
+impl_codec_unit_enum!(Slope {
+    Increasing,
+    Decreasing,
+    Varying,
+    Automatic
+});
+impl_codec_unit_enum!(DisplayNotation {
+    Automatic,
+    Fixed,
+    Scientific
+});
+impl_codec_unit_enum!(StandardNameSpace {
+    None,
+    IIDC,
+    GEV,
+    CL,
+    USB
+});
+impl_codec_unit_enum!(CachingMode {
+    WriteThrough,
+    WriteAround,
+    NoCache
+});
+impl_codec_unit_enum!(Endianness { LE, BE });
+impl_codec_unit_enum!(Sign { Signed, Unsigned });
+impl_codec_unit_enum!(BinOpKind {
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Rem,
+    Pow,
+    Shl,
+    Shr,
+    And,
+    Or,
+    Eq,
+    Ne,
+    Lt,
+    Le,
+    Gt,
+    Ge,
+    BitAnd,
+    BitOr,
+    Xor,
+});
+impl_codec_unit_enum!(UnOpKind {
+    Not,
+    Abs,
+    Sgn,
+    Neg,
+    Sin,
+    Cos,
+    Tan,
+    Asin,
+    Acos,
+    Atan,
+    Exp,
+    Ln,
+    Lg,
+    Sqrt,
+    Trunc,
+    Floor,
+    Ceil,
+    Round,
+});
+
+impl<T: Codec> Codec for ImmOrPNode<T> {
+    fn encode(&self, enc: &mut Encoder) {
+        match self {
+            Self::Imm(value) => {
+                0_u8.encode(enc);
+                value.encode(enc);
+            }
+            Self::PNode(nid) => {
+                1_u8.encode(enc);
+                nid.encode(enc);
+            }
+        }
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        match u8::decode(dec)? {
+            0 => Ok(Self::Imm(Codec::decode(dec)?)),
+            1 => Ok(Self::PNode(Codec::decode(dec)?)),
+            _ => Decoder::invalid("invalid ImmOrPNode"),
+        }
+    }
+}
+
+impl<T: Codec> Codec for ValueKind<T> {
+    fn encode(&self, enc: &mut Encoder) {
+        match self {
+            Self::Value(value) => {
+                0_u8.encode(enc);
+                value.encode(enc);
+            }
+            Self::PValue(p_value) => {
+                1_u8.encode(enc);
+                p_value.encode(enc);
+            }
+            Self::PIndex(p_index) => {
+                2_u8.encode(enc);
+                p_index.encode(enc);
+            }
+        }
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        match u8::decode(dec)? {
+            0 => Ok(Self::Value(Codec::decode(dec)?)),
+            1 => Ok(Self::PValue(Codec::decode(dec)?)),
+            2 => Ok(Self::PIndex(Codec::decode(dec)?)),
+            _ => Decoder::invalid("invalid ValueKind"),
+        }
+    }
+}
+
+impl Codec for AddressKind {
+    fn encode(&self, enc: &mut Encoder) {
+        match self {
+            Self::Address(address) => {
+                0_u8.encode(enc);
+                address.encode(enc);
+            }
+            Self::IntSwissKnife(nid) => {
+                1_u8.encode(enc);
+                nid.encode(enc);
+            }
+            Self::PIndex(p_index) => {
+                2_u8.encode(enc);
+                p_index.encode(enc);
+            }
+        }
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        match u8::decode(dec)? {
+            0 => Ok(Self::Address(Codec::decode(dec)?)),
+            1 => Ok(Self::IntSwissKnife(Codec::decode(dec)?)),
+            2 => Ok(Self::PIndex(Codec::decode(dec)?)),
+            _ => Decoder::invalid("invalid AddressKind"),
+        }
+    }
+}
+
+impl Codec for BitMask {
+    fn encode(&self, enc: &mut Encoder) {
+        match self {
+            Self::SingleBit(bit) => {
+                0_u8.encode(enc);
+                bit.encode(enc);
+            }
+            Self::Range { lsb, msb } => {
+                1_u8.encode(enc);
+                lsb.encode(enc);
+                msb.encode(enc);
+            }
+        }
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        match u8::decode(dec)? {
+            0 => Ok(Self::SingleBit(Codec::decode(dec)?)),
+            1 => Ok(Self::Range {
+                lsb: Codec::decode(dec)?,
+                msb: Codec::decode(dec)?,
+            }),
+            _ => Decoder::invalid("invalid BitMask"),
+        }
+    }
+}
+
+impl Codec for EvaluationResult {
+    fn encode(&self, enc: &mut Encoder) {
+        match self {
+            Self::Integer(i) => {
+                0_u8.encode(enc);
+                i.encode(enc);
+            }
+            Self::Float(f) => {
+                1_u8.encode(enc);
+                f.encode(enc);
+            }
+        }
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        match u8::decode(dec)? {
+            0 => Ok(Self::Integer(Codec::decode(dec)?)),
+            1 => Ok(Self::Float(Codec::decode(dec)?)),
+            _ => Decoder::invalid("invalid EvaluationResult"),
+        }
+    }
+}
+
+impl Codec for Expr {
+    fn encode(&self, enc: &mut Encoder) {
+        match self {
+            Self::BinOp { kind, lhs, rhs } => {
+                0_u8.encode(enc);
+                kind.encode(enc);
+                lhs.encode(enc);
+                rhs.encode(enc);
+            }
+            Self::UnOp { kind, expr } => {
+                1_u8.encode(enc);
+                kind.encode(enc);
+                expr.encode(enc);
+            }
+            Self::If { cond, then, else_ } => {
+                2_u8.encode(enc);
+                cond.encode(enc);
+                then.encode(enc);
+                else_.encode(enc);
+            }
+            Self::Integer(i) => {
+                3_u8.encode(enc);
+                i.encode(enc);
+            }
+            Self::Float(f) => {
+                4_u8.encode(enc);
+                f.encode(enc);
+            }
+            Self::Ident(ident) => {
+                5_u8.encode(enc);
+                ident.encode(enc);
+            }
+        }
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        Ok(match u8::decode(dec)? {
+            0 => Self::BinOp {
+                kind: Codec::decode(dec)?,
+                lhs: Codec::decode(dec)?,
+                rhs: Codec::decode(dec)?,
+            },
+            1 => Self::UnOp {
+                kind: Codec::decode(dec)?,
+                expr: Codec::decode(dec)?,
+            },
+            2 => Self::If {
+                cond: Codec::decode(dec)?,
+                then: Codec::decode(dec)?,
+                else_: Codec::decode(dec)?,
+            },
+            3 => Self::Integer(Codec::decode(dec)?),
+            4 => Self::Float(Codec::decode(dec)?),
+            5 => Self::Ident(Codec::decode(dec)?),
+            _ => return Decoder::invalid("invalid Expr"),
+        })
+    }
+}
+
+impl Codec for ValueData {
+    fn encode(&self, enc: &mut Encoder) {
+        match self {
+            Self::Integer(i) => {
+                0_u8.encode(enc);
+                i.encode(enc);
+            }
+            Self::Float(f) => {
+                1_u8.encode(enc);
+                f.encode(enc);
+            }
+            Self::Str(s) => {
+                2_u8.encode(enc);
+                s.encode(enc);
+            }
+            Self::Boolean(b) => {
+                3_u8.encode(enc);
+                b.encode(enc);
+            }
+        }
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        match u8::decode(dec)? {
+            0 => Ok(Self::Integer(Codec::decode(dec)?)),
+            1 => Ok(Self::Float(Codec::decode(dec)?)),
+            2 => Ok(Self::Str(Codec::decode(dec)?)),
+            3 => Ok(Self::Boolean(Codec::decode(dec)?)),
+            _ => Decoder::invalid("invalid ValueData"),
+        }
+    }
+}
+
+/// Implements [`Codec`] for [`NodeData`] with the tag of each variant.
+macro_rules! impl_codec_node_data {
+    ($($tag:literal => $variant:ident,)*) => {
+        impl Codec for NodeData {
+            fn encode(&self, enc: &mut Encoder) {
+                match self {
+                    $(Self::$variant(node) => {
+                        $tag.encode(enc);
+                        node.encode(enc);
+                    })*
+                }
+            }
+
+            fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+                match u8::decode(dec)? {
+                    $($tag => Ok(Self::$variant(Codec::decode(dec)?)),)*
+                    _ => Decoder::invalid("invalid NodeData"),
+                }
+            }
+        }
+    };
+}
+
+impl_codec_node_data! {
+    0_u8 => Node,
+    1_u8 => Category,
+    2_u8 => Integer,
+    3_u8 => IntReg,
+    4_u8 => MaskedIntReg,
+    5_u8 => Boolean,
+    6_u8 => Command,
+    7_u8 => Enumeration,
+    8_u8 => EnumEntry,
+    9_u8 => Float,
+    10_u8 => FloatReg,
+    11_u8 => String,
+    12_u8 => StringReg,
+    13_u8 => Register,
+    14_u8 => Converter,
+    15_u8 => IntConverter,
+    16_u8 => SwissKnife,
+    17_u8 => IntSwissKnife,
+    18_u8 => Port,
+    19_u8 => ConfRom,
+    20_u8 => TextDesc,
+    21_u8 => IntKey,
+    22_u8 => AdvFeatureLock,
+    23_u8 => SmartFeature,
+}
+
+impl_codec_struct!(NamedValue<T> { name, value });
+impl_codec_struct!(PValue<T> {
+    p_value,
+    p_value_copies,
+    phantom
+});
+impl_codec_struct!(PIndex<T> {
+    p_index,
+    value_indexed,
+    value_default
+});
+impl_codec_struct!(ValueIndexed<T> { index, indexed });
+impl_codec_struct!(RegPIndex { offset, p_index });
+impl_codec_struct!(Formula { expr });
+
+impl_codec_struct!(RegisterDescription {
+    model_name,
+    vendor_name,
+    tooltip,
+    standard_name_space,
+    schema_major_version,
+    schema_minor_version,
+    schema_subminor_version,
+    major_version,
+    minor_version,
+    subminor_version,
+    product_guid,
+    version_guid,
+});
+
+impl_codec_struct!(NodeAttributeBase {
+    id,
+    name_space,
+    merge_priority,
+    expose_static,
+});
+
+impl_codec_struct!(NodeElementBase {
+    tooltip,
+    description,
+    display_name,
+    visibility,
+    docu_url,
+    is_deprecated,
+    event_id,
+    p_is_implemented,
+    p_is_available,
+    p_is_locked,
+    p_block_polling,
+    imposed_access_mode,
+    p_errors,
+    p_alias,
+    p_cast_alias,
+    p_invalidators,
+});
+
+impl_codec_struct!(RegisterBase {
+    elem_base,
+    streamable,
+    address_kinds,
+    length,
+    access_mode,
+    p_port,
+    cacheable,
+    polling_time,
+    p_invalidators,
+});
+
+impl_codec_struct!(Node {
+    attr_base,
+    elem_base
+});
+
+impl_codec_struct!(CategoryNode {
+    attr_base,
+    elem_base,
+    p_features
+});
+
+impl_codec_struct!(IntegerNode {
+    attr_base,
+    elem_base,
+    streamable,
+    value_kind,
+    min,
+    max,
+    inc,
+    unit,
+    representation,
+    p_selected,
+});
+
+impl_codec_struct!(IntRegNode {
+    attr_base,
+    register_base,
+    sign,
+    endianness,
+    unit,
+    representation,
+    p_selected,
+});
+
+impl_codec_struct!(MaskedIntRegNode {
+    attr_base,
+    register_base,
+    bit_mask,
+    sign,
+    endianness,
+    unit,
+    representation,
+    p_selected,
+});
+
+impl_codec_struct!(BooleanNode {
+    attr_base,
+    elem_base,
+    streamable,
+    value,
+    on_value,
+    off_value,
+    p_selected,
+});
+
+impl_codec_struct!(CommandNode {
+    attr_base,
+    elem_base,
+    value,
+    command_value,
+    polling_time,
+});
+
+impl_codec_struct!(EnumerationNode {
+    attr_base,
+    elem_base,
+    streamable,
+    entries,
+    value,
+    p_selected,
+    polling_time,
+});
+
+impl_codec_struct!(EnumEntryNode {
+    attr_base,
+    elem_base,
+    value,
+    numeric_value,
+    symbolic,
+    is_self_clearing,
+});
+
+impl_codec_struct!(FloatNode {
+    attr_base,
+    elem_base,
+    streamable,
+    value_kind,
+    min,
+    max,
+    inc,
+    unit,
+    representation,
+    display_notation,
+    display_precision,
+});
+
+impl_codec_struct!(FloatRegNode {
+    attr_base,
+    register_base,
+    endianness,
+    unit,
+    representation,
+    display_notation,
+    display_precision,
+});
+
+impl_codec_struct!(StringNode {
+    attr_base,
+    elem_base,
+    streamable,
+    value,
+});
+
+impl_codec_struct!(StringRegNode {
+    attr_base,
+    register_base
+});
+
+impl_codec_struct!(RegisterNode {
+    attr_base,
+    register_base
+});
+
+impl_codec_struct!(ConverterNode {
+    attr_base,
+    elem_base,
+    streamable,
+    p_variables,
+    constants,
+    expressions,
+    formula_to,
+    formula_from,
+    compiled_formula_to,
+    compiled_formula_from,
+    p_value,
+    unit,
+    representation,
+    display_notation,
+    display_precision,
+    slope,
+    is_linear,
+});
+
+impl_codec_struct!(IntConverterNode {
+    attr_base,
+    elem_base,
+    streamable,
+    p_variables,
+    constants,
+    expressions,
+    formula_to,
+    formula_from,
+    compiled_formula_to,
+    compiled_formula_from,
+    p_value,
+    unit,
+    representation,
+    slope,
+});
+
+impl_codec_struct!(SwissKnifeNode {
+    attr_base,
+    elem_base,
+    streamable,
+    p_variables,
+    constants,
+    expressions,
+    formula,
+    compiled_formula,
+    unit,
+    representation,
+    display_notation,
+    display_precision,
+});
+
+impl_codec_struct!(IntSwissKnifeNode {
+    attr_base,
+    elem_base,
+    streamable,
+    p_variables,
+    constants,
+    expressions,
+    formula,
+    compiled_formula,
+    unit,
+    representation,
+});
+
+impl_codec_struct!(PortNode {
+    attr_base,
+    elem_base,
+    chunk_id,
+    swap_endianness,
+    cache_chunk_data,
+});
+
+#[cfg(test)]
+mod tests {
+    use crate::{
+        builder::GenApiBuilder,
+        interface::{IEnumeration, IInteger},
+        store::NodeStore,
+        testing::{register_description, TestDevice},
+    };
+
+    use super::*;
+
+    #[test]
+    fn test_codec() {
+        let xml = register_description(
+            r#"
+
+            <Integer Name="Width">
+                <pValue>WidthReg</pValue>
+            </Integer>
+
+            <IntReg Name="WidthReg">
+              <Address>0x0</Address>
+              <Length>4</Length>
+              <AccessMode>RW</AccessMode>
+              <pPort>Device</pPort>
+              <Endianess>LittleEndian</Endianess>
+            </IntReg>
+
+            <IntSwissKnife Name="PayloadSize">
+                <pVariable Name="W">Width</pVariable>
+                <Constant Name="Bpp">3</Constant>
+                <Formula>W * Bpp - 1</Formula>
+            </IntSwissKnife>
+
+            <Enumeration Name="PixelFormat">
+                <EnumEntry Name="Mono8">
+                    <Value>1</Value>
+                </EnumEntry>
+                <EnumEntry Name="RGB8">
+                    <Value>2</Value>
+                </EnumEntry>
+                <Value>1</Value>
+            </Enumeration>
+
+            <Port Name="Device">
+            </Port>
+
+        "#,
+        );
+
+        let (reg_desc, node_store, value_ctxt) = GenApiBuilder::<DefaultNodeStore>::default()
+            .build(&xml)
+            .unwrap();
+        let data = encode(&reg_desc, &node_store, &value_ctxt);
+        let (decoded_desc, decoded_store, mut decoded_ctxt) = decode(&data).unwrap();
+
+        assert_eq!(decoded_desc.model_name(), reg_desc.model_name());
+        assert_eq!(decoded_desc.version_guid(), reg_desc.version_guid());
+        for name in &["Width", "WidthReg", "PayloadSize", "PixelFormat", "RGB8"] {
+            assert_eq!(
+                decoded_store.id_by_name(name),
+                node_store.id_by_name(name),
+                "{}",
+                name
+            );
+        }
+
+        let mut device = TestDevice::new(vec![0; 4]);
+        let width = decoded_store
+            .id_by_name("Width")
+            .unwrap()
+            .as_iinteger_kind(&decoded_store)
+            .unwrap();
+        width
+            .set_value(100, &mut device, &decoded_store, &mut decoded_ctxt)
+            .unwrap();
+        let payload_size = decoded_store
+            .id_by_name("PayloadSize")
+            .unwrap()
+            .as_iinteger_kind(&decoded_store)
+            .unwrap();
+        assert_eq!(
+            payload_size
+                .value(&mut device, &decoded_store, &mut decoded_ctxt)
+                .unwrap(),
+            299
+        );
+        let pixel_format = decoded_store
+            .id_by_name("PixelFormat")
+            .unwrap()
+            .as_ienumeration_kind(&decoded_store)
+            .unwrap();
+        pixel_format
+            .set_entry_by_symbolic("RGB8", &mut device, &decoded_store, &mut decoded_ctxt)
+            .unwrap();
+        assert_eq!(
+            pixel_format
+                .current_value(&mut device, &decoded_store, &mut decoded_ctxt)
+                .unwrap(),
+            2
+        );
+
+        // Truncated or corrupted data is rejected.
+        assert!(decode(&data[..data.len() - 1]).is_err());
+        let mut corrupted = data.clone();
+        corrupted[0] ^= 0xff;
+        assert!(decode(&corrupted).is_err());
+        let mut trailing = data;
+        trailing.push(0);
+        assert!(decode(&trailing).is_err());
+    }
+}
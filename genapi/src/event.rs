@@ -0,0 +1,200 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! Feeding event data to registers of event ports.
+//!
+//! A port declaring `EventID` exposes the data sent with the event of the ID, e.g.
+//! `EventExposureEndTimestamp`. [`EventRegisters::feed`] stores the data of a received event in
+//! the cache of the registers of the port, so that the following reads of the nodes are answered
+//! without accessing the device.
+
+use std::collections::HashMap;
+
+use super::{
+    store::{CacheStore, NodeData, NodeId, NodeStore, ValueStore},
+    Device, ValueCtxt,
+};
+
+/// Registers of event ports indexed by event ID.
+#[derive(Debug, Clone, Default)]
+pub struct EventRegisters {
+    registers: HashMap<u64, Vec<EventRegister>>,
+}
+
+#[derive(Debug, Clone, Copy)]
+struct EventRegister {
+    nid: NodeId,
+    address: i64,
+    length: i64,
+}
+
+impl EventRegisters {
+    /// Collects registers of all event ports in `store`.
+    ///
+    /// Registers whose address or length can't be resolved without accessing the device are
+    /// skipped.
+    pub fn new<T: ValueStore, U: CacheStore>(
+        store: &impl NodeStore,
+        cx: &mut ValueCtxt<T, U>,
+    ) -> Self {
+        let mut ports = HashMap::new();
+        let mut candidates = vec![];
+        store.visit_nodes(|data| match data {
+            NodeData::Port(port) => {
+                if let Some(event_id) = data.node_base().event_id() {
+                    if port.chunk_id.is_none() {
+                        ports.insert(data.node_base().id(), event_id);
+                    }
+                }
+            }
+            _ => {
+                if data.register_base().is_some() {
+                    candidates.push(data.node_base().id());
+                }
+            }
+        });
+
+        let mut registers: HashMap<u64, Vec<EventRegister>> = HashMap::new();
+        let mut device = DetachedDevice;
+        for nid in candidates {
+            let register_base = match store.node_opt(nid).and_then(NodeData::register_base) {
+                Some(register_base) => register_base,
+                None => continue,
+            };
+            let event_id = match ports.get(&register_base.p_port) {
+                Some(event_id) => *event_id,
+                None => continue,
+            };
+            let address = register_base.address(&mut device, store, cx);
+            let length = register_base.length(&mut device, store, cx);
+            if let (Ok(address), Ok(length)) = (address, length) {
+                registers.entry(event_id).or_default().push(EventRegister {
+                    nid,
+                    address,
+                    length,
+                });
+            }
+        }
+
+        Self { registers }
+    }
+
+    /// Returns `true` if there is no register of event ports.
+    #[must_use]
+    pub fn is_empty(&self) -> bool {
+        self.registers.is_empty()
+    }
+
+    /// Stores `data` of the event with `event_id` in the cache of the registers of its port, and
+    /// invalidates the cache of the nodes depending on them.
+    ///
+    /// Registers out of the range of `data` are left untouched. Returns the number of registers
+    /// fed.
+    pub fn feed<T: ValueStore, U: CacheStore>(
+        &self,
+        event_id: u64,
+        data: &[u8],
+        cx: &mut ValueCtxt<T, U>,
+    ) -> usize {
+        let registers = match self.registers.get(&event_id) {
+            Some(registers) => registers,
+            None => return 0,
+        };
+
+        let mut count = 0;
+        for reg in registers {
+            let (start, end) = (reg.address as usize, (reg.address + reg.length) as usize);
+            if reg.address < 0 || reg.length < 0 || data.len() < end {
+                continue;
+            }
+            cx.invalidate_cache_of(reg.nid);
+            cx.cache_data(reg.nid, reg.address, reg.length, &data[start..end]);
+            count += 1;
+        }
+        count
+    }
+}
+
+/// Device used to resolve register addresses which is never accessed.
+struct DetachedDevice;
+
+impl Device for DetachedDevice {
+    fn read_mem(
+        &mut self,
+        _: i64,
+        _: &mut [u8],
+    ) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
+        Err("event registers must be resolved without accessing the device".into())
+    }
+
+    fn write_mem(
+        &mut self,
+        _: i64,
+        _: &[u8],
+    ) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
+        Err("event registers must be resolved without accessing the device".into())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::{
+        builder::GenApiBuilder,
+        interface::IInteger,
+        store::{DefaultNodeStore, NodeStore},
+        testing::register_description,
+    };
+
+    use super::{DetachedDevice, EventRegisters};
+
+    #[test]
+    fn test_feed_event() {
+        let xml = register_description(
+            r#"
+
+            <IntReg Name="EventExposureEndFrameID">
+              <Address>0x0</Address>
+              <Length>8</Length>
+              <AccessMode>RO</AccessMode>
+              <pPort>EventExposureEndPort</pPort>
+              <Cachable>NoCache</Cachable>
+              <Endianess>LittleEndian</Endianess>
+            </IntReg>
+
+            <IntSwissKnife Name="NextFrameID">
+                <pVariable Name="ID">EventExposureEndFrameID</pVariable>
+                <Formula>ID + 1</Formula>
+            </IntSwissKnife>
+
+            <Port Name="EventExposureEndPort">
+                <EventID>9001</EventID>
+            </Port>
+
+        "#,
+        );
+
+        let (_, store, mut cx) = GenApiBuilder::<DefaultNodeStore>::default()
+            .build(&xml)
+            .unwrap();
+        let registers = EventRegisters::new(&store, &mut cx);
+        assert!(!registers.is_empty());
+
+        let next = store
+            .id_by_name("NextFrameID")
+            .unwrap()
+            .as_iinteger_kind(&store)
+            .unwrap();
+        // Nodes are read from the fed data without accessing the device.
+        let mut device = DetachedDevice;
+        assert_eq!(registers.feed(0x9001, &7_u64.to_le_bytes(), &mut cx), 1);
+        assert_eq!(next.value(&mut device, &store, &mut cx).unwrap(), 8);
+        assert_eq!(registers.feed(0x9001, &10_u64.to_le_bytes(), &mut cx), 1);
+        assert_eq!(next.value(&mut device, &store, &mut cx).unwrap(), 11);
+
+        // Data of other events or shorter than the register are ignored.
+        assert_eq!(registers.feed(0x9002, &1_u64.to_le_bytes(), &mut cx), 0);
+        assert_eq!(registers.feed(0x9001, &[0; 4], &mut cx), 0);
+        assert_eq!(next.value(&mut device, &store, &mut cx).unwrap(), 11);
+    }
+}
@@ -172,6 +172,7 @@ impl IFloat for FloatNode {
         store: &impl NodeStore,
         cx: &mut ValueCtxt<T, U>,
     ) -> GenApiResult<()> {
+        cx.invalidate_cache_by(self.node_base().id());
         self.min.set_value(value, device, store, cx)
     }
 
@@ -185,6 +186,7 @@ impl IFloat for FloatNode {
         store: &impl NodeStore,
         cx: &mut ValueCtxt<T, U>,
     ) -> GenApiResult<()> {
+        cx.invalidate_cache_by(self.node_base().id());
         self.max.set_value(value, device, store, cx)
     }
 
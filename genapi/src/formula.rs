@@ -12,7 +12,10 @@ use std::{borrow::Borrow, collections::HashMap, fmt, hash::Hash, str::FromStr};
 
 use tracing::debug;
 
-use super::{GenApiError, GenApiResult};
+use super::{
+    codec::{impl_codec_struct, Codec, DecodeResult, Decoder, Encoder},
+    GenApiError, GenApiResult,
+};
 
 #[derive(Debug, Clone, PartialEq)]
 pub struct Formula {
@@ -77,6 +80,15 @@ impl From<bool> for Expr {
     }
 }
 
+impl From<EvaluationResult> for Expr {
+    fn from(res: EvaluationResult) -> Self {
+        match res {
+            EvaluationResult::Integer(i) => Self::Integer(i),
+            EvaluationResult::Float(f) => Self::Float(f),
+        }
+    }
+}
+
 #[derive(Debug, Clone, Copy, PartialEq)]
 pub enum EvaluationResult {
     Integer(i64),
@@ -175,79 +187,12 @@ impl Expr {
         K: Borrow<str> + Eq + Hash + fmt::Debug,
         V: Borrow<Expr> + fmt::Debug,
     {
-        use std::ops::{Add, Mul, Rem, Sub};
-
         Ok(match op {
             BinOpKind::And => {
                 (self.eval(var_env)?.as_bool() && rhs.eval(var_env)?.as_bool()).into()
             }
             BinOpKind::Or => (self.eval(var_env)?.as_bool() || rhs.eval(var_env)?.as_bool()).into(),
-
-            _ => {
-                let lhs = self.eval(var_env)?;
-                let rhs = rhs.eval(var_env)?;
-
-                macro_rules! apply_arithmetic_op {
-                    ($fint:ident, $ffloat:ident) => {{
-                        if lhs.is_integer() && rhs.is_integer() {
-                            (lhs.as_integer().$fint(rhs.as_integer())).0.into()
-                        } else {
-                            (lhs.as_float().$ffloat(rhs.as_float())).into()
-                        }
-                    }};
-                }
-
-                macro_rules! apply_cmp_op {
-                    ($fint:ident, $ffloat:ident) => {{
-                        if lhs.is_integer() && rhs.is_integer() {
-                            (lhs.as_integer().$fint(&rhs.as_integer())).into()
-                        } else {
-                            (lhs.as_float().$ffloat(&rhs.as_float())).into()
-                        }
-                    }};
-                }
-                match op {
-                    BinOpKind::Add => apply_arithmetic_op!(overflowing_add, add),
-                    BinOpKind::Sub => apply_arithmetic_op!(overflowing_sub, sub),
-                    BinOpKind::Mul => apply_arithmetic_op!(overflowing_mul, mul),
-                    BinOpKind::Div => {
-                        // Division must be treated as floating points.
-                        // e.g. Converter node with `<FormulaFrom>TO/(1&lt;&lt;P1)</FormulaFrom>` where `P1` points to integer node are commonplace.
-                        (lhs.as_float() / rhs.as_float()).into()
-                    }
-                    BinOpKind::Rem => apply_arithmetic_op!(overflowing_rem, rem),
-                    BinOpKind::Pow => {
-                        if lhs.is_integer() && rhs.is_integer() && rhs.as_integer() >= 0 {
-                            lhs.as_integer()
-                                .overflowing_pow(rhs.as_integer() as u32)
-                                .0
-                                .into()
-                        } else {
-                            lhs.as_float().powf(rhs.as_float()).into()
-                        }
-                    }
-                    BinOpKind::Eq => apply_cmp_op!(eq, eq),
-                    BinOpKind::Ne => apply_cmp_op!(ne, ne),
-                    BinOpKind::Lt => apply_cmp_op!(lt, lt),
-                    BinOpKind::Le => apply_cmp_op!(le, le),
-                    BinOpKind::Gt => apply_cmp_op!(gt, gt),
-                    BinOpKind::Ge => apply_cmp_op!(ge, ge),
-                    BinOpKind::Shl => lhs
-                        .as_integer()
-                        .overflowing_shl(rhs.as_integer() as u32)
-                        .0
-                        .into(),
-                    BinOpKind::Shr => lhs
-                        .as_integer()
-                        .overflowing_shr(rhs.as_integer() as u32)
-                        .0
-                        .into(),
-                    BinOpKind::BitAnd => (lhs.as_integer() & rhs.as_integer()).into(),
-                    BinOpKind::BitOr => (lhs.as_integer() | rhs.as_integer()).into(),
-                    BinOpKind::Xor => (lhs.as_integer() ^ rhs.as_integer()).into(),
-                    _ => unreachable!(),
-                }
-            }
+            _ => apply_binop(op, self.eval(var_env)?, rhs.eval(var_env)?),
         })
     }
 
@@ -260,39 +205,547 @@ impl Expr {
         K: Borrow<str> + Eq + Hash + fmt::Debug,
         V: Borrow<Expr> + fmt::Debug,
     {
-        use std::ops::Neg;
-
-        let res = self.eval(var_env)?;
-        macro_rules! apply_op {
-            ($f:ident) => {
-                match res {
-                    EvaluationResult::Integer(i) => EvaluationResult::from(i.$f()),
-                    EvaluationResult::Float(f) => EvaluationResult::from(f.$f()),
+        Ok(apply_unop(op, self.eval(var_env)?))
+    }
+}
+
+fn apply_binop(op: BinOpKind, lhs: EvaluationResult, rhs: EvaluationResult) -> EvaluationResult {
+    use std::ops::{Add, Mul, Rem, Sub};
+
+    macro_rules! apply_arithmetic_op {
+        ($fint:ident, $ffloat:ident) => {{
+            if lhs.is_integer() && rhs.is_integer() {
+                (lhs.as_integer().$fint(rhs.as_integer())).0.into()
+            } else {
+                (lhs.as_float().$ffloat(rhs.as_float())).into()
+            }
+        }};
+    }
+
+    macro_rules! apply_cmp_op {
+        ($fint:ident, $ffloat:ident) => {{
+            if lhs.is_integer() && rhs.is_integer() {
+                (lhs.as_integer().$fint(&rhs.as_integer())).into()
+            } else {
+                (lhs.as_float().$ffloat(&rhs.as_float())).into()
+            }
+        }};
+    }
+
+    match op {
+        BinOpKind::And => (lhs.as_bool() && rhs.as_bool()).into(),
+        BinOpKind::Or => (lhs.as_bool() || rhs.as_bool()).into(),
+        BinOpKind::Add => apply_arithmetic_op!(overflowing_add, add),
+        BinOpKind::Sub => apply_arithmetic_op!(overflowing_sub, sub),
+        BinOpKind::Mul => apply_arithmetic_op!(overflowing_mul, mul),
+        BinOpKind::Div => {
+            // Division must be treated as floating points.
+            // e.g. Converter node with `<FormulaFrom>TO/(1&lt;&lt;P1)</FormulaFrom>` where `P1` points to integer node are commonplace.
+            (lhs.as_float() / rhs.as_float()).into()
+        }
+        BinOpKind::Rem => apply_arithmetic_op!(overflowing_rem, rem),
+        BinOpKind::Pow => {
+            if lhs.is_integer() && rhs.is_integer() && rhs.as_integer() >= 0 {
+                lhs.as_integer()
+                    .overflowing_pow(rhs.as_integer() as u32)
+                    .0
+                    .into()
+            } else {
+                lhs.as_float().powf(rhs.as_float()).into()
+            }
+        }
+        BinOpKind::Eq => apply_cmp_op!(eq, eq),
+        BinOpKind::Ne => apply_cmp_op!(ne, ne),
+        BinOpKind::Lt => apply_cmp_op!(lt, lt),
+        BinOpKind::Le => apply_cmp_op!(le, le),
+        BinOpKind::Gt => apply_cmp_op!(gt, gt),
+        BinOpKind::Ge => apply_cmp_op!(ge, ge),
+        BinOpKind::Shl => lhs
+            .as_integer()
+            .overflowing_shl(rhs.as_integer() as u32)
+            .0
+            .into(),
+        BinOpKind::Shr => lhs
+            .as_integer()
+            .overflowing_shr(rhs.as_integer() as u32)
+            .0
+            .into(),
+        BinOpKind::BitAnd => (lhs.as_integer() & rhs.as_integer()).into(),
+        BinOpKind::BitOr => (lhs.as_integer() | rhs.as_integer()).into(),
+        BinOpKind::Xor => (lhs.as_integer() ^ rhs.as_integer()).into(),
+    }
+}
+
+fn apply_unop(op: UnOpKind, res: EvaluationResult) -> EvaluationResult {
+    use std::ops::Neg;
+
+    macro_rules! apply_op {
+        ($f:ident) => {
+            match res {
+                EvaluationResult::Integer(i) => EvaluationResult::from(i.$f()),
+                EvaluationResult::Float(f) => EvaluationResult::from(f.$f()),
+            }
+        };
+    }
+
+    match op {
+        UnOpKind::Not => (!res.as_integer()).into(),
+        UnOpKind::Abs => apply_op!(abs),
+        UnOpKind::Sgn => apply_op!(signum),
+        UnOpKind::Neg => apply_op!(neg),
+        UnOpKind::Sin => res.as_float().sin().into(),
+        UnOpKind::Cos => res.as_float().cos().into(),
+        UnOpKind::Tan => res.as_float().tan().into(),
+        UnOpKind::Asin => res.as_float().asin().into(),
+        UnOpKind::Acos => res.as_float().acos().into(),
+        UnOpKind::Atan => res.as_float().atan().into(),
+        UnOpKind::Exp => res.as_float().exp().into(),
+        UnOpKind::Ln => res.as_float().ln().into(),
+        UnOpKind::Lg => res.as_float().log10().into(),
+        UnOpKind::Sqrt => res.as_float().sqrt().into(),
+        UnOpKind::Trunc => res.as_float().trunc().into(),
+        UnOpKind::Floor => res.as_float().floor().into(),
+        UnOpKind::Ceil => res.as_float().ceil().into(),
+        UnOpKind::Round => res.as_float().round().into(),
+    }
+}
+
+/// The number of registers [`Program::eval`] keeps on the stack. Larger programs allocate their
+/// registers on the heap.
+const INLINE_REGISTERS: usize = 32;
+
+/// The maximum nesting of `Expression`s inlined into a [`Program`], which also guards against
+/// self-referencing expressions.
+const MAX_INLINE_DEPTH: usize = 16;
+
+/// Meaning of an identifier in a formula, resolved when the formula is compiled.
+#[derive(Debug, Clone, Copy)]
+pub(crate) enum Binding<'a> {
+    /// The identifier is loaded into the slot of the index when the program is evaluated.
+    Slot(usize),
+    /// The identifier is a constant.
+    Imm(EvaluationResult),
+    /// The identifier is a named expression, which is inlined into the program.
+    Expr(&'a Expr),
+}
+
+/// Operand of [`Op`].
+#[derive(Debug, Clone, Copy, PartialEq)]
+enum Operand {
+    Slot(usize),
+    Reg(usize),
+    Imm(EvaluationResult),
+}
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+enum Op {
+    Binary {
+        kind: BinOpKind,
+        dst: usize,
+        lhs: Operand,
+        rhs: Operand,
+    },
+    Unary {
+        kind: UnOpKind,
+        dst: usize,
+        src: Operand,
+    },
+    /// Stores `src` normalized to `0` or `1`.
+    Bool {
+        dst: usize,
+        src: Operand,
+    },
+    Move {
+        dst: usize,
+        src: Operand,
+    },
+    /// Jumps to `target` if `cond.as_bool() == when`.
+    Branch {
+        cond: Operand,
+        when: bool,
+        target: usize,
+    },
+    Jump {
+        target: usize,
+    },
+}
+
+/// A formula compiled to flat register based bytecode.
+///
+/// Identifiers are resolved to slots at compile time, so evaluation neither hashes nor allocates
+/// as long as the program fits in [`INLINE_REGISTERS`]. Constant sub-expressions are folded, and
+/// `&&`, `||` and `? :` are short-circuited with jumps.
+///
+/// The first `slot_count` registers hold the slots, and temporaries follow them.
+#[derive(Debug, Clone, PartialEq)]
+pub(crate) struct Program {
+    ops: Vec<Op>,
+    result: Operand,
+    slot_count: usize,
+    register_count: usize,
+}
+
+impl_codec_struct!(Program {
+    ops,
+    result,
+    slot_count,
+    register_count
+});
+
+impl Codec for Operand {
+    fn encode(&self, enc: &mut Encoder) {
+        match self {
+            Self::Slot(i) => {
+                0_u8.encode(enc);
+                i.encode(enc);
+            }
+            Self::Reg(i) => {
+                1_u8.encode(enc);
+                i.encode(enc);
+            }
+            Self::Imm(imm) => {
+                2_u8.encode(enc);
+                imm.encode(enc);
+            }
+        }
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        match u8::decode(dec)? {
+            0 => Ok(Self::Slot(Codec::decode(dec)?)),
+            1 => Ok(Self::Reg(Codec::decode(dec)?)),
+            2 => Ok(Self::Imm(Codec::decode(dec)?)),
+            _ => Decoder::invalid("invalid Operand"),
+        }
+    }
+}
+
+impl Codec for Op {
+    fn encode(&self, enc: &mut Encoder) {
+        match self {
+            Self::Binary {
+                kind,
+                dst,
+                lhs,
+                rhs,
+            } => {
+                0_u8.encode(enc);
+                kind.encode(enc);
+                dst.encode(enc);
+                lhs.encode(enc);
+                rhs.encode(enc);
+            }
+            Self::Unary { kind, dst, src } => {
+                1_u8.encode(enc);
+                kind.encode(enc);
+                dst.encode(enc);
+                src.encode(enc);
+            }
+            Self::Bool { dst, src } => {
+                2_u8.encode(enc);
+                dst.encode(enc);
+                src.encode(enc);
+            }
+            Self::Move { dst, src } => {
+                3_u8.encode(enc);
+                dst.encode(enc);
+                src.encode(enc);
+            }
+            Self::Branch { cond, when, target } => {
+                4_u8.encode(enc);
+                cond.encode(enc);
+                when.encode(enc);
+                target.encode(enc);
+            }
+            Self::Jump { target } => {
+                5_u8.encode(enc);
+                target.encode(enc);
+            }
+        }
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        Ok(match u8::decode(dec)? {
+            0 => Self::Binary {
+                kind: Codec::decode(dec)?,
+                dst: Codec::decode(dec)?,
+                lhs: Codec::decode(dec)?,
+                rhs: Codec::decode(dec)?,
+            },
+            1 => Self::Unary {
+                kind: Codec::decode(dec)?,
+                dst: Codec::decode(dec)?,
+                src: Codec::decode(dec)?,
+            },
+            2 => Self::Bool {
+                dst: Codec::decode(dec)?,
+                src: Codec::decode(dec)?,
+            },
+            3 => Self::Move {
+                dst: Codec::decode(dec)?,
+                src: Codec::decode(dec)?,
+            },
+            4 => Self::Branch {
+                cond: Codec::decode(dec)?,
+                when: Codec::decode(dec)?,
+                target: Codec::decode(dec)?,
+            },
+            5 => Self::Jump {
+                target: Codec::decode(dec)?,
+            },
+            _ => return Decoder::invalid("invalid Op"),
+        })
+    }
+}
+
+impl Program {
+    /// Compiles `expr`. `resolve` is called for each identifier appearing in `expr`.
+    ///
+    /// Returns `None` if an identifier can't be resolved, or expressions are nested too deeply.
+    pub(crate) fn compile<'a>(
+        expr: &'a Expr,
+        resolve: impl FnMut(&str) -> Option<Binding<'a>>,
+    ) -> Option<Self> {
+        let mut compiler = Compiler {
+            resolve,
+            ops: vec![],
+            top: 0,
+            temp_count: 0,
+            slot_count: 0,
+        };
+        let result = compiler.emit(expr, 0)?;
+
+        // Temporaries are numbered from zero while compiling, because the number of slots is
+        // unknown until all identifiers are resolved. Move them after the slots.
+        let slot_count = compiler.slot_count;
+        let relocate = |operand: &mut Operand| {
+            if let Operand::Reg(reg) = operand {
+                *reg += slot_count;
+            }
+        };
+        let mut ops = compiler.ops;
+        for op in &mut ops {
+            match op {
+                Op::Binary { dst, lhs, rhs, .. } => {
+                    *dst += slot_count;
+                    relocate(lhs);
+                    relocate(rhs);
                 }
-            };
+                Op::Unary { dst, src, .. } | Op::Bool { dst, src } | Op::Move { dst, src } => {
+                    *dst += slot_count;
+                    relocate(src);
+                }
+                Op::Branch { cond, .. } => relocate(cond),
+                Op::Jump { .. } => {}
+            }
         }
+        let mut result = result;
+        relocate(&mut result);
+
+        Some(Self {
+            ops,
+            result,
+            slot_count,
+            register_count: slot_count + compiler.temp_count,
+        })
+    }
 
-        Ok(match op {
-            UnOpKind::Not => (!res.as_integer()).into(),
-            UnOpKind::Abs => apply_op!(abs),
-            UnOpKind::Sgn => apply_op!(signum),
-            UnOpKind::Neg => apply_op!(neg),
-            UnOpKind::Sin => res.as_float().sin().into(),
-            UnOpKind::Cos => res.as_float().cos().into(),
-            UnOpKind::Tan => res.as_float().tan().into(),
-            UnOpKind::Asin => res.as_float().asin().into(),
-            UnOpKind::Acos => res.as_float().acos().into(),
-            UnOpKind::Atan => res.as_float().atan().into(),
-            UnOpKind::Exp => res.as_float().exp().into(),
-            UnOpKind::Ln => res.as_float().ln().into(),
-            UnOpKind::Lg => res.as_float().log10().into(),
-            UnOpKind::Sqrt => res.as_float().sqrt().into(),
-            UnOpKind::Trunc => res.as_float().trunc().into(),
-            UnOpKind::Floor => res.as_float().floor().into(),
-            UnOpKind::Ceil => res.as_float().ceil().into(),
-            UnOpKind::Round => res.as_float().round().into(),
+    /// Returns the number of slots loaded by [`Self::eval`].
+    #[must_use]
+    pub(crate) fn slot_count(&self) -> usize {
+        self.slot_count
+    }
+
+    /// Evaluates the program. `load` is called once for each slot before running the program.
+    pub(crate) fn eval(
+        &self,
+        mut load: impl FnMut(usize) -> GenApiResult<EvaluationResult>,
+    ) -> GenApiResult<EvaluationResult> {
+        let mut inline = [EvaluationResult::Integer(0); INLINE_REGISTERS];
+        let mut heap;
+        let regs = if self.register_count <= INLINE_REGISTERS {
+            &mut inline[..self.register_count]
+        } else {
+            heap = vec![EvaluationResult::Integer(0); self.register_count];
+            heap.as_mut_slice()
+        };
+
+        for (slot, reg) in regs[..self.slot_count].iter_mut().enumerate() {
+            *reg = load(slot)?;
+        }
+        Ok(self.run(regs))
+    }
+
+    fn run(&self, regs: &mut [EvaluationResult]) -> EvaluationResult {
+        let read = |regs: &[EvaluationResult], operand| match operand {
+            Operand::Slot(reg) | Operand::Reg(reg) => regs[reg],
+            Operand::Imm(value) => value,
+        };
+
+        let mut pc = 0;
+        while let Some(&op) = self.ops.get(pc) {
+            pc += 1;
+            match op {
+                Op::Binary {
+                    kind,
+                    dst,
+                    lhs,
+                    rhs,
+                } => regs[dst] = apply_binop(kind, read(regs, lhs), read(regs, rhs)),
+                Op::Unary { kind, dst, src } => regs[dst] = apply_unop(kind, read(regs, src)),
+                Op::Bool { dst, src } => regs[dst] = read(regs, src).as_bool().into(),
+                Op::Move { dst, src } => regs[dst] = read(regs, src),
+                Op::Branch { cond, when, target } => {
+                    if read(regs, cond).as_bool() == when {
+                        pc = target;
+                    }
+                }
+                Op::Jump { target } => pc = target,
+            }
+        }
+        read(regs, self.result)
+    }
+}
+
+struct Compiler<F> {
+    resolve: F,
+    ops: Vec<Op>,
+    /// The first free temporary.
+    top: usize,
+    temp_count: usize,
+    slot_count: usize,
+}
+
+impl<'a, F> Compiler<F>
+where
+    F: FnMut(&str) -> Option<Binding<'a>>,
+{
+    fn emit(&mut self, expr: &'a Expr, depth: usize) -> Option<Operand> {
+        Some(match expr {
+            &Expr::Integer(i) => Operand::Imm(i.into()),
+            &Expr::Float(f) => Operand::Imm(f.into()),
+            Expr::Ident(name) => match (self.resolve)(name)? {
+                Binding::Slot(slot) => {
+                    self.slot_count = self.slot_count.max(slot + 1);
+                    Operand::Slot(slot)
+                }
+                Binding::Imm(value) => Operand::Imm(value),
+                Binding::Expr(expr) if depth < MAX_INLINE_DEPTH => self.emit(expr, depth + 1)?,
+                Binding::Expr(_) => return None,
+            },
+            Expr::UnOp { kind, expr } => {
+                let mark = self.top;
+                let src = self.emit(expr, depth)?;
+                if let Operand::Imm(value) = src {
+                    return Some(Operand::Imm(apply_unop(*kind, value)));
+                }
+                self.top = mark;
+                let dst = self.alloc();
+                self.ops.push(Op::Unary {
+                    kind: *kind,
+                    dst,
+                    src,
+                });
+                Operand::Reg(dst)
+            }
+            Expr::BinOp { kind, lhs, rhs } if matches!(kind, BinOpKind::And | BinOpKind::Or) => {
+                // `when` is the value of `lhs` which determines the result without `rhs`.
+                let when = *kind == BinOpKind::Or;
+                let mark = self.top;
+                let lhs = self.emit(lhs, depth)?;
+                match lhs {
+                    Operand::Imm(value) if value.as_bool() == when => {
+                        return Some(Operand::Imm(when.into()))
+                    }
+                    Operand::Imm(_) => {
+                        let rhs = self.emit(rhs, depth)?;
+                        if let Operand::Imm(value) = rhs {
+                            return Some(Operand::Imm(value.as_bool().into()));
+                        }
+                        self.top = mark;
+                        let dst = self.alloc();
+                        self.ops.push(Op::Bool { dst, src: rhs });
+                        Operand::Reg(dst)
+                    }
+                    Operand::Slot(_) | Operand::Reg(_) => {
+                        self.top = mark;
+                        let dst = self.alloc();
+                        self.ops.push(Op::Bool { dst, src: lhs });
+                        let branch = self.branch(Operand::Reg(dst), when);
+                        let rhs = self.emit(rhs, depth)?;
+                        self.ops.push(Op::Bool { dst, src: rhs });
+                        self.patch(branch);
+                        self.top = dst + 1;
+                        Operand::Reg(dst)
+                    }
+                }
+            }
+            Expr::BinOp { kind, lhs, rhs } => {
+                let mark = self.top;
+                let lhs = self.emit(lhs, depth)?;
+                let rhs = self.emit(rhs, depth)?;
+                if let (Operand::Imm(lhs), Operand::Imm(rhs)) = (lhs, rhs) {
+                    return Some(Operand::Imm(apply_binop(*kind, lhs, rhs)));
+                }
+                self.top = mark;
+                let dst = self.alloc();
+                self.ops.push(Op::Binary {
+                    kind: *kind,
+                    dst,
+                    lhs,
+                    rhs,
+                });
+                Operand::Reg(dst)
+            }
+            Expr::If { cond, then, else_ } => {
+                let mark = self.top;
+                let cond = self.emit(cond, depth)?;
+                if let Operand::Imm(value) = cond {
+                    self.top = mark;
+                    return self.emit(if value.as_bool() { then } else { else_ }, depth);
+                }
+                self.top = mark;
+                let dst = self.alloc();
+                let branch = self.branch(cond, false);
+                let then = self.emit(then, depth)?;
+                self.ops.push(Op::Move { dst, src: then });
+                self.top = dst + 1;
+                let jump = self.ops.len();
+                self.ops.push(Op::Jump { target: 0 });
+                self.patch(branch);
+                let else_ = self.emit(else_, depth)?;
+                self.ops.push(Op::Move { dst, src: else_ });
+                self.top = dst + 1;
+                self.patch(jump);
+                Operand::Reg(dst)
+            }
         })
     }
+
+    fn alloc(&mut self) -> usize {
+        let reg = self.top;
+        self.top += 1;
+        self.temp_count = self.temp_count.max(self.top);
+        reg
+    }
+
+    fn branch(&mut self, cond: Operand, when: bool) -> usize {
+        self.ops.push(Op::Branch {
+            cond,
+            when,
+            target: 0,
+        });
+        self.ops.len() - 1
+    }
+
+    /// Makes the jump at `idx` jump to the next op to be emitted.
+    fn patch(&mut self, idx: usize) {
+        let next = self.ops.len();
+        match &mut self.ops[idx] {
+            Op::Branch { target, .. } | Op::Jump { target } => *target = next,
+            _ => unreachable!(),
+        }
+    }
 }
 
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
@@ -860,6 +1313,18 @@ mod tests {
             expr.eval(var_env).unwrap(),
             EvaluationResult::Integer(1)
         ));
+
+        // Compiled program must agree with the tree walking evaluation. Identifiers are bound to
+        // slots so that nothing is folded away.
+        let names: Vec<&str> = var_env.keys().copied().collect();
+        let program = Program::compile(&expr, |name| {
+            names.iter().position(|n| *n == name).map(Binding::Slot)
+        })
+        .unwrap();
+        let result = program
+            .eval(|slot| var_env[names[slot]].eval(var_env))
+            .unwrap();
+        assert!(matches!(result, EvaluationResult::Integer(1)));
     }
 
     fn test_eval_no_var_impl(expr: &str) {
@@ -902,4 +1367,61 @@ mod tests {
         test_eval_impl("ABS(VAR1 + 1 / 4 - 1.25) < EPS", &env);
         test_eval_impl("( EXP = 1 ) ? 1 : 0", &env);
     }
+
+    #[test]
+    fn test_compile() {
+        let var = Expr::Ident("VAR".into());
+        let expr = parse("(1 + 2 * 3) + CONST * VAR + EXPR");
+        let const_expr = parse("VAR * 2");
+        let resolve = |name: &str| match name {
+            "VAR" => Some(Binding::Slot(0)),
+            "CONST" => Some(Binding::Imm(EvaluationResult::Integer(10))),
+            "EXPR" => Some(Binding::Expr(&const_expr)),
+            _ => None,
+        };
+        let program = Program::compile(&expr, resolve).unwrap();
+        assert_eq!(program.slot_count(), 1);
+        // `(1 + 2 * 3)` is folded.
+        assert_eq!(program.ops.len(), 4);
+        let result = program.eval(|_| Ok(EvaluationResult::Integer(3))).unwrap();
+        assert_eq!(result, EvaluationResult::Integer(7 + 30 + 6));
+
+        // Whole program is folded.
+        let folded = parse("CONST > 5 ? SQRT(CONST - 1) : VAR");
+        let program = Program::compile(&folded, resolve).unwrap();
+        assert!(program.ops.is_empty());
+        assert_eq!(
+            program.eval(|_| unreachable!()).unwrap(),
+            EvaluationResult::Float(3.0)
+        );
+
+        // Short-circuit.
+        let or = parse("VAR || EXPR = 0 ? 1 : 0");
+        let program = Program::compile(&or, resolve).unwrap();
+        assert_eq!(program.eval(|_| Ok(1.into())).unwrap(), 1.into());
+        assert_eq!(program.eval(|_| Ok(0.into())).unwrap(), 1.into());
+        let and = parse("VAR && 0 + 2");
+        let program = Program::compile(&and, resolve).unwrap();
+        assert_eq!(program.eval(|_| Ok(3.into())).unwrap(), 1.into());
+        assert_eq!(program.eval(|_| Ok(0.into())).unwrap(), 0.into());
+
+        // Unknown or self referencing identifiers can't be compiled.
+        assert!(Program::compile(&parse("UNKNOWN + 1"), resolve).is_none());
+        assert!(Program::compile(&var, |_| Some(Binding::Expr(&var))).is_none());
+    }
+
+    #[test]
+    fn test_compile_many_registers() {
+        // Each level of the nesting holds `VAR * 2` in a temporary while evaluating the rest.
+        let src = (0..INLINE_REGISTERS * 2)
+            .fold("VAR".to_string(), |acc, _| format!("VAR * 2 + ({})", acc));
+        let expr = parse(&src);
+        let program = Program::compile(&expr, |_| Some(Binding::Slot(0))).unwrap();
+        assert!(program.register_count > INLINE_REGISTERS);
+        let result = program.eval(|_| Ok(1.into())).unwrap();
+        assert_eq!(
+            result,
+            EvaluationResult::Integer(INLINE_REGISTERS as i64 * 4 + 1)
+        );
+    }
 }
@@ -8,7 +8,8 @@ use super::{
     interface::{IInteger, INode, IncrementMode},
     node_base::{NodeAttributeBase, NodeBase, NodeElementBase},
     store::{CacheStore, NodeId, NodeStore, ValueStore},
-    utils, Device, GenApiError, GenApiResult, ValueCtxt,
+    utils::{self, CompiledFormula},
+    Device, GenApiError, GenApiResult, ValueCtxt,
 };
 
 #[derive(Debug, Clone)]
@@ -22,6 +23,10 @@ pub struct IntConverterNode {
     pub(crate) expressions: Vec<NamedValue<Expr>>,
     pub(crate) formula_to: Formula,
     pub(crate) formula_from: Formula,
+    /// `None` if `formula_to` couldn't be compiled, see [`CompiledFormula::compile`].
+    pub(crate) compiled_formula_to: Option<CompiledFormula>,
+    /// `None` if `formula_from` couldn't be compiled, see [`CompiledFormula::compile`].
+    pub(crate) compiled_formula_from: Option<CompiledFormula>,
     pub(crate) p_value: NodeId,
     pub(crate) unit: Option<String>,
     pub(crate) representation: IntegerRepresentation,
@@ -95,12 +100,24 @@ impl IInteger for IntConverterNode {
         store: &impl NodeStore,
         cx: &mut ValueCtxt<T, U>,
     ) -> GenApiResult<i64> {
-        let mut collector =
-            utils::FormulaEnvCollector::new(&self.p_variables, &self.constants, &self.expressions);
-        collector.insert("TO", self.p_value(), device, store, cx)?;
-        let var_env = collector.collect(device, store, cx)?;
-
-        let eval_result = self.formula_from.eval(&var_env)?;
+        let nid = self.node_base().id();
+        if let Some(value) = cx.get_value_cache(nid) {
+            return Ok(value.as_integer());
+        }
+
+        let eval_result = if let Some(formula) = &self.compiled_formula_from {
+            formula.eval(None, device, store, cx)?
+        } else {
+            let mut collector = utils::FormulaEnvCollector::new(
+                &self.p_variables,
+                &self.constants,
+                &self.expressions,
+            );
+            collector.insert("TO", self.p_value(), device, store, cx)?;
+            let var_env = collector.collect(device, store, cx)?;
+            self.formula_from.eval(&var_env)?
+        };
+        cx.cache_value(nid, eval_result);
         Ok(eval_result.as_integer())
     }
 
@@ -116,12 +133,18 @@ impl IInteger for IntConverterNode {
     ) -> GenApiResult<()> {
         cx.invalidate_cache_by(self.node_base().id());
 
-        let mut collector =
-            utils::FormulaEnvCollector::new(&self.p_variables, &self.constants, &self.expressions);
-        collector.insert_imm("FROM", value);
-        let var_env = collector.collect(device, store, cx)?;
-
-        let eval_result = self.formula_to.eval(&var_env)?;
+        let eval_result = if let Some(formula) = &self.compiled_formula_to {
+            formula.eval(Some(value.into()), device, store, cx)?
+        } else {
+            let mut collector = utils::FormulaEnvCollector::new(
+                &self.p_variables,
+                &self.constants,
+                &self.expressions,
+            );
+            collector.insert_imm("FROM", value);
+            let var_env = collector.collect(device, store, cx)?;
+            self.formula_to.eval(&var_env)?
+        };
         utils::set_eval_result(self.p_value, eval_result, device, store, cx)?;
         Ok(())
     }
@@ -8,7 +8,8 @@ use super::{
     interface::{IInteger, INode, IncrementMode},
     node_base::{NodeAttributeBase, NodeBase, NodeElementBase},
     store::{CacheStore, NodeId, NodeStore, ValueStore},
-    utils, Device, GenApiError, GenApiResult, ValueCtxt,
+    utils::{self, CompiledFormula},
+    Device, GenApiError, GenApiResult, ValueCtxt,
 };
 
 #[derive(Debug, Clone)]
@@ -21,6 +22,8 @@ pub struct IntSwissKnifeNode {
     pub(crate) constants: Vec<NamedValue<i64>>,
     pub(crate) expressions: Vec<NamedValue<Expr>>,
     pub(crate) formula: Formula,
+    /// `None` if `formula` couldn't be compiled, see [`CompiledFormula::compile`].
+    pub(crate) compiled_formula: Option<CompiledFormula>,
     pub(crate) unit: Option<String>,
     pub(crate) representation: IntegerRepresentation,
 }
@@ -77,10 +80,23 @@ impl IInteger for IntSwissKnifeNode {
         store: &impl NodeStore,
         cx: &mut ValueCtxt<T, U>,
     ) -> GenApiResult<i64> {
-        let var_env =
-            utils::FormulaEnvCollector::new(&self.p_variables, &self.constants, &self.expressions)
-                .collect(device, store, cx)?;
-        let eval_result = self.formula.eval(&var_env)?;
+        let nid = self.node_base().id();
+        if let Some(value) = cx.get_value_cache(nid) {
+            return Ok(value.as_integer());
+        }
+
+        let eval_result = if let Some(formula) = &self.compiled_formula {
+            formula.eval(None, device, store, cx)?
+        } else {
+            let var_env = utils::FormulaEnvCollector::new(
+                &self.p_variables,
+                &self.constants,
+                &self.expressions,
+            )
+            .collect(device, store, cx)?;
+            self.formula.eval(&var_env)?
+        };
+        cx.cache_value(nid, eval_result);
         Ok(eval_result.as_integer())
     }
 
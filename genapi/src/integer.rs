@@ -162,6 +162,7 @@ impl IInteger for IntegerNode {
         store: &impl NodeStore,
         cx: &mut ValueCtxt<T, U>,
     ) -> GenApiResult<()> {
+        cx.invalidate_cache_by(self.node_base().id());
         self.min.set_value(value, device, store, cx)
     }
 
@@ -175,6 +176,7 @@ impl IInteger for IntegerNode {
         store: &impl NodeStore,
         cx: &mut ValueCtxt<T, U>,
     ) -> GenApiResult<()> {
+        cx.invalidate_cache_by(self.node_base().id());
         self.max.set_value(value, device, store, cx)
     }
 
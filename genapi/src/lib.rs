@@ -13,17 +13,24 @@
 )]
 
 pub mod builder;
+pub mod codec;
 pub mod elem_type;
 pub mod formula;
 pub mod interface;
 pub mod parser;
 pub mod store;
 
+#[cfg(any(test, feature = "testing"))]
+#[doc(hidden)]
+pub mod testing;
+
+mod batch;
 mod boolean;
 mod category;
 mod command;
 mod converter;
 mod enumeration;
+mod event;
 mod float;
 mod float_reg;
 mod int_converter;
@@ -43,11 +50,13 @@ mod string_reg;
 mod swiss_knife;
 mod utils;
 
+pub use batch::{chunk_registers, invalidate_registers, polling_nodes, prefetch, refresh};
 pub use boolean::BooleanNode;
 pub use category::CategoryNode;
 pub use command::CommandNode;
 pub use converter::ConverterNode;
 pub use enumeration::{EnumEntryNode, EnumerationNode};
+pub use event::EventRegisters;
 pub use float::FloatNode;
 pub use float_reg::FloatRegNode;
 pub use int_converter::IntConverterNode;
@@ -91,6 +100,30 @@ pub trait Device {
         address: i64,
         data: &[u8],
     ) -> Result<(), Box<dyn std::error::Error + Send + Sync>>;
+
+    /// Reads multiple regions of the memory. Each entry is a pair of an address and a buffer to
+    /// fill.
+    ///
+    /// Devices supporting a stacked read, e.g. `ReadMemStacked` of `U3V`, should override this
+    /// to read all entries in a single transaction. The default implementation calls
+    /// [`Device::read_mem`] for each entry.
+    fn read_mem_stacked(
+        &mut self,
+        entries: &mut [(i64, &mut [u8])],
+    ) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
+        for (address, buf) in entries {
+            self.read_mem(*address, buf)?;
+        }
+        Ok(())
+    }
+
+    /// Returns the chunk data with `chunk_id` attached to the device, which registers of chunk
+    /// ports are read from.
+    ///
+    /// The default implementation returns `None`, i.e. no chunk data is attached.
+    fn chunk_data(&self, _chunk_id: u64) -> Option<&[u8]> {
+        None
+    }
 }
 
 #[derive(Debug, thiserror::Error)]
@@ -209,6 +242,20 @@ impl<T, U> ValueCtxt<T, U> {
         self.cache_store.get_cache(nid, address, length)
     }
 
+    pub fn cache_value(&mut self, nid: store::NodeId, value: formula::EvaluationResult)
+    where
+        U: store::CacheStore,
+    {
+        self.cache_store.cache_value(nid, value);
+    }
+
+    pub fn get_value_cache(&self, nid: store::NodeId) -> Option<formula::EvaluationResult>
+    where
+        U: store::CacheStore,
+    {
+        self.cache_store.get_value_cache(nid)
+    }
+
     pub fn invalidate_cache_by(&mut self, nid: store::NodeId)
     where
         U: store::CacheStore,
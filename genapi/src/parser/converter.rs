@@ -6,6 +6,7 @@ use tracing::debug;
 
 use crate::{
     builder::{CacheStoreBuilder, NodeStoreBuilder, ValueStoreBuilder},
+    utils::{CompiledFormula, FormulaInput},
     ConverterNode,
 };
 
@@ -62,6 +63,21 @@ impl Parse for ConverterNode {
             .parse_if(IS_LINEAR, node_builder, value_builder, cache_builder)
             .unwrap_or_default();
 
+        let compiled_formula_to = CompiledFormula::compile(
+            &formula_to,
+            &p_variables,
+            &constants,
+            &expressions,
+            &[FormulaInput::Imm("FROM")],
+        );
+        let compiled_formula_from = CompiledFormula::compile(
+            &formula_from,
+            &p_variables,
+            &constants,
+            &expressions,
+            &[FormulaInput::Node("TO", p_value)],
+        );
+
         Self {
             attr_base,
             elem_base,
@@ -71,6 +87,8 @@ impl Parse for ConverterNode {
             expressions,
             formula_to,
             formula_from,
+            compiled_formula_to,
+            compiled_formula_from,
             p_value,
             unit,
             representation,
@@ -130,5 +148,8 @@ mod tests {
         assert_eq!(node.p_value(), node_builder.get_or_intern("Target"));
         assert_eq!(node.slope(), Slope::Increasing);
         assert!(node.is_linear());
+
+        assert!(node.compiled_formula_to.is_some());
+        assert!(node.compiled_formula_from.is_some());
     }
 }
@@ -0,0 +1,229 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! Extraction of value dependencies between nodes.
+//!
+//! A node depends on another node if the value of the node is computed from the value of the
+//! other node. The dependencies are stored in [`CacheStoreBuilder`] so that the cache store can
+//! invalidate cached values of transitive dependents when a node is written.
+
+use crate::{
+    builder::CacheStoreBuilder,
+    elem_type::{AddressKind, CachingMode, ImmOrPNode, ValueKind},
+    store::{NodeData, NodeId},
+    RegisterBase,
+};
+
+pub(super) fn store_dependencies(data: &NodeData, cache_builder: &mut impl CacheStoreBuilder) {
+    let nid = data.node_base().id();
+    visit_dependencies(data, |dependency| {
+        cache_builder.store_dependency(nid, dependency)
+    });
+
+    // Features selected by a selector depend on the selector.
+    let p_selected: &[NodeId] = match data {
+        NodeData::Integer(node) => &node.p_selected,
+        NodeData::IntReg(node) => &node.p_selected,
+        NodeData::MaskedIntReg(node) => &node.p_selected,
+        NodeData::Boolean(node) => &node.p_selected,
+        NodeData::Enumeration(node) => &node.p_selected,
+        _ => &[],
+    };
+    for selected in p_selected {
+        cache_builder.store_dependency(*selected, nid);
+    }
+
+    if matches!(data.register_base(), Some(base) if base.cacheable == CachingMode::NoCache) {
+        cache_builder.store_volatile(nid);
+    }
+}
+
+/// Calls `depends_on` with each node which the value of `data` is computed from.
+pub(crate) fn visit_dependencies(data: &NodeData, mut depends_on: impl FnMut(NodeId)) {
+    match data {
+        NodeData::Integer(node) => {
+            value_kind(&node.value_kind, &mut depends_on);
+            imm_or_pnode(&node.min, &mut depends_on);
+            imm_or_pnode(&node.max, &mut depends_on);
+            imm_or_pnode(&node.inc, &mut depends_on);
+        }
+        NodeData::Float(node) => {
+            value_kind(&node.value_kind, &mut depends_on);
+            imm_or_pnode(&node.min, &mut depends_on);
+            imm_or_pnode(&node.max, &mut depends_on);
+            if let Some(inc) = &node.inc {
+                imm_or_pnode(inc, &mut depends_on);
+            }
+        }
+        NodeData::Boolean(node) => imm_or_pnode(&node.value, &mut depends_on),
+        NodeData::Enumeration(node) => imm_or_pnode(&node.value, &mut depends_on),
+        NodeData::Command(node) => {
+            imm_or_pnode(&node.value, &mut depends_on);
+            imm_or_pnode(&node.command_value, &mut depends_on);
+        }
+        NodeData::Converter(node) => {
+            depends_on(node.p_value);
+            node.p_variables
+                .iter()
+                .for_each(|var| depends_on(var.value()));
+        }
+        NodeData::IntConverter(node) => {
+            depends_on(node.p_value);
+            node.p_variables
+                .iter()
+                .for_each(|var| depends_on(var.value()));
+        }
+        NodeData::SwissKnife(node) => node
+            .p_variables
+            .iter()
+            .for_each(|var| depends_on(var.value())),
+        NodeData::IntSwissKnife(node) => node
+            .p_variables
+            .iter()
+            .for_each(|var| depends_on(var.value())),
+        NodeData::IntReg(node) => register_base(&node.register_base, &mut depends_on),
+        NodeData::MaskedIntReg(node) => register_base(&node.register_base, &mut depends_on),
+        NodeData::FloatReg(node) => register_base(&node.register_base, &mut depends_on),
+        NodeData::StringReg(node) => register_base(&node.register_base, &mut depends_on),
+        NodeData::Register(node) => register_base(&node.register_base, &mut depends_on),
+        _ => {}
+    }
+}
+
+fn imm_or_pnode<T>(value: &ImmOrPNode<T>, depends_on: &mut impl FnMut(NodeId)) {
+    if let ImmOrPNode::PNode(nid) = value {
+        depends_on(*nid);
+    }
+}
+
+fn value_kind<T>(value: &ValueKind<T>, depends_on: &mut impl FnMut(NodeId)) {
+    match value {
+        ValueKind::Value(_) => {}
+        ValueKind::PValue(p_value) => depends_on(p_value.p_value),
+        ValueKind::PIndex(p_index) => {
+            depends_on(p_index.p_index);
+            for indexed in &p_index.value_indexed {
+                imm_or_pnode(&indexed.indexed, depends_on);
+            }
+            imm_or_pnode(&p_index.value_default, depends_on);
+        }
+    }
+}
+
+fn register_base(base: &RegisterBase, depends_on: &mut impl FnMut(NodeId)) {
+    for address_kind in &base.address_kinds {
+        match address_kind {
+            AddressKind::Address(address) => imm_or_pnode(address, depends_on),
+            AddressKind::IntSwissKnife(nid) => depends_on(*nid),
+            AddressKind::PIndex(p_index) => {
+                depends_on(p_index.p_index);
+                if let Some(offset) = &p_index.offset {
+                    imm_or_pnode(offset, depends_on);
+                }
+            }
+        }
+    }
+    imm_or_pnode(&base.length, depends_on);
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::{
+        builder::GenApiBuilder,
+        interface::{IFloat, IInteger},
+        store::{DefaultNodeStore, NodeStore},
+        testing::{register_description, TestDevice},
+    };
+
+    #[test]
+    fn test_value_cache_invalidation() {
+        let xml = register_description(
+            r#"
+
+            <Integer Name="Scale">
+                <Value>2</Value>
+            </Integer>
+
+            <IntReg Name="WidthReg">
+              <Address>0x0</Address>
+              <Length>4</Length>
+              <AccessMode>RW</AccessMode>
+              <pPort>Device</pPort>
+              <Endianess>LittleEndian</Endianess>
+            </IntReg>
+
+            <IntReg Name="VolatileReg">
+              <Address>0x4</Address>
+              <Length>4</Length>
+              <AccessMode>RO</AccessMode>
+              <pPort>Device</pPort>
+              <Cachable>NoCache</Cachable>
+              <Endianess>LittleEndian</Endianess>
+            </IntReg>
+
+            <SwissKnife Name="Scaled">
+                <pVariable Name="W">WidthReg</pVariable>
+                <pVariable Name="S">Scale</pVariable>
+                <Formula>W * S</Formula>
+            </SwissKnife>
+
+            <SwissKnife Name="ScaledTwice">
+                <pVariable Name="V">Scaled</pVariable>
+                <Formula>V * 2</Formula>
+            </SwissKnife>
+
+            <SwissKnife Name="FromVolatile">
+                <pVariable Name="V">VolatileReg</pVariable>
+                <Formula>V + 1</Formula>
+            </SwissKnife>
+
+            <Port Name="Device">
+            </Port>
+
+        "#,
+        );
+
+        let (_, store, mut cx) = GenApiBuilder::<DefaultNodeStore>::default()
+            .build(&xml)
+            .unwrap();
+        let mut device = TestDevice::new(vec![10, 0, 0, 0, 5, 0, 0, 0]);
+        let nid = |name| store.id_by_name(name).unwrap();
+        let scaled_twice = nid("ScaledTwice").as_ifloat_kind(&store).unwrap();
+        let from_volatile = nid("FromVolatile").as_ifloat_kind(&store).unwrap();
+        let scale = nid("Scale").as_iinteger_kind(&store).unwrap();
+        let width = nid("WidthReg").as_iinteger_kind(&store).unwrap();
+
+        assert!(
+            (scaled_twice.value(&mut device, &store, &mut cx).unwrap() - 40.0).abs() < f64::EPSILON
+        );
+        assert!(cx.get_value_cache(nid("Scaled")).is_some());
+        assert!(cx.get_value_cache(nid("ScaledTwice")).is_some());
+        assert_eq!(device.reads.len(), 1);
+
+        // Writing a node invalidates only its transitive dependents.
+        scale.set_value(3, &mut device, &store, &mut cx).unwrap();
+        assert!(cx.get_value_cache(nid("Scaled")).is_none());
+        assert!(cx.get_value_cache(nid("ScaledTwice")).is_none());
+        assert!(
+            (scaled_twice.value(&mut device, &store, &mut cx).unwrap() - 60.0).abs() < f64::EPSILON
+        );
+
+        width.set_value(20, &mut device, &store, &mut cx).unwrap();
+        assert!(cx.get_value_cache(nid("ScaledTwice")).is_none());
+        assert!(
+            (scaled_twice.value(&mut device, &store, &mut cx).unwrap() - 120.0).abs()
+                < f64::EPSILON
+        );
+
+        // A value depending on a `NoCache` register is never cached.
+        assert!(
+            (from_volatile.value(&mut device, &store, &mut cx).unwrap() - 6.0).abs() < f64::EPSILON
+        );
+        assert!(cx.get_value_cache(nid("FromVolatile")).is_none());
+        device.memory[4] = 7;
+        assert!(
+            (from_volatile.value(&mut device, &store, &mut cx).unwrap() - 8.0).abs() < f64::EPSILON
+        );
+    }
+}
@@ -6,6 +6,7 @@ use tracing::debug;
 
 use crate::{
     builder::{CacheStoreBuilder, NodeStoreBuilder, ValueStoreBuilder},
+    utils::{CompiledFormula, FormulaInput},
     IntConverterNode,
 };
 
@@ -47,6 +48,21 @@ impl Parse for IntConverterNode {
             .parse_if(SLOPE, node_builder, value_builder, cache_builder)
             .unwrap_or_default();
 
+        let compiled_formula_to = CompiledFormula::compile(
+            &formula_to,
+            &p_variables,
+            &constants,
+            &expressions,
+            &[FormulaInput::Imm("FROM")],
+        );
+        let compiled_formula_from = CompiledFormula::compile(
+            &formula_from,
+            &p_variables,
+            &constants,
+            &expressions,
+            &[FormulaInput::Node("TO", p_value)],
+        );
+
         Self {
             attr_base,
             elem_base,
@@ -56,6 +72,8 @@ impl Parse for IntConverterNode {
             expressions,
             formula_to,
             formula_from,
+            compiled_formula_to,
+            compiled_formula_from,
             p_value,
             unit,
             representation,
@@ -6,6 +6,7 @@ use tracing::debug;
 
 use crate::{
     builder::{CacheStoreBuilder, NodeStoreBuilder, ValueStoreBuilder},
+    utils::CompiledFormula,
     IntSwissKnifeNode,
 };
 
@@ -42,6 +43,9 @@ impl Parse for IntSwissKnifeNode {
             .parse_if(REPRESENTATION, node_builder, value_builder, cache_builder)
             .unwrap_or_default();
 
+        let compiled_formula =
+            CompiledFormula::compile(&formula, &p_variables, &constants, &expressions, &[]);
+
         Self {
             attr_base,
             elem_base,
@@ -50,6 +54,7 @@ impl Parse for IntSwissKnifeNode {
             constants,
             expressions,
             formula,
+            compiled_formula,
             unit,
             representation,
         }
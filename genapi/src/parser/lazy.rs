@@ -0,0 +1,429 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! On-demand parsing of `GenApi` xml.
+//!
+//! [`LazyParser`] indexes byte ranges of node elements by their `Name` in a single linear scan
+//! of the xml without building a document tree. A node is parsed the first time it's loaded,
+//! together with all nodes it refers to, so features that are never used don't cost anything
+//! but the scan.
+
+use std::{collections::HashMap, ops::Range};
+
+use crate::{
+    builder::{CacheStoreBuilder, NodeStoreBuilder, ValueStoreBuilder},
+    store::NodeData,
+    RegisterDescription, ValueCtxt,
+};
+
+use super::{
+    elem_name::{GROUP, NAME, STRUCT_ENTRY, STRUCT_REG},
+    store_nodes, xml, ParseError, ParseResult,
+};
+
+/// Parser which parses nodes of `GenApi` xml on demand.
+///
+/// Nodes are loaded into stores which are also builders, e.g. [`DefaultNodeStore`],
+/// [`DefaultValueStore`] and [`DefaultCacheStore`], see [`GenApiBuilder::build_lazy`].
+///
+/// [`DefaultNodeStore`]: crate::store::DefaultNodeStore
+/// [`DefaultValueStore`]: crate::store::DefaultValueStore
+/// [`DefaultCacheStore`]: crate::store::DefaultCacheStore
+/// [`GenApiBuilder::build_lazy`]: crate::builder::GenApiBuilder::build_lazy
+#[derive(Debug, Clone)]
+pub struct LazyParser {
+    xml: String,
+    elements: Vec<Element>,
+    /// Map from a node name to the index of the element which defines the node.
+    index: HashMap<String, usize>,
+}
+
+#[derive(Debug, Clone)]
+struct Element {
+    span: Range<usize>,
+    is_loaded: bool,
+}
+
+impl LazyParser {
+    /// Indexes node elements of `xml` and parses `RegisterDescription`.
+    pub fn new(
+        xml: impl Into<String>,
+        node_builder: &mut impl NodeStoreBuilder,
+        value_builder: &mut impl ValueStoreBuilder,
+        cache_builder: &mut impl CacheStoreBuilder,
+    ) -> ParseResult<(Self, RegisterDescription)> {
+        let xml = xml.into();
+        let Indexer {
+            root,
+            elements,
+            index,
+            ..
+        } = Indexer::scan(&xml)?;
+
+        // Parse `RegisterDescription` from its start tag alone.
+        let root = root.ok_or(ParseError::InvalidStructure(0))?;
+        let mut root_src = xml[root.span].to_string();
+        if !root_src.ends_with("/>") {
+            root_src.push_str("</");
+            root_src.push_str(&root.tag_name);
+            root_src.push('>');
+        }
+        let document = xml::Document::from_str(&root_src)?;
+        let reg_desc = document
+            .root_node()
+            .parse(node_builder, value_builder, cache_builder);
+
+        Ok((
+            Self {
+                xml,
+                elements,
+                index,
+            },
+            reg_desc,
+        ))
+    }
+
+    /// Returns `true` if the xml defines a node named `name`.
+    #[must_use]
+    pub fn contains(&self, name: &str) -> bool {
+        self.index.contains_key(name)
+    }
+
+    /// Returns `true` if the node named `name` is already loaded.
+    #[must_use]
+    pub fn is_loaded(&self, name: &str) -> bool {
+        matches!(self.index.get(name), Some(idx) if self.elements[*idx].is_loaded)
+    }
+
+    /// Parses the node named `name` and all nodes it refers to transitively, and stores them.
+    /// Nodes which are already loaded are skipped.
+    ///
+    /// Returns `false` if the xml doesn't define a node named `name`.
+    pub fn load<U, S>(
+        &mut self,
+        name: &str,
+        node_builder: &mut impl NodeStoreBuilder,
+        cx: &mut ValueCtxt<U, S>,
+    ) -> ParseResult<bool>
+    where
+        U: ValueStoreBuilder,
+        S: CacheStoreBuilder,
+    {
+        let idx = match self.index.get(name) {
+            Some(idx) => *idx,
+            None => return Ok(false),
+        };
+        self.load_element(idx, node_builder, cx)?;
+        Ok(true)
+    }
+
+    /// Parses all nodes which are not loaded yet, and stores them.
+    pub fn load_all<U, S>(
+        &mut self,
+        node_builder: &mut impl NodeStoreBuilder,
+        cx: &mut ValueCtxt<U, S>,
+    ) -> ParseResult<()>
+    where
+        U: ValueStoreBuilder,
+        S: CacheStoreBuilder,
+    {
+        for idx in 0..self.elements.len() {
+            self.load_element(idx, node_builder, cx)?;
+        }
+        Ok(())
+    }
+
+    fn load_element<U, S>(
+        &mut self,
+        idx: usize,
+        node_builder: &mut impl NodeStoreBuilder,
+        cx: &mut ValueCtxt<U, S>,
+    ) -> ParseResult<()>
+    where
+        U: ValueStoreBuilder,
+        S: CacheStoreBuilder,
+    {
+        let mut stack = vec![idx];
+        while let Some(idx) = stack.pop() {
+            if self.elements[idx].is_loaded {
+                continue;
+            }
+            let span = self.elements[idx].span.clone();
+            let document = xml::Document::from_str(&self.xml[span])?;
+            self.elements[idx].is_loaded = true;
+
+            let index = &self.index;
+            stack.extend(
+                document
+                    .node_references()
+                    .filter_map(|name| index.get(name).copied()),
+            );
+            let nodes: Vec<NodeData> =
+                document
+                    .root_node()
+                    .parse(node_builder, &mut cx.value_store, &mut cx.cache_store);
+            store_nodes(nodes, node_builder, &mut cx.cache_store);
+        }
+
+        Ok(())
+    }
+}
+
+struct RootTag {
+    span: Range<usize>,
+    tag_name: String,
+}
+
+/// Element which is being scanned.
+struct Pending {
+    start: usize,
+    depth: usize,
+    names: Vec<String>,
+    is_struct_reg: bool,
+}
+
+#[derive(Default)]
+struct Indexer {
+    root: Option<RootTag>,
+    in_group: bool,
+    pending: Option<Pending>,
+    elements: Vec<Element>,
+    index: HashMap<String, usize>,
+}
+
+impl Indexer {
+    fn scan(xml: &str) -> ParseResult<Self> {
+        let mut indexer = Self::default();
+        let mut depth = 0_usize;
+        let mut pos = 0;
+
+        while let Some(offset) = xml[pos..].find('<') {
+            let start = pos + offset;
+            let rest = &xml[start..];
+            let skip_to = |close: &str| {
+                rest.find(close)
+                    .map(|end| start + end + close.len())
+                    .ok_or(ParseError::InvalidStructure(start))
+            };
+
+            if rest.starts_with("<!--") {
+                pos = skip_to("-->")?;
+            } else if rest.starts_with("<![CDATA[") {
+                pos = skip_to("]]>")?;
+            } else if rest.starts_with("<?") {
+                pos = skip_to("?>")?;
+            } else if rest.starts_with("<!") {
+                pos = skip_to(">")?;
+            } else if rest.starts_with("</") {
+                pos = skip_to(">")?;
+                depth = depth
+                    .checked_sub(1)
+                    .ok_or(ParseError::InvalidStructure(start))?;
+                indexer.close(depth, pos);
+            } else {
+                let end = tag_end(xml, start)?;
+                let tag = &xml[start + 1..end];
+                let is_empty = tag.ends_with('/');
+                let tag = tag.trim_end_matches('/');
+                let tag_name = tag
+                    .split(|c: char| c.is_ascii_whitespace())
+                    .next()
+                    .unwrap_or_default();
+                pos = end + 1;
+
+                indexer.open(depth, tag_name, attribute_of(tag, NAME), start..pos);
+                if is_empty {
+                    indexer.close(depth, pos);
+                } else {
+                    depth += 1;
+                }
+            }
+        }
+
+        if depth == 0 {
+            Ok(indexer)
+        } else {
+            Err(ParseError::InvalidStructure(xml.len()))
+        }
+    }
+
+    fn open(&mut self, depth: usize, tag_name: &str, name: Option<&str>, span: Range<usize>) {
+        if depth == 0 {
+            self.root = Some(RootTag {
+                span,
+                tag_name: tag_name.to_string(),
+            });
+            return;
+        }
+
+        match &mut self.pending {
+            // Entries of `StructReg` are stored as separate nodes.
+            Some(pending) => {
+                if pending.is_struct_reg && depth == pending.depth + 1 && tag_name == STRUCT_ENTRY {
+                    pending.names.extend(name.map(Into::into));
+                }
+            }
+            None if depth == 1 && tag_name == GROUP => self.in_group = true,
+            None if depth == 1 || (depth == 2 && self.in_group) => {
+                self.pending = Some(Pending {
+                    start: span.start,
+                    depth,
+                    names: name.map(Into::into).into_iter().collect(),
+                    is_struct_reg: tag_name == STRUCT_REG,
+                });
+            }
+            None => {}
+        }
+    }
+
+    fn close(&mut self, depth: usize, end: usize) {
+        match self.pending.take() {
+            Some(pending) if pending.depth == depth => {
+                let idx = self.elements.len();
+                self.elements.push(Element {
+                    span: pending.start..end,
+                    is_loaded: false,
+                });
+                for name in pending.names {
+                    self.index.insert(name, idx);
+                }
+            }
+            Some(pending) => self.pending = Some(pending),
+            None if depth == 1 => self.in_group = false,
+            None => {}
+        }
+    }
+}
+
+/// Returns the position of `>` which closes the tag starting at `start`.
+fn tag_end(xml: &str, start: usize) -> ParseResult<usize> {
+    let mut quote = None;
+    for (pos, b) in xml.bytes().enumerate().skip(start) {
+        match (quote, b) {
+            (None, b'"' | b'\'') => quote = Some(b),
+            (Some(q), _) if q == b => quote = None,
+            (None, b'>') => return Ok(pos),
+            _ => {}
+        }
+    }
+    Err(ParseError::InvalidStructure(start))
+}
+
+/// Returns the raw value of the attribute `key` in `tag`, which is the content of a start tag.
+fn attribute_of<'a>(tag: &'a str, key: &str) -> Option<&'a str> {
+    let mut rest = tag.split_once(|c: char| c.is_ascii_whitespace())?.1;
+    loop {
+        let (attr, value) = rest.split_once('=')?;
+        let value = value.trim_start();
+        let quote = value.chars().next()?;
+        let value = &value[1..];
+        let end = value.find(quote)?;
+        if attr.trim() == key {
+            return Some(&value[..end]);
+        }
+        rest = &value[end + 1..];
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::{
+        builder::GenApiBuilder,
+        interface::IInteger,
+        store::{DefaultNodeStore, NodeStore},
+        testing::{register_description, TestDevice},
+    };
+
+    #[test]
+    fn test_lazy_parser() {
+        let xml = register_description(
+            r#"
+
+            <!-- <Integer Name="Commented"> -->
+            <Category Name="Root">
+                <ToolTip><![CDATA[<Integer Name="InCData">]]></ToolTip>
+                <pFeature>Width</pFeature>
+            </Category>
+
+            <Integer Name="Width">
+                <pValue>WidthReg</pValue>
+                <pMax>MaxWidth</pMax>
+            </Integer>
+
+            <Group Comment="Registers">
+                <IntReg Name="WidthReg">
+                  <Address>0x0</Address>
+                  <Length>4</Length>
+                  <AccessMode>RW</AccessMode>
+                  <pPort>Device</pPort>
+                  <Endianess>LittleEndian</Endianess>
+                </IntReg>
+            </Group>
+
+            <Integer Name="MaxWidth">
+                <Value>100</Value>
+            </Integer>
+
+            <StructReg Comment="Flags">
+                <Address>0x4</Address>
+                <Length>4</Length>
+                <pPort>Device</pPort>
+                <Endianess>LittleEndian</Endianess>
+                <StructEntry Name="Flag0">
+                    <Bit>0</Bit>
+                </StructEntry>
+                <StructEntry Name="Flag1">
+                    <Bit>1</Bit>
+                </StructEntry>
+            </StructReg>
+
+            <Port Name="Device"/>
+
+            <ConfRom Name="Unsupported">
+                <Unit>0</Unit>
+            </ConfRom>
+
+        "#,
+        );
+        // The indexer skips the xml declaration.
+        let xml = format!(r#"<?xml version="1.0" encoding="utf-8"?>{}"#, xml);
+
+        let (reg_desc, mut parser, mut store, mut cx) =
+            GenApiBuilder::<DefaultNodeStore>::default()
+                .build_lazy(xml)
+                .unwrap();
+        assert_eq!(reg_desc.model_name(), "CameleonModel");
+        for name in &["Root", "Width", "WidthReg", "MaxWidth", "Flag0", "Flag1"] {
+            assert!(parser.contains(name));
+        }
+        assert!(!parser.contains("Commented"));
+        assert!(!parser.contains("InCData"));
+
+        // Loading `Width` also loads nodes it refers to, but not others.
+        assert!(parser.load("Width", &mut store, &mut cx).unwrap());
+        for name in &["Width", "WidthReg", "MaxWidth", "Device"] {
+            assert!(parser.is_loaded(name));
+        }
+        assert!(!parser.is_loaded("Root"));
+        assert!(!parser.is_loaded("Unsupported"));
+
+        let mut device = TestDevice::new(vec![0; 8]);
+        let width = store
+            .id_by_name("Width")
+            .unwrap()
+            .as_iinteger_kind(&store)
+            .unwrap();
+        width.set_value(64, &mut device, &store, &mut cx).unwrap();
+        assert_eq!(width.value(&mut device, &store, &mut cx).unwrap(), 64);
+        assert_eq!(width.max(&mut device, &store, &mut cx).unwrap(), 100);
+
+        // All entries of `StructReg` are loaded at once.
+        assert!(parser.load("Flag1", &mut store, &mut cx).unwrap());
+        assert!(parser.is_loaded("Flag0"));
+        let flag0 = store.id_by_name("Flag0").unwrap();
+        assert!(flag0.as_iinteger_kind(&store).is_some());
+
+        assert!(!parser.load("Missing", &mut store, &mut cx).unwrap());
+    }
+}
@@ -6,6 +6,7 @@ mod boolean;
 mod category;
 mod command;
 mod converter;
+mod dependency;
 mod elem_name;
 mod elem_type;
 mod enumeration;
@@ -17,6 +18,7 @@ mod int_converter;
 mod int_reg;
 mod int_swiss_knife;
 mod integer;
+mod lazy;
 mod masked_int_reg;
 mod node;
 mod node_base;
@@ -31,6 +33,10 @@ mod swiss_knife;
 mod utils;
 mod xml;
 
+pub use lazy::LazyParser;
+
+pub(crate) use dependency::visit_dependencies;
+
 use group::GroupNode;
 use struct_reg::StructRegNode;
 use thiserror::Error;
@@ -54,6 +60,9 @@ pub enum ParseError {
 
     #[error("invalid XML syntax: {0}")]
     InvalidSyntax(#[from] roxmltree::Error),
+
+    #[error("invalid XML structure at byte {0}")]
+    InvalidStructure(usize),
 }
 
 pub type ParseResult<T> = std::result::Result<T, ParseError>;
@@ -69,15 +78,24 @@ pub fn parse(
     let reg_desc = node.parse(node_builder, value_builder, cache_builder);
     while let Some(ref mut child) = node.next() {
         let children: Vec<NodeData> = child.parse(node_builder, value_builder, cache_builder);
-        for child in children {
-            let id = child.node_base().id();
-            node_builder.store_node(id, child);
-        }
+        store_nodes(children, node_builder, cache_builder);
     }
 
     Ok(reg_desc)
 }
 
+fn store_nodes(
+    nodes: Vec<NodeData>,
+    node_builder: &mut impl NodeStoreBuilder,
+    cache_builder: &mut impl CacheStoreBuilder,
+) {
+    for node in nodes {
+        dependency::store_dependencies(&node, cache_builder);
+        let id = node.node_base().id();
+        node_builder.store_node(id, node);
+    }
+}
+
 trait Parse {
     fn parse(
         node: &mut xml::Node,
@@ -6,6 +6,7 @@ use tracing::debug;
 
 use crate::{
     builder::{CacheStoreBuilder, NodeStoreBuilder, ValueStoreBuilder},
+    utils::CompiledFormula,
     SwissKnifeNode,
 };
 
@@ -54,6 +55,9 @@ impl Parse for SwissKnifeNode {
             )
             .unwrap_or(6);
 
+        let compiled_formula =
+            CompiledFormula::compile(&formula, &p_variables, &constants, &expressions, &[]);
+
         Self {
             attr_base,
             elem_base,
@@ -62,6 +66,7 @@ impl Parse for SwissKnifeNode {
             constants,
             expressions,
             formula,
+            compiled_formula,
             unit,
             representation,
             display_notation,
@@ -108,5 +113,7 @@ mod tests {
         let expressions = node.expressions();
         assert_eq!(expressions.len(), 1);
         assert_eq!(expressions[0].name(), "ConstBy2");
+
+        assert!(node.compiled_formula.is_some());
     }
 }
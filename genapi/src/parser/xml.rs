@@ -26,6 +26,21 @@ impl<'input> Document<'input> {
     pub(super) fn inner_str(&self) -> &'input str {
         self.document.input_text()
     }
+
+    /// Returns names of nodes referred to by `pXXX` elements in the document.
+    pub(super) fn node_references(&self) -> impl Iterator<Item = &str> {
+        self.document.descendants().filter_map(|node| {
+            let mut chars = node.tag_name().name().chars();
+            let is_reference = node.is_element()
+                && chars.next() == Some('p')
+                && matches!(chars.next(), Some(c) if c.is_ascii_uppercase());
+            if is_reference {
+                node.text().map(str::trim)
+            } else {
+                None
+            }
+        })
+    }
 }
 
 pub(super) struct Node<'a, 'input> {
@@ -2,9 +2,12 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 
+use std::convert::TryFrom;
+
 use super::{
     elem_type::ImmOrPNode,
     interface::{INode, IPort},
+    ivalue::IValue,
     node_base::{NodeAttributeBase, NodeBase, NodeElementBase},
     store::{CacheStore, NodeStore, ValueStore},
     Device, GenApiError, GenApiResult, ValueCtxt,
@@ -37,6 +40,47 @@ impl PortNode {
     }
 }
 
+impl PortNode {
+    fn read_chunk(
+        &self,
+        chunk_id: u64,
+        address: i64,
+        buf: &mut [u8],
+        device: &impl Device,
+    ) -> GenApiResult<()> {
+        let data = device
+            .chunk_data(chunk_id)
+            .ok_or_else(GenApiError::chunk_data_missing)?;
+        let start = usize::try_from(address)
+            .map_err(|_| GenApiError::invalid_data("negative address of chunk data".into()))?;
+        if data.len() < start + buf.len() {
+            return Err(GenApiError::invalid_data(
+                format!(
+                    "range {}..{} is out of chunk data of length {}",
+                    start,
+                    start + buf.len(),
+                    data.len()
+                )
+                .into(),
+            ));
+        }
+
+        if self.swap_endianness {
+            // Bytes are swapped in each 4 bytes word.
+            for (i, b) in buf.iter_mut().enumerate() {
+                let pos = start + i;
+                *b = data
+                    .get((pos & !0x3) + 3 - (pos & 0x3))
+                    .copied()
+                    .unwrap_or(0);
+            }
+        } else {
+            buf.copy_from_slice(&data[start..start + buf.len()]);
+        }
+        Ok(())
+    }
+}
+
 impl INode for PortNode {
     fn node_base(&self) -> NodeBase {
         NodeBase::new(&self.attr_base, &self.elem_base)
@@ -48,7 +92,7 @@ impl INode for PortNode {
 }
 
 impl IPort for PortNode {
-    #[tracing::instrument(skip(self, device, store),
+    #[tracing::instrument(skip(self, device, store, cx),
                           level = "trace",
                           fields(node = store.name_by_id(self.node_base().id()).unwrap()))]
     fn read<T: ValueStore, U: CacheStore>(
@@ -57,10 +101,17 @@ impl IPort for PortNode {
         buf: &mut [u8],
         device: &mut impl Device,
         store: &impl NodeStore,
-        _: &mut ValueCtxt<T, U>,
+        cx: &mut ValueCtxt<T, U>,
     ) -> GenApiResult<()> {
-        if self.chunk_id.is_some() {
-            Err(GenApiError::chunk_data_missing())
+        if let Some(chunk_id) = &self.chunk_id {
+            let chunk_id = match chunk_id {
+                ImmOrPNode::Imm(id) => *id,
+                ImmOrPNode::PNode(nid) => {
+                    let id: i64 = nid.value(device, store, cx)?;
+                    id as u64
+                }
+            };
+            self.read_chunk(chunk_id, address, buf, device)
         } else {
             device.read_mem(address, buf).map_err(GenApiError::device)
         }
@@ -80,8 +131,7 @@ impl IPort for PortNode {
         cx.invalidate_cache_by(self.node_base().id());
 
         if self.chunk_id.is_some() {
-            // TODO: Implement chunk parser.
-            todo!()
+            Err(GenApiError::not_writable())
         } else {
             device.write_mem(address, buf).map_err(GenApiError::device)
         }
@@ -2,24 +2,37 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 
-use std::{collections::HashMap, convert::TryFrom};
+use std::{
+    collections::{HashMap, HashSet},
+    convert::TryFrom,
+    sync::Arc,
+};
 
 use auto_impl::auto_impl;
 use string_interner::{DefaultBackend, StringInterner, Symbol};
 
 use super::{
     builder,
+    codec::{Codec, DecodeResult, Decoder, Encoder},
+    formula::EvaluationResult,
     interface::{
         IBooleanKind, ICategoryKind, ICommandKind, IEnumerationKind, IFloatKind, IIntegerKind,
         INode, INodeKind, IPortKind, IRegisterKind, ISelectorKind, IStringKind,
     },
     node_base::NodeBase,
+    register_base::RegisterBase,
     BooleanNode, CategoryNode, CommandNode, ConverterNode, EnumEntryNode, EnumerationNode,
     FloatNode, FloatRegNode, GenApiError, GenApiResult, IntConverterNode, IntRegNode,
     IntSwissKnifeNode, IntegerNode, MaskedIntRegNode, Node, PortNode, RegisterNode, StringNode,
     StringRegNode, SwissKnifeNode,
 };
 
+mod lazy;
+
+pub use lazy::{LazyCacheStore, LazyNodeStore, LazyValueStore};
+
+pub(crate) use lazy::build as build_lazy;
+
 #[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 pub struct NodeId(u32);
 
@@ -127,6 +140,19 @@ pub trait CacheStore {
 
     fn get_cache(&self, nid: NodeId, address: i64, length: i64) -> Option<&[u8]>;
 
+    /// Cache `value` computed by `nid` from the values of other nodes, e.g. `SwissKnife`.
+    ///
+    /// The default implementation doesn't cache the value.
+    fn cache_value(&mut self, nid: NodeId, value: EvaluationResult) {
+        let _ = (nid, value);
+    }
+
+    /// The default implementation always returns `None`.
+    fn get_value_cache(&self, nid: NodeId) -> Option<EvaluationResult> {
+        let _ = nid;
+        None
+    }
+
     fn invalidate_by(&mut self, nid: NodeId);
 
     fn invalidate_of(&mut self, nid: NodeId);
@@ -278,6 +304,57 @@ impl NodeId {
 }
 
 impl NodeData {
+    /// Returns the index of the variant, which groups nodes of the same kind.
+    fn kind_index(&self) -> u8 {
+        match self {
+            Self::Node(_) => 0,
+            Self::Category(_) => 1,
+            Self::Integer(_) => 2,
+            Self::IntReg(_) => 3,
+            Self::MaskedIntReg(_) => 4,
+            Self::Boolean(_) => 5,
+            Self::Command(_) => 6,
+            Self::Enumeration(_) => 7,
+            Self::EnumEntry(_) => 8,
+            Self::Float(_) => 9,
+            Self::FloatReg(_) => 10,
+            Self::String(_) => 11,
+            Self::StringReg(_) => 12,
+            Self::Register(_) => 13,
+            Self::Converter(_) => 14,
+            Self::IntConverter(_) => 15,
+            Self::SwissKnife(_) => 16,
+            Self::IntSwissKnife(_) => 17,
+            Self::Port(_) => 18,
+            Self::ConfRom(_) => 19,
+            Self::TextDesc(_) => 20,
+            Self::IntKey(_) => 21,
+            Self::AdvFeatureLock(_) => 22,
+            Self::SmartFeature(_) => 23,
+        }
+    }
+
+    /// Returns [`RegisterBase`] if the node is a register.
+    pub(crate) fn register_base(&self) -> Option<&RegisterBase> {
+        match self {
+            Self::IntReg(node) => Some(&node.register_base),
+            Self::MaskedIntReg(node) => Some(&node.register_base),
+            Self::FloatReg(node) => Some(&node.register_base),
+            Self::StringReg(node) => Some(&node.register_base),
+            Self::Register(node) => Some(&node.register_base),
+            _ => None,
+        }
+    }
+
+    /// Returns the interval in milliseconds at which the node should be polled, if declared.
+    pub(crate) fn polling_time(&self) -> Option<u64> {
+        match self {
+            Self::Command(node) => node.polling_time,
+            Self::Enumeration(node) => node.polling_time,
+            _ => self.register_base()?.polling_time,
+        }
+    }
+
     #[allow(clippy::missing_panics_doc)]
     #[must_use]
     pub fn node_base(&self) -> NodeBase<'_> {
@@ -290,6 +367,7 @@ impl NodeData {
             Self::Boolean(node) => node.node_base(),
             Self::Command(node) => node.node_base(),
             Self::Enumeration(node) => node.node_base(),
+            Self::EnumEntry(node) => node.node_base(),
             Self::Float(node) => node.node_base(),
             Self::FloatReg(node) => node.node_base(),
             Self::String(node) => node.node_base(),
@@ -386,6 +464,206 @@ impl Default for DefaultNodeStore {
     }
 }
 
+impl Codec for NodeId {
+    fn encode(&self, enc: &mut Encoder) {
+        self.0.encode(enc);
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        Ok(Self(Codec::decode(dec)?))
+    }
+}
+
+impl Codec for DefaultNodeStore {
+    fn encode(&self, enc: &mut Encoder) {
+        // Names are encoded in the order of their ids, so that interning them again restores the
+        // same ids.
+        self.interner.len().encode(enc);
+        for (_, name) in self.interner.iter() {
+            enc.write_str(name);
+        }
+        self.store.encode(enc);
+        self.fresh_id.encode(enc);
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        let len = usize::decode(dec)?;
+        let mut interner = StringInterner::<DefaultBackend<NodeId>>::new();
+        for i in 0..len {
+            let name = String::decode(dec)?;
+            if interner.get_or_intern(name).to_usize() != i {
+                return Decoder::invalid("duplicated node name");
+            }
+        }
+        Ok(Self {
+            interner,
+            store: Codec::decode(dec)?,
+            fresh_id: Codec::decode(dec)?,
+        })
+    }
+}
+
+/// [`NodeStore`] which packs nodes and names into a few contiguous tables.
+///
+/// [`DefaultNodeStore`] keeps a slot for every interned name, including names that are only
+/// referenced and never defined, and resolves names through a hash table. `ArenaNodeStore`
+/// instead keeps only defined nodes in a dense table grouped by node kind, and all names in a
+/// single buffer looked up by binary search. This reduces the memory held by each context when
+/// many devices are opened at once.
+///
+/// Use [`ArenaNodeStoreBuilder`] to build the store.
+#[derive(Debug, Clone)]
+pub struct ArenaNodeStore {
+    /// Dense table of nodes grouped by node kind.
+    nodes: Vec<NodeData>,
+    /// Index into `nodes` for each `NodeId`, or `u32::MAX` if the node isn't defined.
+    slots: Vec<u32>,
+    /// Concatenation of all node names.
+    names: String,
+    /// End offset of the name in `names` for each `NodeId`.
+    name_ends: Vec<u32>,
+    /// `NodeId`s sorted by their names.
+    sorted_ids: Vec<NodeId>,
+}
+
+impl ArenaNodeStore {
+    const EMPTY_SLOT: u32 = u32::MAX;
+
+    /// Returns the number of defined nodes.
+    #[must_use]
+    pub fn len(&self) -> usize {
+        self.nodes.len()
+    }
+
+    /// Returns `true` if no node is defined.
+    #[must_use]
+    pub fn is_empty(&self) -> bool {
+        self.nodes.is_empty()
+    }
+
+    fn name_range(&self, nid: NodeId) -> Option<std::ops::Range<usize>> {
+        let idx = nid.to_usize();
+        let end = *self.name_ends.get(idx)? as usize;
+        let start = if idx == 0 {
+            0
+        } else {
+            self.name_ends[idx - 1] as usize
+        };
+        Some(start..end)
+    }
+}
+
+impl NodeStore for ArenaNodeStore {
+    fn name_by_id(&self, nid: NodeId) -> Option<&str> {
+        self.name_range(nid).map(|range| &self.names[range])
+    }
+
+    fn id_by_name<T>(&self, s: T) -> Option<NodeId>
+    where
+        T: AsRef<str>,
+    {
+        let s = s.as_ref();
+        let idx = self
+            .sorted_ids
+            .binary_search_by(|nid| self.name_by_id(*nid).unwrap().cmp(s))
+            .ok()?;
+        Some(self.sorted_ids[idx])
+    }
+
+    fn node_opt(&self, nid: NodeId) -> Option<&NodeData> {
+        match *self.slots.get(nid.to_usize())? {
+            Self::EMPTY_SLOT => None,
+            slot => Some(&self.nodes[slot as usize]),
+        }
+    }
+
+    fn visit_nodes<F>(&self, f: F)
+    where
+        F: FnMut(&NodeData),
+    {
+        self.nodes.iter().for_each(f);
+    }
+}
+
+/// Builder of [`ArenaNodeStore`].
+///
+/// Names and nodes are collected while parsing and packed into [`ArenaNodeStore`] by
+/// [`NodeStoreBuilder::build`](builder::NodeStoreBuilder::build).
+#[derive(Debug, Default)]
+pub struct ArenaNodeStoreBuilder {
+    interner: StringInterner<DefaultBackend<NodeId>>,
+    nodes: Vec<(NodeId, NodeData)>,
+    fresh_id: u32,
+}
+
+impl ArenaNodeStoreBuilder {
+    #[must_use]
+    pub fn new() -> Self {
+        Self::default()
+    }
+}
+
+impl builder::NodeStoreBuilder for ArenaNodeStoreBuilder {
+    type Store = ArenaNodeStore;
+
+    fn build(mut self) -> ArenaNodeStore {
+        let id_count = self.interner.len();
+        let mut names = String::new();
+        let mut name_ends = Vec::with_capacity(id_count);
+        for idx in 0..id_count {
+            let nid = NodeId::try_from_usize(idx).unwrap();
+            names.push_str(self.interner.resolve(nid).unwrap());
+            let end = u32::try_from(names.len())
+                .expect("the total length of node names must not exceed u32::MAX");
+            name_ends.push(end);
+        }
+        names.shrink_to_fit();
+
+        // Stable sort keeps nodes of the same kind in the order of their definition.
+        self.nodes.sort_by_key(|(_, data)| data.kind_index());
+        let mut slots = vec![ArenaNodeStore::EMPTY_SLOT; id_count];
+        let mut nodes = Vec::with_capacity(self.nodes.len());
+        for (slot, (nid, data)) in self.nodes.into_iter().enumerate() {
+            debug_assert_eq!(slots[nid.to_usize()], ArenaNodeStore::EMPTY_SLOT);
+            #[allow(clippy::cast_possible_truncation)]
+            let slot = slot as u32;
+            slots[nid.to_usize()] = slot;
+            nodes.push(data);
+        }
+
+        let mut store = ArenaNodeStore {
+            nodes,
+            slots,
+            names,
+            name_ends,
+            sorted_ids: Vec::new(),
+        };
+        let mut sorted_ids: Vec<_> = (0..id_count)
+            .map(|idx| NodeId::try_from_usize(idx).unwrap())
+            .collect();
+        sorted_ids.sort_unstable_by(|a, b| store.name_by_id(*a).cmp(&store.name_by_id(*b)));
+        store.sorted_ids = sorted_ids;
+        store
+    }
+
+    fn get_or_intern<T>(&mut self, s: T) -> NodeId
+    where
+        T: AsRef<str>,
+    {
+        self.interner.get_or_intern(s)
+    }
+
+    fn store_node(&mut self, nid: NodeId, data: NodeData) {
+        self.nodes.push((nid, data));
+    }
+
+    fn fresh_id(&mut self) -> u32 {
+        let id = self.fresh_id;
+        self.fresh_id += 1;
+        id
+    }
+}
+
 #[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 pub struct ValueId(u32);
 
@@ -412,6 +690,16 @@ macro_rules! declare_value_id {
                 Self(vid.0)
             }
         }
+
+        impl Codec for $name {
+            fn encode(&self, enc: &mut Encoder) {
+                self.0.encode(enc);
+            }
+
+            fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+                Ok(Self(Codec::decode(dec)?))
+            }
+        }
     };
 }
 declare_value_id!(IntegerId);
@@ -440,7 +728,7 @@ impl_value_data_conversion!(f64, Self::Float);
 impl_value_data_conversion!(String, Self::Str);
 impl_value_data_conversion!(bool, Self::Boolean);
 
-#[derive(Debug, Default)]
+#[derive(Debug, Default, Clone)]
 pub struct DefaultValueStore(Vec<ValueData>);
 
 impl DefaultValueStore {
@@ -450,6 +738,16 @@ impl DefaultValueStore {
     }
 }
 
+impl Codec for DefaultValueStore {
+    fn encode(&self, enc: &mut Encoder) {
+        self.0.encode(enc);
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        Ok(Self(Codec::decode(dec)?))
+    }
+}
+
 impl builder::ValueStoreBuilder for DefaultValueStore {
     type Store = Self;
 
@@ -489,10 +787,25 @@ impl ValueStore for DefaultValueStore {
     }
 }
 
-#[derive(Debug, Default)]
+/// Cache of register data and values of nodes computed from other nodes.
+///
+/// Dependencies between nodes are stored while parsing. Writing a node invalidates the cached
+/// values of its transitive dependents, and values depending on a volatile node are never cached.
+///
+/// The dependencies are shared between clones of the store, so cloning only copies the caches.
+#[derive(Debug, Default, Clone)]
 pub struct DefaultCacheStore {
     store: HashMap<NodeId, HashMap<(i64, i64), Vec<u8>>>,
+    values: HashMap<NodeId, EvaluationResult>,
+    deps: Arc<Dependencies>,
+}
+
+#[derive(Debug, Default, Clone)]
+struct Dependencies {
     invalidators: HashMap<NodeId, Vec<NodeId>>,
+    /// Map from a node to the nodes which depend on it.
+    dependents: HashMap<NodeId, Vec<NodeId>>,
+    volatile: HashSet<NodeId>,
 }
 
 impl DefaultCacheStore {
@@ -502,6 +815,27 @@ impl DefaultCacheStore {
     }
 }
 
+/// Only the dependencies between nodes are encoded, caches are empty when decoded.
+impl Codec for DefaultCacheStore {
+    fn encode(&self, enc: &mut Encoder) {
+        self.deps.invalidators.encode(enc);
+        self.deps.dependents.encode(enc);
+        self.deps.volatile.encode(enc);
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        let deps = Dependencies {
+            invalidators: Codec::decode(dec)?,
+            dependents: Codec::decode(dec)?,
+            volatile: Codec::decode(dec)?,
+        };
+        Ok(Self {
+            deps: Arc::new(deps),
+            ..Self::default()
+        })
+    }
+}
+
 impl builder::CacheStoreBuilder for DefaultCacheStore {
     type Store = Self;
 
@@ -510,9 +844,35 @@ impl builder::CacheStoreBuilder for DefaultCacheStore {
     }
 
     fn store_invalidator(&mut self, invalidator: NodeId, target: NodeId) {
-        let entry = self.invalidators.entry(invalidator).or_default();
+        let deps = Arc::make_mut(&mut self.deps);
+        let entry = deps.invalidators.entry(invalidator).or_default();
         entry.push(target)
     }
+
+    fn store_dependency(&mut self, dependent: NodeId, dependency: NodeId) {
+        let deps = Arc::make_mut(&mut self.deps);
+        let entry = deps.dependents.entry(dependency).or_default();
+        entry.push(dependent);
+        if deps.volatile.contains(&dependency) {
+            self.store_volatile(dependent);
+        }
+    }
+
+    /// Volatility is propagated to all transitive dependents as soon as it's stored, so that
+    /// nodes stored after `build`, e.g. by [`LazyParser`](crate::parser::LazyParser), are also
+    /// handled.
+    fn store_volatile(&mut self, nid: NodeId) {
+        let deps = Arc::make_mut(&mut self.deps);
+        let mut stack = vec![nid];
+        while let Some(nid) = stack.pop() {
+            if deps.volatile.insert(nid) {
+                self.values.remove(&nid);
+                if let Some(dependents) = deps.dependents.get(&nid) {
+                    stack.extend(dependents.iter().copied());
+                }
+            }
+        }
+    }
 }
 
 impl CacheStore for DefaultCacheStore {
@@ -536,12 +896,24 @@ impl CacheStore for DefaultCacheStore {
         Some(self.store.get(&nid)?.get(&(address, length))?.as_ref())
     }
 
+    fn cache_value(&mut self, nid: NodeId, value: EvaluationResult) {
+        if !self.deps.volatile.contains(&nid) {
+            self.values.insert(nid, value);
+        }
+    }
+
+    fn get_value_cache(&self, nid: NodeId) -> Option<EvaluationResult> {
+        self.values.get(&nid).copied()
+    }
+
     fn invalidate_by(&mut self, nid: NodeId) {
-        if let Some(target_nodes) = self.invalidators.get(&nid) {
+        invalidate_dependents(&mut self.values, &self.deps.dependents, nid);
+        if let Some(target_nodes) = self.deps.invalidators.get(&nid) {
             for nid in target_nodes {
                 if let Some(cache) = self.store.get_mut(nid) {
                     *cache = HashMap::new();
                 }
+                invalidate_dependents(&mut self.values, &self.deps.dependents, *nid);
             }
         }
     }
@@ -550,10 +922,34 @@ impl CacheStore for DefaultCacheStore {
         if let Some(cache) = self.store.get_mut(&nid) {
             *cache = HashMap::new();
         }
+        invalidate_dependents(&mut self.values, &self.deps.dependents, nid);
     }
 
     fn clear(&mut self) {
-        self.store.clear()
+        self.store.clear();
+        self.values.clear();
+    }
+}
+
+/// Removes cached values of `nid` and its transitive dependents.
+fn invalidate_dependents(
+    values: &mut HashMap<NodeId, EvaluationResult>,
+    dependents: &HashMap<NodeId, Vec<NodeId>>,
+    nid: NodeId,
+) {
+    if values.is_empty() {
+        return;
+    }
+
+    let mut visited = HashSet::new();
+    let mut stack = vec![nid];
+    while let Some(nid) = stack.pop() {
+        if visited.insert(nid) {
+            values.remove(&nid);
+            if let Some(dependents) = dependents.get(&nid) {
+                stack.extend(dependents);
+            }
+        }
     }
 }
 
@@ -593,3 +989,120 @@ impl CacheStore for CacheSink {
 
     fn clear(&mut self) {}
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{builder::GenApiBuilder, testing::register_description};
+
+    #[test]
+    fn test_arena_node_store() {
+        let xml = register_description(
+            r#"
+
+            <Category Name="Root">
+                <pFeature>Width</pFeature>
+                <pFeature>PixelFormat</pFeature>
+            </Category>
+
+            <Integer Name="Width">
+                <pValue>WidthReg</pValue>
+            </Integer>
+
+            <IntReg Name="WidthReg">
+              <Address>0x0</Address>
+              <Length>4</Length>
+              <AccessMode>RW</AccessMode>
+              <pPort>Device</pPort>
+              <Endianess>LittleEndian</Endianess>
+            </IntReg>
+
+            <Enumeration Name="PixelFormat">
+                <EnumEntry Name="Mono8">
+                    <Value>1</Value>
+                </EnumEntry>
+                <EnumEntry Name="RGB8">
+                    <Value>2</Value>
+                </EnumEntry>
+                <Value>1</Value>
+            </Enumeration>
+
+            <Port Name="Device">
+            </Port>
+
+        "#,
+        );
+
+        let (_, default_store, _) = GenApiBuilder::<DefaultNodeStore>::default()
+            .build(&xml)
+            .unwrap();
+        let (_, arena_store, _) = GenApiBuilder::<DefaultNodeStore>::default()
+            .with_node_store(ArenaNodeStoreBuilder::new())
+            .build(&xml)
+            .unwrap();
+
+        let mut ids = vec![];
+        default_store.visit_nodes(|data| ids.push(data.node_base().id()));
+        let mut arena_count = 0;
+        arena_store.visit_nodes(|_| arena_count += 1);
+        assert_eq!(ids.len(), arena_count);
+        assert_eq!(arena_store.len(), arena_count);
+
+        for nid in ids {
+            let name = default_store.name_by_id(nid).unwrap();
+            assert_eq!(arena_store.name_by_id(nid), Some(name));
+            assert_eq!(arena_store.id_by_name(name), Some(nid));
+            assert_eq!(
+                arena_store.node(nid).node_base().id(),
+                default_store.node(nid).node_base().id()
+            );
+        }
+
+        let pixel_format = arena_store.id_by_name("PixelFormat").unwrap();
+        assert!(pixel_format.as_ienumeration_kind(&arena_store).is_some());
+        assert!(arena_store
+            .id_by_name("Width")
+            .unwrap()
+            .as_iinteger_kind(&arena_store)
+            .is_some());
+        assert!(arena_store.id_by_name("Missing").is_none());
+    }
+
+    #[test]
+    fn test_cache_store_clone() {
+        let (_, node_store, value_ctxt) = GenApiBuilder::<DefaultNodeStore>::default()
+            .build(&register_description(
+                r#"
+            <Integer Name="Width">
+                <pValue>WidthReg</pValue>
+            </Integer>
+
+            <IntReg Name="WidthReg">
+              <Address>0x0</Address>
+              <Length>4</Length>
+              <AccessMode>RW</AccessMode>
+              <pPort>Device</pPort>
+              <Endianess>LittleEndian</Endianess>
+            </IntReg>
+
+            <Port Name="Device">
+            </Port>
+        "#,
+            ))
+            .unwrap();
+        let width = node_store.id_by_name("Width").unwrap();
+        let width_reg = node_store.id_by_name("WidthReg").unwrap();
+
+        let cache_store = value_ctxt.cache_store;
+        let mut clone = cache_store.clone();
+        assert!(Arc::ptr_eq(&clone.deps, &cache_store.deps));
+        clone.cache_value(width, EvaluationResult::Integer(1));
+        assert!(cache_store.get_value_cache(width).is_none());
+
+        // Dependencies stored after cloning are copied on write.
+        builder::CacheStoreBuilder::store_volatile(&mut clone, width_reg);
+        assert!(!Arc::ptr_eq(&clone.deps, &cache_store.deps));
+        assert!(clone.deps.volatile.contains(&width));
+        assert!(!cache_store.deps.volatile.contains(&width));
+    }
+}
@@ -0,0 +1,648 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! Stores which parse nodes of `GenApi` xml on demand.
+//!
+//! [`LazyNodeStore`] resolves a node the first time it's looked up by [`LazyParser`], so that
+//! nodes can be loaded through `&self` as [`NodeStore`] requires. Loaded nodes and the initial
+//! values they store are kept in append-only slots which are never moved, thus references to them
+//! stay valid while other nodes are being loaded.
+
+use std::{
+    collections::HashSet,
+    fmt,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc, Mutex, OnceLock,
+    },
+};
+
+use string_interner::{DefaultBackend, StringInterner, Symbol};
+use tracing::debug;
+
+use crate::{
+    builder::{CacheStoreBuilder, NodeStoreBuilder, ValueStoreBuilder},
+    formula::EvaluationResult,
+    parser::{LazyParser, ParseResult},
+    RegisterDescription, ValueCtxt,
+};
+
+use super::{
+    CacheStore, DefaultCacheStore, NodeData, NodeId, NodeStore, ValueData, ValueId, ValueStore,
+};
+
+/// Builds stores which load nodes from `xml` on demand.
+pub(crate) fn build<S>(
+    xml: String,
+    cache_store: S,
+) -> ParseResult<(
+    RegisterDescription,
+    LazyNodeStore,
+    ValueCtxt<LazyValueStore, LazyCacheStore<S>>,
+)> {
+    let slots = Slots::default();
+    let mut interner = StringInterner::new();
+    let mut fresh_id = 0;
+    let mut value_count = 0;
+    let (parser, reg_desc) = LazyParser::new(
+        xml,
+        &mut NodeStaging {
+            interner: &mut interner,
+            names: &slots.names,
+            nodes: &slots.nodes,
+            fresh_id: &mut fresh_id,
+        },
+        &mut ValueStaging {
+            values: &slots.values,
+            count: &mut value_count,
+        },
+        &mut CacheStaging(&mut slots.cache_ops.lock().unwrap()),
+    )?;
+    slots.sync_cache_op_count();
+
+    let shared = Arc::new(Shared {
+        loader: Mutex::new(Loader {
+            parser,
+            interner,
+            fresh_id,
+            value_count,
+            is_fully_loaded: false,
+            absent: HashSet::new(),
+        }),
+        slots,
+    });
+    let value_ctxt = ValueCtxt::new(
+        LazyValueStore {
+            shared: shared.clone(),
+            updated: Vec::new(),
+        },
+        LazyCacheStore {
+            inner: cache_store,
+            shared: shared.clone(),
+            applied: 0,
+        },
+    );
+    Ok((reg_desc, LazyNodeStore { shared }, value_ctxt))
+}
+
+/// [`NodeStore`] which parses a node the first time it's looked up.
+///
+/// [`NodeStore::id_by_name`] and [`NodeStore::node_opt`] load the node together with all nodes
+/// it refers to, and [`NodeStore::visit_nodes`] loads all nodes which are not loaded yet. Values
+/// and dependencies of loaded nodes are shared with the [`LazyValueStore`] and
+/// [`LazyCacheStore`] built along with the store.
+///
+/// Use [`GenApiBuilder::build_on_demand`](crate::builder::GenApiBuilder::build_on_demand) to
+/// build the store.
+#[derive(Debug, Clone)]
+pub struct LazyNodeStore {
+    shared: Arc<Shared>,
+}
+
+impl NodeStore for LazyNodeStore {
+    fn name_by_id(&self, nid: NodeId) -> Option<&str> {
+        self.shared
+            .slots
+            .names
+            .get(nid.to_usize())
+            .map(AsRef::as_ref)
+    }
+
+    fn id_by_name<T>(&self, s: T) -> Option<NodeId>
+    where
+        T: AsRef<str>,
+    {
+        let name = s.as_ref();
+        let mut loader = self.shared.loader.lock().unwrap();
+        if !loader.parser.is_loaded(name) {
+            loader.load(&self.shared.slots, Some(name));
+        }
+        loader.interner.get(name)
+    }
+
+    fn node_opt(&self, nid: NodeId) -> Option<&NodeData> {
+        let slots = &self.shared.slots;
+        if let Some(node) = slots.nodes.get(nid.to_usize()) {
+            return Some(node);
+        }
+
+        // The name is interned but the node isn't loaded yet, e.g. the name is resolved before
+        // its definition.
+        let name = slots.names.get(nid.to_usize())?;
+        self.shared.loader.lock().unwrap().load(slots, Some(name));
+        slots.nodes.get(nid.to_usize())
+    }
+
+    fn visit_nodes<F>(&self, mut f: F)
+    where
+        F: FnMut(&NodeData),
+    {
+        let len = {
+            let mut loader = self.shared.loader.lock().unwrap();
+            loader.load(&self.shared.slots, None);
+            loader.interner.len()
+        };
+        // The lock is released so that `f` can look up nodes.
+        for idx in 0..len {
+            if let Some(node) = self.shared.slots.nodes.get(idx) {
+                f(node);
+            }
+        }
+    }
+}
+
+/// [`ValueStore`] which holds values of nodes loaded by [`LazyNodeStore`].
+///
+/// Initial values are shared with the node store, and updated values are kept in this store.
+#[derive(Debug, Clone)]
+pub struct LazyValueStore {
+    shared: Arc<Shared>,
+    updated: Vec<Option<ValueData>>,
+}
+
+impl ValueStore for LazyValueStore {
+    fn value_opt<T>(&self, id: T) -> Option<&ValueData>
+    where
+        T: Into<ValueId>,
+    {
+        let idx = id.into().0 as usize;
+        match self.updated.get(idx) {
+            Some(Some(value)) => Some(value),
+            _ => self.shared.slots.values.get(idx),
+        }
+    }
+
+    fn update<T, U>(&mut self, id: T, value: U) -> Option<ValueData>
+    where
+        T: Into<ValueId>,
+        U: Into<ValueData>,
+    {
+        let idx = id.into().0 as usize;
+        let initial = self.shared.slots.values.get(idx)?;
+        if self.updated.len() <= idx {
+            self.updated.resize(idx + 1, None);
+        }
+        let old = self.updated[idx].replace(value.into());
+        Some(old.unwrap_or_else(|| initial.clone()))
+    }
+}
+
+/// [`CacheStore`] which receives dependencies of nodes loaded by [`LazyNodeStore`].
+///
+/// Dependencies stored while loading nodes are passed to the inner store before it's mutated.
+/// Until then, lookups of cache miss so that a stale cache is never returned.
+#[derive(Debug, Clone)]
+pub struct LazyCacheStore<S = DefaultCacheStore> {
+    inner: S,
+    shared: Arc<Shared>,
+    /// The number of cache operations passed to `inner`.
+    applied: usize,
+}
+
+impl<S> LazyCacheStore<S> {
+    fn is_synced(&self) -> bool {
+        self.shared.slots.cache_op_count.load(Ordering::Acquire) == self.applied
+    }
+}
+
+impl<S> LazyCacheStore<S>
+where
+    S: CacheStoreBuilder,
+{
+    fn sync(&mut self) {
+        if self.is_synced() {
+            return;
+        }
+
+        let ops = self.shared.slots.cache_ops.lock().unwrap();
+        for op in &ops[self.applied..] {
+            match *op {
+                CacheOp::Invalidator(invalidator, target) => {
+                    self.inner.store_invalidator(invalidator, target);
+                }
+                CacheOp::Dependency(dependent, dependency) => {
+                    self.inner.store_dependency(dependent, dependency);
+                }
+                CacheOp::Volatile(nid) => self.inner.store_volatile(nid),
+            }
+        }
+        self.applied = ops.len();
+    }
+}
+
+impl<S> CacheStore for LazyCacheStore<S>
+where
+    S: CacheStore + CacheStoreBuilder,
+{
+    fn cache(&mut self, nid: NodeId, address: i64, length: i64, data: &[u8]) {
+        self.sync();
+        self.inner.cache(nid, address, length, data);
+    }
+
+    fn get_cache(&self, nid: NodeId, address: i64, length: i64) -> Option<&[u8]> {
+        if self.is_synced() {
+            self.inner.get_cache(nid, address, length)
+        } else {
+            None
+        }
+    }
+
+    fn cache_value(&mut self, nid: NodeId, value: EvaluationResult) {
+        self.sync();
+        self.inner.cache_value(nid, value);
+    }
+
+    fn get_value_cache(&self, nid: NodeId) -> Option<EvaluationResult> {
+        if self.is_synced() {
+            self.inner.get_value_cache(nid)
+        } else {
+            None
+        }
+    }
+
+    fn invalidate_by(&mut self, nid: NodeId) {
+        self.sync();
+        self.inner.invalidate_by(nid);
+    }
+
+    fn invalidate_of(&mut self, nid: NodeId) {
+        self.sync();
+        self.inner.invalidate_of(nid);
+    }
+
+    fn clear(&mut self) {
+        self.sync();
+        self.inner.clear();
+    }
+}
+
+#[derive(Debug)]
+struct Shared {
+    loader: Mutex<Loader>,
+    slots: Slots,
+}
+
+#[derive(Debug, Default)]
+struct Slots {
+    /// Node names indexed by [`NodeId`].
+    names: SlotVec<Box<str>>,
+    /// Loaded nodes indexed by [`NodeId`].
+    nodes: SlotVec<NodeData>,
+    /// Initial values indexed by [`ValueId`].
+    values: SlotVec<ValueData>,
+    /// All cache operations stored so far, which are passed to each [`LazyCacheStore`].
+    cache_ops: Mutex<Vec<CacheOp>>,
+    /// The length of `cache_ops`, which is read without the lock.
+    cache_op_count: AtomicUsize,
+}
+
+impl Slots {
+    fn sync_cache_op_count(&self) {
+        let len = self.cache_ops.lock().unwrap().len();
+        self.cache_op_count.store(len, Ordering::Release);
+    }
+}
+
+#[derive(Debug)]
+struct Loader {
+    parser: LazyParser,
+    interner: StringInterner<DefaultBackend<NodeId>>,
+    fresh_id: u32,
+    value_count: u32,
+    is_fully_loaded: bool,
+    /// Names which the xml doesn't define or whose nodes failed to load. Optional nodes are
+    /// probed repeatedly, so the lookups are answered without loading again.
+    absent: HashSet<Box<str>>,
+}
+
+impl Loader {
+    /// Loads the node named `name` and nodes it refers to, or all nodes if `name` is `None`.
+    fn load(&mut self, slots: &Slots, name: Option<&str>) {
+        if self.is_fully_loaded || matches!(name, Some(name) if self.absent.contains(name)) {
+            return;
+        }
+
+        let mut node_builder = NodeStaging {
+            interner: &mut self.interner,
+            names: &slots.names,
+            nodes: &slots.nodes,
+            fresh_id: &mut self.fresh_id,
+        };
+        let mut cache_ops = slots.cache_ops.lock().unwrap();
+        let mut cx = ValueCtxt::new(
+            ValueStaging {
+                values: &slots.values,
+                count: &mut self.value_count,
+            },
+            CacheStaging(&mut cache_ops),
+        );
+        let result = match name {
+            Some(name) => self.parser.load(name, &mut node_builder, &mut cx),
+            None => self
+                .parser
+                .load_all(&mut node_builder, &mut cx)
+                .map(|()| true),
+        };
+        slots
+            .cache_op_count
+            .store(cache_ops.len(), Ordering::Release);
+
+        match result {
+            Ok(true) => self.is_fully_loaded = name.is_none(),
+            Ok(false) => self.mark_absent(name),
+            Err(err) => {
+                debug!(%err, "failed to load GenApi nodes");
+                self.mark_absent(name);
+            }
+        }
+    }
+
+    fn mark_absent(&mut self, name: Option<&str>) {
+        if let Some(name) = name {
+            self.absent.insert(name.into());
+        }
+    }
+}
+
+#[derive(Debug, Clone, Copy)]
+enum CacheOp {
+    Invalidator(NodeId, NodeId),
+    Dependency(NodeId, NodeId),
+    Volatile(NodeId),
+}
+
+struct NodeStaging<'a> {
+    interner: &'a mut StringInterner<DefaultBackend<NodeId>>,
+    names: &'a SlotVec<Box<str>>,
+    nodes: &'a SlotVec<NodeData>,
+    fresh_id: &'a mut u32,
+}
+
+impl NodeStoreBuilder for NodeStaging<'_> {
+    type Store = ();
+
+    fn build(self) {}
+
+    fn store_node(&mut self, nid: NodeId, data: NodeData) {
+        let is_new = self.nodes.set(nid.to_usize(), data);
+        debug_assert!(is_new);
+    }
+
+    fn get_or_intern<T>(&mut self, node_name: T) -> NodeId
+    where
+        T: AsRef<str>,
+    {
+        let node_name = node_name.as_ref();
+        let nid = self.interner.get_or_intern(node_name);
+        if self.names.get(nid.to_usize()).is_none() {
+            self.names.set(nid.to_usize(), node_name.into());
+        }
+        nid
+    }
+
+    fn fresh_id(&mut self) -> u32 {
+        let id = *self.fresh_id;
+        *self.fresh_id += 1;
+        id
+    }
+}
+
+struct ValueStaging<'a> {
+    values: &'a SlotVec<ValueData>,
+    count: &'a mut u32,
+}
+
+impl ValueStoreBuilder for ValueStaging<'_> {
+    type Store = ();
+
+    fn build(self) {}
+
+    fn store<T, U>(&mut self, data: T) -> U
+    where
+        T: Into<ValueData>,
+        U: From<ValueId>,
+    {
+        let id = ValueId(*self.count);
+        *self.count = self
+            .count
+            .checked_add(1)
+            .expect("the number of value stored in `ValueStore` must not exceed u32::MAX");
+        self.values.set(id.0 as usize, data.into());
+        id.into()
+    }
+}
+
+struct CacheStaging<'a>(&'a mut Vec<CacheOp>);
+
+impl CacheStoreBuilder for CacheStaging<'_> {
+    type Store = ();
+
+    fn build(self) {}
+
+    fn store_invalidator(&mut self, invalidator: NodeId, target: NodeId) {
+        self.0.push(CacheOp::Invalidator(invalidator, target));
+    }
+
+    fn store_dependency(&mut self, dependent: NodeId, dependency: NodeId) {
+        self.0.push(CacheOp::Dependency(dependent, dependency));
+    }
+
+    fn store_volatile(&mut self, nid: NodeId) {
+        self.0.push(CacheOp::Volatile(nid));
+    }
+}
+
+/// The length of the first segment of [`SlotVec`], each following segment doubles it.
+const FIRST_SEGMENT_LEN: usize = 64;
+/// Enough segments to hold `u32::MAX` slots.
+const SEGMENT_COUNT: usize = 27;
+
+/// Append-only vector whose slots are set at most once through `&self`.
+///
+/// Slots are allocated in segments which are never reallocated, thus a reference to a value is
+/// valid as long as the vector.
+struct SlotVec<T> {
+    segments: [OnceLock<Box<[OnceLock<T>]>>; SEGMENT_COUNT],
+}
+
+impl<T> SlotVec<T> {
+    /// Returns the index of the segment and the offset in it.
+    fn locate(idx: usize) -> (usize, usize) {
+        let n = idx / FIRST_SEGMENT_LEN + 1;
+        let segment = (usize::BITS - 1 - n.leading_zeros()) as usize;
+        let start = FIRST_SEGMENT_LEN * ((1 << segment) - 1);
+        (segment, idx - start)
+    }
+
+    fn get(&self, idx: usize) -> Option<&T> {
+        let (segment, offset) = Self::locate(idx);
+        self.segments.get(segment)?.get()?[offset].get()
+    }
+
+    /// Sets the value of the slot, returns `false` if the slot is already set.
+    fn set(&self, idx: usize, value: T) -> bool {
+        let (segment, offset) = Self::locate(idx);
+        let slots = self.segments[segment].get_or_init(|| {
+            (0..FIRST_SEGMENT_LEN << segment)
+                .map(|_| OnceLock::new())
+                .collect()
+        });
+        slots[offset].set(value).is_ok()
+    }
+}
+
+impl<T> Default for SlotVec<T> {
+    fn default() -> Self {
+        Self {
+            segments: Default::default(),
+        }
+    }
+}
+
+impl<T> fmt::Debug for SlotVec<T> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let len = self.segments.iter().filter_map(OnceLock::get).count();
+        f.debug_struct("SlotVec")
+            .field("allocated_segments", &len)
+            .finish()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{super::DefaultNodeStore, *};
+    use crate::{
+        builder::GenApiBuilder,
+        interface::{IInteger, INode},
+        testing::{register_description, TestDevice},
+    };
+
+    fn xml() -> String {
+        register_description(
+            r#"
+
+            <Category Name="Root">
+                <pFeature>Width</pFeature>
+                <pFeature>Scale</pFeature>
+            </Category>
+
+            <Integer Name="Width">
+                <pValue>WidthReg</pValue>
+            </Integer>
+
+            <IntReg Name="WidthReg">
+              <Address>0x0</Address>
+              <Length>4</Length>
+              <AccessMode>RW</AccessMode>
+              <pPort>Device</pPort>
+              <Endianess>LittleEndian</Endianess>
+            </IntReg>
+
+            <Integer Name="Scale">
+                <Value>2</Value>
+            </Integer>
+
+            <IntSwissKnife Name="ScaledWidth">
+                <pVariable Name="W">Width</pVariable>
+                <pVariable Name="S">Scale</pVariable>
+                <Formula>W * S</Formula>
+            </IntSwissKnife>
+
+            <Port Name="Device"/>
+
+        "#,
+        )
+    }
+
+    #[test]
+    fn test_lazy_node_store() {
+        fn assert_send_sync<T: Send + Sync>() {}
+        assert_send_sync::<LazyNodeStore>();
+        assert_send_sync::<LazyValueStore>();
+        assert_send_sync::<LazyCacheStore>();
+
+        let (reg_desc, store, mut cx) = GenApiBuilder::<DefaultNodeStore>::default()
+            .build_on_demand(xml())
+            .unwrap();
+        assert_eq!(reg_desc.model_name(), "CameleonModel");
+        let mut device = TestDevice::new(vec![0; 4]);
+
+        // Looking up `ScaledWidth` loads the nodes it refers to, but not others.
+        let scaled = store
+            .id_by_name("ScaledWidth")
+            .unwrap()
+            .as_iinteger_kind(&store)
+            .unwrap();
+        {
+            let loader = store.shared.loader.lock().unwrap();
+            for name in &["ScaledWidth", "Width", "WidthReg", "Scale", "Device"] {
+                assert!(loader.parser.is_loaded(name));
+            }
+            assert!(!loader.parser.is_loaded("Root"));
+        }
+
+        let width = store
+            .id_by_name("Width")
+            .unwrap()
+            .as_iinteger_kind(&store)
+            .unwrap();
+        width.set_value(10, &mut device, &store, &mut cx).unwrap();
+        assert_eq!(scaled.value(&mut device, &store, &mut cx).unwrap(), 20);
+
+        // The value computed from `Width` is invalidated by writing `Width`.
+        width.set_value(20, &mut device, &store, &mut cx).unwrap();
+        assert_eq!(scaled.value(&mut device, &store, &mut cx).unwrap(), 40);
+        assert_eq!(device.memory, 20_u32.to_le_bytes());
+
+        // Values are updated in the value store.
+        let scale = store.id_by_name("Scale").unwrap();
+        let scale_kind = scale.as_iinteger_kind(&store).unwrap();
+        scale_kind
+            .set_value(3, &mut device, &store, &mut cx)
+            .unwrap();
+        assert_eq!(scale_kind.value(&mut device, &store, &mut cx).unwrap(), 3);
+        assert_eq!(scaled.value(&mut device, &store, &mut cx).unwrap(), 60);
+
+        // Visiting nodes loads all nodes.
+        let mut names = vec![];
+        store.visit_nodes(|node| names.push(node.node_base().id().name(&store).to_string()));
+        assert!(names.iter().any(|name| name == "Root"));
+        assert_eq!(scale.as_inode_kind(&store).unwrap().name(&store), "Scale");
+        assert!(store.id_by_name("Missing").is_none());
+    }
+
+    #[test]
+    fn test_absent_node() {
+        let (_, store, _) = GenApiBuilder::<DefaultNodeStore>::default()
+            .build_on_demand(xml())
+            .unwrap();
+
+        // A node which the xml doesn't define is looked up only once.
+        assert!(store.id_by_name("TimestampLatch").is_none());
+        assert!(store
+            .shared
+            .loader
+            .lock()
+            .unwrap()
+            .absent
+            .contains("TimestampLatch"));
+        assert!(store.id_by_name("TimestampLatch").is_none());
+        assert_eq!(store.shared.loader.lock().unwrap().absent.len(), 1);
+
+        // Defined nodes are still loaded.
+        assert!(store.id_by_name("Width").is_some());
+    }
+
+    #[test]
+    fn test_slot_vec() {
+        let slots = SlotVec::default();
+        for idx in &[0, 63, 64, 191, 192, 100_000] {
+            assert!(slots.get(*idx).is_none());
+            assert!(slots.set(*idx, *idx));
+            assert!(!slots.set(*idx, 0));
+            assert_eq!(slots.get(*idx), Some(idx));
+        }
+        assert!(slots.get(u32::MAX as usize).is_none());
+    }
+}
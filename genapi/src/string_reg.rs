@@ -150,8 +150,10 @@ impl IRegister for StringRegNode {
         store: &impl NodeStore,
         cx: &mut ValueCtxt<T, U>,
     ) -> GenApiResult<()> {
+        let nid = self.node_base().id();
+        cx.invalidate_cache_by(nid);
         self.register_base()
-            .write_and_cache(self.node_base().id(), buf, device, store, cx)
+            .write_and_cache(nid, buf, device, store, cx)
     }
 
     fn address<T: ValueStore, U: CacheStore>(
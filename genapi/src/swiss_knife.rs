@@ -8,7 +8,8 @@ use super::{
     interface::{IFloat, INode, IncrementMode},
     node_base::{NodeAttributeBase, NodeBase, NodeElementBase},
     store::{CacheStore, NodeId, NodeStore, ValueStore},
-    utils, Device, GenApiError, GenApiResult, ValueCtxt,
+    utils::{self, CompiledFormula},
+    Device, GenApiError, GenApiResult, ValueCtxt,
 };
 
 #[derive(Debug, Clone)]
@@ -21,6 +22,8 @@ pub struct SwissKnifeNode {
     pub(crate) constants: Vec<NamedValue<f64>>,
     pub(crate) expressions: Vec<NamedValue<Expr>>,
     pub(crate) formula: Formula,
+    /// `None` if `formula` couldn't be compiled, see [`CompiledFormula::compile`].
+    pub(crate) compiled_formula: Option<CompiledFormula>,
     pub(crate) unit: Option<String>,
     pub(crate) representation: FloatRepresentation,
     pub(crate) display_notation: DisplayNotation,
@@ -89,10 +92,23 @@ impl IFloat for SwissKnifeNode {
         store: &impl NodeStore,
         cx: &mut ValueCtxt<T, U>,
     ) -> GenApiResult<f64> {
-        let var_env =
-            utils::FormulaEnvCollector::new(&self.p_variables, &self.constants, &self.expressions)
-                .collect(device, store, cx)?;
-        let eval_result = self.formula.eval(&var_env)?;
+        let nid = self.node_base().id();
+        if let Some(value) = cx.get_value_cache(nid) {
+            return Ok(value.as_float());
+        }
+
+        let eval_result = if let Some(formula) = &self.compiled_formula {
+            formula.eval(None, device, store, cx)?
+        } else {
+            let var_env = utils::FormulaEnvCollector::new(
+                &self.p_variables,
+                &self.constants,
+                &self.expressions,
+            )
+            .collect(device, store, cx)?;
+            self.formula.eval(&var_env)?
+        };
+        cx.cache_value(nid, eval_result);
         Ok(eval_result.as_float())
     }
 
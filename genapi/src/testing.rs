@@ -0,0 +1,98 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! Fixtures shared by tests.
+//!
+//! Items are referred to through `super` only, so that benchmarks can include this file with
+//! `#[path]` as well.
+
+use super::Device;
+
+const REGISTER_DESCRIPTION_START: &str = r#"<RegisterDescription
+  ModelName="CameleonModel"
+  VendorName="CameleonVendor"
+  StandardNameSpace="None"
+  SchemaMajorVersion="1"
+  SchemaMinorVersion="1"
+  SchemaSubMinorVersion="0"
+  MajorVersion="1"
+  MinorVersion="2"
+  SubMinorVersion="3"
+  ProductGuid="01234567-0123-0123-0123-0123456789ab"
+  VersionGuid="76543210-3210-3210-3210-ba9876543210"
+  xmlns="http://www.genicam.org/GenApi/Version_1_0"
+  xmlns:xsi="http://www.w3.org/2001/XMLSchema-instance"
+  xsi:schemaLocation="http://www.genicam.org/GenApi/Version_1_0 GenApiSchema.xsd">"#;
+
+/// Wraps `body` in a `RegisterDescription` element.
+#[must_use]
+pub fn register_description(body: &str) -> String {
+    format!(
+        "{}\n{}\n</RegisterDescription>\n",
+        REGISTER_DESCRIPTION_START, body
+    )
+}
+
+/// Device whose memory is `memory`, which records reads of it.
+#[derive(Debug, Default)]
+pub struct TestDevice {
+    pub memory: Vec<u8>,
+    /// Address and length of each read.
+    pub reads: Vec<(i64, usize)>,
+    /// The number of calls of [`Device::read_mem_stacked`].
+    pub stacked_reads: usize,
+    /// Chunk data attached to the device, paired with its chunk id.
+    pub chunk: Option<(u64, Vec<u8>)>,
+}
+
+impl TestDevice {
+    #[must_use]
+    pub fn new(memory: Vec<u8>) -> Self {
+        Self {
+            memory,
+            ..Self::default()
+        }
+    }
+}
+
+impl Device for TestDevice {
+    fn read_mem(
+        &mut self,
+        address: i64,
+        buf: &mut [u8],
+    ) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
+        self.reads.push((address, buf.len()));
+        let address = address as usize;
+        buf.copy_from_slice(&self.memory[address..address + buf.len()]);
+        Ok(())
+    }
+
+    fn write_mem(
+        &mut self,
+        address: i64,
+        data: &[u8],
+    ) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
+        let address = address as usize;
+        self.memory[address..address + data.len()].copy_from_slice(data);
+        Ok(())
+    }
+
+    fn read_mem_stacked(
+        &mut self,
+        entries: &mut [(i64, &mut [u8])],
+    ) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
+        self.stacked_reads += 1;
+        for (address, buf) in entries {
+            self.read_mem(*address, buf)?;
+        }
+        Ok(())
+    }
+
+    fn chunk_data(&self, chunk_id: u64) -> Option<&[u8]> {
+        match &self.chunk {
+            Some((id, data)) if *id == chunk_id => Some(data),
+            _ => None,
+        }
+    }
+}
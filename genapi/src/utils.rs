@@ -5,9 +5,9 @@
 use std::{borrow::Cow, collections::HashMap, convert::TryInto};
 
 use super::{
+    codec::{impl_codec_struct, Codec, DecodeResult, Decoder, Encoder},
     elem_type::{Endianness, NamedValue, Sign},
-    formula::EvaluationResult,
-    formula::Expr,
+    formula::{Binding, EvaluationResult, Expr, Formula, Program},
     interface::{IBoolean, IEnumeration, IFloat, IInteger},
     store::{CacheStore, NodeId, NodeStore, ValueStore},
     Device, GenApiError, GenApiResult, ValueCtxt,
@@ -169,8 +169,8 @@ impl<'a, T: Copy + Into<Expr>> FormulaEnvCollector<'a, T> {
         store: &impl NodeStore,
         cx: &mut ValueCtxt<U, S>,
     ) -> GenApiResult<()> {
-        let expr = expr_from_nid(nid, device, store, cx)?;
-        self.insert_imm(name, expr);
+        let value = value_from_nid(nid, device, store, cx)?;
+        self.insert_imm(name, value);
         Ok(())
     }
 
@@ -200,31 +200,31 @@ impl<'a, T: Copy + Into<Expr>> FormulaEnvCollector<'a, T> {
         for variable in self.p_variables {
             let name = variable.name();
             let nid = variable.value();
-            let expr = VariableKind::from_str(name)?.get_value(nid, device, store, cx)?;
-            self.var_env.insert(name, Cow::Owned(expr));
+            let value = VariableKind::from_str(name)?.get_value(nid, device, store, cx)?;
+            self.var_env.insert(name, Cow::Owned(value.into()));
         }
         Ok(())
     }
 }
 
-#[derive(Debug)]
-enum VariableKind<'a> {
+#[derive(Debug, Clone, PartialEq)]
+enum VariableKind {
     Value,
     Min,
     Max,
     Inc,
-    Enum(&'a str),
+    Enum(String),
 }
 
-impl<'a> VariableKind<'a> {
-    fn from_str(s: &'a str) -> GenApiResult<Self> {
-        let split: Vec<&'a str> = s.splitn(3, '.').collect();
+impl VariableKind {
+    fn from_str(s: &str) -> GenApiResult<Self> {
+        let split: Vec<&str> = s.splitn(3, '.').collect();
         Ok(match split.as_slice() {
             [_] | [_, "Value"] => Self::Value,
             [_, "Min"] => Self::Min,
             [_, "Max"] => Self::Max,
             [_, "Inc"] => Self::Inc,
-            [_, "Enum", name] => Self::Enum(name),
+            [_, "Enum", name] => Self::Enum((*name).to_string()),
             _ => {
                 return Err(GenApiError::invalid_node(
                     format!("invalid `pVariable`: {}", s).into(),
@@ -234,18 +234,18 @@ impl<'a> VariableKind<'a> {
     }
 
     fn get_value<T: ValueStore, U: CacheStore>(
-        self,
+        &self,
         nid: NodeId,
         device: &mut impl Device,
         store: &impl NodeStore,
         cx: &mut ValueCtxt<T, U>,
-    ) -> GenApiResult<Expr> {
+    ) -> GenApiResult<EvaluationResult> {
         fn error(nid: NodeId, store: &impl NodeStore) -> GenApiError {
             GenApiError::invalid_node(format!("invalid `pVariable: {}`", nid.name(store)).into())
         }
 
-        let expr: Expr = match self {
-            Self::Value => expr_from_nid(nid, device, store, cx)?,
+        let value = match self {
+            Self::Value => value_from_nid(nid, device, store, cx)?,
             Self::Min => {
                 if let Some(node) = nid.as_iinteger_kind(store) {
                     node.min(device, store, cx)?.into()
@@ -290,7 +290,156 @@ impl<'a> VariableKind<'a> {
             }
         };
 
-        Ok(expr)
+        Ok(value)
+    }
+}
+
+/// Identifier bound by a node in addition to `pVariable`s, e.g. `TO` and `FROM` of converters.
+#[derive(Debug, Clone, Copy)]
+pub(super) enum FormulaInput {
+    /// The identifier is bound to the value of the node.
+    Node(&'static str, NodeId),
+    /// The identifier is bound to the immediate passed to [`CompiledFormula::eval`].
+    Imm(&'static str),
+}
+
+/// [`Formula`] compiled with the `pVariable`s, `Constant`s and `Expression`s of its node.
+///
+/// This is built once when the node is parsed, so evaluation doesn't need to rebuild the variable
+/// environment which [`FormulaEnvCollector`] makes for each read.
+#[derive(Debug, Clone, PartialEq)]
+pub(crate) struct CompiledFormula {
+    program: Program,
+    slots: Vec<Slot>,
+}
+
+#[derive(Debug, Clone, PartialEq)]
+enum Slot {
+    Variable { nid: NodeId, kind: VariableKind },
+    Imm,
+}
+
+impl_codec_struct!(CompiledFormula { program, slots });
+
+impl Codec for Slot {
+    fn encode(&self, enc: &mut Encoder) {
+        match self {
+            Self::Variable { nid, kind } => {
+                0_u8.encode(enc);
+                nid.encode(enc);
+                kind.encode(enc);
+            }
+            Self::Imm => 1_u8.encode(enc),
+        }
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        match u8::decode(dec)? {
+            0 => Ok(Self::Variable {
+                nid: Codec::decode(dec)?,
+                kind: Codec::decode(dec)?,
+            }),
+            1 => Ok(Self::Imm),
+            _ => Decoder::invalid("invalid Slot"),
+        }
+    }
+}
+
+impl Codec for VariableKind {
+    fn encode(&self, enc: &mut Encoder) {
+        match self {
+            Self::Value => 0_u8.encode(enc),
+            Self::Min => 1_u8.encode(enc),
+            Self::Max => 2_u8.encode(enc),
+            Self::Inc => 3_u8.encode(enc),
+            Self::Enum(name) => {
+                4_u8.encode(enc);
+                name.encode(enc);
+            }
+        }
+    }
+
+    fn decode(dec: &mut Decoder) -> DecodeResult<Self> {
+        Ok(match u8::decode(dec)? {
+            0 => Self::Value,
+            1 => Self::Min,
+            2 => Self::Max,
+            3 => Self::Inc,
+            4 => Self::Enum(Codec::decode(dec)?),
+            _ => return Decoder::invalid("invalid VariableKind"),
+        })
+    }
+}
+
+impl CompiledFormula {
+    /// Returns `None` if the formula refers to an unknown identifier or an invalid `pVariable`.
+    /// Such a formula must be evaluated with [`FormulaEnvCollector`], which reports the error
+    /// when the node is read.
+    pub(super) fn compile<T: Copy + Into<EvaluationResult>>(
+        formula: &Formula,
+        p_variables: &[NamedValue<NodeId>],
+        constants: &[NamedValue<T>],
+        expressions: &[NamedValue<Expr>],
+        inputs: &[FormulaInput],
+    ) -> Option<Self> {
+        // Identifiers are resolved with the same precedence as `FormulaEnvCollector`, where later
+        // insertion shadows earlier one.
+        let mut slots: Vec<(&str, Slot)> = vec![];
+        let mut bind = |name, slot| {
+            let idx = match slots.iter().position(|(n, _)| *n == name) {
+                Some(idx) => idx,
+                None => {
+                    slots.push((name, slot));
+                    slots.len() - 1
+                }
+            };
+            Binding::Slot(idx)
+        };
+
+        let program = Program::compile(&formula.expr, |name| {
+            if let Some(expr) = expressions.iter().rev().find(|e| e.name() == name) {
+                Some(Binding::Expr(expr.value_ref()))
+            } else if let Some(constant) = constants.iter().rev().find(|c| c.name() == name) {
+                Some(Binding::Imm(constant.value().into()))
+            } else if let Some(variable) = p_variables.iter().rev().find(|v| v.name() == name) {
+                let kind = VariableKind::from_str(variable.name()).ok()?;
+                let nid = variable.value();
+                Some(bind(variable.name(), Slot::Variable { nid, kind }))
+            } else {
+                inputs.iter().find_map(|input| match *input {
+                    FormulaInput::Node(n, nid) if n == name => Some(bind(
+                        n,
+                        Slot::Variable {
+                            nid,
+                            kind: VariableKind::Value,
+                        },
+                    )),
+                    FormulaInput::Imm(n) if n == name => Some(bind(n, Slot::Imm)),
+                    _ => None,
+                })
+            }
+        })?;
+        debug_assert_eq!(program.slot_count(), slots.len());
+
+        Some(Self {
+            program,
+            slots: slots.into_iter().map(|(_, slot)| slot).collect(),
+        })
+    }
+
+    pub(super) fn eval<T: ValueStore, U: CacheStore>(
+        &self,
+        imm: Option<EvaluationResult>,
+        device: &mut impl Device,
+        store: &impl NodeStore,
+        cx: &mut ValueCtxt<T, U>,
+    ) -> GenApiResult<EvaluationResult> {
+        self.program.eval(|slot| match &self.slots[slot] {
+            Slot::Variable { nid, kind } => kind.get_value(*nid, device, store, cx),
+            Slot::Imm => imm.ok_or_else(|| {
+                GenApiError::invalid_node("immediate of formula is not given".into())
+            }),
+        })
     }
 }
 
@@ -359,12 +508,12 @@ pub(super) fn set_eval_result<T: ValueStore, U: CacheStore>(
     Ok(())
 }
 
-fn expr_from_nid<T: ValueStore, U: CacheStore>(
+fn value_from_nid<T: ValueStore, U: CacheStore>(
     nid: NodeId,
     device: &mut impl Device,
     store: &impl NodeStore,
     cx: &mut ValueCtxt<T, U>,
-) -> GenApiResult<Expr> {
+) -> GenApiResult<EvaluationResult> {
     Ok(if let Some(node) = nid.as_iinteger_kind(store) {
         node.value(device, store, cx)?.into()
     } else if let Some(node) = nid.as_ifloat_kind(store) {
@@ -0,0 +1,580 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+use std::{ops::Deref, ptr::NonNull, sync::Mutex};
+
+use cameleon::payload::PayloadType;
+
+use super::{
+    bool8_t, copy_info, device, event::EventRef, imp, GenTlError, GenTlResult, ModuleHandle,
+    GC_ERROR, INFO_DATATYPE,
+};
+
+use imp::data_stream::{BufferHandle, FlushOperation};
+
+pub(super) type DS_HANDLE = *mut libc::c_void;
+pub(super) type BUFFER_HANDLE = *mut libc::c_void;
+
+/// Value of a timeout which means waiting infinitely.
+pub(super) const GENTL_INFINITE: u64 = 0xFFFF_FFFF_FFFF_FFFF;
+
+/// Namespace of `BUFFER_INFO_PIXELFORMAT`.
+const PIXELFORMAT_NAMESPACE_PFNC_32BIT: u64 = 4;
+
+#[derive(Clone, Copy)]
+pub(super) struct DataStreamModuleRef<'a> {
+    inner: &'a Mutex<dyn imp::data_stream::DataStream>,
+    parent_dev: device::DEV_HANDLE,
+    pub(super) new_buffer_event: super::event::EVENT_HANDLE,
+}
+
+impl<'a> DataStreamModuleRef<'a> {
+    pub(super) fn new(
+        inner: &'a Mutex<dyn imp::data_stream::DataStream>,
+        parent_dev: device::DEV_HANDLE,
+    ) -> Self {
+        let event = EventRef::NewBuffer(inner.lock().unwrap().buffers().clone());
+        let new_buffer_event = unsafe { Box::new(ModuleHandle::Event(event)).into_raw() };
+
+        Self {
+            inner,
+            parent_dev,
+            new_buffer_event,
+        }
+    }
+}
+
+impl<'a> Deref for DataStreamModuleRef<'a> {
+    type Target = Mutex<dyn imp::data_stream::DataStream>;
+
+    fn deref(&self) -> &Self::Target {
+        self.inner
+    }
+}
+
+fn buffer_handle(hBuffer: BUFFER_HANDLE) -> GenTlResult<BufferHandle> {
+    if hBuffer.is_null() {
+        Err(GenTlError::InvalidHandle)
+    } else {
+        Ok(BufferHandle(hBuffer as usize))
+    }
+}
+
+fn buffer_raw_handle(handle: BufferHandle) -> BUFFER_HANDLE {
+    handle.0 as BUFFER_HANDLE
+}
+
+newtype_enum! {
+    pub enum STREAM_INFO_CMD {
+        STREAM_INFO_ID = 0,
+        STREAM_INFO_NUM_DELIVERED = 1,
+        STREAM_INFO_NUM_UNDERRUN = 2,
+        STREAM_INFO_NUM_ANNOUNCED = 3,
+        STREAM_INFO_NUM_QUEUED = 4,
+        STREAM_INFO_NUM_AWAIT_DELIVERY = 5,
+        STREAM_INFO_NUM_STARTED = 6,
+        STREAM_INFO_PAYLOAD_SIZE = 7,
+        STREAM_INFO_IS_GRABBING = 8,
+        STREAM_INFO_DEFINES_PAYLOADSIZE = 9,
+        STREAM_INFO_TLTYPE = 10,
+        STREAM_INFO_NUM_CHUNKS_MAX = 11,
+        STREAM_INFO_BUF_ANNOUNCE_MIN = 12,
+        STREAM_INFO_BUF_ALIGNMENT = 13,
+        STREAM_INFO_CUSTOM_ID = 1000,
+    }
+}
+
+newtype_enum! {
+    pub enum BUFFER_INFO_CMD {
+        BUFFER_INFO_BASE = 0,
+        BUFFER_INFO_SIZE = 1,
+        BUFFER_INFO_USER_PTR = 2,
+        BUFFER_INFO_TIMESTAMP = 3,
+        BUFFER_INFO_NEW_DATA = 4,
+        BUFFER_INFO_IS_QUEUED = 5,
+        BUFFER_INFO_IS_ACQUIRING = 6,
+        BUFFER_INFO_IS_INCOMPLETE = 7,
+        BUFFER_INFO_TLTYPE = 8,
+        BUFFER_INFO_SIZE_FILLED = 9,
+        BUFFER_INFO_WIDTH = 10,
+        BUFFER_INFO_HEIGHT = 11,
+        BUFFER_INFO_XOFFSET = 12,
+        BUFFER_INFO_YOFFSET = 13,
+        BUFFER_INFO_XPADDING = 14,
+        BUFFER_INFO_YPADDING = 15,
+        BUFFER_INFO_FRAMEID = 16,
+        BUFFER_INFO_IMAGEPRESENT = 17,
+        BUFFER_INFO_IMAGEOFFSET = 18,
+        BUFFER_INFO_PAYLOADTYPE = 19,
+        BUFFER_INFO_PIXELFORMAT = 20,
+        BUFFER_INFO_PIXELFORMAT_NAMESPACE = 21,
+        BUFFER_INFO_DELIVERED_IMAGEHEIGHT = 22,
+        BUFFER_INFO_DELIVERED_CHUNKPAYLOADSIZE = 23,
+        BUFFER_INFO_CHUNKLAYOUTID = 24,
+        BUFFER_INFO_CUSTOM_ID = 1000,
+    }
+}
+
+newtype_enum! {
+    pub enum ACQ_QUEUE_TYPE {
+        ACQ_QUEUE_INPUT_TO_OUTPUT = 0,
+        ACQ_QUEUE_OUTPUT_DISCARD = 1,
+        ACQ_QUEUE_ALL_TO_INPUT = 2,
+        ACQ_QUEUE_UNQUEUED_TO_INPUT = 3,
+        ACQ_QUEUE_ALL_DISCARD = 4,
+        ACQ_QUEUE_CUSTOM_ID = 1000,
+    }
+}
+
+newtype_enum! {
+    pub enum ACQ_START_FLAGS {
+        ACQ_START_FLAGS_DEFAULT = 0,
+        ACQ_START_FLAGS_CUSTOM_ID = 1000,
+    }
+}
+
+newtype_enum! {
+    pub enum ACQ_STOP_FLAGS {
+        ACQ_STOP_FLAGS_DEFAULT = 0,
+        ACQ_STOP_FLAGS_KILL = 1,
+        ACQ_STOP_FLAGS_CUSTOM_ID = 1000,
+    }
+}
+
+newtype_enum! {
+    pub enum TL_PAYLOAD_TYPE {
+        PAYLOAD_TYPE_UNKNOWN = 0,
+        PAYLOAD_TYPE_IMAGE = 1,
+        PAYLOAD_TYPE_RAW_DATA = 2,
+        PAYLOAD_TYPE_FILE = 3,
+        PAYLOAD_TYPE_CHUNK_DATA = 4,
+        PAYLOAD_TYPE_CUSTOM_ID = 1000,
+    }
+}
+
+impl std::convert::TryFrom<ACQ_QUEUE_TYPE> for FlushOperation {
+    type Error = GenTlError;
+
+    fn try_from(value: ACQ_QUEUE_TYPE) -> GenTlResult<Self> {
+        use FlushOperation::{
+            AllDiscard, AllToInput, InputToOutput, OutputDiscard, UnqueuedToInput,
+        };
+        match value {
+            ACQ_QUEUE_TYPE::ACQ_QUEUE_INPUT_TO_OUTPUT => Ok(InputToOutput),
+            ACQ_QUEUE_TYPE::ACQ_QUEUE_OUTPUT_DISCARD => Ok(OutputDiscard),
+            ACQ_QUEUE_TYPE::ACQ_QUEUE_ALL_TO_INPUT => Ok(AllToInput),
+            ACQ_QUEUE_TYPE::ACQ_QUEUE_UNQUEUED_TO_INPUT => Ok(UnqueuedToInput),
+            ACQ_QUEUE_TYPE::ACQ_QUEUE_ALL_DISCARD => Ok(AllDiscard),
+            _ => Err(GenTlError::InvalidParameter),
+        }
+    }
+}
+
+fn ds_get_info(
+    ds: &Mutex<dyn imp::data_stream::DataStream>,
+    iInfoCmd: STREAM_INFO_CMD,
+    piType: *mut INFO_DATATYPE,
+    pBuffer: *mut libc::c_void,
+    piSize: *mut libc::size_t,
+) -> GenTlResult<()> {
+    let ds_guard = ds.lock().unwrap();
+    let table = ds_guard.buffers().lock();
+    let info_data_type = match iInfoCmd {
+        STREAM_INFO_CMD::STREAM_INFO_ID => copy_info(ds_guard.stream_id(), pBuffer, piSize),
+
+        STREAM_INFO_CMD::STREAM_INFO_NUM_DELIVERED => {
+            copy_info(table.num_delivered, pBuffer, piSize)
+        }
+
+        STREAM_INFO_CMD::STREAM_INFO_NUM_UNDERRUN => copy_info(table.num_underrun, pBuffer, piSize),
+
+        STREAM_INFO_CMD::STREAM_INFO_NUM_ANNOUNCED => {
+            copy_info(table.num_announced(), pBuffer, piSize)
+        }
+
+        STREAM_INFO_CMD::STREAM_INFO_NUM_QUEUED => copy_info(table.num_queued(), pBuffer, piSize),
+
+        STREAM_INFO_CMD::STREAM_INFO_NUM_AWAIT_DELIVERY => {
+            copy_info(table.num_await_delivery(), pBuffer, piSize)
+        }
+
+        STREAM_INFO_CMD::STREAM_INFO_NUM_STARTED => copy_info(table.num_started, pBuffer, piSize),
+
+        STREAM_INFO_CMD::STREAM_INFO_PAYLOAD_SIZE => {
+            copy_info(ds_guard.payload_size()?, pBuffer, piSize)
+        }
+
+        STREAM_INFO_CMD::STREAM_INFO_IS_GRABBING => {
+            copy_info(bool8_t::from(ds_guard.is_grabbing()), pBuffer, piSize)
+        }
+
+        STREAM_INFO_CMD::STREAM_INFO_DEFINES_PAYLOADSIZE => {
+            copy_info(bool8_t::true_(), pBuffer, piSize)
+        }
+
+        STREAM_INFO_CMD::STREAM_INFO_TLTYPE => {
+            copy_info(imp::port::TlType::USB3Vision, pBuffer, piSize)
+        }
+
+        STREAM_INFO_CMD::STREAM_INFO_BUF_ANNOUNCE_MIN => copy_info(1_usize, pBuffer, piSize),
+
+        STREAM_INFO_CMD::STREAM_INFO_BUF_ALIGNMENT => copy_info(1_usize, pBuffer, piSize),
+
+        _ => Err(GenTlError::InvalidParameter),
+    }?;
+
+    unsafe {
+        *piType = info_data_type;
+    }
+
+    Ok(())
+}
+
+fn buffer_get_info(
+    ds: &Mutex<dyn imp::data_stream::DataStream>,
+    handle: BufferHandle,
+    iInfoCmd: BUFFER_INFO_CMD,
+    piType: *mut INFO_DATATYPE,
+    pBuffer: *mut libc::c_void,
+    piSize: *mut libc::size_t,
+) -> GenTlResult<()> {
+    let ds_guard = ds.lock().unwrap();
+    let table = ds_guard.buffers().lock();
+    let info = table.buffer_info(handle)?;
+    let payload = info.payload;
+    let image_info = payload.and_then(|payload| payload.image_info());
+    let image_info = || image_info.ok_or(GenTlError::NoData);
+
+    let info_data_type = match iInfoCmd {
+        BUFFER_INFO_CMD::BUFFER_INFO_BASE => {
+            copy_info(info.base.cast::<libc::c_void>(), pBuffer, piSize)
+        }
+
+        BUFFER_INFO_CMD::BUFFER_INFO_SIZE => copy_info(info.size, pBuffer, piSize),
+
+        BUFFER_INFO_CMD::BUFFER_INFO_USER_PTR => copy_info(info.user_ptr, pBuffer, piSize),
+
+        BUFFER_INFO_CMD::BUFFER_INFO_TIMESTAMP => {
+            let payload = payload.ok_or(GenTlError::NoData)?;
+            copy_info(payload.timestamp().as_nanos() as u64, pBuffer, piSize)
+        }
+
+        BUFFER_INFO_CMD::BUFFER_INFO_NEW_DATA => {
+            copy_info(bool8_t::from(payload.is_some()), pBuffer, piSize)
+        }
+
+        BUFFER_INFO_CMD::BUFFER_INFO_IS_QUEUED => {
+            copy_info(bool8_t::from(info.is_queued), pBuffer, piSize)
+        }
+
+        BUFFER_INFO_CMD::BUFFER_INFO_IS_ACQUIRING => copy_info(
+            bool8_t::from(info.is_queued && ds_guard.is_grabbing()),
+            pBuffer,
+            piSize,
+        ),
+
+        // Incomplete payloads are never delivered.
+        BUFFER_INFO_CMD::BUFFER_INFO_IS_INCOMPLETE => copy_info(bool8_t::false_(), pBuffer, piSize),
+
+        BUFFER_INFO_CMD::BUFFER_INFO_TLTYPE => {
+            copy_info(imp::port::TlType::USB3Vision, pBuffer, piSize)
+        }
+
+        BUFFER_INFO_CMD::BUFFER_INFO_SIZE_FILLED => copy_info(
+            payload.map_or(0, |payload| payload.payload().len()),
+            pBuffer,
+            piSize,
+        ),
+
+        BUFFER_INFO_CMD::BUFFER_INFO_WIDTH => copy_info(image_info()?.width, pBuffer, piSize),
+
+        BUFFER_INFO_CMD::BUFFER_INFO_HEIGHT => copy_info(image_info()?.height, pBuffer, piSize),
+
+        BUFFER_INFO_CMD::BUFFER_INFO_XOFFSET => copy_info(image_info()?.x_offset, pBuffer, piSize),
+
+        BUFFER_INFO_CMD::BUFFER_INFO_YOFFSET => copy_info(image_info()?.y_offset, pBuffer, piSize),
+
+        BUFFER_INFO_CMD::BUFFER_INFO_XPADDING | BUFFER_INFO_CMD::BUFFER_INFO_YPADDING => {
+            copy_info(0_usize, pBuffer, piSize)
+        }
+
+        BUFFER_INFO_CMD::BUFFER_INFO_FRAMEID => {
+            let payload = payload.ok_or(GenTlError::NoData)?;
+            copy_info(payload.id(), pBuffer, piSize)
+        }
+
+        BUFFER_INFO_CMD::BUFFER_INFO_IMAGEPRESENT => {
+            copy_info(bool8_t::from(image_info().is_ok()), pBuffer, piSize)
+        }
+
+        // The image is always the first chunk if present.
+        BUFFER_INFO_CMD::BUFFER_INFO_IMAGEOFFSET => copy_info(0_usize, pBuffer, piSize),
+
+        BUFFER_INFO_CMD::BUFFER_INFO_PAYLOADTYPE => {
+            let payload = payload.ok_or(GenTlError::NoData)?;
+            let payload_type = match payload.payload_type() {
+                PayloadType::Image => TL_PAYLOAD_TYPE::PAYLOAD_TYPE_IMAGE,
+                PayloadType::ImageExtendedChunk | PayloadType::Chunk => {
+                    TL_PAYLOAD_TYPE::PAYLOAD_TYPE_CHUNK_DATA
+                }
+            };
+            copy_info(payload_type.0 as usize, pBuffer, piSize)
+        }
+
+        BUFFER_INFO_CMD::BUFFER_INFO_PIXELFORMAT => {
+            let pixel_format: u32 = image_info()?.pixel_format.into();
+            copy_info(u64::from(pixel_format), pBuffer, piSize)
+        }
+
+        BUFFER_INFO_CMD::BUFFER_INFO_PIXELFORMAT_NAMESPACE => {
+            copy_info(PIXELFORMAT_NAMESPACE_PFNC_32BIT, pBuffer, piSize)
+        }
+
+        BUFFER_INFO_CMD::BUFFER_INFO_DELIVERED_IMAGEHEIGHT => {
+            copy_info(image_info()?.height, pBuffer, piSize)
+        }
+
+        BUFFER_INFO_CMD::BUFFER_INFO_DELIVERED_CHUNKPAYLOADSIZE => {
+            let payload = payload.ok_or(GenTlError::NoData)?;
+            let size = match payload.payload_type() {
+                PayloadType::Image => 0,
+                _ => payload.payload().len(),
+            };
+            copy_info(size, pBuffer, piSize)
+        }
+
+        _ => Err(GenTlError::InvalidParameter),
+    }?;
+
+    unsafe {
+        *piType = info_data_type;
+    }
+
+    Ok(())
+}
+
+gentl_api! {
+    pub fn DSAnnounceBuffer(
+        hDataStream: DS_HANDLE,
+        pBuffer: *mut libc::c_void,
+        iSize: libc::size_t,
+        pPrivate: *mut libc::c_void,
+        phBuffer: *mut BUFFER_HANDLE,
+    ) -> GenTlResult<()> {
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hDataStream)? };
+        let ds = handle.data_stream()?;
+
+        let ptr = NonNull::new(pBuffer.cast::<u8>()).ok_or(GenTlError::InvalidParameter)?;
+        let ds_guard = ds.lock().unwrap();
+        // Safety: The consumer guarantees that the buffer is valid until it's revoked.
+        let buffer = unsafe { ds_guard.buffers().lock().announce(ptr, iSize, pPrivate)? };
+        unsafe {
+            *phBuffer = buffer_raw_handle(buffer);
+        }
+
+        Ok(())
+    }
+}
+
+gentl_api! {
+    pub fn DSAllocAndAnnounceBuffer(
+        hDataStream: DS_HANDLE,
+        iSize: libc::size_t,
+        pPrivate: *mut libc::c_void,
+        phBuffer: *mut BUFFER_HANDLE,
+    ) -> GenTlResult<()> {
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hDataStream)? };
+        let ds = handle.data_stream()?;
+
+        let ds_guard = ds.lock().unwrap();
+        let buffer = ds_guard.buffers().lock().alloc_and_announce(iSize, pPrivate)?;
+        unsafe {
+            *phBuffer = buffer_raw_handle(buffer);
+        }
+
+        Ok(())
+    }
+}
+
+gentl_api! {
+    pub fn DSRevokeBuffer(
+        hDataStream: DS_HANDLE,
+        hBuffer: BUFFER_HANDLE,
+        pBuffer: *mut *mut libc::c_void,
+        pPrivate: *mut *mut libc::c_void,
+    ) -> GenTlResult<()> {
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hDataStream)? };
+        let ds = handle.data_stream()?;
+
+        let ds_guard = ds.lock().unwrap();
+        let (buffer, user_ptr) = ds_guard.buffers().lock().revoke(buffer_handle(hBuffer)?)?;
+        unsafe {
+            if !pBuffer.is_null() {
+                *pBuffer = buffer.map_or(std::ptr::null_mut(), |ptr| ptr.as_ptr().cast());
+            }
+            if !pPrivate.is_null() {
+                *pPrivate = user_ptr;
+            }
+        }
+
+        Ok(())
+    }
+}
+
+gentl_api! {
+    pub fn DSQueueBuffer(hDataStream: DS_HANDLE, hBuffer: BUFFER_HANDLE) -> GenTlResult<()> {
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hDataStream)? };
+        let ds = handle.data_stream()?;
+
+        let ds_guard = ds.lock().unwrap();
+        ds_guard.buffers().lock().queue(buffer_handle(hBuffer)?)?;
+
+        Ok(())
+    }
+}
+
+gentl_api! {
+    pub fn DSFlushQueue(hDataStream: DS_HANDLE, iOperation: ACQ_QUEUE_TYPE) -> GenTlResult<()> {
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hDataStream)? };
+        let ds = handle.data_stream()?;
+
+        let operation = std::convert::TryInto::try_into(iOperation)?;
+        let ds_guard = ds.lock().unwrap();
+        ds_guard.buffers().lock().flush(operation);
+
+        Ok(())
+    }
+}
+
+gentl_api! {
+    pub fn DSStartAcquisition(
+        hDataStream: DS_HANDLE,
+        iStartFlags: ACQ_START_FLAGS,
+        iNumToAcquire: u64,
+    ) -> GenTlResult<()> {
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hDataStream)? };
+        let ds = handle.data_stream()?;
+
+        if iStartFlags != ACQ_START_FLAGS::ACQ_START_FLAGS_DEFAULT {
+            return Err(GenTlError::InvalidParameter);
+        }
+        let num_to_acquire = if iNumToAcquire == GENTL_INFINITE {
+            None
+        } else {
+            Some(iNumToAcquire)
+        };
+
+        ds.lock().unwrap().start_acquisition(num_to_acquire)?;
+
+        Ok(())
+    }
+}
+
+gentl_api! {
+    pub fn DSStopAcquisition(hDataStream: DS_HANDLE, iStopFlags: ACQ_STOP_FLAGS) -> GenTlResult<()> {
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hDataStream)? };
+        let ds = handle.data_stream()?;
+
+        // Streaming loop cancels pending transfers on stop, so `ACQ_STOP_FLAGS_KILL` is same as the
+        // default.
+        if iStopFlags != ACQ_STOP_FLAGS::ACQ_STOP_FLAGS_DEFAULT
+            && iStopFlags != ACQ_STOP_FLAGS::ACQ_STOP_FLAGS_KILL
+        {
+            return Err(GenTlError::InvalidParameter);
+        }
+
+        ds.lock().unwrap().stop_acquisition()?;
+
+        Ok(())
+    }
+}
+
+gentl_api! {
+    pub fn DSGetInfo(
+        hDataStream: DS_HANDLE,
+        iInfoCmd: STREAM_INFO_CMD,
+        piType: *mut INFO_DATATYPE,
+        pBuffer: *mut libc::c_void,
+        piSize: *mut libc::size_t,
+    ) -> GenTlResult<()> {
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hDataStream)? };
+        let ds = handle.data_stream()?;
+
+        ds_get_info(&ds, iInfoCmd, piType, pBuffer, piSize)
+    }
+}
+
+gentl_api! {
+    pub fn DSGetBufferID(
+        hDataStream: DS_HANDLE,
+        iIndex: u32,
+        phBuffer: *mut BUFFER_HANDLE,
+    ) -> GenTlResult<()> {
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hDataStream)? };
+        let ds = handle.data_stream()?;
+
+        let ds_guard = ds.lock().unwrap();
+        let buffer = ds_guard.buffers().lock().buffer_handle(iIndex as usize)?;
+        unsafe {
+            *phBuffer = buffer_raw_handle(buffer);
+        }
+
+        Ok(())
+    }
+}
+
+gentl_api! {
+    pub fn DSGetBufferInfo(
+        hDataStream: DS_HANDLE,
+        hBuffer: BUFFER_HANDLE,
+        iInfoCmd: BUFFER_INFO_CMD,
+        piType: *mut INFO_DATATYPE,
+        pBuffer: *mut libc::c_void,
+        piSize: *mut libc::size_t,
+    ) -> GenTlResult<()> {
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hDataStream)? };
+        let ds = handle.data_stream()?;
+
+        buffer_get_info(&ds, buffer_handle(hBuffer)?, iInfoCmd, piType, pBuffer, piSize)
+    }
+}
+
+gentl_api! {
+    pub fn DSGetParentDev(
+        hDataStream: DS_HANDLE,
+        phDevice: *mut device::DEV_HANDLE,
+    ) -> GenTlResult<()> {
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hDataStream)? };
+        let ds = handle.data_stream()?;
+
+        unsafe {
+            *phDevice = ds.parent_dev;
+        }
+
+        Ok(())
+    }
+}
+
+gentl_api! {
+    pub fn DSClose(hDataStream: DS_HANDLE) -> GenTlResult<()> {
+        let mut handle = unsafe { ModuleHandle::from_raw_manually_drop(hDataStream)? };
+        let ds = handle.data_stream()?;
+
+        // Close the data stream module, which stops acquisition and revokes all buffers.
+        ds.lock().unwrap().close()?;
+
+        // Drop the event handle of the data stream.
+        unsafe {
+            let mut event_handle = ModuleHandle::from_raw_manually_drop(ds.new_buffer_event)?;
+            std::mem::ManuallyDrop::drop(&mut event_handle);
+        }
+
+        // Drop the data stream handle.
+        unsafe {
+            std::mem::ManuallyDrop::drop(&mut handle)
+        }
+
+        Ok(())
+    }
+}
@@ -2,15 +2,16 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 
-use std::{convert::TryInto, ops::Deref, sync::Mutex};
+use std::{convert::TryInto, ffi::CStr, ops::Deref, sync::Mutex};
 
 use super::{
-    copy_info, imp, interface, GenTlError, GenTlResult, ModuleHandle, GC_ERROR, INFO_DATATYPE,
+    copy_info,
+    data_stream::{DataStreamModuleRef, DS_HANDLE},
+    imp, interface, GenTlError, GenTlResult, ModuleHandle, GC_ERROR, INFO_DATATYPE,
 };
 
 pub(super) type DEV_HANDLE = *mut libc::c_void;
 pub(super) type PORT_HANDLE = *mut libc::c_void;
-pub(super) type DS_HANDLE = *mut libc::c_void;
 
 #[derive(Clone, Copy)]
 pub(super) struct DeviceModuleRef<'a> {
@@ -204,14 +205,28 @@ gentl_api! {
         sDataStreamID: *mut libc::c_char,
         piSize: *mut libc::size_t,
     ) -> GenTlResult<()> {
-        todo!()
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hDevice)? };
+        let dev_handle = handle.device()?;
+
+        let id = dev_handle.lock().unwrap().data_stream_id(iIndex as usize)?;
+        copy_info(id.as_str(), sDataStreamID.cast(), piSize)?;
+
+        Ok(())
     }
 }
 
 gentl_api! {
     pub fn DevGetNumDataStreams(hDevice: DEV_HANDLE, piNumDataStreams: *mut u32) -> GenTlResult<()>
     {
-        todo!()
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hDevice)? };
+        let dev_handle = handle.device()?;
+
+        let num = dev_handle.lock().unwrap().num_data_streams()?;
+        unsafe {
+            *piNumDataStreams = num as u32;
+        }
+
+        Ok(())
     }
 }
 
@@ -234,7 +249,21 @@ gentl_api! {
         sDataStreamID: *const ::std::os::raw::c_char,
         phDataStream: *mut DS_HANDLE,
     ) -> GenTlResult<()> {
-        todo!()
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hDevice)? };
+        let dev_handle = handle.device()?;
+
+        let dev_guard = dev_handle.lock().unwrap();
+        let id = unsafe { CStr::from_ptr(sDataStreamID) }.to_string_lossy();
+        let ds = dev_guard.data_stream(&id)?;
+
+        ds.lock().unwrap().open()?;
+        let ds = DataStreamModuleRef::new(ds, hDevice);
+        let ds_handle = Box::new(ModuleHandle::DataStream(ds));
+        unsafe {
+            *phDataStream = ds_handle.into_raw();
+        }
+
+        Ok(())
     }
 }
 
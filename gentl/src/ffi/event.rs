@@ -0,0 +1,131 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+use std::{sync::Arc, time::Duration};
+
+use super::{data_stream, imp, GenTlError, GenTlResult, ModuleHandle, GC_ERROR};
+
+pub(super) type EVENTSRC_HANDLE = *mut libc::c_void;
+pub(super) type EVENT_HANDLE = *mut libc::c_void;
+
+/// Event object of a module.
+pub(super) enum EventRef {
+    /// `EVENT_NEW_BUFFER` of a data stream module.
+    NewBuffer(Arc<imp::data_stream::StreamBuffers>),
+}
+
+newtype_enum! {
+    pub enum EVENT_TYPE {
+        EVENT_ERROR = 0,
+        EVENT_NEW_BUFFER = 1,
+        EVENT_FEATURE_INVALIDATE = 2,
+        EVENT_FEATURE_CHANGE = 3,
+        EVENT_REMOTE_DEVICE = 4,
+        EVENT_MODULE = 5,
+        EVENT_CUSTOM_ID = 1000,
+    }
+}
+
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct EVENT_NEW_BUFFER_DATA {
+    pub BufferHandle: data_stream::BUFFER_HANDLE,
+    pub pUserPointer: *mut libc::c_void,
+}
+
+gentl_api! {
+    pub fn GCRegisterEvent(
+        hEventSrc: EVENTSRC_HANDLE,
+        iEventID: EVENT_TYPE,
+        phEvent: *mut EVENT_HANDLE,
+    ) -> GenTlResult<()> {
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hEventSrc)? };
+
+        // The event object of a data stream is created when the data stream is opened, and lives
+        // until the data stream is closed.
+        match (handle.data_stream(), iEventID) {
+            (Ok(ds), EVENT_TYPE::EVENT_NEW_BUFFER) => {
+                unsafe {
+                    *phEvent = ds.new_buffer_event;
+                }
+                Ok(())
+            }
+            _ => Err(GenTlError::NotImplemented),
+        }
+    }
+}
+
+gentl_api! {
+    pub fn GCUnregisterEvent(hEventSrc: EVENTSRC_HANDLE, iEventID: EVENT_TYPE) -> GenTlResult<()> {
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hEventSrc)? };
+
+        match (handle.data_stream(), iEventID) {
+            (Ok(_), EVENT_TYPE::EVENT_NEW_BUFFER) => Ok(()),
+            _ => Err(GenTlError::NotImplemented),
+        }
+    }
+}
+
+gentl_api! {
+    pub fn EventGetData(
+        hEvent: EVENT_HANDLE,
+        pBuffer: *mut libc::c_void,
+        piSize: *mut libc::size_t,
+        iTimeout: u64,
+    ) -> GenTlResult<()> {
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hEvent)? };
+        let timeout = if iTimeout == data_stream::GENTL_INFINITE {
+            None
+        } else {
+            Some(Duration::from_millis(iTimeout))
+        };
+
+        match handle.event()? {
+            EventRef::NewBuffer(buffers) => {
+                let len = std::mem::size_of::<EVENT_NEW_BUFFER_DATA>();
+                if piSize.is_null() || unsafe { *piSize } < len || pBuffer.is_null() {
+                    return Err(GenTlError::BufferTooSmall);
+                }
+
+                let (buffer, user_ptr) = buffers.wait_new_buffer(timeout)?;
+                unsafe {
+                    pBuffer.cast::<EVENT_NEW_BUFFER_DATA>().write_unaligned(EVENT_NEW_BUFFER_DATA {
+                        BufferHandle: buffer.0 as data_stream::BUFFER_HANDLE,
+                        pUserPointer: user_ptr,
+                    });
+                    *piSize = len;
+                }
+            }
+        }
+
+        Ok(())
+    }
+}
+
+gentl_api! {
+    pub fn EventKill(hEvent: EVENT_HANDLE) -> GenTlResult<()> {
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hEvent)? };
+
+        match handle.event()? {
+            EventRef::NewBuffer(buffers) => buffers.kill_wait(),
+        }
+
+        Ok(())
+    }
+}
+
+gentl_api! {
+    pub fn EventFlush(hEvent: EVENT_HANDLE) -> GenTlResult<()> {
+        let handle = unsafe { ModuleHandle::from_raw_manually_drop(hEvent)? };
+
+        // Buffers in the output queue are the pending events of `EVENT_NEW_BUFFER`.
+        match handle.event()? {
+            EventRef::NewBuffer(buffers) => buffers
+                .lock()
+                .flush(imp::data_stream::FlushOperation::OutputDiscard),
+        }
+
+        Ok(())
+    }
+}
@@ -5,7 +5,9 @@
 #[macro_use]
 mod macros;
 
+pub mod data_stream;
 pub mod device;
+pub mod event;
 pub mod interface;
 pub mod port;
 pub mod system;
@@ -118,6 +120,8 @@ enum ModuleHandle<'a> {
     Interface(interface::InterfaceModuleRef<'a>),
     Device(device::DeviceModuleRef<'a>),
     RemoteDevice(device::RemoteDeviceRef<'a>),
+    DataStream(data_stream::DataStreamModuleRef<'a>),
+    Event(event::EventRef),
 }
 
 impl<'a> ModuleHandle<'a> {
@@ -142,6 +146,20 @@ impl<'a> ModuleHandle<'a> {
         }
     }
 
+    fn data_stream(&self) -> GenTlResult<data_stream::DataStreamModuleRef<'a>> {
+        match self {
+            ModuleHandle::DataStream(ds) => Ok(*ds),
+            _ => Err(GenTlError::InvalidHandle),
+        }
+    }
+
+    fn event(&self) -> GenTlResult<&event::EventRef> {
+        match self {
+            ModuleHandle::Event(event) => Ok(event),
+            _ => Err(GenTlError::InvalidHandle),
+        }
+    }
+
     unsafe fn from_raw_manually_drop(
         raw_handle: *mut libc::c_void,
     ) -> GenTlResult<ManuallyDrop<Box<ModuleHandle<'a>>>> {
@@ -407,6 +425,8 @@ impl_copy_to_for_numeric!(i32, INFO_DATATYPE::INFO_DATATYPE_INT32);
 impl_copy_to_for_numeric!(u32, INFO_DATATYPE::INFO_DATATYPE_UINT32);
 impl_copy_to_for_numeric!(i64, INFO_DATATYPE::INFO_DATATYPE_INT64);
 impl_copy_to_for_numeric!(u64, INFO_DATATYPE::INFO_DATATYPE_UINT64);
+impl_copy_to_for_numeric!(usize, INFO_DATATYPE::INFO_DATATYPE_SIZET);
+impl_copy_to_for_numeric!(*mut libc::c_void, INFO_DATATYPE::INFO_DATATYPE_PTR);
 
 fn assert_lib_initialized() -> GenTlResult<()> {
     if *IS_LIB_INITIALIZED.read().unwrap() {
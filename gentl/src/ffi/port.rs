@@ -28,6 +28,8 @@ newtype_enum! {
         PORT_INFO_VERSION = 11,
         PORT_INFO_PORTNAME = 12,
         PORT_INFO_CUSTOM_ID = 1000,
+        /// Custom command to query whether stacked port access is handled in a single transaction.
+        PORT_INFO_STACKED_SUPPORTED = 1001,
     }
 }
 
@@ -79,6 +81,15 @@ macro_rules! with_port {
                 let mut $port = handle.lock().unwrap();
                 $body
             }
+
+            // Data stream modules don't expose their own port.
+            ModuleHandle::DataStream(..) => {
+                return Err(GenTlError::NotImplemented);
+            }
+
+            ModuleHandle::Event(..) => {
+                return Err(GenTlError::InvalidHandle);
+            }
         }
     };
 }
@@ -211,6 +222,11 @@ gentl_api! {
                     copy_info(info.port_name.as_str(), pBuffer, piSize)
                 }
 
+                PORT_INFO_CMD::PORT_INFO_STACKED_SUPPORTED => {
+                    let is_stacked_supported: bool8_t = info.is_stacked_supported.into();
+                    copy_info(is_stacked_supported, pBuffer, piSize)
+                }
+
                 _ => Err(GenTlError::InvalidParameter),
             }
         })?;
@@ -0,0 +1,583 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+//! Data Stream module and its buffers.
+//!
+//! An announced buffer is in one of the following states.
+//! * Announced: The buffer is known to the module but is not queued.
+//! * Queued: The buffer is in the input pool. While acquisition is running, the buffer is lent to
+//!   the [`PayloadBufferPool`] of the stream, so the payload is received directly into it.
+//! * Filled: The buffer is in the output queue, or delivered to the consumer by `EventGetData`.
+//!   The received payload is kept in the buffer until it's queued again.
+
+use std::{
+    collections::VecDeque,
+    ptr::NonNull,
+    sync::{Arc, Condvar, Mutex, MutexGuard},
+    time::{Duration, Instant},
+};
+
+use cameleon::payload::{BufferAllocator, HeapAllocator, Payload, PayloadBufferPool};
+
+use crate::{GenTlError, GenTlResult};
+
+pub(crate) mod u3v;
+
+pub(crate) trait DataStream {
+    /// Open the data stream.
+    fn open(&mut self) -> GenTlResult<()>;
+
+    /// Close the data stream. Acquisition is stopped and all buffers are revoked.
+    fn close(&mut self) -> GenTlResult<()>;
+
+    /// Returns `true` if the data stream is opened.
+    fn is_opened(&self) -> bool;
+
+    /// ID of the data stream module.
+    fn stream_id(&self) -> &str;
+
+    /// Buffers of the data stream.
+    fn buffers(&self) -> &Arc<StreamBuffers>;
+
+    /// Starts acquisition. `num_to_acquire` is the number of buffers to fill before stopping
+    /// acquisition automatically, or `None` to acquire until [`DataStream::stop_acquisition`].
+    fn start_acquisition(&mut self, num_to_acquire: Option<u64>) -> GenTlResult<()>;
+
+    /// Stops acquisition. Queued buffers are kept in the input pool.
+    fn stop_acquisition(&mut self) -> GenTlResult<()>;
+
+    /// Returns `true` if acquisition is running.
+    fn is_grabbing(&self) -> bool;
+
+    /// The number of bytes of a payload the device sends.
+    fn payload_size(&self) -> GenTlResult<usize>;
+}
+
+/// Handle of a buffer announced to a data stream. A handle is never reused in the data stream.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub(crate) struct BufferHandle(pub(crate) usize);
+
+/// Operations of `DSFlushQueue`.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub(crate) enum FlushOperation {
+    /// Moves buffers in the input pool to the output queue without data.
+    InputToOutput,
+    /// Discards buffers in the output queue.
+    OutputDiscard,
+    /// Moves buffers in the output queue and unqueued buffers to the input pool.
+    AllToInput,
+    /// Moves unqueued buffers to the input pool.
+    UnqueuedToInput,
+    /// Discards buffers in the input pool and the output queue.
+    AllDiscard,
+}
+
+/// Information of a buffer, which is a snapshot at the time it's queried.
+pub(crate) struct BufferInfo<'a> {
+    pub(crate) base: *mut u8,
+    pub(crate) size: usize,
+    pub(crate) user_ptr: *mut libc::c_void,
+    pub(crate) is_queued: bool,
+    /// The payload received into the buffer, if any.
+    pub(crate) payload: Option<&'a Payload>,
+}
+
+/// Buffers of a data stream, shared with the thread receiving payloads and `EventGetData` of
+/// `EVENT_NEW_BUFFER`, both of which don't lock the data stream module itself.
+pub(crate) struct StreamBuffers {
+    table: Mutex<BufferTable>,
+    /// Notified when a buffer is pushed to the output queue or waiting is killed.
+    output_cond: Condvar,
+}
+
+impl StreamBuffers {
+    pub(crate) fn new() -> Self {
+        Self {
+            table: Mutex::new(BufferTable::default()),
+            output_cond: Condvar::new(),
+        }
+    }
+
+    pub(crate) fn lock(&self) -> MutexGuard<'_, BufferTable> {
+        self.table.lock().unwrap()
+    }
+
+    /// Pushes the buffer which `payload` was received into to the output queue.
+    pub(crate) fn deliver(&self, payload: Payload) -> Option<BufferHandle> {
+        let handle = self.lock().fill(payload);
+        if handle.is_some() {
+            self.output_cond.notify_one();
+        }
+        handle
+    }
+
+    /// Waits for a buffer pushed to the output queue, and delivers it to the consumer.
+    /// `None` timeout waits infinitely.
+    pub(crate) fn wait_new_buffer(
+        &self,
+        timeout: Option<Duration>,
+    ) -> GenTlResult<(BufferHandle, *mut libc::c_void)> {
+        let deadline = timeout.map(|timeout| Instant::now() + timeout);
+        let mut table = self.lock();
+        loop {
+            if table.kill_requests > 0 {
+                table.kill_requests -= 1;
+                return Err(GenTlError::Abort);
+            }
+            if let Some(handle) = table.output.pop_front() {
+                let user_ptr = table.buffer(handle)?.user_ptr.0;
+                return Ok((handle, user_ptr));
+            }
+
+            table = match deadline {
+                Some(deadline) => {
+                    let now = Instant::now();
+                    if now >= deadline {
+                        return Err(GenTlError::Timeout);
+                    }
+                    self.output_cond
+                        .wait_timeout(table, deadline - now)
+                        .unwrap()
+                        .0
+                }
+                None => self.output_cond.wait(table).unwrap(),
+            };
+        }
+    }
+
+    /// Makes a thread waiting in [`Self::wait_new_buffer`] return with [`GenTlError::Abort`].
+    /// If no thread is waiting, the next wait is aborted.
+    pub(crate) fn kill_wait(&self) {
+        self.lock().kill_requests += 1;
+        self.output_cond.notify_one();
+    }
+}
+
+#[derive(Default)]
+pub(crate) struct BufferTable {
+    /// Announced buffers in the order of announcement.
+    buffers: Vec<(BufferHandle, Buffer)>,
+    /// Filled buffers which are not delivered to the consumer yet.
+    output: VecDeque<BufferHandle>,
+    /// The pool which queued buffers are lent to while acquisition is running.
+    pool: Option<PayloadBufferPool>,
+    next_handle: usize,
+    kill_requests: usize,
+    /// The number of buffers filled since the module is opened.
+    pub(crate) num_delivered: u64,
+    /// The number of payloads lost because the input pool was empty.
+    pub(crate) num_underrun: u64,
+    /// The number of buffers filled since acquisition is started.
+    pub(crate) num_started: u64,
+}
+
+struct Buffer {
+    ptr: RawPtr<u8>,
+    size: usize,
+    user_ptr: RawPtr<libc::c_void>,
+    /// `true` if the memory is allocated by `DSAllocAndAnnounceBuffer`.
+    allocated: bool,
+    state: BufferState,
+}
+
+enum BufferState {
+    Announced,
+    Queued,
+    /// The payload and the pool which it's received from. Payload is `None` if the buffer is moved
+    /// to the output queue by [`FlushOperation::InputToOutput`].
+    Filled(Option<(Payload, PayloadBufferPool)>),
+}
+
+/// Pointer owned by the consumer, which is only dereferenced while it's announced.
+#[derive(Clone, Copy)]
+struct RawPtr<T>(*mut T);
+
+// Safety: The consumer guarantees that the memory is valid while it's announced.
+unsafe impl<T> Send for RawPtr<T> {}
+
+impl BufferTable {
+    /// Announces a buffer allocated by the consumer.
+    ///
+    /// # Safety
+    /// `ptr` MUST be valid for reads and writes of `size` bytes until the buffer is revoked.
+    pub(crate) unsafe fn announce(
+        &mut self,
+        ptr: NonNull<u8>,
+        size: usize,
+        user_ptr: *mut libc::c_void,
+    ) -> GenTlResult<BufferHandle> {
+        if self
+            .buffers
+            .iter()
+            .any(|(_, buf)| buf.ptr.0 == ptr.as_ptr())
+        {
+            return Err(GenTlError::ResourceInUse);
+        }
+        Ok(self.push(ptr, size, user_ptr, false))
+    }
+
+    /// Allocates a buffer and announces it.
+    pub(crate) fn alloc_and_announce(
+        &mut self,
+        size: usize,
+        user_ptr: *mut libc::c_void,
+    ) -> GenTlResult<BufferHandle> {
+        let ptr = HeapAllocator
+            .allocate(size)
+            .ok_or(GenTlError::OutOfMemory)?;
+        Ok(self.push(ptr, size, user_ptr, true))
+    }
+
+    /// Revokes the buffer, and returns the memory announced by the consumer and the user pointer.
+    /// The memory is `None` if it's allocated by the module.
+    pub(crate) fn revoke(
+        &mut self,
+        handle: BufferHandle,
+    ) -> GenTlResult<(Option<NonNull<u8>>, *mut libc::c_void)> {
+        let pos = self.position(handle)?;
+        if matches!(self.buffers[pos].1.state, BufferState::Queued) || self.output.contains(&handle)
+        {
+            return Err(GenTlError::Busy);
+        }
+
+        self.discard(pos);
+        let (_, buf) = self.buffers.remove(pos);
+        if buf.allocated {
+            // Safety: The memory is allocated by `alloc_and_announce` with the same size and it's
+            // not lent to any pool.
+            unsafe { HeapAllocator.deallocate(NonNull::new_unchecked(buf.ptr.0), buf.size) };
+            Ok((None, buf.user_ptr.0))
+        } else {
+            Ok((NonNull::new(buf.ptr.0), buf.user_ptr.0))
+        }
+    }
+
+    /// Puts the buffer into the input pool.
+    pub(crate) fn queue(&mut self, handle: BufferHandle) -> GenTlResult<()> {
+        let pos = self.position(handle)?;
+        match self.buffers[pos].1.state {
+            BufferState::Queued => return Err(GenTlError::Busy),
+            BufferState::Filled(..) => {
+                self.output.retain(|h| *h != handle);
+                self.discard(pos);
+            }
+            BufferState::Announced => {}
+        }
+
+        let buf = &mut self.buffers[pos].1;
+        if let Some(pool) = &self.pool {
+            // Safety: The memory is valid until the buffer is revoked, and a queued buffer can't
+            // be revoked.
+            if !unsafe { pool.lend(NonNull::new_unchecked(buf.ptr.0), buf.size) } {
+                return Err(GenTlError::BufferTooSmall);
+            }
+        }
+        buf.state = BufferState::Queued;
+        Ok(())
+    }
+
+    pub(crate) fn flush(&mut self, operation: FlushOperation) {
+        use FlushOperation::{
+            AllDiscard, AllToInput, InputToOutput, OutputDiscard, UnqueuedToInput,
+        };
+
+        match operation {
+            InputToOutput => {
+                for pos in 0..self.buffers.len() {
+                    if matches!(self.buffers[pos].1.state, BufferState::Queued) && self.unlend(pos)
+                    {
+                        let (handle, buf) = &mut self.buffers[pos];
+                        buf.state = BufferState::Filled(None);
+                        self.output.push_back(*handle);
+                    }
+                }
+            }
+            OutputDiscard => self.discard_output(),
+            AllToInput => {
+                self.discard_output();
+                self.queue_unqueued();
+            }
+            UnqueuedToInput => self.queue_unqueued(),
+            AllDiscard => {
+                self.discard_output();
+                for pos in 0..self.buffers.len() {
+                    if matches!(self.buffers[pos].1.state, BufferState::Queued) && self.unlend(pos)
+                    {
+                        self.buffers[pos].1.state = BufferState::Announced;
+                    }
+                }
+            }
+        }
+    }
+
+    /// Lends all queued buffers to `pool`, and makes `pool` receive buffers queued later.
+    ///
+    /// Fails if any queued buffer is smaller than the buffer size of `pool`.
+    pub(crate) fn attach_pool(&mut self, pool: PayloadBufferPool) -> GenTlResult<()> {
+        let queued = self
+            .buffers
+            .iter()
+            .filter(|(_, buf)| matches!(buf.state, BufferState::Queued));
+        if queued.clone().next().is_none() {
+            return Err(GenTlError::InvalidBuffer);
+        }
+        if queued.clone().any(|(_, buf)| buf.size < pool.buffer_size()) {
+            return Err(GenTlError::BufferTooSmall);
+        }
+
+        for (_, buf) in queued {
+            // Safety: Same as `queue`.
+            unsafe { pool.lend(NonNull::new_unchecked(buf.ptr.0), buf.size) };
+        }
+        self.pool = Some(pool);
+        self.num_started = 0;
+        Ok(())
+    }
+
+    /// Takes back queued buffers from the pool attached by [`Self::attach_pool`].
+    ///
+    /// The stream must not hold any buffer of the pool.
+    pub(crate) fn detach_pool(&mut self) {
+        if let Some(pool) = self.pool.take() {
+            for (_, buf) in &self.buffers {
+                if matches!(buf.state, BufferState::Queued) {
+                    // Safety: The pointer of an announced buffer is never null.
+                    pool.take_back(unsafe { NonNull::new_unchecked(buf.ptr.0) });
+                }
+            }
+        }
+    }
+
+    pub(crate) fn buffer_handle(&self, index: usize) -> GenTlResult<BufferHandle> {
+        self.buffers
+            .get(index)
+            .map(|(handle, _)| *handle)
+            .ok_or(GenTlError::InvalidIndex)
+    }
+
+    pub(crate) fn buffer_info(&self, handle: BufferHandle) -> GenTlResult<BufferInfo<'_>> {
+        let buf = self.buffer(handle)?;
+        let payload = match &buf.state {
+            BufferState::Filled(Some((payload, _))) => Some(payload),
+            _ => None,
+        };
+        Ok(BufferInfo {
+            base: buf.ptr.0,
+            size: buf.size,
+            user_ptr: buf.user_ptr.0,
+            is_queued: matches!(buf.state, BufferState::Queued),
+            payload,
+        })
+    }
+
+    pub(crate) fn num_announced(&self) -> usize {
+        self.buffers.len()
+    }
+
+    pub(crate) fn num_queued(&self) -> usize {
+        self.buffers
+            .iter()
+            .filter(|(_, buf)| matches!(buf.state, BufferState::Queued))
+            .count()
+    }
+
+    pub(crate) fn num_await_delivery(&self) -> usize {
+        self.output.len()
+    }
+
+    /// Revokes all buffers. Acquisition must be stopped.
+    pub(crate) fn clear(&mut self) {
+        self.detach_pool();
+        self.output.clear();
+        for pos in 0..self.buffers.len() {
+            self.buffers[pos].1.state = BufferState::Announced;
+        }
+        while let Some((handle, _)) = self.buffers.last() {
+            let handle = *handle;
+            self.revoke(handle).ok();
+        }
+        self.kill_requests = 0;
+    }
+
+    fn push(
+        &mut self,
+        ptr: NonNull<u8>,
+        size: usize,
+        user_ptr: *mut libc::c_void,
+        allocated: bool,
+    ) -> BufferHandle {
+        self.next_handle += 1;
+        let handle = BufferHandle(self.next_handle);
+        self.buffers.push((
+            handle,
+            Buffer {
+                ptr: RawPtr(ptr.as_ptr()),
+                size,
+                user_ptr: RawPtr(user_ptr),
+                allocated,
+                state: BufferState::Announced,
+            },
+        ));
+        handle
+    }
+
+    fn fill(&mut self, payload: Payload) -> Option<BufferHandle> {
+        let pool = self.pool.clone()?;
+        let ptr = payload.payload().as_ptr();
+        match self.buffers.iter_mut().find(|(_, buf)| {
+            std::ptr::eq(buf.ptr.0, ptr) && matches!(buf.state, BufferState::Queued)
+        }) {
+            Some((handle, buf)) => {
+                buf.state = BufferState::Filled(Some((payload, pool)));
+                self.output.push_back(*handle);
+                self.num_delivered += 1;
+                self.num_started += 1;
+                Some(*handle)
+            }
+            None => {
+                // The payload is received into a buffer out of the pool.
+                self.num_underrun += 1;
+                None
+            }
+        }
+    }
+
+    fn buffer(&self, handle: BufferHandle) -> GenTlResult<&Buffer> {
+        Ok(&self.buffers[self.position(handle)?].1)
+    }
+
+    fn position(&self, handle: BufferHandle) -> GenTlResult<usize> {
+        self.buffers
+            .iter()
+            .position(|(h, _)| *h == handle)
+            .ok_or(GenTlError::InvalidHandle)
+    }
+
+    /// Drops the payload of a filled buffer and takes the buffer back from its pool. The buffer
+    /// gets announced state.
+    fn discard(&mut self, pos: usize) {
+        let buf = &mut self.buffers[pos].1;
+        if let BufferState::Filled(Some((payload, pool))) =
+            std::mem::replace(&mut buf.state, BufferState::Announced)
+        {
+            // Dropping the payload returns the buffer to its pool.
+            drop(payload);
+            // Safety: The pointer of an announced buffer is never null.
+            pool.take_back(unsafe { NonNull::new_unchecked(buf.ptr.0) });
+        }
+    }
+
+    fn discard_output(&mut self) {
+        while let Some(handle) = self.output.pop_front() {
+            if let Ok(pos) = self.position(handle) {
+                self.discard(pos);
+            }
+        }
+    }
+
+    fn queue_unqueued(&mut self) {
+        for pos in 0..self.buffers.len() {
+            if matches!(self.buffers[pos].1.state, BufferState::Announced) {
+                let handle = self.buffers[pos].0;
+                self.queue(handle).ok();
+            }
+        }
+    }
+
+    /// Takes back the queued buffer from the pool. Returns `false` if the buffer is being filled.
+    fn unlend(&self, pos: usize) -> bool {
+        let buf = &self.buffers[pos].1;
+        match &self.pool {
+            // Safety: The pointer of an announced buffer is never null.
+            Some(pool) => pool.take_back(unsafe { NonNull::new_unchecked(buf.ptr.0) }),
+            None => true,
+        }
+    }
+}
+
+impl Drop for BufferTable {
+    fn drop(&mut self) {
+        self.clear();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_buffer_states() {
+        let buffers = StreamBuffers::new();
+        let mut mem = vec![0_u8; 32];
+        let user_ptr = std::ptr::dangling_mut::<libc::c_void>();
+
+        let (h1, h2) = {
+            let mut table = buffers.lock();
+            let h1 =
+                unsafe { table.announce(NonNull::new(mem.as_mut_ptr()).unwrap(), 32, user_ptr) }
+                    .unwrap();
+            let h2 = table.alloc_and_announce(32, std::ptr::null_mut()).unwrap();
+            assert_eq!(table.buffer_handle(1).unwrap(), h2);
+
+            // Acquisition can't be started without queued buffers.
+            let pool = PayloadBufferPool::external(32);
+            assert!(matches!(
+                table.attach_pool(pool.clone()),
+                Err(GenTlError::InvalidBuffer)
+            ));
+
+            table.queue(h1).unwrap();
+            assert!(matches!(table.queue(h1), Err(GenTlError::Busy)));
+            table.flush(FlushOperation::UnqueuedToInput);
+            assert_eq!(table.num_queued(), 2);
+            table.attach_pool(pool).unwrap();
+            (h1, h2)
+        };
+
+        // The streaming loop receives payloads into queued buffers in the order they are queued.
+        let pool = buffers.lock().pool.clone().unwrap();
+        let filling = pool.acquire().unwrap();
+        assert_eq!(filling.as_ptr(), mem.as_ptr());
+        assert!(matches!(
+            buffers.wait_new_buffer(Some(Duration::from_millis(10))),
+            Err(GenTlError::Timeout)
+        ));
+
+        buffers.kill_wait();
+        assert!(matches!(
+            buffers.wait_new_buffer(None),
+            Err(GenTlError::Abort)
+        ));
+
+        {
+            let mut table = buffers.lock();
+            // Queued buffer can't be revoked.
+            assert!(matches!(table.revoke(h2), Err(GenTlError::Busy)));
+            // The buffer being filled is kept in the input pool.
+            table.flush(FlushOperation::InputToOutput);
+            assert_eq!(table.num_await_delivery(), 1);
+            assert!(table.buffer_info(h1).unwrap().is_queued);
+            assert!(table.buffer_info(h2).unwrap().payload.is_none());
+        }
+        assert_eq!(
+            buffers.wait_new_buffer(Some(Duration::ZERO)).unwrap(),
+            (h2, std::ptr::null_mut())
+        );
+        drop(filling);
+
+        let mut table = buffers.lock();
+        // The delivered buffer is lent to the pool again.
+        table.queue(h2).unwrap();
+        assert_eq!(pool.available(), 2);
+        table.flush(FlushOperation::AllDiscard);
+        assert_eq!((table.num_queued(), pool.available()), (0, 0));
+
+        table.detach_pool();
+        let (ptr, revoked_user_ptr) = table.revoke(h1).unwrap();
+        assert_eq!(ptr.unwrap().as_ptr(), mem.as_mut_ptr());
+        assert_eq!(revoked_user_ptr, user_ptr);
+        assert_eq!(table.revoke(h2).unwrap().0, None);
+        assert_eq!(table.num_announced(), 0);
+    }
+}
@@ -0,0 +1,186 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+use std::{
+    sync::{Arc, Mutex},
+    thread::{self, JoinHandle},
+};
+
+use cameleon::{
+    payload::{self, PayloadBufferPool},
+    u3v::{SharedControlHandle, StreamHandle, StreamParams},
+    PayloadStream, StreamError, StreamResult,
+};
+
+use crate::{GenTlError, GenTlResult};
+
+use super::{DataStream, StreamBuffers};
+
+/// Capacity of the channel between the streaming loop and the thread filling buffers. Payloads
+/// are moved to the output queue as soon as they arrive, so a small capacity is enough.
+const CHANNEL_CAPACITY: usize = 4;
+
+pub(crate) struct U3VDataStreamModule {
+    /// Shared with the forwarder, which stops acquisition once `num_to_acquire` buffers are
+    /// filled.
+    strm: Arc<Mutex<StreamHandle>>,
+    ctrl: SharedControlHandle,
+    buffers: Arc<StreamBuffers>,
+    is_opened: bool,
+    /// The thread moving received payloads to the output queue while acquisition is running.
+    /// It returns the result of stopping acquisition.
+    forwarder: Option<JoinHandle<StreamResult<()>>>,
+}
+
+impl U3VDataStreamModule {
+    pub(crate) fn new(strm: StreamHandle, ctrl: SharedControlHandle) -> Self {
+        Self {
+            strm: Arc::new(Mutex::new(strm)),
+            ctrl,
+            buffers: Arc::new(StreamBuffers::new()),
+            is_opened: false,
+            forwarder: None,
+        }
+    }
+
+    fn assert_open(&self) -> GenTlResult<()> {
+        if self.is_opened {
+            Ok(())
+        } else {
+            Err(GenTlError::NotInitialized)
+        }
+    }
+}
+
+impl DataStream for U3VDataStreamModule {
+    fn open(&mut self) -> GenTlResult<()> {
+        if self.is_opened {
+            return Err(GenTlError::ResourceInUse);
+        }
+
+        self.strm.lock().unwrap().open()?;
+        self.is_opened = true;
+        Ok(())
+    }
+
+    fn close(&mut self) -> GenTlResult<()> {
+        if !self.is_opened {
+            return Ok(());
+        }
+
+        if self.forwarder.is_some() {
+            self.stop_acquisition()?;
+        }
+        self.buffers.lock().clear();
+        self.is_opened = false;
+        self.strm.lock().unwrap().close()?;
+        Ok(())
+    }
+
+    fn is_opened(&self) -> bool {
+        self.is_opened
+    }
+
+    fn stream_id(&self) -> &str {
+        "Stream0"
+    }
+
+    fn buffers(&self) -> &Arc<StreamBuffers> {
+        &self.buffers
+    }
+
+    fn start_acquisition(&mut self, num_to_acquire: Option<u64>) -> GenTlResult<()> {
+        self.assert_open()?;
+        if self.is_grabbing() {
+            return Err(GenTlError::ResourceInUse);
+        }
+        // Reap the forwarder of the acquisition which has stopped by itself.
+        if let Some(forwarder) = self.forwarder.take() {
+            forwarder.join().ok();
+        }
+
+        let pool = PayloadBufferPool::external(self.payload_size()?);
+        self.buffers.lock().attach_pool(pool.clone())?;
+        let mut strm = self.strm.lock().unwrap();
+        strm.set_buffer_pool(Some(pool));
+
+        let (sender, receiver) = payload::channel(CHANNEL_CAPACITY, CHANNEL_CAPACITY);
+        if let Err(err) = strm.start_streaming_loop(sender, &mut self.ctrl) {
+            self.buffers.lock().detach_pool();
+            strm.set_buffer_pool(None);
+            return Err(err.into());
+        }
+        drop(strm);
+
+        let strm = self.strm.clone();
+        let buffers = self.buffers.clone();
+        self.forwarder = Some(thread::spawn(move || {
+            let mut count = 0;
+            loop {
+                match receiver.recv_blocking() {
+                    Ok(payload) => {
+                        if buffers.deliver(payload).is_some() {
+                            count += 1;
+                            if num_to_acquire == Some(count) {
+                                break;
+                            }
+                        }
+                    }
+                    // The channel is closed when the streaming loop is stopped.
+                    Err(StreamError::ReceiveError(..)) => break,
+                    // A broken payload is lost, and the loop keeps streaming.
+                    Err(_) => {}
+                }
+            }
+
+            finish_acquisition(&strm, &buffers)
+        }));
+
+        Ok(())
+    }
+
+    fn stop_acquisition(&mut self) -> GenTlResult<()> {
+        let forwarder = match self.forwarder.take() {
+            Some(forwarder) => forwarder,
+            None => return Err(GenTlError::ResourceInUse),
+        };
+
+        let result = finish_acquisition(&self.strm, &self.buffers);
+        // The streaming loop drops the sender on exit, which ends the forwarder.
+        let forwarded = forwarder
+            .join()
+            .map_err(|_| GenTlError::Error("the forwarder thread panicked".into()))?;
+        result.and(forwarded)?;
+        Ok(())
+    }
+
+    fn is_grabbing(&self) -> bool {
+        // The forwarder exits when acquisition stops, including when `num_to_acquire` buffers
+        // are filled.
+        matches!(&self.forwarder, Some(forwarder) if !forwarder.is_finished())
+    }
+
+    fn payload_size(&self) -> GenTlResult<usize> {
+        let params = StreamParams::from_control(&mut self.ctrl.clone())?;
+        Ok(params.maximum_payload_size())
+    }
+}
+
+/// Stops the streaming loop and takes back the queued buffers from the payload pool.
+///
+/// Stopping is idempotent, so both the forwarder and [`DataStream::stop_acquisition`] may call
+/// this.
+fn finish_acquisition(strm: &Mutex<StreamHandle>, buffers: &StreamBuffers) -> StreamResult<()> {
+    let mut strm = strm.lock().unwrap();
+    let result = strm.stop_streaming_loop();
+    strm.set_buffer_pool(None);
+    buffers.lock().detach_pool();
+    result
+}
+
+impl Drop for U3VDataStreamModule {
+    fn drop(&mut self) {
+        self.close().ok();
+    }
+}
@@ -8,7 +8,10 @@ use crate::{GenTlError, GenTlResult};
 
 pub(crate) mod u3v;
 
-use crate::imp::port::{Port, TlType};
+use crate::imp::{
+    data_stream::DataStream,
+    port::{Port, TlType},
+};
 
 mod u3v_genapi;
 
@@ -103,6 +106,15 @@ pub(crate) trait Device: Port {
     /// Port of the remote device.
     fn remote_device(&self) -> GenTlResult<&Mutex<dyn Port>>;
 
+    /// The number of data streams of the device.
+    fn num_data_streams(&self) -> GenTlResult<usize>;
+
+    /// ID of the data stream at `index`.
+    fn data_stream_id(&self, index: usize) -> GenTlResult<String>;
+
+    /// Data stream module with `id`.
+    fn data_stream(&self, id: &str) -> GenTlResult<&Mutex<dyn DataStream>>;
+
     /// Vendor name of the remote device.
     fn vendor_name(&self) -> GenTlResult<String>;
 
@@ -6,12 +6,18 @@ use std::{convert::TryFrom, sync::Mutex};
 
 use cameleon::{
     genapi::{CompressionType, SharedDefaultGenApiCtxt},
-    u3v::{self, SharedControlHandle, StreamHandle},
+    u3v::{
+        self,
+        register_map::{Abrm, GenICamFileType},
+        SharedControlHandle, StreamHandle,
+    },
+    DeviceControl,
 };
 use cameleon_impl::memory::prelude::*;
 
 use crate::{
     imp::{
+        data_stream::{u3v::U3VDataStreamModule, DataStream},
         genapi_common,
         port::{Endianness, ModuleType, Port, PortAccess, PortInfo, TlType, XmlInfo, XmlLocation},
     },
@@ -24,16 +30,27 @@ use genapi::GenApiReg;
 type Camera = cameleon::Camera<SharedControlHandle, StreamHandle, SharedDefaultGenApiCtxt>;
 
 pub(crate) fn enumerate_u3v_device() -> GenTlResult<Vec<U3VDeviceModule>> {
-    todo!()
+    u3v::enumerate_cameras()?
+        .into_iter()
+        .map(|camera| {
+            let cameleon::Camera {
+                ctrl, strm, info, ..
+            } = camera;
+            U3VDeviceModule::new(Camera::new(ctrl.into(), strm, None, info))
+        })
+        .collect()
 }
 
 pub(crate) struct U3VDeviceModule {
     vm: genapi::Memory,
     port_info: PortInfo,
     xml_infos: Vec<XmlInfo>,
+    device_info: u3v::DeviceInfo,
 
-    camera: Camera,
+    ctrl: SharedControlHandle,
+    ctxt: Option<SharedDefaultGenApiCtxt>,
     remote_device: Option<Box<Mutex<U3VRemoteDevice>>>,
+    data_stream: Box<Mutex<U3VDataStreamModule>>,
 
     /// Current status of the device.  
     /// `DeviceAccessStatus` and `DeviceAccessStatusReg` in VM doesn't reflect this value while
@@ -41,17 +58,20 @@ pub(crate) struct U3VDeviceModule {
     current_status: super::DeviceAccessStatus,
 }
 
-// TODO: Implement methods for stream and event channel.
+// TODO: Implement methods for event channel.
 impl U3VDeviceModule {
     pub(crate) fn new(camera: Camera) -> GenTlResult<Self> {
-        let device_info = camera.ctrl.device_info();
+        let Camera {
+            ctrl, strm, ctxt, ..
+        } = camera;
+        let device_info = ctrl.device_info();
 
         let port_info = PortInfo {
-            id: device_info.guid,
+            id: device_info.guid.clone(),
             vendor: genapi::VENDOR_NAME.into(),
             model: genapi::MODEL_NAME.into(),
             tl_type: genapi::DEVICE_TYPE,
-            module_type: ModuleType::Interface,
+            module_type: ModuleType::Device,
             endianness: Endianness::LE,
             access: PortAccess::RW,
             version: semver::Version::new(
@@ -60,6 +80,7 @@ impl U3VDeviceModule {
                 genapi::XML_SUBMINOR_VERSION,
             ),
             port_name: genapi::PORT_NAME.into(),
+            is_stacked_supported: false,
         };
 
         let xml_info = XmlInfo {
@@ -73,9 +94,9 @@ impl U3VDeviceModule {
                 genapi_common::SCHEME_SUBMINOR_VERSION,
             ),
             file_version: semver::Version::new(
-                genapi_common::SCHEME_MAJOR_VERSION,
-                genapi_common::SCHEME_MINOR_VERSION,
-                genapi_common::SCHEME_SUBMINOR_VERSION,
+                genapi::XML_MAJOR_VERSION,
+                genapi::XML_MINOR_VERSION,
+                genapi::XML_SUBMINOR_VERSION,
             ),
             sha1_hash: None,
             compressed: CompressionType::Uncompressed,
@@ -85,9 +106,12 @@ impl U3VDeviceModule {
             vm: genapi::Memory::new(),
             port_info,
             xml_infos: vec![xml_info],
+            device_info,
 
-            camera,
+            ctrl: ctrl.clone(),
+            ctxt,
             remote_device: None,
+            data_stream: Box::new(Mutex::new(U3VDataStreamModule::new(strm, ctrl))),
 
             current_status: super::DeviceAccessStatus::Unknown,
         };
@@ -97,7 +121,7 @@ impl U3VDeviceModule {
     }
 
     pub(crate) fn device_info(&self) -> &u3v::DeviceInfo {
-        todo!()
+        &self.device_info
     }
 
     /// Reflect current_status to `DeviceAccessStatusReg` in VM.
@@ -146,8 +170,27 @@ impl U3VDeviceModule {
         // TODO: Handle stream related events.
     }
 
+    fn abrm(&self) -> GenTlResult<Abrm> {
+        self.assert_open()?;
+
+        Ok(self.ctrl.abrm()?)
+    }
+
     fn initialize_vm(&mut self) -> GenTlResult<()> {
-        todo!()
+        self.vm
+            .write::<GenApiReg::DeviceID>(self.device_info.guid.clone())?;
+        self.vm
+            .write::<GenApiReg::DeviceVendorName>(self.device_info.vendor_name.clone())?;
+        self.vm
+            .write::<GenApiReg::DeviceModelName>(self.device_info.model_name.clone())?;
+        self.reflect_status();
+
+        let stream_id = self.data_stream.lock().unwrap().stream_id().to_string();
+        self.vm.write::<GenApiReg::StreamSelector>(0)?;
+        self.vm.write::<GenApiReg::StreamSelectorMax>(0)?;
+        self.vm.write::<GenApiReg::StreamID>(stream_id)?;
+
+        Ok(())
     }
 }
 
@@ -194,11 +237,41 @@ impl Port for U3VDeviceModule {
 
 impl Device for U3VDeviceModule {
     fn open(&mut self, access_flag: super::DeviceAccessFlag) -> GenTlResult<()> {
-        todo!()
+        if self.is_opened() {
+            return Err(GenTlError::ResourceInUse);
+        }
+
+        // The remote device port doesn't restrict writes, so read only access isn't supported.
+        if access_flag == super::DeviceAccessFlag::ReadOnly {
+            return Err(GenTlError::NotImplemented);
+        }
+
+        self.ctrl.open()?;
+        let remote_device =
+            match U3VRemoteDevice::new(self.ctrl.clone(), self.device_info.guid.clone()) {
+                Ok(remote_device) => remote_device,
+                Err(e) => {
+                    self.ctrl.close().ok();
+                    return Err(e);
+                }
+            };
+        self.remote_device = Some(Box::new(Mutex::new(remote_device)));
+        self.current_status = DeviceAccessStatus::OpenReadWrite;
+
+        Ok(())
     }
 
     fn close(&mut self) -> GenTlResult<()> {
-        todo!()
+        if !self.is_opened() {
+            return Ok(());
+        }
+
+        self.data_stream.lock().unwrap().close()?;
+        self.remote_device = None;
+        self.ctrl.close()?;
+        self.current_status = DeviceAccessStatus::ReadWrite;
+
+        Ok(())
     }
 
     fn device_id(&self) -> &str {
@@ -211,12 +284,38 @@ impl Device for U3VDeviceModule {
         Ok(self.remote_device.as_ref().unwrap().as_ref())
     }
 
+    fn num_data_streams(&self) -> GenTlResult<usize> {
+        self.assert_open()?;
+
+        Ok(1)
+    }
+
+    fn data_stream_id(&self, index: usize) -> GenTlResult<String> {
+        self.assert_open()?;
+
+        if index == 0 {
+            Ok(self.data_stream.lock().unwrap().stream_id().to_string())
+        } else {
+            Err(GenTlError::InvalidIndex)
+        }
+    }
+
+    fn data_stream(&self, id: &str) -> GenTlResult<&Mutex<dyn DataStream>> {
+        self.assert_open()?;
+
+        if self.data_stream.lock().unwrap().stream_id() == id {
+            Ok(self.data_stream.as_ref())
+        } else {
+            Err(GenTlError::InvalidId(id.into()))
+        }
+    }
+
     fn vendor_name(&self) -> GenTlResult<String> {
-        todo!()
+        Ok(self.device_info.vendor_name.clone())
     }
 
     fn model_name(&self) -> GenTlResult<String> {
-        todo!()
+        Ok(self.device_info.model_name.clone())
     }
 
     fn display_name(&self) -> GenTlResult<String> {
@@ -231,11 +330,13 @@ impl Device for U3VDeviceModule {
     }
 
     fn device_access_status(&self) -> DeviceAccessStatus {
-        todo!()
+        self.current_status
     }
 
     fn user_defined_name(&self) -> GenTlResult<String> {
-        todo!()
+        let abrm = self.abrm()?;
+        abrm.user_defined_name(&mut self.ctrl.clone())?
+            .ok_or(GenTlError::NotAvailable)
     }
 
     fn serial_number(&self) -> GenTlResult<String> {
@@ -243,44 +344,192 @@ impl Device for U3VDeviceModule {
     }
 
     fn device_version(&self) -> GenTlResult<String> {
-        todo!()
+        Ok(self.device_info.device_version.clone())
     }
 
     fn timespamp_frequency(&self) -> GenTlResult<u64> {
-        todo!()
+        let abrm = self.abrm()?;
+        // The increment is the tick length of the device clock in ns.
+        match abrm.timestamp_increment(&mut self.ctrl.clone())? {
+            0 => Err(GenTlError::InvalidValue(
+                "timestamp increment of the device is 0".into(),
+            )),
+            increment => Ok(1_000_000_000 / increment),
+        }
     }
 }
 
-pub(crate) struct U3VRemoteDevice {}
+/// Port of the remote device, which accesses the device memory through `Ctrl`.
+pub(crate) struct U3VRemoteDevice<Ctrl = SharedControlHandle> {
+    ctrl: Mutex<Ctrl>,
+    port_info: PortInfo,
+    xml_infos: Vec<XmlInfo>,
+}
 
-impl U3VRemoteDevice {
-    fn new(handle: u3v::ControlHandle) -> GenTlResult<Self> {
-        todo!()
-    }
+impl<Ctrl: DeviceControl> U3VRemoteDevice<Ctrl> {
+    /// Constructs the remote device port of an opened device whose id is `id`.
+    fn new(mut ctrl: Ctrl, id: String) -> GenTlResult<Self> {
+        let abrm = Abrm::new(&mut ctrl)?;
+        let port_info = Self::port_info(&mut ctrl, &abrm, id)?;
+        let xml_infos = Self::xml_infos(&mut ctrl, &abrm)?;
+        Ok(Self {
+            ctrl: Mutex::new(ctrl),
+            port_info,
+            xml_infos,
+        })
+    }
+
+    fn port_info(ctrl: &mut Ctrl, abrm: &Abrm, id: String) -> GenTlResult<PortInfo> {
+        let sbrm = abrm.sbrm(ctrl)?;
+        Ok(PortInfo {
+            id,
+            vendor: abrm.manufacturer_name(ctrl)?,
+            model: abrm.model_name(ctrl)?,
+            tl_type: TlType::USB3Vision,
+            module_type: ModuleType::RemoteDevice,
+            endianness: Endianness::LE,
+            access: PortAccess::RW,
+            version: sbrm.u3v_version(ctrl)?,
+            port_name: "Device".into(),
+            is_stacked_supported: abrm.device_capability()?.is_stacked_commands_supported(),
+        })
+    }
+
+    /// Device XMLs listed in the manifest table, newest file version first.
+    fn xml_infos(ctrl: &mut Ctrl, abrm: &Abrm) -> GenTlResult<Vec<XmlInfo>> {
+        let mut xml_infos = vec![];
+        for ent in abrm.manifest_table(ctrl)?.entries(ctrl)? {
+            let file_info = ent.file_info(ctrl)?;
+            if file_info.file_type()? != GenICamFileType::DeviceXml {
+                continue;
+            }
+
+            xml_infos.push(XmlInfo {
+                location: XmlLocation::RegisterMap {
+                    address: ent.file_address(ctrl)?,
+                    size: ent.file_size(ctrl)? as usize,
+                },
+                schema_version: file_info.schema_version(),
+                file_version: ent.genicam_file_version(ctrl)?,
+                sha1_hash: ent.sha1_hash(ctrl)?,
+                compressed: file_info.compression_type()?,
+            });
+        }
 
-    fn port_info(handle: &u3v::ControlHandle) -> GenTlResult<PortInfo> {
-        todo!()
-    }
+        if xml_infos.is_empty() {
+            return Err(GenTlError::InvalidValue(
+                "device doesn't have valid `ManifestEntry`".into(),
+            ));
+        }
+        xml_infos.sort_by(|lhs, rhs| rhs.file_version.cmp(&lhs.file_version));
 
-    fn xml_infos(handle: &u3v::ControlHandle) -> GenTlResult<Vec<XmlInfo>> {
-        todo!()
+        Ok(xml_infos)
     }
 }
 
-impl Port for U3VRemoteDevice {
+impl<Ctrl: DeviceControl> Port for U3VRemoteDevice<Ctrl> {
     fn read(&self, address: u64, buf: &mut [u8]) -> GenTlResult<usize> {
-        todo!()
+        self.ctrl.lock().unwrap().read(address, buf)?;
+        Ok(buf.len())
     }
 
     fn write(&mut self, address: u64, data: &[u8]) -> GenTlResult<usize> {
-        todo!()
+        self.ctrl.get_mut().unwrap().write(address, data)?;
+        Ok(data.len())
+    }
+
+    fn read_stacked(
+        &self,
+        entries: &mut [(u64, &mut [u8])],
+        read_count: &mut usize,
+    ) -> GenTlResult<()> {
+        *read_count = 0;
+        self.ctrl.lock().unwrap().read_stacked(entries)?;
+        *read_count = entries.len();
+        Ok(())
+    }
+
+    fn write_stacked(
+        &mut self,
+        entries: &[(u64, &[u8])],
+        written_count: &mut usize,
+    ) -> GenTlResult<()> {
+        *written_count = 0;
+        self.ctrl.get_mut().unwrap().write_stacked(entries)?;
+        *written_count = entries.len();
+        Ok(())
     }
 
     fn port_info(&self) -> GenTlResult<&PortInfo> {
-        todo!()
+        Ok(&self.port_info)
     }
 
     fn xml_infos(&self) -> GenTlResult<&[XmlInfo]> {
-        todo!()
+        Ok(&self.xml_infos)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use cameleon::u3v::emulator::{self, EmulatorConfig};
+
+    use super::*;
+
+    /// Addresses of `ABRM` registers.
+    const MANUFACTURER_NAME: u64 = 0x0004;
+    const MODEL_NAME: u64 = 0x0044;
+    const USER_DEFINED_NAME: u64 = 0x0184;
+
+    #[test]
+    fn test_remote_device_port() {
+        let mut camera = emulator::camera(EmulatorConfig::default());
+        camera.ctrl.open().unwrap();
+        let info = camera.info;
+        let mut remote_device =
+            U3VRemoteDevice::new(camera.ctrl, info.serial_number.clone()).unwrap();
+
+        let port_info = remote_device.port_info().unwrap();
+        assert_eq!(port_info.vendor, info.vendor_name);
+        assert_eq!(port_info.model, info.model_name);
+        assert!(!port_info.is_stacked_supported);
+
+        let xml_info = &remote_device.xml_infos().unwrap()[0];
+        assert!(matches!(xml_info.compressed, CompressionType::Uncompressed));
+        let (address, size) = match xml_info.location {
+            XmlLocation::RegisterMap { address, size } => (address, size),
+            _ => panic!("the device XML must be in the register map"),
+        };
+        let mut xml = vec![0; size];
+        remote_device.read(address, &mut xml).unwrap();
+        assert!(String::from_utf8_lossy(&xml).contains("<RegisterDescription"));
+
+        // Stacked access falls back to a transaction per entry on a device without the support.
+        let mut vendor = [0; 64];
+        let mut model = [0; 64];
+        let mut read_count = 0;
+        remote_device
+            .read_stacked(
+                &mut [(MANUFACTURER_NAME, &mut vendor), (MODEL_NAME, &mut model)],
+                &mut read_count,
+            )
+            .unwrap();
+        assert_eq!(read_count, 2);
+        assert!(vendor.starts_with(info.vendor_name.as_bytes()));
+        assert!(model.starts_with(info.model_name.as_bytes()));
+
+        let mut written_count = 0;
+        remote_device
+            .write_stacked(
+                &[
+                    (USER_DEFINED_NAME, b"Came"),
+                    (USER_DEFINED_NAME + 4, b"leon\0"),
+                ],
+                &mut written_count,
+            )
+            .unwrap();
+        assert_eq!(written_count, 2);
+        let mut name = [0; 10];
+        remote_device.read(USER_DEFINED_NAME, &mut name).unwrap();
+        assert_eq!(&name[..9], b"Cameleon\0");
     }
 }
@@ -51,6 +51,7 @@ impl U3VInterfaceModule {
                 genapi::XML_SUBMINOR_VERSION,
             ),
             port_name: genapi::PORT_NAME.into(),
+            is_stacked_supported: false,
         };
 
         let xml_info = XmlInfo {
@@ -2,6 +2,7 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 
+pub(super) mod data_stream;
 pub(super) mod device;
 pub(super) mod interface;
 pub(super) mod port;
@@ -9,7 +10,7 @@ pub(super) mod system;
 
 mod genapi_common;
 
-use cameleon::ControlError;
+use cameleon::{CameleonError, ControlError, StreamError};
 use cameleon_impl::memory::MemoryError;
 
 use super::GenTlError;
@@ -43,8 +44,32 @@ impl From<ControlError> for GenTlError {
     }
 }
 
+impl From<StreamError> for GenTlError {
+    fn from(err: StreamError) -> Self {
+        use GenTlError::{BufferTooSmall, Error, Io, ResourceInUse, Timeout};
+
+        match err {
+            StreamError::Disconnected | StreamError::Io(..) => Io(err.into()),
+            StreamError::Timeout => Timeout,
+            StreamError::BufferTooSmall => BufferTooSmall,
+            StreamError::InStreaming => ResourceInUse,
+            _ => Error(format!("{}", err)),
+        }
+    }
+}
+
 #[derive(Clone, Copy)]
 pub(crate) enum CharEncoding {
     Ascii,
     UTF8,
 }
+
+impl From<CameleonError> for GenTlError {
+    fn from(err: CameleonError) -> Self {
+        match err {
+            CameleonError::ControlError(err) => err.into(),
+            CameleonError::StreamError(err) => err.into(),
+            _ => Self::Error(format!("{}", err)),
+        }
+    }
+}
@@ -89,6 +89,10 @@ pub(crate) struct PortInfo {
     /// Name of the port as referenced in the XML description.
     /// This name is used to connect this port to the nodemap instance of this module.
     pub(crate) port_name: String,
+
+    /// `true` if [`Port::read_stacked`] and [`Port::write_stacked`] are handled in a single
+    /// transaction instead of one transaction for each entry.
+    pub(crate) is_stacked_supported: bool,
 }
 
 #[derive(Clone, Copy)]
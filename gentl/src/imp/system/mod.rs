@@ -55,6 +55,7 @@ impl SystemModule {
                 genapi::XML_SUBMINOR_VERSION,
             ),
             port_name: genapi::PORT_NAME.into(),
+            is_stacked_supported: false,
         };
 
         let xml_info = XmlInfo {